@@ -55,6 +55,26 @@ static HRESULT s_NewNode
 
 static UINT s_GetTreeSize(_In_opt_ PBSTNODE pnode);
 
+static SIZE_T s_GetNodeBytes(_In_ PCHL_BSTREE pbstree, _In_ PBSTNODE pnode);
+
+static PBSTNODE s_Select(_In_ PBSTNODE pCurNode, _In_ UINT rank);
+
+static UINT s_Rank
+(
+    _In_ PCHL_BSTREE pbstree,
+    _In_ PBSTNODE pCurNode,
+    _In_ PCHL_INPUT_KV pInputKey
+);
+
+static PBSTNODE s_DetachAtRank
+(
+    _In_ PBSTNODE pCurNode,
+    _In_ UINT rank,
+    _Out_ PBSTNODE *ppDetached
+);
+
+static void s_EvictToBudget(_In_ PCHL_BSTREE pbstree, _In_opt_ PBSTNODE pNodeToKeep);
+
 // --------------------------------------------------------
 // Public function definitions
 
@@ -89,12 +109,43 @@ HRESULT CHL_DsCreateBST
     pbst->Destroy = CHL_DsDestroyBST;
     pbst->Insert = CHL_DsInsertBST;
     pbst->Find = CHL_DsFindBST;
+    pbst->FindAll = CHL_DsFindAllBST;
+    pbst->RemoveVal = CHL_DsRemoveValBST;
     pbst->FindMax = CHL_DsFindMaxBST;
     pbst->FindMin = CHL_DsFindMinBST;
     pbst->FindFloor = CHL_DsFindFloorBST;
     pbst->FindCeil = CHL_DsFindCeilBST;
     pbst->InitIterator = CHL_DsInitIteratorBST;
     pbst->GetNext = CHL_DsGetNextBST;
+    pbst->SetBudget = CHL_DsSetBudgetBST;
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsCreateExBST
+(
+    _Out_ PCHL_BSTREE pbst,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_ CHL_CompareFn pfnKeyCompare,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ DWORD dwFlags
+)
+{
+    HRESULT hr = S_OK;
+
+    if ((dwFlags & ~CHL_BST_FLAG_MULTIMAP) != 0)
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    hr = CHL_DsCreateBST(pbst, keyType, valType, pfnKeyCompare, fValInHeapMem);
+    if (SUCCEEDED(hr))
+    {
+        pbst->fMultimap = (dwFlags & CHL_BST_FLAG_MULTIMAP) ? TRUE : FALSE;
+    }
 
 fend:
     return hr;
@@ -127,6 +178,7 @@ HRESULT CHL_DsInsertBST
     HRESULT hr = S_OK;
     CHL_KEYTYPE keyType;
     CHL_INPUT_KV inputKV;
+    PBSTNODE pExistingNode = NULL;
 
     keyType = pbst->keyType;
     if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, keyType, &iKeySize)))
@@ -147,7 +199,25 @@ HRESULT CHL_DsInsertBST
     inputKV.iKeySize = iKeySize;
     inputKV.pvVal = pvVal;
     inputKV.iValSize = iValSize;
+
+    if (pbst->budget.cbMax > 0)
+    {
+        pExistingNode = s_Find(pbst, pbst->pRoot, &inputKV);
+        hr = _CheckBudget(
+            &pbst->budget,
+            _GetEntryBytes(keyType, iKeySize, pbst->valType, iValSize, sizeof(BSTNODE)),
+            (pExistingNode != NULL) ? s_GetNodeBytes(pbst, pExistingNode) : 0);
+        if (FAILED(hr))
+        {
+            goto fend;
+        }
+    }
+
     hr = s_Insert(&pbst->pRoot, pbst, pbst->pRoot, &inputKV);
+    if (SUCCEEDED(hr) && _IsOverBudget(&pbst->budget))
+    {
+        s_EvictToBudget(pbst, (pExistingNode != NULL) ? pExistingNode : s_Find(pbst, pbst->pRoot, &inputKV));
+    }
 
 fend:
     return hr;
@@ -188,7 +258,113 @@ HRESULT CHL_DsFindBST
 
     if (pvVal)
     {
-        hr = _CopyValOut(&pFoundNode->chlVal, pbst->valType, pvVal, pValsize, fGetPointerOnly);
+        // The first value of a key of a multimap
+        hr = _CopyValOut(_GetMultiVals(&pFoundNode->chlVal, NULL), pbst->valType, pvVal, pValsize, fGetPointerOnly);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsFindAllBST
+(
+    _In_ PCHL_BSTREE pbst,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ PCHL_VAL *ppChlVals,
+    _Out_ PINT pnVals
+)
+{
+    HRESULT hr = S_OK;
+    PBSTNODE pFoundNode = NULL;
+
+    CHL_INPUT_KV kvInput;
+
+    if ((ppChlVals == NULL) || (pnVals == NULL))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    *ppChlVals = NULL;
+    *pnVals = 0;
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pbst->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    kvInput.pvKey = pvkey;
+    kvInput.iKeySize = iKeySize;
+
+    pFoundNode = s_Find(pbst, pbst->pRoot, &kvInput);
+    if (!pFoundNode)
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    *ppChlVals = _GetMultiVals(&pFoundNode->chlVal, pnVals);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsRemoveValBST
+(
+    _In_ PCHL_BSTREE pbst,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize
+)
+{
+    HRESULT hr = S_OK;
+    PBSTNODE pFoundNode = NULL;
+    int iVal;
+
+    CHL_INPUT_KV kvInput;
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pbst->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, pbst->valType, &iValSize)))
+    {
+        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    kvInput.pvKey = pvkey;
+    kvInput.iKeySize = iKeySize;
+
+    pFoundNode = s_Find(pbst, pbst->pRoot, &kvInput);
+    if ((pFoundNode == NULL) || ((iVal = _FindMultiVal(&pFoundNode->chlVal, pbst->valType, pvVal, iValSize)) < 0))
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    pbst->budget.cbUsed -= s_GetNodeBytes(pbst, pFoundNode);
+    if (_IsMultiVal(&pFoundNode->chlVal))
+    {
+        _RemoveMultiVal(&pFoundNode->chlVal, iVal, pbst->valType, pbst->fValIsInHeap);
+        pbst->budget.cbUsed += s_GetNodeBytes(pbst, pFoundNode);
+    }
+    else
+    {
+        // The only value of the key, so the node goes
+        pbst->pRoot = s_DetachAtRank(pbst->pRoot, s_Rank(pbst, pbst->pRoot, &kvInput), &pFoundNode);
+
+        _DeleteVal(&pFoundNode->chlVal, pbst->valType, pbst->fValIsInHeap);
+        _DeleteKey(&pFoundNode->chlKey, pbst->keyType);
+        CHL_MmFree(&pFoundNode);
     }
 
 fend:
@@ -409,6 +585,41 @@ HRESULT CHL_DsGetNextBST
     return E_NOTIMPL;
 }
 
+HRESULT CHL_DsSetBudgetBST
+(
+    _In_ PCHL_BSTREE pbst,
+    _In_ SIZE_T cbMaxBytes,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext
+)
+{
+    HRESULT hr;
+
+    if ((cbMaxBytes > 0) && (policy == CHL_BP_EVICT_OLDEST))
+    {
+        logerr("%s(): The tree does not keep insertion order", __FUNCTION__);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto fend;
+    }
+
+    if ((cbMaxBytes > 0) && pbst->fMultimap)
+    {
+        logerr("%s(): Not supported on a multimap", __FUNCTION__);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto fend;
+    }
+
+    hr = _SetBudget(&pbst->budget, cbMaxBytes, policy, pfnEvict, pvEvictContext);
+    if (SUCCEEDED(hr))
+    {
+        s_EvictToBudget(pbst, NULL);
+    }
+
+fend:
+    return hr;
+}
+
 // --------------------------------------------------------
 // Private function definitions
 
@@ -457,6 +668,10 @@ HRESULT s_Insert(_Out_ PBSTNODE *ppNewNode, _In_ PCHL_BSTREE pbstree, _In_ PBSTN
     if (pCurNode == NULL)
     {
         hr = s_NewNode(&pNewNode, pInputKeyValue);
+        if (SUCCEEDED(hr))
+        {
+            pbstree->budget.cbUsed += s_GetNodeBytes(pbstree, pNewNode);
+        }
         goto fend;
     }
 
@@ -474,6 +689,12 @@ HRESULT s_Insert(_Out_ PBSTNODE *ppNewNode, _In_ PCHL_BSTREE pbstree, _In_ PBSTN
     {
         hr = s_Insert(&pCurNode->pRight, pbstree, pCurNode->pRight, pInputKeyValue);
     }
+    else if (pbstree->fMultimap)
+    {
+        pbstree->budget.cbUsed -= s_GetNodeBytes(pbstree, pCurNode);
+        hr = _AppendMultiVal(&pCurNode->chlVal, pbstree->valType, pInputKeyValue->pvVal, pInputKeyValue->iValSize);
+        pbstree->budget.cbUsed += s_GetNodeBytes(pbstree, pCurNode);
+    }
     else
     {
         CHL_VAL val;
@@ -481,8 +702,10 @@ HRESULT s_Insert(_Out_ PBSTNODE *ppNewNode, _In_ PCHL_BSTREE pbstree, _In_ PBSTN
         if (SUCCEEDED(hr))
         {
             // Successfully constructed CHL_VAL, now replace the cur node's value with new one
+            pbstree->budget.cbUsed -= s_GetNodeBytes(pbstree, pCurNode);
             _DeleteVal(&pCurNode->chlVal, pbstree->valType, pbstree->fValIsInHeap);
             CopyMemory(&pCurNode->chlVal, &val, sizeof(val));
+            pbstree->budget.cbUsed += s_GetNodeBytes(pbstree, pCurNode);
         }
     }
 
@@ -638,3 +861,160 @@ UINT s_GetTreeSize(_In_opt_ PBSTNODE pnode)
 {
     return ((pnode != NULL) ? pnode->treeSize : 0);
 }
+
+// Bytes charged for a node: the node and the heap copies of the key and value, or values of a multimap
+SIZE_T s_GetNodeBytes(_In_ PCHL_BSTREE pbstree, _In_ PBSTNODE pnode)
+{
+    return _GetEntryBytes(
+        pbstree->keyType,
+        pnode->chlKey.iKeySize,
+        pbstree->valType,
+        pnode->chlVal.iValSize,
+        sizeof(BSTNODE)) + _GetMultiValBytes(&pnode->chlVal, pbstree->valType);
+}
+
+// Returns the node with the specified rank, the number of keys less than its key
+PBSTNODE s_Select(_In_ PBSTNODE pCurNode, _In_ UINT rank)
+{
+    UINT nLeft;
+
+    while (pCurNode != NULL)
+    {
+        nLeft = s_GetTreeSize(pCurNode->pLeft);
+        if (rank < nLeft)
+        {
+            pCurNode = pCurNode->pLeft;
+        }
+        else if (rank > nLeft)
+        {
+            rank -= nLeft + 1;
+            pCurNode = pCurNode->pRight;
+        }
+        else
+        {
+            break;
+        }
+    }
+    return pCurNode;
+}
+
+// Returns the rank of the node with the specified key, which must be in the subtree
+UINT s_Rank
+(
+    _In_ PCHL_BSTREE pbstree,
+    _In_ PBSTNODE pCurNode,
+    _In_ PCHL_INPUT_KV pInputKey
+)
+{
+    PVOID pvExistingKey;
+    HRESULT hrTemp = S_OK;
+    UINT rank = 0;
+    int cmp;
+
+    while (pCurNode != NULL)
+    {
+        hrTemp = _CopyKeyOut(&pCurNode->chlKey, pbstree->keyType, &pvExistingKey, NULL, TRUE /*fGetPointerOnly*/);
+        ASSERT(SUCCEEDED(hrTemp));
+
+        cmp = pbstree->fnKeyCompare(pInputKey->pvKey, pvExistingKey);
+        if (cmp < 0)
+        {
+            pCurNode = pCurNode->pLeft;
+        }
+        else if (cmp > 0)
+        {
+            rank += s_GetTreeSize(pCurNode->pLeft) + 1;
+            pCurNode = pCurNode->pRight;
+        }
+        else
+        {
+            return rank + s_GetTreeSize(pCurNode->pLeft);
+        }
+    }
+
+    ASSERT(FALSE);
+    return rank;
+}
+
+// Unlinks the node with the specified rank from the subtree and returns the new root of the subtree.
+// A node with two children is replaced by the minimum of its right subtree (Hibbard deletion).
+PBSTNODE s_DetachAtRank
+(
+    _In_ PBSTNODE pCurNode,
+    _In_ UINT rank,
+    _Out_ PBSTNODE *ppDetached
+)
+{
+    PBSTNODE pSuccessor;
+    UINT nLeft;
+
+    ASSERT(pCurNode);
+    ASSERT(rank < pCurNode->treeSize);
+
+    nLeft = s_GetTreeSize(pCurNode->pLeft);
+    if (rank < nLeft)
+    {
+        pCurNode->pLeft = s_DetachAtRank(pCurNode->pLeft, rank, ppDetached);
+    }
+    else if (rank > nLeft)
+    {
+        pCurNode->pRight = s_DetachAtRank(pCurNode->pRight, rank - nLeft - 1, ppDetached);
+    }
+    else
+    {
+        *ppDetached = pCurNode;
+        if (pCurNode->pLeft == NULL)
+        {
+            return pCurNode->pRight;
+        }
+
+        if (pCurNode->pRight == NULL)
+        {
+            return pCurNode->pLeft;
+        }
+
+        pSuccessor = NULL;
+        pCurNode->pRight = s_DetachAtRank(pCurNode->pRight, 0, &pSuccessor);
+        pSuccessor->pLeft = pCurNode->pLeft;
+        pSuccessor->pRight = pCurNode->pRight;
+        pCurNode = pSuccessor;
+    }
+
+    pCurNode->treeSize = s_GetTreeSize(pCurNode->pLeft) + s_GetTreeSize(pCurNode->pRight) + 1;
+    return pCurNode;
+}
+
+// Evicts random entries while over budget, but never pNodeToKeep which holds the key just inserted, if any
+void s_EvictToBudget(_In_ PCHL_BSTREE pbstree, _In_opt_ PBSTNODE pNodeToKeep)
+{
+    PBSTNODE pVictim;
+    UINT nNodes;
+    UINT rank;
+
+    // Only a lowered budget can leave a failing tree over it, which is not an error
+    while (_IsOverBudget(&pbstree->budget) && (pbstree->budget.policy == CHL_BP_EVICT_RANDOM))
+    {
+        nNodes = s_GetTreeSize(pbstree->pRoot);
+        if (nNodes <= ((pNodeToKeep != NULL) ? 1U : 0U))
+        {
+            break;
+        }
+
+        rank = _NextBudgetRandom(&pbstree->budget, nNodes);
+        pVictim = s_Select(pbstree->pRoot, rank);
+        if (pVictim == pNodeToKeep)
+        {
+            rank = (rank + 1) % nNodes;
+            pVictim = s_Select(pbstree->pRoot, rank);
+        }
+
+        _NotifyEvict(&pbstree->budget, &pVictim->chlKey, pbstree->keyType, &pVictim->chlVal, pbstree->valType);
+
+        pbstree->pRoot = s_DetachAtRank(pbstree->pRoot, rank, &pVictim);
+        pbstree->budget.cbUsed -= s_GetNodeBytes(pbstree, pVictim);
+
+        _DeleteVal(&pVictim->chlVal, pbstree->valType, pbstree->fValIsInHeap);
+        _DeleteKey(&pVictim->chlKey, pbstree->keyType);
+        CHL_MmFree(&pVictim);
+    }
+}
@@ -4,6 +4,8 @@
 // Shishir Bhat (http://www.shishirbhat.com)
 // History
 //      2016/01/28 Initial version. Create, destroy, insert and traverse.
+//      10/17/26 Byte accounting and an optional byte budget
+//      10/17/26 Multimap mode with several values per key
 //
 
 #ifndef _CHL_BINARY_SEARCHTREE_H
@@ -16,6 +18,9 @@ extern "C" {
 #include "Defines.h"
 #include "MemFunctions.h"
 
+// Flags for CHL_DsCreateExBST
+#define CHL_BST_FLAG_MULTIMAP   0x00000001  // Inserting an existing key adds a value instead of replacing it
+
 typedef enum _bstIerationType {
     BstIterationType_PreOrder,
     BstIterationType_InOrder,
@@ -42,9 +47,11 @@ struct _bstTree {
     CHL_KEYTYPE keyType;
     CHL_VALTYPE valType;
     BOOL        fValIsInHeap;
+    BOOL        fMultimap;  // Created with CHL_BST_FLAG_MULTIMAP
     PBSTNODE    pRoot;
 
     CHL_CompareFn fnKeyCompare;
+    CHL_BUDGET  budget;     // Bytes charged for all nodes and the budget, see CHL_DsSetBudgetBST
 
     // Pointers to binary search tree methods
 
@@ -78,6 +85,24 @@ struct _bstTree {
             _In_opt_ BOOL fGetPointerOnly
             );
 
+    HRESULT(*FindAll)
+        (
+            _In_ PCHL_BSTREE pbst,
+            _In_ PCVOID pvkey,
+            _In_ int iKeySize,
+            _Out_ PCHL_VAL *ppChlVals,
+            _Out_ PINT pnVals
+            );
+
+    HRESULT(*RemoveVal)
+        (
+            _In_ PCHL_BSTREE pbst,
+            _In_ PCVOID pvkey,
+            _In_ int iKeySize,
+            _In_ PCVOID pvVal,
+            _In_ int iValSize
+            );
+
     HRESULT(*FindMax)
         (
             _In_ PCHL_BSTREE pbst,
@@ -131,6 +156,15 @@ struct _bstTree {
             _In_opt_ BOOL fGetPointerOnly
             );
 
+    HRESULT(*SetBudget)
+        (
+            _In_ PCHL_BSTREE pbst,
+            _In_ SIZE_T cbMaxBytes,
+            _In_ CHL_BUDGET_POLICY policy,
+            _In_opt_ CHL_EVICT_FN pfnEvict,
+            _In_opt_ PVOID pvEvictContext
+            );
+
 };
 
 // Iterator used to traverse the tree
@@ -175,6 +209,26 @@ DllExpImp HRESULT CHL_DsCreateBST
     _In_opt_ BOOL fValInHeapMem
 );
 
+// Same as CHL_DsCreateBST, with flags that select a variant of the tree.
+// With CHL_BST_FLAG_MULTIMAP, a key may have several values. Inserting a key that is already
+// in the tree adds the value after the existing ones, even if it is one of them. The only value
+// of a key is stored in its node, more values are stored together in one array, so they are all
+// found with one search, see CHL_DsFindAllBST. CHL_DsFindBST sees the first value of each key and
+// CHL_DsRemoveValBST removes one value. Budgets are not supported on a multimap.
+// Params:
+//      pbst, keyType, valType, pfnKeyCompare, fValInHeapMem: Same as for CHL_DsCreateBST.
+//      dwFlags         : Zero or CHL_BST_FLAG_MULTIMAP.
+//
+DllExpImp HRESULT CHL_DsCreateExBST
+(
+    _Out_ PCHL_BSTREE pbst,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_ CHL_CompareFn pfnKeyCompare,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ DWORD dwFlags
+);
+
 // Destroy the tree by removing all key-value pairs from the tree.
 // The CHL_BSTREE object itself is also destroyed.
 // Params:
@@ -222,6 +276,47 @@ DllExpImp HRESULT CHL_DsFindBST
     _In_opt_ BOOL fGetPointerOnly
 );
 
+// Find all values of the specified key in the binary search tree with one search. For a tree created
+// with CHL_BST_FLAG_MULTIMAP, these are in the order they were inserted in, other trees have one
+// value per key. The values are returned as an array of stored values that is valid until the
+// next call that modifies the tree. Read them with the CHL_VAL members for the value type,
+// e.g. paVals[i].valDef.iVal, and iValSize.
+// Params:
+//      pbst            : Pointer to the binary search tree object returned by CHL_DsCreateBST function.
+//      pvkey           : Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize        : Size of the key in bytes. For null-terminated strings, zero may be passed.
+//      ppChlVals       : Receives a pointer to the first of the values, NULL if the key is not found.
+//      pnVals          : Receives the number of values, 0 if the key is not found.
+//
+DllExpImp HRESULT CHL_DsFindAllBST
+(
+    _In_ PCHL_BSTREE pbst,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ PCHL_VAL *ppChlVals,
+    _Out_ PINT pnVals
+);
+
+// Deletes one key,value pair from the tree: the first value of the key that is equal to the
+// specified value, compared as CHL_DsInsertBST compares values. The other values of the key
+// keep their order. If it was the only value of the key, the key is deleted. Returns E_NOT_SET
+// if the key does not have the value.
+// Params:
+//      pbst            : Pointer to the binary search tree object returned by CHL_DsCreateBST function.
+//      pvkey           : Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize        : Size of the key in bytes. For null-terminated strings, zero may be passed.
+//      pvVal           : The value to delete, as it would be passed to CHL_DsInsertBST().
+//      iValSize        : Size of the value in bytes. For null-terminated strings, zero may be passed.
+//
+DllExpImp HRESULT CHL_DsRemoveValBST
+(
+    _In_ PCHL_BSTREE pbst,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize
+);
+
 // Get the maximum key in the binary search tree
 // Params:
 //      pbst            : Pointer to the binary search tree object returned by CHL_DsCreateBST function.
@@ -337,6 +432,31 @@ DllExpImp HRESULT CHL_DsGetNextBST
     _In_opt_ BOOL fGetPointerOnly
 );
 
+// Sets a byte budget for the tree. The tree always keeps budget.cbUsed up to date, the bytes
+// charged for its nodes and for heap copies of string keys and of string and user object values.
+// With a budget, an insert that would take the tree over it fails with
+// HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA) under CHL_BP_FAIL, or succeeds and evicts other entries
+// picked at random until the tree is within budget again under CHL_BP_EVICT_RANDOM. The tree does
+// not keep insertion order, CHL_BP_EVICT_OLDEST is not supported. An entry that alone is charged
+// more than the budget is never inserted, E_INVALIDARG is returned. Lowering the budget of a tree
+// evicts right away. Budgets are not supported on trees created with CHL_BST_FLAG_MULTIMAP,
+// HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) is returned.
+// Params:
+//      pbst            : Pointer to the binary search tree object returned by CHL_DsCreateBST function.
+//      cbMaxBytes      : The budget in bytes, 0 to remove the budget.
+//      policy          : What to do when an insert goes over the budget.
+//      pfnEvict        : Optional. Called for each entry that is evicted.
+//      pvEvictContext  : Optional. Passed to pfnEvict.
+//
+DllExpImp HRESULT CHL_DsSetBudgetBST
+(
+    _In_ PCHL_BSTREE pbst,
+    _In_ SIZE_T cbMaxBytes,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext
+);
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,9 +4,11 @@
 // Shishir Bhat (http://www.shishirbhat.com)
 // History
 //      06/23/13 Initial version
+//      10/17/26 Release the epoch reader state of threads on unload
 //
 
 #include "CommonInclude.h"
+#include "EpochFunctions.h"
 
 BOOL WINAPI DllMain(HINSTANCE hiDLL, DWORD dwReason,
     LPVOID pvReserved)
@@ -30,6 +32,7 @@ BOOL WINAPI DllMain(HINSTANCE hiDLL, DWORD dwReason,
 
     case DLL_PROCESS_DETACH:
         // Cleanup code here 
+        _EpochProcessDetach();
         break;
     }
 
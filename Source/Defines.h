@@ -6,6 +6,7 @@
 //      09/09/2014 Refactor to store defs in individual headers.
 //      08/04/2015 Make individual headers usable by clients.
 //      01/19/2016 Provide a way to test if a CHL_VAL is occupied or not.
+//      10/17/26 Byte budgets for containers.
 //
 
 #ifndef CHL_DEFINES_H
@@ -34,6 +35,12 @@ typedef PVOID const PCVOID;
 // -1 if right is lesser than left
 typedef int (*CHL_CompareFn)(_In_ PCVOID pvLeft, _In_ PCVOID pvRight);
 
+// Called for every entry that a container evicts to stay within its byte budget, before the
+// container frees its copy of the key and value. The key and value are passed as the container's
+// Find function would pass them with fGetPointerOnly: integers cast to pointers, otherwise pointers
+// to the stored copies. Containers without keys pass NULL and 0 for the key.
+typedef void (*CHL_EVICT_FN)(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext);
+
 // -------------------------------------------
 // Structures
 
@@ -134,6 +141,43 @@ typedef enum
     CHL_VT_END
 }CHL_VALTYPE;
 
+// What a container does when an insert would take it over its byte budget
+typedef enum
+{
+    // Invalid policy
+    CHL_BP_START,
+
+    // The insert fails with HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA)
+    CHL_BP_FAIL,
+
+    // Entries are evicted in the order they were inserted. Only containers that keep insertion
+    // order support it: CHL_LINKEDLIST and a CHL_HTABLE created with CHL_HT_FLAG_COMPACT.
+    // Setting it on any other hashtable, or on a CHL_BSTREE, fails with
+    // HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED); use CHL_BP_EVICT_RANDOM there.
+    CHL_BP_EVICT_OLDEST,
+
+    // Entries picked at random are evicted
+    CHL_BP_EVICT_RANDOM,
+
+    // Invalid policy
+    CHL_BP_END
+}CHL_BUDGET_POLICY;
+
+// Byte accounting of a container. Every entry is charged for its node plus the heap copies
+// of a string key and of a string or user object value, as CHL_LRU charges its entries.
+// Bucket arrays and other per-container memory are not charged.
+typedef struct CHL_BUDGET
+{
+    SIZE_T cbUsed;              // Bytes charged for all entries, always up to date
+    SIZE_T cbMax;               // Byte budget, 0 for no budget
+    CHL_BUDGET_POLICY policy;   // What to do when an insert goes over cbMax
+    CHL_EVICT_FN pfnEvict;      // Optional eviction callback
+    PVOID pvEvictContext;       // Passed to pfnEvict
+    ULONGLONG ullEvictions;     // Number of entries evicted so far
+    ULONGLONG ullRandom;        // State of the generator that picks random victims
+
+}CHL_BUDGET, *PCHL_BUDGET;
+
 DllExpImp int CHL_CompareFnInt32(PCVOID pvLeft, PCVOID pvRight);
 DllExpImp CHL_CompareFn CHL_FindCompareFn(CHL_VALTYPE vt);
 
@@ -0,0 +1,197 @@
+
+// EpochFunctions.c
+// Epoch based reclamation of memory that lock-free readers may still be using
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#include "EpochFunctions.h"
+
+#define EPOCH_CACHE_LINE_SIZE   64
+
+// Each reader is on its own cache line, so that a read section on one
+// thread does not invalidate the cache line of another thread's reader.
+struct _epochReader {
+    union {
+        struct {
+            volatile ULONG uEpoch;      // Epoch the outermost read section started in, CHL_EPOCH_IDLE outside
+            int nDepth;                 // Nesting of read sections, only used by the owning thread
+            volatile LONG fInUse;       // Whether a live thread owns this reader
+            struct _epochReader *pNext; // Next registered reader
+        };
+        BYTE abCacheLine[EPOCH_CACHE_LINE_SIZE];
+    };
+};
+
+static volatile ULONG s_uGlobalEpoch = 1;
+static EPOCH_READER * volatile s_pReaders = NULL;
+static DWORD s_dwFlsIndex = FLS_OUT_OF_INDEXES;
+static INIT_ONCE s_initOnce = INIT_ONCE_STATIC_INIT;
+
+// File-local Functions
+static BOOL CALLBACK _InitFlsIndex(_Inout_ PINIT_ONCE pInitOnce, _Inout_opt_ PVOID pvParam, _Out_opt_ PVOID *ppvContext);
+static void WINAPI _OnThreadExit(_In_ PVOID pvReader);
+static EPOCH_READER* _RegisterThread(void);
+
+BOOL CALLBACK _InitFlsIndex(_Inout_ PINIT_ONCE pInitOnce, _Inout_opt_ PVOID pvParam, _Out_opt_ PVOID *ppvContext)
+{
+    UNREFERENCED_PARAMETER(pInitOnce);
+    UNREFERENCED_PARAMETER(pvParam);
+    UNREFERENCED_PARAMETER(ppvContext);
+
+    // The callback releases the reader of a thread when it exits
+    s_dwFlsIndex = FlsAlloc(_OnThreadExit);
+    if (s_dwFlsIndex == FLS_OUT_OF_INDEXES)
+    {
+        logerr("%s(): FlsAlloc() failed %u", __FUNCTION__, GetLastError());
+    }
+    return TRUE;
+}
+
+void WINAPI _OnThreadExit(_In_ PVOID pvReader)
+{
+    EPOCH_READER *pReader = (EPOCH_READER*)pvReader;
+
+    pReader->nDepth = 0;
+    pReader->uEpoch = CHL_EPOCH_IDLE;
+    InterlockedExchange(&pReader->fInUse, FALSE);
+}
+
+// Reuses the reader of a thread that has exited, or adds a new one
+EPOCH_READER* _RegisterThread(void)
+{
+    EPOCH_READER *pReader;
+    EPOCH_READER *pHead;
+
+    for (pReader = s_pReaders; pReader != NULL; pReader = pReader->pNext)
+    {
+        if (!pReader->fInUse && (InterlockedCompareExchange(&pReader->fInUse, TRUE, FALSE) == FALSE))
+        {
+            break;
+        }
+    }
+
+    if (pReader == NULL)
+    {
+        pReader = (EPOCH_READER*)_aligned_malloc(sizeof(EPOCH_READER), EPOCH_CACHE_LINE_SIZE);
+        if (pReader == NULL)
+        {
+            logerr("%s(): _aligned_malloc() ", __FUNCTION__);
+            return NULL;
+        }
+
+        ZeroMemory(pReader, sizeof(EPOCH_READER));
+        pReader->uEpoch = CHL_EPOCH_IDLE;
+        pReader->fInUse = TRUE;
+
+        // Readers are only ever added, so pushing onto the head needs no lock
+        do
+        {
+            pHead = s_pReaders;
+            pReader->pNext = pHead;
+        } while (InterlockedCompareExchangePointer((PVOID volatile*)&s_pReaders, pReader, pHead) != pHead);
+    }
+
+    if (!FlsSetValue(s_dwFlsIndex, pReader))
+    {
+        logerr("%s(): FlsSetValue() failed %u", __FUNCTION__, GetLastError());
+        InterlockedExchange(&pReader->fInUse, FALSE);
+        return NULL;
+    }
+    return pReader;
+}
+
+EPOCH_READER* _EpochGetThreadReader(void)
+{
+    if (!InitOnceExecuteOnce(&s_initOnce, _InitFlsIndex, NULL, NULL) || (s_dwFlsIndex == FLS_OUT_OF_INDEXES))
+    {
+        return NULL;
+    }
+    return (EPOCH_READER*)FlsGetValue(s_dwFlsIndex);
+}
+
+EPOCH_READER* _EpochEnterRead(void)
+{
+    EPOCH_READER *pReader = _EpochGetThreadReader();
+
+    if ((pReader == NULL) && (s_dwFlsIndex != FLS_OUT_OF_INDEXES))
+    {
+        pReader = _RegisterThread();
+    }
+
+    if ((pReader != NULL) && (pReader->nDepth++ == 0))
+    {
+        // No fence is needed between publishing the epoch and reading shared memory.
+        // _EpochTryAdvance flushes the write buffers of all processors before it looks
+        // at the readers, only the compiler must not move the reads above this.
+        pReader->uEpoch = s_uGlobalEpoch;
+        _ReadWriteBarrier();
+    }
+    return pReader;
+}
+
+void _EpochExitRead(_In_ EPOCH_READER *pReader)
+{
+    ASSERT(pReader && (pReader->nDepth > 0));
+
+    if (--pReader->nDepth == 0)
+    {
+        // Stores are not reordered with earlier loads on x86/x64
+        _ReadWriteBarrier();
+        pReader->uEpoch = CHL_EPOCH_IDLE;
+    }
+}
+
+ULONG _EpochGetCurrent(void)
+{
+    return s_uGlobalEpoch;
+}
+
+ULONG _EpochTryAdvance(void)
+{
+    ULONG uEpoch;
+    ULONG uReaderEpoch;
+    EPOCH_READER *pReader;
+
+    uEpoch = s_uGlobalEpoch;
+
+    // Makes the epoch stores of readers that have started a read section visible
+    FlushProcessWriteBuffers();
+
+    for (pReader = s_pReaders; pReader != NULL; pReader = pReader->pNext)
+    {
+        uReaderEpoch = pReader->uEpoch;
+        if ((uReaderEpoch != CHL_EPOCH_IDLE) && (uReaderEpoch != uEpoch))
+        {
+            // Still in a read section that started in an earlier epoch
+            return uEpoch;
+        }
+    }
+
+    InterlockedCompareExchange((volatile LONG*)&s_uGlobalEpoch, (LONG)(uEpoch + 2), (LONG)uEpoch);
+    return s_uGlobalEpoch;
+}
+
+void _EpochProcessDetach(void)
+{
+    EPOCH_READER *pReader;
+    EPOCH_READER *pNext;
+
+    if (s_dwFlsIndex != FLS_OUT_OF_INDEXES)
+    {
+        // Calls the callback for threads that are still alive, it must not
+        // be called after the DLL is unloaded.
+        FlsFree(s_dwFlsIndex);
+        s_dwFlsIndex = FLS_OUT_OF_INDEXES;
+    }
+
+    pReader = s_pReaders;
+    s_pReaders = NULL;
+    while (pReader != NULL)
+    {
+        pNext = pReader->pNext;
+        _aligned_free(pReader);
+        pReader = pNext;
+    }
+}
@@ -0,0 +1,58 @@
+
+// EpochFunctions.h
+// Epoch based reclamation of memory that lock-free readers may still be using
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#ifndef _CHL_EPOCHFUNCTIONS_H
+#define _CHL_EPOCHFUNCTIONS_H
+
+#include "InternalDefines.h"
+
+// A reader outside of any read section shows this epoch. Epochs themselves are
+// odd numbers and advance by 2, so they never collide with it.
+#define CHL_EPOCH_IDLE      0
+
+// Per-thread reader state. Threads register one the first time they start a
+// read section and it is reused by another thread after the thread exits.
+typedef struct _epochReader EPOCH_READER;
+
+// -------------------------------------------
+// Functions internal only
+
+// Starts a read section on the calling thread. Memory that is retired after the
+// read section starts is not freed until it ends. Read sections may be nested.
+// Does not write to any memory shared with other threads (after the thread's
+// first read section), so readers do not contend with each other.
+// Returns NULL if the thread's reader state could not be allocated.
+EPOCH_READER* _EpochEnterRead(void);
+
+// Ends a read section started by _EpochEnterRead on the calling thread
+void _EpochExitRead(_In_ EPOCH_READER *pReader);
+
+// Returns the calling thread's reader state, NULL if it has none
+EPOCH_READER* _EpochGetThreadReader(void);
+
+// Returns the epoch to tag memory with after it was made unreachable
+ULONG _EpochGetCurrent(void);
+
+// Advances the global epoch if every reader that is in a read section has started
+// it in the current epoch. Returns the epoch after the attempt.
+// This is expensive, it flushes the write buffers of every processor.
+ULONG _EpochTryAdvance(void);
+
+// Whether memory tagged with uRetiredEpoch can be freed when the epoch is uCurrentEpoch.
+// The epoch must have advanced twice: once for the readers that had already started
+// when the memory was retired, and once more since some of those may have started
+// in the epoch before that.
+static __inline BOOL _EpochIsSafe(_In_ ULONG uRetiredEpoch, _In_ ULONG uCurrentEpoch)
+{
+    return (uCurrentEpoch - uRetiredEpoch) >= 4;
+}
+
+// Frees the reader state of all threads, called when the DLL is unloaded
+void _EpochProcessDetach(void);
+
+#endif // _CHL_EPOCHFUNCTIONS_H
@@ -0,0 +1,689 @@
+
+// FlatHashtable.c
+// Open-addressing hashtable with SIMD probed control bytes (Swiss-table style)
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#include "InternalDefines.h"
+#include "HashFunctions.h"
+#include "FlatHashtable.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define FHT_USE_SSE2
+#endif
+
+// Control byte values. A full slot stores the low 7 bits of its key's hash, so
+// the high bit is set only for empty and deleted slots.
+#define FHT_CTRL_EMPTY      ((CHAR)0x80)
+#define FHT_CTRL_DELETED    ((CHAR)0xFE)
+
+#define FHT_IS_FULL(c)      (((signed char)(c)) >= 0)
+
+// H1 (probe start) and H2 (fingerprint) are both taken from the hash of _HashKeyBytes64,
+// whose low bits are as well mixed as its high bits
+#define FHT_H1(hash)        ((hash) >> 7)
+#define FHT_H2(hash)        ((CHAR)((hash) & 0x7F))
+
+// Table is rehashed when #full + #deleted slots would exceed 7/8th of the capacity
+#define FHT_MAX_LOAD_NUMERATOR      7
+#define FHT_MAX_LOAD_DENOMINATOR    8
+
+#define FHT_MIN_CAPACITY    CHL_FHT_GROUP_WIDTH
+
+// File-local Functions
+static __inline UINT _GroupMatch(_In_ const CHAR *pGroup, _In_ CHAR ctrl);
+static __inline UINT _GroupMatchEmptyOrDeleted(_In_ const CHAR *pGroup);
+static __inline UINT _LowestBitIndex(_In_ UINT uMask);
+static __inline UINT _GrowthForCapacity(_In_ UINT nCapacity);
+
+static BOOL _FindSlot(
+    _In_ PCHL_FHTABLE pfht,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ ULONGLONG ullHash,
+    _Out_ UINT *piSlot);
+
+static UINT _FindInsertSlot(_In_ const CHAR *pCtrl, _In_ UINT nCapacity, _In_ ULONGLONG ullHash);
+static HRESULT _AllocSlots(_In_ UINT nCapacity, _Out_ CHAR **ppCtrl, _Out_ FHT_SLOT **ppSlots);
+static HRESULT _Rehash(_In_ PCHL_FHTABLE pfht, _In_ UINT nNewCapacity);
+static HRESULT _EnsureGrowthLeft(_In_ PCHL_FHTABLE pfht);
+static void _EraseSlot(_In_ PCHL_FHTABLE pfht, _In_ UINT iSlot);
+static int _NextFullSlot(_In_ PCHL_FHTABLE pfht, _In_ int iStartSlot);
+
+// Returns a bitmask with bit i set if pGroup[i] == ctrl
+UINT _GroupMatch(_In_ const CHAR *pGroup, _In_ CHAR ctrl)
+{
+#ifdef FHT_USE_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*)pGroup);
+    return (UINT)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(ctrl)));
+#else
+    UINT uMask = 0;
+    int i;
+    for (i = 0; i < CHL_FHT_GROUP_WIDTH; ++i)
+    {
+        if (pGroup[i] == ctrl)
+        {
+            uMask |= (1U << i);
+        }
+    }
+    return uMask;
+#endif
+}
+
+// Returns a bitmask with bit i set if pGroup[i] is not a full slot
+UINT _GroupMatchEmptyOrDeleted(_In_ const CHAR *pGroup)
+{
+#ifdef FHT_USE_SSE2
+    // Empty and deleted are the only control values with the high bit set
+    return (UINT)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)pGroup));
+#else
+    UINT uMask = 0;
+    int i;
+    for (i = 0; i < CHL_FHT_GROUP_WIDTH; ++i)
+    {
+        if (!FHT_IS_FULL(pGroup[i]))
+        {
+            uMask |= (1U << i);
+        }
+    }
+    return uMask;
+#endif
+}
+
+UINT _LowestBitIndex(_In_ UINT uMask)
+{
+    DWORD dwIndex;
+
+    ASSERT(uMask != 0);
+    _BitScanForward(&dwIndex, uMask);
+    return (UINT)dwIndex;
+}
+
+UINT _GrowthForCapacity(_In_ UINT nCapacity)
+{
+    return (nCapacity / FHT_MAX_LOAD_DENOMINATOR) * FHT_MAX_LOAD_NUMERATOR;
+}
+
+HRESULT CHL_DsCreateFHT(
+    _Inout_ PCHL_FHTABLE *pFHTableOut,
+    _In_ int nEstEntries,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem)
+{
+    UINT nCapacity = FHT_MIN_CAPACITY;
+    PCHL_FHTABLE pnewtable = NULL;
+
+    HRESULT hr = S_OK;
+
+    // validate parameters
+    if ((pFHTableOut == NULL) || (nEstEntries < 0) ||
+        IS_INVALID_CHL_KEYTYPE(keyType) || IS_INVALID_CHL_VALTYPE(valType))
+    {
+        hr = E_INVALIDARG;
+        goto error_return;
+    }
+
+    // Smallest power of 2 that holds the estimated entries within the max load
+    while ((_GrowthForCapacity(nCapacity) < (UINT)nEstEntries) && (nCapacity < (UINT_MAX / 2)))
+    {
+        nCapacity *= 2;
+    }
+
+    if ((pnewtable = (CHL_FHTABLE*)calloc(1, sizeof(CHL_FHTABLE))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto error_return;
+    }
+
+    hr = _AllocSlots(nCapacity, &pnewtable->pCtrl, &pnewtable->pSlots);
+    if (FAILED(hr))
+    {
+        goto error_return;
+    }
+
+    pnewtable->keyType = keyType;
+    pnewtable->valType = valType;
+    pnewtable->fValIsInHeap = fValInHeapMem;
+    pnewtable->nCapacity = nCapacity;
+    pnewtable->nGrowthLeft = _GrowthForCapacity(nCapacity);
+    pnewtable->ullHashSeed = _GenerateHashSeed();
+
+    pnewtable->Destroy = CHL_DsDestroyFHT;
+    pnewtable->Insert = CHL_DsInsertFHT;
+    pnewtable->Find = CHL_DsFindFHT;
+    pnewtable->Remove = CHL_DsRemoveFHT;
+    pnewtable->RemoveAt = CHL_DsRemoveAtFHT;
+    pnewtable->InitIterator = CHL_DsInitIteratorFHT;
+
+    *pFHTableOut = pnewtable;
+    return hr;
+
+error_return:
+    if (pnewtable)
+    {
+        free(pnewtable);
+    }
+    if (pFHTableOut)
+    {
+        *pFHTableOut = NULL;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsDestroyFHT(_In_ PCHL_FHTABLE pfht)
+{
+    UINT iSlot;
+
+    ASSERT(pfht);
+
+    for (iSlot = 0; (pfht->nEntries > 0) && (iSlot < pfht->nCapacity); ++iSlot)
+    {
+        if (FHT_IS_FULL(pfht->pCtrl[iSlot]))
+        {
+            _DeleteKey(&pfht->pSlots[iSlot].chlKey, pfht->keyType);
+            _DeleteVal(&pfht->pSlots[iSlot].chlVal, pfht->valType, pfht->fValIsInHeap);
+            --(pfht->nEntries);
+        }
+    }
+
+    CHL_MmFree((PVOID*)&pfht->pCtrl);
+    CHL_MmFree((PVOID*)&pfht->pSlots);
+
+    DBG_MEMSET(pfht, sizeof(CHL_FHTABLE));
+    free(pfht);
+
+    return S_OK;
+}
+
+HRESULT CHL_DsInsertFHT(
+    _In_ PCHL_FHTABLE pfht,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    ULONGLONG ullHash;
+    UINT iSlot;
+    FHT_SLOT *pSlot;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pfht);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pfht->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, pfht->valType, &iValSize)))
+    {
+        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    ullHash = _HashKeyBytes64(pvkey, pfht->keyType, iKeySize, pfht->ullHashSeed);
+    if (_FindSlot(pfht, pvkey, iKeySize, ullHash, &iSlot))
+    {
+        pSlot = &pfht->pSlots[iSlot];
+        if (!_IsDuplicateVal(&pSlot->chlVal, pvVal, pfht->valType, pSlot->chlVal.iValSize))
+        {
+            // Same key but different value, just update slot with new value
+            // NOTE: Old value will be lost!!
+            _DeleteVal(&pSlot->chlVal, pfht->valType, pfht->fValIsInHeap);
+            hr = _CopyValIn(&pSlot->chlVal, pfht->valType, pvVal, iValSize);
+        }
+        goto done;
+    }
+
+    iSlot = _FindInsertSlot(pfht->pCtrl, pfht->nCapacity, ullHash);
+    if ((pfht->nGrowthLeft == 0) && (pfht->pCtrl[iSlot] == FHT_CTRL_EMPTY))
+    {
+        // Reusing a deleted slot is always fine, taking an empty one needs room
+        hr = _EnsureGrowthLeft(pfht);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+        iSlot = _FindInsertSlot(pfht->pCtrl, pfht->nCapacity, ullHash);
+    }
+
+    pSlot = &pfht->pSlots[iSlot];
+    hr = _CopyKeyIn(&pSlot->chlKey, pfht->keyType, pvkey, iKeySize);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    hr = _CopyValIn(&pSlot->chlVal, pfht->valType, pvVal, iValSize);
+    if (FAILED(hr))
+    {
+        _DeleteKey(&pSlot->chlKey, pfht->keyType);
+        goto done;
+    }
+
+    if (pfht->pCtrl[iSlot] == FHT_CTRL_EMPTY)
+    {
+        --(pfht->nGrowthLeft);
+    }
+    pfht->pCtrl[iSlot] = FHT_H2(ullHash);
+    ++(pfht->nEntries);
+
+done:
+    return hr;
+}
+
+HRESULT CHL_DsFindFHT(
+    _In_ PCHL_FHTABLE pfht,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    UINT iSlot;
+    FHT_SLOT *pSlot;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pfht);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pfht->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto not_found;
+    }
+
+    if (!_FindSlot(pfht, pvkey, iKeySize, _HashKeyBytes64(pvkey, pfht->keyType, iKeySize, pfht->ullHashSeed), &iSlot))
+    {
+        hr = E_NOT_SET;
+        goto not_found;
+    }
+
+    pSlot = &pfht->pSlots[iSlot];
+    if (pvVal)
+    {
+        hr = _CopyValOut(&pSlot->chlVal, pfht->valType, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr) && (piValSize != NULL))
+    {
+        *piValSize = pSlot->chlVal.iValSize;
+    }
+
+    return hr;
+
+not_found:
+    if (piValSize)
+    {
+        *piValSize = 0;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsRemoveFHT(_In_ PCHL_FHTABLE pfht, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    UINT iSlot;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pfht);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pfht->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (!_FindSlot(pfht, pvkey, iKeySize, _HashKeyBytes64(pvkey, pfht->keyType, iKeySize, pfht->ullHashSeed), &iSlot))
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    _EraseSlot(pfht, iSlot);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsRemoveAtFHT(_Inout_ CHL_FHT_ITERATOR *pItr)
+{
+    PCHL_FHTABLE pfht;
+    int iSlot;
+
+    ASSERT(pItr && pItr->pMyHashTable);
+
+    pfht = pItr->pMyHashTable;
+    if (pItr->uLayoutVersion != pfht->uLayoutVersion)
+    {
+        return E_CHANGED_STATE;
+    }
+
+    iSlot = pItr->iCurSlot;
+    if ((iSlot < 0) || ((UINT)iSlot >= pfht->nCapacity) || !FHT_IS_FULL(pfht->pCtrl[iSlot]))
+    {
+        return E_NOT_SET;
+    }
+
+    // Removal never moves other entries so the iterator can simply step forward
+    pItr->iCurSlot = _NextFullSlot(pfht, iSlot + 1);
+    _EraseSlot(pfht, (UINT)iSlot);
+    return S_OK;
+}
+
+HRESULT CHL_DsInitIteratorFHT(_In_ PCHL_FHTABLE pfht, _Out_ CHL_FHT_ITERATOR *pItr)
+{
+    ASSERT(pfht && pItr);
+
+    pItr->pMyHashTable = pfht;
+    pItr->uLayoutVersion = pfht->uLayoutVersion;
+    pItr->MoveNext = CHL_DsMoveNextFHT;
+    pItr->GetCurrent = CHL_DsGetCurrentFHT;
+
+    // Move to first element or the end if none exist
+    pItr->iCurSlot = _NextFullSlot(pfht, 0);
+    return (pItr->iCurSlot >= 0) ? S_OK : E_NOT_SET;
+}
+
+HRESULT CHL_DsMoveNextFHT(_Inout_ CHL_FHT_ITERATOR *pItr)
+{
+    ASSERT(pItr && pItr->pMyHashTable);
+
+    if (pItr->uLayoutVersion != pItr->pMyHashTable->uLayoutVersion)
+    {
+        return E_CHANGED_STATE;
+    }
+
+    if (pItr->iCurSlot < 0)
+    {
+        return E_NOT_SET;
+    }
+
+    pItr->iCurSlot = _NextFullSlot(pItr->pMyHashTable, pItr->iCurSlot + 1);
+    return (pItr->iCurSlot >= 0) ? S_OK : E_NOT_SET;
+}
+
+HRESULT CHL_DsGetCurrentFHT(
+    _In_ CHL_FHT_ITERATOR *pItr,
+    _Inout_opt_ PCVOID pvKey,
+    _Inout_opt_ PINT piKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    PCHL_FHTABLE pfht;
+    FHT_SLOT *pSlot;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pItr && pItr->pMyHashTable);
+
+    pfht = pItr->pMyHashTable;
+    if (pItr->uLayoutVersion != pfht->uLayoutVersion)
+    {
+        return E_CHANGED_STATE;
+    }
+
+    if ((pItr->iCurSlot < 0) || !FHT_IS_FULL(pfht->pCtrl[pItr->iCurSlot]))
+    {
+        return E_NOT_SET;
+    }
+
+    pSlot = &pfht->pSlots[pItr->iCurSlot];
+    if (pvKey)
+    {
+        hr = _CopyKeyOut(&pSlot->chlKey, pfht->keyType, pvKey, piKeySize, fGetPointerOnly);
+    }
+    if (SUCCEEDED(hr) && pvVal)
+    {
+        hr = _CopyValOut(&pSlot->chlVal, pfht->valType, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (piKeySize != NULL)
+        {
+            *piKeySize = pSlot->chlKey.iKeySize;
+        }
+
+        if (piValSize != NULL)
+        {
+            *piValSize = pSlot->chlVal.iValSize;
+        }
+    }
+    return hr;
+}
+
+// Probes groups starting at the group selected by H1. Within a group only the slots
+// whose control byte equals H2 are compared. A group with an empty slot ends the probe
+// because an insert of the key would have stopped there.
+BOOL _FindSlot(
+    _In_ PCHL_FHTABLE pfht,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ ULONGLONG ullHash,
+    _Out_ UINT *piSlot)
+{
+    const CHAR h2 = FHT_H2(ullHash);
+    const UINT nGroups = pfht->nCapacity / CHL_FHT_GROUP_WIDTH;
+    UINT iGroup = (UINT)FHT_H1(ullHash) & (nGroups - 1);
+    UINT iProbe;
+
+    for (iProbe = 0; iProbe < nGroups; ++iProbe)
+    {
+        const CHAR *pGroup = &pfht->pCtrl[iGroup * CHL_FHT_GROUP_WIDTH];
+        UINT uMatch = _GroupMatch(pGroup, h2);
+
+        while (uMatch != 0)
+        {
+            UINT iSlot = (iGroup * CHL_FHT_GROUP_WIDTH) + _LowestBitIndex(uMatch);
+            FHT_SLOT *pSlot = &pfht->pSlots[iSlot];
+            if (_IsSameKeyBytes(&pSlot->chlKey, pvkey, pfht->keyType, iKeySize))
+            {
+                *piSlot = iSlot;
+                return TRUE;
+            }
+            uMatch &= (uMatch - 1);
+        }
+
+        if (_GroupMatch(pGroup, FHT_CTRL_EMPTY) != 0)
+        {
+            break;
+        }
+
+        // Triangular steps visit every group when the #groups is a power of 2
+        iGroup = (iGroup + iProbe + 1) & (nGroups - 1);
+    }
+
+    *piSlot = 0;
+    return FALSE;
+}
+
+// Returns the first empty or deleted slot along the probe sequence of the hash.
+// There always is one since the table is never allowed to fill up completely.
+UINT _FindInsertSlot(_In_ const CHAR *pCtrl, _In_ UINT nCapacity, _In_ ULONGLONG ullHash)
+{
+    const UINT nGroups = nCapacity / CHL_FHT_GROUP_WIDTH;
+    UINT iGroup = (UINT)FHT_H1(ullHash) & (nGroups - 1);
+    UINT iProbe;
+
+    for (iProbe = 0; iProbe < nGroups; ++iProbe)
+    {
+        UINT uMatch = _GroupMatchEmptyOrDeleted(&pCtrl[iGroup * CHL_FHT_GROUP_WIDTH]);
+        if (uMatch != 0)
+        {
+            return (iGroup * CHL_FHT_GROUP_WIDTH) + _LowestBitIndex(uMatch);
+        }
+        iGroup = (iGroup + iProbe + 1) & (nGroups - 1);
+    }
+
+    ASSERT(!L"Flat hashtable has no free slot");
+    return 0;
+}
+
+HRESULT _AllocSlots(_In_ UINT nCapacity, _Out_ CHAR **ppCtrl, _Out_ FHT_SLOT **ppSlots)
+{
+    HRESULT hr = S_OK;
+    size_t cbSlots;
+
+    *ppCtrl = NULL;
+    *ppSlots = NULL;
+
+    hr = SizeTMult(nCapacity, sizeof(FHT_SLOT), &cbSlots);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    hr = CHL_MmAlloc((PVOID*)ppCtrl, nCapacity, NULL);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    hr = CHL_MmAlloc((PVOID*)ppSlots, cbSlots, NULL);
+    if (FAILED(hr))
+    {
+        CHL_MmFree((PVOID*)ppCtrl);
+        goto fend;
+    }
+
+    memset(*ppCtrl, FHT_CTRL_EMPTY, nCapacity);
+
+fend:
+    return hr;
+}
+
+// Moves all entries into freshly allocated slot arrays of the specified capacity.
+// Keys and values are moved as-is, nothing is copied or freed. Deleted slots are dropped.
+HRESULT _Rehash(_In_ PCHL_FHTABLE pfht, _In_ UINT nNewCapacity)
+{
+    CHAR *pNewCtrl = NULL;
+    FHT_SLOT *pNewSlots = NULL;
+    UINT iSlot;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(_GrowthForCapacity(nNewCapacity) > pfht->nEntries);
+
+    hr = _AllocSlots(nNewCapacity, &pNewCtrl, &pNewSlots);
+    if (FAILED(hr))
+    {
+        logerr("%s(): Unable to allocate %u slots", __FUNCTION__, nNewCapacity);
+        goto fend;
+    }
+
+    for (iSlot = 0; iSlot < pfht->nCapacity; ++iSlot)
+    {
+        FHT_SLOT *pSlot = &pfht->pSlots[iSlot];
+        PVOID pvStoredKey = NULL;
+        ULONGLONG ullHash;
+        UINT iNewSlot;
+
+        if (!FHT_IS_FULL(pfht->pCtrl[iSlot]))
+        {
+            continue;
+        }
+
+        hr = _CopyKeyOut(&pSlot->chlKey, pfht->keyType, &pvStoredKey, NULL, TRUE);
+        ASSERT(SUCCEEDED(hr));
+
+        ullHash = _HashKeyBytes64(pvStoredKey, pfht->keyType, pSlot->chlKey.iKeySize, pfht->ullHashSeed);
+        iNewSlot = _FindInsertSlot(pNewCtrl, nNewCapacity, ullHash);
+        pNewCtrl[iNewSlot] = FHT_H2(ullHash);
+        pNewSlots[iNewSlot] = *pSlot;
+    }
+
+    CHL_MmFree((PVOID*)&pfht->pCtrl);
+    CHL_MmFree((PVOID*)&pfht->pSlots);
+
+    pfht->pCtrl = pNewCtrl;
+    pfht->pSlots = pNewSlots;
+    pfht->nCapacity = nNewCapacity;
+    pfht->nGrowthLeft = _GrowthForCapacity(nNewCapacity) - pfht->nEntries;
+    ++(pfht->uLayoutVersion);
+    hr = S_OK;
+
+fend:
+    return hr;
+}
+
+// Called when there are no more empty slots to use within the max load. If deleted slots
+// take up most of that room, rehashing at the same size reclaims them. Otherwise the
+// table doubles in size.
+HRESULT _EnsureGrowthLeft(_In_ PCHL_FHTABLE pfht)
+{
+    UINT nNewCapacity = pfht->nCapacity;
+
+    if (pfht->nEntries >= (_GrowthForCapacity(pfht->nCapacity) / 2))
+    {
+        if (pfht->nCapacity > (UINT_MAX / 2))
+        {
+            logerr("%s(): Table cannot grow beyond %u slots", __FUNCTION__, pfht->nCapacity);
+            return E_OUTOFMEMORY;
+        }
+        nNewCapacity *= 2;
+    }
+    return _Rehash(pfht, nNewCapacity);
+}
+
+void _EraseSlot(_In_ PCHL_FHTABLE pfht, _In_ UINT iSlot)
+{
+    UINT iGroupStart = iSlot & ~(UINT)(CHL_FHT_GROUP_WIDTH - 1);
+
+    ASSERT(FHT_IS_FULL(pfht->pCtrl[iSlot]));
+
+    _DeleteKey(&pfht->pSlots[iSlot].chlKey, pfht->keyType);
+    _DeleteVal(&pfht->pSlots[iSlot].chlVal, pfht->valType, pfht->fValIsInHeap);
+
+    // If the group still has an empty slot, no probe sequence ever continued past
+    // this group, so the slot can become empty again instead of a tombstone.
+    if (_GroupMatch(&pfht->pCtrl[iGroupStart], FHT_CTRL_EMPTY) != 0)
+    {
+        pfht->pCtrl[iSlot] = FHT_CTRL_EMPTY;
+        ++(pfht->nGrowthLeft);
+    }
+    else
+    {
+        pfht->pCtrl[iSlot] = FHT_CTRL_DELETED;
+    }
+    --(pfht->nEntries);
+}
+
+// Returns index of the first full slot at or after iStartSlot, -1 if there is none
+int _NextFullSlot(_In_ PCHL_FHTABLE pfht, _In_ int iStartSlot)
+{
+    UINT iGroupStart;
+    UINT uFull;
+
+    if ((iStartSlot < 0) || ((UINT)iStartSlot >= pfht->nCapacity))
+    {
+        return -1;
+    }
+
+    // First group may be partially visited already, mask off the slots before the start
+    iGroupStart = (UINT)iStartSlot & ~(UINT)(CHL_FHT_GROUP_WIDTH - 1);
+    uFull = ~_GroupMatchEmptyOrDeleted(&pfht->pCtrl[iGroupStart]) & 0xFFFF;
+    uFull &= ~((1U << ((UINT)iStartSlot - iGroupStart)) - 1);
+
+    while (uFull == 0)
+    {
+        iGroupStart += CHL_FHT_GROUP_WIDTH;
+        if (iGroupStart >= pfht->nCapacity)
+        {
+            return -1;
+        }
+        uFull = ~_GroupMatchEmptyOrDeleted(&pfht->pCtrl[iGroupStart]) & 0xFFFF;
+    }
+    return (int)(iGroupStart + _LowestBitIndex(uFull));
+}
@@ -0,0 +1,193 @@
+
+// FlatHashtable.h
+// Open-addressing hashtable with SIMD probed control bytes (Swiss-table style)
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#ifndef _FLATHASHTABLE_H
+#define _FLATHASHTABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Defines.h"
+#include "MemFunctions.h"
+
+// Number of slots whose control bytes are scanned together in one probe
+#define CHL_FHT_GROUP_WIDTH     16
+
+// A slot holds one key-value pair. Slots live in a single flat array, there
+// is no per-entry allocation other than for the key/value contents themselves.
+typedef struct _flatHashtableSlot {
+    CHL_KEY chlKey;
+    CHL_VAL chlVal;
+}FHT_SLOT;
+
+// Foward declare the iterator struct
+struct _flatHashtableIterator;
+
+// The flat hashtable itself.
+// Each slot has a control byte that is either empty, deleted or holds the low 7 bits
+// of the key's hash. A lookup compares a group of 16 control bytes against those 7 bits
+// at once and only compares keys in slots whose control byte matches.
+typedef struct _flatHashtable CHL_FHTABLE, *PCHL_FHTABLE;
+typedef struct _flatHashtableIterator CHL_FHT_ITERATOR;
+struct _flatHashtable {
+    CHL_KEYTYPE keyType;    // Type information for the hashtable key
+    CHL_VALTYPE valType;    // Type information for the hashtable value
+    BOOL fValIsInHeap;      // Whether value was allocated on heap by client (for CHL_VT_POINTER only)
+    CHAR *pCtrl;            // Control bytes, one per slot
+    FHT_SLOT *pSlots;       // Key-value slots
+    UINT nCapacity;         // Number of slots, a power of 2 and a multiple of CHL_FHT_GROUP_WIDTH
+    UINT nEntries;          // Number of key-value pairs currently stored
+    UINT nGrowthLeft;       // Number of empty slots that can be used before the table is rehashed
+    UINT uLayoutVersion;    // Bumped whenever the table is rehashed, invalidates iterators
+    ULONGLONG ullHashSeed;  // Random per-table seed for the key hash
+
+    // Access methods
+    HRESULT (*Destroy)(PCHL_FHTABLE pfht);
+
+    HRESULT (*Insert)(
+        PCHL_FHTABLE pfht,
+        PCVOID pvkey,
+        int iKeySize,
+        PCVOID pvVal,
+        int iValSize);
+
+    HRESULT (*Find)(
+        PCHL_FHTABLE pfht,
+        PCVOID pvkey,
+        int iKeySize,
+        PVOID pvVal,
+        PINT pvalsize,
+        BOOL fGetPointerOnly);
+
+    HRESULT (*Remove)(PCHL_FHTABLE pfht, PCVOID pvkey, int iKeySize);
+    HRESULT (*RemoveAt)(CHL_FHT_ITERATOR *pItr);
+
+    HRESULT (*InitIterator)(PCHL_FHTABLE pfht, CHL_FHT_ITERATOR *pItr);
+};
+
+// Structure that defines the iterator for the flat hashtable
+// Callers can use this to iterate through the hashtable
+// and get all (key,value) pairs one-by-one
+struct _flatHashtableIterator {
+    int iCurSlot;               // Current slot, -1 if not positioned on an element
+    PCHL_FHTABLE pMyHashTable;  // Pointer to the hashtable to work on
+    UINT uLayoutVersion;        // Table layout the iterator was positioned against
+
+    HRESULT (*MoveNext)(
+        struct _flatHashtableIterator *pItr);
+
+    HRESULT (*GetCurrent)(
+        CHL_FHT_ITERATOR *pItr,
+        PCVOID pvKey,
+        PINT piKeySize,
+        PVOID pvVal,
+        PINT piValSize,
+        BOOL fGetPointerOnly);
+};
+
+// -------------------------------------------
+// Functions exported
+
+// Creates a flat hashtable and returns a pointer which can be used for later operations
+// on the table. The table has the same key and value semantics as CHL_HTABLE.
+// Params:
+//      pFHTableOut: Address of pointer where to copy the pointer to the hashtable
+//      nEstEntries: Estimated number of entries that would be in the table at any given time.
+//                   This is used to determine the initial size of the hashtable. The table
+//                   grows as needed.
+//      keyType: Type of variable that is used as key - a string or a number
+//      valType: Type of value that is stored - number, string or void(can be anything)
+//      fValInHeapMem: Set this to true if the value(type is CHL_VT_POINTER) is allocated memory on the heap.
+//                     This indicates the hash table to free it when a table entry is removed.
+//
+DllExpImp HRESULT CHL_DsCreateFHT(
+    _Inout_ CHL_FHTABLE **pFHTableOut,
+    _In_ int nEstEntries,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem);
+
+// Destroy the hashtable by removing all key-value pairs from the hashtable.
+// The CHL_FHTABLE object itself is also destroyed.
+// Params:
+//      pfht: Pointer to the hashtable object returned by CHL_DsCreateFHT function.
+//
+DllExpImp HRESULT CHL_DsDestroyFHT(_In_ CHL_FHTABLE *pfht);
+
+// Inserts a key,value pair into the hash table. If the key already exists, then the value is over-written
+// with the new value. Inserting a new key may rehash the table into a larger one.
+// Params: Refer documentation of the CHL_DsInsertHT() function.
+//
+DllExpImp HRESULT CHL_DsInsertFHT(
+    _In_ CHL_FHTABLE *pfht,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+// Find the specified key in the hash table.
+// Params: Refer documentation of the CHL_DsFindHT() function.
+//
+DllExpImp HRESULT CHL_DsFindFHT(
+    _In_ CHL_FHTABLE *pfht,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pvalsize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+// Deletes the specified key from the hash table. Entries are never moved by a removal.
+// Params:
+//      pfht: Pointer to the hashtable object returned by CHL_DsCreateFHT function.
+//      pvkey: Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//
+DllExpImp HRESULT CHL_DsRemoveFHT(_In_ CHL_FHTABLE *pfht, _In_ PCVOID pvkey, _In_ int iKeySize);
+
+// Deletes the element that the iterator points to. Upon return, the iterator will
+// have been moved forward to point to the next element or the end if no more elements.
+// Params:
+//      pItr: A previously initialized iterator. If iterator does not point to a valid
+//          element, then this method returns E_NOT_SET.
+//
+DllExpImp HRESULT CHL_DsRemoveAtFHT(_Inout_ CHL_FHT_ITERATOR *pItr);
+
+// Initialize the iterator object for use with the specified hashtable.
+// Iterator will point to the first element or nothing if hashtable is empty.
+// If the table is rehashed by a later Insert, the iterator methods return
+// E_CHANGED_STATE and the iterator must be initialized again.
+// Params:
+//      pfht: Pointer to the hashtable object returned by CHL_DsCreateFHT function.
+//      pItr: Pointer to the iterator object to initialize.
+//
+DllExpImp HRESULT CHL_DsInitIteratorFHT(_In_ PCHL_FHTABLE pfht, _Out_ CHL_FHT_ITERATOR *pItr);
+
+// Moves iterator to the next element in the hash table using the specified iterator object.
+// If there are no more items remaining, then it returns E_NOT_SET.
+// Params:
+//      pItr: The iterator object that was initialized by CHL_DsInitIteratorFHT.
+//
+DllExpImp HRESULT CHL_DsMoveNextFHT(_Inout_ CHL_FHT_ITERATOR *pItr);
+
+// Get the current element in the hash table using the specified iterator object.
+// Params: Refer documentation of the CHL_DsGetCurrentHT() function.
+//
+DllExpImp HRESULT CHL_DsGetCurrentFHT(
+    _In_ CHL_FHT_ITERATOR *pItr,
+    _Inout_opt_ PCVOID pvKey,
+    _Inout_opt_ PINT piKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _FLATHASHTABLE_H
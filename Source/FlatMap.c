@@ -0,0 +1,1221 @@
+// FlatMap.c
+// Ordered map stored as sorted arrays of keys and values, for read-mostly ordered lookups
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#include "InternalDefines.h"
+#include "FlatMap.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FM_PREFETCH(p)      _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define FM_PREFETCH(p)      ((void)(p))
+#endif
+
+// The Eytzinger keys start at a cache line. The descendants of key k four levels down, for 4-byte
+// keys, or three levels down, for 8-byte keys, then fill the cache line at k * FM_CACHE_LINE_SIZE.
+#define FM_CACHE_LINE_SIZE  64
+
+// Runs of this many batch keys are sorted by insertion before they are merged
+#define FM_SORT_RUN         16
+
+// Most entries in a map, so that Eytzinger indexes, up to 2 * nEntries + 1, fit in a UINT
+#define FM_MAX_ENTRIES      ((UINT)MAXINT - 1)
+
+// Marks a batch key that is already in the map, in the top bit of its position
+#define FM_POS_EXISTS       0x80000000
+
+// A batch key along with where it is in the batch, sorted together so that the keys compared are
+// next to each other in memory
+typedef struct _fmSortItem {
+    PVOID pvKey;
+    UINT index;
+}FM_SORT_ITEM;
+
+// File-local functions
+static CHL_VALTYPE s_GetKeyValType(_In_ CHL_KEYTYPE keyType);
+static BOOL s_IsPackable(_In_ CHL_VALTYPE valType);
+static HRESULT s_CreateArrays(_In_ PCHL_FLATMAP pfm, _Out_ PCHL_RARRAY praKeys, _Out_ PCHL_RARRAY praVals);
+static HRESULT s_ReserveFor(_In_ PCHL_FLATMAP pfm, _In_ UINT nTotal);
+static __inline PCVOID s_GetKeyAt(_In_ PCHL_FLATMAP pfm, _In_ PCHL_RARRAY praKeys, _In_ UINT index);
+static __inline int s_CompareKeys(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvLeft, _In_ PCVOID pvRight);
+static BOOL s_IsKeyAt(_In_ PCHL_FLATMAP pfm, _In_ UINT index, _In_ PCVOID pvKey);
+static UINT s_LowerBound(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey, _Out_opt_ PBOOL pfIsKey);
+static UINT s_LowerBoundSorted(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey);
+static UINT s_LowerBoundEytzinger(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey, _Out_opt_ PBOOL pfIsKey);
+static void s_MoveEntries(_In_ PCHL_FLATMAP pfm, _In_ UINT destIndex, _In_ UINT srcIndex, _In_ UINT nEntries);
+static PVOID s_GetHeapVal(_In_ PCHL_FLATMAP pfm, _In_ PCHL_RARRAY praVals, _In_ UINT index);
+static __inline PVOID s_GetInputAt(_In_ PCVOID pvArray, _In_ CHL_VALTYPE valType, _In_ UINT index);
+static __inline void s_SetInputAt(_Inout_ PVOID pvArray, _In_ CHL_VALTYPE valType, _In_ UINT index, _In_ PVOID pvVal);
+static void s_SortBatch(
+    _In_ PCHL_FLATMAP pfm,
+    _Inout_ FM_SORT_ITEM *pItems,
+    _In_ FM_SORT_ITEM *pScratch,
+    _In_ UINT nItems);
+static void s_RebuildEytzinger(_In_ PCHL_FLATMAP pfm);
+static __inline PCVOID s_GetEytzingerKeyAt(_In_ PCHL_FLATMAP pfm, _In_ UINT k);
+static UINT s_FillEytzinger(_In_ PCHL_FLATMAP pfm, _In_ UINT index, _In_ UINT k);
+static void s_FreeEytzinger(_In_ PCHL_FLATMAP pfm);
+
+// --------------------------------------------------------
+// Public function definitions
+
+HRESULT CHL_DsCreateFM
+(
+    _Out_ PCHL_FLATMAP pfm,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ CHL_CompareFn pfnKeyCompare,
+    _In_opt_ BOOL fValInHeapMem
+)
+{
+    HRESULT hr = S_OK;
+
+    ASSERT(IS_VALID_CHL_VALTYPE(valType));
+    ASSERT(IS_VALID_CHL_KEYTYPE(keyType));
+
+    if (IS_INVALID_CHL_KEYTYPE(keyType) || IS_INVALID_CHL_VALTYPE(valType))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if ((pfnKeyCompare == NULL) && !s_IsPackable(s_GetKeyValType(keyType)))
+    {
+        logerr("%s(): String keys need a compare function", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    memset(pfm, 0, sizeof(*pfm));
+
+    pfm->keyType = keyType;
+    pfm->valType = valType;
+    pfm->fValIsInHeap = fValInHeapMem;
+    pfm->fnKeyCompare = pfnKeyCompare;
+
+    hr = s_CreateArrays(pfm, &pfm->raKeys, &pfm->raVals);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    pfm->Destroy = CHL_DsDestroyFM;
+    pfm->Insert = CHL_DsInsertFM;
+    pfm->InsertBatch = CHL_DsInsertBatchFM;
+    pfm->Find = CHL_DsFindFM;
+    pfm->Remove = CHL_DsRemoveFM;
+    pfm->FindMax = CHL_DsFindMaxFM;
+    pfm->FindMin = CHL_DsFindMinFM;
+    pfm->FindFloor = CHL_DsFindFloorFM;
+    pfm->FindCeil = CHL_DsFindCeilFM;
+    pfm->GetAt = CHL_DsGetAtFM;
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsCreateExFM
+(
+    _Out_ PCHL_FLATMAP pfm,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ CHL_CompareFn pfnKeyCompare,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ DWORD dwFlags
+)
+{
+    HRESULT hr = S_OK;
+
+    if ((dwFlags & ~CHL_FM_FLAG_EYTZINGER) != 0)
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    hr = CHL_DsCreateFM(pfm, keyType, valType, pfnKeyCompare, fValInHeapMem);
+    if (SUCCEEDED(hr))
+    {
+        pfm->fEytzinger = (dwFlags & CHL_FM_FLAG_EYTZINGER) ? TRUE : FALSE;
+        s_RebuildEytzinger(pfm);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsDestroyFM(_In_ PCHL_FLATMAP pfm)
+{
+    PVOID pvVal;
+
+    if (IS_INVALID_CHL_KEYTYPE(pfm->keyType) || IS_INVALID_CHL_VALTYPE(pfm->valType))
+    {
+        return E_INVALIDARG;
+    }
+
+    for (UINT index = 0; index < pfm->nEntries; ++index)
+    {
+        pvVal = s_GetHeapVal(pfm, &pfm->raVals, index);
+        CHL_MmFree(&pvVal);
+    }
+
+    pfm->raKeys.Destroy(&pfm->raKeys);
+    pfm->raVals.Destroy(&pfm->raVals);
+    s_FreeEytzinger(pfm);
+    memset(pfm, 0, sizeof(*pfm));
+    return S_OK;
+}
+
+HRESULT CHL_DsInsertFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize
+)
+{
+    HRESULT hr = S_OK;
+    UINT index;
+    BOOL fIsKey;
+    PVOID pvOldVal;
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvKey, pfm->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    index = s_LowerBound(pfm, pvKey, &fIsKey);
+    if (fIsKey)
+    {
+        // The write releases the old value but not the memory it points to
+        pvOldVal = s_GetHeapVal(pfm, &pfm->raVals, index);
+        hr = pfm->raVals.Write(&pfm->raVals, index, pvVal, iValSize);
+        if (SUCCEEDED(hr) && (pvOldVal != pvVal))
+        {
+            CHL_MmFree(&pvOldVal);
+        }
+        goto fend;
+    }
+
+    if (pfm->nEntries >= FM_MAX_ENTRIES)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+        goto fend;
+    }
+
+    hr = s_ReserveFor(pfm, pfm->nEntries + 1);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    // Make room for the new entry, the entries are moved back if the key or value cannot be copied
+    s_MoveEntries(pfm, index + 1, index, pfm->nEntries - index);
+
+    hr = pfm->raKeys.Write(&pfm->raKeys, index, pvKey, iKeySize);
+    if (SUCCEEDED(hr))
+    {
+        hr = pfm->raVals.Write(&pfm->raVals, index, pvVal, iValSize);
+        if (FAILED(hr))
+        {
+            pfm->raKeys.ClearAt(&pfm->raKeys, index);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        s_MoveEntries(pfm, index, index + 1, pfm->nEntries - index);
+        goto fend;
+    }
+
+    ++pfm->nEntries;
+    s_RebuildEytzinger(pfm);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsInsertBatchFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKeys,
+    _In_opt_ const int *piKeySizes,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piValSizes,
+    _In_ UINT nPairs
+)
+{
+    HRESULT hr = S_OK;
+    HRESULT hrTemp;
+    CHL_VALTYPE keyValType = s_GetKeyValType(pfm->keyType);
+    CHL_RARRAY raBatchKeys;
+    CHL_RARRAY raBatchVals;
+    FM_SORT_ITEM *pItems = NULL;    // Batch keys in key order, then (in pvKey) the batch values to free
+    PUINT puPos = NULL;             // Where each kept key goes in the map
+    PVOID *ppvKept = NULL;          // Kept keys and values in key order, as input to AppendRange
+    int *piKeptSizes = NULL;
+    UINT nUnique = 0;
+    UINT nNew = 0;
+    UINT nDropped = 0;
+    UINT nDroppedBefore;
+    UINT nToInsert, nRun;
+    UINT idx, idxEnd, idxKept, end, pos;
+    BOOL fExists;
+    PVOID pvKey;
+    PVOID pvVal;
+    PVOID pvOldVal;
+
+    memset(&raBatchKeys, 0, sizeof(raBatchKeys));
+    memset(&raBatchVals, 0, sizeof(raBatchVals));
+
+    if (nPairs == 0)
+    {
+        goto fend;
+    }
+
+    if (nPairs > (FM_MAX_ENTRIES - pfm->nEntries))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+        goto fend;
+    }
+
+    // Twice the items, the second half is scratch space for sorting
+    hr = CHL_MmAlloc((PVOID*)&pItems, (SIZE_T)nPairs * 2 * sizeof(FM_SORT_ITEM), NULL);
+    if (SUCCEEDED(hr))
+    {
+        hr = CHL_MmAlloc((PVOID*)&puPos, (SIZE_T)nPairs * sizeof(UINT), NULL);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = CHL_MmAlloc((PVOID*)&ppvKept, (SIZE_T)nPairs * 2 * sizeof(PVOID), NULL);
+    }
+
+    if (SUCCEEDED(hr) && ((piKeySizes != NULL) || (piValSizes != NULL)))
+    {
+        hr = CHL_MmAlloc((PVOID*)&piKeptSizes, (SIZE_T)nPairs * 2 * sizeof(int), NULL);
+    }
+
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    // Keys are checked before they are compared, as CHL_DsInsertFM checks one key
+    for (idx = 0; idx < nPairs; ++idx)
+    {
+        pItems[idx].pvKey = s_GetInputAt(pvKeys, keyValType, idx);
+        pItems[idx].index = idx;
+        if (((pfm->keyType == CHL_KT_STRING) || (pfm->keyType == CHL_KT_WSTRING)) && (pItems[idx].pvKey == NULL))
+        {
+            logerr("%s(): Key %u is NULL.", __FUNCTION__, idx);
+            hr = E_INVALIDARG;
+            goto fend;
+        }
+    }
+    s_SortBatch(pfm, pItems, &pItems[nPairs], nPairs);
+
+    // Of equal keys, the last one is kept. Find where each key goes before changing the map.
+    for (idx = 0; idx < nPairs; idx = idxEnd)
+    {
+        pvKey = pItems[idx].pvKey;
+        for (idxEnd = idx + 1; (idxEnd < nPairs) && (s_CompareKeys(pfm, pvKey, pItems[idxEnd].pvKey) == 0); ++idxEnd);
+
+        idxKept = pItems[idxEnd - 1].index;
+        pos = s_LowerBound(pfm, pvKey, &fExists);
+
+        // The values of the dropped keys are freed once the batch is in the map, except one that is
+        // also the kept value of the key or the value the key has in the map now. A value passed for
+        // the key more than once is freed once.
+        if (pfm->fValIsInHeap && (pfm->valType == CHL_VT_POINTER))
+        {
+            pvVal = s_GetInputAt(pvVals, pfm->valType, idxKept);
+            pvOldVal = fExists ? s_GetHeapVal(pfm, &pfm->raVals, pos) : NULL;
+            nDroppedBefore = nDropped;
+            for (UINT idxDropped = idx; idxDropped < (idxEnd - 1); ++idxDropped)
+            {
+                PVOID pvDropped = s_GetInputAt(pvVals, pfm->valType, pItems[idxDropped].index);
+                UINT idxRecorded;
+
+                if ((pvDropped == NULL) || (pvDropped == pvVal) || (pvDropped == pvOldVal))
+                {
+                    continue;
+                }
+
+                for (idxRecorded = nDroppedBefore;
+                    (idxRecorded < nDropped) && (pItems[nPairs + idxRecorded].pvKey != pvDropped);
+                    ++idxRecorded);
+
+                if (idxRecorded == nDropped)
+                {
+                    pItems[nPairs + nDropped].pvKey = pvDropped;
+                    ++nDropped;
+                }
+            }
+        }
+
+        s_SetInputAt(ppvKept, keyValType, nUnique, s_GetInputAt(pvKeys, keyValType, idxKept));
+        s_SetInputAt(&ppvKept[nPairs], pfm->valType, nUnique, s_GetInputAt(pvVals, pfm->valType, idxKept));
+        if (piKeptSizes != NULL)
+        {
+            piKeptSizes[nUnique] = (piKeySizes != NULL) ? piKeySizes[idxKept] : 0;
+            piKeptSizes[nPairs + nUnique] = (piValSizes != NULL) ? piValSizes[idxKept] : 0;
+        }
+
+        puPos[nUnique] = pos | (fExists ? FM_POS_EXISTS : 0);
+        if (!fExists)
+        {
+            ++nNew;
+        }
+        ++nUnique;
+    }
+
+    // The kept keys and values are copied in key order before the map is changed, so that the map
+    // is left unchanged if a copy fails
+    hr = s_CreateArrays(pfm, &raBatchKeys, &raBatchVals);
+    if (SUCCEEDED(hr))
+    {
+        hr = raBatchKeys.AppendRange(&raBatchKeys, ppvKept, piKeptSizes, nUnique, NULL);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = raBatchVals.AppendRange(&raBatchVals, &ppvKept[nPairs], (piKeptSizes != NULL) ? &piKeptSizes[nPairs] : NULL, nUnique, NULL);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = s_ReserveFor(pfm, pfm->nEntries + nNew);
+    }
+
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    // From the largest key down, the run of entries from where new keys go up to the previous new
+    // keys is moved up by the number of new keys still to go, and the new keys that go in the same
+    // place are moved into the gap below the run together. Every entry of the map is moved at most once.
+    nToInsert = nNew;
+    end = pfm->nEntries;
+    for (idx = nUnique; idx-- > 0; )
+    {
+        pos = puPos[idx] & ~FM_POS_EXISTS;
+        if (puPos[idx] & FM_POS_EXISTS)
+        {
+            pvOldVal = s_GetHeapVal(pfm, &pfm->raVals, pos);
+            if (pvOldVal != s_GetHeapVal(pfm, &raBatchVals, idx))
+            {
+                CHL_MmFree(&pvOldVal);
+            }
+
+            hrTemp = pfm->raVals.MoveRange(&pfm->raVals, pos, &raBatchVals, idx, 1);
+            ASSERT(SUCCEEDED(hrTemp));
+        }
+        else
+        {
+            for (nRun = 1; (nRun <= idx) && (puPos[idx - nRun] == pos); ++nRun);
+            idx -= (nRun - 1);
+
+            s_MoveEntries(pfm, pos + nToInsert, pos, end - pos);
+            nToInsert -= nRun;
+
+            hrTemp = pfm->raKeys.MoveRange(&pfm->raKeys, pos + nToInsert, &raBatchKeys, idx, nRun);
+            ASSERT(SUCCEEDED(hrTemp));
+            hrTemp = pfm->raVals.MoveRange(&pfm->raVals, pos + nToInsert, &raBatchVals, idx, nRun);
+            ASSERT(SUCCEEDED(hrTemp));
+            end = pos;
+        }
+    }
+    ASSERT(nToInsert == 0);
+
+    pfm->nEntries += nNew;
+    s_RebuildEytzinger(pfm);
+
+    for (idx = 0; idx < nDropped; ++idx)
+    {
+        CHL_MmFree(&pItems[nPairs + idx].pvKey);
+    }
+
+fend:
+    if (raBatchKeys.Destroy != NULL)
+    {
+        raBatchKeys.Destroy(&raBatchKeys);
+    }
+
+    if (raBatchVals.Destroy != NULL)
+    {
+        raBatchVals.Destroy(&raBatchVals);
+    }
+
+    CHL_MmFree((PVOID*)&pItems);
+    CHL_MmFree((PVOID*)&puPos);
+    CHL_MmFree((PVOID*)&ppvKept);
+    CHL_MmFree((PVOID*)&piKeptSizes);
+    return hr;
+}
+
+HRESULT CHL_DsFindFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pValSize,
+    _In_opt_ BOOL fGetPointerOnly
+)
+{
+    HRESULT hr = S_OK;
+    UINT index;
+    BOOL fIsKey;
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvKey, pfm->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    index = s_LowerBound(pfm, pvKey, &fIsKey);
+    if (!fIsKey)
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    if (pvVal)
+    {
+        hr = pfm->raVals.Read(&pfm->raVals, index, pvVal, pValSize, fGetPointerOnly);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsRemoveFM(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey, _In_ int iKeySize)
+{
+    HRESULT hr = S_OK;
+    UINT index;
+    BOOL fIsKey;
+    PVOID pvVal;
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvKey, pfm->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    index = s_LowerBound(pfm, pvKey, &fIsKey);
+    if (!fIsKey)
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    pvVal = s_GetHeapVal(pfm, &pfm->raVals, index);
+    CHL_MmFree(&pvVal);
+
+    pfm->raKeys.ClearAt(&pfm->raKeys, index);
+    pfm->raVals.ClearAt(&pfm->raVals, index);
+    s_MoveEntries(pfm, index, index + 1, pfm->nEntries - index - 1);
+
+    --pfm->nEntries;
+    s_RebuildEytzinger(pfm);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsFindMaxFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+)
+{
+    HRESULT hr = E_NOT_SET;
+
+    if (IS_INVALID_CHL_KEYTYPE(pfm->keyType) || IS_INVALID_CHL_VALTYPE(pfm->valType))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (pfm->nEntries > 0)
+    {
+        hr = S_OK;
+        if (pvKeyOut)
+        {
+            hr = pfm->raKeys.Read(&pfm->raKeys, pfm->nEntries - 1, pvKeyOut, pKeySizeOut, fGetPointerOnly);
+        }
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsFindMinFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+)
+{
+    HRESULT hr = E_NOT_SET;
+
+    if (IS_INVALID_CHL_KEYTYPE(pfm->keyType) || IS_INVALID_CHL_VALTYPE(pfm->valType))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (pfm->nEntries > 0)
+    {
+        hr = S_OK;
+        if (pvKeyOut)
+        {
+            hr = pfm->raKeys.Read(&pfm->raKeys, 0, pvKeyOut, pKeySizeOut, fGetPointerOnly);
+        }
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsFindFloorFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+)
+{
+    HRESULT hr = E_NOT_SET;
+    UINT index;
+    BOOL fIsKey;
+
+    if (IS_INVALID_CHL_KEYTYPE(pfm->keyType) || IS_INVALID_CHL_VALTYPE(pfm->valType))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvKey, pfm->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    // floor(k) = Largest key k1 such that k1 <= k, the key before the first key > k
+
+    index = s_LowerBound(pfm, pvKey, &fIsKey);
+    if (!fIsKey)
+    {
+        if (index == 0)
+        {
+            goto fend;
+        }
+        --index;
+    }
+
+    hr = S_OK;
+    if (pvKeyOut)
+    {
+        hr = pfm->raKeys.Read(&pfm->raKeys, index, pvKeyOut, pKeySizeOut, fGetPointerOnly);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsFindCeilFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+)
+{
+    HRESULT hr = E_NOT_SET;
+    UINT index;
+
+    if (IS_INVALID_CHL_KEYTYPE(pfm->keyType) || IS_INVALID_CHL_VALTYPE(pfm->valType))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvKey, pfm->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    // ceil(k) = Smallest key k1 such that k1 >= k, the lower bound of k
+
+    index = s_LowerBound(pfm, pvKey, NULL);
+    if (index < pfm->nEntries)
+    {
+        hr = S_OK;
+        if (pvKeyOut)
+        {
+            hr = pfm->raKeys.Read(&pfm->raKeys, index, pvKeyOut, pKeySizeOut, fGetPointerOnly);
+        }
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsGetAtFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ UINT index,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pValSize,
+    _In_opt_ BOOL fGetPointerOnly
+)
+{
+    HRESULT hr = S_OK;
+
+    if (index >= pfm->nEntries)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+        goto fend;
+    }
+
+    if (pvKeyOut)
+    {
+        hr = pfm->raKeys.Read(&pfm->raKeys, index, pvKeyOut, pKeySizeOut, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr) && pvVal)
+    {
+        hr = pfm->raVals.Read(&pfm->raVals, index, pvVal, pValSize, fGetPointerOnly);
+    }
+
+fend:
+    return hr;
+}
+
+// --------------------------------------------------------
+// Private function definitions
+
+// Keys are stored in a resizable array of the matching value type
+CHL_VALTYPE s_GetKeyValType(_In_ CHL_KEYTYPE keyType)
+{
+    switch (keyType)
+    {
+    case CHL_KT_INT32:
+        return CHL_VT_INT32;
+
+    case CHL_KT_UINT32:
+        return CHL_VT_UINT32;
+
+    case CHL_KT_POINTER:
+        return CHL_VT_POINTER;
+
+    case CHL_KT_STRING:
+        return CHL_VT_STRING;
+
+    case CHL_KT_WSTRING:
+        return CHL_VT_WSTRING;
+
+    default:
+        return CHL_VT_START;
+    }
+}
+
+BOOL s_IsPackable(_In_ CHL_VALTYPE valType)
+{
+    return (valType == CHL_VT_INT32) || (valType == CHL_VT_UINT32) || (valType == CHL_VT_POINTER);
+}
+
+HRESULT s_CreateArrays(_In_ PCHL_FLATMAP pfm, _Out_ PCHL_RARRAY praKeys, _Out_ PCHL_RARRAY praVals)
+{
+    HRESULT hr;
+    CHL_VALTYPE keyValType = s_GetKeyValType(pfm->keyType);
+
+    hr = CHL_DsCreateExRA(praKeys, keyValType, 0, 0, s_IsPackable(keyValType) ? CHL_RA_FLAG_PACKED : 0);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    hr = CHL_DsCreateExRA(praVals, pfm->valType, 0, 0, s_IsPackable(pfm->valType) ? CHL_RA_FLAG_PACKED : 0);
+    if (FAILED(hr))
+    {
+        praKeys->Destroy(praKeys);
+        memset(praKeys, 0, sizeof(*praKeys));
+    }
+
+fend:
+    return hr;
+}
+
+// Makes sure that both arrays can hold nTotal entries. The capacity is doubled, as when appending
+// to a resizable array, so that inserting one key after the other does not reallocate every time.
+HRESULT s_ReserveFor(_In_ PCHL_FLATMAP pfm, _In_ UINT nTotal)
+{
+    HRESULT hr = S_OK;
+    PCHL_RARRAY apra[] = { &pfm->raKeys, &pfm->raVals };
+    UINT capacity;
+
+    for (UINT i = 0; (i < ARRAYSIZE(apra)) && SUCCEEDED(hr); ++i)
+    {
+        capacity = apra[i]->Capacity(apra[i]);
+        if (capacity < nTotal)
+        {
+            capacity = (capacity > (MAXUINT / 2)) ? MAXUINT : (capacity * 2);
+            hr = apra[i]->Reserve(apra[i], max(capacity, nTotal));
+        }
+    }
+
+    return hr;
+}
+
+// Returns the key at the specified index as it is passed to the compare function
+__inline PCVOID s_GetKeyAt(_In_ PCHL_FLATMAP pfm, _In_ PCHL_RARRAY praKeys, _In_ UINT index)
+{
+    switch (pfm->keyType)
+    {
+    case CHL_KT_INT32:
+        return (PCVOID)(INT_PTR)((int*)praKeys->pvPacked)[index];
+
+    case CHL_KT_UINT32:
+        return (PCVOID)(UINT_PTR)((UINT*)praKeys->pvPacked)[index];
+
+    case CHL_KT_POINTER:
+        return ((PVOID*)praKeys->pvPacked)[index];
+
+    default:
+        // Strings are stored as pointers to copies of them
+        return praKeys->pValArray[index].valDef.pvPtr;
+    }
+}
+
+// Negative if pvLeft comes before pvRight, as CHL_BSTREE orders keys
+__inline int s_CompareKeys(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvLeft, _In_ PCVOID pvRight)
+{
+    if (pfm->fnKeyCompare != NULL)
+    {
+        return pfm->fnKeyCompare(pvLeft, pvRight);
+    }
+
+    switch (pfm->keyType)
+    {
+    case CHL_KT_INT32:
+        return ((int)(INT_PTR)pvLeft < (int)(INT_PTR)pvRight) ? -1 : ((int)(INT_PTR)pvLeft > (int)(INT_PTR)pvRight);
+
+    case CHL_KT_UINT32:
+        return ((UINT)(UINT_PTR)pvLeft < (UINT)(UINT_PTR)pvRight) ? -1 : ((UINT)(UINT_PTR)pvLeft > (UINT)(UINT_PTR)pvRight);
+
+    default:
+        return ((UINT_PTR)pvLeft < (UINT_PTR)pvRight) ? -1 : ((UINT_PTR)pvLeft > (UINT_PTR)pvRight);
+    }
+}
+
+BOOL s_IsKeyAt(_In_ PCHL_FLATMAP pfm, _In_ UINT index, _In_ PCVOID pvKey)
+{
+    return (index < pfm->nEntries) && (s_CompareKeys(pfm, s_GetKeyAt(pfm, &pfm->raKeys, index), pvKey) == 0);
+}
+
+// Returns the index of the first key that is not before pvKey, nEntries if there is none, and
+// whether that key is pvKey in pfIsKey
+UINT s_LowerBound(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey, _Out_opt_ PBOOL pfIsKey)
+{
+    UINT index;
+
+    if (pfm->pvEytzinger != NULL)
+    {
+        return s_LowerBoundEytzinger(pfm, pvKey, pfIsKey);
+    }
+
+    index = s_LowerBoundSorted(pfm, pvKey);
+    if (pfIsKey != NULL)
+    {
+        *pfIsKey = s_IsKeyAt(pfm, index, pvKey);
+    }
+    return index;
+}
+
+// Binary search that halves the range without branching on the comparison, so there is no
+// misprediction to pay for when the compiler turns the conditional assignment into a cmov
+UINT s_LowerBoundSorted(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey)
+{
+    UINT base = 0;
+    UINT len = pfm->nEntries;
+    UINT half;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    if (pfm->fnKeyCompare != NULL)
+    {
+        while (len > 1)
+        {
+            half = len / 2;
+            base = (pfm->fnKeyCompare(s_GetKeyAt(pfm, &pfm->raKeys, base + half), pvKey) < 0) ? (base + half) : base;
+            len -= half;
+        }
+        return base + ((pfm->fnKeyCompare(s_GetKeyAt(pfm, &pfm->raKeys, base), pvKey) < 0) ? 1 : 0);
+    }
+
+    switch (pfm->keyType)
+    {
+    case CHL_KT_INT32:
+        {
+            const int *piKeys = (const int*)pfm->raKeys.pvPacked;
+            int iKey = (int)(INT_PTR)pvKey;
+            while (len > 1)
+            {
+                half = len / 2;
+                base = (piKeys[base + half] < iKey) ? (base + half) : base;
+                len -= half;
+            }
+            return base + ((piKeys[base] < iKey) ? 1 : 0);
+        }
+
+    case CHL_KT_UINT32:
+        {
+            const UINT *puKeys = (const UINT*)pfm->raKeys.pvPacked;
+            UINT uKey = (UINT)(UINT_PTR)pvKey;
+            while (len > 1)
+            {
+                half = len / 2;
+                base = (puKeys[base + half] < uKey) ? (base + half) : base;
+                len -= half;
+            }
+            return base + ((puKeys[base] < uKey) ? 1 : 0);
+        }
+
+    default:
+        {
+            const UINT_PTR *puptrKeys = (const UINT_PTR*)pfm->raKeys.pvPacked;
+            UINT_PTR uptrKey = (UINT_PTR)pvKey;
+            while (len > 1)
+            {
+                half = len / 2;
+                base = (puptrKeys[base + half] < uptrKey) ? (base + half) : base;
+                len -= half;
+            }
+            return base + ((puptrKeys[base] < uptrKey) ? 1 : 0);
+        }
+    }
+}
+
+// Goes down the Eytzinger tree, right after every key that is before pvKey and left otherwise,
+// until it falls off the tree. The lower bound is the last key the search went left at. Going
+// right appends a 1 bit to k and going left a 0 bit, so that key is found by dropping the 1 bits
+// of the moves after it along with the 0 bit of the move itself.
+UINT s_LowerBoundEytzinger(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey, _Out_opt_ PBOOL pfIsKey)
+{
+    UINT n = pfm->nEntries;
+    UINT k = 1;
+    DWORD dwIndex;
+    PBYTE pbLines = (PBYTE)pfm->pvEytzinger;
+
+    if (pfm->fnKeyCompare != NULL)
+    {
+        PVOID *ppvKeys = (PVOID*)pfm->pvEytzinger;
+        while (k <= n)
+        {
+            FM_PREFETCH(pbLines + ((SIZE_T)k * FM_CACHE_LINE_SIZE));
+            k = (2 * k) + ((pfm->fnKeyCompare(ppvKeys[k], pvKey) < 0) ? 1 : 0);
+        }
+    }
+    else
+    {
+        switch (pfm->keyType)
+        {
+        case CHL_KT_INT32:
+            {
+                const int *piKeys = (const int*)pfm->pvEytzinger;
+                int iKey = (int)(INT_PTR)pvKey;
+                while (k <= n)
+                {
+                    FM_PREFETCH(pbLines + ((SIZE_T)k * FM_CACHE_LINE_SIZE));
+                    k = (2 * k) + ((piKeys[k] < iKey) ? 1 : 0);
+                }
+                break;
+            }
+
+        case CHL_KT_UINT32:
+            {
+                const UINT *puKeys = (const UINT*)pfm->pvEytzinger;
+                UINT uKey = (UINT)(UINT_PTR)pvKey;
+                while (k <= n)
+                {
+                    FM_PREFETCH(pbLines + ((SIZE_T)k * FM_CACHE_LINE_SIZE));
+                    k = (2 * k) + ((puKeys[k] < uKey) ? 1 : 0);
+                }
+                break;
+            }
+
+        default:
+            {
+                const UINT_PTR *puptrKeys = (const UINT_PTR*)pfm->pvEytzinger;
+                UINT_PTR uptrKey = (UINT_PTR)pvKey;
+                while (k <= n)
+                {
+                    FM_PREFETCH(pbLines + ((SIZE_T)k * FM_CACHE_LINE_SIZE));
+                    k = (2 * k) + ((puptrKeys[k] < uptrKey) ? 1 : 0);
+                }
+                break;
+            }
+        }
+    }
+
+    // k is at most 2n+1 < MAXUINT, so ~k has a bit set. k is 0 if the search never went left.
+    _BitScanForward(&dwIndex, ~k);
+    k >>= (dwIndex + 1);
+
+    // The key at k was the last one compared, so it is checked here while it is in the cache
+    if (pfIsKey != NULL)
+    {
+        *pfIsKey = (k != 0) && (s_CompareKeys(pfm, s_GetEytzingerKeyAt(pfm, k), pvKey) == 0);
+    }
+    return (k == 0) ? n : pfm->puEytzingerIndex[k];
+}
+
+// Moves nEntries keys and values within the map. The arrays have room for them, so this cannot fail.
+void s_MoveEntries(_In_ PCHL_FLATMAP pfm, _In_ UINT destIndex, _In_ UINT srcIndex, _In_ UINT nEntries)
+{
+    HRESULT hrTemp;
+
+    hrTemp = pfm->raKeys.MoveRange(&pfm->raKeys, destIndex, &pfm->raKeys, srcIndex, nEntries);
+    ASSERT(SUCCEEDED(hrTemp));
+    hrTemp = pfm->raVals.MoveRange(&pfm->raVals, destIndex, &pfm->raVals, srcIndex, nEntries);
+    ASSERT(SUCCEEDED(hrTemp));
+}
+
+// Returns the value at the specified index if the map frees it when it is removed, NULL otherwise
+PVOID s_GetHeapVal(_In_ PCHL_FLATMAP pfm, _In_ PCHL_RARRAY praVals, _In_ UINT index)
+{
+    PVOID pvVal = NULL;
+
+    if (pfm->fValIsInHeap && (pfm->valType == CHL_VT_POINTER))
+    {
+        if (FAILED(praVals->Read(praVals, index, &pvVal, NULL, TRUE)))
+        {
+            pvVal = NULL;
+        }
+    }
+    return pvVal;
+}
+
+// Returns an element of an array of keys or values as passed to CHL_DsInsertBatchFM: of 32-bit
+// integers for CHL_VT_INT32 and CHL_VT_UINT32, of pointers otherwise
+__inline PVOID s_GetInputAt(_In_ PCVOID pvArray, _In_ CHL_VALTYPE valType, _In_ UINT index)
+{
+    switch (valType)
+    {
+    case CHL_VT_INT32:
+        return (PVOID)(INT_PTR)((const int*)pvArray)[index];
+
+    case CHL_VT_UINT32:
+        return (PVOID)(UINT_PTR)((const UINT*)pvArray)[index];
+
+    default:
+        return ((PVOID const*)pvArray)[index];
+    }
+}
+
+// Sets an element of an array of keys or values laid out as for s_GetInputAt
+__inline void s_SetInputAt(_Inout_ PVOID pvArray, _In_ CHL_VALTYPE valType, _In_ UINT index, _In_ PVOID pvVal)
+{
+    if ((valType == CHL_VT_INT32) || (valType == CHL_VT_UINT32))
+    {
+        ((PUINT)pvArray)[index] = (UINT)(UINT_PTR)pvVal;
+    }
+    else
+    {
+        ((PVOID*)pvArray)[index] = pvVal;
+    }
+}
+
+// Sorts the items by their key, keeping the order of equal keys.
+// Runs are sorted by insertion, then merged in pairs back and forth with pScratch.
+void s_SortBatch(
+    _In_ PCHL_FLATMAP pfm,
+    _Inout_ FM_SORT_ITEM *pItems,
+    _In_ FM_SORT_ITEM *pScratch,
+    _In_ UINT nItems)
+{
+    FM_SORT_ITEM *pSrc = pItems;
+    FM_SORT_ITEM *pDst = pScratch;
+    FM_SORT_ITEM *pTemp;
+    FM_SORT_ITEM cur;
+    UINT start, mid, end, a, b, out, width;
+
+    for (start = 0; start < nItems; start += FM_SORT_RUN)
+    {
+        end = min(start + FM_SORT_RUN, nItems);
+        for (a = start + 1; a < end; ++a)
+        {
+            cur = pItems[a];
+            for (b = a; (b > start) && (s_CompareKeys(pfm, cur.pvKey, pItems[b - 1].pvKey) < 0); --b)
+            {
+                pItems[b] = pItems[b - 1];
+            }
+            pItems[b] = cur;
+        }
+    }
+
+    for (width = FM_SORT_RUN; width < nItems; width *= 2)
+    {
+        for (start = 0; start < nItems; start += min(2 * width, nItems - start))
+        {
+            mid = start + min(width, nItems - start);
+            end = mid + min(width, nItems - mid);
+
+            // Take from the left run unless the right key comes first, so equal keys keep their order
+            a = start;
+            b = mid;
+            out = start;
+            while ((a < mid) && (b < end))
+            {
+                if (s_CompareKeys(pfm, pSrc[b].pvKey, pSrc[a].pvKey) < 0)
+                {
+                    pDst[out++] = pSrc[b++];
+                }
+                else
+                {
+                    pDst[out++] = pSrc[a++];
+                }
+            }
+            memcpy(&pDst[out], &pSrc[a], (SIZE_T)(mid - a) * sizeof(FM_SORT_ITEM));
+            out += mid - a;
+            memcpy(&pDst[out], &pSrc[b], (SIZE_T)(end - b) * sizeof(FM_SORT_ITEM));
+        }
+
+        pTemp = pSrc;
+        pSrc = pDst;
+        pDst = pTemp;
+    }
+
+    if (pSrc != pItems)
+    {
+        memcpy(pItems, pSrc, (SIZE_T)nItems * sizeof(FM_SORT_ITEM));
+    }
+}
+
+// Lays out the keys again after the map changed. If there is no memory for that, the Eytzinger
+// keys are freed and searches use the sorted keys until the next change.
+void s_RebuildEytzinger(_In_ PCHL_FLATMAP pfm)
+{
+    UINT nNeeded = pfm->nEntries + 1;
+    UINT newCapacity;
+    SIZE_T cbKey = (pfm->fnKeyCompare != NULL) ? sizeof(PVOID) : pfm->raKeys.cbPackedVal;
+
+    if (!pfm->fEytzinger)
+    {
+        return;
+    }
+
+    if (nNeeded > pfm->nEytzingerCapacity)
+    {
+        s_FreeEytzinger(pfm);
+
+        // Room for a quarter more keys, so that inserting one key at a time does not reallocate every time
+        newCapacity = nNeeded + (nNeeded / 4);
+        if ((SIZE_T)newCapacity > (MAXSIZE_T / cbKey))
+        {
+            return;
+        }
+
+        pfm->pvEytzinger = _aligned_malloc((SIZE_T)newCapacity * cbKey, FM_CACHE_LINE_SIZE);
+        if ((pfm->pvEytzinger == NULL) ||
+            FAILED(CHL_MmAlloc((PVOID*)&pfm->puEytzingerIndex, (SIZE_T)newCapacity * sizeof(UINT), NULL)))
+        {
+            logerr("%s(): Cannot allocate %u Eytzinger keys", __FUNCTION__, newCapacity);
+            s_FreeEytzinger(pfm);
+            return;
+        }
+        pfm->nEytzingerCapacity = newCapacity;
+    }
+
+    s_FillEytzinger(pfm, 0, 1);
+}
+
+// Returns the key at node k of the Eytzinger layout, as s_GetKeyAt does for the sorted keys
+__inline PCVOID s_GetEytzingerKeyAt(_In_ PCHL_FLATMAP pfm, _In_ UINT k)
+{
+    if (pfm->fnKeyCompare != NULL)
+    {
+        return ((PVOID*)pfm->pvEytzinger)[k];
+    }
+
+    switch (pfm->keyType)
+    {
+    case CHL_KT_INT32:
+        return (PCVOID)(INT_PTR)((int*)pfm->pvEytzinger)[k];
+
+    case CHL_KT_UINT32:
+        return (PCVOID)(UINT_PTR)((UINT*)pfm->pvEytzinger)[k];
+
+    default:
+        return (PCVOID)((UINT_PTR*)pfm->pvEytzinger)[k];
+    }
+}
+
+// Fills the subtree at k with the keys from index on in an in-order walk, returns the index of the next key
+UINT s_FillEytzinger(_In_ PCHL_FLATMAP pfm, _In_ UINT index, _In_ UINT k)
+{
+    PVOID pvKey;
+
+    if (k > pfm->nEntries)
+    {
+        return index;
+    }
+
+    index = s_FillEytzinger(pfm, index, 2 * k);
+
+    pvKey = s_GetKeyAt(pfm, &pfm->raKeys, index);
+    if (pfm->fnKeyCompare != NULL)
+    {
+        ((PVOID*)pfm->pvEytzinger)[k] = (PVOID)pvKey;
+    }
+    else if (pfm->keyType == CHL_KT_POINTER)
+    {
+        ((UINT_PTR*)pfm->pvEytzinger)[k] = (UINT_PTR)pvKey;
+    }
+    else
+    {
+        ((UINT*)pfm->pvEytzinger)[k] = (UINT)(UINT_PTR)pvKey;
+    }
+    pfm->puEytzingerIndex[k] = index;
+
+    return s_FillEytzinger(pfm, index + 1, (2 * k) + 1);
+}
+
+void s_FreeEytzinger(_In_ PCHL_FLATMAP pfm)
+{
+    if (pfm->pvEytzinger != NULL)
+    {
+        _aligned_free(pfm->pvEytzinger);
+        pfm->pvEytzinger = NULL;
+    }
+
+    CHL_MmFree((PVOID*)&pfm->puEytzingerIndex);
+    pfm->nEytzingerCapacity = 0;
+}
@@ -0,0 +1,306 @@
+// FlatMap.h
+// Ordered map stored as sorted arrays of keys and values, for read-mostly ordered lookups
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#ifndef _FLATMAP_H
+#define _FLATMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Defines.h"
+#include "MemFunctions.h"
+#include "RArray.h"
+
+// Flags for CHL_DsCreateExFM
+#define CHL_FM_FLAG_EYTZINGER   0x00000001  // Keep a copy of the keys in Eytzinger order for searching
+
+// The flat map object. Keys are kept sorted in one resizable array and the value of each key
+// at the same index of another, so a search touches only the keys and no memory is allocated
+// per entry. Integer and pointer keys and values are stored packed, see CHL_RA_FLAG_PACKED.
+typedef struct _flatMap CHL_FLATMAP, *PCHL_FLATMAP;
+struct _flatMap {
+    CHL_KEYTYPE keyType;
+    CHL_VALTYPE valType;
+    BOOL        fValIsInHeap;
+    UINT        nEntries;       // Number of key-value pairs, at indexes 0 to nEntries - 1 of both arrays
+
+    CHL_CompareFn fnKeyCompare; // NULL if integer and pointer keys are ordered by their value
+    CHL_RARRAY  raKeys;         // Keys in ascending order
+    CHL_RARRAY  raVals;         // The value of each key, at the same index as the key
+
+    // Created with CHL_FM_FLAG_EYTZINGER: the keys laid out as a complete binary search tree in
+    // breadth-first order. The children of the key at index k are at 2k and 2k+1, index 0 is not
+    // used. NULL if memory could not be allocated, searches then use the sorted keys.
+    BOOL        fEytzinger;
+    PVOID       pvEytzinger;        // Keys as int, UINT or PVOID, aligned to a cache line
+    PUINT       puEytzingerIndex;   // Index in raKeys of each key in pvEytzinger
+    UINT        nEytzingerCapacity; // Number of keys pvEytzinger and puEytzingerIndex can hold
+
+    // Pointers to flat map methods
+
+    HRESULT(*Destroy)(_In_ PCHL_FLATMAP pfm);
+
+    HRESULT(*Insert)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _In_ PCVOID pvKey,
+            _In_ int iKeySize,
+            _In_ PCVOID pvVal,
+            _In_ int iValSize
+            );
+
+    HRESULT(*InsertBatch)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _In_ PCVOID pvKeys,
+            _In_opt_ const int *piKeySizes,
+            _In_ PCVOID pvVals,
+            _In_opt_ const int *piValSizes,
+            _In_ UINT nPairs
+            );
+
+    HRESULT(*Find)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _In_ PCVOID pvKey,
+            _In_ int iKeySize,
+            _Inout_opt_ PVOID pvVal,
+            _Inout_opt_ PINT pValSize,
+            _In_opt_ BOOL fGetPointerOnly
+            );
+
+    HRESULT(*Remove)(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey, _In_ int iKeySize);
+
+    HRESULT(*FindMax)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _Inout_opt_ PVOID pvKeyOut,
+            _Inout_opt_ PINT pKeySizeOut,
+            _In_opt_ BOOL fGetPointerOnly
+            );
+
+    HRESULT(*FindMin)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _Inout_opt_ PVOID pvKeyOut,
+            _Inout_opt_ PINT pKeySizeOut,
+            _In_opt_ BOOL fGetPointerOnly
+            );
+
+    HRESULT(*FindFloor)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _In_ PCVOID pvKey,
+            _In_ int iKeySize,
+            _Inout_opt_ PVOID pvKeyOut,
+            _Inout_opt_ PINT pKeySizeOut,
+            _In_opt_ BOOL fGetPointerOnly
+            );
+
+    HRESULT(*FindCeil)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _In_ PCVOID pvKey,
+            _In_ int iKeySize,
+            _Inout_opt_ PVOID pvKeyOut,
+            _Inout_opt_ PINT pKeySizeOut,
+            _In_opt_ BOOL fGetPointerOnly
+            );
+
+    HRESULT(*GetAt)
+        (
+            _In_ PCHL_FLATMAP pfm,
+            _In_ UINT index,
+            _Inout_opt_ PVOID pvKeyOut,
+            _Inout_opt_ PINT pKeySizeOut,
+            _Inout_opt_ PVOID pvVal,
+            _Inout_opt_ PINT pValSize,
+            _In_opt_ BOOL fGetPointerOnly
+            );
+};
+
+// -------------------------------------------
+// Functions exported
+
+// Creates a flat map. It has the same key and value semantics as CHL_BSTREE and orders keys as
+// CHL_BSTREE does, so the same compare function can be used with both: the key passed as pvLeft
+// comes first if the function returns a negative number. Finding a key is a binary search over the
+// sorted keys. Inserting or removing a key moves the keys and values after it, so a large map is
+// best filled with CHL_DsInsertBatchFM.
+// Params:
+//      pfm             : Pointer to a CHL_FLATMAP object to initialize
+//      keyType         : Type of variable that is used as key - refer to definition of CHL_KEYTYPE
+//      valType         : Type of value that is stored - refer to definition of CHL_VALTYPE
+//      pfnKeyCompare   : Pointer to function of type CHL_CompareFn that can compare two keys. Optional for
+//                        keys of type CHL_KT_INT32, CHL_KT_UINT32 and CHL_KT_POINTER, which are then
+//                        ordered by their value without calling a function.
+//      fValInHeapMem   : Set this to true if the value (type is CHL_VT_POINTER) is allocated memory on the heap.
+//                        This indicates the map to free it when an entry is removed.
+//
+DllExpImp HRESULT CHL_DsCreateFM
+(
+    _Out_ PCHL_FLATMAP pfm,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ CHL_CompareFn pfnKeyCompare,
+    _In_opt_ BOOL fValInHeapMem
+);
+
+// Same as CHL_DsCreateFM, with flags that select a variant of the map.
+// With CHL_FM_FLAG_EYTZINGER, the map also keeps the keys in Eytzinger order: the order of a
+// complete binary search tree read level by level. A search goes down the tree with a compare and
+// an add per level and no unpredictable branch, and fetches the keys of four levels further down
+// ahead of time, since they are next to each other. This is faster than a binary search once the
+// keys do not fit in the processor caches, for a copy of the keys plus 4 bytes per key that is
+// rebuilt by every call that changes the map.
+// Params:
+//      pfm, keyType, valType, pfnKeyCompare, fValInHeapMem: Same as for CHL_DsCreateFM.
+//      dwFlags         : Zero or CHL_FM_FLAG_EYTZINGER.
+//
+DllExpImp HRESULT CHL_DsCreateExFM
+(
+    _Out_ PCHL_FLATMAP pfm,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ CHL_CompareFn pfnKeyCompare,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ DWORD dwFlags
+);
+
+// Destroy the map by removing all key-value pairs from it.
+// Params:
+//      pfm: Pointer to the flat map object initialized by CHL_DsCreateFM function.
+//
+DllExpImp HRESULT CHL_DsDestroyFM(_In_ PCHL_FLATMAP pfm);
+
+// Inserts a key,value pair into the map. If the key already exists, then the value is over-written
+// with the new value.
+// Params: Refer documentation of the CHL_DsInsertBST() function.
+//
+DllExpImp HRESULT CHL_DsInsertFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize
+);
+
+// Inserts several key,value pairs into the map at once, as if they were inserted one after the other:
+// of equal keys, the value inserted last is kept and, if the map frees values, the others are freed.
+// The pairs are sorted by key and only the kept ones are copied. The keys and values of the map are
+// then moved once each, in runs between the places where new keys go, and the new keys that go in
+// the same place are moved in together. If a key or value cannot be copied, the map is left unchanged.
+// Params:
+//      pfm         : Pointer to the flat map object initialized by CHL_DsCreateFM function.
+//      pvKeys      : Array of nPairs keys: of int for CHL_KT_INT32, of UINT for CHL_KT_UINT32 and of
+//                    pointers for other key types.
+//      piKeySizes  : Optional. Array of nPairs key sizes in bytes, as iKeySize of CHL_DsInsertFM.
+//      pvVals      : Array of nPairs values, as passed to CHL_DsWriteRangeRA.
+//      piValSizes  : Optional. Array of nPairs value sizes in bytes, as iValSize of CHL_DsInsertFM.
+//                    Required for CHL_VT_USEROBJECT.
+//      nPairs      : Number of key,value pairs.
+//
+DllExpImp HRESULT CHL_DsInsertBatchFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKeys,
+    _In_opt_ const int *piKeySizes,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piValSizes,
+    _In_ UINT nPairs
+);
+
+// Find the specified key in the map.
+// Params: Refer documentation of the CHL_DsFindBST() function.
+//
+DllExpImp HRESULT CHL_DsFindFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pValSize,
+    _In_opt_ BOOL fGetPointerOnly
+);
+
+// Deletes the specified key and its value from the map. Returns E_NOT_SET if the key is not in the map.
+// Params:
+//      pfm     : Pointer to the flat map object initialized by CHL_DsCreateFM function.
+//      pvKey   : Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//
+DllExpImp HRESULT CHL_DsRemoveFM(_In_ PCHL_FLATMAP pfm, _In_ PCVOID pvKey, _In_ int iKeySize);
+
+// Get the maximum, minimum, floor or ceil key in the map.
+// Params: Refer documentation of the CHL_DsFindMaxBST(), CHL_DsFindMinBST(), CHL_DsFindFloorBST()
+//         and CHL_DsFindCeilBST() functions.
+//
+DllExpImp HRESULT CHL_DsFindMaxFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+);
+
+DllExpImp HRESULT CHL_DsFindMinFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+);
+
+DllExpImp HRESULT CHL_DsFindFloorFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+);
+
+DllExpImp HRESULT CHL_DsFindCeilFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ PCVOID pvKey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _In_opt_ BOOL fGetPointerOnly
+);
+
+// Get the key and value at the specified position in key order, 0 for the minimum key.
+// Returns HRESULT_FROM_WIN32(ERROR_INVALID_INDEX) if index is not below pfm->nEntries.
+// Params:
+//      pfm             : Pointer to the flat map object initialized by CHL_DsCreateFM function.
+//      index           : Position of the key,value pair.
+//      pvKeyOut        : Optional. Pointer to buffer to receive the key.
+//      pKeySizeOut     : Optional. Size of the key buffer in bytes, as for CHL_DsFindMinBST.
+//      pvVal           : Optional. Pointer to buffer to receive the value.
+//      pValSize        : Optional. Size of the value buffer in bytes, as for CHL_DsFindBST.
+//      fGetPointerOnly : Applies to both the key and the value, as for CHL_DsFindBST.
+//
+DllExpImp HRESULT CHL_DsGetAtFM
+(
+    _In_ PCHL_FLATMAP pfm,
+    _In_ UINT index,
+    _Inout_opt_ PVOID pvKeyOut,
+    _Inout_opt_ PINT pKeySizeOut,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pValSize,
+    _In_opt_ BOOL fGetPointerOnly
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _FLATMAP_H
@@ -0,0 +1,216 @@
+
+// HashFunctions.c
+// Seeded 64bit hash functions used by the hashtables
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//      10/17/26 Seed shared by all tables of the process
+//      10/17/26 Key hash shared by the flat hashtable and the caches
+//
+
+#define _CRT_RAND_S     // rand_s
+#include <stdlib.h>
+
+#include "HashFunctions.h"
+
+#if defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// Default secret of wyhash final version 4
+static const ULONGLONG s_wySecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL };
+
+static volatile LONG s_lSeedCounter = 0;
+static volatile LONGLONG s_llSharedSeed = 0;   // Seed of CHL_HT_HASH_SHARED64, 0 until first used
+
+// File-local Functions
+static __inline void _Mum(_Inout_ ULONGLONG *pullA, _Inout_ ULONGLONG *pullB);
+static __inline ULONGLONG _Mix(_In_ ULONGLONG ullA, _In_ ULONGLONG ullB);
+static __inline ULONGLONG _Read8(_In_ const BYTE *pb);
+static __inline ULONGLONG _Read4(_In_ const BYTE *pb);
+
+// 64x64 -> 128bit multiply, low half into *pullA and high half into *pullB
+void _Mum(_Inout_ ULONGLONG *pullA, _Inout_ ULONGLONG *pullB)
+{
+#if defined(_M_X64)
+    *pullA = _umul128(*pullA, *pullB, pullB);
+#else
+    ULONGLONG ha = *pullA >> 32, hb = *pullB >> 32;
+    ULONGLONG la = (DWORD)*pullA, lb = (DWORD)*pullB;
+    ULONGLONG rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    ULONGLONG t = rl + (rm0 << 32);
+    ULONGLONG c = (t < rl);
+    ULONGLONG lo = t + (rm1 << 32);
+    c += (lo < t);
+    *pullA = lo;
+    *pullB = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+ULONGLONG _Mix(_In_ ULONGLONG ullA, _In_ ULONGLONG ullB)
+{
+    _Mum(&ullA, &ullB);
+    return ullA ^ ullB;
+}
+
+ULONGLONG _Read8(_In_ const BYTE *pb)
+{
+    ULONGLONG ull;
+    memcpy(&ull, pb, sizeof(ull));
+    return ull;
+}
+
+ULONGLONG _Read4(_In_ const BYTE *pb)
+{
+    DWORD dw;
+    memcpy(&dw, pb, sizeof(dw));
+    return dw;
+}
+
+ULONGLONG _GenerateHashSeed(void)
+{
+    UINT uRand[2];
+    LARGE_INTEGER liCounter;
+
+    if ((rand_s(&uRand[0]) == 0) && (rand_s(&uRand[1]) == 0))
+    {
+        return ((ULONGLONG)uRand[0] << 32) | uRand[1];
+    }
+
+    // Not expected to fail, but a distinct seed per table is still better than a fixed one
+    logwarn("%s(): rand_s() failed, deriving seed from counters", __FUNCTION__);
+    QueryPerformanceCounter(&liCounter);
+    return _Mix((ULONGLONG)liCounter.QuadPart ^ s_wySecret[0],
+        ((ULONGLONG)InterlockedIncrement(&s_lSeedCounter) << 32) ^ GetCurrentThreadId() ^ s_wySecret[1]);
+}
+
+// Threads that generate the seed at the same time all return the one that was stored first.
+// The seed is read with an interlocked operation since 64bit reads are not atomic on x86.
+ULONGLONG _GetSharedHashSeed(void)
+{
+    LONGLONG llSeed;
+    LONGLONG llNewSeed;
+
+    llSeed = InterlockedCompareExchange64(&s_llSharedSeed, 0, 0);
+    if (llSeed == 0)
+    {
+        // Never 0, which means not generated yet
+        llNewSeed = (LONGLONG)(_GenerateHashSeed() | 1);
+        llSeed = InterlockedCompareExchange64(&s_llSharedSeed, llNewSeed, 0);
+        if (llSeed == 0)
+        {
+            llSeed = llNewSeed;
+        }
+    }
+    return (ULONGLONG)llSeed;
+}
+
+// wyhash final version 4 by Wang Yi, released into the public domain.
+// See https://github.com/wangyi-fudan/wyhash
+ULONGLONG _HashBytes64(_In_bytecount_c_(cbData) const void *pvData, _In_ size_t cbData, _In_ ULONGLONG ullSeed)
+{
+    const BYTE *pb = (const BYTE*)pvData;
+    ULONGLONG ullA;
+    ULONGLONG ullB;
+
+    ullSeed ^= _Mix(ullSeed ^ s_wySecret[0], s_wySecret[1]);
+    if (cbData <= 16)
+    {
+        if (cbData >= 4)
+        {
+            ullA = (_Read4(pb) << 32) | _Read4(pb + ((cbData >> 3) << 2));
+            ullB = (_Read4(pb + cbData - 4) << 32) | _Read4(pb + cbData - 4 - ((cbData >> 3) << 2));
+        }
+        else if (cbData > 0)
+        {
+            ullA = ((ULONGLONG)pb[0] << 16) | ((ULONGLONG)pb[cbData >> 1] << 8) | pb[cbData - 1];
+            ullB = 0;
+        }
+        else
+        {
+            ullA = ullB = 0;
+        }
+    }
+    else
+    {
+        size_t cbLeft = cbData;
+        if (cbLeft > 48)
+        {
+            ULONGLONG ullSeed1 = ullSeed;
+            ULONGLONG ullSeed2 = ullSeed;
+            do
+            {
+                ullSeed = _Mix(_Read8(pb) ^ s_wySecret[1], _Read8(pb + 8) ^ ullSeed);
+                ullSeed1 = _Mix(_Read8(pb + 16) ^ s_wySecret[2], _Read8(pb + 24) ^ ullSeed1);
+                ullSeed2 = _Mix(_Read8(pb + 32) ^ s_wySecret[3], _Read8(pb + 40) ^ ullSeed2);
+                pb += 48;
+                cbLeft -= 48;
+            } while (cbLeft > 48);
+            ullSeed ^= ullSeed1 ^ ullSeed2;
+        }
+
+        while (cbLeft > 16)
+        {
+            ullSeed = _Mix(_Read8(pb) ^ s_wySecret[1], _Read8(pb + 8) ^ ullSeed);
+            pb += 16;
+            cbLeft -= 16;
+        }
+
+        // Last 16 bytes, overlapping with what was already consumed
+        ullA = _Read8(pb + cbLeft - 16);
+        ullB = _Read8(pb + cbLeft - 8);
+    }
+
+    ullA ^= s_wySecret[1];
+    ullB ^= ullSeed;
+    _Mum(&ullA, &ullB);
+    return _Mix(ullA ^ s_wySecret[0] ^ cbData, ullB ^ s_wySecret[1]);
+}
+
+ULONGLONG _HashUInt64(_In_ ULONGLONG ullValue, _In_ ULONGLONG ullSeed)
+{
+    ULONGLONG ullA = ullValue ^ s_wySecret[0];
+    ULONGLONG ullB = ullSeed ^ s_wySecret[1];
+    _Mum(&ullA, &ullB);
+    return _Mix(ullA ^ s_wySecret[2], ullB ^ s_wySecret[3]);
+}
+
+ULONGLONG _HashKeyBytes64(_In_ PCVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize, _In_ ULONGLONG ullSeed)
+{
+    ULONGLONG ullHash = 0;
+
+    ASSERT(IS_VALID_CHL_KEYTYPE(keyType));
+
+    switch (keyType)
+    {
+    case CHL_KT_INT32:
+    case CHL_KT_UINT32:
+        {
+            // Only the low 32bits are significant, same as in _IsDuplicateKey
+            ullHash = _HashUInt64((UINT)(UINT_PTR)pvKey, ullSeed);
+            break;
+        }
+
+    case CHL_KT_POINTER:
+        {
+            ullHash = _HashUInt64((ULONGLONG)(UINT_PTR)pvKey, ullSeed);
+            break;
+        }
+
+    case CHL_KT_STRING:
+    case CHL_KT_WSTRING:
+        {
+            ullHash = _HashBytes64(pvKey, (size_t)iKeySize, ullSeed);
+            break;
+        }
+
+    default:
+        {
+            logerr("%s(): Invalid keyType %d", __FUNCTION__, keyType);
+            ASSERT(!L"Invalid keytype");
+            break;
+        }
+    }
+    return ullHash;
+}
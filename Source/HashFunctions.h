@@ -0,0 +1,59 @@
+
+// HashFunctions.h
+// Seeded 64bit hash functions used by the hashtables
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//      10/17/26 fmix64 finalizer for integer keyed tables
+//      10/17/26 Seed shared by all tables of the process
+//      10/17/26 Key hash shared by the flat hashtable and the caches
+//
+
+#ifndef _CHL_HASHFUNCTIONS_H
+#define _CHL_HASHFUNCTIONS_H
+
+#include "InternalDefines.h"
+
+// -------------------------------------------
+// Functions internal only
+
+// Returns a random seed for a new table, so that the bucket of a key
+// cannot be predicted by whoever supplies the keys.
+ULONGLONG _GenerateHashSeed(void);
+
+// Returns the seed of CHL_HT_HASH_SHARED64, generated by the first call in the process
+ULONGLONG _GetSharedHashSeed(void);
+
+// wyhash (final version 4) over cbData bytes, reads 8 bytes at a time
+ULONGLONG _HashBytes64(_In_bytecount_c_(cbData) const void *pvData, _In_ size_t cbData, _In_ ULONGLONG ullSeed);
+
+// Seeded hash of a single 64bit value, for integer and pointer keys
+ULONGLONG _HashUInt64(_In_ ULONGLONG ullValue, _In_ ULONGLONG ullSeed);
+
+// Seeded hash of a key as passed to CHL_FHTABLE, CHL_LRU and CHL_TTLCACHE. String keys are hashed
+// as all of their iKeySize bytes, consistent with _IsSameKeyBytes.
+ULONGLONG _HashKeyBytes64(_In_ PCVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize, _In_ ULONGLONG ullSeed);
+
+// MurmurHash3's 64bit finalizer (fmix64) over the seeded value. Two multiplies and three
+// shifts, inlined so that integer keyed tables hash without a call. Every input bit
+// affects every output bit, so aligned pointers do not cluster.
+static __inline ULONGLONG _FinalizeHash64(_In_ ULONGLONG ullValue, _In_ ULONGLONG ullSeed)
+{
+    ULONGLONG ullHash = ullValue ^ ullSeed;
+
+    ullHash ^= ullHash >> 33;
+    ullHash *= 0xff51afd7ed558ccdULL;
+    ullHash ^= ullHash >> 33;
+    ullHash *= 0xc4ceb9fe1a85ec53ULL;
+    ullHash ^= ullHash >> 33;
+    return ullHash;
+}
+
+// Maps a hash uniformly onto [0, nBuckets) using a multiply and shift instead of a divide.
+// Uses the high bits of the hash, which are the best mixed ones.
+static __inline DWORD _ReduceHash64(_In_ ULONGLONG ullHash, _In_ DWORD nBuckets)
+{
+    return (DWORD)(((ullHash >> 32) * nBuckets) >> 32);
+}
+
+#endif // _CHL_HASHFUNCTIONS_H
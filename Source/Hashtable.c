@@ -1,31 +1,186 @@
 
 
 #include "InternalDefines.h"
+#include "HashFunctions.h"
+#include "EpochFunctions.h"
 #include "Hashtable.h"
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <xmmintrin.h>
+#define HT_PREFETCH(p)      _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define HT_PREFETCH(p)      ((void)(p))
+#endif
+
 #define HT_ITR_FIRST    0xdeedbeed
 #define HT_ITR_NEXT     0xabcddcba
 
+// Default load factors, in percent of #entries per bucket
+#define HT_DEFAULT_GROW_LOAD_PCT    100
+#define HT_DEFAULT_SHRINK_LOAD_PCT  10
+
+// A resize picks the smallest size that is at least twice the #entries. Since successive
+// sizes roughly double, the resized table is 25%-50% full. The grow and shrink thresholds
+// must lie outside of this range or the table would resize again right away.
+#define HT_RESIZE_ENTRIES_MULTIPLIER    2
+#define HT_MIN_GROW_LOAD_PCT            50
+#define HT_MAX_SHRINK_LOAD_PCT          25
+
+// Bounds on the work done by one incremental migration step
+#define HT_MIGRATE_BUCKETS_PER_STEP     4
+#define HT_MIGRATE_MAX_EMPTY_VISITS     (HT_MIGRATE_BUCKETS_PER_STEP * 10)
+
+// Batch operations hash and prefetch this many keys before looking up any of them
+#define HT_BATCH_GROUP_SIZE     16
+
+// Lookup counters are only kept when built with CHL_HT_ENABLE_COUNTERS, and only
+// for tables used by one thread at a time so that lookups do not share a cache line.
+#ifdef CHL_HT_ENABLE_COUNTERS
+#define HT_COUNTERS(phtable)    (((phtable)->fConcurrent || ((phtable)->pLockFree != NULL)) ? NULL : &(phtable)->counters)
+#else
+#define HT_COUNTERS(phtable)    ((CHL_HT_COUNTERS*)NULL)
+#endif
+
+// Concurrent tables guard bucket i with lock (i % HT_LOCK_STRIPES), a power of 2. Each lock
+// is on its own cache line so that threads using different stripes do not contend.
+#define HT_LOCK_STRIPES         256
+#define HT_CACHE_LINE_SIZE      64
+#define HT_ALL_STRIPES          (-1)
+
+struct _htStripeLock {
+    union {
+        SRWLOCK srwLock;
+        BYTE abCacheLine[HT_CACHE_LINE_SIZE];
+    };
+};
+
+// Tables with lock-free reads keep every node in the chain after the bucket, the node
+// in the bucket itself is never occupied. Nodes are not modified after they are published,
+// other than their pnext. Readers follow pnext with this.
+#define HT_READ_NEXT(pnode)     (*(HT_NODE * volatile *)&(pnode)->pnext)
+
+// The buckets that readers look keys up in. Replaced as a whole when the table is resized.
+struct _htBucketSet {
+    HT_NODE *phtNodes;
+    int nBuckets;
+};
+
+// Memory that was unlinked from a table with lock-free reads and is freed once
+// no reader can be using it anymore. Either a single node or a whole bucket set.
+typedef struct _htRetired {
+    struct _htRetired *pnext;
+    ULONG uEpoch;                   // Epoch when it was unlinked
+    HT_NODE *phtNode;               // Node to free along with its key and value
+    struct _htBucketSet *pBuckets;  // Bucket set to free along with its nodes, but not their keys and values
+}HT_RETIRED;
+
+struct _htLockFree {
+    SRWLOCK srwWriter;                          // Serializes writers
+    struct _htBucketSet * volatile pBuckets;    // Current buckets, same as phtNodes/nTableSize of the table
+    HT_RETIRED *pRetiredFirst;                  // Oldest retired memory, list is in the order of retiring
+    HT_RETIRED *pRetiredLast;
+};
+
+// Compact tables keep their entries in a dense array in insertion order, each bucket holds
+// the index of the first entry in its chain. A removed entry leaves a hole in the array,
+// which is skipped by iterators until the array is compacted.
+#define HT_NO_ENTRY             (-1)
+#define HT_COMPACT_MIN_ENTRIES  16
+
+typedef struct _htEntry {
+    ULONGLONG ullHash;      // Full hash of chlKey, same as in HT_NODE
+    CHL_KEY chlKey;
+    CHL_VAL chlVal;
+    int iNext;              // Next entry in the same bucket, HT_NO_ENTRY at the end
+    BOOL fOccupied;         // FALSE for a hole left by a removed entry
+}HT_ENTRY;
+
+struct _htCompact {
+    int *piBuckets;         // First entry of each bucket, HT_NO_ENTRY if the bucket is empty
+    HT_ENTRY *pEntries;     // Entries in insertion order, including holes
+    int nEntriesUsed;       // Slots of pEntries in use, up to and including the last entry
+    int nEntriesAlloc;      // Slots allocated in pEntries
+    int iFirstEntry;        // There are only holes below this index, where eviction of the oldest entry starts
+};
+
+// Entry handles refer to a slot, which refers to the node of the entry. Nodes move between
+// buckets as the table resizes, and each move updates the slot. A slot that is released gets
+// a new generation so that the handles returned for it before no longer match. Generations
+// are odd while the slot is in use and even while it is free.
+#define HT_HANDLE_MIN_SLOTS     16
+
+typedef struct _htHandleSlot {
+    HT_NODE *phtNode;       // Node of the entry, NULL while the slot is free
+    UINT uGeneration;
+    UINT uNextFree;         // Next free slot plus one, 0 at the end of the free list
+}HT_HANDLE_SLOT;
 
-/* Prime numbers from
- * https://en.wikipedia.org/wiki/List_of_prime_numbers#Centered_heptagonal_primes
- * and Carol primes for 16769023
- * and Circular primes for 319993, 919393
+struct _htHandleSlots {
+    HT_HANDLE_SLOT *pSlots;
+    UINT nSlotsUsed;        // Slots that have been handed out at some point, free ones are in the free list
+    UINT nSlotsAlloc;       // Slots allocated in pSlots
+    UINT uFirstFree;        // First free slot plus one, 0 if the free list is empty
+};
+
+// A merge splits the destination buckets into this many ranges per thread, so that
+// threads that finish a range early take another one
+#define HT_MERGE_RANGES_PER_THREAD  8
+#define HT_MERGE_MAX_THREADS        MAXIMUM_WAIT_OBJECTS
+
+// Keys of each source looked up in the other tables to estimate the size of the merged table
+#define HT_MERGE_SAMPLE_KEYS        256
+
+// Per-range totals of the second phase of a merge, added to the destination at the end
+typedef struct _htMergeRange {
+    int nEntriesAdded;
+    SIZE_T cbAdded;
+    SIZE_T cbRemoved;
+}HT_MERGE_RANGE;
+
+// State shared by the workers of a merge. The entries of source s that go into destination
+// bucket range r are in lists at index (s * nRanges) + r, linked by pnext.
+typedef struct _htMerge {
+    PCHL_HTABLE phtDst;
+    PCHL_HTABLE *pphtSrcs;
+    int nSrcs;
+    int nRanges;
+    HT_NODE **ppLists;              // Chained nodes of the sources
+    HT_NODE **ppHeadLists;          // Bucket heads of the sources
+    HT_MERGE_RANGE *pRanges;
+    volatile LONG lOutOfMemory;     // Some bucket head could not be moved
+    CHL_HT_COMBINE_FN pfnCombine;
+    PVOID pvContext;
+    BOOL fPlacing;                  // Second phase, work items are ranges rather than sources
+    volatile LONG lNextWork;        // Next source or range for a worker to take
+    LONG lWorkItems;
+}HT_MERGE;
+
+
+/* Primes that roughly double in size, each one being the smallest prime
+ * greater than twice the previous one. Doubling keeps the load factor
+ * after a resize within a predictable range.
  */
-int s_hashSizes[] = { 43,     197,    547,    1471,
-                    4663,   8233,   11173,  14561,
-                    20483,  93563,  319993, 919393,
-                    16769023 };
+int s_hashSizes[] = { 43,       89,       179,      359,
+                      719,      1439,     2879,     5779,
+                      11579,    23159,    46327,    92657,
+                      185323,   370661,   741337,   1482707,
+                      2965421,  5930887,  11861791, 23723597 };
 
 // File-local Functions
-static DWORD _hashi(_In_ int tablesize, _In_ size_t key);
-static DWORD _hashs(_In_ int tablesize, _In_bytecount_c_(iKeySize) const BYTE *key, _In_ size_t cchKey);
-static DWORD _hashsW(_In_ int tablesize, _In_bytecount_c_(iKeySize) const PUSHORT key, _In_ size_t cchKey);
+static DWORD _hashs(_In_bytecount_c_(iKeySize) const BYTE *key, _In_ size_t cchKey);
+static DWORD _hashsW(_In_bytecount_c_(iKeySize) const PUSHORT key, _In_ size_t cchKey);
+static ULONGLONG _GetDjb2Hash(_In_ PCVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize);
+static ULONGLONG _GetSeededHash(_In_ PCVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize, _In_ ULONGLONG ullSeed);
+static ULONGLONG _GetFullHash(_In_ PCHL_HTABLE phtable, _In_ PCVOID pvKey, _In_ int iKeySize);
+static ULONGLONG _GetHandleHash(_In_ PCHL_HTABLE phtable, _Inout_ CHL_HT_KEYHANDLE *phKey);
+static DWORD _ReduceToBucket(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ int nBuckets);
 
 static void _ClearNode(CHL_KEYTYPE ktype, CHL_VALTYPE vtype, HT_NODE *pnode, BOOL fFreeVal);
-static HRESULT _CopyNodeOut(
+static void _ClearBuckets(_In_ PCHL_HTABLE phtable, _In_ HT_NODE *phtNodes, _In_ int nBuckets);
+static HRESULT _CopyKeyValOut(
     _In_ PCHL_HTABLE phtable,
-    _In_ HT_NODE* phtNode,
+    _In_ PCHL_KEY pChlKey,
+    _In_ PCHL_VAL pChlVal,
     _Inout_opt_ PCVOID pvKey,
     _Inout_opt_ PINT piKeySize,
     _Inout_opt_ PVOID pvVal,
@@ -34,11 +189,16 @@ static HRESULT _CopyNodeOut(
 
 static BOOL _FindKeyInList(
     _In_ HT_NODE *pFirstHTNode,
+    _In_ ULONGLONG ullHash,
     _In_ PVOID pvkey,
     _In_ int iKeySize,
     _In_ CHL_KEYTYPE keyType,
     _Out_ HT_NODE **phtFoundNode,
-    _Out_opt_ HT_NODE **phtPrevFound);
+    _Out_opt_ HT_NODE **phtPrevFound,
+    _Inout_opt_ CHL_HT_COUNTERS *pCounters);
+
+static void _AddBucketStats(_In_ PCHL_HTABLE phtable, _In_ HT_NODE *phtBucket, _Inout_ CHL_HT_STATS *pStats);
+static void _AddEntryBytes(_In_ PCHL_HTABLE phtable, _In_ PCHL_KEY pChlKey, _In_ PCHL_VAL pChlVal, _Inout_ CHL_HT_STATS *pStats);
 
 static BOOL _FindKnownKeyInList(
     _In_ HT_NODE *pFirstHTNode,
@@ -46,23 +206,216 @@ static BOOL _FindKnownKeyInList(
     _Out_ HT_NODE **phtFoundNode,
     _Out_ HT_NODE **phtPrevFound);
 
-static HRESULT _IncrementIterator(_In_ CHL_HT_ITERATOR *pItr);
+static BOOL _FindNode(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ HT_NODE **phtFoundNode,
+    _Out_opt_ HT_NODE **phtPrevFound,
+    _Out_opt_ HT_NODE **phtBucket);
 
-DWORD _hashi(_In_ int tablesize, _In_ size_t key)
-{
-    ASSERT(tablesize > 0);
+static HRESULT _FindHashed(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly);
+static HRESULT _InsertHashed(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+static HRESULT _RemoveHashed(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize);
 
-    return key % tablesize;
-}
+static PCHL_VAL _FindKeyVal(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize);
+static PCHL_VAL _FindVal(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize);
+static HRESULT _ReplaceVal(
+    _In_ PCHL_HTABLE phtable,
+    _Inout_ PCHL_VAL pChlVal,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+static HRESULT _InsertOrUpdate(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+static HRESULT _InsertNewNode(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_opt_ HT_NODE **phtNewNode);
+
+static void _PrepareBatchGroup(
+    _In_ PCHL_HTABLE phtable,
+    _In_count_(nKeys) PCVOID *ppvKeys,
+    _In_opt_count_(nKeys) const int *piKeySizes,
+    _In_ int nKeys,
+    _Out_cap_(nKeys) int *piKeySizesOut,
+    _Out_cap_(nKeys) ULONGLONG *pullHashes);
+
+static void _RemoveNode(
+    _In_ PCHL_HTABLE phtable,
+    _In_ HT_NODE *phtBucket,
+    _In_ HT_NODE *phtFoundNode,
+    _In_opt_ HT_NODE *phtPrevFound);
+
+static __inline void _AddToEntryCount(_In_ PCHL_HTABLE phtable, _In_ LONG lDelta);
+static __inline void _AddToByteCount(_In_ PCHL_HTABLE phtable, _In_ SIZE_T cbAdded, _In_ SIZE_T cbRemoved);
+static SIZE_T _EntryBytes(_In_ PCHL_HTABLE phtable, _In_ int iKeySize, _In_ int iValSize);
+static SIZE_T _StoredEntryBytes(_In_ PCHL_HTABLE phtable, _In_ int iKeySize, _In_ PCHL_VAL pChlVal);
+static HRESULT _InsertWithBudget(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+static void _EvictToBudget(_In_ PCHL_HTABLE phtable, _In_opt_ PCHL_KEY pChlKeyToKeep);
+static BOOL _EvictOne(_In_ PCHL_HTABLE phtable, _In_opt_ PCHL_KEY pChlKeyToKeep);
+static BOOL _EvictOneCompact(_In_ PCHL_HTABLE phtable, _In_opt_ PCHL_KEY pChlKeyToKeep);
+static HRESULT _CheckMergeTables(_In_ PCHL_HTABLE phtDst, _In_count_(nSrcs) PCHL_HTABLE *pphtSrcs, _In_ int nSrcs);
+static HRESULT _MergeTable(
+    _In_ PCHL_HTABLE phtDst,
+    _In_ PCHL_HTABLE phtSrc,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext);
+static void _PrefetchMergeGroup(_In_ PCHL_HTABLE phtDst, _In_count_(nGroup) HT_NODE **ppGroup, _In_ int nGroup);
+static LONGLONG _EstimateMergedEntries(_In_ PCHL_HTABLE phtDst, _In_count_(nSrcs) PCHL_HTABLE *pphtSrcs, _In_ int nSrcs);
+static HRESULT _PrepareMergeDest(_In_ PCHL_HTABLE phtDst, _In_count_(nSrcs) PCHL_HTABLE *pphtSrcs, _In_ int nSrcs);
+static void _RunMergePhase(_In_ HT_MERGE *pMerge, _In_ BOOL fPlacing, _In_ int nThreads);
+static DWORD WINAPI _MergeWorker(_In_ LPVOID pvMerge);
+static void _SplitMergeSource(_In_ HT_MERGE *pMerge, _In_ int iSrc);
+static void _PlaceMergeRange(_In_ HT_MERGE *pMerge, _In_ int iRange);
+static HRESULT _MergeNode(
+    _In_ PCHL_HTABLE phtDst,
+    _Inout_ HT_NODE *phtNode,
+    _In_ BOOL fBucketHead,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _Inout_ HT_MERGE_RANGE *pTotals);
+static HT_NODE* _FindNodeForMerge(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PVOID pvkey, _In_ int iKeySize);
+static void _FinishMergeSource(_In_ PCHL_HTABLE phtSrc);
+static BOOL _NeedsRehashForMerge(_In_ PCHL_HTABLE phtDst, _In_ PCHL_HTABLE phtSrc);
+static int _LockStripe(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ BOOL fExclusive);
+static void _UnlockStripe(_In_ PCHL_HTABLE phtable, _In_ int iStripe, _In_ BOOL fExclusive);
+static void _LockAllStripes(_In_ PCHL_HTABLE phtable);
+static void _UnlockAllStripes(_In_ PCHL_HTABLE phtable);
+static void _ResizeConcurrent(_In_ PCHL_HTABLE phtable);
+
+static PCHL_VAL _FindValLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize);
+
+static HRESULT _FindLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+static HRESULT _InsertLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+static HRESULT _RemoveLockFree(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize);
+static void _ResizeLockFree(_In_ PCHL_HTABLE phtable, _In_ int iNewSizeIndex);
+static void _RetireLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ HT_RETIRED *pRetired,
+    _In_opt_ HT_NODE *phtNode,
+    _In_opt_ struct _htBucketSet *pBuckets);
+static void _ReclaimLockFree(_In_ PCHL_HTABLE phtable, _In_ BOOL fAll);
+static void _FreeBucketSetNodes(_In_ struct _htBucketSet *pBuckets);
+
+static void _ClearEntry(_In_ PCHL_HTABLE phtable, _Inout_ HT_ENTRY *pEntry);
+static int _FindEntryCompact(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_opt_ int **ppiLink);
+
+static int* _FindLinkToEntryCompact(_In_ PCHL_HTABLE phtable, _In_ int iEntry);
+
+static HRESULT _InsertCompact(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+static HRESULT _InsertNewEntryCompact(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_opt_ HT_ENTRY **ppNewEntry);
+
+static HRESULT _RemoveCompact(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize);
+static void _RemoveEntryCompact(_In_ PCHL_HTABLE phtable, _In_ int iEntry, _In_ int *piLink);
+static HRESULT _ReserveEntryCompact(_In_ PCHL_HTABLE phtable);
+static void _CompactEntries(_In_ PCHL_HTABLE phtable);
+static void _RelinkCompact(_In_ PCHL_HTABLE phtable);
+static void _ResizeCompact(_In_ PCHL_HTABLE phtable, _In_ int iNewSizeIndex);
+static void _AddCompactStats(_In_ PCHL_HTABLE phtable, _Inout_ CHL_HT_STATS *pStats);
+
+static BOOL _SupportsEntryHandles(_In_ PCHL_HTABLE phtable);
+static HRESULT _ReserveHandleSlot(_In_ PCHL_HTABLE phtable);
+static void _GetEntryHandle(_In_ PCHL_HTABLE phtable, _Inout_ HT_NODE *phtNode, _Out_ PCHL_HT_ENTRYHANDLE phEntry);
+static HT_NODE* _NodeFromEntryHandle(_In_ PCHL_HTABLE phtable, _In_opt_ const CHL_HT_ENTRYHANDLE *phEntry);
+static void _ReleaseHandleSlot(_In_ PCHL_HTABLE phtable, _Inout_ HT_NODE *phtNode);
+static void _ReleaseAllHandleSlots(_In_ PCHL_HTABLE phtable);
+static BOOL _FindNodeLinks(
+    _In_ PCHL_HTABLE phtable,
+    _In_ HT_NODE *phtNode,
+    _Out_ HT_NODE **phtBucket,
+    _Out_ HT_NODE **phtPrevFound);
+
+static __inline BOOL _IsMigrating(_In_ PCHL_HTABLE phtable);
+static __inline HT_NODE* _GetBucketAt(_In_ PCHL_HTABLE phtable, _In_ int iBucket);
+static void _MoveNodeContents(_In_ PCHL_HTABLE phtable, _Inout_ HT_NODE *phtDest, _Inout_ HT_NODE *phtSrc);
+static int _GetResizeSizeIndex(_In_ PCHL_HTABLE phtable);
+static void _ResizeIfNeeded(_In_ PCHL_HTABLE phtable);
+static void _BeginMigration(_In_ PCHL_HTABLE phtable, _In_ int iNewSizeIndex);
+static void _MigrateStep(_In_ PCHL_HTABLE phtable);
+static void _MigrateBuckets(_In_ PCHL_HTABLE phtable);
+static HRESULT _MigrateBucket(_In_ PCHL_HTABLE phtable, _In_ HT_NODE *phtOldBucket);
+static void _CompleteMigration(_In_ PCHL_HTABLE phtable);
+
+static HRESULT _IncrementIterator(_In_ CHL_HT_ITERATOR *pItr);
+static void _SetIteratorActive(_Inout_ CHL_HT_ITERATOR *pItr, _In_ BOOL fActive);
+static HRESULT _IncrementIteratorCompact(_In_ CHL_HT_ITERATOR *pItr);
 
-DWORD _hashs(_In_ int tablesize, _In_bytecount_c_(iKeySize) const BYTE *key, _In_ size_t cchKey)
+DWORD _hashs(_In_bytecount_c_(iKeySize) const BYTE *key, _In_ size_t cchKey)
 {
     DWORD hash = 5381;
     BYTE c;
     size_t i = 0;
 
-    ASSERT(tablesize > 0);
-
     //
     // hash function from
     // http://www.cse.yorku.ca/~oz/hash.html
@@ -75,18 +428,16 @@ DWORD _hashs(_In_ int tablesize, _In_bytecount_c_(iKeySize) const BYTE *key, _In
         c = key[++i];
     }
 
-    return (DWORD)(hash % tablesize);
+    return hash;
 }
 
 // Wide-char version of the hash function
-DWORD _hashsW(_In_ int tablesize, _In_bytecount_c_(iKeySize) const PUSHORT key, _In_ size_t cchKey)
+DWORD _hashsW(_In_bytecount_c_(iKeySize) const PUSHORT key, _In_ size_t cchKey)
 {
     DWORD hash = 5381;
     USHORT us;
     size_t i = 0;
 
-    ASSERT(tablesize > 0);
-
     //
     // hash function from
     // http://www.cse.yorku.ca/~oz/hash.html
@@ -99,24 +450,29 @@ DWORD _hashsW(_In_ int tablesize, _In_bytecount_c_(iKeySize) const PUSHORT key,
         us = key[++i];
     }
 
-    return (DWORD)(hash % tablesize);
+    return hash;
 }
 
-DWORD _GetKeyHash(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize, _In_ int iTableNodes)
+// Returns the hash that CHL_HT_HASH_DJB2 reduces by modulo. Integer and pointer keys are their own hash.
+ULONGLONG _GetDjb2Hash(_In_ PCVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize)
 {
-    DWORD dwKeyHash;
+    ULONGLONG ullKeyHash = 0;
 
-    ASSERT(iTableNodes > 0);
     ASSERT((keyType > CHL_KT_START) && (keyType < CHL_KT_END));
 
-    dwKeyHash = 0;
     switch (keyType)
     {
     case CHL_KT_INT32:
     case CHL_KT_UINT32:
+        {
+            // Only the low 32bits are significant, same as in _IsDuplicateKey
+            ullKeyHash = (UINT)(UINT_PTR)pvKey;
+            break;
+        }
+
     case CHL_KT_POINTER:
         {
-            dwKeyHash = _hashi(iTableNodes, (size_t)pvKey);
+            ullKeyHash = (size_t)pvKey;
             break;
         }
 
@@ -127,7 +483,7 @@ DWORD _GetKeyHash(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize,
             {
                 nChars = (int)strlen((PCSTR)pvKey);
             }
-            dwKeyHash = _hashs(iTableNodes, (const PBYTE)pvKey, nChars);
+            ullKeyHash = _hashs((const PBYTE)pvKey, nChars);
             break;
         }
 
@@ -138,7 +494,58 @@ DWORD _GetKeyHash(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize,
             {
                 nChars = wcslen((PCWSTR)pvKey);
             }
-            dwKeyHash = _hashsW(iTableNodes, (const PUSHORT)pvKey, nChars);
+            ullKeyHash = _hashsW((const PUSHORT)pvKey, nChars);
+            break;
+        }
+
+    default:
+        {
+            logerr("%s(): Invalid keyType %d", __FUNCTION__, keyType);
+            ASSERT(!L"Invalid keytype");
+            break;
+        }
+    }
+    return ullKeyHash;
+}
+
+DWORD _GetKeyHash(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize, _In_ int iTableNodes)
+{
+    ASSERT(iTableNodes > 0);
+    return (DWORD)(_GetDjb2Hash(pvKey, keyType, iKeySize) % iTableNodes);
+}
+
+// String keys are hashed up to the terminator, which is as far as _IsDuplicateKey compares them
+ULONGLONG _GetSeededHash(_In_ PCVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize, _In_ ULONGLONG ullSeed)
+{
+    ULONGLONG ullKeyHash = 0;
+
+    ASSERT((keyType > CHL_KT_START) && (keyType < CHL_KT_END));
+    ASSERT(iKeySize > 0);
+
+    switch (keyType)
+    {
+    case CHL_KT_INT32:
+    case CHL_KT_UINT32:
+        {
+            ullKeyHash = _HashUInt64((UINT)(UINT_PTR)pvKey, ullSeed);
+            break;
+        }
+
+    case CHL_KT_POINTER:
+        {
+            ullKeyHash = _HashUInt64((ULONGLONG)(UINT_PTR)pvKey, ullSeed);
+            break;
+        }
+
+    case CHL_KT_STRING:
+        {
+            ullKeyHash = _HashBytes64(pvKey, strnlen((PCSTR)pvKey, iKeySize), ullSeed);
+            break;
+        }
+
+    case CHL_KT_WSTRING:
+        {
+            ullKeyHash = _HashBytes64(pvKey, wcsnlen((PCWSTR)pvKey, iKeySize / sizeof(WCHAR)) * sizeof(WCHAR), ullSeed);
             break;
         }
 
@@ -149,7 +556,58 @@ DWORD _GetKeyHash(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize,
             break;
         }
     }
-    return dwKeyHash;
+    return ullKeyHash;
+}
+
+// Returns the hash that is cached in a node and reduced to a bucket index by _ReduceToBucket
+ULONGLONG _GetFullHash(_In_ PCHL_HTABLE phtable, _In_ PCVOID pvKey, _In_ int iKeySize)
+{
+    if (phtable->hashType == CHL_HT_HASH_DJB2)
+    {
+        return _GetDjb2Hash(pvKey, phtable->keyType, iKeySize);
+    }
+    return _GetSeededHash(pvKey, phtable->keyType, iKeySize, phtable->ullHashSeed);
+}
+
+// Returns the hash of the key of a handle for the table. Tables that use CHL_HT_HASH_SHARED64
+// use the hash of the handle as is. For CHL_HT_HASH_SEEDED64 the hash is kept in the handle
+// along with the seed, so it is only computed again when the handle is used with another table.
+ULONGLONG _GetHandleHash(_In_ PCHL_HTABLE phtable, _Inout_ CHL_HT_KEYHANDLE *phKey)
+{
+    if (phtable->hashType == CHL_HT_HASH_SHARED64)
+    {
+        ASSERT(phtable->ullHashSeed == _GetSharedHashSeed());
+        return phKey->ullHash;
+    }
+
+    if (phtable->hashType == CHL_HT_HASH_SEEDED64)
+    {
+        if (!phKey->fSeededHash || (phKey->ullSeed != phtable->ullHashSeed))
+        {
+            phKey->ullSeededHash = _GetFullHash(phtable, (PCVOID)phKey->pvKey, phKey->iKeySize);
+            phKey->ullSeed = phtable->ullHashSeed;
+            phKey->fSeededHash = TRUE;
+        }
+        return phKey->ullSeededHash;
+    }
+
+    return _GetFullHash(phtable, (PCVOID)phKey->pvKey, phKey->iKeySize);
+}
+
+DWORD _ReduceToBucket(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ int nBuckets)
+{
+    ASSERT(nBuckets > 0);
+
+    if (phtable->hashType == CHL_HT_HASH_DJB2)
+    {
+        return (DWORD)(ullHash % nBuckets);
+    }
+    return _ReduceHash64(ullHash, nBuckets);
+}
+
+DWORD _GetBucketIndex(_In_ PCHL_HTABLE phtable, _In_ PCVOID pvKey, _In_ int iKeySize, _In_ int nBuckets)
+{
+    return _ReduceToBucket(phtable, _GetFullHash(phtable, pvKey, iKeySize), nBuckets);
 }
 
 // TODO: Think about using the CHL_LLIST object here (for hash collisions)
@@ -164,7 +622,7 @@ DWORD _GetKeyHash(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize,
 //      valType: Type of value that is stored - number, string or void(can be anything)
 //      fValInHeapMem: Set this to true if the value(void type) is allocated memory on the heap
 //                     so that it is freed whenever an table entry is removed or when table is destroyed.
-// 
+//
 HRESULT CHL_DsCreateHT(
     _Inout_ PCHL_HTABLE *pHTableOut,
     _In_ int nEstEntries,
@@ -172,6 +630,19 @@ HRESULT CHL_DsCreateHT(
     _In_ CHL_VALTYPE valType,
     _In_opt_ BOOL fValInHeapMem)
 {
+    return CHL_DsCreateExHT(pHTableOut, nEstEntries, keyType, valType, fValInHeapMem, 0);
+}
+
+HRESULT CHL_DsCreateExHT(
+    _Inout_ PCHL_HTABLE *pHTableOut,
+    _In_ int nEstEntries,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ DWORD dwFlags)
+{
+    int i;
+    int newSizeIndex = 0;
     int newTableSize = 0;
     PCHL_HTABLE pnewtable = NULL;
 
@@ -180,17 +651,22 @@ HRESULT CHL_DsCreateHT(
     // validate parameters
     if ((nEstEntries < 0) ||
         (keyType < CHL_KT_START) || (keyType > CHL_KT_END) ||
-        (valType < CHL_VT_START) || (valType > CHL_VT_END))
+        (valType < CHL_VT_START) || (valType > CHL_VT_END) ||
+        ((dwFlags & ~(CHL_HT_FLAG_CONCURRENT | CHL_HT_FLAG_LOCKFREE_READS | CHL_HT_FLAG_COMPACT | CHL_HT_FLAG_MULTIMAP)) != 0) ||
+        ((dwFlags & CHL_HT_FLAG_CONCURRENT) && (dwFlags & CHL_HT_FLAG_LOCKFREE_READS)) ||
+        ((dwFlags & CHL_HT_FLAG_COMPACT) && (dwFlags & (CHL_HT_FLAG_CONCURRENT | CHL_HT_FLAG_LOCKFREE_READS))) ||
+        ((dwFlags & CHL_HT_FLAG_MULTIMAP) && (dwFlags & ~CHL_HT_FLAG_MULTIMAP)))
     {
         hr = E_INVALIDARG;
         goto error_return;
     }
 
-    // 
-    newTableSize = s_hashSizes[CHL_DsGetNearestSizeIndexHT(nEstEntries)];
-    if ((pnewtable = (CHL_HTABLE*)malloc(sizeof(CHL_HTABLE))) == NULL)
+    //
+    newSizeIndex = CHL_DsGetNearestSizeIndexHT(nEstEntries);
+    newTableSize = s_hashSizes[newSizeIndex];
+    if ((pnewtable = (CHL_HTABLE*)calloc(1, sizeof(CHL_HTABLE))) == NULL)
     {
-        logerr("%s(): malloc() ", __FUNCTION__);
+        logerr("%s(): calloc() ", __FUNCTION__);
         hr = E_OUTOFMEMORY;
         goto error_return;
     }
@@ -199,33 +675,133 @@ HRESULT CHL_DsCreateHT(
     pnewtable->nTableSize = newTableSize;
     pnewtable->keyType = keyType;
     pnewtable->valType = valType;
+    pnewtable->iMinSizeIndex = newSizeIndex;
+    pnewtable->iGrowLoadPct = HT_DEFAULT_GROW_LOAD_PCT;
+    pnewtable->iShrinkLoadPct = HT_DEFAULT_SHRINK_LOAD_PCT;
+    pnewtable->hashType = CHL_HT_HASH_SEEDED64;
+    pnewtable->ullHashSeed = _GenerateHashSeed();
+    pnewtable->fMultimap = (dwFlags & CHL_HT_FLAG_MULTIMAP) ? TRUE : FALSE;
 
-    pnewtable->phtNodes = (HT_NODE*)calloc(newTableSize, sizeof(HT_NODE));
-    if (pnewtable->phtNodes == NULL)
+    if (dwFlags & CHL_HT_FLAG_COMPACT)
     {
-        logerr("%s(): calloc() ", __FUNCTION__);
-        hr = E_OUTOFMEMORY;
-        goto error_return;
+        // The entry array is allocated by the first Insert
+        pnewtable->pCompact = (struct _htCompact*)calloc(1, sizeof(struct _htCompact));
+        if ((pnewtable->pCompact == NULL) ||
+            ((pnewtable->pCompact->piBuckets = (int*)malloc(newTableSize * sizeof(int))) == NULL))
+        {
+            logerr("%s(): alloc failed ", __FUNCTION__);
+            hr = E_OUTOFMEMORY;
+            goto error_return;
+        }
+
+        for (i = 0; i < newTableSize; ++i)
+        {
+            pnewtable->pCompact->piBuckets[i] = HT_NO_ENTRY;
+        }
+    }
+    else
+    {
+        pnewtable->phtNodes = (HT_NODE*)calloc(newTableSize, sizeof(HT_NODE));
+        if (pnewtable->phtNodes == NULL)
+        {
+            logerr("%s(): calloc() ", __FUNCTION__);
+            hr = E_OUTOFMEMORY;
+            goto error_return;
+        }
+    }
+
+    if (dwFlags & CHL_HT_FLAG_CONCURRENT)
+    {
+        pnewtable->pStripeLocks = (struct _htStripeLock*)calloc(HT_LOCK_STRIPES, sizeof(struct _htStripeLock));
+        if (pnewtable->pStripeLocks == NULL)
+        {
+            logerr("%s(): calloc() ", __FUNCTION__);
+            hr = E_OUTOFMEMORY;
+            goto error_return;
+        }
+
+        for (i = 0; i < HT_LOCK_STRIPES; ++i)
+        {
+            InitializeSRWLock(&pnewtable->pStripeLocks[i].srwLock);
+        }
+        pnewtable->fConcurrent = TRUE;
+    }
+
+    if (dwFlags & CHL_HT_FLAG_LOCKFREE_READS)
+    {
+        pnewtable->pLockFree = (struct _htLockFree*)calloc(1, sizeof(struct _htLockFree));
+        if (pnewtable->pLockFree == NULL)
+        {
+            logerr("%s(): calloc() ", __FUNCTION__);
+            hr = E_OUTOFMEMORY;
+            goto error_return;
+        }
+
+        InitializeSRWLock(&pnewtable->pLockFree->srwWriter);
+        pnewtable->pLockFree->pBuckets = (struct _htBucketSet*)calloc(1, sizeof(struct _htBucketSet));
+        if (pnewtable->pLockFree->pBuckets == NULL)
+        {
+            logerr("%s(): calloc() ", __FUNCTION__);
+            hr = E_OUTOFMEMORY;
+            goto error_return;
+        }
+
+        pnewtable->pLockFree->pBuckets->phtNodes = pnewtable->phtNodes;
+        pnewtable->pLockFree->pBuckets->nBuckets = pnewtable->nTableSize;
     }
 
     pnewtable->Destroy = CHL_DsDestroyHT;
     pnewtable->Insert = CHL_DsInsertHT;
     pnewtable->Find = CHL_DsFindHT;
+    pnewtable->InsertEx = CHL_DsInsertExHT;
+    pnewtable->GetByEntryHandle = CHL_DsGetByEntryHandleHT;
+    pnewtable->SetByEntryHandle = CHL_DsSetByEntryHandleHT;
+    pnewtable->RemoveByEntryHandle = CHL_DsRemoveByEntryHandleHT;
+    pnewtable->InsertByHandle = CHL_DsInsertByHandleHT;
+    pnewtable->FindByHandle = CHL_DsFindByHandleHT;
+    pnewtable->RemoveByHandle = CHL_DsRemoveByHandleHT;
+    pnewtable->FindOrInsert = CHL_DsFindOrInsertHT;
+    pnewtable->FindBatch = CHL_DsFindBatchHT;
+    pnewtable->InsertBatch = CHL_DsInsertBatchHT;
+    pnewtable->FindAll = CHL_DsFindAllHT;
     pnewtable->Remove = CHL_DsRemoveHT;
+    pnewtable->RemoveVal = CHL_DsRemoveValHT;
     pnewtable->RemoveAt = CHL_DsRemoveAtHT;
     pnewtable->InitIterator = CHL_DsInitIteratorHT;
+    pnewtable->SetLoadFactor = CHL_DsSetLoadFactorHT;
+    pnewtable->SetHashType = CHL_DsSetHashTypeHT;
+    pnewtable->BeginRead = CHL_DsBeginReadHT;
+    pnewtable->EndRead = CHL_DsEndReadHT;
+    pnewtable->GetStats = CHL_DsGetStatsHT;
+    pnewtable->SetBudget = CHL_DsSetBudgetHT;
+    pnewtable->Merge = CHL_DsMergeHT;
+    pnewtable->MergeMany = CHL_DsMergeManyHT;
     pnewtable->Dump = CHL_DsDumpHT;
 
     *pHTableOut = pnewtable;
     return hr;
 
 error_return:
-    if (pnewtable->phtNodes)
-    {
-        free(pnewtable->phtNodes);
-    }
     if (pnewtable)
     {
+        if (pnewtable->phtNodes)
+        {
+            free(pnewtable->phtNodes);
+        }
+        if (pnewtable->pStripeLocks)
+        {
+            free(pnewtable->pStripeLocks);
+        }
+        if (pnewtable->pLockFree)
+        {
+            free(pnewtable->pLockFree->pBuckets);
+            free(pnewtable->pLockFree);
+        }
+        if (pnewtable->pCompact)
+        {
+            free(pnewtable->pCompact->piBuckets);
+            free(pnewtable->pCompact);
+        }
         free(pnewtable);
     }
     *pHTableOut = NULL;
@@ -236,44 +812,61 @@ error_return:
 HRESULT CHL_DsDestroyHT(_In_ PCHL_HTABLE phtable)
 {
     int i;
-    int maxNodes;
-    CHL_KEYTYPE ktype;
-    CHL_VALTYPE vtype;
-    BOOL fInHeap;
-    HT_NODE *phtnodes = NULL;
-    HT_NODE *pcurnode = NULL;
-    HT_NODE *pnextnode = NULL;
 
-    phtnodes = phtable->phtNodes;
-    if (phtnodes != NULL)
+    if (phtable->pLockFree != NULL)
     {
-        ktype = phtable->keyType;
-        vtype = phtable->valType;
-        maxNodes = phtable->nTableSize;
-        fInHeap = phtable->fValIsInHeap;
-        for (i = 0; i < maxNodes; ++i)
+        // There are no more readers, everything retired can be freed. The current
+        // bucket array is freed below along with the rest of the table.
+        _ReclaimLockFree(phtable, TRUE);
+        free(phtable->pLockFree->pBuckets);
+        free(phtable->pLockFree);
+        phtable->pLockFree = NULL;
+    }
+
+    if (phtable->pCompact != NULL)
+    {
+        for (i = 0; i < phtable->pCompact->nEntriesUsed; ++i)
         {
-            pcurnode = phtnodes[i].pnext;
-            if (phtnodes[i].fOccupied)
+            if (phtable->pCompact->pEntries[i].fOccupied)
             {
-                _ClearNode(ktype, vtype, &phtnodes[i], fInHeap);
+                _ClearEntry(phtable, &phtable->pCompact->pEntries[i]);
             }
+        }
+        free(phtable->pCompact->pEntries);
+        free(phtable->pCompact->piBuckets);
+        free(phtable->pCompact);
+        phtable->pCompact = NULL;
+    }
 
-            while (pcurnode)
-            {
-                pnextnode = pcurnode->pnext;
+    if (phtable->phtNodes != NULL)
+    {
+        _ClearBuckets(phtable, phtable->phtNodes, phtable->nTableSize);
+        free(phtable->phtNodes);
+    }
 
-                ASSERT(pcurnode->fOccupied);
-                _ClearNode(ktype, vtype, pcurnode, fInHeap);
-                CHL_MmFree((PVOID*)&pcurnode);
+    if (phtable->phtNodesOld != NULL)
+    {
+        _ClearBuckets(phtable, phtable->phtNodesOld, phtable->nTableSizeOld);
+        free(phtable->phtNodesOld);
+    }
 
-                pcurnode = pnextnode;
-            }
-        }
+    if (phtable->pStripeLocks != NULL)
+    {
+        free(phtable->pStripeLocks);
+    }
+
+    if (phtable->pHandleSlots != NULL)
+    {
+        free(phtable->pHandleSlots->pSlots);
+        free(phtable->pHandleSlots);
+        phtable->pHandleSlots = NULL;
     }
 
     phtable->nTableSize = 0;
     phtable->phtNodes = NULL;
+    phtable->nTableSizeOld = 0;
+    phtable->phtNodesOld = NULL;
+    phtable->pStripeLocks = NULL;
 
     DBG_MEMSET(phtable, sizeof(CHL_HTABLE));
     free(phtable);
@@ -288,92 +881,80 @@ HRESULT CHL_DsInsertHT(
     _In_ PCVOID pvVal,
     _In_ int iValSize)
 {
-    DWORD index;
-    HT_NODE *pNodeAtHashedIndex = NULL;
-    HT_NODE *pNodeToInsertTo = NULL;
-
-    CHL_KEYTYPE keyType;
-
     HRESULT hr = S_OK;
 
     ASSERT(phtable);
 
-    keyType = phtable->keyType;
-    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, keyType, &iKeySize)))
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
     {
         logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
         hr = E_INVALIDARG;
         goto done;
     }
 
-    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, phtable->valType, &iValSize)))
+    hr = _InsertHashed(phtable, _GetFullHash(phtable, pvkey, iKeySize), pvkey, iKeySize, pvVal, iValSize);
+
+done:
+    return hr;
+}
+
+HRESULT CHL_DsInsertExHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_opt_ PCHL_HT_ENTRYHANDLE phEntry)
+{
+    ULONGLONG ullHash;
+    HT_NODE *phtNode;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    if (phEntry == NULL)
     {
-        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
-        hr = E_INVALIDARG;
+        hr = CHL_DsInsertHT(phtable, pvkey, iKeySize, pvVal, iValSize);
         goto done;
     }
 
-    ASSERT(phtable->nTableSize > 0);
-    index = _GetKeyHash(pvkey, keyType, iKeySize, phtable->nTableSize);
-    pNodeAtHashedIndex = &phtable->phtNodes[index];
+    ZeroMemory(phEntry, sizeof(*phEntry));
 
-    // Verify that duplicate values are not inserted (same key and value)
-    if (pNodeAtHashedIndex->fOccupied == FALSE)
+    if (!_SupportsEntryHandles(phtable))
     {
-        // Nothing at this index, just copy key:value into this
-        pNodeToInsertTo = &phtable->phtNodes[index];
+        logerr("%s(): Not supported on a concurrent, compact or multimap table, or one with lock-free reads.", __FUNCTION__);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto done;
     }
-    // We have the key hashing onto a index that is already populated, check if key is duplicate
-    else if (!_IsDuplicateKey(&pNodeAtHashedIndex->chlKey, pvkey, keyType, pNodeAtHashedIndex->chlKey.iKeySize))
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
     {
-        // Not a duplicate, so this is just a key collision. Attach to linked list.
-        // create a new hashtable node
-        hr = CHL_MmAlloc((PVOID*)&pNodeToInsertTo, sizeof(HT_NODE), NULL);
-        if (FAILED(hr))
-        {
-            hr = E_OUTOFMEMORY;
-            goto done;
-        }
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
     }
-    // It is a duplicate key
-    else
+
+    // So that there is no failure to undo once the key is in
+    hr = _ReserveHandleSlot(phtable);
+    if (FAILED(hr))
     {
-        if (!_IsDuplicateVal(&pNodeAtHashedIndex->chlVal, pvVal, phtable->valType, pNodeAtHashedIndex->chlVal.iValSize))
-        {
-            // Same key but different value, just update node with new value
-            // NOTE: Old value will be lost!!
-            _DeleteVal(&pNodeAtHashedIndex->chlVal, phtable->valType, phtable->fValIsInHeap);
-            hr = _CopyValIn(&pNodeAtHashedIndex->chlVal, phtable->valType, pvVal, iValSize);
-        }
         goto done;
     }
 
-    ASSERT(pNodeToInsertTo);
-
-    // Populate node
-    hr = _CopyKeyIn(&pNodeToInsertTo->chlKey, keyType, pvkey, iKeySize);
+    ullHash = _GetFullHash(phtable, pvkey, iKeySize);
+    hr = _InsertHashed(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize);
     if (SUCCEEDED(hr))
     {
-        hr = _CopyValIn(&pNodeToInsertTo->chlVal, phtable->valType, pvVal, iValSize);
-        if (SUCCEEDED(hr))
+        // The insert may have moved the node since, by migrating buckets
+        if (_FindNode(phtable, ullHash, pvkey, iKeySize, &phtNode, NULL, NULL))
         {
-            pNodeToInsertTo->fOccupied = TRUE;
-            if (pNodeToInsertTo != pNodeAtHashedIndex)
-            {
-                // There was a key collision. Connect to head of linked list.
-                pNodeToInsertTo->pnext = pNodeAtHashedIndex->pnext;
-                pNodeAtHashedIndex->pnext = pNodeToInsertTo;
-            }
+            _GetEntryHandle(phtable, phtNode, phEntry);
         }
-    }
-
-    if (FAILED(hr))
-    {
-        // Check if we have to free any newly allocated node
-        if ((pNodeToInsertTo != pNodeAtHashedIndex) && (pNodeToInsertTo != NULL))
+        else
         {
-            _ClearNode(phtable->keyType, phtable->valType, pNodeToInsertTo, phtable->fValIsInHeap);
-            CHL_MmFree((PVOID*)&pNodeToInsertTo);
+            ASSERT(FALSE);
+            hr = E_UNEXPECTED;
         }
     }
 
@@ -381,471 +962,4053 @@ done:
     return hr;
 }
 
-HRESULT CHL_DsFindHT(
+HRESULT CHL_DsGetByEntryHandleHT(
     _In_ PCHL_HTABLE phtable,
-    _In_ PCVOID pvkey,
-    _In_ int iKeySize,
+    _In_ const CHL_HT_ENTRYHANDLE *phEntry,
     _Inout_opt_ PVOID pvVal,
-    _Inout_opt_ PINT piValSize,
+    _Inout_opt_ PINT pvalsize,
     _In_opt_ BOOL fGetPointerOnly)
 {
-    int index = 0;
-    HT_NODE *phtFoundNode = NULL;
+    HT_NODE *phtNode;
 
     HRESULT hr = S_OK;
 
-    ASSERT(phtable->nTableSize > 0);
+    ASSERT(phtable);
 
-    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
+    phtNode = _NodeFromEntryHandle(phtable, phEntry);
+    if (phtNode == NULL)
     {
-        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
-        hr = E_INVALIDARG;
-        goto not_found;
+        IFPTR_SETVAL(pvalsize, 0);
+        hr = E_NOT_SET;
+        goto done;
     }
 
-    index = _GetKeyHash(pvkey, phtable->keyType, iKeySize, phtable->nTableSize);
-    if (!_FindKeyInList(
-        &phtable->phtNodes[index],
-        pvkey,
-        iKeySize,
-        phtable->keyType,
-        &phtFoundNode,
-        NULL))
+    hr = _CopyKeyValOut(phtable, &phtNode->chlKey, &phtNode->chlVal, NULL, NULL, pvVal, pvalsize, fGetPointerOnly);
+
+done:
+    return hr;
+}
+
+HRESULT CHL_DsSetByEntryHandleHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ const CHL_HT_ENTRYHANDLE *phEntry,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    HT_NODE *phtNode;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    phtNode = _NodeFromEntryHandle(phtable, phEntry);
+    if (phtNode == NULL)
     {
         hr = E_NOT_SET;
-        goto not_found;
+        goto done;
     }
 
-    // Passed in or Calculated keysize should be equal to stored keysize
-    ASSERT(iKeySize == phtFoundNode->chlKey.iKeySize);
-
-    if (pvVal)
+    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, phtable->valType, &iValSize)))
     {
-        hr = _CopyValOut(&phtFoundNode->chlVal, phtable->valType, pvVal, piValSize, fGetPointerOnly);
+        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
     }
 
-    if (SUCCEEDED(hr) && (piValSize != NULL))
+    hr = _CheckBudget(&phtable->budget,
+        _EntryBytes(phtable, phtNode->chlKey.iKeySize, iValSize),
+        _EntryBytes(phtable, phtNode->chlKey.iKeySize, phtNode->chlVal.iValSize));
+    if (FAILED(hr))
     {
-        *piValSize = phtFoundNode->chlVal.iValSize;
+        goto done;
     }
 
-    return hr;
-
-not_found:
-    if (piValSize)
+    hr = _ReplaceVal(phtable, &phtNode->chlVal, phtNode->chlKey.iKeySize, pvVal, iValSize);
+    if (SUCCEEDED(hr) && _IsOverBudget(&phtable->budget))
     {
-        *piValSize = 0;
+        _EvictToBudget(phtable, &phtNode->chlKey);
+        _ResizeIfNeeded(phtable);
     }
-    return hr;
 
+done:
+    return hr;
 }
 
-HRESULT CHL_DsRemoveHT(_In_ PCHL_HTABLE phtable, _In_ PCVOID pvkey, _In_ int iKeySize)
+HRESULT CHL_DsRemoveByEntryHandleHT(_In_ PCHL_HTABLE phtable, _In_ const CHL_HT_ENTRYHANDLE *phEntry)
 {
-    int index = 0;
-    HT_NODE *phtFoundNode = NULL;
+    HT_NODE *phtNode;
+    HT_NODE *phtBucket = NULL;
     HT_NODE *phtPrevFound = NULL;
 
     HRESULT hr = S_OK;
 
     ASSERT(phtable);
-    ASSERT(phtable->nTableSize > 0);
 
-    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
+    phtNode = _NodeFromEntryHandle(phtable, phEntry);
+    if (phtNode == NULL)
     {
-        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
-        hr = E_INVALIDARG;
-        goto fend;
+        hr = E_NOT_SET;
+        goto done;
     }
-    index = _GetKeyHash(pvkey, phtable->keyType, iKeySize, phtable->nTableSize);
 
-    if (!_FindKeyInList(
-        &phtable->phtNodes[index],
-        pvkey,
-        iKeySize,
-        phtable->keyType,
-        &phtFoundNode,
-        &phtPrevFound))
+    if (!_FindNodeLinks(phtable, phtNode, &phtBucket, &phtPrevFound))
     {
-        hr = E_NOT_SET;
-        goto fend;
+        ASSERT(FALSE);
+        hr = E_UNEXPECTED;
+        goto done;
     }
 
-    ASSERT(phtFoundNode);
+    _RemoveNode(phtable, phtBucket, phtNode, phtPrevFound);
+    _ResizeIfNeeded(phtable);
 
-    if (phtFoundNode == &phtable->phtNodes[index])
-    {
-        // Node in the main table is to be removed
-        // Preserve pnext and restore because _ClearNode sets it to NULL
-        HT_NODE* pnext = phtFoundNode->pnext;
-        _ClearNode(phtable->keyType, phtable->valType, phtFoundNode, phtable->fValIsInHeap);
-        phtFoundNode->pnext = pnext;
-    }
-    else
+done:
+    return hr;
+}
+
+HRESULT CHL_DsInsertByHandleHT(
+    _In_ PCHL_HTABLE phtable,
+    _Inout_ CHL_HT_KEYHANDLE *phKey,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    if ((phKey == NULL) || (phKey->keyType != phtable->keyType))
     {
-        ASSERT(phtPrevFound);
-        phtPrevFound->pnext = phtFoundNode->pnext;
-        _ClearNode(phtable->keyType, phtable->valType, phtFoundNode, phtable->fValIsInHeap);
-        CHL_MmFree((PVOID*)&phtFoundNode);
+        hr = E_INVALIDARG;
+        goto done;
     }
 
-fend:
+    hr = _InsertHashed(phtable, _GetHandleHash(phtable, phKey), (PCVOID)phKey->pvKey, phKey->iKeySize, pvVal, iValSize);
+
+done:
     return hr;
 }
 
-HRESULT CHL_DsRemoveAtHT(_Inout_ CHL_HT_ITERATOR *pItr)
+// Insert of a key whose size is known and that has been hashed for the table
+HRESULT _InsertHashed(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
 {
-    int iFoundIndex = -1;
-    HT_NODE *phtFoundNode = NULL;
-    HT_NODE *phtPrevFound = NULL;
+    int iStripe;
 
     HRESULT hr = S_OK;
-    HRESULT hrIncrement = S_OK;
-
-    ASSERT(pItr->pMyHashTable);
-    ASSERT(pItr->pMyHashTable->nTableSize > 0);
 
-    PCHL_HTABLE phtable = pItr->pMyHashTable;
-
-    if ((pItr->opType != HT_ITR_NEXT) || (pItr->phtCurNodeInList == NULL)
-        || (pItr->nCurIndex < 0) || (phtable->nTableSize <= pItr->nCurIndex)
-        || !_FindKnownKeyInList(&phtable->phtNodes[pItr->nCurIndex], pItr->phtCurNodeInList, &phtFoundNode, &phtPrevFound))
+    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, phtable->valType, &iValSize)))
     {
-        hr = E_NOT_SET;
-        goto fend;
+        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
     }
 
-    ASSERT(phtFoundNode == pItr->phtCurNodeInList);
-    iFoundIndex = pItr->nCurIndex;
+    ASSERT(phtable->nTableSize > 0);
 
-    hrIncrement = _IncrementIterator(pItr);
-    if (SUCCEEDED(hrIncrement))
-    {
-        ASSERT(pItr->phtCurNodeInList->fOccupied == TRUE);
-        ASSERT(pItr->nCurIndex < pItr->pMyHashTable->nTableSize);
-    }
-    else
+    if (phtable->fConcurrent)
     {
-        // Cannot use this iterator anymore before calling InitIterator again.
-        ASSERT(pItr->phtCurNodeInList == NULL);
-        ASSERT(pItr->pMyHashTable->nTableSize <= pItr->nCurIndex);
-    }
+        iStripe = _LockStripe(phtable, ullHash, TRUE);
+        hr = _InsertOrUpdate(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize);
+        _UnlockStripe(phtable, iStripe, TRUE);
 
-    if (phtFoundNode == &phtable->phtNodes[iFoundIndex])
-    {
-        // Node in the main table is to be removed
-        // Preserve pnext and restore because _ClearNode sets it to NULL
-        HT_NODE* pnext = phtFoundNode->pnext;
-        _ClearNode(phtable->keyType, phtable->valType, phtFoundNode, phtable->fValIsInHeap);
-        phtFoundNode->pnext = pnext;
+        _ResizeConcurrent(phtable);
+        goto done;
     }
-    else
+
+    if (phtable->pLockFree)
     {
-        ASSERT(phtPrevFound);
-        phtPrevFound->pnext = phtFoundNode->pnext;
-        _ClearNode(phtable->keyType, phtable->valType, phtFoundNode, phtable->fValIsInHeap);
-        CHL_MmFree((PVOID*)&phtFoundNode);
+        hr = _InsertLockFree(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize);
+        goto done;
     }
 
-fend:
+    hr = _InsertWithBudget(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize);
+
+done:
     return hr;
 }
 
-HRESULT CHL_DsInitIteratorHT(_In_ PCHL_HTABLE phtable, _Out_ CHL_HT_ITERATOR *pItr)
+HRESULT CHL_DsFindOrInsertHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_opt_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_ PCHL_VAL *ppChlVal,
+    _Out_opt_ PBOOL pfCreated)
 {
-    pItr->opType = HT_ITR_FIRST;
-    pItr->nCurIndex = 0;
-    pItr->phtCurNodeInList = NULL;
-    pItr->pMyHashTable = phtable;
-    pItr->MoveNext = CHL_DsMoveNextHT;
-    pItr->GetCurrent = CHL_DsGetCurrentHT;
-    return _IncrementIterator(pItr); // move to first element or the end if none exist
-}
+    ULONGLONG ullHash;
+    HT_NODE *phtNode = NULL;
+    HT_ENTRY *pEntry = NULL;
+    PCHL_VAL pChlVal = NULL;
+    BOOL fCreated = FALSE;
 
-HRESULT CHL_DsMoveNextHT(_Inout_ CHL_HT_ITERATOR *pItr)
-{
-    ASSERT(pItr && pItr->pMyHashTable);
-    return _IncrementIterator(pItr);
-}
+    HRESULT hr = S_OK;
 
-HRESULT CHL_DsGetCurrentHT(
-    _In_ CHL_HT_ITERATOR *pItr,
-    _Inout_opt_ PCVOID pvKey,
-    _Inout_opt_ PINT piKeySize,
-    _Inout_opt_ PVOID pvVal,
-    _Inout_opt_ PINT piValSize,
-    _In_opt_ BOOL fGetPointerOnly)
-{
-    ASSERT(pItr && pItr->pMyHashTable);
+    ASSERT(phtable);
+    ASSERT(phtable->nTableSize > 0);
 
-    if (pItr->phtCurNodeInList == NULL)
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
     {
-        return E_NOT_SET;
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
     }
-    return _CopyNodeOut(pItr->pMyHashTable, pItr->phtCurNodeInList, pvKey, piKeySize, pvVal, piValSize, fGetPointerOnly);
-}
 
-int CHL_DsGetNearestSizeIndexHT(_In_ int maxNumberOfEntries)
-{
-    int index = 0;
-    while ((index < (_countof(s_hashSizes) - 1)) && (maxNumberOfEntries > s_hashSizes[index]))
+    // The value is updated in place, which lock-free readers could see half done
+    if (phtable->pLockFree)
     {
-        ++index;
+        logerr("%s(): Not supported on a table with lock-free reads.", __FUNCTION__);
+        hr = E_NOT_VALID_STATE;
+        goto done;
     }
-    return index;
-}
 
-void CHL_DsDumpHT(_In_ PCHL_HTABLE phtable)
-{
-    DBG_UNREFERENCED_PARAMETER(phtable);
+    // The returned pointer is used after any stripe lock would have been released
+    if (phtable->fConcurrent)
+    {
+        logerr("%s(): Not supported on a concurrent table.", __FUNCTION__);
+        hr = E_NOT_VALID_STATE;
+        goto done;
+    }
 
-    //int i;
-    //int nNodes = 0;
-    //int uTableSize = -1;
+    _MigrateStep(phtable);
 
-    //CHL_KEYTYPE keyType;
-    //CHL_VALTYPE valType;
-    //
-    //HT_NODE **phtNodes = NULL;
-    //HT_NODE *phtCurNode = NULL;
+    ullHash = _GetFullHash(phtable, pvkey, iKeySize);
+    pChlVal = _FindVal(phtable, ullHash, pvkey, iKeySize);
+    if (pChlVal == NULL)
+    {
+        // Value is only needed for a new entry. Types other than numbers and pointers are copied from pvVal.
+        if ((pvVal == NULL) &&
+            ((phtable->valType == CHL_VT_STRING) || (phtable->valType == CHL_VT_WSTRING) || (phtable->valType == CHL_VT_USEROBJECT)))
+        {
+            logerr("%s(): Value must be specified for a new key.", __FUNCTION__);
+            hr = E_INVALIDARG;
+            goto done;
+        }
+
+        if (iValSize <= 0 && FAILED(_GetValSize(pvVal, phtable->valType, &iValSize)))
+        {
+            logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+            hr = E_INVALIDARG;
+            goto done;
+        }
+
+        hr = _CheckBudget(&phtable->budget, _EntryBytes(phtable, iKeySize, iValSize), 0);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+
+        if (phtable->pCompact)
+        {
+            hr = _InsertNewEntryCompact(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize, &pEntry);
+        }
+        else
+        {
+            hr = _InsertNewNode(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize, &phtNode);
+        }
+
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+
+        // Neither eviction nor a resize that starts here moves the new node (or entry),
+        // eviction leaves holes and a resize only swaps bucket arrays
+        pChlVal = (pEntry != NULL) ? &pEntry->chlVal : &phtNode->chlVal;
+        fCreated = TRUE;
+        if (_IsOverBudget(&phtable->budget))
+        {
+            _EvictToBudget(phtable, (pEntry != NULL) ? &pEntry->chlKey : &phtNode->chlKey);
+        }
+        _ResizeIfNeeded(phtable);
+    }
+
+    ASSERT(pChlVal);
+
+done:
+    *ppChlVal = SUCCEEDED(hr) ? pChlVal : NULL;
+    IFPTR_SETVAL(pfCreated, fCreated);
+    return hr;
+}
+
+HRESULT CHL_DsFindHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    ASSERT(phtable->nTableSize > 0);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        IFPTR_SETVAL(piValSize, 0);
+        return E_INVALIDARG;
+    }
+
+    return _FindHashed(phtable, _GetFullHash(phtable, pvkey, iKeySize), pvkey, iKeySize, pvVal, piValSize, fGetPointerOnly);
+}
+
+HRESULT CHL_DsFindByHandleHT(
+    _In_ PCHL_HTABLE phtable,
+    _Inout_ CHL_HT_KEYHANDLE *phKey,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    ASSERT(phtable->nTableSize > 0);
+
+    if ((phKey == NULL) || (phKey->keyType != phtable->keyType))
+    {
+        IFPTR_SETVAL(piValSize, 0);
+        return E_INVALIDARG;
+    }
+
+    return _FindHashed(phtable, _GetHandleHash(phtable, phKey), (PCVOID)phKey->pvKey, phKey->iKeySize, pvVal, piValSize, fGetPointerOnly);
+}
+
+// Find of a key whose size is known and that has been hashed for the table
+HRESULT _FindHashed(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    int iStripe = 0;
+    PCHL_VAL pFoundVal = NULL;
+
+    HRESULT hr = S_OK;
+
+    if (phtable->pLockFree)
+    {
+        hr = _FindLockFree(phtable, ullHash, pvkey, iKeySize, pvVal, piValSize, fGetPointerOnly);
+        if (hr == E_NOT_SET)
+        {
+            goto not_found;
+        }
+        return hr;
+    }
+
+    if (phtable->fConcurrent)
+    {
+        iStripe = _LockStripe(phtable, ullHash, FALSE);
+    }
+    else
+    {
+        _MigrateStep(phtable);
+    }
+
+    pFoundVal = _FindVal(phtable, ullHash, pvkey, iKeySize);
+    if (pFoundVal != NULL)
+    {
+        if (pvVal)
+        {
+            hr = _CopyValOut(pFoundVal, phtable->valType, pvVal, piValSize, fGetPointerOnly);
+        }
+
+        if (SUCCEEDED(hr) && (piValSize != NULL))
+        {
+            *piValSize = pFoundVal->iValSize;
+        }
+    }
+
+    if (phtable->fConcurrent)
+    {
+        _UnlockStripe(phtable, iStripe, FALSE);
+    }
+
+    if (pFoundVal == NULL)
+    {
+        hr = E_NOT_SET;
+        goto not_found;
+    }
+    return hr;
+
+not_found:
+    if (piValSize)
+    {
+        *piValSize = 0;
+    }
+    return hr;
+
+}
+
+HRESULT CHL_DsFindBatchHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_count_(nKeys) PCVOID *ppvKeys,
+    _In_opt_count_(nKeys) const int *piKeySizes,
+    _In_ int nKeys,
+    _Out_cap_(nKeys) PCHL_VAL *ppChlVals,
+    _Out_opt_cap_(nKeys) HRESULT *phrResults)
+{
+    int i;
+    int iGroup;
+    int nGroup;
+    int aiKeySizes[HT_BATCH_GROUP_SIZE];
+    ULONGLONG aullHashes[HT_BATCH_GROUP_SIZE];
+    PCHL_VAL pFoundVal;
+    EPOCH_READER *pReader = NULL;
+
+    HRESULT hrKey;
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+    ASSERT(phtable->nTableSize > 0);
+
+    if ((nKeys < 0) || ((nKeys > 0) && ((ppvKeys == NULL) || (ppChlVals == NULL))))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    // The returned pointers are used after any stripe lock would have been released
+    if (phtable->fConcurrent)
+    {
+        logerr("%s(): Not supported on a concurrent table.", __FUNCTION__);
+        hr = E_NOT_VALID_STATE;
+        goto fend;
+    }
+
+    // Nodes of a table with lock-free reads are only freed once no read section is left
+    // that could still be using them. The lookups are done inside one.
+    if (phtable->pLockFree)
+    {
+        pReader = _EpochEnterRead();
+        if (pReader == NULL)
+        {
+            AcquireSRWLockShared(&phtable->pLockFree->srwWriter);
+        }
+    }
+
+    // The migration work of all the lookups is done up front, so that entries
+    // stay put and all returned pointers remain valid until the next call.
+    for (i = 0; (i < nKeys) && _IsMigrating(phtable); ++i)
+    {
+        _MigrateStep(phtable);
+    }
+
+    for (iGroup = 0; iGroup < nKeys; iGroup += HT_BATCH_GROUP_SIZE)
+    {
+        nGroup = min(HT_BATCH_GROUP_SIZE, nKeys - iGroup);
+        _PrepareBatchGroup(phtable, &ppvKeys[iGroup], (piKeySizes != NULL) ? &piKeySizes[iGroup] : NULL,
+            nGroup, aiKeySizes, aullHashes);
+
+        for (i = 0; i < nGroup; ++i)
+        {
+            pFoundVal = NULL;
+            if (aiKeySizes[i] <= 0)
+            {
+                hrKey = E_INVALIDARG;
+            }
+            else
+            {
+                pFoundVal = (phtable->pLockFree != NULL) ?
+                    _FindValLockFree(phtable, aullHashes[i], ppvKeys[iGroup + i], aiKeySizes[i]) :
+                    _FindVal(phtable, aullHashes[i], ppvKeys[iGroup + i], aiKeySizes[i]);
+                hrKey = (pFoundVal != NULL) ? S_OK : E_NOT_SET;
+            }
+
+            ppChlVals[iGroup + i] = pFoundVal;
+            if (phrResults != NULL)
+            {
+                phrResults[iGroup + i] = hrKey;
+            }
+            if (FAILED(hrKey) && SUCCEEDED(hr))
+            {
+                hr = hrKey;
+            }
+        }
+    }
+
+    if (phtable->pLockFree)
+    {
+        if (pReader == NULL)
+        {
+            ReleaseSRWLockShared(&phtable->pLockFree->srwWriter);
+        }
+        else
+        {
+            _EpochExitRead(pReader);
+        }
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsInsertBatchHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_count_(nKeys) PCVOID *ppvKeys,
+    _In_opt_count_(nKeys) const int *piKeySizes,
+    _In_count_(nKeys) PCVOID *ppvVals,
+    _In_opt_count_(nKeys) const int *piValSizes,
+    _In_ int nKeys,
+    _Out_opt_cap_(nKeys) HRESULT *phrResults)
+{
+    int i;
+    int iGroup;
+    int nGroup;
+    int iValSize;
+    int aiKeySizes[HT_BATCH_GROUP_SIZE];
+    ULONGLONG aullHashes[HT_BATCH_GROUP_SIZE];
+
+    HRESULT hrKey;
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+    ASSERT(phtable->nTableSize > 0);
+
+    if ((nKeys < 0) || ((nKeys > 0) && ((ppvKeys == NULL) || (ppvVals == NULL))))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (phtable->pLockFree)
+    {
+        logerr("%s(): Not supported on a table with lock-free reads.", __FUNCTION__);
+        hr = E_NOT_VALID_STATE;
+        goto fend;
+    }
+
+    for (iGroup = 0; iGroup < nKeys; iGroup += HT_BATCH_GROUP_SIZE)
+    {
+        nGroup = min(HT_BATCH_GROUP_SIZE, nKeys - iGroup);
+        _PrepareBatchGroup(phtable, &ppvKeys[iGroup], (piKeySizes != NULL) ? &piKeySizes[iGroup] : NULL,
+            nGroup, aiKeySizes, aullHashes);
+
+        // Each insert does the same migration step (or stripe locking on a concurrent table)
+        // and resize check as CHL_DsInsertHT. Bucket indexes are derived from the hash again,
+        // so a resize within the group only makes some of the prefetches useless.
+        for (i = 0; i < nGroup; ++i)
+        {
+            iValSize = (piValSizes != NULL) ? piValSizes[iGroup + i] : 0;
+            if (aiKeySizes[i] <= 0)
+            {
+                hrKey = E_INVALIDARG;
+            }
+            else if (iValSize <= 0 && FAILED(_GetValSize(ppvVals[iGroup + i], phtable->valType, &iValSize)))
+            {
+                logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+                hrKey = E_INVALIDARG;
+            }
+            else
+            {
+                hrKey = _InsertHashed(phtable, aullHashes[i], ppvKeys[iGroup + i], aiKeySizes[i],
+                    ppvVals[iGroup + i], iValSize);
+            }
+
+            if (phrResults != NULL)
+            {
+                phrResults[iGroup + i] = hrKey;
+            }
+            if (FAILED(hrKey) && SUCCEEDED(hr))
+            {
+                hr = hrKey;
+            }
+        }
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsFindAllHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ PCHL_VAL *ppChlVals,
+    _Out_ PINT pnVals)
+{
+    ULONGLONG ullHash;
+    PCHL_VAL pChlVal = NULL;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+    ASSERT(phtable->nTableSize > 0);
+
+    if ((ppChlVals == NULL) || (pnVals == NULL))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    *ppChlVals = NULL;
+    *pnVals = 0;
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    // The returned values stay in place only until the next writer
+    if (phtable->pLockFree)
+    {
+        logerr("%s(): Not supported on a table with lock-free reads.", __FUNCTION__);
+        hr = E_NOT_VALID_STATE;
+        goto fend;
+    }
+
+    _MigrateStep(phtable);
+
+    ullHash = _GetFullHash(phtable, pvkey, iKeySize);
+    pChlVal = _FindKeyVal(phtable, ullHash, pvkey, iKeySize);
+    if (pChlVal == NULL)
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    *ppChlVals = _GetMultiVals(pChlVal, pnVals);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsRemoveValHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    int iVal;
+    ULONGLONG ullHash;
+    SIZE_T cbOld;
+    HT_NODE *phtFoundNode = NULL;
+    HT_NODE *phtPrevFound = NULL;
+    HT_NODE *phtBucket = NULL;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+    ASSERT(phtable->nTableSize > 0);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, phtable->valType, &iValSize)))
+    {
+        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (phtable->fConcurrent || phtable->pLockFree || phtable->pCompact)
+    {
+        logerr("%s(): Not supported on a concurrent or compact table or one with lock-free reads.", __FUNCTION__);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto fend;
+    }
+
+    _MigrateStep(phtable);
+
+    ullHash = _GetFullHash(phtable, pvkey, iKeySize);
+    if (!_FindNode(phtable, ullHash, pvkey, iKeySize, &phtFoundNode, &phtPrevFound, &phtBucket) ||
+        ((iVal = _FindMultiVal(&phtFoundNode->chlVal, phtable->valType, pvVal, iValSize)) < 0))
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    if (_IsMultiVal(&phtFoundNode->chlVal))
+    {
+        cbOld = _StoredEntryBytes(phtable, iKeySize, &phtFoundNode->chlVal);
+        _RemoveMultiVal(&phtFoundNode->chlVal, iVal, phtable->valType, phtable->fValIsInHeap);
+        _AddToByteCount(phtable, _StoredEntryBytes(phtable, iKeySize, &phtFoundNode->chlVal), cbOld);
+    }
+    else
+    {
+        // The only value of the key
+        _RemoveNode(phtable, phtBucket, phtFoundNode, phtPrevFound);
+        _ResizeIfNeeded(phtable);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsRemoveHT(_In_ PCHL_HTABLE phtable, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+    ASSERT(phtable->nTableSize > 0);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, phtable->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    hr = _RemoveHashed(phtable, _GetFullHash(phtable, pvkey, iKeySize), pvkey, iKeySize);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsRemoveByHandleHT(_In_ PCHL_HTABLE phtable, _Inout_ CHL_HT_KEYHANDLE *phKey)
+{
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+    ASSERT(phtable->nTableSize > 0);
+
+    if ((phKey == NULL) || (phKey->keyType != phtable->keyType))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    hr = _RemoveHashed(phtable, _GetHandleHash(phtable, phKey), (PCVOID)phKey->pvKey, phKey->iKeySize);
+
+fend:
+    return hr;
+}
+
+// Remove of a key whose size is known and that has been hashed for the table
+HRESULT _RemoveHashed(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    int iStripe = 0;
+    HT_NODE *phtFoundNode = NULL;
+    HT_NODE *phtPrevFound = NULL;
+    HT_NODE *phtBucket = NULL;
+
+    HRESULT hr = S_OK;
+
+    if (phtable->pLockFree)
+    {
+        hr = _RemoveLockFree(phtable, ullHash, pvkey, iKeySize);
+        goto fend;
+    }
+
+    if (phtable->pCompact)
+    {
+        hr = _RemoveCompact(phtable, ullHash, pvkey, iKeySize);
+        goto fend;
+    }
+
+    if (phtable->fConcurrent)
+    {
+        iStripe = _LockStripe(phtable, ullHash, TRUE);
+    }
+    else
+    {
+        _MigrateStep(phtable);
+    }
+
+    if (_FindNode(phtable, ullHash, pvkey, iKeySize, &phtFoundNode, &phtPrevFound, &phtBucket))
+    {
+        ASSERT(phtFoundNode);
+        _RemoveNode(phtable, phtBucket, phtFoundNode, phtPrevFound);
+    }
+    else
+    {
+        hr = E_NOT_SET;
+    }
+
+    if (phtable->fConcurrent)
+    {
+        _UnlockStripe(phtable, iStripe, TRUE);
+        _ResizeConcurrent(phtable);
+    }
+    else if (SUCCEEDED(hr))
+    {
+        _ResizeIfNeeded(phtable);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsRemoveAtHT(_Inout_ CHL_HT_ITERATOR *pItr)
+{
+    int iFoundIndex = -1;
+    HT_NODE *phtFoundNode = NULL;
+    HT_NODE *phtPrevFound = NULL;
+    HT_NODE *phtBucket = NULL;
+
+    HRESULT hr = S_OK;
+    HRESULT hrIncrement = S_OK;
+
+    ASSERT(pItr->pMyHashTable);
+    ASSERT(pItr->pMyHashTable->nTableSize > 0);
+
+    PCHL_HTABLE phtable = pItr->pMyHashTable;
+
+    if (pItr->uLayoutVersion != phtable->uLayoutVersion)
+    {
+        hr = E_CHANGED_STATE;
+        goto fend;
+    }
+
+    if (phtable->pCompact)
+    {
+        if ((pItr->opType != HT_ITR_NEXT) || (pItr->nCurIndex < 0) || (pItr->nCurIndex >= phtable->pCompact->nEntriesUsed)
+            || !phtable->pCompact->pEntries[pItr->nCurIndex].fOccupied)
+        {
+            hr = E_NOT_SET;
+            goto fend;
+        }
+
+        // Removal leaves a hole and never compacts, so the iterator stays valid
+        iFoundIndex = pItr->nCurIndex;
+        _IncrementIterator(pItr);
+        _RemoveEntryCompact(phtable, iFoundIndex, _FindLinkToEntryCompact(phtable, iFoundIndex));
+        goto fend;
+    }
+
+    if ((pItr->opType != HT_ITR_NEXT) || (pItr->phtCurNodeInList == NULL)
+        || (pItr->nCurIndex < 0) || ((phtable->nTableSizeOld + phtable->nTableSize) <= pItr->nCurIndex)
+        || !_FindKnownKeyInList(_GetBucketAt(phtable, pItr->nCurIndex), pItr->phtCurNodeInList, &phtFoundNode, &phtPrevFound))
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    ASSERT(phtFoundNode == pItr->phtCurNodeInList);
+    iFoundIndex = pItr->nCurIndex;
+    phtBucket = _GetBucketAt(phtable, iFoundIndex);
+
+    hrIncrement = _IncrementIterator(pItr);
+    if (SUCCEEDED(hrIncrement))
+    {
+        ASSERT(pItr->phtCurNodeInList->fOccupied == TRUE);
+        ASSERT(pItr->nCurIndex < (pItr->pMyHashTable->nTableSizeOld + pItr->pMyHashTable->nTableSize));
+    }
+    else
+    {
+        // Cannot use this iterator anymore before calling InitIterator again.
+        ASSERT(pItr->phtCurNodeInList == NULL);
+        ASSERT((pItr->pMyHashTable->nTableSizeOld + pItr->pMyHashTable->nTableSize) <= pItr->nCurIndex);
+    }
+
+    // Removal through an iterator never resizes the table, so that the iterator stays valid.
+    _RemoveNode(phtable, phtBucket, phtFoundNode, phtPrevFound);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsInitIteratorHT(_In_ PCHL_HTABLE phtable, _Out_ CHL_HT_ITERATOR *pItr)
+{
+    // A resize that is in progress is left as it is, the iterator visits the buckets
+    // that remain to be migrated and then the current ones.
+    pItr->opType = HT_ITR_FIRST;
+    pItr->nCurIndex = 0;
+    pItr->phtCurNodeInList = NULL;
+    pItr->pMyHashTable = phtable;
+    pItr->uLayoutVersion = phtable->uLayoutVersion;
+    pItr->fActive = FALSE;
+    pItr->MoveNext = CHL_DsMoveNextHT;
+    pItr->GetCurrent = CHL_DsGetCurrentHT;
+    pItr->End = CHL_DsEndIteratorHT;
+
+    // Only these tables migrate a resize a few buckets at a time, concurrent ones complete it at once
+    if (!phtable->fConcurrent && (phtable->pLockFree == NULL) && (phtable->pCompact == NULL))
+    {
+        _SetIteratorActive(pItr, TRUE);
+    }
+    return _IncrementIterator(pItr); // move to first element or the end if none exist
+}
+
+HRESULT CHL_DsMoveNextHT(_Inout_ CHL_HT_ITERATOR *pItr)
+{
+    ASSERT(pItr && pItr->pMyHashTable);
+    return _IncrementIterator(pItr);
+}
+
+HRESULT CHL_DsEndIteratorHT(_Inout_ CHL_HT_ITERATOR *pItr)
+{
+    ASSERT(pItr && pItr->pMyHashTable);
+    _SetIteratorActive(pItr, FALSE);
+    return S_OK;
+}
+
+HRESULT CHL_DsGetCurrentHT(
+    _In_ CHL_HT_ITERATOR *pItr,
+    _Inout_opt_ PCVOID pvKey,
+    _Inout_opt_ PINT piKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    HT_ENTRY *pEntry;
+    struct _htCompact *pCompact;
+
+    ASSERT(pItr && pItr->pMyHashTable);
+
+    if (pItr->uLayoutVersion != pItr->pMyHashTable->uLayoutVersion)
+    {
+        return E_CHANGED_STATE;
+    }
+
+    pCompact = pItr->pMyHashTable->pCompact;
+    if (pCompact != NULL)
+    {
+        if ((pItr->nCurIndex < 0) || (pItr->nCurIndex >= pCompact->nEntriesUsed) || !pCompact->pEntries[pItr->nCurIndex].fOccupied)
+        {
+            return E_NOT_SET;
+        }
+
+        pEntry = &pCompact->pEntries[pItr->nCurIndex];
+        return _CopyKeyValOut(pItr->pMyHashTable, &pEntry->chlKey, &pEntry->chlVal, pvKey, piKeySize, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (pItr->phtCurNodeInList == NULL)
+    {
+        return E_NOT_SET;
+    }
+
+    ASSERT(pItr->phtCurNodeInList->fOccupied == TRUE);
+    return _CopyKeyValOut(pItr->pMyHashTable, &pItr->phtCurNodeInList->chlKey, &pItr->phtCurNodeInList->chlVal,
+        pvKey, piKeySize, pvVal, piValSize, fGetPointerOnly);
+}
+
+HRESULT CHL_DsSetLoadFactorHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ int iGrowLoadPercent,
+    _In_ int iShrinkLoadPercent)
+{
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    if ((iGrowLoadPercent < 0) || ((iGrowLoadPercent > 0) && (iGrowLoadPercent <= HT_MIN_GROW_LOAD_PCT)) ||
+        (iShrinkLoadPercent < 0) || (iShrinkLoadPercent >= HT_MAX_SHRINK_LOAD_PCT))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    phtable->iGrowLoadPct = iGrowLoadPercent;
+    phtable->iShrinkLoadPct = iShrinkLoadPercent;
+    _ResizeIfNeeded(phtable);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsSetHashTypeHT(_In_ PCHL_HTABLE phtable, _In_ CHL_HT_HASHTYPE hashType)
+{
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    if ((hashType <= CHL_HT_HASH_START) || (hashType >= CHL_HT_HASH_END))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    // Existing entries would have to be moved to the buckets of the new hash
+    if ((phtable->nEntries > 0) || _IsMigrating(phtable))
+    {
+        logerr("%s(): Hash type can only be changed while the table is empty", __FUNCTION__);
+        hr = E_NOT_VALID_STATE;
+        goto fend;
+    }
+
+    phtable->hashType = hashType;
+    if (hashType == CHL_HT_HASH_SEEDED64)
+    {
+        phtable->ullHashSeed = _GenerateHashSeed();
+    }
+    else if (hashType == CHL_HT_HASH_SHARED64)
+    {
+        phtable->ullHashSeed = _GetSharedHashSeed();
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsPrepareKeyHT(
+    _In_ CHL_KEYTYPE keyType,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ CHL_HT_KEYHANDLE *phKey)
+{
+    HRESULT hr = S_OK;
+
+    if ((phKey == NULL) || (keyType <= CHL_KT_START) || (keyType >= CHL_KT_END))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    phKey->keyType = keyType;
+    phKey->pvKey = pvkey;
+    phKey->iKeySize = iKeySize;
+    phKey->ullHash = _GetSeededHash(pvkey, keyType, iKeySize, _GetSharedHashSeed());
+    phKey->fSeededHash = FALSE;
+    phKey->ullSeed = 0;
+    phKey->ullSeededHash = 0;
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsSetBudgetHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ SIZE_T cbMaxBytes,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext)
+{
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    if (cbMaxBytes > 0)
+    {
+        // Eviction would have to lock every stripe, or retire nodes, on the way
+        if (phtable->fConcurrent || phtable->pLockFree)
+        {
+            logerr("%s(): Not supported on a concurrent table or one with lock-free reads.", __FUNCTION__);
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+            goto fend;
+        }
+
+        // Appending a value would have to be checked against the budget and undone on failure
+        if (phtable->fMultimap)
+        {
+            logerr("%s(): Not supported on a multimap.", __FUNCTION__);
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+            goto fend;
+        }
+
+        if ((policy == CHL_BP_EVICT_OLDEST) && (phtable->pCompact == NULL))
+        {
+            logerr("%s(): Only a compact table keeps insertion order.", __FUNCTION__);
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+            goto fend;
+        }
+    }
+
+    hr = _SetBudget(&phtable->budget, cbMaxBytes, policy, pfnEvict, pvEvictContext);
+    if (SUCCEEDED(hr) && _IsOverBudget(&phtable->budget))
+    {
+        _EvictToBudget(phtable, NULL);
+        _ResizeIfNeeded(phtable);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsMergeHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_ PCHL_HTABLE phtSrc,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext)
+{
+    return CHL_DsMergeManyHT(phtable, &phtSrc, 1, pfnCombine, pvContext, 1);
+}
+
+HRESULT CHL_DsMergeManyHT(
+    _In_ PCHL_HTABLE phtable,
+    _In_count_(nSrcs) PCHL_HTABLE *pphtSrcs,
+    _In_ int nSrcs,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads)
+{
+    int i;
+    int nRanges;
+    SYSTEM_INFO sysInfo;
+    HT_MERGE merge;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    ZeroMemory(&merge, sizeof(merge));
+
+    if ((pphtSrcs == NULL) || (nSrcs < 0) || (nThreads < 0))
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    hr = _CheckMergeTables(phtable, pphtSrcs, nSrcs);
+    if (FAILED(hr) || (nSrcs == 0))
+    {
+        goto fend;
+    }
+
+    // Entries of the sources leave their slots behind
+    for (i = 0; i < nSrcs; ++i)
+    {
+        _ReleaseAllHandleSlots(pphtSrcs[i]);
+    }
+
+    if (nThreads == 0)
+    {
+        GetSystemInfo(&sysInfo);
+        nThreads = (int)sysInfo.dwNumberOfProcessors;
+    }
+    nThreads = max(1, min(nThreads, HT_MERGE_MAX_THREADS));
+
+    // On one thread, each source is moved in one pass and the table grows as it goes
+    if (nThreads == 1)
+    {
+        for (i = 0; i < nSrcs; ++i)
+        {
+            if (FAILED(_MergeTable(phtable, pphtSrcs[i], pfnCombine, pvContext)) && SUCCEEDED(hr))
+            {
+                hr = E_OUTOFMEMORY;
+            }
+        }
+        goto evict;
+    }
+
+    hr = _PrepareMergeDest(phtable, pphtSrcs, nSrcs);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    nRanges = min(nThreads * HT_MERGE_RANGES_PER_THREAD, phtable->nTableSize);
+    merge.ppLists = (HT_NODE**)calloc((SIZE_T)nSrcs * nRanges * 2, sizeof(HT_NODE*));
+    merge.pRanges = (HT_MERGE_RANGE*)calloc(nRanges, sizeof(HT_MERGE_RANGE));
+    if ((merge.ppLists == NULL) || (merge.pRanges == NULL))
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto fend;
+    }
+
+    merge.ppHeadLists = merge.ppLists + ((SIZE_T)nSrcs * nRanges);
+    merge.phtDst = phtable;
+    merge.pphtSrcs = pphtSrcs;
+    merge.nSrcs = nSrcs;
+    merge.nRanges = nRanges;
+    merge.pfnCombine = pfnCombine;
+    merge.pvContext = pvContext;
+
+    _RunMergePhase(&merge, FALSE, nThreads);
+    _RunMergePhase(&merge, TRUE, nThreads);
+
+    for (i = 0; i < nRanges; ++i)
+    {
+        _AddToEntryCount(phtable, merge.pRanges[i].nEntriesAdded);
+        _AddToByteCount(phtable, merge.pRanges[i].cbAdded, merge.pRanges[i].cbRemoved);
+    }
+
+    for (i = 0; i < nSrcs; ++i)
+    {
+        _FinishMergeSource(pphtSrcs[i]);
+    }
+
+    hr = merge.lOutOfMemory ? E_OUTOFMEMORY : S_OK;
+
+    // Grows the table further if there were more entries than estimated
+    _ResizeIfNeeded(phtable);
+
+evict:
+    // Only a table with a budget can be over it, and those are not concurrent
+    if (_IsOverBudget(&phtable->budget))
+    {
+        _EvictToBudget(phtable, NULL);
+        _ResizeIfNeeded(phtable);
+    }
+
+fend:
+    free(merge.ppLists);
+    free(merge.pRanges);
+    return hr;
+}
+
+void CHL_DsCombineSumHT(_Inout_ PCHL_VAL pChlValDst, _Inout_ PCHL_VAL pChlValSrc, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext)
+{
+    UNREFERENCED_PARAMETER(pvContext);
+
+    // Unsigned, so that signed values wrap around the same way
+    if ((valType == CHL_VT_INT32) || (valType == CHL_VT_UINT32))
+    {
+        pChlValDst->valDef.uiVal += pChlValSrc->valDef.uiVal;
+    }
+}
+
+void CHL_DsCombineMaxHT(_Inout_ PCHL_VAL pChlValDst, _Inout_ PCHL_VAL pChlValSrc, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext)
+{
+    UNREFERENCED_PARAMETER(pvContext);
+
+    if (valType == CHL_VT_INT32)
+    {
+        pChlValDst->valDef.iVal = max(pChlValDst->valDef.iVal, pChlValSrc->valDef.iVal);
+    }
+    else if (valType == CHL_VT_UINT32)
+    {
+        pChlValDst->valDef.uiVal = max(pChlValDst->valDef.uiVal, pChlValSrc->valDef.uiVal);
+    }
+}
+
+HRESULT CHL_DsBeginReadHT(_In_ PCHL_HTABLE phtable)
+{
+    ASSERT(phtable);
+
+    if (phtable->pLockFree == NULL)
+    {
+        return S_OK;
+    }
+    return (_EpochEnterRead() != NULL) ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT CHL_DsEndReadHT(_In_ PCHL_HTABLE phtable)
+{
+    EPOCH_READER *pReader;
+
+    ASSERT(phtable);
+
+    if (phtable->pLockFree == NULL)
+    {
+        return S_OK;
+    }
+
+    pReader = _EpochGetThreadReader();
+    if (pReader == NULL)
+    {
+        logerr("%s(): No read section was started on this thread.", __FUNCTION__);
+        return E_NOT_VALID_STATE;
+    }
+
+    _EpochExitRead(pReader);
+    return S_OK;
+}
+
+HRESULT CHL_DsGetStatsHT(_In_ PCHL_HTABLE phtable, _Out_ CHL_HT_STATS *pStats)
+{
+    int i;
+
+    ASSERT(phtable && pStats);
+
+    ZeroMemory(pStats, sizeof(*pStats));
+
+    // Other threads may be using a concurrent table or one with lock-free reads,
+    // keep them from changing it while its nodes are counted.
+    if (phtable->fConcurrent)
+    {
+        _LockAllStripes(phtable);
+    }
+    else if (phtable->pLockFree)
+    {
+        AcquireSRWLockExclusive(&phtable->pLockFree->srwWriter);
+    }
+
+    pStats->nEntries = phtable->nEntries;
+    pStats->nBuckets = phtable->nTableSize;
+    if (phtable->pCompact)
+    {
+        _AddCompactStats(phtable, pStats);
+    }
+    else
+    {
+        pStats->cbNodes = (SIZE_T)(phtable->nTableSize + phtable->nTableSizeOld) * sizeof(HT_NODE);
+        for (i = 0; i < phtable->nTableSize; ++i)
+        {
+            _AddBucketStats(phtable, &phtable->phtNodes[i], pStats);
+        }
+    }
+
+    if (_IsMigrating(phtable))
+    {
+        pStats->nBucketsOld = phtable->nTableSizeOld - phtable->iMigrateIndex;
+        for (i = phtable->iMigrateIndex; i < phtable->nTableSizeOld; ++i)
+        {
+            _AddBucketStats(phtable, &phtable->phtNodesOld[i], pStats);
+        }
+    }
+
+    pStats->iLoadPct = (int)(((LONGLONG)pStats->nEntries * 100) / (pStats->nBuckets + pStats->nBucketsOld));
+
+#ifdef CHL_HT_ENABLE_COUNTERS
+    pStats->fCountersEnabled = (HT_COUNTERS(phtable) != NULL);
+    pStats->counters = phtable->counters;
+#endif
+
+    if (phtable->fConcurrent)
+    {
+        _UnlockAllStripes(phtable);
+    }
+    else if (phtable->pLockFree)
+    {
+        ReleaseSRWLockExclusive(&phtable->pLockFree->srwWriter);
+    }
+    return S_OK;
+}
+
+int CHL_DsGetNearestSizeIndexHT(_In_ int maxNumberOfEntries)
+{
+    int index = 0;
+    while ((index < (_countof(s_hashSizes) - 1)) && (maxNumberOfEntries > s_hashSizes[index]))
+    {
+        ++index;
+    }
+    return index;
+}
+
+void CHL_DsDumpHT(_In_ PCHL_HTABLE phtable)
+{
+    DBG_UNREFERENCED_PARAMETER(phtable);
+
+    //int i;
+    //int nNodes = 0;
+    //int uTableSize = -1;
+
+    //CHL_KEYTYPE keyType;
+    //CHL_VALTYPE valType;
+    //
+    //HT_NODE **phtNodes = NULL;
+    //HT_NODE *phtCurNode = NULL;
+
+    //ASSERT(phtable && phtable->nTableSize > 0);
+
+    //uTableSize = phtable->nTableSize;
+    //keyType = phtable->keyType;
+    //valType = phtable->valType;
+    //
+    //phtNodes = phtable->phtNodes;
+    //
+    //printf("-----------------------------------\n");
+    //printf("Hashtable Dump::\nkey  :  iValSize  :  chlVal\n");
+    //printf("-----------------------------------\n");
+    //
+    //if(!phtNodes)
+    //{
+    //    printf("Hastable empty");
+    //    goto done;
+    //}
+    //
+    //for(i = 0; i < uTableSize; ++i)
+    //{
+    //    if((phtCurNode = phtNodes[i]) == NULL) continue;
+    //    
+    //    while(phtCurNode)
+    //    {
+    //        ++nNodes;
+    //        
+    //        // print the key
+    //        switch(keyType)
+    //        {
+    //            case HT_KEY_STR:
+    //            {
+    //                int chars = 0;
+    //                while(chars < phtCurNode->iKeySize)
+    //                    putchar(phtCurNode->chlKey.skey[chars++]);
+    //                putchar(':');
+    //                break;
+    //            }
+
+    //            case HT_KEY_DWORD:printf("%u:", phtCurNode->chlKey.dwkey); break;
+    //            default: printf("Invalid keyType %d:", keyType); break;
+    //        }
+
+    //        // print the iValSize
+    //        printf("%d:", phtCurNode->iValSize);
+
+    //        // print the value
+    //        if(valType == HT_VAL_STR)
+    //            printf("[%s]\n", phtCurNode->chlVal.pbVal);
+    //        else if(valType == HT_VAL_DWORD)
+    //            printf("[%u]\n", phtCurNode->chlVal.dwVal);
+    //        else if(valType == HT_VAL_PTR)
+    //            printf("[0x%p]\n", phtCurNode->chlVal.pbVal);
+    //        else
+    //            printf("Invalid valType %d\n", valType);
+    //        phtCurNode = phtCurNode->pnext;
+    //    
+    //    }// while phtCurNode
+    //    
+    //}// for i
+    //
+    //printf("Hashtable stats:\n");
+    //printf("Total size     : %u\n", uTableSize);
+    //printf("Occupied       : %d\n", nNodes);
+    //    
+    //done:
+    //return;
+
+}// CHL_DsDumpHT
+
+void _ClearNode(CHL_KEYTYPE ktype, CHL_VALTYPE vtype, HT_NODE *pnode, BOOL fFreeVal)
+{
+    ASSERT(pnode);
+
+    _DeleteKey(&pnode->chlKey, ktype);
+    _DeleteVal(&pnode->chlVal, vtype, fFreeVal);
+
+    pnode->fOccupied = FALSE;
+    pnode->ullHash = 0;
+    pnode->pnext = NULL;
+
+    return;
+}// _ClearNode()
+
+void _ClearBuckets(_In_ PCHL_HTABLE phtable, _In_ HT_NODE *phtNodes, _In_ int nBuckets)
+{
+    int i;
+    HT_NODE *pcurnode = NULL;
+    HT_NODE *pnextnode = NULL;
+
+    for (i = 0; i < nBuckets; ++i)
+    {
+        pcurnode = phtNodes[i].pnext;
+        if (phtNodes[i].fOccupied)
+        {
+            _ClearNode(phtable->keyType, phtable->valType, &phtNodes[i], phtable->fValIsInHeap);
+        }
+
+        while (pcurnode)
+        {
+            pnextnode = pcurnode->pnext;
+
+            ASSERT(pcurnode->fOccupied);
+            _ClearNode(phtable->keyType, phtable->valType, pcurnode, phtable->fValIsInHeap);
+            CHL_MmFree((PVOID*)&pcurnode);
+
+            pcurnode = pnextnode;
+        }
+    }
+}
+
+HRESULT _CopyKeyValOut(
+    _In_ PCHL_HTABLE phtable,
+    _In_ PCHL_KEY pChlKey,
+    _In_ PCHL_VAL pChlVal,
+    _Inout_opt_ PCVOID pvKey,
+    _Inout_opt_ PINT piKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    HRESULT hr = S_OK;
+
+    // The first value of a key of a multimap
+    pChlVal = _GetMultiVals(pChlVal, NULL);
+
+    if (pvKey)
+    {
+        hr = _CopyKeyOut(pChlKey, phtable->keyType, pvKey, piKeySize, fGetPointerOnly);
+    }
+    if (SUCCEEDED(hr) && pvVal)
+    {
+        hr = _CopyValOut(pChlVal, phtable->valType, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (piKeySize != NULL)
+        {
+            *piKeySize = pChlKey->iKeySize;
+        }
+
+        if (piValSize != NULL)
+        {
+            *piValSize = pChlVal->iValSize;
+        }
+    }
+    return hr;
+}
+
+// Keys are compared only if the cached hashes are equal, so mismatching
+// string keys in a chain cost one integer compare each.
+BOOL _FindKeyInList(
+    _In_ HT_NODE *pFirstHTNode,
+    _In_ ULONGLONG ullHash,
+    _In_ PVOID pvkey,
+    _In_ int iKeySize,
+    _In_ CHL_KEYTYPE keyType,
+    _Out_ HT_NODE **phtFoundNode,
+    _Out_opt_ HT_NODE **phtPrevFound,
+    _Inout_opt_ CHL_HT_COUNTERS *pCounters)
+{
+    HT_NODE *prevNode = NULL;
+    HT_NODE *pcurNode = NULL;
+
+    ASSERT(phtFoundNode);
+
+    *phtFoundNode = NULL;
+
+    UNREFERENCED_PARAMETER(pCounters);
+
+    pcurNode = pFirstHTNode;
+    while (pcurNode)
+    {
+#ifdef CHL_HT_ENABLE_COUNTERS
+        if (pCounters && pcurNode->fOccupied)
+        {
+            ++(pCounters->ullProbes);
+        }
+#endif
+        if (pcurNode->fOccupied &&
+            (pcurNode->ullHash == ullHash) &&
+            (pcurNode->chlKey.iKeySize == iKeySize) &&
+            _IsDuplicateKey(&pcurNode->chlKey, pvkey, keyType, pcurNode->chlKey.iKeySize))
+        {
+            break;
+        }
+
+        prevNode = pcurNode;
+        pcurNode = pcurNode->pnext;
+    }
+
+    *phtFoundNode = pcurNode;
+    if (phtPrevFound)
+    {
+        *phtPrevFound = prevNode;
+    }
+
+    return (pcurNode != NULL);
+}
+
+void _AddBucketStats(_In_ PCHL_HTABLE phtable, _In_ HT_NODE *phtBucket, _Inout_ CHL_HT_STATS *pStats)
+{
+    int nChain = 0;
+    HT_NODE *pcurNode;
+
+    for (pcurNode = phtBucket; pcurNode != NULL; pcurNode = pcurNode->pnext)
+    {
+        if (pcurNode != phtBucket)
+        {
+            pStats->cbNodes += sizeof(HT_NODE);
+        }
+
+        if (!pcurNode->fOccupied)
+        {
+            continue;
+        }
+
+        ++nChain;
+        _AddEntryBytes(phtable, &pcurNode->chlKey, &pcurNode->chlVal, pStats);
+    }
+
+    pStats->nMaxChain = max(pStats->nMaxChain, nChain);
+    ++(pStats->anChainLengths[min(nChain, CHL_HT_STATS_CHAIN_LENGTHS - 1)]);
+}
+
+// Adds the memory that the table allocated for copies of the key and value
+void _AddEntryBytes(_In_ PCHL_HTABLE phtable, _In_ PCHL_KEY pChlKey, _In_ PCHL_VAL pChlVal, _Inout_ CHL_HT_STATS *pStats)
+{
+    if ((phtable->keyType == CHL_KT_STRING) || (phtable->keyType == CHL_KT_WSTRING))
+    {
+        pStats->cbKeys += pChlKey->iKeySize;
+    }
+    if ((phtable->valType == CHL_VT_STRING) || (phtable->valType == CHL_VT_WSTRING) ||
+        (phtable->valType == CHL_VT_USEROBJECT))
+    {
+        pStats->cbValues += pChlVal->iValSize;
+    }
+    pStats->cbValues += _GetMultiValBytes(pChlVal, phtable->valType);
+}
+
+BOOL _FindKnownKeyInList(
+    _In_ HT_NODE *pFirstHTNode,
+    _In_ HT_NODE *pTarget,
+    _Out_ HT_NODE **phtFoundNode,
+    _Out_ HT_NODE **phtPrevFound)
+{
+    HT_NODE *prevNode = NULL;
+    HT_NODE *pcurNode = NULL;
+
+    ASSERT(phtFoundNode && phtPrevFound);
+
+    *phtFoundNode = NULL;
+
+    pcurNode = pFirstHTNode;
+    while (pcurNode && (pcurNode != pTarget))
+    {
+        prevNode = pcurNode;
+        pcurNode = pcurNode->pnext;
+    }
+
+    *phtFoundNode = pcurNode;
+    *phtPrevFound = prevNode;
+    return (pcurNode != NULL);
+}
+
+// Look for the key in the current buckets and, if a resize is in progress,
+// in the old buckets that have not been migrated yet.
+BOOL _FindNode(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ HT_NODE **phtFoundNode,
+    _Out_opt_ HT_NODE **phtPrevFound,
+    _Out_opt_ HT_NODE **phtBucket)
+{
+    int index;
+    BOOL fFound;
+    HT_NODE *pBucket;
+
+    index = _ReduceToBucket(phtable, ullHash, phtable->nTableSize);
+    pBucket = &phtable->phtNodes[index];
+    fFound = _FindKeyInList(pBucket, ullHash, pvkey, iKeySize, phtable->keyType, phtFoundNode, phtPrevFound, HT_COUNTERS(phtable));
+
+    if (!fFound && _IsMigrating(phtable))
+    {
+        index = _ReduceToBucket(phtable, ullHash, phtable->nTableSizeOld);
+        if (index >= phtable->iMigrateIndex)
+        {
+            pBucket = &phtable->phtNodesOld[index];
+            fFound = _FindKeyInList(pBucket, ullHash, pvkey, iKeySize, phtable->keyType, phtFoundNode, phtPrevFound, HT_COUNTERS(phtable));
+        }
+    }
+
+#ifdef CHL_HT_ENABLE_COUNTERS
+    if (HT_COUNTERS(phtable))
+    {
+        ++(phtable->counters.ullLookups);
+        phtable->counters.ullHits += fFound ? 1 : 0;
+    }
+#endif
+
+    IFPTR_SETVAL(phtBucket, pBucket);
+    return fFound;
+}
+
+// Returns the value stored with the key in either layout, NULL if the key is not found.
+// For a key of a multimap with more than one value, this holds all of them.
+PCHL_VAL _FindKeyVal(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    int iEntry;
+    HT_NODE *phtFoundNode;
+
+    if (phtable->pCompact)
+    {
+        iEntry = _FindEntryCompact(phtable, ullHash, pvkey, iKeySize, NULL);
+        return (iEntry != HT_NO_ENTRY) ? &phtable->pCompact->pEntries[iEntry].chlVal : NULL;
+    }
+
+    if (_FindNode(phtable, ullHash, pvkey, iKeySize, &phtFoundNode, NULL, NULL))
+    {
+        // Passed in or Calculated keysize should be equal to stored keysize
+        ASSERT(iKeySize == phtFoundNode->chlKey.iKeySize);
+        return &phtFoundNode->chlVal;
+    }
+    return NULL;
+}
+
+// Returns the stored value of the key, the first one for a key of a multimap. NULL if the key is not found.
+PCHL_VAL _FindVal(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    PCHL_VAL pChlVal = _FindKeyVal(phtable, ullHash, pvkey, iKeySize);
+    return (pChlVal != NULL) ? _GetMultiVals(pChlVal, NULL) : NULL;
+}
+
+// Inserts the key or updates its value, as described for CHL_DsInsertHT. A multimap adds
+// the value to those of the key instead. The caller checks whether the table needs to be
+// resized afterwards.
+HRESULT _InsertOrUpdate(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    HT_NODE *pExistingNode = NULL;
+    SIZE_T cbOld;
+
+    HRESULT hr = S_OK;
+
+    if (_FindNode(phtable, ullHash, pvkey, iKeySize, &pExistingNode, NULL, NULL))
+    {
+        // A multimap adds the value even if the key already has it. Other tables verify
+        // that duplicate values are not inserted (same key and value).
+        if (phtable->fMultimap)
+        {
+            cbOld = _StoredEntryBytes(phtable, iKeySize, &pExistingNode->chlVal);
+            hr = _AppendMultiVal(&pExistingNode->chlVal, phtable->valType, pvVal, iValSize);
+            _AddToByteCount(phtable, _StoredEntryBytes(phtable, iKeySize, &pExistingNode->chlVal), cbOld);
+        }
+        else
+        {
+            hr = _ReplaceVal(phtable, &pExistingNode->chlVal, iKeySize, pvVal, iValSize);
+        }
+        goto done;
+    }
+
+    hr = _InsertNewNode(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize, NULL);
+
+done:
+    return hr;
+}
+
+// Replaces the value of a key that is in the table, unless it is the same value
+HRESULT _ReplaceVal(
+    _In_ PCHL_HTABLE phtable,
+    _Inout_ PCHL_VAL pChlVal,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    SIZE_T cbOld;
+
+    HRESULT hr = S_OK;
+
+    if (!_IsDuplicateVal(pChlVal, pvVal, phtable->valType, pChlVal->iValSize))
+    {
+        // NOTE: Old value will be lost!!
+        cbOld = _EntryBytes(phtable, iKeySize, pChlVal->iValSize);
+        _DeleteVal(pChlVal, phtable->valType, phtable->fValIsInHeap);
+        hr = _CopyValIn(pChlVal, phtable->valType, pvVal, iValSize);
+        _AddToByteCount(phtable, _EntryBytes(phtable, iKeySize, pChlVal->iValSize), cbOld);
+    }
+    return hr;
+}
+
+// Adds a key that is known not to be in the table. New keys always go
+// into the current buckets, even while a resize is in progress.
+HRESULT _InsertNewNode(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_opt_ HT_NODE **phtNewNode)
+{
+    DWORD index;
+    HT_NODE *pNodeAtHashedIndex = NULL;
+    HT_NODE *pNodeToInsertTo = NULL;
+
+    HRESULT hr = S_OK;
+
+    index = _ReduceToBucket(phtable, ullHash, phtable->nTableSize);
+    pNodeAtHashedIndex = &phtable->phtNodes[index];
+
+    if (pNodeAtHashedIndex->fOccupied == FALSE)
+    {
+        // Nothing at this index, just copy key:value into this
+        pNodeToInsertTo = pNodeAtHashedIndex;
+    }
+    else
+    {
+        // Key collision. Attach to linked list.
+        // create a new hashtable node
+        hr = CHL_MmAlloc((PVOID*)&pNodeToInsertTo, sizeof(HT_NODE), NULL);
+        if (FAILED(hr))
+        {
+            hr = E_OUTOFMEMORY;
+            goto done;
+        }
+    }
+
+    ASSERT(pNodeToInsertTo);
+
+    // Populate node
+    hr = _CopyKeyIn(&pNodeToInsertTo->chlKey, phtable->keyType, pvkey, iKeySize);
+    if (SUCCEEDED(hr))
+    {
+        hr = _CopyValIn(&pNodeToInsertTo->chlVal, phtable->valType, pvVal, iValSize);
+        if (SUCCEEDED(hr))
+        {
+            pNodeToInsertTo->fOccupied = TRUE;
+            pNodeToInsertTo->ullHash = ullHash;
+            if (pNodeToInsertTo != pNodeAtHashedIndex)
+            {
+                // There was a key collision. Connect to head of linked list.
+                pNodeToInsertTo->pnext = pNodeAtHashedIndex->pnext;
+                pNodeAtHashedIndex->pnext = pNodeToInsertTo;
+            }
+            _AddToEntryCount(phtable, 1);
+            _AddToByteCount(phtable, _EntryBytes(phtable, iKeySize, iValSize), 0);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        if (pNodeToInsertTo == pNodeAtHashedIndex)
+        {
+            // Preserve pnext and restore because _ClearNode sets it to NULL
+            HT_NODE* pnext = pNodeToInsertTo->pnext;
+            _ClearNode(phtable->keyType, phtable->valType, pNodeToInsertTo, phtable->fValIsInHeap);
+            pNodeToInsertTo->pnext = pnext;
+        }
+        else
+        {
+            // Free the newly allocated node
+            _ClearNode(phtable->keyType, phtable->valType, pNodeToInsertTo, phtable->fValIsInHeap);
+            CHL_MmFree((PVOID*)&pNodeToInsertTo);
+        }
+        goto done;
+    }
+
+    IFPTR_SETVAL(phtNewNode, pNodeToInsertTo);
+
+done:
+    return hr;
+}
+
+// Hashes a group of keys and prefetches what looking them up will touch, in two passes.
+// The first pass prefetches the buckets. By the time the second pass reads a bucket head
+// it is likely in the cache, and the first chained node and the stored key are prefetched.
+// piKeySizesOut is set to zero for keys whose size cannot be determined.
+// A concurrent table, or one with lock-free reads, may be resized by another thread,
+// so its keys are only hashed.
+void _PrepareBatchGroup(
+    _In_ PCHL_HTABLE phtable,
+    _In_count_(nKeys) PCVOID *ppvKeys,
+    _In_opt_count_(nKeys) const int *piKeySizes,
+    _In_ int nKeys,
+    _Out_cap_(nKeys) int *piKeySizesOut,
+    _Out_cap_(nKeys) ULONGLONG *pullHashes)
+{
+    int i;
+    int index;
+    HT_NODE *pBucket;
+    struct _htCompact *pCompact = phtable->pCompact;
+    BOOL fStringKeys = (phtable->keyType == CHL_KT_STRING) || (phtable->keyType == CHL_KT_WSTRING);
+
+    ASSERT(nKeys <= HT_BATCH_GROUP_SIZE);
+
+    for (i = 0; i < nKeys; ++i)
+    {
+        piKeySizesOut[i] = (piKeySizes != NULL) ? piKeySizes[i] : 0;
+        if (piKeySizesOut[i] <= 0 && FAILED(_GetKeySize(ppvKeys[i], phtable->keyType, &piKeySizesOut[i])))
+        {
+            logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+            piKeySizesOut[i] = 0;
+            continue;
+        }
+
+        pullHashes[i] = _GetFullHash(phtable, ppvKeys[i], piKeySizesOut[i]);
+        if (phtable->fConcurrent || phtable->pLockFree)
+        {
+            continue;
+        }
+
+        if (pCompact)
+        {
+            HT_PREFETCH(&pCompact->piBuckets[_ReduceToBucket(phtable, pullHashes[i], phtable->nTableSize)]);
+            continue;
+        }
+
+        HT_PREFETCH(&phtable->phtNodes[_ReduceToBucket(phtable, pullHashes[i], phtable->nTableSize)]);
+        if (_IsMigrating(phtable))
+        {
+            index = _ReduceToBucket(phtable, pullHashes[i], phtable->nTableSizeOld);
+            if (index >= phtable->iMigrateIndex)
+            {
+                HT_PREFETCH(&phtable->phtNodesOld[index]);
+            }
+        }
+    }
+
+    for (i = 0; (i < nKeys) && !phtable->fConcurrent && (phtable->pLockFree == NULL); ++i)
+    {
+        if (piKeySizesOut[i] <= 0)
+        {
+            continue;
+        }
+
+        // A compact bucket only has the index of the first entry in its chain
+        if (pCompact)
+        {
+            index = pCompact->piBuckets[_ReduceToBucket(phtable, pullHashes[i], phtable->nTableSize)];
+            if (index != HT_NO_ENTRY)
+            {
+                HT_PREFETCH(&pCompact->pEntries[index]);
+            }
+            continue;
+        }
+
+        pBucket = &phtable->phtNodes[_ReduceToBucket(phtable, pullHashes[i], phtable->nTableSize)];
+        if (pBucket->pnext != NULL)
+        {
+            HT_PREFETCH(pBucket->pnext);
+        }
+        if (fStringKeys && pBucket->fOccupied && (pBucket->ullHash == pullHashes[i]))
+        {
+            HT_PREFETCH(pBucket->chlKey.keyDef.pvKey);
+        }
+    }
+}
+
+void _RemoveNode(
+    _In_ PCHL_HTABLE phtable,
+    _In_ HT_NODE *phtBucket,
+    _In_ HT_NODE *phtFoundNode,
+    _In_opt_ HT_NODE *phtPrevFound)
+{
+    _ReleaseHandleSlot(phtable, phtFoundNode);
+    _AddToByteCount(phtable, 0, _StoredEntryBytes(phtable, phtFoundNode->chlKey.iKeySize, &phtFoundNode->chlVal));
+
+    if (phtFoundNode == phtBucket)
+    {
+        // Node in the main table is to be removed
+        // Preserve pnext and restore because _ClearNode sets it to NULL
+        HT_NODE* pnext = phtFoundNode->pnext;
+        _ClearNode(phtable->keyType, phtable->valType, phtFoundNode, phtable->fValIsInHeap);
+        phtFoundNode->pnext = pnext;
+    }
+    else
+    {
+        ASSERT(phtPrevFound);
+        phtPrevFound->pnext = phtFoundNode->pnext;
+        _ClearNode(phtable->keyType, phtable->valType, phtFoundNode, phtable->fValIsInHeap);
+        CHL_MmFree((PVOID*)&phtFoundNode);
+    }
+
+    ASSERT(phtable->nEntries > 0);
+    _AddToEntryCount(phtable, -1);
+}
+
+__inline void _AddToEntryCount(_In_ PCHL_HTABLE phtable, _In_ LONG lDelta)
+{
+    if (phtable->fConcurrent)
+    {
+        // Entries in different stripes are added and removed at the same time
+        InterlockedExchangeAdd((volatile LONG*)&phtable->nEntries, lDelta);
+    }
+    else
+    {
+        phtable->nEntries += lDelta;
+    }
+}
+
+__inline void _AddToByteCount(_In_ PCHL_HTABLE phtable, _In_ SIZE_T cbAdded, _In_ SIZE_T cbRemoved)
+{
+    if (phtable->fConcurrent)
+    {
+        // Unsigned arithmetic wraps around, so adding the difference also subtracts
+        InterlockedExchangeAddSizeT(&phtable->budget.cbUsed, cbAdded - cbRemoved);
+    }
+    else
+    {
+        phtable->budget.cbUsed = phtable->budget.cbUsed + cbAdded - cbRemoved;
+    }
+}
+
+// Bytes charged for an entry: its node (or entry of a compact table) and the heap copies of the key and value
+SIZE_T _EntryBytes(_In_ PCHL_HTABLE phtable, _In_ int iKeySize, _In_ int iValSize)
+{
+    return _GetEntryBytes(phtable->keyType, iKeySize, phtable->valType, iValSize,
+        (phtable->pCompact != NULL) ? sizeof(HT_ENTRY) : sizeof(HT_NODE));
+}
+
+// Bytes charged for an entry that is in the table, including all values of a key of a multimap
+SIZE_T _StoredEntryBytes(_In_ PCHL_HTABLE phtable, _In_ int iKeySize, _In_ PCHL_VAL pChlVal)
+{
+    return _EntryBytes(phtable, iKeySize, pChlVal->iValSize) + _GetMultiValBytes(pChlVal, phtable->valType);
+}
+
+// Insert path of tables without CHL_HT_FLAG_CONCURRENT or CHL_HT_FLAG_LOCKFREE_READS, the only
+// ones that can have a budget. With an evicting policy, the entry of the key is kept.
+HRESULT _InsertWithBudget(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    int iEntry;
+    SIZE_T cbReplaced = 0;
+    PCHL_VAL pChlVal;
+    HT_NODE *phtNode;
+
+    HRESULT hr = S_OK;
+
+    if ((phtable->budget.cbMax > 0) && (phtable->budget.policy == CHL_BP_FAIL))
+    {
+        pChlVal = _FindVal(phtable, ullHash, pvkey, iKeySize);
+        cbReplaced = (pChlVal != NULL) ? _EntryBytes(phtable, iKeySize, pChlVal->iValSize) : 0;
+    }
+
+    hr = _CheckBudget(&phtable->budget, _EntryBytes(phtable, iKeySize, iValSize), cbReplaced);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    if (phtable->pCompact)
+    {
+        hr = _InsertCompact(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize);
+        if (SUCCEEDED(hr) && _IsOverBudget(&phtable->budget))
+        {
+            iEntry = _FindEntryCompact(phtable, ullHash, pvkey, iKeySize, NULL);
+            ASSERT(iEntry != HT_NO_ENTRY);
+            _EvictToBudget(phtable, &phtable->pCompact->pEntries[iEntry].chlKey);
+        }
+        goto done;
+    }
+
+    _MigrateStep(phtable);
+    hr = _InsertOrUpdate(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize);
+    if (SUCCEEDED(hr))
+    {
+        if (_IsOverBudget(&phtable->budget) && _FindNode(phtable, ullHash, pvkey, iKeySize, &phtNode, NULL, NULL))
+        {
+            _EvictToBudget(phtable, &phtNode->chlKey);
+        }
+        _ResizeIfNeeded(phtable);
+    }
+
+done:
+    return hr;
+}
+
+// Evicts while over budget, but never the entry whose key is pChlKeyToKeep. The caller checks
+// whether the table needs to be resized afterwards.
+void _EvictToBudget(_In_ PCHL_HTABLE phtable, _In_opt_ PCHL_KEY pChlKeyToKeep)
+{
+    ASSERT(!phtable->fConcurrent && (phtable->pLockFree == NULL));
+
+    while (_IsOverBudget(&phtable->budget) &&
+        ((phtable->budget.policy == CHL_BP_EVICT_OLDEST) || (phtable->budget.policy == CHL_BP_EVICT_RANDOM)))
+    {
+        if (!((phtable->pCompact != NULL) ? _EvictOneCompact(phtable, pChlKeyToKeep) : _EvictOne(phtable, pChlKeyToKeep)))
+        {
+            break;
+        }
+    }
+}
+
+// Evicts a random entry: the first one found from a random bucket on. Returns FALSE if there is none to evict.
+BOOL _EvictOne(_In_ PCHL_HTABLE phtable, _In_opt_ PCHL_KEY pChlKeyToKeep)
+{
+    int i;
+    int iStart;
+    int nBuckets;
+    HT_NODE *phtBucket;
+    HT_NODE *phtNode;
+    HT_NODE *phtPrev;
+
+    ASSERT(phtable->budget.policy == CHL_BP_EVICT_RANDOM);
+
+    // While a resize is in progress entries are in either set of buckets
+    nBuckets = phtable->nTableSizeOld + phtable->nTableSize;
+    iStart = (int)_NextBudgetRandom(&phtable->budget, (UINT)nBuckets);
+    for (i = 0; i < nBuckets; ++i)
+    {
+        phtBucket = _GetBucketAt(phtable, (iStart + i) % nBuckets);
+        for (phtPrev = NULL, phtNode = phtBucket; phtNode != NULL; phtPrev = phtNode, phtNode = phtNode->pnext)
+        {
+            if (phtNode->fOccupied && (&phtNode->chlKey != pChlKeyToKeep))
+            {
+                _NotifyEvict(&phtable->budget, &phtNode->chlKey, phtable->keyType, &phtNode->chlVal, phtable->valType);
+                _RemoveNode(phtable, phtBucket, phtNode, phtPrev);
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+// Evicts the oldest entry, or a random one, of a compact table. The entry leaves a hole that is
+// squeezed out later as for CHL_DsRemoveAtHT. Returns FALSE if there is no entry to evict.
+BOOL _EvictOneCompact(_In_ PCHL_HTABLE phtable, _In_opt_ PCHL_KEY pChlKeyToKeep)
+{
+    int i;
+    int iStart;
+    int iEntry;
+    HT_ENTRY *pEntry;
+    struct _htCompact *pCompact = phtable->pCompact;
+
+    if (pCompact->nEntriesUsed == 0)
+    {
+        return FALSE;
+    }
+
+    if (phtable->budget.policy == CHL_BP_EVICT_OLDEST)
+    {
+        // Entries are in insertion order
+        iStart = min(pCompact->iFirstEntry, pCompact->nEntriesUsed);
+        while ((iStart < pCompact->nEntriesUsed) && !pCompact->pEntries[iStart].fOccupied)
+        {
+            ++iStart;
+        }
+        pCompact->iFirstEntry = iStart;
+    }
+    else
+    {
+        iStart = (int)_NextBudgetRandom(&phtable->budget, (UINT)pCompact->nEntriesUsed);
+    }
+
+    for (i = 0; i < pCompact->nEntriesUsed; ++i)
+    {
+        iEntry = (iStart + i) % pCompact->nEntriesUsed;
+        pEntry = &pCompact->pEntries[iEntry];
+        if (pEntry->fOccupied && (&pEntry->chlKey != pChlKeyToKeep))
+        {
+            _NotifyEvict(&phtable->budget, &pEntry->chlKey, phtable->keyType, &pEntry->chlVal, phtable->valType);
+            _RemoveEntryCompact(phtable, iEntry, _FindLinkToEntryCompact(phtable, iEntry));
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Checks that the source tables can be merged into the destination
+HRESULT _CheckMergeTables(_In_ PCHL_HTABLE phtDst, _In_count_(nSrcs) PCHL_HTABLE *pphtSrcs, _In_ int nSrcs)
+{
+    int i;
+    int j;
+    SIZE_T cbTotal = phtDst->budget.cbUsed;
+    PCHL_HTABLE phtSrc;
+
+    // Nodes of tables with lock-free reads must be retired, compact tables have no nodes to move.
+    // Values of a key that is in more than one multimap would have to be concatenated.
+    if (phtDst->pLockFree || phtDst->pCompact || phtDst->fMultimap)
+    {
+        logerr("%s(): Not supported on a compact table, a multimap or one with lock-free reads.", __FUNCTION__);
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    for (i = 0; i < nSrcs; ++i)
+    {
+        phtSrc = pphtSrcs[i];
+        if ((phtSrc == NULL) || (phtSrc == phtDst) ||
+            (phtSrc->keyType != phtDst->keyType) ||
+            (phtSrc->valType != phtDst->valType) ||
+            (phtSrc->fValIsInHeap != phtDst->fValIsInHeap))
+        {
+            logerr("%s(): Source table %d cannot be merged.", __FUNCTION__, i);
+            return E_INVALIDARG;
+        }
+
+        for (j = 0; j < i; ++j)
+        {
+            if (pphtSrcs[j] == phtSrc)
+            {
+                logerr("%s(): Source table %d is also source table %d.", __FUNCTION__, i, j);
+                return E_INVALIDARG;
+            }
+        }
+
+        if (phtSrc->pLockFree || phtSrc->pCompact || phtSrc->fMultimap)
+        {
+            logerr("%s(): Not supported on a compact table, a multimap or one with lock-free reads.", __FUNCTION__);
+            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        }
+
+        cbTotal += phtSrc->budget.cbUsed;
+    }
+
+    // As if no key was in more than one table
+    if ((phtDst->budget.cbMax > 0) && (phtDst->budget.policy == CHL_BP_FAIL) && (cbTotal > phtDst->budget.cbMax))
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA);
+    }
+    return S_OK;
+}
+
+// Moves the entries of one table into another on the calling thread. The destination grows
+// and migrates its buckets as it would for Inserts. Entries are taken in groups, as batch
+// operations take keys, so that the destination buckets of a group are prefetched together.
+HRESULT _MergeTable(
+    _In_ PCHL_HTABLE phtDst,
+    _In_ PCHL_HTABLE phtSrc,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext)
+{
+    int i;
+    int iGroup;
+    int nGroup;
+    int nBuckets;
+    BOOL fRehash;
+    HT_NODE *phtBucket = NULL;
+    HT_NODE *pcurnode = NULL;
+    HT_NODE *pnextnode;
+    HT_NODE *apGroup[HT_BATCH_GROUP_SIZE];
+    BOOL afBucketHeads[HT_BATCH_GROUP_SIZE];
+    HT_MERGE_RANGE totals;
+
+    HRESULT hr = S_OK;
+
+    fRehash = _NeedsRehashForMerge(phtDst, phtSrc);
+
+    // While a resize is in progress entries are in either set of buckets
+    nBuckets = phtSrc->nTableSizeOld + phtSrc->nTableSize;
+    i = 0;
+    for (;;)
+    {
+        // Unlink the next group, each bucket head first and then its chain
+        nGroup = 0;
+        while (nGroup < HT_BATCH_GROUP_SIZE)
+        {
+            if (pcurnode == NULL)
+            {
+                if (i >= nBuckets)
+                {
+                    break;
+                }
+                phtBucket = _GetBucketAt(phtSrc, i++);
+                pcurnode = phtBucket->fOccupied ? phtBucket : phtBucket->pnext;
+                if (!phtBucket->fOccupied)
+                {
+                    // A removed head can still hold a chain, which is taken as well
+                    phtBucket->pnext = NULL;
+                }
+                continue;
+            }
+
+            pnextnode = pcurnode->pnext;
+            pcurnode->pnext = NULL;
+
+            ASSERT(pcurnode->fOccupied);
+            if (fRehash)
+            {
+                pcurnode->ullHash = _GetFullHash(phtDst, _GetKeyArg(&pcurnode->chlKey, phtDst->keyType), pcurnode->chlKey.iKeySize);
+            }
+            HT_PREFETCH(&phtDst->phtNodes[_ReduceToBucket(phtDst, pcurnode->ullHash, phtDst->nTableSize)]);
+
+            afBucketHeads[nGroup] = (pcurnode == phtBucket);
+            apGroup[nGroup++] = pcurnode;
+            pcurnode = pnextnode;
+        }
+
+        if (nGroup == 0)
+        {
+            break;
+        }
+
+        _PrefetchMergeGroup(phtDst, apGroup, nGroup);
+        for (iGroup = 0; iGroup < nGroup; ++iGroup)
+        {
+            _MigrateStep(phtDst);
+            ZeroMemory(&totals, sizeof(totals));
+            if (FAILED(_MergeNode(phtDst, apGroup[iGroup], afBucketHeads[iGroup], pfnCombine, pvContext, &totals)))
+            {
+                // Left in the source, which counts what it has left when finished
+                hr = E_OUTOFMEMORY;
+            }
+
+            _AddToEntryCount(phtDst, totals.nEntriesAdded);
+            _AddToByteCount(phtDst, totals.cbAdded, totals.cbRemoved);
+            _ResizeIfNeeded(phtDst);
+        }
+    }
+
+    _FinishMergeSource(phtSrc);
+    return hr;
+}
+
+// Second pass over a group of entries about to be merged, whose destination buckets were
+// prefetched as the group was taken. By now the buckets are likely in the cache, so what
+// comparing the keys touches is prefetched too, as _PrepareBatchGroup does.
+void _PrefetchMergeGroup(_In_ PCHL_HTABLE phtDst, _In_count_(nGroup) HT_NODE **ppGroup, _In_ int nGroup)
+{
+    int i;
+    HT_NODE *phtBucket;
+    BOOL fStringKeys = (phtDst->keyType == CHL_KT_STRING) || (phtDst->keyType == CHL_KT_WSTRING);
+
+    for (i = 0; i < nGroup; ++i)
+    {
+        phtBucket = &phtDst->phtNodes[_ReduceToBucket(phtDst, ppGroup[i]->ullHash, phtDst->nTableSize)];
+        if (phtBucket->pnext != NULL)
+        {
+            HT_PREFETCH(phtBucket->pnext);
+        }
+        if (fStringKeys && phtBucket->fOccupied && (phtBucket->ullHash == ppGroup[i]->ullHash))
+        {
+            HT_PREFETCH(phtBucket->chlKey.keyDef.pvKey);
+        }
+    }
+}
+
+// Returns an estimate of the number of distinct keys in all tables. For each source, a sample
+// of its keys is looked up in the destination and the sources before it, the share of keys that
+// are in none of them is taken to be the share of its entries that the merge adds.
+LONGLONG _EstimateMergedEntries(_In_ PCHL_HTABLE phtDst, _In_count_(nSrcs) PCHL_HTABLE *pphtSrcs, _In_ int nSrcs)
+{
+    int i;
+    int iSrc;
+    int iPrev;
+    int nBuckets;
+    int nStride;
+    int nSampled;
+    int nNew;
+    PVOID pvKey;
+    HT_NODE *phtNode;
+    PCHL_HTABLE phtSrc;
+    PCHL_HTABLE phtOther;
+    LONGLONG llEntries = phtDst->nEntries;
+
+    for (iSrc = 0; iSrc < nSrcs; ++iSrc)
+    {
+        phtSrc = pphtSrcs[iSrc];
+        if (phtSrc->nEntries == 0)
+        {
+            continue;
+        }
+
+        nSampled = 0;
+        nNew = 0;
+        nBuckets = phtSrc->nTableSizeOld + phtSrc->nTableSize;
+        nStride = max(1, nBuckets / HT_MERGE_SAMPLE_KEYS);
+        for (i = 0; (i < nBuckets) && (nSampled < HT_MERGE_SAMPLE_KEYS); i += nStride)
+        {
+            // The first entry of each sampled bucket
+            phtNode = _GetBucketAt(phtSrc, i);
+            phtNode = phtNode->fOccupied ? phtNode : phtNode->pnext;
+            if (phtNode == NULL)
+            {
+                continue;
+            }
+
+            ++nSampled;
+            pvKey = _GetKeyArg(&phtNode->chlKey, phtSrc->keyType);
+            for (iPrev = -1; iPrev < iSrc; ++iPrev)
+            {
+                phtOther = (iPrev < 0) ? phtDst : pphtSrcs[iPrev];
+                if ((phtOther->nEntries > 0) &&
+                    (_FindNodeForMerge(phtOther, _GetFullHash(phtOther, pvKey, phtNode->chlKey.iKeySize), pvKey, phtNode->chlKey.iKeySize) != NULL))
+                {
+                    break;
+                }
+            }
+            nNew += (iPrev == iSrc) ? 1 : 0;
+        }
+
+        if (nSampled > 0)
+        {
+            llEntries += ((LONGLONG)phtSrc->nEntries * nNew) / nSampled;
+        }
+    }
+    return llEntries;
+}
+
+// Grows the destination so that it fits the estimated number of entries after the merge.
+// Workers only place entries into the current buckets, which must stay the same meanwhile.
+HRESULT _PrepareMergeDest(_In_ PCHL_HTABLE phtDst, _In_count_(nSrcs) PCHL_HTABLE *pphtSrcs, _In_ int nSrcs)
+{
+    int iNewSizeIndex;
+    LONGLONG llEntries;
+
+    _CompleteMigration(phtDst);
+
+    llEntries = _EstimateMergedEntries(phtDst, pphtSrcs, nSrcs);
+    if ((phtDst->iGrowLoadPct > 0) && (llEntries * 100 > (LONGLONG)phtDst->nTableSize * phtDst->iGrowLoadPct))
+    {
+        iNewSizeIndex = CHL_DsGetNearestSizeIndexHT(
+            (int)min(llEntries, MAXINT32 / HT_RESIZE_ENTRIES_MULTIPLIER) * HT_RESIZE_ENTRIES_MULTIPLIER);
+        if (!_IsMigrating(phtDst) && (s_hashSizes[iNewSizeIndex] > phtDst->nTableSize))
+        {
+            // If this fails the table is merged into at its current size
+            _BeginMigration(phtDst, iNewSizeIndex);
+            _CompleteMigration(phtDst);
+        }
+    }
+
+    if (_IsMigrating(phtDst))
+    {
+        logerr("%s(): Out of memory resizing the destination table.", __FUNCTION__);
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
+}
+
+// Runs one phase of a merge on up to nThreads threads, including the calling one
+void _RunMergePhase(_In_ HT_MERGE *pMerge, _In_ BOOL fPlacing, _In_ int nThreads)
+{
+    int i;
+    int nStarted = 0;
+    HANDLE ahThreads[HT_MERGE_MAX_THREADS];
+
+    pMerge->fPlacing = fPlacing;
+    pMerge->lNextWork = 0;
+    pMerge->lWorkItems = fPlacing ? pMerge->nRanges : pMerge->nSrcs;
+
+    // If a thread cannot be started, the others take its share
+    nThreads = min(nThreads, (int)pMerge->lWorkItems);
+    for (i = 1; i < nThreads; ++i)
+    {
+        ahThreads[nStarted] = CreateThread(NULL, 0, _MergeWorker, pMerge, 0, NULL);
+        if (ahThreads[nStarted] == NULL)
+        {
+            logwarn("%s(): CreateThread() failed, merging on %d threads", __FUNCTION__, nStarted + 1);
+            break;
+        }
+        ++nStarted;
+    }
+
+    _MergeWorker(pMerge);
+
+    if (nStarted > 0)
+    {
+        WaitForMultipleObjects(nStarted, ahThreads, TRUE, INFINITE);
+        for (i = 0; i < nStarted; ++i)
+        {
+            CloseHandle(ahThreads[i]);
+        }
+    }
+}
+
+DWORD WINAPI _MergeWorker(_In_ LPVOID pvMerge)
+{
+    LONG lWork;
+    HT_MERGE *pMerge = (HT_MERGE*)pvMerge;
+
+    while ((lWork = InterlockedIncrement(&pMerge->lNextWork) - 1) < pMerge->lWorkItems)
+    {
+        if (pMerge->fPlacing)
+        {
+            _PlaceMergeRange(pMerge, (int)lWork);
+        }
+        else
+        {
+            _SplitMergeSource(pMerge, (int)lWork);
+        }
+    }
+    return 0;
+}
+
+// Unlinks every entry of a source table into the lists of the destination bucket ranges they go
+// into. Bucket heads are linked into lists of their own since they are part of the source's bucket
+// array, only their contents can be moved. The source is not usable until its entries are placed
+// and _FinishMergeSource is called.
+void _SplitMergeSource(_In_ HT_MERGE *pMerge, _In_ int iSrc)
+{
+    int i;
+    int nBuckets;
+    int iRange;
+    BOOL fRehash;
+    DWORD index;
+    HT_NODE *phtBucket;
+    HT_NODE *pcurnode;
+    HT_NODE *pnextnode;
+    HT_NODE **ppLists;
+    PCHL_HTABLE phtDst = pMerge->phtDst;
+    PCHL_HTABLE phtSrc = pMerge->pphtSrcs[iSrc];
+
+    fRehash = _NeedsRehashForMerge(phtDst, phtSrc);
+
+    nBuckets = phtSrc->nTableSizeOld + phtSrc->nTableSize;
+    for (i = 0; i < nBuckets; ++i)
+    {
+        phtBucket = _GetBucketAt(phtSrc, i);
+        pcurnode = phtBucket->fOccupied ? phtBucket : phtBucket->pnext;
+        if (!phtBucket->fOccupied)
+        {
+            // A removed head can still hold a chain, which is taken as well
+            phtBucket->pnext = NULL;
+        }
+        while (pcurnode)
+        {
+            pnextnode = (pcurnode == phtBucket) ? phtBucket->pnext : pcurnode->pnext;
+
+            ASSERT(pcurnode->fOccupied);
+            if (fRehash)
+            {
+                pcurnode->ullHash = _GetFullHash(phtDst, _GetKeyArg(&pcurnode->chlKey, phtDst->keyType), pcurnode->chlKey.iKeySize);
+            }
+
+            index = _ReduceToBucket(phtDst, pcurnode->ullHash, phtDst->nTableSize);
+            iRange = (int)(((ULONGLONG)index * pMerge->nRanges) / phtDst->nTableSize);
+            ppLists = (pcurnode == phtBucket) ? pMerge->ppHeadLists : pMerge->ppLists;
+            ppLists += ((SIZE_T)iSrc * pMerge->nRanges) + iRange;
+
+            pcurnode->pnext = *ppLists;
+            *ppLists = pcurnode;
+            pcurnode = pnextnode;
+        }
+    }
+}
+
+// Places the entries of all sources that go into one range of destination buckets. Only this
+// worker touches these buckets, the totals are added to the destination when all are done.
+// Entries are placed in groups, as _MergeTable does.
+void _PlaceMergeRange(_In_ HT_MERGE *pMerge, _In_ int iRange)
+{
+    int iSrc;
+    int iList;
+    int iGroup;
+    int nGroup;
+    SIZE_T iListIndex;
+    HT_NODE *pcurnode;
+    HT_NODE *apGroup[HT_BATCH_GROUP_SIZE];
+    PCHL_HTABLE phtDst = pMerge->phtDst;
+    HT_MERGE_RANGE totals = { 0 };
+
+    // Sources in order, so that the value a key is left with does not depend on the threads
+    for (iSrc = 0; iSrc < pMerge->nSrcs; ++iSrc)
+    {
+        iListIndex = ((SIZE_T)iSrc * pMerge->nRanges) + iRange;
+        for (iList = 0; iList < 2; ++iList)
+        {
+            pcurnode = (iList == 0) ? pMerge->ppHeadLists[iListIndex] : pMerge->ppLists[iListIndex];
+            while (pcurnode != NULL)
+            {
+                for (nGroup = 0; (nGroup < HT_BATCH_GROUP_SIZE) && (pcurnode != NULL); ++nGroup)
+                {
+                    apGroup[nGroup] = pcurnode;
+                    pcurnode = pcurnode->pnext;
+                    apGroup[nGroup]->pnext = NULL;
+                    HT_PREFETCH(&phtDst->phtNodes[_ReduceToBucket(phtDst, apGroup[nGroup]->ullHash, phtDst->nTableSize)]);
+                }
+
+                _PrefetchMergeGroup(phtDst, apGroup, nGroup);
+
+                for (iGroup = 0; iGroup < nGroup; ++iGroup)
+                {
+                    if (FAILED(_MergeNode(phtDst, apGroup[iGroup], (iList == 0), pMerge->pfnCombine, pMerge->pvContext, &totals)))
+                    {
+                        // Left in the source, which counts what it has left when finished
+                        InterlockedExchange(&pMerge->lOutOfMemory, TRUE);
+                    }
+                }
+            }
+        }
+        pMerge->ppHeadLists[iListIndex] = NULL;
+        pMerge->ppLists[iListIndex] = NULL;
+    }
+
+    pMerge->pRanges[iRange] = totals;
+}
+
+// Moves a node of a source table into the destination, or combines it with the destination's
+// entry of the same key. A node that is the head of a source bucket is left where it is and
+// only its contents are moved. Fails only if a node has to be allocated for a bucket head
+// and memory runs out, the head is then left as it is.
+HRESULT _MergeNode(
+    _In_ PCHL_HTABLE phtDst,
+    _Inout_ HT_NODE *phtNode,
+    _In_ BOOL fBucketHead,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _Inout_ HT_MERGE_RANGE *pTotals)
+{
+    SIZE_T cbEntry;
+    CHL_VAL chlVal;
+    HT_NODE *phtBucket;
+    HT_NODE *phtFoundNode;
+    HT_NODE *phtNewNode;
+
+    ASSERT(phtNode->fOccupied && (phtNode->pnext == NULL));
+
+    phtFoundNode = _FindNodeForMerge(phtDst, phtNode->ullHash,
+        _GetKeyArg(&phtNode->chlKey, phtDst->keyType), phtNode->chlKey.iKeySize);
+    if (phtFoundNode != NULL)
+    {
+        cbEntry = _EntryBytes(phtDst, phtFoundNode->chlKey.iKeySize, phtFoundNode->chlVal.iValSize);
+        if (pfnCombine)
+        {
+            pfnCombine(&phtFoundNode->chlVal, &phtNode->chlVal, phtDst->valType, pvContext);
+        }
+        else
+        {
+            chlVal = phtFoundNode->chlVal;
+            phtFoundNode->chlVal = phtNode->chlVal;
+            phtNode->chlVal = chlVal;
+        }
+
+        pTotals->cbRemoved += cbEntry;
+        pTotals->cbAdded += _EntryBytes(phtDst, phtFoundNode->chlKey.iKeySize, phtFoundNode->chlVal.iValSize);
+
+        _ClearNode(phtDst->keyType, phtDst->valType, phtNode, phtDst->fValIsInHeap);
+        if (!fBucketHead)
+        {
+            CHL_MmFree((PVOID*)&phtNode);
+        }
+        return S_OK;
+    }
+
+    // New keys always go into the current buckets, as for _InsertNewNode
+    cbEntry = _EntryBytes(phtDst, phtNode->chlKey.iKeySize, phtNode->chlVal.iValSize);
+    phtBucket = &phtDst->phtNodes[_ReduceToBucket(phtDst, phtNode->ullHash, phtDst->nTableSize)];
+    if (!phtBucket->fOccupied)
+    {
+        _MoveNodeContents(phtDst, phtBucket, phtNode);
+        if (!fBucketHead)
+        {
+            CHL_MmFree((PVOID*)&phtNode);
+        }
+    }
+    else
+    {
+        phtNewNode = phtNode;
+        if (fBucketHead)
+        {
+            if (FAILED(CHL_MmAlloc((PVOID*)&phtNewNode, sizeof(HT_NODE), NULL)))
+            {
+                return E_OUTOFMEMORY;
+            }
+            _MoveNodeContents(phtDst, phtNewNode, phtNode);
+        }
+
+        phtNewNode->pnext = phtBucket->pnext;
+        phtBucket->pnext = phtNewNode;
+    }
+
+    ++(pTotals->nEntriesAdded);
+    pTotals->cbAdded += cbEntry;
+    return S_OK;
+}
+
+// Same as _FindNode but does not update the lookup counters, which merge workers would share
+HT_NODE* _FindNodeForMerge(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PVOID pvkey, _In_ int iKeySize)
+{
+    int index;
+    HT_NODE *phtFoundNode;
+
+    index = _ReduceToBucket(phtable, ullHash, phtable->nTableSize);
+    if (_FindKeyInList(&phtable->phtNodes[index], ullHash, pvkey, iKeySize, phtable->keyType, &phtFoundNode, NULL, NULL))
+    {
+        return phtFoundNode;
+    }
+
+    if (_IsMigrating(phtable))
+    {
+        index = _ReduceToBucket(phtable, ullHash, phtable->nTableSizeOld);
+        if ((index >= phtable->iMigrateIndex) &&
+            _FindKeyInList(&phtable->phtNodesOld[index], ullHash, pvkey, iKeySize, phtable->keyType, &phtFoundNode, NULL, NULL))
+        {
+            return phtFoundNode;
+        }
+    }
+    return NULL;
+}
+
+// Counts what is left in a source table after its entries were merged, only bucket heads that
+// could not be moved are, and gives back its buckets
+void _FinishMergeSource(_In_ PCHL_HTABLE phtSrc)
+{
+    int i;
+    int nBuckets;
+    HT_NODE *phtBucket;
+
+    phtSrc->nEntries = 0;
+    phtSrc->budget.cbUsed = 0;
+
+    nBuckets = phtSrc->nTableSizeOld + phtSrc->nTableSize;
+    for (i = 0; i < nBuckets; ++i)
+    {
+        phtBucket = _GetBucketAt(phtSrc, i);
+        ASSERT(phtBucket->pnext == NULL);
+        if (phtBucket->fOccupied)
+        {
+            ++(phtSrc->nEntries);
+            phtSrc->budget.cbUsed += _EntryBytes(phtSrc, phtBucket->chlKey.iKeySize, phtBucket->chlVal.iValSize);
+        }
+    }
+
+    ++(phtSrc->uLayoutVersion);
+    _CompleteMigration(phtSrc);
+    _ResizeIfNeeded(phtSrc);
+    _CompleteMigration(phtSrc);
+}
+
+// Whether the hash cached in the nodes of the source is not the one the destination would compute
+BOOL _NeedsRehashForMerge(_In_ PCHL_HTABLE phtDst, _In_ PCHL_HTABLE phtSrc)
+{
+    return (phtSrc->hashType != phtDst->hashType) ||
+        ((phtDst->hashType != CHL_HT_HASH_DJB2) && (phtSrc->ullHashSeed != phtDst->ullHashSeed));
+}
+
+// Locks the stripe that guards the bucket of the hash in the current buckets. Returns the stripe
+// to pass to _UnlockStripe. If the table was left in the middle of a resize (only if memory ran out
+// while resizing), every stripe is locked exclusively and HT_ALL_STRIPES is returned.
+int _LockStripe(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ BOOL fExclusive)
+{
+    int iStripe;
+    int nBuckets;
+    PSRWLOCK psrwLock;
+
+    ASSERT(phtable->fConcurrent);
+
+    for (;;)
+    {
+        // Resizing holds every stripe, so the number of buckets cannot change while
+        // a stripe is held. If it changed before the stripe was acquired, try again.
+        nBuckets = *(volatile int*)&phtable->nTableSize;
+        iStripe = _ReduceToBucket(phtable, ullHash, nBuckets) & (HT_LOCK_STRIPES - 1);
+        psrwLock = &phtable->pStripeLocks[iStripe].srwLock;
+
+        if (fExclusive)
+        {
+            AcquireSRWLockExclusive(psrwLock);
+        }
+        else
+        {
+            AcquireSRWLockShared(psrwLock);
+        }
+
+        if ((phtable->nTableSize == nBuckets) && !_IsMigrating(phtable))
+        {
+            return iStripe;
+        }
+
+        _UnlockStripe(phtable, iStripe, fExclusive);
+        if (_IsMigrating(phtable))
+        {
+            _LockAllStripes(phtable);
+            _CompleteMigration(phtable);
+            return HT_ALL_STRIPES;
+        }
+    }
+}
+
+void _UnlockStripe(_In_ PCHL_HTABLE phtable, _In_ int iStripe, _In_ BOOL fExclusive)
+{
+    if (iStripe == HT_ALL_STRIPES)
+    {
+        _UnlockAllStripes(phtable);
+    }
+    else if (fExclusive)
+    {
+        ReleaseSRWLockExclusive(&phtable->pStripeLocks[iStripe].srwLock);
+    }
+    else
+    {
+        ReleaseSRWLockShared(&phtable->pStripeLocks[iStripe].srwLock);
+    }
+}
+
+// Stripes are always locked in ascending order, and a single operation holds either
+// one stripe or all of them, so this cannot deadlock.
+void _LockAllStripes(_In_ PCHL_HTABLE phtable)
+{
+    int i;
+    for (i = 0; i < HT_LOCK_STRIPES; ++i)
+    {
+        AcquireSRWLockExclusive(&phtable->pStripeLocks[i].srwLock);
+    }
+}
+
+void _UnlockAllStripes(_In_ PCHL_HTABLE phtable)
+{
+    int i;
+    for (i = HT_LOCK_STRIPES - 1; i >= 0; --i)
+    {
+        ReleaseSRWLockExclusive(&phtable->pStripeLocks[i].srwLock);
+    }
+}
+
+// Called by a concurrent Insert/Remove after its stripe is released
+void _ResizeConcurrent(_In_ PCHL_HTABLE phtable)
+{
+    // Unlocked check first, this is racy but most calls need not resize
+    if (_GetResizeSizeIndex(phtable) < 0)
+    {
+        return;
+    }
+
+    _LockAllStripes(phtable);
+    _CompleteMigration(phtable);
+    _ResizeIfNeeded(phtable);
+    _UnlockAllStripes(phtable);
+}
+
+__inline BOOL _IsMigrating(_In_ PCHL_HTABLE phtable)
+{
+    return (phtable->phtNodesOld != NULL);
+}
+
+// Buckets are indexed as if the old buckets (if any) were followed by the current ones
+__inline HT_NODE* _GetBucketAt(_In_ PCHL_HTABLE phtable, _In_ int iBucket)
+{
+    ASSERT((iBucket >= 0) && (iBucket < (phtable->nTableSizeOld + phtable->nTableSize)));
+
+    return (iBucket < phtable->nTableSizeOld) ?
+        &phtable->phtNodesOld[iBucket] :
+        &phtable->phtNodes[iBucket - phtable->nTableSizeOld];
+}
+
+BOOL _SupportsEntryHandles(_In_ PCHL_HTABLE phtable)
+{
+    return !phtable->fConcurrent && (phtable->pLockFree == NULL) && (phtable->pCompact == NULL) && !phtable->fMultimap;
+}
+
+// Makes sure that a slot is available for _GetEntryHandle
+HRESULT _ReserveHandleSlot(_In_ PCHL_HTABLE phtable)
+{
+    UINT nNewAlloc;
+    HT_HANDLE_SLOT *pNewSlots;
+    struct _htHandleSlots *pHandleSlots = phtable->pHandleSlots;
+
+    if (pHandleSlots == NULL)
+    {
+        pHandleSlots = (struct _htHandleSlots*)calloc(1, sizeof(struct _htHandleSlots));
+        if (pHandleSlots == NULL)
+        {
+            logerr("%s(): calloc() ", __FUNCTION__);
+            return E_OUTOFMEMORY;
+        }
+        phtable->pHandleSlots = pHandleSlots;
+    }
+
+    if ((pHandleSlots->uFirstFree != 0) || (pHandleSlots->nSlotsUsed < pHandleSlots->nSlotsAlloc))
+    {
+        return S_OK;
+    }
+
+    if (pHandleSlots->nSlotsAlloc > (MAXINT32 / 2))
+    {
+        logerr("%s(): Too many entry handles", __FUNCTION__);
+        return E_OUTOFMEMORY;
+    }
+
+    nNewAlloc = max(HT_HANDLE_MIN_SLOTS, pHandleSlots->nSlotsAlloc * 2);
+    pNewSlots = (HT_HANDLE_SLOT*)realloc(pHandleSlots->pSlots, (SIZE_T)nNewAlloc * sizeof(HT_HANDLE_SLOT));
+    if (pNewSlots == NULL)
+    {
+        logerr("%s(): realloc() ", __FUNCTION__);
+        return E_OUTOFMEMORY;
+    }
+
+    ZeroMemory(pNewSlots + pHandleSlots->nSlotsAlloc, (SIZE_T)(nNewAlloc - pHandleSlots->nSlotsAlloc) * sizeof(HT_HANDLE_SLOT));
+    pHandleSlots->pSlots = pNewSlots;
+    pHandleSlots->nSlotsAlloc = nNewAlloc;
+    return S_OK;
+}
+
+// Returns the handle of the node, taking a slot for it if it has none yet. A slot must
+// have been reserved with _ReserveHandleSlot.
+void _GetEntryHandle(_In_ PCHL_HTABLE phtable, _Inout_ HT_NODE *phtNode, _Out_ PCHL_HT_ENTRYHANDLE phEntry)
+{
+    UINT uSlot;
+    HT_HANDLE_SLOT *pSlot;
+    struct _htHandleSlots *pHandleSlots = phtable->pHandleSlots;
+
+    ASSERT(phtNode->fOccupied);
+
+    if (phtNode->uHandleSlot == 0)
+    {
+        if (pHandleSlots->uFirstFree != 0)
+        {
+            uSlot = pHandleSlots->uFirstFree - 1;
+            pHandleSlots->uFirstFree = pHandleSlots->pSlots[uSlot].uNextFree;
+        }
+        else
+        {
+            ASSERT(pHandleSlots->nSlotsUsed < pHandleSlots->nSlotsAlloc);
+            uSlot = (pHandleSlots->nSlotsUsed)++;
+        }
+
+        pSlot = &pHandleSlots->pSlots[uSlot];
+        ASSERT((pSlot->phtNode == NULL) && ((pSlot->uGeneration & 1) == 0));
+        ++(pSlot->uGeneration);
+        pSlot->phtNode = phtNode;
+        pSlot->uNextFree = 0;
+        phtNode->uHandleSlot = uSlot + 1;
+    }
+
+    phEntry->uSlot = phtNode->uHandleSlot - 1;
+    phEntry->uGeneration = pHandleSlots->pSlots[phEntry->uSlot].uGeneration;
+}
+
+// Returns the node that the handle refers to, or NULL if the handle does not match its slot
+HT_NODE* _NodeFromEntryHandle(_In_ PCHL_HTABLE phtable, _In_opt_ const CHL_HT_ENTRYHANDLE *phEntry)
+{
+    HT_HANDLE_SLOT *pSlot;
+    struct _htHandleSlots *pHandleSlots = phtable->pHandleSlots;
+
+    if ((phEntry == NULL) || (pHandleSlots == NULL) || (phEntry->uSlot >= pHandleSlots->nSlotsUsed))
+    {
+        return NULL;
+    }
+
+    pSlot = &pHandleSlots->pSlots[phEntry->uSlot];
+    if ((pSlot->uGeneration != phEntry->uGeneration) || ((pSlot->uGeneration & 1) == 0))
+    {
+        return NULL;
+    }
+
+    ASSERT(pSlot->phtNode->fOccupied && (pSlot->phtNode->uHandleSlot == phEntry->uSlot + 1));
+    return pSlot->phtNode;
+}
+
+// Gives back the slot of a node that is being removed. A slot whose generation would
+// wrap around is not used again, so that old handles cannot match it by chance.
+void _ReleaseHandleSlot(_In_ PCHL_HTABLE phtable, _Inout_ HT_NODE *phtNode)
+{
+    HT_HANDLE_SLOT *pSlot;
+    struct _htHandleSlots *pHandleSlots = phtable->pHandleSlots;
+
+    if (phtNode->uHandleSlot == 0)
+    {
+        return;
+    }
+
+    pSlot = &pHandleSlots->pSlots[phtNode->uHandleSlot - 1];
+    ASSERT(pSlot->phtNode == phtNode);
+
+    pSlot->phtNode = NULL;
+    ++(pSlot->uGeneration);
+    if (pSlot->uGeneration != 0)
+    {
+        pSlot->uNextFree = pHandleSlots->uFirstFree;
+        pHandleSlots->uFirstFree = phtNode->uHandleSlot;
+    }
+
+    phtNode->uHandleSlot = 0;
+}
+
+void _ReleaseAllHandleSlots(_In_ PCHL_HTABLE phtable)
+{
+    UINT i;
+    struct _htHandleSlots *pHandleSlots = phtable->pHandleSlots;
+
+    if (pHandleSlots == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < pHandleSlots->nSlotsUsed; ++i)
+    {
+        if (pHandleSlots->pSlots[i].phtNode != NULL)
+        {
+            _ReleaseHandleSlot(phtable, pHandleSlots->pSlots[i].phtNode);
+        }
+    }
+}
+
+// Finds the bucket that a node is in and the node before it in the chain, by following
+// the chain that its cached hash leads to. Keys are neither hashed nor compared.
+BOOL _FindNodeLinks(
+    _In_ PCHL_HTABLE phtable,
+    _In_ HT_NODE *phtNode,
+    _Out_ HT_NODE **phtBucket,
+    _Out_ HT_NODE **phtPrevFound)
+{
+    int index;
+    HT_NODE *pcurnode;
+    HT_NODE *pprevnode = NULL;
+
+    index = _ReduceToBucket(phtable, phtNode->ullHash, phtable->nTableSize);
+    *phtBucket = &phtable->phtNodes[index];
+    for (pcurnode = *phtBucket; pcurnode != NULL; pcurnode = pcurnode->pnext)
+    {
+        if (pcurnode == phtNode)
+        {
+            *phtPrevFound = pprevnode;
+            return TRUE;
+        }
+        pprevnode = pcurnode;
+    }
+
+    if (_IsMigrating(phtable))
+    {
+        index = _ReduceToBucket(phtable, phtNode->ullHash, phtable->nTableSizeOld);
+        if (index >= phtable->iMigrateIndex)
+        {
+            pprevnode = NULL;
+            *phtBucket = &phtable->phtNodesOld[index];
+            for (pcurnode = *phtBucket; pcurnode != NULL; pcurnode = pcurnode->pnext)
+            {
+                if (pcurnode == phtNode)
+                {
+                    *phtPrevFound = pprevnode;
+                    return TRUE;
+                }
+                pprevnode = pcurnode;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+// Moves the key and value from one node to another without copying what they point to.
+// The entry handle slot of the node, if any, follows it to the new node.
+void _MoveNodeContents(_In_ PCHL_HTABLE phtable, _Inout_ HT_NODE *phtDest, _Inout_ HT_NODE *phtSrc)
+{
+    ASSERT(phtSrc->fOccupied && !phtDest->fOccupied);
+
+    phtDest->chlKey = phtSrc->chlKey;
+    phtDest->chlVal = phtSrc->chlVal;
+    phtDest->ullHash = phtSrc->ullHash;
+    phtDest->fOccupied = TRUE;
+
+    phtDest->uHandleSlot = phtSrc->uHandleSlot;
+    if (phtDest->uHandleSlot != 0)
+    {
+        phtable->pHandleSlots->pSlots[phtDest->uHandleSlot - 1].phtNode = phtDest;
+    }
+
+    phtSrc->uHandleSlot = 0;
+    phtSrc->ullHash = 0;
+    ZeroMemory(&phtSrc->chlKey, sizeof(phtSrc->chlKey));
+    ZeroMemory(&phtSrc->chlVal, sizeof(phtSrc->chlVal));
+    phtSrc->fOccupied = FALSE;
+}
+
+// Looks up the key in a table with lock-free reads. Must be called inside a read section,
+// or with the writer lock held shared.
+PCHL_VAL _FindValLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize)
+{
+    struct _htBucketSet *pBuckets;
+    HT_NODE *pcurNode;
+
+    pBuckets = phtable->pLockFree->pBuckets;
+    pcurNode = HT_READ_NEXT(&pBuckets->phtNodes[_ReduceToBucket(phtable, ullHash, pBuckets->nBuckets)]);
+    while (pcurNode)
+    {
+        if ((pcurNode->ullHash == ullHash) &&
+            (pcurNode->chlKey.iKeySize == iKeySize) &&
+            _IsDuplicateKey(&pcurNode->chlKey, pvkey, phtable->keyType, iKeySize))
+        {
+            ASSERT(pcurNode->fOccupied);
+            return &pcurNode->chlVal;
+        }
+        pcurNode = HT_READ_NEXT(pcurNode);
+    }
+    return NULL;
+}
+
+// Looks up the key without taking any lock, inside a read section. If the calling
+// thread's reader state cannot be allocated, takes the writer lock shared instead.
+HRESULT _FindLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    EPOCH_READER *pReader;
+    PCHL_VAL pFoundVal;
+
+    HRESULT hr = S_OK;
+
+    pReader = _EpochEnterRead();
+    if (pReader == NULL)
+    {
+        AcquireSRWLockShared(&phtable->pLockFree->srwWriter);
+    }
+
+    pFoundVal = _FindValLockFree(phtable, ullHash, pvkey, iKeySize);
+    if (pFoundVal == NULL)
+    {
+        hr = E_NOT_SET;
+    }
+    else
+    {
+        if (pvVal)
+        {
+            hr = _CopyValOut(pFoundVal, phtable->valType, pvVal, piValSize, fGetPointerOnly);
+        }
+
+        if (SUCCEEDED(hr) && (piValSize != NULL))
+        {
+            *piValSize = pFoundVal->iValSize;
+        }
+    }
+
+    if (pReader == NULL)
+    {
+        ReleaseSRWLockShared(&phtable->pLockFree->srwWriter);
+    }
+    else
+    {
+        _EpochExitRead(pReader);
+    }
+    return hr;
+}
+
+// An existing key gets a new node with the new value in place of its old node,
+// so that a reader sees either the old value or the new one.
+HRESULT _InsertLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    HT_NODE *pBucket;
+    HT_NODE *phtFoundNode = NULL;
+    HT_NODE *phtPrevFound = NULL;
+    HT_NODE *phtNewNode = NULL;
+    HT_RETIRED *pRetired = NULL;
+
+    HRESULT hr = S_OK;
+
+    AcquireSRWLockExclusive(&phtable->pLockFree->srwWriter);
+
+    pBucket = &phtable->phtNodes[_ReduceToBucket(phtable, ullHash, phtable->nTableSize)];
+    if (_FindKeyInList(pBucket, ullHash, (PVOID)pvkey, iKeySize, phtable->keyType, &phtFoundNode, &phtPrevFound, NULL))
+    {
+        if (_IsDuplicateVal(&phtFoundNode->chlVal, pvVal, phtable->valType, phtFoundNode->chlVal.iValSize))
+        {
+            goto done;
+        }
+
+        if ((pRetired = (HT_RETIRED*)calloc(1, sizeof(HT_RETIRED))) == NULL)
+        {
+            logerr("%s(): calloc() ", __FUNCTION__);
+            hr = E_OUTOFMEMORY;
+            goto done;
+        }
+    }
+
+    hr = CHL_MmAlloc((PVOID*)&phtNewNode, sizeof(HT_NODE), NULL);
+    if (FAILED(hr))
+    {
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
 
-    //ASSERT(phtable && phtable->nTableSize > 0);
+    hr = _CopyKeyIn(&phtNewNode->chlKey, phtable->keyType, pvkey, iKeySize);
+    if (SUCCEEDED(hr))
+    {
+        hr = _CopyValIn(&phtNewNode->chlVal, phtable->valType, pvVal, iValSize);
+    }
 
-    //uTableSize = phtable->nTableSize;
-    //keyType = phtable->keyType;
-    //valType = phtable->valType;
-    //
-    //phtNodes = phtable->phtNodes;
-    //
-    //printf("-----------------------------------\n");
-    //printf("Hashtable Dump::\nkey  :  iValSize  :  chlVal\n");
-    //printf("-----------------------------------\n");
-    //
-    //if(!phtNodes)
-    //{
-    //    printf("Hastable empty");
-    //    goto done;
-    //}
-    //
-    //for(i = 0; i < uTableSize; ++i)
-    //{
-    //    if((phtCurNode = phtNodes[i]) == NULL) continue;
-    //    
-    //    while(phtCurNode)
-    //    {
-    //        ++nNodes;
-    //        
-    //        // print the key
-    //        switch(keyType)
-    //        {
-    //            case HT_KEY_STR:
-    //            {
-    //                int chars = 0;
-    //                while(chars < phtCurNode->iKeySize)
-    //                    putchar(phtCurNode->chlKey.skey[chars++]);
-    //                putchar(':');
-    //                break;
-    //            }
+    if (FAILED(hr))
+    {
+        _ClearNode(phtable->keyType, phtable->valType, phtNewNode, phtable->fValIsInHeap);
+        CHL_MmFree((PVOID*)&phtNewNode);
+        goto done;
+    }
+
+    phtNewNode->fOccupied = TRUE;
+    phtNewNode->ullHash = ullHash;
+
+    // The node must be complete before readers can reach it
+    if (phtFoundNode)
+    {
+        phtNewNode->pnext = phtFoundNode->pnext;
+        InterlockedExchangePointer((PVOID volatile*)&phtPrevFound->pnext, phtNewNode);
+        _AddToByteCount(phtable, _EntryBytes(phtable, iKeySize, iValSize),
+            _EntryBytes(phtable, phtFoundNode->chlKey.iKeySize, phtFoundNode->chlVal.iValSize));
+        _RetireLockFree(phtable, pRetired, phtFoundNode, NULL);
+        pRetired = NULL;
+    }
+    else
+    {
+        phtNewNode->pnext = pBucket->pnext;
+        InterlockedExchangePointer((PVOID volatile*)&pBucket->pnext, phtNewNode);
+        _AddToEntryCount(phtable, 1);
+        _AddToByteCount(phtable, _EntryBytes(phtable, iKeySize, iValSize), 0);
+        _ResizeIfNeeded(phtable);
+    }
+
+    _ReclaimLockFree(phtable, FALSE);
+
+done:
+    ReleaseSRWLockExclusive(&phtable->pLockFree->srwWriter);
+    if (pRetired)
+    {
+        free(pRetired);
+    }
+    return hr;
+}
+
+HRESULT _RemoveLockFree(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    HT_NODE *pBucket;
+    HT_NODE *phtFoundNode = NULL;
+    HT_NODE *phtPrevFound = NULL;
+    HT_RETIRED *pRetired = NULL;
+
+    HRESULT hr = S_OK;
+
+    AcquireSRWLockExclusive(&phtable->pLockFree->srwWriter);
+
+    pBucket = &phtable->phtNodes[_ReduceToBucket(phtable, ullHash, phtable->nTableSize)];
+    if (!_FindKeyInList(pBucket, ullHash, (PVOID)pvkey, iKeySize, phtable->keyType, &phtFoundNode, &phtPrevFound, NULL))
+    {
+        hr = E_NOT_SET;
+        goto done;
+    }
+
+    if ((pRetired = (HT_RETIRED*)calloc(1, sizeof(HT_RETIRED))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
+
+    // Readers that are on the node still find the rest of the chain through it
+    ASSERT(phtPrevFound);
+    InterlockedExchangePointer((PVOID volatile*)&phtPrevFound->pnext, phtFoundNode->pnext);
+    _AddToByteCount(phtable, 0, _EntryBytes(phtable, phtFoundNode->chlKey.iKeySize, phtFoundNode->chlVal.iValSize));
+    _RetireLockFree(phtable, pRetired, phtFoundNode, NULL);
+
+    ASSERT(phtable->nEntries > 0);
+    _AddToEntryCount(phtable, -1);
+    _ResizeIfNeeded(phtable);
+    _ReclaimLockFree(phtable, FALSE);
+
+done:
+    ReleaseSRWLockExclusive(&phtable->pLockFree->srwWriter);
+    return hr;
+}
+
+// Readers may be in the current buckets at any time, so instead of moving nodes, the
+// resized table gets a copy of every node. The key and value memory moves over to the
+// copies. The old buckets and nodes are retired. If memory runs out, the table is left
+// as it is and the resize is tried again on a later Insert or Remove.
+void _ResizeLockFree(_In_ PCHL_HTABLE phtable, _In_ int iNewSizeIndex)
+{
+    int i;
+    int index;
+    int nNewSize = s_hashSizes[iNewSizeIndex];
+    HT_NODE *pcurNode;
+    HT_NODE *phtCopy;
+    HT_RETIRED *pRetired = NULL;
+    struct _htBucketSet *pNewBuckets = NULL;
+    struct _htBucketSet *pOldBuckets;
+
+    pRetired = (HT_RETIRED*)calloc(1, sizeof(HT_RETIRED));
+    pNewBuckets = (struct _htBucketSet*)calloc(1, sizeof(struct _htBucketSet));
+    if ((pRetired == NULL) || (pNewBuckets == NULL) ||
+        ((pNewBuckets->phtNodes = (HT_NODE*)calloc(nNewSize, sizeof(HT_NODE))) == NULL))
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        goto error_return;
+    }
+    pNewBuckets->nBuckets = nNewSize;
+
+    for (i = 0; i < phtable->nTableSize; ++i)
+    {
+        for (pcurNode = phtable->phtNodes[i].pnext; pcurNode != NULL; pcurNode = pcurNode->pnext)
+        {
+            if (FAILED(CHL_MmAlloc((PVOID*)&phtCopy, sizeof(HT_NODE), NULL)))
+            {
+                goto error_return;
+            }
+
+            *phtCopy = *pcurNode;
+            index = _ReduceToBucket(phtable, phtCopy->ullHash, nNewSize);
+            phtCopy->pnext = pNewBuckets->phtNodes[index].pnext;
+            pNewBuckets->phtNodes[index].pnext = phtCopy;
+        }
+    }
+
+    pOldBuckets = phtable->pLockFree->pBuckets;
+    InterlockedExchangePointer((PVOID volatile*)&phtable->pLockFree->pBuckets, pNewBuckets);
+
+    phtable->phtNodes = pNewBuckets->phtNodes;
+    phtable->nTableSize = nNewSize;
+    ++(phtable->uLayoutVersion);
+
+    _RetireLockFree(phtable, pRetired, NULL, pOldBuckets);
+    return;
+
+error_return:
+    if (pNewBuckets)
+    {
+        if (pNewBuckets->phtNodes)
+        {
+            _FreeBucketSetNodes(pNewBuckets);
+            free(pNewBuckets->phtNodes);
+        }
+        free(pNewBuckets);
+    }
+    if (pRetired)
+    {
+        free(pRetired);
+    }
+}
+
+// Tags memory that was just unlinked with the current epoch and queues it to be freed
+void _RetireLockFree(
+    _In_ PCHL_HTABLE phtable,
+    _In_ HT_RETIRED *pRetired,
+    _In_opt_ HT_NODE *phtNode,
+    _In_opt_ struct _htBucketSet *pBuckets)
+{
+    struct _htLockFree *pLockFree = phtable->pLockFree;
+
+    ASSERT(pRetired && ((phtNode == NULL) != (pBuckets == NULL)));
+
+    pRetired->pnext = NULL;
+    pRetired->uEpoch = _EpochGetCurrent();
+    pRetired->phtNode = phtNode;
+    pRetired->pBuckets = pBuckets;
+
+    if (pLockFree->pRetiredLast)
+    {
+        pLockFree->pRetiredLast->pnext = pRetired;
+    }
+    else
+    {
+        pLockFree->pRetiredFirst = pRetired;
+    }
+    pLockFree->pRetiredLast = pRetired;
+}
+
+// Frees retired memory that readers can no longer be using, or all of it if fAll
+void _ReclaimLockFree(_In_ PCHL_HTABLE phtable, _In_ BOOL fAll)
+{
+    ULONG uEpoch = 0;
+    HT_RETIRED *pRetired;
+    struct _htLockFree *pLockFree = phtable->pLockFree;
+
+    if (pLockFree->pRetiredFirst == NULL)
+    {
+        return;
+    }
+
+    if (!fAll)
+    {
+        uEpoch = _EpochTryAdvance();
+    }
+
+    while (((pRetired = pLockFree->pRetiredFirst) != NULL) && (fAll || _EpochIsSafe(pRetired->uEpoch, uEpoch)))
+    {
+        pLockFree->pRetiredFirst = pRetired->pnext;
+        if (pRetired->phtNode)
+        {
+            _ClearNode(phtable->keyType, phtable->valType, pRetired->phtNode, phtable->fValIsInHeap);
+            CHL_MmFree((PVOID*)&pRetired->phtNode);
+        }
+        else
+        {
+            _FreeBucketSetNodes(pRetired->pBuckets);
+            free(pRetired->pBuckets->phtNodes);
+            free(pRetired->pBuckets);
+        }
+        free(pRetired);
+    }
+
+    if (pLockFree->pRetiredFirst == NULL)
+    {
+        pLockFree->pRetiredLast = NULL;
+    }
+}
+
+// Frees the nodes chained to the buckets, without their keys and values
+void _FreeBucketSetNodes(_In_ struct _htBucketSet *pBuckets)
+{
+    int i;
+    HT_NODE *pcurNode;
+    HT_NODE *pnextNode;
+
+    for (i = 0; i < pBuckets->nBuckets; ++i)
+    {
+        ASSERT(!pBuckets->phtNodes[i].fOccupied);
+        for (pcurNode = pBuckets->phtNodes[i].pnext; pcurNode != NULL; pcurNode = pnextNode)
+        {
+            pnextNode = pcurNode->pnext;
+            CHL_MmFree((PVOID*)&pcurNode);
+        }
+    }
+}
+
+void _ClearEntry(_In_ PCHL_HTABLE phtable, _Inout_ HT_ENTRY *pEntry)
+{
+    _DeleteKey(&pEntry->chlKey, phtable->keyType);
+    _DeleteVal(&pEntry->chlVal, phtable->valType, phtable->fValIsInHeap);
+
+    pEntry->fOccupied = FALSE;
+    pEntry->ullHash = 0;
+    pEntry->iNext = HT_NO_ENTRY;
+}
+
+// Returns the index of the key's entry, HT_NO_ENTRY if not found. ppiLink receives
+// the bucket or iNext that holds the index, so that the entry can be unlinked.
+int _FindEntryCompact(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_opt_ int **ppiLink)
+{
+    int iEntry;
+    int *piLink;
+    HT_ENTRY *pEntry;
+    struct _htCompact *pCompact = phtable->pCompact;
+
+    piLink = &pCompact->piBuckets[_ReduceToBucket(phtable, ullHash, phtable->nTableSize)];
+    for (iEntry = *piLink; iEntry != HT_NO_ENTRY; iEntry = *piLink)
+    {
+        pEntry = &pCompact->pEntries[iEntry];
+        ASSERT(pEntry->fOccupied);
+
+#ifdef CHL_HT_ENABLE_COUNTERS
+        ++(phtable->counters.ullProbes);
+#endif
+        if ((pEntry->ullHash == ullHash) &&
+            (pEntry->chlKey.iKeySize == iKeySize) &&
+            _IsDuplicateKey(&pEntry->chlKey, pvkey, phtable->keyType, iKeySize))
+        {
+            break;
+        }
+        piLink = &pEntry->iNext;
+    }
+
+#ifdef CHL_HT_ENABLE_COUNTERS
+    ++(phtable->counters.ullLookups);
+    phtable->counters.ullHits += (iEntry != HT_NO_ENTRY) ? 1 : 0;
+#endif
+
+    IFPTR_SETVAL(ppiLink, piLink);
+    return iEntry;
+}
+
+// Returns the bucket or iNext that holds the index of an entry that is in the table
+int* _FindLinkToEntryCompact(_In_ PCHL_HTABLE phtable, _In_ int iEntry)
+{
+    int *piLink;
+    struct _htCompact *pCompact = phtable->pCompact;
+
+    ASSERT(pCompact->pEntries[iEntry].fOccupied);
+
+    piLink = &pCompact->piBuckets[_ReduceToBucket(phtable, pCompact->pEntries[iEntry].ullHash, phtable->nTableSize)];
+    while (*piLink != iEntry)
+    {
+        ASSERT(*piLink != HT_NO_ENTRY);
+        piLink = &pCompact->pEntries[*piLink].iNext;
+    }
+    return piLink;
+}
+
+// Same as _InsertOrUpdate followed by _ResizeIfNeeded. An existing key keeps its
+// place in the insertion order when its value is updated.
+HRESULT _InsertCompact(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    int iEntry;
+    HT_ENTRY *pEntry;
+
+    HRESULT hr = S_OK;
+
+    iEntry = _FindEntryCompact(phtable, ullHash, pvkey, iKeySize, NULL);
+    if (iEntry != HT_NO_ENTRY)
+    {
+        pEntry = &phtable->pCompact->pEntries[iEntry];
+        hr = _ReplaceVal(phtable, &pEntry->chlVal, iKeySize, pvVal, iValSize);
+        goto done;
+    }
+
+    hr = _InsertNewEntryCompact(phtable, ullHash, pvkey, iKeySize, pvVal, iValSize, NULL);
+    if (SUCCEEDED(hr))
+    {
+        _ResizeIfNeeded(phtable);
+    }
+
+done:
+    return hr;
+}
+
+// Appends an entry for a key that is known not to be in the table. The returned
+// entry is valid until the next entry is added or the entries are compacted.
+HRESULT _InsertNewEntryCompact(
+    _In_ PCHL_HTABLE phtable,
+    _In_ ULONGLONG ullHash,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_opt_ HT_ENTRY **ppNewEntry)
+{
+    int iEntry;
+    int *piBucket;
+    HT_ENTRY *pEntry;
+    struct _htCompact *pCompact = phtable->pCompact;
+
+    HRESULT hr = S_OK;
+
+    hr = _ReserveEntryCompact(phtable);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    iEntry = pCompact->nEntriesUsed;
+    pEntry = &pCompact->pEntries[iEntry];
+    ZeroMemory(pEntry, sizeof(*pEntry));
+
+    hr = _CopyKeyIn(&pEntry->chlKey, phtable->keyType, pvkey, iKeySize);
+    if (SUCCEEDED(hr))
+    {
+        hr = _CopyValIn(&pEntry->chlVal, phtable->valType, pvVal, iValSize);
+    }
+
+    if (FAILED(hr))
+    {
+        _ClearEntry(phtable, pEntry);
+        goto done;
+    }
+
+    pEntry->fOccupied = TRUE;
+    pEntry->ullHash = ullHash;
+
+    piBucket = &pCompact->piBuckets[_ReduceToBucket(phtable, ullHash, phtable->nTableSize)];
+    pEntry->iNext = *piBucket;
+    *piBucket = iEntry;
+
+    ++(pCompact->nEntriesUsed);
+    _AddToEntryCount(phtable, 1);
+    _AddToByteCount(phtable, _EntryBytes(phtable, iKeySize, iValSize), 0);
+
+    IFPTR_SETVAL(ppNewEntry, pEntry);
+
+done:
+    return hr;
+}
+
+HRESULT _RemoveCompact(_In_ PCHL_HTABLE phtable, _In_ ULONGLONG ullHash, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    int iEntry;
+    int nHoles;
+    int *piLink;
+
+    iEntry = _FindEntryCompact(phtable, ullHash, pvkey, iKeySize, &piLink);
+    if (iEntry == HT_NO_ENTRY)
+    {
+        return E_NOT_SET;
+    }
+
+    _RemoveEntryCompact(phtable, iEntry, piLink);
+
+    // Holes are squeezed out once they outnumber the entries, so that iterating
+    // does not mostly skip holes. Each compaction at least halves the array.
+    nHoles = phtable->pCompact->nEntriesUsed - phtable->nEntries;
+    if ((nHoles > HT_COMPACT_MIN_ENTRIES) && (nHoles > phtable->nEntries))
+    {
+        _CompactEntries(phtable);
+    }
+
+    _ResizeIfNeeded(phtable);
+    return S_OK;
+}
+
+// Unlinks the entry from its bucket and leaves a hole in its place.
+// Holes at the end of the array are given back to it right away.
+void _RemoveEntryCompact(_In_ PCHL_HTABLE phtable, _In_ int iEntry, _In_ int *piLink)
+{
+    struct _htCompact *pCompact = phtable->pCompact;
+
+    ASSERT(*piLink == iEntry);
+
+    *piLink = pCompact->pEntries[iEntry].iNext;
+    _AddToByteCount(phtable, 0,
+        _EntryBytes(phtable, pCompact->pEntries[iEntry].chlKey.iKeySize, pCompact->pEntries[iEntry].chlVal.iValSize));
+    _ClearEntry(phtable, &pCompact->pEntries[iEntry]);
+
+    while ((pCompact->nEntriesUsed > 0) && !pCompact->pEntries[pCompact->nEntriesUsed - 1].fOccupied)
+    {
+        --(pCompact->nEntriesUsed);
+    }
+
+    // Entries appended from here on are newer than any below the hint
+    pCompact->iFirstEntry = min(pCompact->iFirstEntry, pCompact->nEntriesUsed);
+
+    ASSERT(phtable->nEntries > 0);
+    _AddToEntryCount(phtable, -1);
+}
+
+// Makes room for one more entry at the end of the array. If a quarter of the
+// array is holes, they are squeezed out instead of growing the array.
+HRESULT _ReserveEntryCompact(_In_ PCHL_HTABLE phtable)
+{
+    int nNewAlloc;
+    HT_ENTRY *pNewEntries;
+    struct _htCompact *pCompact = phtable->pCompact;
 
-    //            case HT_KEY_DWORD:printf("%u:", phtCurNode->chlKey.dwkey); break;
-    //            default: printf("Invalid keyType %d:", keyType); break;
-    //        }
+    if (pCompact->nEntriesUsed < pCompact->nEntriesAlloc)
+    {
+        return S_OK;
+    }
 
-    //        // print the iValSize
-    //        printf("%d:", phtCurNode->iValSize);
+    if ((pCompact->nEntriesUsed > phtable->nEntries) &&
+        ((pCompact->nEntriesUsed - phtable->nEntries) >= (pCompact->nEntriesAlloc / 4)))
+    {
+        _CompactEntries(phtable);
+        ASSERT(pCompact->nEntriesUsed < pCompact->nEntriesAlloc);
+        return S_OK;
+    }
 
-    //        // print the value
-    //        if(valType == HT_VAL_STR)
-    //            printf("[%s]\n", phtCurNode->chlVal.pbVal);
-    //        else if(valType == HT_VAL_DWORD)
-    //            printf("[%u]\n", phtCurNode->chlVal.dwVal);
-    //        else if(valType == HT_VAL_PTR)
-    //            printf("[0x%p]\n", phtCurNode->chlVal.pbVal);
-    //        else
-    //            printf("Invalid valType %d\n", valType);
-    //        phtCurNode = phtCurNode->pnext;
-    //    
-    //    }// while phtCurNode
-    //    
-    //}// for i
-    //
-    //printf("Hashtable stats:\n");
-    //printf("Total size     : %u\n", uTableSize);
-    //printf("Occupied       : %d\n", nNodes);
-    //    
-    //done:
-    //return;
+    if (pCompact->nEntriesAlloc > (MAXINT32 / 2))
+    {
+        logerr("%s(): Too many entries", __FUNCTION__);
+        return E_OUTOFMEMORY;
+    }
 
-}// CHL_DsDumpHT
+    nNewAlloc = max(HT_COMPACT_MIN_ENTRIES, pCompact->nEntriesAlloc * 2);
+    pNewEntries = (HT_ENTRY*)realloc(pCompact->pEntries, (SIZE_T)nNewAlloc * sizeof(HT_ENTRY));
+    if (pNewEntries == NULL)
+    {
+        logerr("%s(): realloc() ", __FUNCTION__);
+        return E_OUTOFMEMORY;
+    }
 
-void _ClearNode(CHL_KEYTYPE ktype, CHL_VALTYPE vtype, HT_NODE *pnode, BOOL fFreeVal)
+    pCompact->pEntries = pNewEntries;
+    pCompact->nEntriesAlloc = nNewAlloc;
+    return S_OK;
+}
+
+// Moves the entries down over the holes, keeping their order. Since entries move,
+// iterators must be initialized again.
+void _CompactEntries(_In_ PCHL_HTABLE phtable)
 {
-    ASSERT(pnode);
+    int i;
+    int nLive = 0;
+    int nNewAlloc;
+    HT_ENTRY *pNewEntries;
+    struct _htCompact *pCompact = phtable->pCompact;
 
-    _DeleteKey(&pnode->chlKey, ktype);
-    _DeleteVal(&pnode->chlVal, vtype, fFreeVal);
+    for (i = 0; i < pCompact->nEntriesUsed; ++i)
+    {
+        if (pCompact->pEntries[i].fOccupied)
+        {
+            if (nLive != i)
+            {
+                pCompact->pEntries[nLive] = pCompact->pEntries[i];
+            }
+            ++nLive;
+        }
+    }
 
-    pnode->fOccupied = FALSE;
-    pnode->pnext = NULL;
+    ASSERT(nLive == phtable->nEntries);
+    pCompact->nEntriesUsed = nLive;
+    pCompact->iFirstEntry = 0;
 
-    return;
-}// _ClearNode()
+    // Give memory back if the array is mostly unused, it is not an error if this fails
+    if ((pCompact->nEntriesAlloc > HT_COMPACT_MIN_ENTRIES) && (nLive < (pCompact->nEntriesAlloc / 4)))
+    {
+        nNewAlloc = max(HT_COMPACT_MIN_ENTRIES, nLive * 2);
+        pNewEntries = (HT_ENTRY*)realloc(pCompact->pEntries, (SIZE_T)nNewAlloc * sizeof(HT_ENTRY));
+        if (pNewEntries != NULL)
+        {
+            pCompact->pEntries = pNewEntries;
+            pCompact->nEntriesAlloc = nNewAlloc;
+        }
+    }
 
-HRESULT _CopyNodeOut(
-    _In_ PCHL_HTABLE phtable,
-    _In_ HT_NODE* phtNode,
-    _Inout_opt_ PCVOID pvKey,
-    _Inout_opt_ PINT piKeySize,
-    _Inout_opt_ PVOID pvVal,
-    _Inout_opt_ PINT piValSize,
-    _In_opt_ BOOL fGetPointerOnly)
+    _RelinkCompact(phtable);
+    ++(phtable->uLayoutVersion);
+}
+
+// Rebuilds the chain of every bucket from the hashes cached in the entries
+void _RelinkCompact(_In_ PCHL_HTABLE phtable)
 {
-    ASSERT(phtNode->fOccupied == TRUE);
+    int i;
+    int *piBucket;
+    struct _htCompact *pCompact = phtable->pCompact;
 
-    HRESULT hr = S_OK;
-    
-    if (pvKey)
+    for (i = 0; i < phtable->nTableSize; ++i)
     {
-        hr = _CopyKeyOut(&phtNode->chlKey, phtable->keyType, pvKey, piKeySize, fGetPointerOnly);
+        pCompact->piBuckets[i] = HT_NO_ENTRY;
     }
-    if (SUCCEEDED(hr) && pvVal)
+
+    for (i = 0; i < pCompact->nEntriesUsed; ++i)
     {
-        hr = _CopyValOut(&phtNode->chlVal, phtable->valType, pvVal, piValSize, fGetPointerOnly);
+        if (pCompact->pEntries[i].fOccupied)
+        {
+            piBucket = &pCompact->piBuckets[_ReduceToBucket(phtable, pCompact->pEntries[i].ullHash, phtable->nTableSize)];
+            pCompact->pEntries[i].iNext = *piBucket;
+            *piBucket = i;
+        }
     }
+}
 
-    if (SUCCEEDED(hr))
+// Only the bucket array is replaced. Entries stay where they are and are linked into
+// the new buckets by their cached hash, so iterators remain valid. This is done all at
+// once rather than incrementally: it writes 4 bytes per bucket and reads the entries in
+// order, without hashing keys or allocating nodes.
+void _ResizeCompact(_In_ PCHL_HTABLE phtable, _In_ int iNewSizeIndex)
+{
+    int *piNewBuckets;
+    int newTableSize = s_hashSizes[iNewSizeIndex];
+
+    piNewBuckets = (int*)malloc(newTableSize * sizeof(int));
+    if (piNewBuckets == NULL)
     {
-        if (piKeySize != NULL)
+        // Not fatal, the table keeps working at its current size
+        logwarn("%s(): malloc() failed, not resizing to %d buckets", __FUNCTION__, newTableSize);
+        return;
+    }
+
+    free(phtable->pCompact->piBuckets);
+    phtable->pCompact->piBuckets = piNewBuckets;
+    phtable->nTableSize = newTableSize;
+    _RelinkCompact(phtable);
+}
+
+void _AddCompactStats(_In_ PCHL_HTABLE phtable, _Inout_ CHL_HT_STATS *pStats)
+{
+    int i;
+    int iEntry;
+    int nChain;
+    struct _htCompact *pCompact = phtable->pCompact;
+
+    pStats->cbNodes = ((SIZE_T)phtable->nTableSize * sizeof(int)) + ((SIZE_T)pCompact->nEntriesAlloc * sizeof(HT_ENTRY));
+    for (i = 0; i < phtable->nTableSize; ++i)
+    {
+        nChain = 0;
+        for (iEntry = pCompact->piBuckets[i]; iEntry != HT_NO_ENTRY; iEntry = pCompact->pEntries[iEntry].iNext)
         {
-            *piKeySize = phtNode->chlKey.iKeySize;
+            ++nChain;
+            _AddEntryBytes(phtable, &pCompact->pEntries[iEntry].chlKey, &pCompact->pEntries[iEntry].chlVal, pStats);
         }
 
-        if (piValSize != NULL)
+        pStats->nMaxChain = max(pStats->nMaxChain, nChain);
+        ++(pStats->anChainLengths[min(nChain, CHL_HT_STATS_CHAIN_LENGTHS - 1)]);
+    }
+}
+
+// Returns the index into s_hashSizes to resize the table to, -1 if it need not be resized
+int _GetResizeSizeIndex(_In_ PCHL_HTABLE phtable)
+{
+    int iNewSizeIndex;
+    LONGLONG llEntriesPct = (LONGLONG)phtable->nEntries * 100;
+    int nTargetEntries = min(phtable->nEntries, MAXINT32 / HT_RESIZE_ENTRIES_MULTIPLIER) * HT_RESIZE_ENTRIES_MULTIPLIER;
+
+    iNewSizeIndex = CHL_DsGetNearestSizeIndexHT(nTargetEntries);
+    if ((phtable->iGrowLoadPct > 0) &&
+        (llEntriesPct > (LONGLONG)phtable->nTableSize * phtable->iGrowLoadPct))
+    {
+        if (s_hashSizes[iNewSizeIndex] > phtable->nTableSize)
         {
-            *piValSize = phtNode->chlVal.iValSize;
+            return iNewSizeIndex;
         }
     }
-    return hr;
+    else if ((phtable->iShrinkLoadPct > 0) &&
+        (llEntriesPct < (LONGLONG)phtable->nTableSize * phtable->iShrinkLoadPct))
+    {
+        iNewSizeIndex = max(iNewSizeIndex, phtable->iMinSizeIndex);
+        if (s_hashSizes[iNewSizeIndex] < phtable->nTableSize)
+        {
+            return iNewSizeIndex;
+        }
+    }
+    return -1;
 }
 
-BOOL _FindKeyInList(
-    _In_ HT_NODE *pFirstHTNode,
-    _In_ PVOID pvkey,
-    _In_ int iKeySize,
-    _In_ CHL_KEYTYPE keyType,
-    _Out_ HT_NODE **phtFoundNode,
-    _Out_opt_ HT_NODE **phtPrevFound)
+void _ResizeIfNeeded(_In_ PCHL_HTABLE phtable)
 {
-    HT_NODE *prevNode = NULL;
-    HT_NODE *pcurNode = NULL;
+    int iNewSizeIndex;
 
-    ASSERT(phtFoundNode);
+    if (phtable->pLockFree)
+    {
+        iNewSizeIndex = _GetResizeSizeIndex(phtable);
+        if (iNewSizeIndex >= 0)
+        {
+            _ResizeLockFree(phtable, iNewSizeIndex);
+        }
+        return;
+    }
 
-    *phtFoundNode = NULL;
+    if (phtable->pCompact)
+    {
+        iNewSizeIndex = _GetResizeSizeIndex(phtable);
+        if (iNewSizeIndex >= 0)
+        {
+            _ResizeCompact(phtable, iNewSizeIndex);
+        }
+        return;
+    }
 
-    pcurNode = pFirstHTNode;
-    while (pcurNode)
+    // Only one resize at a time. The next one is considered after it completes.
+    if (_IsMigrating(phtable))
     {
-        if (pcurNode->fOccupied &&
-            (pcurNode->chlKey.iKeySize == iKeySize) &&
-            _IsDuplicateKey(&pcurNode->chlKey, pvkey, keyType, pcurNode->chlKey.iKeySize))
+        return;
+    }
+
+    iNewSizeIndex = _GetResizeSizeIndex(phtable);
+    if (iNewSizeIndex >= 0)
+    {
+        _BeginMigration(phtable, iNewSizeIndex);
+
+        // A concurrent table is resized all at once, with every stripe locked,
+        // so that other operations never have to look at two sets of buckets.
+        if (phtable->fConcurrent)
         {
-            break;
+            _CompleteMigration(phtable);
         }
+    }
+}
 
-        prevNode = pcurNode;
-        pcurNode = pcurNode->pnext;
+void _BeginMigration(_In_ PCHL_HTABLE phtable, _In_ int iNewSizeIndex)
+{
+    HT_NODE *phtNewNodes;
+    int newTableSize = s_hashSizes[iNewSizeIndex];
+
+    ASSERT(!_IsMigrating(phtable));
+
+    phtNewNodes = (HT_NODE*)calloc(newTableSize, sizeof(HT_NODE));
+    if (phtNewNodes == NULL)
+    {
+        // Not fatal, the table keeps working at its current size
+        logwarn("%s(): calloc() failed, not resizing to %d buckets", __FUNCTION__, newTableSize);
+        return;
     }
 
-    *phtFoundNode = pcurNode;
-    if (phtPrevFound)
+    phtable->phtNodesOld = phtable->phtNodes;
+    phtable->nTableSizeOld = phtable->nTableSize;
+    phtable->iMigrateIndex = 0;
+    phtable->phtNodes = phtNewNodes;
+    phtable->nTableSize = newTableSize;
+
+    // The old buckets keep their indexes and the new ones are empty, see _GetBucketAt(),
+    // so iterators stay valid
+}
+
+// Migrate a bounded number of buckets from the old table to the current one, unless an
+// iterator is active. Entries then stay where iterators expect them until they are done.
+void _MigrateStep(_In_ PCHL_HTABLE phtable)
+{
+    if (phtable->nActiveIterators == 0)
     {
-        *phtPrevFound = prevNode;
+        _MigrateBuckets(phtable);
     }
+}
 
-    return (pcurNode != NULL);
+void _MigrateBuckets(_In_ PCHL_HTABLE phtable)
+{
+    int nMigrated = 0;
+    int nEmptyVisits = 0;
+    HT_NODE *phtOldBucket;
+
+    if (!_IsMigrating(phtable))
+    {
+        return;
+    }
+
+    while ((phtable->iMigrateIndex < phtable->nTableSizeOld) &&
+        (nMigrated < HT_MIGRATE_BUCKETS_PER_STEP) &&
+        (nEmptyVisits < HT_MIGRATE_MAX_EMPTY_VISITS))
+    {
+        phtOldBucket = &phtable->phtNodesOld[phtable->iMigrateIndex];
+        if (!phtOldBucket->fOccupied && (phtOldBucket->pnext == NULL))
+        {
+            ++nEmptyVisits;
+            ++(phtable->iMigrateIndex);
+            continue;
+        }
+
+        // Entries are moved (and chained nodes may be freed), even if the bucket head cannot be
+        ++(phtable->uLayoutVersion);
+        if (FAILED(_MigrateBucket(phtable, phtOldBucket)))
+        {
+            // Out of memory, try again on a later call
+            return;
+        }
+        ++nMigrated;
+        ++(phtable->iMigrateIndex);
+    }
+
+    if (phtable->iMigrateIndex >= phtable->nTableSizeOld)
+    {
+        // Indexes of the current buckets change once the old ones are gone
+        ++(phtable->uLayoutVersion);
+        free(phtable->phtNodesOld);
+        phtable->phtNodesOld = NULL;
+        phtable->nTableSizeOld = 0;
+        phtable->iMigrateIndex = 0;
+    }
 }
 
-BOOL _FindKnownKeyInList(
-    _In_ HT_NODE *pFirstHTNode,
-    _In_ HT_NODE *pTarget,
-    _Out_ HT_NODE **phtFoundNode,
-    _Out_ HT_NODE **phtPrevFound)
+HRESULT _MigrateBucket(_In_ PCHL_HTABLE phtable, _In_ HT_NODE *phtOldBucket)
 {
-    HT_NODE *prevNode = NULL;
-    HT_NODE *pcurNode = NULL;
+    DWORD index;
+    HT_NODE *pcurnode;
+    HT_NODE *pnextnode;
+    HT_NODE *pNewBucket;
 
-    ASSERT(phtFoundNode && phtPrevFound);
+    HRESULT hr = S_OK;
 
-    *phtFoundNode = NULL;
+    // Keys are not hashed again, the cached hash is reduced to the new table size.
+    // Chained nodes are on the heap and can be linked into the new bucket as they are.
+    pcurnode = phtOldBucket->pnext;
+    phtOldBucket->pnext = NULL;
+    while (pcurnode)
+    {
+        pnextnode = pcurnode->pnext;
 
-    pcurNode = pFirstHTNode;
-    while (pcurNode && (pcurNode != pTarget))
+        ASSERT(pcurnode->fOccupied);
+        index = _ReduceToBucket(phtable, pcurnode->ullHash, phtable->nTableSize);
+        pNewBucket = &phtable->phtNodes[index];
+        if (!pNewBucket->fOccupied)
+        {
+            _MoveNodeContents(phtable, pNewBucket, pcurnode);
+            CHL_MmFree((PVOID*)&pcurnode);
+        }
+        else
+        {
+            pcurnode->pnext = pNewBucket->pnext;
+            pNewBucket->pnext = pcurnode;
+        }
+
+        pcurnode = pnextnode;
+    }
+
+    // The bucket head is part of the old array, so its contents have to be moved out
+    if (phtOldBucket->fOccupied)
     {
-        prevNode = pcurNode;
-        pcurNode = pcurNode->pnext;
+        index = _ReduceToBucket(phtable, phtOldBucket->ullHash, phtable->nTableSize);
+        pNewBucket = &phtable->phtNodes[index];
+        if (!pNewBucket->fOccupied)
+        {
+            _MoveNodeContents(phtable, pNewBucket, phtOldBucket);
+        }
+        else
+        {
+            hr = CHL_MmAlloc((PVOID*)&pcurnode, sizeof(HT_NODE), NULL);
+            if (SUCCEEDED(hr))
+            {
+                _MoveNodeContents(phtable, pcurnode, phtOldBucket);
+                pcurnode->pnext = pNewBucket->pnext;
+                pNewBucket->pnext = pcurnode;
+            }
+        }
     }
 
-    *phtFoundNode = pcurNode;
-    *phtPrevFound = prevNode;
-    return (pcurNode != NULL);
+    return hr;
+}
+
+void _CompleteMigration(_In_ PCHL_HTABLE phtable)
+{
+    int iPrevIndex;
+
+    while (_IsMigrating(phtable))
+    {
+        iPrevIndex = phtable->iMigrateIndex;
+        _MigrateBuckets(phtable);
+        if (_IsMigrating(phtable) && (phtable->iMigrateIndex == iPrevIndex))
+        {
+            // No progress (out of memory), iteration covers both sets of buckets
+            break;
+        }
+    }
 }
 
 HRESULT _IncrementIterator(_In_ CHL_HT_ITERATOR *pItr)
 {
-    int indexIterator;
     int iCurIndex = 0;
+    int nBuckets;
     HT_NODE* pCurNode = NULL;
 
     HRESULT hr = S_OK;
     PCHL_HTABLE phtable = pItr->pMyHashTable;
-    if (pItr->opType == HT_ITR_FIRST) // Trivial check to see if iterator was initialized or not
+
+    if (phtable->pCompact)
+    {
+        return _IncrementIteratorCompact(pItr);
+    }
+
+    nBuckets = phtable->nTableSizeOld + phtable->nTableSize;
+    if (pItr->uLayoutVersion != phtable->uLayoutVersion)
+    {
+        // Entries moved since the iterator was positioned
+        pCurNode = NULL;
+        iCurIndex = nBuckets;
+        hr = E_CHANGED_STATE;
+    }
+    else if ((pItr->opType == HT_ITR_FIRST) || (pItr->opType == HT_ITR_NEXT))
     {
-        for (indexIterator = 0; indexIterator < phtable->nTableSize; ++indexIterator)
+        if (pItr->opType == HT_ITR_FIRST) // Trivial check to see if iterator was initialized or not
         {
-            if (phtable->phtNodes[indexIterator].fOccupied)
+            // Old buckets below iMigrateIndex are empty
+            iCurIndex = (_IsMigrating(phtable) ? phtable->iMigrateIndex : 0) - 1;
+        }
+        else
+        {
+            iCurIndex = pItr->nCurIndex;
+            pCurNode = (pItr->phtCurNodeInList != NULL) ? pItr->phtCurNodeInList->pnext : NULL;
+        }
+
+        // A bucket head may be unoccupied and still have a chain of siblings
+        while ((pCurNode == NULL) && (++iCurIndex < nBuckets))
+        {
+            pCurNode = _GetBucketAt(phtable, iCurIndex);
+            if (!pCurNode->fOccupied)
             {
-                iCurIndex = indexIterator;
-                pCurNode = &phtable->phtNodes[indexIterator];
-                pItr->opType = HT_ITR_NEXT;
-                break;  // out of for loop
+                pCurNode = pCurNode->pnext;
             }
         }
 
-        if (indexIterator >= phtable->nTableSize)
+        if (pCurNode != NULL)
+        {
+            ASSERT(pCurNode->fOccupied);
+            pItr->opType = HT_ITR_NEXT;
+        }
+        else
         {
-            pCurNode = NULL;
-            iCurIndex = phtable->nTableSize;
+            iCurIndex = nBuckets;
             hr = E_NOT_SET; // reached End of table
         }
     }
-    else if (pItr->opType == HT_ITR_NEXT)
+    else
+    {
+        logerr("Iterator invalid opType %x", pItr->opType);
+        hr = E_UNEXPECTED;
+    }
+
+    pItr->nCurIndex = iCurIndex;
+    pItr->phtCurNodeInList = pCurNode;
+    if (FAILED(hr))
+    {
+        _SetIteratorActive(pItr, FALSE);
+    }
+    return hr;
+}
+
+// An active iterator is counted by its table, which does not migrate buckets meanwhile
+void _SetIteratorActive(_Inout_ CHL_HT_ITERATOR *pItr, _In_ BOOL fActive)
+{
+    if (pItr->fActive != fActive)
+    {
+        pItr->fActive = fActive;
+        pItr->pMyHashTable->nActiveIterators += (fActive ? 1 : -1);
+        ASSERT(pItr->pMyHashTable->nActiveIterators >= 0);
+    }
+}
+
+// Iterators of a compact table walk the entry array, nCurIndex is the current entry
+HRESULT _IncrementIteratorCompact(_In_ CHL_HT_ITERATOR *pItr)
+{
+    int iCurIndex = 0;
+
+    HRESULT hr = S_OK;
+    struct _htCompact *pCompact = pItr->pMyHashTable->pCompact;
+
+    if (pItr->uLayoutVersion != pItr->pMyHashTable->uLayoutVersion)
+    {
+        // Entries moved since the iterator was positioned
+        iCurIndex = pCompact->nEntriesUsed;
+        hr = E_CHANGED_STATE;
+    }
+    else if ((pItr->opType == HT_ITR_FIRST) || (pItr->opType == HT_ITR_NEXT))
     {
-        pCurNode = pItr->phtCurNodeInList;
-        iCurIndex = pItr->nCurIndex;
-        if (pCurNode && pCurNode->pnext)
+        iCurIndex = (pItr->opType == HT_ITR_FIRST) ? 0 : (pItr->nCurIndex + 1);
+        while ((iCurIndex < pCompact->nEntriesUsed) && !pCompact->pEntries[iCurIndex].fOccupied)
+        {
+            ++iCurIndex;
+        }
+
+        if (iCurIndex < pCompact->nEntriesUsed)
         {
-            pCurNode = pCurNode->pnext;
+            pItr->opType = HT_ITR_NEXT;
         }
         else
         {
-            for (indexIterator = iCurIndex + 1; indexIterator < phtable->nTableSize; ++indexIterator)
-            {
-                if (phtable->phtNodes[indexIterator].fOccupied)
-                {
-                    iCurIndex = indexIterator;
-                    pCurNode = &phtable->phtNodes[indexIterator];
-                    pItr->opType = HT_ITR_NEXT;
-                    break;  // out of for loop
-                }
-            }
-
-            if (indexIterator >= phtable->nTableSize)
-            {
-                pCurNode = NULL;
-                iCurIndex = phtable->nTableSize;
-                hr = E_NOT_SET; // reached End of table
-            }
+            iCurIndex = pCompact->nEntriesUsed;
+            hr = E_NOT_SET; // reached End of table
         }
     }
     else
@@ -855,6 +5018,6 @@ HRESULT _IncrementIterator(_In_ CHL_HT_ITERATOR *pItr)
     }
 
     pItr->nCurIndex = iCurIndex;
-    pItr->phtCurNodeInList = pCurNode;
+    pItr->phtCurNodeInList = NULL;
     return hr;
 }
@@ -6,6 +6,20 @@
 //      Unknown history!
 //      09/09/14 Refactor to store defs in individual headers.
 //      09/12/14 Naming convention modifications
+//      10/17/26 Load factor driven resizing with incremental rehashing
+//      10/17/26 Seeded 64bit hash selectable per table
+//      10/17/26 Cache the full key hash in each node
+//      10/17/26 FindOrInsert for updating values in place
+//      10/17/26 Batched Find and Insert with prefetching
+//      10/17/26 Concurrent variant with striped bucket locks
+//      10/17/26 Lock-free reads with epoch based reclamation
+//      10/17/26 Statistics and lookup counters
+//      10/17/26 Compact layout with entries in insertion order
+//      10/17/26 Byte accounting and an optional byte budget
+//      10/17/26 Merging tables, serially or in parallel
+//      10/17/26 Multimap mode with several values per key
+//      10/17/26 Key handles to hash a key once for several tables
+//      10/17/26 Entry handles to get, set and remove an entry without looking it up
 //
 
 #ifndef _HASHTABLE_H
@@ -21,14 +35,114 @@ extern "C" {
 // hashtable node
 typedef struct _hashTableNode {
     BOOL fOccupied;
+    UINT uHandleSlot;       // Slot that entry handles to this node refer to plus one, 0 if there is none
+    ULONGLONG ullHash;      // Full (unreduced) hash of chlKey, compared before the key itself
     CHL_KEY chlKey;
     CHL_VAL chlVal;
     struct _hashTableNode *pnext;
 }HT_NODE;
 
+// Hash functions that a hashtable can use to place keys into buckets
+typedef enum
+{
+    CHL_HT_HASH_START,
+
+    // Seeded 64bit wyhash with a random per-table seed, reduced by multiply-shift.
+    // This is the default.
+    CHL_HT_HASH_SEEDED64,
+
+    // Unseeded DJB2 reduced by modulo, as used by earlier versions
+    CHL_HT_HASH_DJB2,
+
+    // Same as CHL_HT_HASH_SEEDED64, but with one random seed for all tables of the process
+    // instead of one per table, so that a key hashes the same in all of them. Tables that
+    // use this take the hash of a key handle as is, see CHL_DsPrepareKeyHT.
+    CHL_HT_HASH_SHARED64,
+
+    CHL_HT_HASH_END
+}CHL_HT_HASHTYPE;
+
+// Flags for CHL_DsCreateExHT
+#define CHL_HT_FLAG_CONCURRENT      0x00000001  // Insert/Find/Remove may be called from multiple threads
+#define CHL_HT_FLAG_LOCKFREE_READS  0x00000002  // Find takes no locks, Insert/Remove are serialized
+#define CHL_HT_FLAG_COMPACT         0x00000004  // Entries in a dense array in insertion order, buckets hold indexes
+#define CHL_HT_FLAG_MULTIMAP        0x00000008  // Inserting an existing key adds a value instead of replacing it
+
+// A key that has been prepared for lookups in any number of tables with CHL_DsPrepareKeyHT.
+// The key is not copied, it must stay valid for as long as the handle is used.
+// The *ByHandle functions remember the hash of the last CHL_HT_HASH_SEEDED64 table in the
+// handle, so a handle must not be used by two threads at the same time.
+typedef struct _hashtableKeyHandle {
+    CHL_KEYTYPE keyType;    // Type of the key, must be that of the tables it is used with
+    const void *pvKey;      // The key as it was passed to CHL_DsPrepareKeyHT, never written through
+    int iKeySize;           // Size of the key in bytes
+    ULONGLONG ullHash;      // Hash of the key as tables with CHL_HT_HASH_SHARED64 compute it
+    BOOL fSeededHash;       // Whether ullSeededHash is set
+    ULONGLONG ullSeed;      // Seed of the table that ullSeededHash was computed for
+    ULONGLONG ullSeededHash;// Hash of the key for the last CHL_HT_HASH_SEEDED64 table it was used with
+}CHL_HT_KEYHANDLE, *PCHL_HT_KEYHANDLE;
+
+// Refers to one entry of a table, see CHL_DsInsertExHT. A handle to an entry that has
+// been removed since no longer matches and is rejected. A zeroed handle never matches.
+typedef struct _hashtableEntryHandle {
+    UINT uSlot;             // Slot in the table that refers to the entry
+    UINT uGeneration;       // Generation of the slot when the handle was returned
+}CHL_HT_ENTRYHANDLE, *PCHL_HT_ENTRYHANDLE;
+
+// Counters of key lookups by Find, FindBatch, FindOrInsert, Insert and Remove.
+// Only kept if the library is built with CHL_HT_ENABLE_COUNTERS defined, and only
+// for tables created without the CHL_HT_FLAG_* flags.
+typedef struct _hashtableCounters {
+    ULONGLONG ullLookups;   // Keys looked up
+    ULONGLONG ullHits;      // Lookups that found the key
+    ULONGLONG ullProbes;    // Entries whose hash was compared to that of the key looked up
+}CHL_HT_COUNTERS;
+
+// Number of chain lengths in CHL_HT_STATS, the last one includes all longer chains
+#define CHL_HT_STATS_CHAIN_LENGTHS  8
+
+// Statistics returned by CHL_DsGetStatsHT
+typedef struct _hashtableStats {
+    int nEntries;           // Number of key-value pairs
+    int nBuckets;           // Number of buckets
+    int nBucketsOld;        // Buckets of a resize in progress that are yet to be migrated
+    int iLoadPct;           // Entries as a percent of all buckets
+    int nMaxChain;          // Most entries in a single bucket
+    int anChainLengths[CHL_HT_STATS_CHAIN_LENGTHS];     // Number of buckets with 0, 1, 2... entries
+    SIZE_T cbNodes;         // Bytes used by buckets and chained nodes, or by the entry array of a compact table
+    SIZE_T cbKeys;          // Bytes used by copies of string keys
+    SIZE_T cbValues;        // Bytes used by copies of string and user object values (not CHL_VT_POINTER values)
+    BOOL fCountersEnabled;  // Whether counters are kept for the table
+    CHL_HT_COUNTERS counters;
+}CHL_HT_STATS;
+
+// Combines the values of a key that is in both tables being merged, see CHL_DsMergeHT.
+// pChlValDst is the value stored in the destination table, update it in place. pChlValSrc is
+// the value of the source table, which is freed along with the source entry afterwards. To
+// keep the source value instead, swap the two CHL_VAL structures.
+// Params:
+//      pChlValDst: The value in the destination table.
+//      pChlValSrc: The value in the source table.
+//      valType: Value type of both tables.
+//      pvContext: Context passed to CHL_DsMergeHT.
+//
+typedef void (*CHL_HT_COMBINE_FN)(PCHL_VAL pChlValDst, PCHL_VAL pChlValSrc, CHL_VALTYPE valType, PVOID pvContext);
+
 // Foward declare the iterator struct
 struct _hashtableIterator;
 
+// Foward declare the lock stripes of a concurrent hashtable
+struct _htStripeLock;
+
+// Foward declare the state of a hashtable with lock-free reads
+struct _htLockFree;
+
+// Foward declare the entries of a compact hashtable
+struct _htCompact;
+
+// Foward declare the slots that entry handles refer to
+struct _htHandleSlots;
+
 // hashtable itself
 typedef struct _hashtable CHL_HTABLE, *PCHL_HTABLE;
 typedef struct _hashtableIterator CHL_HT_ITERATOR;
@@ -36,8 +150,33 @@ struct _hashtable {
     CHL_KEYTYPE keyType;    // Type information for the hashtable key
     CHL_VALTYPE valType;    // Type information for the hashtable value
     BOOL fValIsInHeap;      // Whether value was allocated on heap by client (for CHL_VT_POINTER only)
-    HT_NODE *phtNodes;      // Pointer to hashtable nodes
+    HT_NODE *phtNodes;      // Pointer to hashtable nodes, NULL for a compact table
     int nTableSize;         // Total number of buckets in the hashtable
+    int nEntries;           // Number of key-value pairs currently stored
+    CHL_HT_HASHTYPE hashType;   // Hash function used to place keys into buckets
+    ULONGLONG ullHashSeed;      // Random seed for CHL_HT_HASH_SEEDED64
+
+    // Resizing. While a resize is in progress, entries live in both phtNodesOld
+    // and phtNodes and are migrated a few buckets at a time by Insert/Find/Remove.
+    HT_NODE *phtNodesOld;   // Buckets being migrated away from, NULL if no resize is in progress
+    int nTableSizeOld;      // Number of buckets in phtNodesOld
+    int iMigrateIndex;      // Buckets in phtNodesOld below this index have been migrated
+    int iMinSizeIndex;      // Table never shrinks below the size it was created with
+    int iGrowLoadPct;       // Grow when #entries exceeds this percent of #buckets, 0 = never grow
+    int iShrinkLoadPct;     // Shrink when #entries falls below this percent of #buckets, 0 = never shrink
+    UINT uLayoutVersion;    // Bumped whenever entries move between buckets, invalidates iterators
+    int nActiveIterators;   // Iterators that have not reached the end, no buckets are migrated meanwhile
+
+    // Concurrency. Bucket i is guarded by lock stripe (i % #stripes).
+    BOOL fConcurrent;                   // Created with CHL_HT_FLAG_CONCURRENT
+    struct _htStripeLock *pStripeLocks; // Lock stripes, NULL if not concurrent
+    struct _htLockFree *pLockFree;      // Created with CHL_HT_FLAG_LOCKFREE_READS, NULL otherwise
+    struct _htCompact *pCompact;        // Created with CHL_HT_FLAG_COMPACT, NULL otherwise
+    BOOL fMultimap;                     // Created with CHL_HT_FLAG_MULTIMAP
+    struct _htHandleSlots *pHandleSlots;    // Slots of entry handles, NULL until the first one is returned
+
+    CHL_HT_COUNTERS counters;   // Lookup counters, see CHL_HT_COUNTERS
+    CHL_BUDGET budget;          // Bytes charged for all entries and the budget, see CHL_DsSetBudgetHT
 
     // Access methods
     HRESULT (*Destroy)(PCHL_HTABLE phtable);
@@ -57,11 +196,112 @@ struct _hashtable {
         PINT pvalsize,
         BOOL fGetPointerOnly);
 
+    HRESULT (*InsertEx)(
+        PCHL_HTABLE phtable,
+        PCVOID pvkey,
+        int iKeySize,
+        PCVOID pvVal,
+        int iValSize,
+        PCHL_HT_ENTRYHANDLE phEntry);
+
+    HRESULT (*GetByEntryHandle)(
+        PCHL_HTABLE phtable,
+        const CHL_HT_ENTRYHANDLE *phEntry,
+        PVOID pvVal,
+        PINT pvalsize,
+        BOOL fGetPointerOnly);
+
+    HRESULT (*SetByEntryHandle)(
+        PCHL_HTABLE phtable,
+        const CHL_HT_ENTRYHANDLE *phEntry,
+        PCVOID pvVal,
+        int iValSize);
+
+    HRESULT (*RemoveByEntryHandle)(PCHL_HTABLE phtable, const CHL_HT_ENTRYHANDLE *phEntry);
+
+    HRESULT (*InsertByHandle)(
+        PCHL_HTABLE phtable,
+        CHL_HT_KEYHANDLE *phKey,
+        PCVOID pvVal,
+        int iValSize);
+
+    HRESULT (*FindByHandle)(
+        PCHL_HTABLE phtable,
+        CHL_HT_KEYHANDLE *phKey,
+        PVOID pvVal,
+        PINT pvalsize,
+        BOOL fGetPointerOnly);
+
+    HRESULT (*RemoveByHandle)(PCHL_HTABLE phtable, CHL_HT_KEYHANDLE *phKey);
+
+    HRESULT (*FindOrInsert)(
+        PCHL_HTABLE phtable,
+        PCVOID pvkey,
+        int iKeySize,
+        PCVOID pvVal,
+        int iValSize,
+        PCHL_VAL *ppChlVal,
+        PBOOL pfCreated);
+
+    HRESULT (*FindBatch)(
+        PCHL_HTABLE phtable,
+        PCVOID *ppvKeys,
+        const int *piKeySizes,
+        int nKeys,
+        PCHL_VAL *ppChlVals,
+        HRESULT *phrResults);
+
+    HRESULT (*InsertBatch)(
+        PCHL_HTABLE phtable,
+        PCVOID *ppvKeys,
+        const int *piKeySizes,
+        PCVOID *ppvVals,
+        const int *piValSizes,
+        int nKeys,
+        HRESULT *phrResults);
+
+    HRESULT (*FindAll)(
+        PCHL_HTABLE phtable,
+        PCVOID pvkey,
+        int iKeySize,
+        PCHL_VAL *ppChlVals,
+        PINT pnVals);
+
     HRESULT (*Remove)(PCHL_HTABLE phtable, PCVOID pvkey, int iKeySize);
+    HRESULT (*RemoveVal)(PCHL_HTABLE phtable, PCVOID pvkey, int iKeySize, PCVOID pvVal, int iValSize);
     HRESULT (*RemoveAt)(CHL_HT_ITERATOR *pItr);
 
     HRESULT (*InitIterator)(PCHL_HTABLE phtable, CHL_HT_ITERATOR *pItr);
 
+    HRESULT (*SetLoadFactor)(PCHL_HTABLE phtable, int iGrowLoadPercent, int iShrinkLoadPercent);
+    HRESULT (*SetHashType)(PCHL_HTABLE phtable, CHL_HT_HASHTYPE hashType);
+
+    HRESULT (*BeginRead)(PCHL_HTABLE phtable);
+    HRESULT (*EndRead)(PCHL_HTABLE phtable);
+
+    HRESULT (*GetStats)(PCHL_HTABLE phtable, CHL_HT_STATS *pStats);
+
+    HRESULT (*SetBudget)(
+        PCHL_HTABLE phtable,
+        SIZE_T cbMaxBytes,
+        CHL_BUDGET_POLICY policy,
+        CHL_EVICT_FN pfnEvict,
+        PVOID pvEvictContext);
+
+    HRESULT (*Merge)(
+        PCHL_HTABLE phtable,
+        PCHL_HTABLE phtSrc,
+        CHL_HT_COMBINE_FN pfnCombine,
+        PVOID pvContext);
+
+    HRESULT (*MergeMany)(
+        PCHL_HTABLE phtable,
+        PCHL_HTABLE *pphtSrcs,
+        int nSrcs,
+        CHL_HT_COMBINE_FN pfnCombine,
+        PVOID pvContext,
+        int nThreads);
+
     void (*Dump)(PCHL_HTABLE phtable);
 };
 
@@ -70,13 +310,18 @@ struct _hashtable {
 // and get all (key,value) pairs one-by-one
 struct _hashtableIterator {
     int opType;
-    int nCurIndex;              // current position in the main bucket
+    int nCurIndex;              // current position in the main bucket, or the current entry of a compact table
     HT_NODE *phtCurNodeInList;  // current position in the sibling list
     PCHL_HTABLE pMyHashTable;   // Pointer to the hashtable to work on
+    UINT uLayoutVersion;        // Table layout the iterator was positioned against
+    BOOL fActive;               // Counted in nActiveIterators of the table
 
     HRESULT (*MoveNext)(
         struct _hashtableIterator *pItr);
 
+    HRESULT (*End)(
+        struct _hashtableIterator *pItr);
+
     HRESULT (*GetCurrent)(
         CHL_HT_ITERATOR *pItr,
         PCVOID pvKey,
@@ -94,7 +339,8 @@ struct _hashtableIterator {
 // Params:
 //      pHTableOut: Address of pointer where to copy the pointer to the hashtable
 //      nEstEntries: Estimated number of entries that would be in the table at any given time.
-//                   This is used to determine the initial size of the hashtable.
+//                   This is used to determine the initial size of the hashtable. The table grows
+//                   and shrinks with the number of entries but never below this initial size.
 //      keyType: Type of variable that is used as key - a string or a number
 //      valType: Type of value that is stored - number, string or void(can be anything)
 //      fValInHeapMem: Set this to true if the value(type is CHL_VT_POINTER) is allocated memory on the heap.
@@ -107,6 +353,89 @@ DllExpImp HRESULT CHL_DsCreateHT(
     _In_ CHL_VALTYPE valType, 
     _In_opt_ BOOL fValInHeapMem);
 
+// Same as CHL_DsCreateHT, with flags that select a variant of the hashtable.
+// With CHL_HT_FLAG_CONCURRENT, CHL_DsInsertHT, CHL_DsFindHT and CHL_DsRemoveHT may be
+// called on the table from multiple threads at the same time. They lock one of a fixed
+// set of lock stripes, each guarding every 256th bucket, so operations on keys in
+// different buckets mostly do not wait for each other. A resize locks every stripe
+// and completes in one go instead of incrementally. CHL_DsInsertBatchHT locks a stripe
+// for each pair as CHL_DsInsertHT does. CHL_DsFindOrInsertHT and CHL_DsFindBatchHT are
+// not supported, since the pointers they return could not be used under a stripe lock.
+// All other functions, including iterators, still require that no other thread uses
+// the table at the same time. With fGetPointerOnly, CHL_DsFindHT returns a pointer to
+// the stored value which is only valid until another thread removes or updates the key.
+// With CHL_HT_FLAG_LOCKFREE_READS, CHL_DsFindHT takes no lock and does not write to memory
+// shared with other threads, so it never waits for a writer and readers do not slow each
+// other down. CHL_DsInsertHT and CHL_DsRemoveHT may be called at the same time as readers
+// but take a single lock, this is meant for tables that are mostly read. An update replaces
+// the entry's node instead of changing its value in place. Removed and replaced entries are
+// freed once every Find that could still be using them has returned, which is checked by
+// later Inserts and Removes. CHL_DsFindBatchHT takes no lock either, and the pointers it
+// returns are valid until CHL_DsEndReadHT as with fGetPointerOnly. CHL_DsFindOrInsertHT and
+// CHL_DsInsertBatchHT are not supported.
+// All other functions require exclusive use as with CHL_HT_FLAG_CONCURRENT. Pointers
+// returned with fGetPointerOnly are valid until CHL_DsEndReadHT, see CHL_DsBeginReadHT.
+// With CHL_HT_FLAG_COMPACT, entries are stored in a dense array in the order their keys
+// were first inserted, and each bucket only holds the index of an entry (4 bytes instead
+// of a whole node). Iterators visit the entries in insertion order and take time in
+// proportion to the number of entries rather than the number of buckets. Updating the
+// value of a key keeps its place in the order. A removed entry leaves a hole in the array
+// until holes outnumber the entries, then the array is compacted, which (like a resize of a
+// concurrent table) makes iterators return E_CHANGED_STATE. A compact table is not resized
+// incrementally: the Insert or Remove that resizes it rebuilds all of the bucket indexes
+// before it returns, taking time in proportion to the number of entries. This only reads
+// the cached hashes in entry order and writes 4 bytes per bucket, without hashing keys or
+// allocating, and does not affect iterators.
+// With CHL_HT_FLAG_MULTIMAP, a key may have several values. Inserting a key that is already
+// in the table adds the value after the existing ones, even if it is one of them. The only
+// value of a key is stored in its node like in other tables, more values are stored together
+// in one array that grows by doubling, so they are all found with one lookup and read without
+// following a pointer per value, see CHL_DsFindAllHT. CHL_DsFindHT, CHL_DsFindOrInsertHT,
+// CHL_DsFindBatchHT and iterators see the first value of each key. CHL_DsRemoveHT and
+// CHL_DsRemoveAtHT remove a key with all of its values, CHL_DsRemoveValHT removes one value.
+// nEntries is the number of keys. Multimaps cannot be combined with the other flags, and
+// CHL_DsSetBudgetHT and merging are not supported.
+// Params:
+//      pHTableOut, nEstEntries, keyType, valType, fValInHeapMem: Same as for CHL_DsCreateHT.
+//      dwFlags: Zero, CHL_HT_FLAG_CONCURRENT, CHL_HT_FLAG_LOCKFREE_READS, CHL_HT_FLAG_COMPACT or
+//          CHL_HT_FLAG_MULTIMAP.
+//
+DllExpImp HRESULT CHL_DsCreateExHT(
+    _Inout_ CHL_HTABLE **pHTableOut,
+    _In_ int nEstEntries,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ DWORD dwFlags);
+
+// Starts a read section on the calling thread, for a table created with CHL_DsCreateExHT
+// and CHL_HT_FLAG_LOCKFREE_READS. Values found with fGetPointerOnly during the read section
+// stay valid until it ends, even if the key is removed or updated meanwhile. This applies to
+// all tables with lock-free reads, not only to phtable. Read sections may be nested, each
+// one must be ended by CHL_DsEndReadHT on the same thread. Inserts and Removes may be done
+// during a read section, but memory is not freed while any thread is in one, so they
+// should be short. Has no effect on other tables.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateExHT function.
+//
+DllExpImp HRESULT CHL_DsBeginReadHT(_In_ PCHL_HTABLE phtable);
+
+// Ends a read section started by CHL_DsBeginReadHT.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateExHT function.
+//
+DllExpImp HRESULT CHL_DsEndReadHT(_In_ PCHL_HTABLE phtable);
+
+// Gets the number of entries, the distribution of chain lengths, memory used and, if enabled,
+// lookup counters. Walks every bucket, so it takes time in proportion to the table's size.
+// May be called on concurrent tables and tables with lock-free reads while they are in use,
+// it blocks writers (and, for concurrent tables, readers) for the duration.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      pStats: Pointer to the structure to fill in.
+//
+DllExpImp HRESULT CHL_DsGetStatsHT(_In_ PCHL_HTABLE phtable, _Out_ CHL_HT_STATS *pStats);
+
 // Destroy the hashtable by removing all key-value pairs from the hashtable.
 // The CHL_HTABLE object itself is also destroyed.
 // Params:
@@ -130,6 +459,59 @@ DllExpImp HRESULT CHL_DsInsertHT(
     _In_ PCVOID pvVal, 
     _In_ int iValSize);
 
+// Same as CHL_DsInsertHT, and returns a handle to the inserted or updated entry. With the handle,
+// CHL_DsGetByEntryHandleHT, CHL_DsSetByEntryHandleHT and CHL_DsRemoveByEntryHandleHT get to the
+// entry without hashing or comparing its key. The handle stays valid while the table grows,
+// shrinks and is updated, until the entry is removed, evicted, merged into another table, or
+// the table is destroyed. Handles are not supported on concurrent, compact and multimap tables,
+// nor on tables with lock-free reads: for them, ERROR_NOT_SUPPORTED is returned if phEntry is specified.
+// Params:
+//      phtable, pvkey, iKeySize, pvVal, iValSize: Refer documentation of the CHL_DsInsertHT() function.
+//      phEntry: Optional. Receives the handle to the entry. The same key always gets the same handle
+//          until it is removed.
+//
+DllExpImp HRESULT CHL_DsInsertExHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_opt_ PCHL_HT_ENTRYHANDLE phEntry);
+
+// Gets the value of the entry that the handle refers to. Returns E_NOT_SET if the entry has been
+// removed since the handle was returned.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      phEntry: Handle returned by CHL_DsInsertExHT for this table.
+//      pvVal, pvalsize, fGetPointerOnly: Refer documentation of the CHL_DsFindHT() function.
+//
+DllExpImp HRESULT CHL_DsGetByEntryHandleHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ const CHL_HT_ENTRYHANDLE *phEntry,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pvalsize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+// Replaces the value of the entry that the handle refers to, as inserting its key again would.
+// Returns E_NOT_SET if the entry has been removed since the handle was returned.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      phEntry: Handle returned by CHL_DsInsertExHT for this table.
+//      pvVal, iValSize: Refer documentation of the CHL_DsInsertHT() function.
+//
+DllExpImp HRESULT CHL_DsSetByEntryHandleHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ const CHL_HT_ENTRYHANDLE *phEntry,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+// Removes the entry that the handle refers to. Returns E_NOT_SET if the entry has already been removed.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      phEntry: Handle returned by CHL_DsInsertExHT for this table.
+//
+DllExpImp HRESULT CHL_DsRemoveByEntryHandleHT(_In_ CHL_HTABLE *phtable, _In_ const CHL_HT_ENTRYHANDLE *phEntry);
+
 // Find the specified key in the hash table.
 // Params:
 //      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
@@ -150,6 +532,171 @@ DllExpImp HRESULT CHL_DsFindHT(
     _Inout_opt_ PINT pvalsize,
     _In_opt_ BOOL fGetPointerOnly);
 
+// Prepares a key for CHL_DsInsertByHandleHT, CHL_DsFindByHandleHT and CHL_DsRemoveByHandleHT,
+// which can then be called on any number of tables with the same key type without determining
+// the size of the key or hashing it again. The hash does not depend on any table, it is the one
+// that tables using CHL_HT_HASH_SHARED64 (see CHL_DsSetHashTypeHT) compute. Tables using the
+// default CHL_HT_HASH_SEEDED64 hash the key with their own seed the first time the handle is
+// used with them and keep that hash in the handle, so repeated calls on one table hash it once.
+// Switching between such tables hashes the key again, use CHL_HT_HASH_SHARED64 for that.
+// Params:
+//      keyType: Type of the key, same as for CHL_DsCreateHT.
+//      pvkey: Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//          Not copied, so it must stay valid for as long as the handle is used.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//      phKey: Pointer to the handle to fill in.
+//
+DllExpImp HRESULT CHL_DsPrepareKeyHT(
+    _In_ CHL_KEYTYPE keyType,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ CHL_HT_KEYHANDLE *phKey);
+
+// Same as CHL_DsInsertHT, with a key prepared by CHL_DsPrepareKeyHT.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      phKey: The key handle. Its key type must be that of the table, otherwise E_INVALIDARG is returned.
+//      pvVal, iValSize: Same as for CHL_DsInsertHT.
+//
+DllExpImp HRESULT CHL_DsInsertByHandleHT(
+    _In_ CHL_HTABLE *phtable,
+    _Inout_ CHL_HT_KEYHANDLE *phKey,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+// Same as CHL_DsFindHT, with a key prepared by CHL_DsPrepareKeyHT.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      phKey: The key handle. Its key type must be that of the table, otherwise E_INVALIDARG is returned.
+//      pvVal, pvalsize, fGetPointerOnly: Same as for CHL_DsFindHT.
+//
+DllExpImp HRESULT CHL_DsFindByHandleHT(
+    _In_ CHL_HTABLE *phtable,
+    _Inout_ CHL_HT_KEYHANDLE *phKey,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pvalsize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+// Same as CHL_DsRemoveHT, with a key prepared by CHL_DsPrepareKeyHT.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      phKey: The key handle. Its key type must be that of the table, otherwise E_INVALIDARG is returned.
+//
+DllExpImp HRESULT CHL_DsRemoveByHandleHT(_In_ CHL_HTABLE *phtable, _Inout_ CHL_HT_KEYHANDLE *phKey);
+
+// Find the specified key in the hash table and insert it with the specified value if it is not
+// found. Either way, a pointer to the stored value is returned so that it can be updated in place.
+// The key is hashed and looked up only once. This is meant for patterns like counting, where
+// an Insert following a Find would do the lookup twice.
+// The returned pointer is valid until the next call that modifies or looks up in the table
+// (Insert/FindOrInsert/Find/Remove), since these may move entries between buckets.
+// Values of type CHL_VT_INT32/CHL_VT_UINT32 can be updated directly through the returned pointer,
+// e.g. ++pChlVal->valDef.iVal. Other value types must not be reallocated through it.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      pvkey: Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//      pvVal: Value to be stored if the key is not found. Ignored if the key is found.
+//      iValSize: Size of the value in bytes. For null-terminated strings, zero may be passed.
+//      ppChlVal: Receives a pointer to the stored value, NULL upon failure.
+//      pfCreated: Optional. Receives TRUE if the key was inserted, FALSE if it already existed.
+//
+DllExpImp HRESULT CHL_DsFindOrInsertHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_opt_ PCVOID pvVal,
+    _In_ int iValSize,
+    _Out_ PCHL_VAL *ppChlVal,
+    _Out_opt_ PBOOL pfCreated);
+
+// Find a batch of keys in the hash table. All keys of a group are hashed and their buckets
+// are prefetched before any of them is looked up, so that the cache misses of different
+// keys overlap instead of being paid one after another.
+// Any resize work is done before the lookups, so that all returned pointers are valid
+// until the next call on the table that modifies or looks up in it.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      ppvKeys: Array of nKeys keys, each as would be passed to CHL_DsFindHT().
+//      piKeySizes: Optional. Array of nKeys key sizes in bytes. If this is NULL, or for
+//          an entry that is zero, the size of the null-terminated string key is computed.
+//      nKeys: Number of keys in the batch.
+//      ppChlVals: Array of nKeys that receives a pointer to the stored value of each key,
+//          or NULL for a key that was not found.
+//      phrResults: Optional. Array of nKeys that receives the result for each key:
+//          S_OK if found, E_NOT_SET if not found, E_INVALIDARG if the key size is unknown.
+// Returns S_OK if all keys were found, otherwise the first failure among the keys.
+//
+DllExpImp HRESULT CHL_DsFindBatchHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_count_(nKeys) PCVOID *ppvKeys,
+    _In_opt_count_(nKeys) const int *piKeySizes,
+    _In_ int nKeys,
+    _Out_cap_(nKeys) PCHL_VAL *ppChlVals,
+    _Out_opt_cap_(nKeys) HRESULT *phrResults);
+
+// Insert a batch of key,value pairs into the hash table. Each pair is inserted as if by
+// CHL_DsInsertHT(), in array order, with the keys hashed and prefetched a group at a time.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      ppvKeys: Array of nKeys keys, each as would be passed to CHL_DsInsertHT().
+//      piKeySizes: Optional. Array of nKeys key sizes, see CHL_DsFindBatchHT().
+//      ppvVals: Array of nKeys values, each as would be passed to CHL_DsInsertHT().
+//      piValSizes: Optional. Array of nKeys value sizes in bytes. If this is NULL, or for
+//          an entry that is zero, the size is determined from the value type.
+//      nKeys: Number of pairs in the batch.
+//      phrResults: Optional. Array of nKeys that receives the result of each insertion.
+// Returns S_OK if all pairs were inserted, otherwise the first failure among them.
+//
+DllExpImp HRESULT CHL_DsInsertBatchHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_count_(nKeys) PCVOID *ppvKeys,
+    _In_opt_count_(nKeys) const int *piKeySizes,
+    _In_count_(nKeys) PCVOID *ppvVals,
+    _In_opt_count_(nKeys) const int *piValSizes,
+    _In_ int nKeys,
+    _Out_opt_cap_(nKeys) HRESULT *phrResults);
+
+// Find all values of the specified key in the hash table with one lookup. For a table created
+// with CHL_HT_FLAG_MULTIMAP, these are in the order they were inserted in, other tables have
+// one value per key. The values are returned as an array of stored values that is valid until
+// the next call that modifies or looks up in the table, as for CHL_DsFindOrInsertHT. Read them
+// with the CHL_VAL members for the value type, e.g. paVals[i].valDef.iVal, and iValSize.
+// Not supported on tables created with CHL_HT_FLAG_LOCKFREE_READS, E_NOT_VALID_STATE is returned.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      pvkey: Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//      ppChlVals: Receives a pointer to the first of the values, NULL if the key is not found.
+//      pnVals: Receives the number of values, 0 if the key is not found.
+//
+DllExpImp HRESULT CHL_DsFindAllHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Out_ PCHL_VAL *ppChlVals,
+    _Out_ PINT pnVals);
+
+// Deletes one key,value pair from the hash table: the first value of the key that is equal to
+// the specified value, compared as CHL_DsInsertHT compares values. The other values of the key
+// keep their order. If it was the only value of the key, the key is deleted. Returns E_NOT_SET
+// if the key does not have the value. Not supported on tables created with CHL_HT_FLAG_CONCURRENT,
+// CHL_HT_FLAG_LOCKFREE_READS or CHL_HT_FLAG_COMPACT, HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED)
+// is returned.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      pvkey: Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//      pvVal: The value to delete, as it would be passed to CHL_DsInsertHT().
+//      iValSize: Size of the value in bytes. For null-terminated strings, zero may be passed.
+//
+DllExpImp HRESULT CHL_DsRemoveValHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
 // Deletes the specified key from the hash table.
 // Params:
 //      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
@@ -168,6 +715,16 @@ DllExpImp HRESULT CHL_DsRemoveAtHT(_Inout_ CHL_HT_ITERATOR *pItr);
 
 // Initialize the iterator object for use with the specified hashtable.
 // Iterator will point to the first element or nothing if hashtable is empty.
+// A resize that is in progress is not completed, the iterator visits the buckets that
+// remain to be migrated and then the new ones. Until the iterator reaches the end, fails or
+// is passed to CHL_DsEndIteratorHT, Insert, Find and Remove do not migrate any buckets, so
+// they leave the iterator valid and it visits every entry that is not removed exactly once.
+// Entries inserted meanwhile may or may not be visited. An iterator that is not moved to the
+// end must be ended before it is initialized again, or the resize stays paused (the table
+// still works, but grows no further). Merging into the table, and a resize of a concurrent
+// table (which completes at once), move entries anyway. The iterator methods then return
+// E_CHANGED_STATE and the iterator must be initialized again. Iterators of a table created
+// with CHL_HT_FLAG_COMPACT visit entries in insertion order.
 // Params:
 //      pItr: Pointer to the iterator object to initialize.
 //      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
@@ -181,6 +738,14 @@ DllExpImp HRESULT CHL_DsInitIteratorHT(_In_ PCHL_HTABLE phtable, _Out_ CHL_HT_IT
 //
 DllExpImp HRESULT CHL_DsMoveNextHT(_Inout_ CHL_HT_ITERATOR *pItr);
 
+// Ends an iteration before the iterator reaches the end, so that the table resumes a resize
+// that is in progress, see CHL_DsInitIteratorHT. The iterator must not be used afterwards
+// unless it is initialized again. Ending an iterator that has reached the end does nothing.
+// Params:
+//      pItr: The iterator object that was initialized by CHL_DsInitIteratorHT.
+//
+DllExpImp HRESULT CHL_DsEndIteratorHT(_Inout_ CHL_HT_ITERATOR *pItr);
+
 // Get the current element in the hash table using the specified iterator object.
 // Params:
 //      pItr: The iterator object that was initialized by CHL_DsInitIteratorHT.
@@ -199,11 +764,127 @@ DllExpImp HRESULT CHL_DsGetCurrentHT(
     _Inout_opt_ PINT piValSize,
     _In_opt_ BOOL fGetPointerOnly);
 
+// Set the load factors at which the hashtable resizes itself. After a resize, the table is
+// at most half full. Moving entries to the resized table is spread across subsequent
+// Insert/Find/Remove calls so that no single call pays for rehashing the whole table.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      iGrowLoadPercent: Grow when #entries exceeds this percent of #buckets. Must be greater
+//          than 50. Zero disables growing. Default is 100.
+//      iShrinkLoadPercent: Shrink when #entries falls below this percent of #buckets. Must be
+//          less than 25. Zero disables shrinking. Default is 10.
+//
+DllExpImp HRESULT CHL_DsSetLoadFactorHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ int iGrowLoadPercent,
+    _In_ int iShrinkLoadPercent);
+
+// Select the hash function that the hashtable uses. This can only be done while
+// the hashtable is empty.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      hashType: One of the CHL_HT_HASHTYPE values. CHL_HT_HASH_SEEDED64 picks a new random seed.
+//
+DllExpImp HRESULT CHL_DsSetHashTypeHT(_In_ CHL_HTABLE *phtable, _In_ CHL_HT_HASHTYPE hashType);
+
+// Set a byte budget for the hashtable. Every table keeps budget.cbUsed up to date, the bytes
+// charged for its entries (see CHL_BUDGET), so its footprint can be read at any time without
+// walking the table like CHL_DsGetStatsHT does. With a budget, an insert that would take the
+// table over it fails with HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA) under CHL_BP_FAIL, or
+// succeeds and evicts other entries until the table is within budget again. The key inserted
+// or updated is never evicted by its own insert. An entry that alone is charged more than the
+// budget is never inserted, E_INVALIDARG is returned. Lowering the budget of a table evicts
+// right away.
+// Budgets are not supported on tables created with CHL_HT_FLAG_CONCURRENT,
+// CHL_HT_FLAG_LOCKFREE_READS or CHL_HT_FLAG_MULTIMAP, HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED)
+// is returned.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      cbMaxBytes: The budget in bytes, 0 to remove the budget.
+//      policy: What to do when an insert goes over the budget. CHL_BP_EVICT_OLDEST evicts in
+//          insertion order and requires CHL_HT_FLAG_COMPACT. CHL_BP_EVICT_RANDOM evicts
+//          the first entry found from a random bucket (or entry of a compact table) on.
+//      pfnEvict: Optional. Called for each entry that is evicted.
+//      pvEvictContext: Optional. Passed to pfnEvict.
+//
+DllExpImp HRESULT CHL_DsSetBudgetHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ SIZE_T cbMaxBytes,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext);
+
+// Moves every entry of phtSrc into phtable. Entries are moved as they are: keys and values
+// are not copied again, and nodes chained in a bucket are linked into the destination
+// buckets without being allocated again. Keys are hashed again only if the two tables do
+// not use the same hash function and seed. If a key is in both tables, pfnCombine decides
+// the value it is left with. phtSrc is left empty, it can be used further or destroyed.
+// The destination grows as entries are moved in, as it would for Inserts. Neither table may
+// be used by another thread meanwhile, even if it was created with CHL_HT_FLAG_CONCURRENT.
+// Tables created with CHL_HT_FLAG_LOCKFREE_READS, CHL_HT_FLAG_COMPACT or CHL_HT_FLAG_MULTIMAP
+// are not supported, HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) is returned. If phtable has a
+// budget, an evicting policy evicts after the merge and CHL_BP_FAIL fails up front if the bytes
+// charged for both tables together are over the budget. If memory runs out, the entries that
+// could not be moved are left in phtSrc and E_OUTOFMEMORY is returned. Entry handles of phtSrc
+// no longer match once the merge starts, those of phtable stay valid.
+// Params:
+//      phtable: Pointer to the destination hashtable object returned by CHL_DsCreateHT function.
+//      phtSrc: The hashtable to move the entries from. Must have the same key type, value
+//          type and fValInHeapMem as phtable.
+//      pfnCombine: Optional. Called for each key that is in both tables, see CHL_HT_COMBINE_FN.
+//          If NULL, the value of phtSrc replaces that of phtable, as CHL_DsInsertHT would.
+//      pvContext: Optional. Passed to pfnCombine.
+//
+DllExpImp HRESULT CHL_DsMergeHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_ CHL_HTABLE *phtSrc,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext);
+
+// Same as CHL_DsMergeHT for several source tables at once, using worker threads. The
+// destination is grown up front to fit the number of entries estimated from a sample of the
+// source keys, and resized again afterwards if the estimate was off. The work is done in two
+// phases. First, the entries of each source are split by the destination bucket they go
+// into, one source per worker. Then the destination buckets are divided into ranges and each
+// worker places the entries of all sources that go into one range, so that no two workers
+// touch the same bucket and no locks are taken. Keys that are in more than one table are
+// combined in the order of pphtSrcs, pfnCombine is called from several threads at once but
+// never for the same key at the same time.
+// Params:
+//      phtable, pfnCombine, pvContext: Same as for CHL_DsMergeHT.
+//      pphtSrcs: Array of nSrcs distinct hashtables to move the entries from.
+//      nSrcs: Number of source tables.
+//      nThreads: Most threads to use, including the calling one. 0 for one per processor.
+//
+DllExpImp HRESULT CHL_DsMergeManyHT(
+    _In_ CHL_HTABLE *phtable,
+    _In_count_(nSrcs) CHL_HTABLE **pphtSrcs,
+    _In_ int nSrcs,
+    _In_opt_ CHL_HT_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads);
+
+// Combiners for CHL_DsMergeHT. For values of type CHL_VT_INT32 and CHL_VT_UINT32, they leave
+// the destination with the sum (wrapping around on overflow) or the larger of the two values.
+// Values of other types are left as they are in the destination.
+DllExpImp void CHL_DsCombineSumHT(
+    _Inout_ PCHL_VAL pChlValDst,
+    _Inout_ PCHL_VAL pChlValSrc,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ PVOID pvContext);
+
+DllExpImp void CHL_DsCombineMaxHT(
+    _Inout_ PCHL_VAL pChlValDst,
+    _Inout_ PCHL_VAL pChlValSrc,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ PVOID pvContext);
+
 DllExpImp int CHL_DsGetNearestSizeIndexHT(_In_ int maxNumberOfEntries);
 DllExpImp void CHL_DsDumpHT(_In_ CHL_HTABLE *phtable);
 
 // Exposing for unit testing
 DllExpImp DWORD _GetKeyHash(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize, _In_ int iTableNodes);
+DllExpImp DWORD _GetBucketIndex(_In_ PCHL_HTABLE phtable, _In_ PCVOID pvKey, _In_ int iKeySize, _In_ int nBuckets);
 
 #ifdef __cplusplus
 }
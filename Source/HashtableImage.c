@@ -0,0 +1,1263 @@
+
+// HashtableImage.c
+// Read-only hashtable images: frozen in memory, or saved to a file once and used by mapping the file
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//      10/17/26 Minimal perfect hash layout, images can be frozen in memory and iterated
+//
+
+#include "InternalDefines.h"
+#include "HashFunctions.h"
+#include "HashtableImage.h"
+
+// 'CHLI' in the first 4 bytes of the file
+#define HT_IMAGE_MAGIC      0x494C4843
+#define HT_IMAGE_VERSION    2
+
+// Alignment of the entries and of user object values in the data section
+#define HT_IMAGE_ALIGN      8
+
+#define HT_IMAGE_ALIGN_UP(cb, align)    (((cb) + ((align) - 1)) & ~((ULONGLONG)(align) - 1))
+
+// Average number of keys that share a pilot. Larger buckets make the image
+// smaller, but it takes longer to find pilots for them.
+#define HT_IMAGE_KEYS_PER_BUCKET    3
+
+// A pilot that places a bucket is practically always found within this many
+// tries per entry. If not, the keys are hashed again with a different seed.
+#define HT_IMAGE_PILOT_TRIES_PER_ENTRY  64
+#define HT_IMAGE_MAX_SEEDS              8
+
+#define HT_IMAGE_PILOT_MULTIPLIER   0x9E3779B97F4A7C15ULL
+
+// Largest single WriteFile call when writing an image
+#define HT_IMAGE_MAX_WRITE  (1UL << 30)
+
+// Layout of the image:
+//      header
+//      pilots: nBuckets DWORDs
+//      entries: nEntries HT_IMAGE_ENTRYs
+//      data: contents of string and user object keys and values
+// A key's bucket is picked by its hash, and its entry by its hash mixed with the
+// pilot of the bucket. The pilots are chosen so that no two keys share an entry.
+// All fields have a fixed size and all references are offsets, so the image has the
+// same layout in 32bit and 64bit processes and can be mapped at any address.
+typedef struct _htImageHeader {
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD dwKeyType;            // CHL_KEYTYPE
+    DWORD dwValType;            // CHL_VALTYPE
+    DWORD nEntries;
+    DWORD nBuckets;
+    ULONGLONG ullHashSeed;
+    ULONGLONG cbImage;          // Size of the whole image
+    ULONGLONG ullPilotsOffset;
+    ULONGLONG ullEntriesOffset;
+    ULONGLONG ullDataOffset;
+}HT_IMAGE_HEADER;
+
+typedef struct _htImageEntry {
+    ULONGLONG ullKey;           // Integer and pointer keys: the key. Otherwise, offset of the key in the data section.
+    ULONGLONG ullVal;           // Integer and pointer values: the value. Otherwise, offset of the value in the data section.
+    DWORD cbKey;                // Size of the key, strings include their terminator
+    DWORD cbVal;                // Size of the value, strings include their terminator
+}HT_IMAGE_ENTRY;
+
+// A key-value pair of the hashtable while its image is built.
+// Points into the hashtable, which is not modified meanwhile.
+typedef struct _htImageSource {
+    ULONGLONG ullHash;
+    PVOID pvKey;                // Integer and pointer keys: the key itself
+    PVOID pvVal;                // Integer and pointer values: the value itself
+    int iKeySize;
+    int iValSize;
+}HT_IMAGE_SOURCE;
+
+// File-local Functions
+static BOOL _IsSupportedKeyType(_In_ CHL_KEYTYPE keyType, _In_ BOOL fForFile);
+static BOOL _IsSupportedValType(_In_ CHL_VALTYPE valType, _In_ BOOL fForFile);
+static ULONGLONG _ImageKeyHash(_In_ CHL_KEYTYPE keyType, _In_ PCVOID pvKey, _In_ int iKeySize, _In_ ULONGLONG ullSeed);
+static DWORD _ImageKeyBytes(_In_ CHL_KEYTYPE keyType, _In_ PCVOID pvKey, _In_ int iKeySize);
+static DWORD _ImageValBytes(_In_ CHL_VALTYPE valType, _In_ PCVOID pvVal, _In_ int iValSize);
+static DWORD _ImageKeyAlign(_In_ CHL_KEYTYPE keyType);
+static DWORD _ImageValAlign(_In_ CHL_VALTYPE valType);
+static __inline DWORD _ImageSlot(_In_ ULONGLONG ullHash, _In_ DWORD dwPilot, _In_ DWORD nEntries);
+
+static HRESULT _CollectSources(
+    _In_ PCHL_HTABLE phtable,
+    _Out_ HT_IMAGE_SOURCE **ppSources,
+    _Out_ DWORD *pnSources);
+
+static HRESULT _FindPilots(
+    _In_ HT_IMAGE_SOURCE *pSources,
+    _In_ DWORD nEntries,
+    _In_ DWORD nBuckets,
+    _Out_ DWORD *pdwPilots,
+    _Out_ DWORD *pdwSourceOfSlot);
+
+static HRESULT _BuildImage(
+    _In_ PCHL_HTABLE phtable,
+    _Out_ BYTE **ppbImage,
+    _Out_ ULONGLONG *pcbImage);
+
+static HRESULT _CreateImageObject(
+    _In_ const BYTE *pbImage,
+    _In_ BOOL fMapped,
+    _Out_ PCHL_HT_IMAGE *ppImage);
+
+static HRESULT _WriteImageFile(_In_z_ PCWSTR pszFilepath, _In_ const BYTE *pbImage, _In_ ULONGLONG cbImage);
+static HRESULT _ValidateImageHeader(_In_ const BYTE *pbImage, _In_ ULONGLONG cbImage);
+
+static BOOL _IsValidImageData(
+    _In_ PCHL_HT_IMAGE pImage,
+    _In_ ULONGLONG ullOffset,
+    _In_ DWORD cbData,
+    _In_ BOOL fString,
+    _In_ DWORD cbChar);
+
+static HRESULT _GetImageKey(_In_ PCHL_HT_IMAGE pImage, _In_ const HT_IMAGE_ENTRY *pEntry, _Out_ PCHL_KEY pChlKey);
+static HRESULT _GetImageVal(_In_ PCHL_HT_IMAGE pImage, _In_ const HT_IMAGE_ENTRY *pEntry, _Out_ PCHL_VAL pChlVal);
+
+// Pointer keys and values only have a meaning in the process that inserted them,
+// they can be frozen but not written to a file.
+BOOL _IsSupportedKeyType(_In_ CHL_KEYTYPE keyType, _In_ BOOL fForFile)
+{
+    return (keyType == CHL_KT_INT32) || (keyType == CHL_KT_UINT32) ||
+        (keyType == CHL_KT_STRING) || (keyType == CHL_KT_WSTRING) ||
+        (!fForFile && (keyType == CHL_KT_POINTER));
+}
+
+BOOL _IsSupportedValType(_In_ CHL_VALTYPE valType, _In_ BOOL fForFile)
+{
+    return (valType == CHL_VT_INT32) || (valType == CHL_VT_UINT32) || (valType == CHL_VT_USEROBJECT) ||
+        (valType == CHL_VT_STRING) || (valType == CHL_VT_WSTRING) ||
+        (!fForFile && (valType == CHL_VT_POINTER));
+}
+
+// Same as the key hash of CHL_HTABLE, string keys are hashed up to their terminator
+// so that a lookup finds the key whether or not iKeySize includes the terminator.
+ULONGLONG _ImageKeyHash(_In_ CHL_KEYTYPE keyType, _In_ PCVOID pvKey, _In_ int iKeySize, _In_ ULONGLONG ullSeed)
+{
+    ULONGLONG ullHash = 0;
+
+    switch (keyType)
+    {
+    case CHL_KT_INT32:
+    case CHL_KT_UINT32:
+        {
+            ullHash = _HashUInt64((UINT)(UINT_PTR)pvKey, ullSeed);
+            break;
+        }
+
+    case CHL_KT_POINTER:
+        {
+            ullHash = _HashUInt64((ULONGLONG)(UINT_PTR)pvKey, ullSeed);
+            break;
+        }
+
+    case CHL_KT_STRING:
+        {
+            ullHash = _HashBytes64(pvKey, strnlen((PCSTR)pvKey, iKeySize), ullSeed);
+            break;
+        }
+
+    case CHL_KT_WSTRING:
+        {
+            ullHash = _HashBytes64(pvKey, wcsnlen((PCWSTR)pvKey, iKeySize / sizeof(WCHAR)) * sizeof(WCHAR), ullSeed);
+            break;
+        }
+
+    default:
+        {
+            ASSERT(FALSE);
+            break;
+        }
+    }
+    return ullHash;
+}
+
+// Number of bytes a key takes in the data section, strings are always stored with a terminator
+DWORD _ImageKeyBytes(_In_ CHL_KEYTYPE keyType, _In_ PCVOID pvKey, _In_ int iKeySize)
+{
+    switch (keyType)
+    {
+    case CHL_KT_STRING:
+        return (DWORD)(strnlen((PCSTR)pvKey, iKeySize) + 1);
+
+    case CHL_KT_WSTRING:
+        return (DWORD)((wcsnlen((PCWSTR)pvKey, iKeySize / sizeof(WCHAR)) + 1) * sizeof(WCHAR));
+
+    default:
+        return 0;
+    }
+}
+
+// Number of bytes a value takes in the data section, strings are always stored with a terminator
+DWORD _ImageValBytes(_In_ CHL_VALTYPE valType, _In_ PCVOID pvVal, _In_ int iValSize)
+{
+    switch (valType)
+    {
+    case CHL_VT_USEROBJECT:
+        return (DWORD)iValSize;
+
+    case CHL_VT_STRING:
+        return (DWORD)(strnlen((PCSTR)pvVal, iValSize) + 1);
+
+    case CHL_VT_WSTRING:
+        return (DWORD)((wcsnlen((PCWSTR)pvVal, iValSize / sizeof(WCHAR)) + 1) * sizeof(WCHAR));
+
+    default:
+        return 0;
+    }
+}
+
+// Keys are packed with only the alignment their characters need
+DWORD _ImageKeyAlign(_In_ CHL_KEYTYPE keyType)
+{
+    return (keyType == CHL_KT_WSTRING) ? sizeof(WCHAR) : sizeof(char);
+}
+
+DWORD _ImageValAlign(_In_ CHL_VALTYPE valType)
+{
+    switch (valType)
+    {
+    case CHL_VT_USEROBJECT:
+        return HT_IMAGE_ALIGN;
+
+    case CHL_VT_WSTRING:
+        return sizeof(WCHAR);
+
+    default:
+        return sizeof(char);
+    }
+}
+
+DWORD _ImageSlot(_In_ ULONGLONG ullHash, _In_ DWORD dwPilot, _In_ DWORD nEntries)
+{
+    return _ReduceHash64(_FinalizeHash64(ullHash, dwPilot * HT_IMAGE_PILOT_MULTIPLIER), nEntries);
+}
+
+HRESULT CHL_DsFreezeHT(_In_ PCHL_HTABLE phtable, _Out_ PCHL_HT_IMAGE *ppImage)
+{
+    BYTE *pbImage = NULL;
+    ULONGLONG cbImage = 0;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    if (ppImage == NULL)
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    *ppImage = NULL;
+
+    if (!_IsSupportedKeyType(phtable->keyType, FALSE) || !_IsSupportedValType(phtable->valType, FALSE))
+    {
+        logerr("%s(): Key type %d / value type %d cannot be frozen", __FUNCTION__, phtable->keyType, phtable->valType);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto fend;
+    }
+
+    // An image holds one value per key
+    if (phtable->fMultimap)
+    {
+        logerr("%s(): Not supported on a multimap.", __FUNCTION__);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto fend;
+    }
+
+    hr = _BuildImage(phtable, &pbImage, &cbImage);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    hr = _CreateImageObject(pbImage, FALSE, ppImage);
+    if (FAILED(hr))
+    {
+        free(pbImage);
+    }
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsWriteImageHT(_In_ PCHL_HT_IMAGE pImage, _In_z_ PCWSTR pszFilepath)
+{
+    ASSERT(pImage);
+
+    if (pszFilepath == NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (!_IsSupportedKeyType(pImage->keyType, TRUE) || !_IsSupportedValType(pImage->valType, TRUE))
+    {
+        logerr("%s(): Key type %d / value type %d cannot be saved", __FUNCTION__, pImage->keyType, pImage->valType);
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    return _WriteImageFile(pszFilepath, pImage->pbImage, pImage->cbImage);
+}
+
+HRESULT CHL_DsSaveImageHT(_In_ PCHL_HTABLE phtable, _In_z_ PCWSTR pszFilepath)
+{
+    BYTE *pbImage = NULL;
+    ULONGLONG cbImage = 0;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(phtable);
+
+    if (pszFilepath == NULL)
+    {
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    if (!_IsSupportedKeyType(phtable->keyType, TRUE) || !_IsSupportedValType(phtable->valType, TRUE))
+    {
+        logerr("%s(): Key type %d / value type %d cannot be saved", __FUNCTION__, phtable->keyType, phtable->valType);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto fend;
+    }
+
+    // An image holds one value per key
+    if (phtable->fMultimap)
+    {
+        logerr("%s(): Not supported on a multimap.", __FUNCTION__);
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto fend;
+    }
+
+    hr = _BuildImage(phtable, &pbImage, &cbImage);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    hr = _WriteImageFile(pszFilepath, pbImage, cbImage);
+
+fend:
+    if (pbImage != NULL)
+    {
+        free(pbImage);
+    }
+    return hr;
+}
+
+// Copies out the key, value and sizes of every pair in the table
+HRESULT _CollectSources(
+    _In_ PCHL_HTABLE phtable,
+    _Out_ HT_IMAGE_SOURCE **ppSources,
+    _Out_ DWORD *pnSources)
+{
+    CHL_HT_ITERATOR itr;
+    HT_IMAGE_SOURCE *pSources = NULL;
+    HT_IMAGE_SOURCE *pSource;
+    DWORD nEntries;
+    DWORD iEntry = 0;
+
+    HRESULT hr = S_OK;
+
+    *ppSources = NULL;
+    *pnSources = 0;
+
+    nEntries = (DWORD)phtable->nEntries;
+    if ((pSources = (HT_IMAGE_SOURCE*)calloc(max(nEntries, 1), sizeof(HT_IMAGE_SOURCE))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto error_return;
+    }
+
+    for (hr = CHL_DsInitIteratorHT(phtable, &itr); SUCCEEDED(hr); hr = CHL_DsMoveNextHT(&itr))
+    {
+        if (iEntry == nEntries)
+        {
+            CHL_DsEndIteratorHT(&itr);
+            hr = E_CHANGED_STATE;
+            goto error_return;
+        }
+
+        pSource = &pSources[iEntry++];
+        hr = CHL_DsGetCurrentHT(&itr, &pSource->pvKey, &pSource->iKeySize, &pSource->pvVal, &pSource->iValSize, TRUE);
+        if (FAILED(hr))
+        {
+            CHL_DsEndIteratorHT(&itr);
+            goto error_return;
+        }
+
+        // Integers are copied out into the low 4 bytes only
+        if ((phtable->keyType == CHL_KT_INT32) || (phtable->keyType == CHL_KT_UINT32))
+        {
+            pSource->pvKey = (PVOID)(UINT_PTR)*(PUINT)&pSource->pvKey;
+        }
+
+        if ((phtable->valType == CHL_VT_INT32) || (phtable->valType == CHL_VT_UINT32))
+        {
+            pSource->pvVal = (PVOID)(UINT_PTR)*(PUINT)&pSource->pvVal;
+        }
+    }
+
+    if ((hr != E_NOT_SET) || (iEntry != nEntries))
+    {
+        hr = (hr == E_NOT_SET) ? E_CHANGED_STATE : hr;
+        goto error_return;
+    }
+
+    *ppSources = pSources;
+    *pnSources = nEntries;
+    return S_OK;
+
+error_return:
+    if (pSources != NULL)
+    {
+        free(pSources);
+    }
+    return hr;
+}
+
+// Hash and displace: buckets are placed from the largest to the smallest, each with the
+// first pilot that moves all of its keys into entries that are still free. The big buckets
+// are placed while most entries are free, single keys fill the remaining ones at the end.
+// Fails with E_FAIL if some bucket cannot be placed, the caller then tries another seed.
+HRESULT _FindPilots(
+    _In_ HT_IMAGE_SOURCE *pSources,
+    _In_ DWORD nEntries,
+    _In_ DWORD nBuckets,
+    _Out_ DWORD *pdwPilots,
+    _Out_ DWORD *pdwSourceOfSlot)
+{
+    DWORD *pdwBucketStarts = NULL;  // Sources of bucket b are pdwOrder[pdwBucketStarts[b] .. pdwBucketStarts[b+1])
+    DWORD *pdwOrder = NULL;         // Sources grouped by bucket
+    DWORD *pdwBuckets = NULL;       // Buckets from the largest to the smallest
+    DWORD *pdwSizeStarts = NULL;
+    DWORD *pdwSlots = NULL;         // Entries of the bucket being placed
+    BYTE *pbTaken = NULL;
+    DWORD nMaxBucketSize = 0;
+    DWORD nMaxTries;
+    DWORD iBucket;
+    DWORD iRank;
+    DWORD iSource;
+    DWORD iKey;
+    DWORD iOther;
+    DWORD nKeys;
+    DWORD dwPilot;
+    DWORD iSlot;
+    const DWORD *pdwKeys;
+
+    HRESULT hr = S_OK;
+
+    pdwBucketStarts = (DWORD*)calloc((size_t)nBuckets + 1, sizeof(DWORD));
+    pdwOrder = (DWORD*)malloc((size_t)max(nEntries, 1) * sizeof(DWORD));
+    pdwBuckets = (DWORD*)malloc((size_t)nBuckets * sizeof(DWORD));
+    pbTaken = (BYTE*)calloc(max(nEntries, 1), sizeof(BYTE));
+    if ((pdwBucketStarts == NULL) || (pdwOrder == NULL) || (pdwBuckets == NULL) || (pbTaken == NULL))
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto fend;
+    }
+
+    // Group the sources by bucket
+    for (iSource = 0; iSource < nEntries; ++iSource)
+    {
+        ++pdwBucketStarts[_ReduceHash64(pSources[iSource].ullHash, nBuckets) + 1];
+    }
+
+    for (iBucket = 0; iBucket < nBuckets; ++iBucket)
+    {
+        nMaxBucketSize = max(nMaxBucketSize, pdwBucketStarts[iBucket + 1]);
+        pdwBucketStarts[iBucket + 1] += pdwBucketStarts[iBucket];
+    }
+
+    // pdwBuckets is the fill position of each bucket until the buckets are ordered
+    memcpy(pdwBuckets, pdwBucketStarts, (size_t)nBuckets * sizeof(DWORD));
+    for (iSource = 0; iSource < nEntries; ++iSource)
+    {
+        iBucket = _ReduceHash64(pSources[iSource].ullHash, nBuckets);
+        pdwOrder[pdwBuckets[iBucket]++] = iSource;
+    }
+
+    // Order the buckets by decreasing size
+    pdwSizeStarts = (DWORD*)calloc((size_t)nMaxBucketSize + 2, sizeof(DWORD));
+    pdwSlots = (DWORD*)malloc(((size_t)nMaxBucketSize + 1) * sizeof(DWORD));
+    if ((pdwSizeStarts == NULL) || (pdwSlots == NULL))
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto fend;
+    }
+
+    for (iBucket = 0; iBucket < nBuckets; ++iBucket)
+    {
+        ++pdwSizeStarts[nMaxBucketSize - (pdwBucketStarts[iBucket + 1] - pdwBucketStarts[iBucket]) + 1];
+    }
+
+    for (nKeys = 0; nKeys <= nMaxBucketSize; ++nKeys)
+    {
+        pdwSizeStarts[nKeys + 1] += pdwSizeStarts[nKeys];
+    }
+
+    for (iBucket = 0; iBucket < nBuckets; ++iBucket)
+    {
+        pdwBuckets[pdwSizeStarts[nMaxBucketSize - (pdwBucketStarts[iBucket + 1] - pdwBucketStarts[iBucket])]++] = iBucket;
+    }
+
+    nMaxTries = (nEntries > (MAXDWORD / HT_IMAGE_PILOT_TRIES_PER_ENTRY)) ?
+        MAXDWORD : max(nEntries * HT_IMAGE_PILOT_TRIES_PER_ENTRY, 1024);
+
+    ZeroMemory(pdwPilots, (size_t)nBuckets * sizeof(DWORD));
+    for (iRank = 0; iRank < nBuckets; ++iRank)
+    {
+        iBucket = pdwBuckets[iRank];
+        pdwKeys = &pdwOrder[pdwBucketStarts[iBucket]];
+        nKeys = pdwBucketStarts[iBucket + 1] - pdwBucketStarts[iBucket];
+        if (nKeys == 0)
+        {
+            // Only empty buckets are left
+            break;
+        }
+
+        // Keys with the same full hash can never be told apart by a pilot
+        for (iKey = 1; iKey < nKeys; ++iKey)
+        {
+            for (iOther = 0; iOther < iKey; ++iOther)
+            {
+                if (pSources[pdwKeys[iKey]].ullHash == pSources[pdwKeys[iOther]].ullHash)
+                {
+                    hr = E_FAIL;
+                    goto fend;
+                }
+            }
+        }
+
+        for (dwPilot = 0; dwPilot < nMaxTries; ++dwPilot)
+        {
+            for (iKey = 0; iKey < nKeys; ++iKey)
+            {
+                iSlot = _ImageSlot(pSources[pdwKeys[iKey]].ullHash, dwPilot, nEntries);
+                if (pbTaken[iSlot])
+                {
+                    break;
+                }
+
+                for (iOther = 0; (iOther < iKey) && (pdwSlots[iOther] != iSlot); ++iOther);
+                if (iOther < iKey)
+                {
+                    break;
+                }
+                pdwSlots[iKey] = iSlot;
+            }
+
+            if (iKey == nKeys)
+            {
+                break;
+            }
+        }
+
+        if (dwPilot == nMaxTries)
+        {
+            hr = E_FAIL;
+            goto fend;
+        }
+
+        pdwPilots[iBucket] = dwPilot;
+        for (iKey = 0; iKey < nKeys; ++iKey)
+        {
+            pbTaken[pdwSlots[iKey]] = TRUE;
+            pdwSourceOfSlot[pdwSlots[iKey]] = pdwKeys[iKey];
+        }
+    }
+
+fend:
+    free(pdwBucketStarts);
+    free(pdwOrder);
+    free(pdwBuckets);
+    free(pdwSizeStarts);
+    free(pdwSlots);
+    free(pbTaken);
+    return hr;
+}
+
+// Builds the whole image in memory
+HRESULT _BuildImage(
+    _In_ PCHL_HTABLE phtable,
+    _Out_ BYTE **ppbImage,
+    _Out_ ULONGLONG *pcbImage)
+{
+    HT_IMAGE_SOURCE *pSources = NULL;
+    HT_IMAGE_SOURCE *pSource;
+    DWORD *pdwPilots = NULL;
+    DWORD *pdwSourceOfSlot = NULL;
+    DWORD nEntries;
+    DWORD nBuckets;
+    DWORD iEntry;
+    DWORD iSeed;
+    DWORD cbKey;
+    DWORD cbVal;
+    DWORD cbKeyAlign;
+    DWORD cbValAlign;
+    ULONGLONG ullHashSeed = 0;
+    ULONGLONG cbDataMax = 0;
+    ULONGLONG ullDataPos = 0;
+
+    BYTE *pbImage = NULL;
+    BYTE *pbShrunk;
+    HT_IMAGE_HEADER *pHeader;
+    HT_IMAGE_ENTRY *pEntry;
+    BYTE *pbData;
+    ULONGLONG cbImage;
+
+    HRESULT hr = S_OK;
+
+    *ppbImage = NULL;
+    *pcbImage = 0;
+
+    hr = _CollectSources(phtable, &pSources, &nEntries);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    nBuckets = max((nEntries + HT_IMAGE_KEYS_PER_BUCKET - 1) / HT_IMAGE_KEYS_PER_BUCKET, 1);
+    pdwPilots = (DWORD*)calloc(nBuckets, sizeof(DWORD));
+    pdwSourceOfSlot = (DWORD*)calloc(max(nEntries, 1), sizeof(DWORD));
+    if ((pdwPilots == NULL) || (pdwSourceOfSlot == NULL))
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto fend;
+    }
+
+    cbKeyAlign = _ImageKeyAlign(phtable->keyType);
+    cbValAlign = _ImageValAlign(phtable->valType);
+    for (iEntry = 0; iEntry < nEntries; ++iEntry)
+    {
+        pSource = &pSources[iEntry];
+        cbDataMax += _ImageKeyBytes(phtable->keyType, pSource->pvKey, pSource->iKeySize) + (cbKeyAlign - 1);
+        cbDataMax += _ImageValBytes(phtable->valType, pSource->pvVal, pSource->iValSize) + (cbValAlign - 1);
+    }
+
+    for (iSeed = 0, hr = E_FAIL; (iSeed < HT_IMAGE_MAX_SEEDS) && (hr == E_FAIL); ++iSeed)
+    {
+        ullHashSeed = _GenerateHashSeed();
+        for (iEntry = 0; iEntry < nEntries; ++iEntry)
+        {
+            pSource = &pSources[iEntry];
+            pSource->ullHash = _ImageKeyHash(phtable->keyType, pSource->pvKey, pSource->iKeySize, ullHashSeed);
+        }
+
+        hr = _FindPilots(pSources, nEntries, nBuckets, pdwPilots, pdwSourceOfSlot);
+    }
+
+    if (FAILED(hr))
+    {
+        logerr("%s(): Unable to find a perfect hash for %u keys", __FUNCTION__, nEntries);
+        goto fend;
+    }
+
+    cbImage = sizeof(HT_IMAGE_HEADER) + HT_IMAGE_ALIGN_UP((ULONGLONG)nBuckets * sizeof(DWORD), HT_IMAGE_ALIGN);
+    cbImage += (ULONGLONG)nEntries * sizeof(HT_IMAGE_ENTRY);
+    cbImage += cbDataMax;
+
+    if ((cbImage > (SIZE_T)-1) || ((pbImage = (BYTE*)calloc(1, (size_t)cbImage)) == NULL))
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto fend;
+    }
+
+    pHeader = (HT_IMAGE_HEADER*)pbImage;
+    pHeader->dwMagic = HT_IMAGE_MAGIC;
+    pHeader->dwVersion = HT_IMAGE_VERSION;
+    pHeader->dwKeyType = (DWORD)phtable->keyType;
+    pHeader->dwValType = (DWORD)phtable->valType;
+    pHeader->nEntries = nEntries;
+    pHeader->nBuckets = nBuckets;
+    pHeader->ullHashSeed = ullHashSeed;
+    pHeader->ullPilotsOffset = sizeof(HT_IMAGE_HEADER);
+    pHeader->ullEntriesOffset = pHeader->ullPilotsOffset + HT_IMAGE_ALIGN_UP((ULONGLONG)nBuckets * sizeof(DWORD), HT_IMAGE_ALIGN);
+    pHeader->ullDataOffset = pHeader->ullEntriesOffset + (ULONGLONG)nEntries * sizeof(HT_IMAGE_ENTRY);
+
+    memcpy(pbImage + pHeader->ullPilotsOffset, pdwPilots, (size_t)nBuckets * sizeof(DWORD));
+    pbData = pbImage + pHeader->ullDataOffset;
+
+    // Data is laid out in entry order, so the key and value of an entry are adjacent
+    for (iEntry = 0; iEntry < nEntries; ++iEntry)
+    {
+        pSource = &pSources[pdwSourceOfSlot[iEntry]];
+        pEntry = (HT_IMAGE_ENTRY*)(pbImage + pHeader->ullEntriesOffset) + iEntry;
+
+        cbKey = _ImageKeyBytes(phtable->keyType, pSource->pvKey, pSource->iKeySize);
+        if (cbKey > 0)
+        {
+            // The terminator is already there, the image was zeroed
+            ullDataPos = HT_IMAGE_ALIGN_UP(ullDataPos, cbKeyAlign);
+            pEntry->ullKey = ullDataPos;
+            pEntry->cbKey = cbKey;
+            memcpy(pbData + ullDataPos, pSource->pvKey, cbKey - cbKeyAlign);
+            ullDataPos += cbKey;
+        }
+        else
+        {
+            pEntry->ullKey = (ULONGLONG)(UINT_PTR)pSource->pvKey;
+            pEntry->cbKey = (DWORD)pSource->iKeySize;
+        }
+
+        cbVal = _ImageValBytes(phtable->valType, pSource->pvVal, pSource->iValSize);
+        if (cbVal > 0)
+        {
+            ullDataPos = HT_IMAGE_ALIGN_UP(ullDataPos, cbValAlign);
+            pEntry->ullVal = ullDataPos;
+            pEntry->cbVal = cbVal;
+            memcpy(pbData + ullDataPos, pSource->pvVal,
+                (phtable->valType == CHL_VT_USEROBJECT) ? cbVal : (cbVal - cbValAlign));
+            ullDataPos += cbVal;
+        }
+        else
+        {
+            pEntry->ullVal = (ULONGLONG)(UINT_PTR)pSource->pvVal;
+            pEntry->cbVal = (DWORD)pSource->iValSize;
+        }
+    }
+
+    ASSERT(ullDataPos <= cbDataMax);
+
+    // Give back the space that alignment did not need
+    cbImage = pHeader->ullDataOffset + ullDataPos;
+    pHeader->cbImage = cbImage;
+    if ((pbShrunk = (BYTE*)realloc(pbImage, (size_t)max(cbImage, sizeof(HT_IMAGE_HEADER)))) != NULL)
+    {
+        pbImage = pbShrunk;
+    }
+
+    *ppbImage = pbImage;
+    *pcbImage = cbImage;
+    pbImage = NULL;
+
+fend:
+    free(pSources);
+    free(pdwPilots);
+    free(pdwSourceOfSlot);
+    free(pbImage);
+    return hr;
+}
+
+HRESULT _CreateImageObject(
+    _In_ const BYTE *pbImage,
+    _In_ BOOL fMapped,
+    _Out_ PCHL_HT_IMAGE *ppImage)
+{
+    const HT_IMAGE_HEADER *pHeader = (const HT_IMAGE_HEADER*)pbImage;
+    PCHL_HT_IMAGE pImage;
+
+    if ((pImage = (PCHL_HT_IMAGE)calloc(1, sizeof(CHL_HT_IMAGE))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        return E_OUTOFMEMORY;
+    }
+
+    pImage->keyType = (CHL_KEYTYPE)pHeader->dwKeyType;
+    pImage->valType = (CHL_VALTYPE)pHeader->dwValType;
+    pImage->nEntries = (int)pHeader->nEntries;
+    pImage->pbImage = pbImage;
+    pImage->cbImage = pHeader->cbImage;
+    pImage->fMapped = fMapped;
+    pImage->pdwPilots = (const DWORD*)(pbImage + pHeader->ullPilotsOffset);
+    pImage->pEntries = (const HT_IMAGE_ENTRY*)(pbImage + pHeader->ullEntriesOffset);
+    pImage->pbData = pbImage + pHeader->ullDataOffset;
+    pImage->cbData = pHeader->cbImage - pHeader->ullDataOffset;
+    pImage->nBuckets = pHeader->nBuckets;
+    pImage->ullHashSeed = pHeader->ullHashSeed;
+
+    pImage->Close = CHL_DsCloseImageHT;
+    pImage->Find = CHL_DsFindImageHT;
+    pImage->InitIterator = CHL_DsInitIteratorImageHT;
+
+    *ppImage = pImage;
+    return S_OK;
+}
+
+HRESULT _WriteImageFile(_In_z_ PCWSTR pszFilepath, _In_ const BYTE *pbImage, _In_ ULONGLONG cbImage)
+{
+    HANDLE hFile;
+    DWORD cbToWrite;
+    DWORD cbWritten;
+    ULONGLONG ullPos = 0;
+
+    HRESULT hr = S_OK;
+
+    hFile = CreateFileW(pszFilepath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        logerr("%s(): CreateFileW() failed %u", __FUNCTION__, GetLastError());
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto fend;
+    }
+
+    while (ullPos < cbImage)
+    {
+        cbToWrite = (DWORD)min(cbImage - ullPos, HT_IMAGE_MAX_WRITE);
+        if (!WriteFile(hFile, pbImage + ullPos, cbToWrite, &cbWritten, NULL))
+        {
+            logerr("%s(): WriteFile() failed %u", __FUNCTION__, GetLastError());
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            break;
+        }
+        ullPos += cbWritten;
+    }
+
+    CloseHandle(hFile);
+
+    if (FAILED(hr))
+    {
+        // Do not leave a partial image behind
+        DeleteFileW(pszFilepath);
+    }
+
+fend:
+    return hr;
+}
+
+// Only the header and the offsets of the sections are checked, so that opening takes
+// the same time for any size of image. Entries are checked when they are used.
+HRESULT _ValidateImageHeader(_In_ const BYTE *pbImage, _In_ ULONGLONG cbImage)
+{
+    const HT_IMAGE_HEADER *pHeader = (const HT_IMAGE_HEADER*)pbImage;
+
+    if ((cbImage < sizeof(HT_IMAGE_HEADER)) ||
+        (pHeader->dwMagic != HT_IMAGE_MAGIC) ||
+        (pHeader->dwVersion != HT_IMAGE_VERSION) ||
+        !_IsSupportedKeyType((CHL_KEYTYPE)pHeader->dwKeyType, TRUE) ||
+        !_IsSupportedValType((CHL_VALTYPE)pHeader->dwValType, TRUE) ||
+        (pHeader->cbImage != cbImage) ||
+        (pHeader->nBuckets == 0) ||
+        (pHeader->nEntries > INT_MAX))
+    {
+        goto bad_format;
+    }
+
+    if ((pHeader->ullPilotsOffset < sizeof(HT_IMAGE_HEADER)) ||
+        (pHeader->ullEntriesOffset < pHeader->ullPilotsOffset) ||
+        (pHeader->ullDataOffset < pHeader->ullEntriesOffset) ||
+        (pHeader->ullDataOffset > cbImage) ||
+        ((pHeader->ullPilotsOffset % sizeof(DWORD)) != 0) ||
+        ((pHeader->ullEntriesOffset % HT_IMAGE_ALIGN) != 0) ||
+        ((pHeader->ullDataOffset % HT_IMAGE_ALIGN) != 0) ||
+        (((pHeader->ullEntriesOffset - pHeader->ullPilotsOffset) / sizeof(DWORD)) < pHeader->nBuckets) ||
+        (((pHeader->ullDataOffset - pHeader->ullEntriesOffset) / sizeof(HT_IMAGE_ENTRY)) < pHeader->nEntries))
+    {
+        goto bad_format;
+    }
+    return S_OK;
+
+bad_format:
+    logerr("%s(): Not a valid hashtable image", __FUNCTION__);
+    return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+}
+
+HRESULT CHL_DsOpenImageHT(_Out_ PCHL_HT_IMAGE *ppImage, _In_z_ PCWSTR pszFilepath)
+{
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+    LARGE_INTEGER liFileSize;
+    const BYTE *pbImage = NULL;
+
+    HRESULT hr = S_OK;
+
+    if ((ppImage == NULL) || (pszFilepath == NULL))
+    {
+        hr = E_INVALIDARG;
+        goto error_return;
+    }
+
+    *ppImage = NULL;
+
+    hFile = CreateFileW(pszFilepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        logerr("%s(): CreateFileW() failed %u", __FUNCTION__, GetLastError());
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto error_return;
+    }
+
+    if (!GetFileSizeEx(hFile, &liFileSize))
+    {
+        logerr("%s(): GetFileSizeEx() failed %u", __FUNCTION__, GetLastError());
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto error_return;
+    }
+
+    // An empty file cannot be mapped
+    if ((ULONGLONG)liFileSize.QuadPart < sizeof(HT_IMAGE_HEADER))
+    {
+        logerr("%s(): Not a valid hashtable image", __FUNCTION__);
+        hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+        goto error_return;
+    }
+
+    // Unnamed mapping, unlike CHL_GnCreateMemMapOfFile, so that any number of images can be open
+    hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping == NULL)
+    {
+        logerr("%s(): CreateFileMappingW() failed %u", __FUNCTION__, GetLastError());
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto error_return;
+    }
+
+    pbImage = (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (pbImage == NULL)
+    {
+        logerr("%s(): MapViewOfFile() failed %u", __FUNCTION__, GetLastError());
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        goto error_return;
+    }
+
+    // The view keeps the mapping and the file open
+    CloseHandle(hMapping);
+    hMapping = NULL;
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+
+    hr = _ValidateImageHeader(pbImage, (ULONGLONG)liFileSize.QuadPart);
+    if (FAILED(hr))
+    {
+        goto error_return;
+    }
+
+    hr = _CreateImageObject(pbImage, TRUE, ppImage);
+    if (FAILED(hr))
+    {
+        goto error_return;
+    }
+    return hr;
+
+error_return:
+    if (pbImage != NULL)
+    {
+        UnmapViewOfFile(pbImage);
+    }
+    if (hMapping != NULL)
+    {
+        CloseHandle(hMapping);
+    }
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+    return hr;
+}
+
+HRESULT CHL_DsCloseImageHT(_In_ PCHL_HT_IMAGE pImage)
+{
+    ASSERT(pImage);
+
+    if (pImage->fMapped)
+    {
+        if (!UnmapViewOfFile(pImage->pbImage))
+        {
+            logerr("%s(): UnmapViewOfFile() failed %u", __FUNCTION__, GetLastError());
+        }
+    }
+    else
+    {
+        free((PVOID)pImage->pbImage);
+    }
+
+    DBG_MEMSET(pImage, sizeof(CHL_HT_IMAGE));
+    free(pImage);
+    return S_OK;
+}
+
+// Whether [ullOffset, ullOffset + cbData) lies within the data section. Strings must
+// be aligned to their character size and end with a terminator.
+BOOL _IsValidImageData(
+    _In_ PCHL_HT_IMAGE pImage,
+    _In_ ULONGLONG ullOffset,
+    _In_ DWORD cbData,
+    _In_ BOOL fString,
+    _In_ DWORD cbChar)
+{
+    const BYTE *pbLastChar;
+
+    if ((cbData < cbChar) || (cbData > INT_MAX) || (ullOffset > pImage->cbData) || (cbData > pImage->cbData - ullOffset))
+    {
+        return FALSE;
+    }
+
+    if (fString)
+    {
+        if (((ullOffset % cbChar) != 0) || ((cbData % cbChar) != 0))
+        {
+            return FALSE;
+        }
+
+        pbLastChar = pImage->pbData + ullOffset + cbData - cbChar;
+        return (cbChar == sizeof(WCHAR)) ? (*(const WCHAR*)pbLastChar == L'\0') : (*pbLastChar == '\0');
+    }
+    return TRUE;
+}
+
+HRESULT _GetImageKey(_In_ PCHL_HT_IMAGE pImage, _In_ const HT_IMAGE_ENTRY *pEntry, _Out_ PCHL_KEY pChlKey)
+{
+    switch (pImage->keyType)
+    {
+    case CHL_KT_INT32:
+    case CHL_KT_UINT32:
+        {
+            pChlKey->keyDef.uiKey = (UINT)pEntry->ullKey;
+            break;
+        }
+
+    case CHL_KT_POINTER:
+        {
+            pChlKey->keyDef.pvKey = (PVOID)(UINT_PTR)pEntry->ullKey;
+            break;
+        }
+
+    case CHL_KT_STRING:
+    case CHL_KT_WSTRING:
+        {
+            if (!_IsValidImageData(pImage, pEntry->ullKey, pEntry->cbKey, TRUE, _ImageKeyAlign(pImage->keyType)))
+            {
+                goto corrupt;
+            }
+            pChlKey->keyDef.pvKey = (PVOID)(pImage->pbData + pEntry->ullKey);
+            break;
+        }
+
+    default:
+        {
+            goto corrupt;
+        }
+    }
+
+    pChlKey->iKeySize = (int)pEntry->cbKey;
+    return S_OK;
+
+corrupt:
+    logerr("%s(): Corrupt key in hashtable image", __FUNCTION__);
+    return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+}
+
+HRESULT _GetImageVal(_In_ PCHL_HT_IMAGE pImage, _In_ const HT_IMAGE_ENTRY *pEntry, _Out_ PCHL_VAL pChlVal)
+{
+    switch (pImage->valType)
+    {
+    case CHL_VT_INT32:
+    case CHL_VT_UINT32:
+        {
+            pChlVal->valDef.uiVal = (UINT)pEntry->ullVal;
+            break;
+        }
+
+    case CHL_VT_POINTER:
+        {
+            pChlVal->valDef.pvPtr = (PVOID)(UINT_PTR)pEntry->ullVal;
+            break;
+        }
+
+    case CHL_VT_USEROBJECT:
+    case CHL_VT_STRING:
+    case CHL_VT_WSTRING:
+        {
+            if (!_IsValidImageData(pImage, pEntry->ullVal, pEntry->cbVal, (pImage->valType != CHL_VT_USEROBJECT),
+                (pImage->valType == CHL_VT_WSTRING) ? sizeof(WCHAR) : sizeof(char)))
+            {
+                goto corrupt;
+            }
+            pChlVal->valDef.pvUserObj = (PVOID)(pImage->pbData + pEntry->ullVal);
+            break;
+        }
+
+    default:
+        {
+            goto corrupt;
+        }
+    }
+
+    pChlVal->iValSize = (int)pEntry->cbVal;
+    pChlVal->magicOccupied = MAGIC_CHLVAL_OCCUPIED;
+    return S_OK;
+
+corrupt:
+    logerr("%s(): Corrupt value in hashtable image", __FUNCTION__);
+    return HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+}
+
+HRESULT CHL_DsFindImageHT(
+    _In_ PCHL_HT_IMAGE pImage,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    ULONGLONG ullHash;
+    DWORD cbKey;
+    const HT_IMAGE_ENTRY *pEntry;
+    CHL_KEY chlKey;
+    CHL_VAL chlVal;
+    BOOL fMatch;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pImage);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pImage->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto not_found;
+    }
+
+    if (pImage->nEntries == 0)
+    {
+        hr = E_NOT_SET;
+        goto not_found;
+    }
+
+    // The only entry the key can be in
+    ullHash = _ImageKeyHash(pImage->keyType, pvkey, iKeySize, pImage->ullHashSeed);
+    pEntry = &pImage->pEntries[_ImageSlot(ullHash,
+        pImage->pdwPilots[_ReduceHash64(ullHash, pImage->nBuckets)], (DWORD)pImage->nEntries)];
+
+    hr = _GetImageKey(pImage, pEntry, &chlKey);
+    if (FAILED(hr))
+    {
+        goto not_found;
+    }
+
+    if ((pImage->keyType == CHL_KT_STRING) || (pImage->keyType == CHL_KT_WSTRING))
+    {
+        // Without a hash to compare first, the length keeps a key from matching a longer one
+        cbKey = _ImageKeyBytes(pImage->keyType, pvkey, iKeySize);
+        fMatch = (pEntry->cbKey == cbKey) &&
+            (memcmp(chlKey.keyDef.pvKey, pvkey, cbKey - _ImageKeyAlign(pImage->keyType)) == 0);
+    }
+    else
+    {
+        fMatch = _IsDuplicateKey(&chlKey, pvkey, pImage->keyType, iKeySize);
+    }
+
+    if (!fMatch)
+    {
+        hr = E_NOT_SET;
+        goto not_found;
+    }
+
+    hr = _GetImageVal(pImage, pEntry, &chlVal);
+    if (FAILED(hr))
+    {
+        goto not_found;
+    }
+
+    if (pvVal)
+    {
+        hr = _CopyValOut(&chlVal, pImage->valType, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr) && (piValSize != NULL))
+    {
+        *piValSize = chlVal.iValSize;
+    }
+
+    return hr;
+
+not_found:
+    if (piValSize)
+    {
+        *piValSize = 0;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsInitIteratorImageHT(_In_ PCHL_HT_IMAGE pImage, _Out_ CHL_HT_IMAGE_ITERATOR *pItr)
+{
+    ASSERT(pImage && pItr);
+
+    pItr->pMyImage = pImage;
+    pItr->MoveNext = CHL_DsMoveNextImageHT;
+    pItr->GetCurrent = CHL_DsGetCurrentImageHT;
+
+    // Every entry holds a key, so the first one is the first element
+    pItr->iCurEntry = (pImage->nEntries > 0) ? 0 : -1;
+    return (pItr->iCurEntry >= 0) ? S_OK : E_NOT_SET;
+}
+
+HRESULT CHL_DsMoveNextImageHT(_Inout_ CHL_HT_IMAGE_ITERATOR *pItr)
+{
+    ASSERT(pItr && pItr->pMyImage);
+
+    if (pItr->iCurEntry < 0)
+    {
+        return E_NOT_SET;
+    }
+
+    if (++(pItr->iCurEntry) >= pItr->pMyImage->nEntries)
+    {
+        pItr->iCurEntry = -1;
+        return E_NOT_SET;
+    }
+    return S_OK;
+}
+
+HRESULT CHL_DsGetCurrentImageHT(
+    _In_ CHL_HT_IMAGE_ITERATOR *pItr,
+    _Inout_opt_ PCVOID pvKey,
+    _Inout_opt_ PINT piKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    PCHL_HT_IMAGE pImage;
+    const HT_IMAGE_ENTRY *pEntry;
+    CHL_KEY chlKey;
+    CHL_VAL chlVal;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pItr && pItr->pMyImage);
+
+    pImage = pItr->pMyImage;
+    if (pItr->iCurEntry < 0)
+    {
+        return E_NOT_SET;
+    }
+
+    pEntry = &pImage->pEntries[pItr->iCurEntry];
+    hr = _GetImageKey(pImage, pEntry, &chlKey);
+    if (SUCCEEDED(hr))
+    {
+        hr = _GetImageVal(pImage, pEntry, &chlVal);
+    }
+
+    if (SUCCEEDED(hr) && pvKey)
+    {
+        hr = _CopyKeyOut(&chlKey, pImage->keyType, (PVOID)pvKey, piKeySize, fGetPointerOnly);
+    }
+    if (SUCCEEDED(hr) && pvVal)
+    {
+        hr = _CopyValOut(&chlVal, pImage->valType, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (piKeySize != NULL)
+        {
+            *piKeySize = chlKey.iKeySize;
+        }
+
+        if (piValSize != NULL)
+        {
+            *piValSize = chlVal.iValSize;
+        }
+    }
+    return hr;
+}
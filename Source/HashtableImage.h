@@ -0,0 +1,184 @@
+
+// HashtableImage.h
+// Read-only hashtable images: frozen in memory, or saved to a file once and used by mapping the file
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//      10/17/26 Minimal perfect hash layout, images can be frozen in memory and iterated
+//
+
+#ifndef _HASHTABLEIMAGE_H
+#define _HASHTABLEIMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Defines.h"
+#include "Hashtable.h"
+
+// Foward declare the structures of the image, they are private to HashtableImage.c
+struct _htImageHeader;
+struct _htImageEntry;
+
+// Foward declare the iterator struct
+struct _hashtableImageIterator;
+
+// A read-only hashtable image.
+// Keys are placed with a minimal perfect hash: every key has its own entry, computed from
+// the key's hash and a per-bucket displacement, so a lookup reads exactly one entry.
+// There are no collision chains and no empty entries.
+// The image is a single block of memory with no pointers, only offsets from its start. A
+// frozen image lives in the heap, an opened one is a read-only view of the file that holds it.
+// The same file can be mapped at any address and by 32bit as well as 64bit processes.
+// Processes that open the same file share its pages in the file cache.
+typedef struct _hashtableImage CHL_HT_IMAGE, *PCHL_HT_IMAGE;
+typedef struct _hashtableImageIterator CHL_HT_IMAGE_ITERATOR;
+struct _hashtableImage {
+    CHL_KEYTYPE keyType;    // Type information for the hashtable key
+    CHL_VALTYPE valType;    // Type information for the hashtable value
+    int nEntries;           // Number of key-value pairs in the image
+
+    const BYTE *pbImage;                        // Start of the image
+    ULONGLONG cbImage;                          // Size of the image in bytes
+    BOOL fMapped;                               // Whether the image is a mapped view of a file
+    const DWORD *pdwPilots;                     // Displacement of each bucket, nBuckets of them
+    const struct _htImageEntry *pEntries;       // Entries, nEntries of them
+    const BYTE *pbData;                         // Contents of string and user object keys and values
+    ULONGLONG cbData;                           // Size of the data section in bytes
+    DWORD nBuckets;                             // Number of buckets
+    ULONGLONG ullHashSeed;                      // Seed for the key hash, chosen when the image was built
+
+    // Access methods
+    HRESULT (*Close)(PCHL_HT_IMAGE pImage);
+
+    HRESULT (*Find)(
+        PCHL_HT_IMAGE pImage,
+        PCVOID pvkey,
+        int iKeySize,
+        PVOID pvVal,
+        PINT pvalsize,
+        BOOL fGetPointerOnly);
+
+    HRESULT (*InitIterator)(PCHL_HT_IMAGE pImage, CHL_HT_IMAGE_ITERATOR *pItr);
+};
+
+// Structure that defines the iterator for a hashtable image
+// Callers can use this to iterate through the image
+// and get all (key,value) pairs one-by-one
+struct _hashtableImageIterator {
+    int iCurEntry;              // Current entry, -1 if not positioned on an element
+    PCHL_HT_IMAGE pMyImage;     // Pointer to the image to work on
+
+    HRESULT (*MoveNext)(
+        struct _hashtableImageIterator *pItr);
+
+    HRESULT (*GetCurrent)(
+        CHL_HT_IMAGE_ITERATOR *pItr,
+        PCVOID pvKey,
+        PINT piKeySize,
+        PVOID pvVal,
+        PINT piValSize,
+        BOOL fGetPointerOnly);
+};
+
+// -------------------------------------------
+// Functions exported
+
+// Freezes the contents of a hashtable into an image in memory. The image does not depend
+// on the table afterwards, the table may be modified or destroyed.
+// Values of type CHL_VT_POINTER are copied as pointers, the memory they point to still
+// belongs to the caller (or to the table, if it was created with fValInHeapMem).
+// An image holds one value per key, so HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) is returned
+// for tables created with CHL_HT_FLAG_MULTIMAP.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      ppImage: Address of pointer where to copy the pointer to the image object.
+//
+DllExpImp HRESULT CHL_DsFreezeHT(_In_ PCHL_HTABLE phtable, _Out_ PCHL_HT_IMAGE *ppImage);
+
+// Writes an image to a file that can later be opened with CHL_DsOpenImageHT.
+// An existing file is overwritten.
+// Keys and values of type CHL_KT_POINTER/CHL_VT_POINTER cannot be written, since the
+// memory they point to does not exist in other processes. HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED)
+// is returned for such images.
+// Params:
+//      pImage: Pointer to the image object returned by CHL_DsFreezeHT or CHL_DsOpenImageHT.
+//      pszFilepath: Path of the file to write the image to.
+//
+DllExpImp HRESULT CHL_DsWriteImageHT(_In_ PCHL_HT_IMAGE pImage, _In_z_ PCWSTR pszFilepath);
+
+// Saves all key-value pairs of a hashtable into a file, same as freezing the table and
+// writing the image. The table must not be modified while it is being saved.
+// Not supported for tables created with CHL_HT_FLAG_MULTIMAP, see CHL_DsFreezeHT.
+// Params:
+//      phtable: Pointer to the hashtable object returned by CHL_DsCreateHT function.
+//      pszFilepath: Path of the file to write the image to.
+//
+DllExpImp HRESULT CHL_DsSaveImageHT(_In_ PCHL_HTABLE phtable, _In_z_ PCWSTR pszFilepath);
+
+// Opens a file written by CHL_DsSaveImageHT or CHL_DsWriteImageHT by mapping it read-only into
+// the process. Nothing is read or allocated per entry, so this takes the same time for any size of image.
+// Returns HRESULT_FROM_WIN32(ERROR_BAD_FORMAT) if the file is not a valid image.
+// Params:
+//      ppImage: Address of pointer where to copy the pointer to the image object.
+//      pszFilepath: Path of the image file.
+//
+DllExpImp HRESULT CHL_DsOpenImageHT(_Out_ PCHL_HT_IMAGE *ppImage, _In_z_ PCWSTR pszFilepath);
+
+// Frees or unmaps the image and destroys the image object. Pointers obtained from
+// CHL_DsFindImageHT or the iterator with fGetPointerOnly are not valid after this.
+// Params:
+//      pImage: Pointer to the image object returned by CHL_DsFreezeHT or CHL_DsOpenImageHT.
+//
+DllExpImp HRESULT CHL_DsCloseImageHT(_In_ PCHL_HT_IMAGE pImage);
+
+// Find the specified key in the image. The lookup hashes the key once and compares it
+// against exactly one entry.
+// With fGetPointerOnly, the pointer returned for string and user object values points
+// into the image, it is read-only and valid until the image is closed.
+// Returns HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT) if the entry that the lookup
+// visits is found to be damaged.
+// Params: Refer documentation of the CHL_DsFindHT() function.
+//
+DllExpImp HRESULT CHL_DsFindImageHT(
+    _In_ PCHL_HT_IMAGE pImage,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pvalsize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+// Initialize the iterator object for use with the specified image.
+// Iterator will point to the first element or nothing if the image is empty.
+// Elements are visited in the order of their entries, which is unrelated to the
+// order in which they were inserted into the hashtable.
+// Params:
+//      pImage: Pointer to the image object.
+//      pItr: Pointer to the iterator object to initialize.
+//
+DllExpImp HRESULT CHL_DsInitIteratorImageHT(_In_ PCHL_HT_IMAGE pImage, _Out_ CHL_HT_IMAGE_ITERATOR *pItr);
+
+// Moves iterator to the next element in the image using the specified iterator object.
+// If there are no more items remaining, then it returns E_NOT_SET.
+// Params:
+//      pItr: The iterator object that was initialized by CHL_DsInitIteratorImageHT.
+//
+DllExpImp HRESULT CHL_DsMoveNextImageHT(_Inout_ CHL_HT_IMAGE_ITERATOR *pItr);
+
+// Get the current element in the image using the specified iterator object.
+// Params: Refer documentation of the CHL_DsGetCurrentHT() function.
+//
+DllExpImp HRESULT CHL_DsGetCurrentImageHT(
+    _In_ CHL_HT_IMAGE_ITERATOR *pItr,
+    _Inout_opt_ PCVOID pvKey,
+    _Inout_opt_ PINT piKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _HASHTABLEIMAGE_H
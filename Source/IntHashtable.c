@@ -0,0 +1,464 @@
+
+// IntHashtable.c
+// Open-addressing hashtable specialized for integer and pointer keys and values
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#include "InternalDefines.h"
+#include "HashFunctions.h"
+#include "IntHashtable.h"
+
+// Linear probing gets slow quickly above 3/4th occupancy
+#define IHT_MAX_LOAD_NUMERATOR      3
+#define IHT_MAX_LOAD_DENOMINATOR    4
+
+#define IHT_MIN_CAPACITY    16
+#define IHT_MAX_CAPACITY    (1U << 30)
+
+#define IHT_EMPTY_KEY       ((UINT_PTR)0)
+
+// File-local Functions
+static __inline UINT _HomeSlot(_In_ PCHL_IHTABLE piht, _In_ UINT_PTR uKey);
+static __inline UINT _ProbeSlot(_In_ PCHL_IHTABLE piht, _In_ UINT_PTR uKey);
+static __inline UINT _MaxEntriesForCapacity(_In_ UINT nCapacity);
+static UINT _ShiftForCapacity(_In_ UINT nCapacity);
+static void _ReplaceVal(_In_ PCHL_IHTABLE piht, _Inout_ UINT_PTR *puStoredVal, _In_ UINT_PTR uNewVal);
+static void _FreeVal(_In_ PCHL_IHTABLE piht, _Inout_ UINT_PTR *puStoredVal);
+static HRESULT _Rehash(_In_ PCHL_IHTABLE piht, _In_ UINT nNewCapacity);
+static int _NextFullSlot(_In_ PCHL_IHTABLE piht, _In_ int iStartSlot);
+
+// The top bits of the hash pick the home slot, they are the best mixed ones
+UINT _HomeSlot(_In_ PCHL_IHTABLE piht, _In_ UINT_PTR uKey)
+{
+    return (UINT)(_FinalizeHash64((ULONGLONG)uKey, piht->ullHashSeed) >> piht->uShift);
+}
+
+// Returns the slot that holds uKey, or the empty slot that ends its probe sequence.
+// The table is never full, so the loop always ends.
+UINT _ProbeSlot(_In_ PCHL_IHTABLE piht, _In_ UINT_PTR uKey)
+{
+    UINT uMask = piht->nCapacity - 1;
+    UINT iSlot = _HomeSlot(piht, uKey);
+
+    ASSERT(uKey != IHT_EMPTY_KEY);
+
+    while ((piht->pSlots[iSlot].uKey != uKey) && (piht->pSlots[iSlot].uKey != IHT_EMPTY_KEY))
+    {
+        iSlot = (iSlot + 1) & uMask;
+    }
+    return iSlot;
+}
+
+UINT _MaxEntriesForCapacity(_In_ UINT nCapacity)
+{
+    return (nCapacity / IHT_MAX_LOAD_DENOMINATOR) * IHT_MAX_LOAD_NUMERATOR;
+}
+
+UINT _ShiftForCapacity(_In_ UINT nCapacity)
+{
+    UINT uShift = 64;
+
+    ASSERT((nCapacity & (nCapacity - 1)) == 0);
+
+    while (nCapacity > 1)
+    {
+        nCapacity >>= 1;
+        --uShift;
+    }
+    return uShift;
+}
+
+void _FreeVal(_In_ PCHL_IHTABLE piht, _Inout_ UINT_PTR *puStoredVal)
+{
+    if (piht->fValIsInHeap)
+    {
+        CHL_MmFree((PVOID*)puStoredVal);
+    }
+}
+
+void _ReplaceVal(_In_ PCHL_IHTABLE piht, _Inout_ UINT_PTR *puStoredVal, _In_ UINT_PTR uNewVal)
+{
+    if (*puStoredVal != uNewVal)
+    {
+        // NOTE: Old value will be lost!!
+        _FreeVal(piht, puStoredVal);
+        *puStoredVal = uNewVal;
+    }
+}
+
+HRESULT CHL_DsCreateIHT(
+    _Out_ PCHL_IHTABLE *pIHTableOut,
+    _In_ int nEstEntries,
+    _In_opt_ BOOL fValInHeapMem)
+{
+    UINT nCapacity = IHT_MIN_CAPACITY;
+    PCHL_IHTABLE pnewtable = NULL;
+
+    HRESULT hr = S_OK;
+
+    // validate parameters
+    if ((pIHTableOut == NULL) || (nEstEntries < 0))
+    {
+        hr = E_INVALIDARG;
+        goto error_return;
+    }
+
+    // Smallest power of 2 that holds the estimated entries within the max load
+    while ((_MaxEntriesForCapacity(nCapacity) < (UINT)nEstEntries) && (nCapacity < IHT_MAX_CAPACITY))
+    {
+        nCapacity *= 2;
+    }
+
+    if ((pnewtable = (CHL_IHTABLE*)calloc(1, sizeof(CHL_IHTABLE))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto error_return;
+    }
+
+    // Zeroed slots are empty
+    hr = CHL_MmAlloc((PVOID*)&pnewtable->pSlots, (size_t)nCapacity * sizeof(IHT_SLOT), NULL);
+    if (FAILED(hr))
+    {
+        goto error_return;
+    }
+
+    pnewtable->nCapacity = nCapacity;
+    pnewtable->uShift = _ShiftForCapacity(nCapacity);
+    pnewtable->nMaxEntries = _MaxEntriesForCapacity(nCapacity);
+    pnewtable->fValIsInHeap = fValInHeapMem;
+    pnewtable->ullHashSeed = _GenerateHashSeed();
+
+    pnewtable->Destroy = CHL_DsDestroyIHT;
+    pnewtable->Insert = CHL_DsInsertIHT;
+    pnewtable->Find = CHL_DsFindIHT;
+    pnewtable->Remove = CHL_DsRemoveIHT;
+    pnewtable->InitIterator = CHL_DsInitIteratorIHT;
+
+    *pIHTableOut = pnewtable;
+    return hr;
+
+error_return:
+    if (pnewtable)
+    {
+        free(pnewtable);
+    }
+    if (pIHTableOut)
+    {
+        *pIHTableOut = NULL;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsDestroyIHT(_In_ PCHL_IHTABLE piht)
+{
+    UINT iSlot;
+
+    ASSERT(piht);
+
+    if (piht->fValIsInHeap)
+    {
+        for (iSlot = 0; iSlot < piht->nCapacity; ++iSlot)
+        {
+            if (piht->pSlots[iSlot].uKey != IHT_EMPTY_KEY)
+            {
+                _FreeVal(piht, &piht->pSlots[iSlot].uVal);
+            }
+        }
+
+        if (piht->fHasZeroKey)
+        {
+            _FreeVal(piht, &piht->uZeroKeyVal);
+        }
+    }
+
+    CHL_MmFree((PVOID*)&piht->pSlots);
+
+    DBG_MEMSET(piht, sizeof(CHL_IHTABLE));
+    free(piht);
+
+    return S_OK;
+}
+
+HRESULT CHL_DsInsertIHT(_In_ PCHL_IHTABLE piht, _In_ UINT_PTR uKey, _In_ UINT_PTR uVal)
+{
+    UINT iSlot;
+    IHT_SLOT *pSlot;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(piht);
+
+    // Key 0 marks empty slots, so it cannot be stored in one
+    if (uKey == IHT_EMPTY_KEY)
+    {
+        if (piht->fHasZeroKey)
+        {
+            _ReplaceVal(piht, &piht->uZeroKeyVal, uVal);
+        }
+        else
+        {
+            piht->fHasZeroKey = TRUE;
+            piht->uZeroKeyVal = uVal;
+            ++(piht->nEntries);
+            ++(piht->uLayoutVersion);
+        }
+        goto done;
+    }
+
+    iSlot = _ProbeSlot(piht, uKey);
+    pSlot = &piht->pSlots[iSlot];
+    if (pSlot->uKey == uKey)
+    {
+        _ReplaceVal(piht, &pSlot->uVal, uVal);
+        goto done;
+    }
+
+    if ((piht->nEntries - (piht->fHasZeroKey ? 1 : 0)) >= piht->nMaxEntries)
+    {
+        if (piht->nCapacity >= IHT_MAX_CAPACITY)
+        {
+            logerr("%s(): Table cannot grow beyond %u slots", __FUNCTION__, piht->nCapacity);
+            hr = E_OUTOFMEMORY;
+            goto done;
+        }
+
+        hr = _Rehash(piht, piht->nCapacity * 2);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+        pSlot = &piht->pSlots[_ProbeSlot(piht, uKey)];
+    }
+
+    pSlot->uKey = uKey;
+    pSlot->uVal = uVal;
+    ++(piht->nEntries);
+    ++(piht->uLayoutVersion);
+
+done:
+    return hr;
+}
+
+HRESULT CHL_DsFindIHT(_In_ PCHL_IHTABLE piht, _In_ UINT_PTR uKey, _Out_opt_ PUINT_PTR puVal)
+{
+    IHT_SLOT *pSlot;
+
+    ASSERT(piht);
+
+    if (uKey == IHT_EMPTY_KEY)
+    {
+        if (!piht->fHasZeroKey)
+        {
+            return E_NOT_SET;
+        }
+        if (puVal)
+        {
+            *puVal = piht->uZeroKeyVal;
+        }
+        return S_OK;
+    }
+
+    pSlot = &piht->pSlots[_ProbeSlot(piht, uKey)];
+    if (pSlot->uKey == IHT_EMPTY_KEY)
+    {
+        return E_NOT_SET;
+    }
+
+    if (puVal)
+    {
+        *puVal = pSlot->uVal;
+    }
+    return S_OK;
+}
+
+// Removal shifts later entries of the probe sequence back into the hole, so that
+// lookups never need to skip over deleted slots.
+HRESULT CHL_DsRemoveIHT(_In_ PCHL_IHTABLE piht, _In_ UINT_PTR uKey)
+{
+    UINT uMask;
+    UINT iHole;
+    UINT iNext;
+    UINT iHome;
+
+    ASSERT(piht);
+
+    if (uKey == IHT_EMPTY_KEY)
+    {
+        if (!piht->fHasZeroKey)
+        {
+            return E_NOT_SET;
+        }
+        _FreeVal(piht, &piht->uZeroKeyVal);
+        piht->uZeroKeyVal = 0;
+        piht->fHasZeroKey = FALSE;
+        goto removed;
+    }
+
+    iHole = _ProbeSlot(piht, uKey);
+    if (piht->pSlots[iHole].uKey == IHT_EMPTY_KEY)
+    {
+        return E_NOT_SET;
+    }
+
+    _FreeVal(piht, &piht->pSlots[iHole].uVal);
+
+    uMask = piht->nCapacity - 1;
+    for (iNext = (iHole + 1) & uMask; piht->pSlots[iNext].uKey != IHT_EMPTY_KEY; iNext = (iNext + 1) & uMask)
+    {
+        // An entry can move back into the hole only if its home slot is not
+        // between the hole and its current slot, else it could not be found.
+        iHome = _HomeSlot(piht, piht->pSlots[iNext].uKey);
+        if (((iNext - iHome) & uMask) >= ((iNext - iHole) & uMask))
+        {
+            piht->pSlots[iHole] = piht->pSlots[iNext];
+            iHole = iNext;
+        }
+    }
+
+    piht->pSlots[iHole].uKey = IHT_EMPTY_KEY;
+    piht->pSlots[iHole].uVal = 0;
+
+removed:
+    --(piht->nEntries);
+    ++(piht->uLayoutVersion);
+    return S_OK;
+}
+
+HRESULT CHL_DsInitIteratorIHT(_In_ PCHL_IHTABLE piht, _Out_ CHL_IHT_ITERATOR *pItr)
+{
+    ASSERT(piht && pItr);
+
+    pItr->pMyHashTable = piht;
+    pItr->uLayoutVersion = piht->uLayoutVersion;
+    pItr->MoveNext = CHL_DsMoveNextIHT;
+    pItr->GetCurrent = CHL_DsGetCurrentIHT;
+
+    // Move to first element or the end if none exist
+    pItr->iCurSlot = _NextFullSlot(piht, 0);
+    return (pItr->iCurSlot >= 0) ? S_OK : E_NOT_SET;
+}
+
+HRESULT CHL_DsMoveNextIHT(_Inout_ CHL_IHT_ITERATOR *pItr)
+{
+    ASSERT(pItr && pItr->pMyHashTable);
+
+    if (pItr->uLayoutVersion != pItr->pMyHashTable->uLayoutVersion)
+    {
+        return E_CHANGED_STATE;
+    }
+
+    if (pItr->iCurSlot < 0)
+    {
+        return E_NOT_SET;
+    }
+
+    pItr->iCurSlot = _NextFullSlot(pItr->pMyHashTable, pItr->iCurSlot + 1);
+    return (pItr->iCurSlot >= 0) ? S_OK : E_NOT_SET;
+}
+
+HRESULT CHL_DsGetCurrentIHT(
+    _In_ CHL_IHT_ITERATOR *pItr,
+    _Out_opt_ PUINT_PTR puKey,
+    _Out_opt_ PUINT_PTR puVal)
+{
+    PCHL_IHTABLE piht;
+
+    ASSERT(pItr && pItr->pMyHashTable);
+
+    piht = pItr->pMyHashTable;
+    if (pItr->uLayoutVersion != piht->uLayoutVersion)
+    {
+        return E_CHANGED_STATE;
+    }
+
+    if (pItr->iCurSlot < 0)
+    {
+        return E_NOT_SET;
+    }
+
+    if ((UINT)pItr->iCurSlot == piht->nCapacity)
+    {
+        ASSERT(piht->fHasZeroKey);
+        if (puKey)
+        {
+            *puKey = IHT_EMPTY_KEY;
+        }
+        if (puVal)
+        {
+            *puVal = piht->uZeroKeyVal;
+        }
+        return S_OK;
+    }
+
+    if (puKey)
+    {
+        *puKey = piht->pSlots[pItr->iCurSlot].uKey;
+    }
+    if (puVal)
+    {
+        *puVal = piht->pSlots[pItr->iCurSlot].uVal;
+    }
+    return S_OK;
+}
+
+// Moves all entries into a freshly allocated slot array of the specified capacity.
+// Values are moved as-is, nothing is freed.
+HRESULT _Rehash(_In_ PCHL_IHTABLE piht, _In_ UINT nNewCapacity)
+{
+    IHT_SLOT *pOldSlots = piht->pSlots;
+    UINT nOldCapacity = piht->nCapacity;
+    UINT iSlot;
+
+    HRESULT hr = S_OK;
+
+    hr = CHL_MmAlloc((PVOID*)&piht->pSlots, (size_t)nNewCapacity * sizeof(IHT_SLOT), NULL);
+    if (FAILED(hr))
+    {
+        logerr("%s(): Unable to allocate %u slots", __FUNCTION__, nNewCapacity);
+        piht->pSlots = pOldSlots;
+        goto fend;
+    }
+
+    piht->nCapacity = nNewCapacity;
+    piht->uShift = _ShiftForCapacity(nNewCapacity);
+    piht->nMaxEntries = _MaxEntriesForCapacity(nNewCapacity);
+
+    for (iSlot = 0; iSlot < nOldCapacity; ++iSlot)
+    {
+        if (pOldSlots[iSlot].uKey != IHT_EMPTY_KEY)
+        {
+            // Keys are unique, so the probe ends at an empty slot
+            piht->pSlots[_ProbeSlot(piht, pOldSlots[iSlot].uKey)] = pOldSlots[iSlot];
+        }
+    }
+
+    CHL_MmFree((PVOID*)&pOldSlots);
+    ++(piht->uLayoutVersion);
+
+fend:
+    return hr;
+}
+
+// Returns index of the first full slot at or after iStartSlot, nCapacity for
+// key 0 which comes after all slots, -1 if there is none
+int _NextFullSlot(_In_ PCHL_IHTABLE piht, _In_ int iStartSlot)
+{
+    UINT iSlot;
+
+    for (iSlot = (UINT)iStartSlot; iSlot < piht->nCapacity; ++iSlot)
+    {
+        if (piht->pSlots[iSlot].uKey != IHT_EMPTY_KEY)
+        {
+            return (int)iSlot;
+        }
+    }
+
+    if ((iSlot == piht->nCapacity) && piht->fHasZeroKey)
+    {
+        return (int)iSlot;
+    }
+    return -1;
+}
@@ -0,0 +1,156 @@
+
+// IntHashtable.h
+// Open-addressing hashtable specialized for integer and pointer keys and values
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#ifndef _INTHASHTABLE_H
+#define _INTHASHTABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Defines.h"
+#include "MemFunctions.h"
+
+// A slot holds the key and the value themselves, there is no type information,
+// size or occupied flag per entry. Key 0 marks an empty slot.
+typedef struct _intHashtableSlot {
+    UINT_PTR uKey;
+    UINT_PTR uVal;
+}IHT_SLOT;
+
+// Foward declare the iterator struct
+struct _intHashtableIterator;
+
+// The integer hashtable itself.
+// Keys are compared as plain integers, so a key may be an int, an unsigned int or a pointer.
+// Integer keys should be passed as (UINT_PTR)(UINT)iKey, so that negative keys do not depend
+// on the pointer width. Collisions are resolved by linear probing over a single slot array and
+// removals shift the following entries back, so no tombstones are ever left behind.
+typedef struct _intHashtable CHL_IHTABLE, *PCHL_IHTABLE;
+typedef struct _intHashtableIterator CHL_IHT_ITERATOR;
+struct _intHashtable {
+    IHT_SLOT *pSlots;       // Key-value slots
+    UINT nCapacity;         // Number of slots, a power of 2
+    UINT uShift;            // 64 - log2(nCapacity), the home slot of a key is the top bits of its hash
+    UINT nEntries;          // Number of key-value pairs currently stored, including key 0
+    UINT nMaxEntries;       // Table grows when an insert would exceed this
+    UINT uLayoutVersion;    // Bumped by any insert of a new key or removal, invalidates iterators
+    BOOL fHasZeroKey;       // Whether key 0 is present, its value is kept outside of the slots
+    UINT_PTR uZeroKeyVal;   // Value of key 0
+    BOOL fValIsInHeap;      // Whether values are heap pointers that the table frees
+    ULONGLONG ullHashSeed;  // Random per-table seed for the key hash
+
+    // Access methods
+    HRESULT (*Destroy)(PCHL_IHTABLE piht);
+    HRESULT (*Insert)(PCHL_IHTABLE piht, UINT_PTR uKey, UINT_PTR uVal);
+    HRESULT (*Find)(PCHL_IHTABLE piht, UINT_PTR uKey, PUINT_PTR puVal);
+    HRESULT (*Remove)(PCHL_IHTABLE piht, UINT_PTR uKey);
+    HRESULT (*InitIterator)(PCHL_IHTABLE piht, CHL_IHT_ITERATOR *pItr);
+};
+
+// Structure that defines the iterator for the integer hashtable
+// Callers can use this to iterate through the hashtable
+// and get all (key,value) pairs one-by-one
+struct _intHashtableIterator {
+    int iCurSlot;               // Current slot, nCapacity for key 0, -1 if not positioned on an element
+    PCHL_IHTABLE pMyHashTable;  // Pointer to the hashtable to work on
+    UINT uLayoutVersion;        // Table layout the iterator was positioned against
+
+    HRESULT (*MoveNext)(
+        struct _intHashtableIterator *pItr);
+
+    HRESULT (*GetCurrent)(
+        CHL_IHT_ITERATOR *pItr,
+        PUINT_PTR puKey,
+        PUINT_PTR puVal);
+};
+
+// -------------------------------------------
+// Functions exported
+
+// Creates an integer hashtable and returns a pointer which can be used for later operations
+// on the table.
+// Params:
+//      pIHTableOut: Address of pointer where to copy the pointer to the hashtable
+//      nEstEntries: Estimated number of entries that would be in the table at any given time.
+//                   This is used to determine the initial size of the hashtable. The table
+//                   grows as needed.
+//      fValInHeapMem: Set this to true if the values are pointers to memory allocated with
+//                     CHL_MmAlloc. This indicates the hash table to free a value when it is
+//                     overwritten or its entry is removed.
+//
+DllExpImp HRESULT CHL_DsCreateIHT(
+    _Out_ CHL_IHTABLE **pIHTableOut,
+    _In_ int nEstEntries,
+    _In_opt_ BOOL fValInHeapMem);
+
+// Destroy the hashtable by removing all key-value pairs from the hashtable.
+// The CHL_IHTABLE object itself is also destroyed.
+// Params:
+//      piht: Pointer to the hashtable object returned by CHL_DsCreateIHT function.
+//
+DllExpImp HRESULT CHL_DsDestroyIHT(_In_ CHL_IHTABLE *piht);
+
+// Inserts a key,value pair into the hash table. If the key already exists, then the value is over-written
+// with the new value. Inserting a new key may rehash the table into a larger one.
+// Params:
+//      piht: Pointer to the hashtable object returned by CHL_DsCreateIHT function.
+//      uKey: The key, an integer or a pointer.
+//      uVal: The value, an integer or a pointer.
+//
+DllExpImp HRESULT CHL_DsInsertIHT(_In_ CHL_IHTABLE *piht, _In_ UINT_PTR uKey, _In_ UINT_PTR uVal);
+
+// Find the specified key in the hash table. Returns E_NOT_SET if the key is not present.
+// Params:
+//      piht: Pointer to the hashtable object returned by CHL_DsCreateIHT function.
+//      uKey: The key to find.
+//      puVal: Optional, receives the value of the key.
+//
+DllExpImp HRESULT CHL_DsFindIHT(_In_ CHL_IHTABLE *piht, _In_ UINT_PTR uKey, _Out_opt_ PUINT_PTR puVal);
+
+// Deletes the specified key from the hash table. Returns E_NOT_SET if the key is not present.
+// Entries that follow the removed one in its probe sequence may be moved.
+// Params:
+//      piht: Pointer to the hashtable object returned by CHL_DsCreateIHT function.
+//      uKey: The key to remove.
+//
+DllExpImp HRESULT CHL_DsRemoveIHT(_In_ CHL_IHTABLE *piht, _In_ UINT_PTR uKey);
+
+// Initialize the iterator object for use with the specified hashtable.
+// Iterator will point to the first element or nothing if hashtable is empty.
+// If a new key is inserted or a key is removed, the iterator methods return
+// E_CHANGED_STATE and the iterator must be initialized again.
+// Params:
+//      piht: Pointer to the hashtable object returned by CHL_DsCreateIHT function.
+//      pItr: Pointer to the iterator object to initialize.
+//
+DllExpImp HRESULT CHL_DsInitIteratorIHT(_In_ PCHL_IHTABLE piht, _Out_ CHL_IHT_ITERATOR *pItr);
+
+// Moves iterator to the next element in the hash table using the specified iterator object.
+// If there are no more items remaining, then it returns E_NOT_SET.
+// Params:
+//      pItr: The iterator object that was initialized by CHL_DsInitIteratorIHT.
+//
+DllExpImp HRESULT CHL_DsMoveNextIHT(_Inout_ CHL_IHT_ITERATOR *pItr);
+
+// Get the current element in the hash table using the specified iterator object.
+// Params:
+//      pItr: The iterator object that was initialized by CHL_DsInitIteratorIHT.
+//      puKey: Optional, receives the key of the current element.
+//      puVal: Optional, receives the value of the current element.
+//
+DllExpImp HRESULT CHL_DsGetCurrentIHT(
+    _In_ CHL_IHT_ITERATOR *pItr,
+    _Out_opt_ PUINT_PTR puKey,
+    _Out_opt_ PUINT_PTR puVal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INTHASHTABLE_H
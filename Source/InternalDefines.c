@@ -10,6 +10,7 @@
 #include "CommonInclude.h"
 #include "InternalDefines.h"
 #include "MemFunctions.h"
+#include "HashFunctions.h"
 
 #pragma region KeyFunctions
 
@@ -236,6 +237,44 @@ BOOL _IsDuplicateKey(_In_ PCHL_KEY pChlLeftKey, _In_ PCVOID pvRightKey, _In_ CHL
     return fMatch;
 }
 
+// String keys are copied in as iKeySize bytes by _CopyKeyIn. Comparing all of those bytes
+// (rather than up to the terminator) keeps equality consistent with _HashKeyBytes64.
+BOOL _IsSameKeyBytes(_In_ PCHL_KEY pChlLeftKey, _In_ PCVOID pvRightKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize)
+{
+    if (pChlLeftKey->iKeySize != iKeySize)
+    {
+        return FALSE;
+    }
+
+    if ((keyType == CHL_KT_STRING) || (keyType == CHL_KT_WSTRING))
+    {
+        return memcmp(pChlLeftKey->keyDef.pvKey, pvRightKey, iKeySize) == 0;
+    }
+
+    return _IsDuplicateKey(pChlLeftKey, pvRightKey, keyType, iKeySize);
+}
+
+// Returns a stored key as it was passed to the Insert function of its container, which is
+// also how callbacks such as CHL_EVICT_FN receive it
+PVOID _GetKeyArg(_In_ PCHL_KEY pChlKey, _In_ CHL_KEYTYPE keyType)
+{
+    if ((keyType == CHL_KT_INT32) || (keyType == CHL_KT_UINT32))
+    {
+        return (PVOID)(UINT_PTR)pChlKey->keyDef.uiKey;
+    }
+    return pChlKey->keyDef.pvKey;
+}
+
+// Same as _GetKeyArg, for a stored value
+PVOID _GetValArg(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType)
+{
+    if ((valType == CHL_VT_INT32) || (valType == CHL_VT_UINT32))
+    {
+        return (PVOID)(UINT_PTR)pChlVal->valDef.uiVal;
+    }
+    return pChlVal->valDef.pvPtr;
+}
+
 void _DeleteKey(_In_ PCHL_KEY pChlKey, _In_ CHL_KEYTYPE keyType)
 {
     pChlKey->iKeySize = 0;
@@ -552,6 +591,13 @@ BOOL _IsDuplicateVal(_In_ PCHL_VAL pChlLeftVal, _In_ PCVOID pvRightVal, _In_ CHL
             break;
         }
 
+    case CHL_VT_USEROBJECT:
+        {
+            // The callers that replace a value pass the size of the stored one, not of pvRightVal,
+            // so the bytes cannot be compared safely. A user object is always written again.
+            break;
+        }
+
     case CHL_VT_STRING:
         {
             if ((iValSize > 0) && (pvRightVal != NULL))
@@ -591,7 +637,20 @@ BOOL _IsDuplicateVal(_In_ PCHL_VAL pChlLeftVal, _In_ PCVOID pvRightVal, _In_ CHL
 
 void _DeleteVal(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType, _In_opt_ BOOL fFreePointerType)
 {
-    if (_IsValOccupied(pChlVal))
+    int i;
+    PCHL_MULTIVALS pVals;
+
+    if (_IsMultiVal(pChlVal))
+    {
+        pVals = (PCHL_MULTIVALS)pChlVal->valDef.pvPtr;
+        for (i = 0; i < pVals->nVals; ++i)
+        {
+            _DeleteVal(&pVals->aVals[i], valType, fFreePointerType);
+        }
+        CHL_MmFree(&pChlVal->valDef.pvPtr);
+        _MarkValUnoccupied(pChlVal);
+    }
+    else if (_IsValOccupied(pChlVal))
     {
         switch (valType)
         {
@@ -700,6 +759,175 @@ HRESULT _GetValSize(_In_ PVOID pvVal, _In_ CHL_VALTYPE valType, _Inout_ PINT piV
     return hr;
 }
 
+#pragma region MultiValFunctions
+
+BOOL _IsMultiVal(_In_ PCHL_VAL pChlVal)
+{
+    return (pChlVal->magicOccupied == MAGIC_CHLVAL_MULTI);
+}
+
+// Returns the values of a multimap key as a contiguous array, a single value is returned as is
+PCHL_VAL _GetMultiVals(_In_ PCHL_VAL pChlVal, _Out_opt_ PINT pnVals)
+{
+    PCHL_MULTIVALS pVals;
+
+    if (_IsMultiVal(pChlVal))
+    {
+        pVals = (PCHL_MULTIVALS)pChlVal->valDef.pvPtr;
+        IFPTR_SETVAL(pnVals, pVals->nVals);
+        return pVals->aVals;
+    }
+
+    IFPTR_SETVAL(pnVals, 1);
+    return pChlVal;
+}
+
+// Adds a value after the existing values of a multimap key. The second value moves the first one
+// out of line into a CHL_MULTIVALS, which then grows by doubling. Upon failure the existing values
+// are left as they were and pvVal still belongs to the caller.
+HRESULT _AppendMultiVal(_Inout_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType, _In_ PCVOID pvVal, _In_ int iValSize)
+{
+    CHL_VAL chlVal = { 0 };
+    PCHL_MULTIVALS pVals;
+    PCHL_MULTIVALS pNewVals;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(_IsValOccupied(pChlVal) || _IsMultiVal(pChlVal));
+
+    hr = _CopyValIn(&chlVal, valType, pvVal, iValSize);
+    if (FAILED(hr))
+    {
+        goto fend;
+    }
+
+    if (!_IsMultiVal(pChlVal))
+    {
+        hr = CHL_MmAlloc((PVOID*)&pVals, CHL_MULTIVALS_BYTES(CHL_MULTIVALS_MIN_ALLOC), NULL);
+        if (FAILED(hr))
+        {
+            goto error_return;
+        }
+
+        pVals->nAlloc = CHL_MULTIVALS_MIN_ALLOC;
+        pVals->nVals = 1;
+        CopyMemory(&pVals->aVals[0], pChlVal, sizeof(CHL_VAL));
+
+        pChlVal->valDef.pvPtr = pVals;
+        pChlVal->iValSize = 0;
+        pChlVal->magicOccupied = MAGIC_CHLVAL_MULTI;
+    }
+
+    pVals = (PCHL_MULTIVALS)pChlVal->valDef.pvPtr;
+    if (pVals->nVals == pVals->nAlloc)
+    {
+        if ((pVals->nAlloc > MAXINT32 / 2) ||
+            ((pNewVals = (PCHL_MULTIVALS)realloc(pVals, CHL_MULTIVALS_BYTES(pVals->nAlloc * 2))) == NULL))
+        {
+            logerr("%s(): realloc() ", __FUNCTION__);
+            hr = E_OUTOFMEMORY;
+            goto error_return;
+        }
+
+        pVals = pNewVals;
+        pVals->nAlloc *= 2;
+        pChlVal->valDef.pvPtr = pVals;
+    }
+
+    CopyMemory(&pVals->aVals[pVals->nVals], &chlVal, sizeof(CHL_VAL));
+    ++(pVals->nVals);
+    goto fend;
+
+error_return:
+    _DeleteVal(&chlVal, valType, FALSE);
+
+fend:
+    return hr;
+}
+
+// Returns the index of the first value of a multimap key that equals pvVal, -1 if there is none
+int _FindMultiVal(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType, _In_ PCVOID pvVal, _In_ int iValSize)
+{
+    int i;
+    int nVals;
+    PCHL_VAL pVals = _GetMultiVals(pChlVal, &nVals);
+
+    // Values of these types are compared up to iValSize bytes, so the sizes must match too
+    BOOL fCompareSize = (valType == CHL_VT_STRING) || (valType == CHL_VT_WSTRING) || (valType == CHL_VT_USEROBJECT);
+
+    for (i = 0; i < nVals; ++i)
+    {
+        if (fCompareSize && (pVals[i].iValSize != iValSize))
+        {
+            continue;
+        }
+
+        // _IsDuplicateVal does not compare user objects. Here the size of pvVal is known, and equal
+        // to that of the stored value, so their bytes can be compared.
+        if (valType == CHL_VT_USEROBJECT)
+        {
+            if ((pvVal != NULL) && (memcmp(pVals[i].valDef.pvUserObj, pvVal, iValSize) == 0))
+            {
+                return i;
+            }
+        }
+        else if (_IsDuplicateVal(&pVals[i], pvVal, valType, iValSize))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Deletes one value of a multimap key that has at least two, keeping the others in order.
+// The last value left moves back inline.
+void _RemoveMultiVal(_Inout_ PCHL_VAL pChlVal, _In_ int iVal, _In_ CHL_VALTYPE valType, _In_opt_ BOOL fFreePointerType)
+{
+    PCHL_MULTIVALS pVals;
+
+    ASSERT(_IsMultiVal(pChlVal));
+
+    pVals = (PCHL_MULTIVALS)pChlVal->valDef.pvPtr;
+    ASSERT((iVal >= 0) && (iVal < pVals->nVals) && (pVals->nVals > 1));
+
+    _DeleteVal(&pVals->aVals[iVal], valType, fFreePointerType);
+    MoveMemory(&pVals->aVals[iVal], &pVals->aVals[iVal + 1], (SIZE_T)(pVals->nVals - iVal - 1) * sizeof(CHL_VAL));
+    --(pVals->nVals);
+
+    if (pVals->nVals == 1)
+    {
+        CopyMemory(pChlVal, &pVals->aVals[0], sizeof(CHL_VAL));
+        CHL_MmFree((PVOID*)&pVals);
+    }
+}
+
+// Bytes allocated for the values of a multimap key beyond what is charged for a single value
+// (see _GetEntryBytes): the CHL_MULTIVALS and the heap copies of the values in it
+SIZE_T _GetMultiValBytes(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType)
+{
+    int i;
+    SIZE_T cbVals;
+    PCHL_MULTIVALS pVals;
+
+    if (!_IsMultiVal(pChlVal))
+    {
+        return 0;
+    }
+
+    pVals = (PCHL_MULTIVALS)pChlVal->valDef.pvPtr;
+    cbVals = CHL_MULTIVALS_BYTES(pVals->nAlloc);
+    if ((valType == CHL_VT_USEROBJECT) || (valType == CHL_VT_STRING) || (valType == CHL_VT_WSTRING))
+    {
+        for (i = 0; i < pVals->nVals; ++i)
+        {
+            cbVals += pVals->aVals[i].iValSize;
+        }
+    }
+    return cbVals;
+}
+
+#pragma endregion MultiValFunctions
+
 HRESULT _EnsureSufficientValBuf(
     _In_ PCHL_VAL pChlVal,
     _In_ int iSpecBufSize,
@@ -718,6 +946,127 @@ HRESULT _EnsureSufficientValBuf(
     return hr;
 }
 
+#pragma region BudgetFunctions
+
+// Bytes charged for an entry: the node and the heap copies of the key and value
+SIZE_T _GetEntryBytes(
+    _In_ CHL_KEYTYPE keyType,
+    _In_ int iKeySize,
+    _In_ CHL_VALTYPE valType,
+    _In_ int iValSize,
+    _In_ SIZE_T cbNode)
+{
+    SIZE_T cbEntry = cbNode;
+
+    if ((keyType == CHL_KT_STRING) || (keyType == CHL_KT_WSTRING))
+    {
+        cbEntry += iKeySize;
+    }
+
+    if ((valType == CHL_VT_USEROBJECT) || (valType == CHL_VT_STRING) || (valType == CHL_VT_WSTRING))
+    {
+        cbEntry += iValSize;
+    }
+    return cbEntry;
+}
+
+HRESULT _SetBudget(
+    _In_ PCHL_BUDGET pBudget,
+    _In_ SIZE_T cbMax,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext)
+{
+    if ((cbMax > 0) && ((policy <= CHL_BP_START) || (policy >= CHL_BP_END)))
+    {
+        logerr("%s(): Invalid budget policy %d", __FUNCTION__, policy);
+        return E_INVALIDARG;
+    }
+
+    pBudget->cbMax = cbMax;
+    pBudget->policy = policy;
+    pBudget->pfnEvict = pfnEvict;
+    pBudget->pvEvictContext = pvEvictContext;
+    if (pBudget->ullRandom == 0)
+    {
+        // Xorshift state must not be zero
+        pBudget->ullRandom = _GenerateHashSeed() | 1;
+    }
+    return S_OK;
+}
+
+// Whether an entry of cbEntry bytes that replaces cbReplaced bytes of an existing entry may be
+// inserted. With an evicting policy the container evicts after the insert, see _IsOverBudget.
+HRESULT _CheckBudget(_In_ PCHL_BUDGET pBudget, _In_ SIZE_T cbEntry, _In_ SIZE_T cbReplaced)
+{
+    if (pBudget->cbMax == 0)
+    {
+        return S_OK;
+    }
+
+    if (cbEntry > pBudget->cbMax)
+    {
+        logerr("%s(): Entry of %Iu bytes exceeds the budget of %Iu bytes", __FUNCTION__, cbEntry, pBudget->cbMax);
+        return E_INVALIDARG;
+    }
+
+    if ((pBudget->policy == CHL_BP_FAIL) && (pBudget->cbUsed - cbReplaced + cbEntry > pBudget->cbMax))
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA);
+    }
+    return S_OK;
+}
+
+BOOL _IsOverBudget(_In_ PCHL_BUDGET pBudget)
+{
+    return (pBudget->cbMax > 0) && (pBudget->cbUsed > pBudget->cbMax);
+}
+
+// Returns a pseudo random number in [0, nRange)
+UINT _NextBudgetRandom(_In_ PCHL_BUDGET pBudget, _In_ UINT nRange)
+{
+    ULONGLONG x = pBudget->ullRandom;
+
+    ASSERT(x != 0);
+
+    // xorshift64*
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    pBudget->ullRandom = x;
+
+    return (UINT)((((x * 0x2545F4914F6CDD1DULL) >> 32) * nRange) >> 32);
+}
+
+// Calls the eviction callback, if any, for an entry about to be evicted and counts the eviction
+void _NotifyEvict(
+    _In_ PCHL_BUDGET pBudget,
+    _In_opt_ PCHL_KEY pChlKey,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ PCHL_VAL pChlVal,
+    _In_ CHL_VALTYPE valType)
+{
+    PVOID pvKey = NULL;
+    int iKeySize = 0;
+
+    ++(pBudget->ullEvictions);
+
+    if (pBudget->pfnEvict == NULL)
+    {
+        return;
+    }
+
+    if (pChlKey != NULL)
+    {
+        pvKey = _GetKeyArg(pChlKey, keyType);
+        iKeySize = pChlKey->iKeySize;
+    }
+
+    pBudget->pfnEvict(pvKey, iKeySize, _GetValArg(pChlVal, valType), pChlVal->iValSize, pBudget->pvEvictContext);
+}
+
+#pragma endregion BudgetFunctions
+
 int CHL_CompareFnInt32(PCVOID pvLeft, PCVOID pvRight)
 {
     int left = (int)pvLeft;
@@ -30,6 +30,22 @@
 // This is actually prime number 433494437 (see https://en.wikipedia.org/wiki/List_of_prime_numbers#Markov_primes)
 #define MAGIC_CHLVAL_OCCUPIED   ((UINT)0x19D699A5)
 
+// Magic number denoting that a CHL_VAL holds all values of a multimap key, see CHL_MULTIVALS.
+// This is Fibonacci prime 2971215073.
+#define MAGIC_CHLVAL_MULTI      ((UINT)0xB11924E1)
+
+// Values of a key of a multimap, stored contiguously in the order they were added. A key with one
+// value has it inline like any other container. Its CHL_VAL points to this once it has more,
+// in valDef.pvPtr with magicOccupied set to MAGIC_CHLVAL_MULTI and iValSize zero.
+typedef struct _chlMultiVals {
+    int nVals;          // Number of values
+    int nAlloc;         // Number of values there is room for
+    CHL_VAL aVals[1];
+}CHL_MULTIVALS, *PCHL_MULTIVALS;
+
+#define CHL_MULTIVALS_MIN_ALLOC         4
+#define CHL_MULTIVALS_BYTES(nAlloc)     (FIELD_OFFSET(CHL_MULTIVALS, aVals) + ((SIZE_T)(nAlloc) * sizeof(CHL_VAL)))
+
 // -------------------------------------------
 // Functions internal only
 
@@ -41,6 +57,9 @@ HRESULT _CopyKeyOut(
     _Inout_opt_ PINT pKeyOutSize,
     _In_ BOOL fGetPointerOnly);
 BOOL _IsDuplicateKey(_In_ PCHL_KEY pChlLeftKey, _In_ PCVOID pvRightKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize);
+BOOL _IsSameKeyBytes(_In_ PCHL_KEY pChlLeftKey, _In_ PCVOID pvRightKey, _In_ CHL_KEYTYPE keyType, _In_ int iKeySize);
+PVOID _GetKeyArg(_In_ PCHL_KEY pChlKey, _In_ CHL_KEYTYPE keyType);
+PVOID _GetValArg(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType);
 void _DeleteKey(_In_ PCHL_KEY pChlKey, _In_ CHL_KEYTYPE keyType);
 HRESULT _GetKeySize(_In_ PVOID pvKey, _In_ CHL_KEYTYPE keyType, _Inout_ PINT piKeySize);
 HRESULT _EnsureSufficientKeyBuf(
@@ -61,9 +80,37 @@ void _MarkValUnoccupied(_In_ PCHL_VAL pChlVal);
 void _MarkValOccupied(_In_ PCHL_VAL pChlVal);
 BOOL _IsValOccupied(_In_ PCHL_VAL pChlVal);
 HRESULT _GetValSize(_In_ PVOID pvVal, _In_ CHL_VALTYPE valType, _Inout_ PINT piValSize);
+BOOL _IsMultiVal(_In_ PCHL_VAL pChlVal);
+PCHL_VAL _GetMultiVals(_In_ PCHL_VAL pChlVal, _Out_opt_ PINT pnVals);
+HRESULT _AppendMultiVal(_Inout_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType, _In_ PCVOID pvVal, _In_ int iValSize);
+int _FindMultiVal(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType, _In_ PCVOID pvVal, _In_ int iValSize);
+void _RemoveMultiVal(_Inout_ PCHL_VAL pChlVal, _In_ int iVal, _In_ CHL_VALTYPE valType, _In_opt_ BOOL fFreePointerType);
+SIZE_T _GetMultiValBytes(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType);
 HRESULT _EnsureSufficientValBuf(
     _In_ PCHL_VAL pChlVal,
     _In_ int iSpecBufSize,
     _Inout_opt_ PINT piReqBufSize);
 
+SIZE_T _GetEntryBytes(
+    _In_ CHL_KEYTYPE keyType,
+    _In_ int iKeySize,
+    _In_ CHL_VALTYPE valType,
+    _In_ int iValSize,
+    _In_ SIZE_T cbNode);
+HRESULT _SetBudget(
+    _In_ PCHL_BUDGET pBudget,
+    _In_ SIZE_T cbMax,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext);
+HRESULT _CheckBudget(_In_ PCHL_BUDGET pBudget, _In_ SIZE_T cbEntry, _In_ SIZE_T cbReplaced);
+BOOL _IsOverBudget(_In_ PCHL_BUDGET pBudget);
+UINT _NextBudgetRandom(_In_ PCHL_BUDGET pBudget, _In_ UINT nRange);
+void _NotifyEvict(
+    _In_ PCHL_BUDGET pBudget,
+    _In_opt_ PCHL_KEY pChlKey,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ PCHL_VAL pChlVal,
+    _In_ CHL_VALTYPE valType);
+
 #endif // CHL_INT_DEFINES_H
@@ -5,6 +5,7 @@
 //      04/05/14 Initial version
 //      04/10/14 Changed to insert at end logic
 //      09/12/14 Naming convention modifications
+//      10/17/26 Byte accounting and an optional byte budget
 //
 
 #include "InternalDefines.h"
@@ -16,6 +17,9 @@
 static void _InsertNode(PCHL_LLIST pLList, PLLNODE pNodeToInsert);
 static void _UnlinkNode(PCHL_LLIST pLList, PLLNODE pNodeToRemove);
 static void _FreeNodeMem(PLLNODE pnode, CHL_VALTYPE valType, BOOL fFreeValMem);
+static SIZE_T _NodeBytes(PCHL_LLIST pLList, int iValSize);
+static void _RemoveNode(PCHL_LLIST pLList, PLLNODE pNodeToRemove, BOOL fFreeValMem);
+static void _EvictToBudget(PCHL_LLIST pLList, PLLNODE pNodeToKeep);
 
 HRESULT CHL_DsCreateLL(_Out_ PCHL_LLIST *ppLList, _In_ CHL_VALTYPE valType, _In_opt_ int nEstEntries)
 {
@@ -51,6 +55,7 @@ HRESULT CHL_DsCreateLL(_Out_ PCHL_LLIST *ppLList, _In_ CHL_VALTYPE valType, _In_
     pListLocal->Destroy = CHL_DsDestroyLL;
     pListLocal->IsEmpty = CHL_DsIsEmptyLL;
     pListLocal->InitIterator = CHL_DsInitIteratorLL;
+    pListLocal->SetBudget = CHL_DsSetBudgetLL;
 
     *ppLList = pListLocal;
     return hr;
@@ -66,6 +71,7 @@ error_return:
 HRESULT CHL_DsInsertLL(_In_ PCHL_LLIST pLList, _In_ PCVOID pvVal, _In_opt_ int iValSize)
 {
     PLLNODE pNewNode = NULL;
+    SIZE_T cbEntry;
     HRESULT hr = S_OK;
 
     // Size parameter validation
@@ -76,6 +82,13 @@ HRESULT CHL_DsInsertLL(_In_ PCHL_LLIST pLList, _In_ PCVOID pvVal, _In_opt_ int i
         goto error_return;
     }
 
+    cbEntry = _NodeBytes(pLList, iValSize);
+    hr = _CheckBudget(&pLList->budget, cbEntry, 0);
+    if (FAILED(hr))
+    {
+        goto error_return;
+    }
+
     // Create new node
     hr = CHL_MmAlloc((PVOID*)&pNewNode, sizeof(LLNODE), NULL);
     if (FAILED(hr))
@@ -91,7 +104,9 @@ HRESULT CHL_DsInsertLL(_In_ PCHL_LLIST pLList, _In_ PCVOID pvVal, _In_opt_ int i
 
     _InsertNode(pLList, pNewNode);
     ++(pLList->nCurNodes);
+    pLList->budget.cbUsed += cbEntry;
 
+    _EvictToBudget(pLList, pNewNode);
     return hr;
 
 error_return:
@@ -111,6 +126,7 @@ HRESULT CHL_DsRemoveLL
 )
 {
     PLLNODE pCurNode = NULL;
+    PLLNODE pNextNode;
     PVOID pvCurVal = NULL;
     CHL_VALTYPE valType = pLList->valType;
 
@@ -121,15 +137,15 @@ HRESULT CHL_DsRemoveLL
     hr = E_NOT_SET;
     while (pCurNode)
     {
+        // Node may be freed below
+        pNextNode = pCurNode->pright;
+
         _CopyValOut(&pCurNode->chlVal, valType, &pvCurVal, NULL, TRUE);
         if (pfnComparer(pvValToFind, pvCurVal) == 0)
         {
             hr = S_OK;
 
-            _UnlinkNode(pLList, pCurNode);
-            _FreeNodeMem(pCurNode, valType, TRUE);
-
-            --(pLList->nCurNodes);
+            _RemoveNode(pLList, pCurNode, TRUE);
 
             if (fStopOnFirstFind)
             {
@@ -137,7 +153,7 @@ HRESULT CHL_DsRemoveLL
             }
         }
 
-        pCurNode = pCurNode->pright;
+        pCurNode = pNextNode;
     }
 
     return hr;
@@ -183,11 +199,8 @@ HRESULT CHL_DsRemoveAtLL(
 
     if (SUCCEEDED(hr))
     {
-        // Unlink and only then free node memory
-        _UnlinkNode(pLList, pCurNode);
-        --(pLList->nCurNodes);
-
-        _FreeNodeMem(pCurNode, pLList->valType, (!pvValOut || !fGetPointerOnly));
+        // A value handed out by pointer is no longer charged to the list either
+        _RemoveNode(pLList, pCurNode, (!pvValOut || !fGetPointerOnly));
     }
 
 fend:
@@ -199,12 +212,8 @@ DllExpImp HRESULT CHL_DsRemoveAtItrLL(_Inout_ CHL_ITERATOR_LL *pItr)
     HRESULT hr = (pItr->pCur != NULL) ? S_OK : E_NOT_SET;
     if (SUCCEEDED(hr))
     {
-        // Unlink and only then free node memory
         PLLNODE pNextNode = pItr->pCur->pright;
-        _UnlinkNode(pItr->pMyList, pItr->pCur);
-        --(pItr->pMyList->nCurNodes);
-
-        _FreeNodeMem(pItr->pCur, pItr->pMyList->valType, TRUE /*fFreeValMem*/);
+        _RemoveNode(pItr->pMyList, pItr->pCur, TRUE /*fFreeValMem*/);
         pItr->pCur = pNextNode;
     }
     return hr;
@@ -374,6 +383,23 @@ HRESULT CHL_DsDestroyLL(_In_ PCHL_LLIST pLList)
     return hr;
 }
 
+HRESULT CHL_DsSetBudgetLL
+(
+    _In_ PCHL_LLIST pLList,
+    _In_ SIZE_T cbMaxBytes,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext
+)
+{
+    HRESULT hr = _SetBudget(&pLList->budget, cbMaxBytes, policy, pfnEvict, pvEvictContext);
+    if (SUCCEEDED(hr))
+    {
+        _EvictToBudget(pLList, NULL);
+    }
+    return hr;
+}
+
 DllExpImp BOOL CHL_DsIsEmptyLL(_In_ PCHL_LLIST pLList)
 {
     return (pLList->nCurNodes == 0);
@@ -514,3 +540,55 @@ static void _FreeNodeMem(PLLNODE pnode, CHL_VALTYPE valType, BOOL fFreeValMem)
     // Finally, free the node itself
     CHL_MmFree((PVOID*)&pnode);
 }
+
+// Bytes charged for a node: the node and the heap copy of the value
+static SIZE_T _NodeBytes(PCHL_LLIST pLList, int iValSize)
+{
+    return _GetEntryBytes(CHL_KT_START, 0, pLList->valType, iValSize, sizeof(LLNODE));
+}
+
+// Unlinks the node, uncharges it and only then frees node memory
+static void _RemoveNode(PCHL_LLIST pLList, PLLNODE pNodeToRemove, BOOL fFreeValMem)
+{
+    _UnlinkNode(pLList, pNodeToRemove);
+    --(pLList->nCurNodes);
+    pLList->budget.cbUsed -= _NodeBytes(pLList, pNodeToRemove->chlVal.iValSize);
+
+    _FreeNodeMem(pNodeToRemove, pLList->valType, fFreeValMem);
+}
+
+// Evicts while over budget, but never pNodeToKeep which is the tail just inserted, if any
+static void _EvictToBudget(PCHL_LLIST pLList, PLLNODE pNodeToKeep)
+{
+    PLLNODE pVictim;
+    int nCandidates;
+    int itr;
+
+    ASSERT((pNodeToKeep == NULL) || (pNodeToKeep == pLList->pTail));
+
+    while (_IsOverBudget(&pLList->budget))
+    {
+        nCandidates = pLList->nCurNodes - ((pNodeToKeep != NULL) ? 1 : 0);
+        if (nCandidates <= 0)
+        {
+            break;
+        }
+
+        pVictim = pLList->pHead;
+        if (pLList->budget.policy == CHL_BP_EVICT_RANDOM)
+        {
+            for (itr = _NextBudgetRandom(&pLList->budget, (UINT)nCandidates); itr > 0; --itr)
+            {
+                pVictim = pVictim->pright;
+            }
+        }
+        else if (pLList->budget.policy != CHL_BP_EVICT_OLDEST)
+        {
+            // Only a lowered budget can leave a failing list over it, which is not an error
+            break;
+        }
+
+        _NotifyEvict(&pLList->budget, NULL, CHL_KT_START, &pVictim->chlVal, pLList->valType);
+        _RemoveNode(pLList, pVictim, TRUE);
+    }
+}
@@ -7,6 +7,7 @@
 //      09/09/14 Refactor to store defs in individual headers.
 //      09/12/14 Naming convention modifications
 //      2016/01/30 Replace compare function with the standard CHL_CompareFn type
+//      10/17/26 Byte accounting and an optional byte budget
 //
 
 #ifndef _LINKEDLIST_H
@@ -36,6 +37,7 @@ struct _LinkedList {
     CHL_VALTYPE valType;
     PLLNODE pHead;
     PLLNODE pTail;
+    CHL_BUDGET budget;      // Bytes charged for all nodes and the budget, see CHL_DsSetBudgetLL
 
     // Access methods
 
@@ -99,6 +101,15 @@ struct _LinkedList {
 
     HRESULT (*InitIterator)(PCHL_LLIST pList, CHL_ITERATOR_LL *pItr);
 
+    HRESULT (*SetBudget)
+    (
+        PCHL_LLIST pLList,
+        SIZE_T cbMaxBytes,
+        CHL_BUDGET_POLICY policy,
+        CHL_EVICT_FN pfnEvict,
+        PVOID pvEvictContext
+    );
+
 };
 
 // Structure that defines the iterator for the linked list.
@@ -189,6 +200,30 @@ DllExpImp HRESULT CHL_DsDestroyLL(_In_ PCHL_LLIST pLList);
 
 DllExpImp BOOL CHL_DsIsEmptyLL(_In_ PCHL_LLIST pLList);
 
+// CHL_DsSetBudgetLL()
+// Sets a byte budget for the list. The list always keeps budget.cbUsed up to date, the bytes
+// charged for its nodes and for heap copies of string and user object values. With a budget,
+// an insert that would take the list over it fails with HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA)
+// under CHL_BP_FAIL, or succeeds and evicts other values until the list is within budget again:
+// from the head under CHL_BP_EVICT_OLDEST, or picked at random under CHL_BP_EVICT_RANDOM which
+// walks the list to the victim. A value that alone is charged more than the budget is never
+// inserted, E_INVALIDARG is returned. Lowering the budget of a list evicts right away.
+//      pLList: Pointer to a linked list object that was returned by a successful call
+//              to CHL_DsCreateLL.
+//      cbMaxBytes: The budget in bytes, 0 to remove the budget.
+//      policy: What to do when an insert goes over the budget.
+//      pfnEvict: Optional. Called for each value that is evicted, with NULL for the key.
+//      pvEvictContext: Optional. Passed to pfnEvict.
+//
+DllExpImp HRESULT CHL_DsSetBudgetLL
+(
+    _In_ PCHL_LLIST pLList,
+    _In_ SIZE_T cbMaxBytes,
+    _In_ CHL_BUDGET_POLICY policy,
+    _In_opt_ CHL_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext
+);
+
 DllExpImp HRESULT CHL_DsInitIteratorLL(_In_ PCHL_LLIST pList, _Out_ CHL_ITERATOR_LL *pItr);
 
 DllExpImp HRESULT CHL_DsMoveNextLL(_Inout_ CHL_ITERATOR_LL *pItr);
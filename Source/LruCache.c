@@ -0,0 +1,477 @@
+// LruCache.c
+// Bounded cache that evicts the least recently used entries
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#include "InternalDefines.h"
+#include "HashFunctions.h"
+#include "LruCache.h"
+
+#define LRU_MIN_BUCKETS     16
+
+// File-local Functions
+static SIZE_T _EntryBytes(_In_ PCHL_LRU plru, _In_ int iKeySize, _In_ int iValSize);
+
+static LRU_NODE** _FindLink(
+    _In_ PCHL_LRU plru,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ ULONGLONG ullHash);
+
+static void _LinkAtFront(_In_ PCHL_LRU plru, _In_ LRU_NODE *pNode);
+static void _Unlink(_In_ PCHL_LRU plru, _In_ LRU_NODE *pNode);
+static void _MoveToFront(_In_ PCHL_LRU plru, _In_ LRU_NODE *pNode);
+static void _RemoveNode(_In_ PCHL_LRU plru, _In_ LRU_NODE **ppLink);
+static void _EvictToCapacity(_In_ PCHL_LRU plru);
+static void _GrowIndex(_In_ PCHL_LRU plru);
+
+// Bytes charged for an entry: the node and the heap copies of the key and value
+SIZE_T _EntryBytes(_In_ PCHL_LRU plru, _In_ int iKeySize, _In_ int iValSize)
+{
+    SIZE_T cbEntry = sizeof(LRU_NODE);
+
+    if ((plru->keyType == CHL_KT_STRING) || (plru->keyType == CHL_KT_WSTRING))
+    {
+        cbEntry += iKeySize;
+    }
+
+    if ((plru->valType == CHL_VT_USEROBJECT) || (plru->valType == CHL_VT_STRING) || (plru->valType == CHL_VT_WSTRING))
+    {
+        cbEntry += iValSize;
+    }
+    return cbEntry;
+}
+
+HRESULT CHL_DsCreateLRU(
+    _Out_ PCHL_LRU *pLruOut,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ UINT nMaxEntries,
+    _In_ SIZE_T cbMaxBytes,
+    _In_opt_ CHL_LRU_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext)
+{
+    PCHL_LRU pnewlru = NULL;
+    UINT nBuckets = LRU_MIN_BUCKETS;
+
+    HRESULT hr = S_OK;
+
+    // validate parameters
+    if ((pLruOut == NULL) || IS_INVALID_CHL_KEYTYPE(keyType) || IS_INVALID_CHL_VALTYPE(valType) ||
+        ((nMaxEntries == 0) && (cbMaxBytes == 0)))
+    {
+        hr = E_INVALIDARG;
+        goto error_return;
+    }
+
+    // With an entry capacity the index never needs to grow
+    if (nMaxEntries > nBuckets)
+    {
+        nBuckets = nMaxEntries;
+    }
+
+    if ((pnewlru = (CHL_LRU*)calloc(1, sizeof(CHL_LRU))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto error_return;
+    }
+
+    if ((pnewlru->ppBuckets = (LRU_NODE**)calloc(nBuckets, sizeof(LRU_NODE*))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto error_return;
+    }
+
+    pnewlru->keyType = keyType;
+    pnewlru->valType = valType;
+    pnewlru->fValIsInHeap = fValInHeapMem;
+    pnewlru->nBuckets = nBuckets;
+    pnewlru->ullHashSeed = _GenerateHashSeed();
+    pnewlru->nMaxEntries = nMaxEntries;
+    pnewlru->cbMaxBytes = cbMaxBytes;
+    pnewlru->pfnEvict = pfnEvict;
+    pnewlru->pvEvictContext = pvEvictContext;
+
+    pnewlru->Destroy = CHL_DsDestroyLRU;
+    pnewlru->Insert = CHL_DsInsertLRU;
+    pnewlru->Find = CHL_DsFindLRU;
+    pnewlru->Remove = CHL_DsRemoveLRU;
+
+    *pLruOut = pnewlru;
+    return hr;
+
+error_return:
+    if (pnewlru)
+    {
+        free(pnewlru->ppBuckets);
+        free(pnewlru);
+    }
+    if (pLruOut)
+    {
+        *pLruOut = NULL;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsDestroyLRU(_In_ PCHL_LRU plru)
+{
+    LRU_NODE *pNode;
+    LRU_NODE *pNext;
+
+    ASSERT(plru);
+
+    for (pNode = plru->pMostRecent; pNode != NULL; pNode = pNext)
+    {
+        pNext = pNode->pNext;
+        _DeleteKey(&pNode->chlKey, plru->keyType);
+        _DeleteVal(&pNode->chlVal, plru->valType, plru->fValIsInHeap);
+        free(pNode);
+    }
+
+    free(plru->ppBuckets);
+
+    DBG_MEMSET(plru, sizeof(CHL_LRU));
+    free(plru);
+
+    return S_OK;
+}
+
+HRESULT CHL_DsInsertLRU(
+    _In_ PCHL_LRU plru,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize)
+{
+    ULONGLONG ullHash;
+    LRU_NODE **ppLink;
+    LRU_NODE *pNode;
+    SIZE_T cbEntry;
+    CHL_VAL chlNewVal;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(plru);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, plru->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, plru->valType, &iValSize)))
+    {
+        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    cbEntry = _EntryBytes(plru, iKeySize, iValSize);
+    if ((plru->cbMaxBytes > 0) && (cbEntry > plru->cbMaxBytes))
+    {
+        logerr("%s(): Entry of %Iu bytes exceeds the capacity of %Iu bytes", __FUNCTION__, cbEntry, plru->cbMaxBytes);
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    ullHash = _HashKeyBytes64(pvkey, plru->keyType, iKeySize, plru->ullHashSeed);
+    ppLink = _FindLink(plru, pvkey, iKeySize, ullHash);
+    if (*ppLink != NULL)
+    {
+        pNode = *ppLink;
+        if (!_IsDuplicateVal(&pNode->chlVal, pvVal, plru->valType, pNode->chlVal.iValSize))
+        {
+            // Copy the new value first so that a failure leaves the entry as it was
+            ZeroMemory(&chlNewVal, sizeof(chlNewVal));
+            hr = _CopyValIn(&chlNewVal, plru->valType, pvVal, iValSize);
+            if (FAILED(hr))
+            {
+                goto done;
+            }
+
+            _DeleteVal(&pNode->chlVal, plru->valType, plru->fValIsInHeap);
+            pNode->chlVal = chlNewVal;
+
+            plru->cbUsed = plru->cbUsed - pNode->cbEntry + cbEntry;
+            pNode->cbEntry = cbEntry;
+        }
+
+        _MoveToFront(plru, pNode);
+        _EvictToCapacity(plru);
+        goto done;
+    }
+
+    if ((pNode = (LRU_NODE*)calloc(1, sizeof(LRU_NODE))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
+
+    hr = _CopyKeyIn(&pNode->chlKey, plru->keyType, pvkey, iKeySize);
+    if (FAILED(hr))
+    {
+        free(pNode);
+        goto done;
+    }
+
+    hr = _CopyValIn(&pNode->chlVal, plru->valType, pvVal, iValSize);
+    if (FAILED(hr))
+    {
+        _DeleteKey(&pNode->chlKey, plru->keyType);
+        free(pNode);
+        goto done;
+    }
+
+    pNode->ullHash = ullHash;
+    pNode->cbEntry = cbEntry;
+    *ppLink = pNode;
+    _LinkAtFront(plru, pNode);
+
+    ++(plru->nEntries);
+    plru->cbUsed += cbEntry;
+
+    _EvictToCapacity(plru);
+
+    // Only without an entry capacity can the index become crowded
+    if (plru->nEntries > plru->nBuckets)
+    {
+        _GrowIndex(plru);
+    }
+
+done:
+    return hr;
+}
+
+HRESULT CHL_DsFindLRU(
+    _In_ PCHL_LRU plru,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    LRU_NODE *pNode;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(plru);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, plru->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto not_found;
+    }
+
+    pNode = *_FindLink(plru, pvkey, iKeySize, _HashKeyBytes64(pvkey, plru->keyType, iKeySize, plru->ullHashSeed));
+    if (pNode == NULL)
+    {
+        ++(plru->counters.ullMisses);
+        hr = E_NOT_SET;
+        goto not_found;
+    }
+
+    ++(plru->counters.ullHits);
+    _MoveToFront(plru, pNode);
+
+    if (pvVal)
+    {
+        hr = _CopyValOut(&pNode->chlVal, plru->valType, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr) && (piValSize != NULL))
+    {
+        *piValSize = pNode->chlVal.iValSize;
+    }
+
+    return hr;
+
+not_found:
+    if (piValSize)
+    {
+        *piValSize = 0;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsRemoveLRU(_In_ PCHL_LRU plru, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    LRU_NODE **ppLink;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(plru);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, plru->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    ppLink = _FindLink(plru, pvkey, iKeySize, _HashKeyBytes64(pvkey, plru->keyType, iKeySize, plru->ullHashSeed));
+    if (*ppLink == NULL)
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    _RemoveNode(plru, ppLink);
+
+fend:
+    return hr;
+}
+
+// Returns the link that points to the entry of the key, or the NULL link at the end
+// of the key's bucket if the key is not in the cache
+LRU_NODE** _FindLink(
+    _In_ PCHL_LRU plru,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ ULONGLONG ullHash)
+{
+    LRU_NODE **ppLink = &plru->ppBuckets[_ReduceHash64(ullHash, plru->nBuckets)];
+
+    for (; *ppLink != NULL; ppLink = &(*ppLink)->pHashNext)
+    {
+        if (((*ppLink)->ullHash == ullHash) && _IsSameKeyBytes(&(*ppLink)->chlKey, pvkey, plru->keyType, iKeySize))
+        {
+            break;
+        }
+    }
+    return ppLink;
+}
+
+void _LinkAtFront(_In_ PCHL_LRU plru, _In_ LRU_NODE *pNode)
+{
+    pNode->pPrev = NULL;
+    pNode->pNext = plru->pMostRecent;
+    if (plru->pMostRecent != NULL)
+    {
+        plru->pMostRecent->pPrev = pNode;
+    }
+    else
+    {
+        plru->pLeastRecent = pNode;
+    }
+    plru->pMostRecent = pNode;
+}
+
+void _Unlink(_In_ PCHL_LRU plru, _In_ LRU_NODE *pNode)
+{
+    if (pNode->pPrev != NULL)
+    {
+        pNode->pPrev->pNext = pNode->pNext;
+    }
+    else
+    {
+        plru->pMostRecent = pNode->pNext;
+    }
+
+    if (pNode->pNext != NULL)
+    {
+        pNode->pNext->pPrev = pNode->pPrev;
+    }
+    else
+    {
+        plru->pLeastRecent = pNode->pPrev;
+    }
+}
+
+void _MoveToFront(_In_ PCHL_LRU plru, _In_ LRU_NODE *pNode)
+{
+    if (plru->pMostRecent != pNode)
+    {
+        _Unlink(plru, pNode);
+        _LinkAtFront(plru, pNode);
+    }
+}
+
+// Unlinks the entry from its bucket and from the recency list, and frees it
+void _RemoveNode(_In_ PCHL_LRU plru, _In_ LRU_NODE **ppLink)
+{
+    LRU_NODE *pNode = *ppLink;
+
+    *ppLink = pNode->pHashNext;
+    _Unlink(plru, pNode);
+
+    --(plru->nEntries);
+    plru->cbUsed -= pNode->cbEntry;
+
+    _DeleteKey(&pNode->chlKey, plru->keyType);
+    _DeleteVal(&pNode->chlVal, plru->valType, plru->fValIsInHeap);
+    free(pNode);
+}
+
+// Evicts from the tail while over capacity, but never the most recently used entry
+// which is the one just inserted or updated
+void _EvictToCapacity(_In_ PCHL_LRU plru)
+{
+    LRU_NODE *pVictim;
+    LRU_NODE **ppLink;
+
+    while ((plru->pLeastRecent != plru->pMostRecent) &&
+        (((plru->nMaxEntries > 0) && (plru->nEntries > plru->nMaxEntries)) ||
+         ((plru->cbMaxBytes > 0) && (plru->cbUsed > plru->cbMaxBytes))))
+    {
+        pVictim = plru->pLeastRecent;
+
+        if (plru->pfnEvict != NULL)
+        {
+            plru->pfnEvict(
+                _GetKeyArg(&pVictim->chlKey, plru->keyType), pVictim->chlKey.iKeySize,
+                _GetValArg(&pVictim->chlVal, plru->valType), pVictim->chlVal.iValSize,
+                plru->pvEvictContext);
+        }
+
+        // Chains are short, finding the link to the victim does not need a key compare
+        ppLink = &plru->ppBuckets[_ReduceHash64(pVictim->ullHash, plru->nBuckets)];
+        while (*ppLink != pVictim)
+        {
+            ppLink = &(*ppLink)->pHashNext;
+        }
+
+        _RemoveNode(plru, ppLink);
+        ++(plru->counters.ullEvictions);
+    }
+}
+
+// Doubles the number of buckets. Entries keep their place in the recency list.
+// If memory for the new buckets cannot be allocated, the cache keeps working with longer chains.
+void _GrowIndex(_In_ PCHL_LRU plru)
+{
+    LRU_NODE **ppNewBuckets;
+    LRU_NODE **ppBucket;
+    LRU_NODE *pNode;
+    UINT nNewBuckets;
+
+    if (plru->nBuckets > (UINT_MAX / 2))
+    {
+        return;
+    }
+
+    nNewBuckets = plru->nBuckets * 2;
+    if ((ppNewBuckets = (LRU_NODE**)calloc(nNewBuckets, sizeof(LRU_NODE*))) == NULL)
+    {
+        logwarn("%s(): calloc() ", __FUNCTION__);
+        return;
+    }
+
+    for (pNode = plru->pMostRecent; pNode != NULL; pNode = pNode->pNext)
+    {
+        ppBucket = &ppNewBuckets[_ReduceHash64(pNode->ullHash, nNewBuckets)];
+        pNode->pHashNext = *ppBucket;
+        *ppBucket = pNode;
+    }
+
+    free(plru->ppBuckets);
+    plru->ppBuckets = ppNewBuckets;
+    plru->nBuckets = nNewBuckets;
+}
@@ -0,0 +1,170 @@
+// LruCache.h
+// Bounded cache that evicts the least recently used entries
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#ifndef _LRUCACHE_H
+#define _LRUCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Defines.h"
+#include "MemFunctions.h"
+
+// A cache entry is a node of the key index and of the recency list at the same time,
+// so a hit finds the entry with one lookup and moves it to the front without searching.
+typedef struct _lruNode {
+    struct _lruNode *pHashNext;     // Next entry in the same bucket of the index
+    struct _lruNode *pPrev;         // More recently used entry, NULL for the most recently used
+    struct _lruNode *pNext;         // Less recently used entry, NULL for the least recently used
+    ULONGLONG ullHash;              // Full hash of chlKey
+    SIZE_T cbEntry;                 // Bytes charged to the cache for this entry
+    CHL_KEY chlKey;
+    CHL_VAL chlVal;
+}LRU_NODE;
+
+// Called for every entry that is evicted to make room, before the cache frees its copy
+// of the key and value. The key and value are passed as CHL_DsGetCurrentHT would pass
+// them with fGetPointerOnly: integers cast to pointers, otherwise pointers to the stored
+// copies. Entries that are removed, overwritten or destroyed with the cache are not evicted.
+// Params:
+//      pvKey: The key of the evicted entry.
+//      iKeySize: Size of the key in bytes.
+//      pvVal: The value of the evicted entry.
+//      iValSize: Size of the value in bytes.
+//      pvContext: Context passed to CHL_DsCreateLRU.
+//
+typedef void (*CHL_LRU_EVICT_FN)(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext);
+
+// Counters kept by every cache
+typedef struct _lruCounters {
+    ULONGLONG ullHits;          // Finds that found the key
+    ULONGLONG ullMisses;        // Finds that did not find the key
+    ULONGLONG ullEvictions;     // Entries evicted to stay within the capacity
+}CHL_LRU_COUNTERS;
+
+// The LRU cache itself
+typedef struct _lruCache CHL_LRU, *PCHL_LRU;
+struct _lruCache {
+    CHL_KEYTYPE keyType;    // Type information for the cache key
+    CHL_VALTYPE valType;    // Type information for the cache value
+    BOOL fValIsInHeap;      // Whether value was allocated on heap by client (for CHL_VT_POINTER only)
+
+    LRU_NODE **ppBuckets;   // Key index, each bucket is a chain of entries
+    UINT nBuckets;          // Number of buckets
+    ULONGLONG ullHashSeed;  // Random per-cache seed for the key hash
+
+    LRU_NODE *pMostRecent;  // Head of the recency list
+    LRU_NODE *pLeastRecent; // Tail of the recency list, the next entry to be evicted
+
+    UINT nEntries;          // Number of key-value pairs currently stored
+    SIZE_T cbUsed;          // Bytes charged for all entries, see CHL_DsCreateLRU
+    UINT nMaxEntries;       // Capacity in entries, 0 if unlimited
+    SIZE_T cbMaxBytes;      // Capacity in bytes, 0 if unlimited
+
+    CHL_LRU_EVICT_FN pfnEvict;  // Optional eviction callback
+    PVOID pvEvictContext;       // Passed to pfnEvict
+
+    CHL_LRU_COUNTERS counters;
+
+    // Access methods
+    HRESULT (*Destroy)(PCHL_LRU plru);
+
+    HRESULT (*Insert)(
+        PCHL_LRU plru,
+        PCVOID pvkey,
+        int iKeySize,
+        PCVOID pvVal,
+        int iValSize);
+
+    HRESULT (*Find)(
+        PCHL_LRU plru,
+        PCVOID pvkey,
+        int iKeySize,
+        PVOID pvVal,
+        PINT pvalsize,
+        BOOL fGetPointerOnly);
+
+    HRESULT (*Remove)(PCHL_LRU plru, PCVOID pvkey, int iKeySize);
+};
+
+// -------------------------------------------
+// Functions exported
+
+// Creates an LRU cache and returns a pointer which can be used for later operations on it.
+// The cache has the same key and value semantics as CHL_FHTABLE: string keys are compared
+// as iKeySize bytes. Each entry is charged sizeof(LRU_NODE) plus the size of its string key
+// and of its string or user object value, the memory pointed to by CHL_VT_POINTER values
+// is not charged. Inserts evict the least recently used entries until the cache is within
+// both capacities again.
+// Params:
+//      pLruOut: Address of pointer where to copy the pointer to the cache
+//      keyType: Type of variable that is used as key - a string or a number
+//      valType: Type of value that is stored - number, string or void(can be anything)
+//      fValInHeapMem: Set this to true if the value(type is CHL_VT_POINTER) is allocated memory on the heap.
+//                     This indicates the cache to free it when an entry is evicted or removed.
+//      nMaxEntries: Most entries the cache may hold, 0 for no limit.
+//      cbMaxBytes: Most bytes the entries may be charged, 0 for no limit. At least one of
+//                  nMaxEntries and cbMaxBytes must be specified.
+//      pfnEvict: Optional. Called for each evicted entry.
+//      pvEvictContext: Optional. Passed to pfnEvict.
+//
+DllExpImp HRESULT CHL_DsCreateLRU(
+    _Out_ CHL_LRU **pLruOut,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ UINT nMaxEntries,
+    _In_ SIZE_T cbMaxBytes,
+    _In_opt_ CHL_LRU_EVICT_FN pfnEvict,
+    _In_opt_ PVOID pvEvictContext);
+
+// Destroy the cache by removing all key-value pairs from it. The eviction callback is not called.
+// The CHL_LRU object itself is also destroyed.
+// Params:
+//      plru: Pointer to the cache object returned by CHL_DsCreateLRU function.
+//
+DllExpImp HRESULT CHL_DsDestroyLRU(_In_ CHL_LRU *plru);
+
+// Inserts a key,value pair into the cache as the most recently used entry. If the key already
+// exists, then the value is over-written with the new value. Then evicts the least recently used
+// entries while the cache is over capacity, the new entry itself is never evicted.
+// An entry that alone is charged more than cbMaxBytes is not inserted, E_INVALIDARG is returned.
+// Params: Refer documentation of the CHL_DsInsertHT() function.
+//
+DllExpImp HRESULT CHL_DsInsertLRU(
+    _In_ CHL_LRU *plru,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize);
+
+// Find the specified key in the cache. If found, the entry becomes the most recently used.
+// With fGetPointerOnly, the returned pointer is valid until the entry is evicted, removed or updated.
+// Params: Refer documentation of the CHL_DsFindHT() function.
+//
+DllExpImp HRESULT CHL_DsFindLRU(
+    _In_ CHL_LRU *plru,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pvalsize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+// Deletes the specified key from the cache. The eviction callback is not called.
+// Params:
+//      plru: Pointer to the cache object returned by CHL_DsCreateLRU function.
+//      pvkey: Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//
+DllExpImp HRESULT CHL_DsRemoveLRU(_In_ CHL_LRU *plru, _In_ PCVOID pvkey, _In_ int iKeySize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _LRUCACHE_H
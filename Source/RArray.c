@@ -5,17 +5,196 @@
 #define RARRAY_MIN_SIZE             1
 #define RARRAY_MAX_SIZE_NOLIMIT     0
 
-static __inline UINT _CalcValArrayBytesForSize(_In_ UINT uiSize);
-static __inline UINT _CalcNewSizeGrow(_In_ PCHL_RARRAY pra);
-static __inline UINT _CalcNewSizeShrink(_In_ PCHL_RARRAY pra);
+#define RA_IS_PACKED(pra)           ((pra)->cbPackedVal != 0)
+#define RA_IS_ALLOCATED(pra)        (((pra)->pValArray != NULL) || ((pra)->pvPacked != NULL))
+
+// Occupancy bitmap of packed arrays, one bit per value
+#define RA_BITMAP_DWORDS(n)         (((SIZE_T)(n) + 31) / 32)
+#define RA_BITMAP_TEST(pdw, i)      (((pdw)[(i) >> 5] & (1UL << ((i) & 31))) != 0)
+#define RA_BITMAP_SET(pdw, i)       ((pdw)[(i) >> 5] |= (1UL << ((i) & 31)))
+#define RA_BITMAP_CLEAR(pdw, i)     ((pdw)[(i) >> 5] &= ~(1UL << ((i) & 31)))
+
+// Parallel algorithms
+#define RA_MAX_THREADS              MAXIMUM_WAIT_OBJECTS
+#define RA_MIN_VALS_PER_THREAD      (1 << 14)   // Fewer values than this are not worth a thread
+#define RA_CHUNKS_PER_THREAD        4           // So that threads that finish early take more work
+#define RA_MERGE_TASKS_PER_THREAD   4
+#define RA_SORT_RUN                 32          // Runs of this many values are insertion sorted
+#define RA_RADIX_BITS               8
+#define RA_RADIX_BUCKETS            (1 << RA_RADIX_BITS)
+
+#define RA_CHUNK_START(nVals, nChunks, iChunk)  ((UINT)(((ULONGLONG)(nVals) * (iChunk)) / (nChunks)))
+
+// Work items numbered from zero are handed to threads as they become free
+typedef void (*RA_WORK_FN)(_In_ PVOID pvWork, _In_ LONG lWork);
+
+typedef struct _raParallel
+{
+    RA_WORK_FN pfnWork;
+    PVOID pvWork;
+    volatile LONG lNextWork;
+    LONG lWorkItems;
+}RA_PARALLEL;
+
+// Merges values aStart to aEnd and bStart to bEnd of pbSrc to pbDst, from outStart on
+typedef struct _raMergeTask
+{
+    UINT aStart;
+    UINT aEnd;
+    UINT bStart;
+    UINT bEnd;
+    UINT outStart;
+}RA_MERGE_TASK;
+
+typedef struct _raSort
+{
+    PCHL_RARRAY pra;
+    CHL_CompareFn pfnCompare;
+    SIZE_T cbVal;               // Bytes per value, of the packed type or of CHL_VAL
+    UINT nVals;
+    UINT nChunks;               // Number of runs sorted on their own before merging
+    PBYTE pbVals;
+    PBYTE pbScratch;            // Room for nVals values
+    PBYTE pbSrc;                // Current merge round: merging from pbSrc to pbDst
+    PBYTE pbDst;
+    RA_MERGE_TASK *pTasks;
+}RA_SORT;
+
+// Sorts 32 or 64 bit keys, a digit of RA_RADIX_BITS per pass, stable within each pass
+typedef struct _raRadix
+{
+    PVOID pvSrc;
+    PVOID pvDst;
+    BOOL f64;
+    UINT nVals;
+    UINT nChunks;
+    UINT shift;                 // Digit of the current pass
+    BOOL fCounting;             // Counting digits, or placing keys
+    PUINT puCounts;             // RA_RADIX_BUCKETS per chunk: the count of each digit, then where it goes
+}RA_RADIX;
+
+// ForEach, Reduce and Scan over values split into chunks
+typedef struct _raChunked
+{
+    PCHL_RARRAY pra;
+    UINT nVals;
+    UINT nChunks;
+    CHL_RA_FOREACH_FN pfnForEach;
+    CHL_RA_COMBINE_FN pfnCombine;
+    PVOID pvContext;
+    PVOID *ppvPartials;         // Reduce and Scan: the values of each chunk combined
+    PBOOL pfHasPartial;         // Reduce and Scan: whether the chunk has any value
+}RA_CHUNKED;
+
+static __inline SIZE_T _CalcValArrayBytesForSize(_In_ PCHL_RARRAY pra, _In_ UINT uiSize);
+static __inline UINT _GetPackedValSize(_In_ CHL_VALTYPE valType);
+static __inline void _WritePacked(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pVal);
+static HRESULT _ReadPacked(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT index,
+    _Out_ PVOID pValBuf,
+    _Inout_opt_ PINT piBufSize,
+    _In_ BOOL fGetPointerOnly);
+static void _ClearPacked(_In_ PCHL_RARRAY pra, _In_ UINT index);
+static __inline PCVOID _GetValAsPCVOID(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType);
+static void _SetBitRange(_Inout_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits, _In_ BOOL fSet);
+static BOOL _AreBitsSet(_In_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits);
+static BOOL _AnyBitsSet(_In_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits);
+static void _CopyBitRange(_Inout_ PDWORD pdwDest, _In_ UINT destStart, _In_ PDWORD pdwSrc, _In_ UINT srcStart, _In_ UINT nBits);
+static void _CopyBits(
+    _Inout_ PDWORD pdwDest,
+    _In_ UINT destStart,
+    _In_ PDWORD pdwSrc,
+    _In_ UINT srcStart,
+    _In_ UINT nBits,
+    _In_ BOOL fBackward);
+static __inline DWORD _GetBits(_In_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits);
+static __inline void _SetBits(_Inout_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits, _In_ DWORD dwBits);
+static HRESULT _CheckRangeVals(
+    _In_ PCHL_RARRAY pra,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals);
+static HRESULT _WriteRangeVals(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT index,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals,
+    _Out_ PUINT pnWritten);
+static HRESULT _CheckCopyRange(
+    _In_ PCHL_RARRAY praDest,
+    _In_ UINT destIndex,
+    _In_ PCHL_RARRAY praSrc,
+    _In_ UINT srcIndex,
+    _In_ UINT nVals);
+static void _ClearRange(_In_ PCHL_RARRAY pra, _In_ UINT start, _In_ UINT end, _In_ BOOL fDeleteVals);
+static HRESULT _GrowSizeTo(_In_ PCHL_RARRAY pra, _In_ UINT newSize);
+static int _GetThreadCount(_In_ int nThreads, _In_ UINT nVals);
+static void _RunParallel(_In_ RA_WORK_FN pfnWork, _In_ PVOID pvWork, _In_ LONG lWorkItems, _In_ int nThreads);
+static DWORD WINAPI _ParallelWorker(_In_ LPVOID pvParallel);
+static UINT _CompactOccupied(_In_ PCHL_RARRAY pra);
+static __inline PCVOID _GetElemAsPCVOID(_In_ PCHL_RARRAY pra, _In_ PBYTE pbVal);
+static __inline BOOL _IsLess(_In_ RA_SORT *pSort, _In_ PBYTE pbLeft, _In_ PBYTE pbRight);
+static void _SortRunWork(_In_ PVOID pvSort, _In_ LONG lChunk);
+static void _MergeTaskWork(_In_ PVOID pvSort, _In_ LONG lTask);
+static void _MergeRuns(
+    _In_ RA_SORT *pSort,
+    _In_ PBYTE pbSrc,
+    _In_ UINT aStart,
+    _In_ UINT aEnd,
+    _In_ UINT bStart,
+    _In_ UINT bEnd,
+    _Out_ PBYTE pbDst,
+    _In_ UINT outStart);
+static UINT _FindMergeSplit(_In_ RA_SORT *pSort, _In_ UINT aStart, _In_ UINT aEnd, _In_ UINT bStart, _In_ UINT bEnd, _In_ UINT diag);
+static HRESULT _MergeSort(_In_ PCHL_RARRAY pra, _In_ CHL_CompareFn pfnCompare, _In_ UINT nVals, _In_ int nThreads);
+static HRESULT _RadixSort(_In_ PCHL_RARRAY pra, _In_ UINT nVals, _In_ int nThreads);
+static PVOID _RadixSortKeys(_In_ PVOID pvKeys, _In_ PVOID pvScratch, _In_ BOOL f64, _In_ UINT nVals, _In_ int nThreads);
+static void _RadixWork(_In_ PVOID pvRadix, _In_ LONG lChunk);
+static __inline PVOID _GetValPtrInPlace(_In_ PCHL_RARRAY pra, _In_ UINT index);
+static __inline BOOL _IsOccupiedAt(_In_ PCHL_RARRAY pra, _In_ UINT index);
+static __inline void _SetPrimitiveAt(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pVal);
+static BOOL _ReduceRange(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT start,
+    _In_ UINT end,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _Out_ PVOID *ppvResult);
+static void _ScanRange(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT start,
+    _In_ UINT end,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_opt_ PCVOID pvCarry,
+    _In_ BOOL fHasCarry);
+static void _ForEachWork(_In_ PVOID pvChunked, _In_ LONG lChunk);
+static void _ReduceWork(_In_ PVOID pvChunked, _In_ LONG lChunk);
+static void _ScanWork(_In_ PVOID pvChunked, _In_ LONG lChunk);
+static HRESULT _AllocChunkPartials(_Inout_ RA_CHUNKED *pChunked);
+static __inline UINT _CalcNewCapacityGrow(_In_ PCHL_RARRAY pra, _In_ UINT uiSizeNeeded);
+static HRESULT _GrowToHold(_In_ PCHL_RARRAY pra, _In_ UINT uiSizeNeeded);
+static HRESULT _SetCapacity(_In_ PCHL_RARRAY pra, _In_ UINT newCapacity);
 
 
 HRESULT CHL_DsCreateRA(_Out_ PCHL_RARRAY pra, _In_ CHL_VALTYPE valType, _In_opt_ UINT initSize, _In_opt_ UINT maxSize)
+{
+    return CHL_DsCreateExRA(pra, valType, initSize, maxSize, 0);
+}
+
+HRESULT CHL_DsCreateExRA(
+    _Out_ PCHL_RARRAY pra,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ UINT initSize,
+    _In_opt_ UINT maxSize,
+    _In_ DWORD dwFlags)
 {
     HRESULT hr = S_OK;
 
     // validate parameters
-    if (IS_INVALID_CHL_VALTYPE(valType))
+    if (IS_INVALID_CHL_VALTYPE(valType) || ((dwFlags & ~CHL_RA_FLAG_PACKED) != 0))
     {
         hr = E_INVALIDARG;
         goto func_end;
@@ -23,14 +202,24 @@ HRESULT CHL_DsCreateRA(_Out_ PCHL_RARRAY pra, _In_ CHL_VALTYPE valType, _In_opt_
 
     memset(pra, 0, sizeof(*pra));
 
+    if (dwFlags & CHL_RA_FLAG_PACKED)
+    {
+        pra->cbPackedVal = _GetPackedValSize(valType);
+        if (pra->cbPackedVal == 0)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+            goto func_end;
+        }
+    }
+
     pra->curSize = max(initSize, RARRAY_MIN_SIZE);
     pra->maxSize = maxSize;
     pra->vt = valType;
 
-    pra->pValArray = (CHL_VAL*)malloc(_CalcValArrayBytesForSize(pra->curSize));
-    if (pra->pValArray == NULL)
+    // New values are zeroed, so that none is occupied
+    hr = _SetCapacity(pra, pra->curSize);
+    if (FAILED(hr))
     {
-        hr = E_OUTOFMEMORY;
         goto func_end;
     }
 
@@ -40,8 +229,23 @@ HRESULT CHL_DsCreateRA(_Out_ PCHL_RARRAY pra, _In_ CHL_VALTYPE valType, _In_opt_
     pra->Write = CHL_DsWriteRA;
     pra->ClearAt = CHL_DsClearAtRA;
     pra->Resize = CHL_DsResizeRA;
+    pra->Append = CHL_DsAppendRA;
+    pra->Reserve = CHL_DsReserveRA;
+    pra->ShrinkToFit = CHL_DsShrinkToFitRA;
     pra->Size = CHL_DsSizeRA;
     pra->MaxSize = CHL_DsMaxSizeRA;
+    pra->Length = CHL_DsLengthRA;
+    pra->Capacity = CHL_DsCapacityRA;
+    pra->GetData = CHL_DsGetDataRA;
+    pra->WriteRange = CHL_DsWriteRangeRA;
+    pra->AppendRange = CHL_DsAppendRangeRA;
+    pra->ReadRange = CHL_DsReadRangeRA;
+    pra->CopyRange = CHL_DsCopyRangeRA;
+    pra->MoveRange = CHL_DsMoveRangeRA;
+    pra->Sort = CHL_DsSortRA;
+    pra->ForEach = CHL_DsForEachRA;
+    pra->Reduce = CHL_DsReduceRA;
+    pra->Scan = CHL_DsScanRA;
 
 func_end:
     return hr;
@@ -49,8 +253,15 @@ func_end:
 
 HRESULT CHL_DsDestroyRA(_In_ PCHL_RARRAY pra)
 {
+    free(pra->pvPacked);
+    free(pra->pdwOccupied);
+
     if (pra->pValArray != NULL)
     {
+        for (UINT idx = 0; idx < pra->curSize; ++idx)
+        {
+            _DeleteVal(&pra->pValArray[idx], pra->vt, FALSE);
+        }
         free(pra->pValArray);
     }
     memset(pra, 0, sizeof(*pra));
@@ -60,7 +271,7 @@ HRESULT CHL_DsDestroyRA(_In_ PCHL_RARRAY pra)
 HRESULT CHL_DsReadRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _Out_opt_ PVOID pValBuf,
     _Inout_opt_ PINT piBufSize, _In_ BOOL fGetPointerOnly)
 {
-    ASSERT(pra->pValArray != NULL);
+    ASSERT(RA_IS_ALLOCATED(pra));
     ASSERT(pra->curSize >= RARRAY_MIN_SIZE);
     ASSERT((pra->vt > CHL_VT_START) && (pra->vt < CHL_VT_END));
 
@@ -73,6 +284,19 @@ HRESULT CHL_DsReadRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _Out_opt_ PVOID pVal
         goto func_end;
     }
 
+    if (RA_IS_PACKED(pra))
+    {
+        if (!RA_BITMAP_TEST(pra->pdwOccupied, index))
+        {
+            hr = E_NOT_SET;
+        }
+        else if (pValBuf != NULL)
+        {
+            hr = _ReadPacked(pra, index, pValBuf, piBufSize, fGetPointerOnly);
+        }
+        goto func_end;
+    }
+
     pValToRead = &(pra->pValArray[index]);
     if (_IsValOccupied(pValToRead) == FALSE)
     {
@@ -91,31 +315,30 @@ func_end:
 
 HRESULT CHL_DsWriteRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pVal, _In_opt_ int iBufSize)
 {
-    ASSERT(pra->pValArray != NULL);
+    ASSERT(RA_IS_ALLOCATED(pra));
     ASSERT(pra->curSize >= RARRAY_MIN_SIZE);
     ASSERT((pra->vt > CHL_VT_START) && (pra->vt < CHL_VT_END));
 
     HRESULT hr = S_OK;
-    
+
+    if (RA_IS_PACKED(pra))
+    {
+        // As with CHL_VAL storage, a NULL pointer cannot be stored
+        if ((pra->vt == CHL_VT_POINTER) && (pVal == NULL))
+        {
+            hr = E_INVALIDARG;
+            goto func_end;
+        }
+    }
     // Size parameter validation
-    if (iBufSize <= 0 && FAILED(_GetValSize(pVal, pra->vt, &iBufSize)))
+    else if (iBufSize <= 0 && FAILED(_GetValSize(pVal, pra->vt, &iBufSize)))
     {
         logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
         hr = E_INVALIDARG;
         goto func_end;
     }
 
-    if (index >= pra->curSize)
-    {
-        UINT newSize = _CalcNewSizeGrow(pra);
-        hr = pra->Resize(pra, newSize);
-    }
-
-    if (SUCCEEDED(hr) && (index >= pra->curSize))
-    {
-        hr = HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
-    }
-
+    hr = (index < MAXUINT) ? _GrowSizeTo(pra, index + 1) : HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
     if (FAILED(hr))
     {
         goto func_end;
@@ -123,7 +346,19 @@ HRESULT CHL_DsWriteRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pVal, _
 
     ASSERT(index < pra->curSize);
 
-    hr = _CopyValIn(&pra->pValArray[index], pra->vt, pVal, iBufSize);
+    if (RA_IS_PACKED(pra))
+    {
+        _WritePacked(pra, index, pVal);
+    }
+    else
+    {
+        _DeleteVal(&pra->pValArray[index], pra->vt, FALSE);
+        hr = _CopyValIn(&pra->pValArray[index], pra->vt, pVal, iBufSize);
+    }
+    if (SUCCEEDED(hr) && (index >= pra->length))
+    {
+        pra->length = index + 1;
+    }
 
 func_end:
     return hr;
@@ -131,7 +366,7 @@ func_end:
 
 HRESULT CHL_DsClearAtRA(_In_ PCHL_RARRAY pra, _In_ UINT index)
 {
-    ASSERT(pra->pValArray != NULL);
+    ASSERT(RA_IS_ALLOCATED(pra));
 
     HRESULT hr = S_OK;
 
@@ -141,6 +376,12 @@ HRESULT CHL_DsClearAtRA(_In_ PCHL_RARRAY pra, _In_ UINT index)
         goto func_end;
     }
 
+    if (RA_IS_PACKED(pra))
+    {
+        _ClearPacked(pra, index);
+        goto func_end;
+    }
+
     PCHL_VAL pChlVal = &pra->pValArray[index];
     _DeleteVal(pChlVal, pra->vt, FALSE);
     // TODO: Revisit and see if fValIsInHeap is a necessary feature
@@ -151,12 +392,11 @@ func_end:
 
 HRESULT CHL_DsResizeRA(_In_ PCHL_RARRAY pra, _In_ UINT newSize)
 {
-    ASSERT(pra->pValArray != NULL);
+    ASSERT(RA_IS_ALLOCATED(pra));
     ASSERT((newSize >= RARRAY_MIN_SIZE) &&
         ((pra->maxSize == RARRAY_MAX_SIZE_NOLIMIT) || (newSize <= pra->maxSize)));
 
     HRESULT hr = S_OK;
-    PVOID pvNew = NULL;
 
     if ((newSize < RARRAY_MIN_SIZE) ||
         ((pra->maxSize != RARRAY_MAX_SIZE_NOLIMIT) && (newSize > pra->maxSize)))
@@ -185,21 +425,72 @@ HRESULT CHL_DsResizeRA(_In_ PCHL_RARRAY pra, _In_ UINT newSize)
         }
     }
 
-    pvNew = realloc(pra->pValArray, _CalcValArrayBytesForSize(newSize));
-    if (pvNew != NULL)
+    if ((curSize > newSize) || (newSize > pra->capacity))
+    {
+        hr = _SetCapacity(pra, newSize);
+    }
+
+    if (SUCCEEDED(hr))
     {
-        pra->pValArray = pvNew;
         pra->curSize = newSize;
+        pra->length = min(pra->length, newSize);
     }
-    else
+
+func_end:
+    return hr;
+}
+
+HRESULT CHL_DsAppendRA(_In_ PCHL_RARRAY pra, _In_ PCVOID pVal, _In_opt_ int iBufSize, _Out_opt_ PUINT puIndex)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    UINT index = pra->length;
+
+    hr = CHL_DsWriteRA(pra, index, pVal, iBufSize);
+    if (SUCCEEDED(hr))
     {
-        hr = E_OUTOFMEMORY;
+        IFPTR_SETVAL(puIndex, index);
+    }
+
+    return hr;
+}
+
+HRESULT CHL_DsReserveRA(_In_ PCHL_RARRAY pra, _In_ UINT newCapacity)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+
+    if ((pra->maxSize != RARRAY_MAX_SIZE_NOLIMIT) && (newCapacity > pra->maxSize))
+    {
+        hr = E_INVALIDARG;
+        goto func_end;
+    }
+
+    if (newCapacity > pra->capacity)
+    {
+        hr = _SetCapacity(pra, newCapacity);
     }
 
 func_end:
     return hr;
 }
 
+HRESULT CHL_DsShrinkToFitRA(_In_ PCHL_RARRAY pra)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+
+    if (pra->capacity > pra->curSize)
+    {
+        hr = _SetCapacity(pra, pra->curSize);
+    }
+
+    return hr;
+}
+
 UINT CHL_DsSizeRA(_In_ PCHL_RARRAY pra)
 {
     return pra->curSize;
@@ -210,18 +501,1765 @@ UINT CHL_DsMaxSizeRA(_In_ PCHL_RARRAY pra)
     return pra->maxSize;
 }
 
-__inline UINT _CalcValArrayBytesForSize(_In_ UINT uiSize)
+UINT CHL_DsLengthRA(_In_ PCHL_RARRAY pra)
 {
-    ASSERT(uiSize > 0);
-    return (uiSize * sizeof(CHL_VAL));
+    return pra->length;
+}
+
+UINT CHL_DsCapacityRA(_In_ PCHL_RARRAY pra)
+{
+    return pra->capacity;
+}
+
+HRESULT CHL_DsGetDataRA(_In_ PCHL_RARRAY pra, _Out_ PVOID *ppvData, _Out_opt_ PDWORD *ppdwOccupied)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    if (!RA_IS_PACKED(pra))
+    {
+        *ppvData = NULL;
+        IFPTR_SETVAL(ppdwOccupied, NULL);
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    *ppvData = pra->pvPacked;
+    IFPTR_SETVAL(ppdwOccupied, pra->pdwOccupied);
+    return S_OK;
+}
+
+HRESULT CHL_DsWriteRangeRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT index,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    UINT nWritten = nVals;
+
+    if (nVals == 0)
+    {
+        goto func_end;
+    }
+
+    if (nVals > (MAXUINT - index))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+        goto func_end;
+    }
+
+    hr = _CheckRangeVals(pra, pvVals, piBufSizes, nVals);
+    if (FAILED(hr))
+    {
+        goto func_end;
+    }
+
+    hr = _GrowSizeTo(pra, index + nVals);
+    if (FAILED(hr))
+    {
+        goto func_end;
+    }
+
+    if (RA_IS_PACKED(pra))
+    {
+        memcpy((PBYTE)pra->pvPacked + ((SIZE_T)index * pra->cbPackedVal), pvVals, (SIZE_T)nVals * pra->cbPackedVal);
+        _SetBitRange(pra->pdwOccupied, index, nVals, TRUE);
+    }
+    else
+    {
+        hr = _WriteRangeVals(pra, index, pvVals, piBufSizes, nVals, &nWritten);
+    }
+
+    pra->length = max(pra->length, index + nWritten);
+
+func_end:
+    return hr;
+}
+
+HRESULT CHL_DsAppendRangeRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals,
+    _Out_opt_ PUINT puIndex)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    UINT index = pra->length;
+
+    hr = CHL_DsWriteRangeRA(pra, index, pvVals, piBufSizes, nVals);
+    if (SUCCEEDED(hr))
+    {
+        IFPTR_SETVAL(puIndex, index);
+    }
+
+    return hr;
+}
+
+HRESULT CHL_DsReadRangeRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ UINT nVals, _Out_ PVOID pvValBuf)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    BOOL fAllOccupied = TRUE;
+
+    if ((index > pra->curSize) || (nVals > (pra->curSize - index)))
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+        goto func_end;
+    }
+
+    if (RA_IS_PACKED(pra))
+    {
+        // Values that are not occupied are zeroed already
+        memcpy(pvValBuf, (PBYTE)pra->pvPacked + ((SIZE_T)index * pra->cbPackedVal), (SIZE_T)nVals * pra->cbPackedVal);
+        fAllOccupied = _AreBitsSet(pra->pdwOccupied, index, nVals);
+    }
+    else
+    {
+        PCHL_VAL pValsToRead = &pra->pValArray[index];
+        BOOL fPrimitive32 = (pra->vt == CHL_VT_INT32) || (pra->vt == CHL_VT_UINT32);
+
+        for (UINT idx = 0; idx < nVals; ++idx)
+        {
+            BOOL fOccupied = _IsValOccupied(&pValsToRead[idx]);
+
+            fAllOccupied = fAllOccupied && fOccupied;
+            if (fPrimitive32)
+            {
+                ((PUINT)pvValBuf)[idx] = fOccupied ? pValsToRead[idx].valDef.uiVal : 0;
+            }
+            else
+            {
+                ((PVOID*)pvValBuf)[idx] = fOccupied ? (PVOID)_GetValAsPCVOID(&pValsToRead[idx], pra->vt) : NULL;
+            }
+        }
+    }
+
+    hr = fAllOccupied ? S_OK : S_FALSE;
+
+func_end:
+    return hr;
 }
 
-__inline UINT _CalcNewSizeGrow(_In_ PCHL_RARRAY pra)
+HRESULT CHL_DsCopyRangeRA(
+    _In_ PCHL_RARRAY praDest,
+    _In_ UINT destIndex,
+    _In_ PCHL_RARRAY praSrc,
+    _In_ UINT srcIndex,
+    _In_ UINT nVals)
 {
-    return (pra->maxSize > 0) ? min(pra->curSize * 2, pra->maxSize) : (pra->curSize * 2);
+    HRESULT hr = S_OK;
+
+    hr = _CheckCopyRange(praDest, destIndex, praSrc, srcIndex, nVals);
+    if (FAILED(hr) || (nVals == 0) || ((praDest == praSrc) && (destIndex == srcIndex)))
+    {
+        goto func_end;
+    }
+
+    hr = _GrowSizeTo(praDest, destIndex + nVals);
+    if (FAILED(hr))
+    {
+        goto func_end;
+    }
+
+    if (RA_IS_PACKED(praDest))
+    {
+        memmove((PBYTE)praDest->pvPacked + ((SIZE_T)destIndex * praDest->cbPackedVal),
+            (PBYTE)praSrc->pvPacked + ((SIZE_T)srcIndex * praSrc->cbPackedVal),
+            (SIZE_T)nVals * praDest->cbPackedVal);
+        _CopyBitRange(praDest->pdwOccupied, destIndex, praSrc->pdwOccupied, srcIndex, nVals);
+    }
+    else if (_GetPackedValSize(praDest->vt) > 0)
+    {
+        // Values of primitive types are entirely within their CHL_VAL
+        memmove(&praDest->pValArray[destIndex], &praSrc->pValArray[srcIndex], (SIZE_T)nVals * sizeof(CHL_VAL));
+    }
+    else
+    {
+        // Within an array, copy in the direction that reads each value before it is overwritten
+        BOOL fBackward = (praDest == praSrc) && (destIndex > srcIndex);
+
+        for (UINT i = 0; i < nVals; ++i)
+        {
+            UINT offset = fBackward ? (nVals - 1 - i) : i;
+            PCHL_VAL pDestVal = &praDest->pValArray[destIndex + offset];
+            PCHL_VAL pSrcVal = &praSrc->pValArray[srcIndex + offset];
+
+            _DeleteVal(pDestVal, praDest->vt, FALSE);
+            if (_IsValOccupied(pSrcVal))
+            {
+                hr = _CopyValIn(pDestVal, praDest->vt, _GetValAsPCVOID(pSrcVal, praSrc->vt), pSrcVal->iValSize);
+                if (FAILED(hr))
+                {
+                    goto func_end;
+                }
+            }
+        }
+    }
+
+    praDest->length = max(praDest->length, destIndex + nVals);
+
+func_end:
+    return hr;
 }
 
-__inline UINT _CalcNewSizeShrink(_In_ PCHL_RARRAY pra)
+HRESULT CHL_DsMoveRangeRA(
+    _In_ PCHL_RARRAY praDest,
+    _In_ UINT destIndex,
+    _In_ PCHL_RARRAY praSrc,
+    _In_ UINT srcIndex,
+    _In_ UINT nVals)
 {
-    return max(pra->curSize / 2, RARRAY_MIN_SIZE);
+    HRESULT hr = S_OK;
+    UINT destEnd = destIndex + nVals;
+    UINT srcEnd = srcIndex + nVals;
+
+    hr = _CheckCopyRange(praDest, destIndex, praSrc, srcIndex, nVals);
+    if (FAILED(hr) || (nVals == 0) || ((praDest == praSrc) && (destIndex == srcIndex)))
+    {
+        goto func_end;
+    }
+
+    hr = _GrowSizeTo(praDest, destEnd);
+    if (FAILED(hr))
+    {
+        goto func_end;
+    }
+
+    // Values about to be overwritten are released, except the ones that are themselves moved
+    if (praDest != praSrc)
+    {
+        _ClearRange(praDest, destIndex, destEnd, TRUE);
+    }
+    else if (destIndex > srcIndex)
+    {
+        _ClearRange(praDest, max(srcEnd, destIndex), destEnd, TRUE);
+    }
+    else
+    {
+        _ClearRange(praDest, destIndex, min(srcIndex, destEnd), TRUE);
+    }
+
+    if (RA_IS_PACKED(praDest))
+    {
+        memmove((PBYTE)praDest->pvPacked + ((SIZE_T)destIndex * praDest->cbPackedVal),
+            (PBYTE)praSrc->pvPacked + ((SIZE_T)srcIndex * praSrc->cbPackedVal),
+            (SIZE_T)nVals * praDest->cbPackedVal);
+        _CopyBitRange(praDest->pdwOccupied, destIndex, praSrc->pdwOccupied, srcIndex, nVals);
+    }
+    else
+    {
+        memmove(&praDest->pValArray[destIndex], &praSrc->pValArray[srcIndex], (SIZE_T)nVals * sizeof(CHL_VAL));
+    }
+
+    // The values left behind are owned by the destination now, so they are only zeroed
+    if (praDest != praSrc)
+    {
+        _ClearRange(praSrc, srcIndex, srcEnd, FALSE);
+    }
+    else if (destIndex > srcIndex)
+    {
+        _ClearRange(praSrc, srcIndex, min(destIndex, srcEnd), FALSE);
+    }
+    else
+    {
+        _ClearRange(praSrc, max(destEnd, srcIndex), srcEnd, FALSE);
+    }
+
+    praDest->length = max(praDest->length, destEnd);
+
+func_end:
+    return hr;
 }
+
+HRESULT CHL_DsSortRA(_In_ PCHL_RARRAY pra, _In_opt_ CHL_CompareFn pfnCompare, _In_ int nThreads)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    UINT nVals;
+
+    if ((nThreads < 0) || ((pfnCompare == NULL) && (_GetPackedValSize(pra->vt) == 0)))
+    {
+        hr = E_INVALIDARG;
+        goto func_end;
+    }
+
+    nVals = _CompactOccupied(pra);
+    if (nVals < 2)
+    {
+        goto func_end;
+    }
+
+    nThreads = _GetThreadCount(nThreads, nVals);
+    hr = (pfnCompare == NULL) ? _RadixSort(pra, nVals, nThreads) : _MergeSort(pra, pfnCompare, nVals, nThreads);
+
+func_end:
+    return hr;
+}
+
+HRESULT CHL_DsForEachRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ CHL_RA_FOREACH_FN pfnForEach,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    RA_CHUNKED chunked;
+
+    if ((pfnForEach == NULL) || (nThreads < 0))
+    {
+        hr = E_INVALIDARG;
+        goto func_end;
+    }
+
+    ZeroMemory(&chunked, sizeof(chunked));
+    chunked.pra = pra;
+    chunked.nVals = pra->length;
+    chunked.pfnForEach = pfnForEach;
+    chunked.pvContext = pvContext;
+
+    nThreads = _GetThreadCount(nThreads, chunked.nVals);
+    chunked.nChunks = (nThreads > 1) ? (nThreads * RA_CHUNKS_PER_THREAD) : 1;
+    _RunParallel(_ForEachWork, &chunked, chunked.nChunks, nThreads);
+
+func_end:
+    return hr;
+}
+
+HRESULT CHL_DsReduceRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads,
+    _Out_ PVOID *ppvResult)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    RA_CHUNKED chunked;
+    BOOL fHasResult = FALSE;
+    PVOID pvResult = NULL;
+
+    ZeroMemory(&chunked, sizeof(chunked));
+
+    if ((pfnCombine == NULL) || (nThreads < 0) || (ppvResult == NULL))
+    {
+        hr = E_INVALIDARG;
+        goto func_end;
+    }
+
+    chunked.pra = pra;
+    chunked.nVals = pra->length;
+    chunked.pfnCombine = pfnCombine;
+    chunked.pvContext = pvContext;
+
+    nThreads = _GetThreadCount(nThreads, chunked.nVals);
+    if (nThreads == 1)
+    {
+        fHasResult = _ReduceRange(pra, 0, chunked.nVals, pfnCombine, pvContext, &pvResult);
+    }
+    else
+    {
+        chunked.nChunks = nThreads * RA_CHUNKS_PER_THREAD;
+        hr = _AllocChunkPartials(&chunked);
+        if (FAILED(hr))
+        {
+            goto func_end;
+        }
+
+        _RunParallel(_ReduceWork, &chunked, chunked.nChunks, nThreads);
+
+        // Chunks are combined in order
+        for (UINT iChunk = 0; iChunk < chunked.nChunks; ++iChunk)
+        {
+            if (chunked.pfHasPartial[iChunk])
+            {
+                pvResult = fHasResult ?
+                    pfnCombine(pvResult, chunked.ppvPartials[iChunk], pra->vt, pvContext) : chunked.ppvPartials[iChunk];
+                fHasResult = TRUE;
+            }
+        }
+    }
+
+    *ppvResult = pvResult;
+    hr = fHasResult ? S_OK : E_NOT_SET;
+
+func_end:
+    free(chunked.ppvPartials);
+    free(chunked.pfHasPartial);
+    return hr;
+}
+
+HRESULT CHL_DsScanRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads)
+{
+    ASSERT(RA_IS_ALLOCATED(pra));
+
+    HRESULT hr = S_OK;
+    RA_CHUNKED chunked;
+    BOOL fHasCarry = FALSE;
+    PVOID pvCarry = NULL;
+
+    ZeroMemory(&chunked, sizeof(chunked));
+
+    if ((pfnCombine == NULL) || (nThreads < 0))
+    {
+        hr = E_INVALIDARG;
+        goto func_end;
+    }
+
+    // Combined values are stored in the array, which only works for values that are not copies
+    if (_GetPackedValSize(pra->vt) == 0)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+        goto func_end;
+    }
+
+    chunked.pra = pra;
+    chunked.nVals = pra->length;
+    chunked.pfnCombine = pfnCombine;
+    chunked.pvContext = pvContext;
+
+    nThreads = _GetThreadCount(nThreads, chunked.nVals);
+    if (nThreads == 1)
+    {
+        _ScanRange(pra, 0, chunked.nVals, pfnCombine, pvContext, NULL, FALSE);
+        goto func_end;
+    }
+
+    chunked.nChunks = nThreads * RA_CHUNKS_PER_THREAD;
+    hr = _AllocChunkPartials(&chunked);
+    if (FAILED(hr))
+    {
+        goto func_end;
+    }
+
+    // Each chunk is combined on its own, then scanned starting from the chunks before it combined
+    _RunParallel(_ReduceWork, &chunked, chunked.nChunks, nThreads);
+    for (UINT iChunk = 0; iChunk < chunked.nChunks; ++iChunk)
+    {
+        BOOL fHasPartial = chunked.pfHasPartial[iChunk];
+        PVOID pvPartial = chunked.ppvPartials[iChunk];
+
+        chunked.ppvPartials[iChunk] = pvCarry;
+        chunked.pfHasPartial[iChunk] = fHasCarry;
+        if (fHasPartial)
+        {
+            pvCarry = fHasCarry ? pfnCombine(pvCarry, pvPartial, pra->vt, pvContext) : pvPartial;
+            fHasCarry = TRUE;
+        }
+    }
+    _RunParallel(_ScanWork, &chunked, chunked.nChunks, nThreads);
+
+func_end:
+    free(chunked.ppvPartials);
+    free(chunked.pfHasPartial);
+    return hr;
+}
+
+PVOID CHL_DsCombineSumRA(_In_ PCVOID pvLeft, _In_ PCVOID pvRight, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext)
+{
+    UNREFERENCED_PARAMETER(pvContext);
+
+    switch (valType)
+    {
+    case CHL_VT_INT32:
+        return (PVOID)(INT_PTR)(int)((UINT)(UINT_PTR)pvLeft + (UINT)(UINT_PTR)pvRight);
+
+    case CHL_VT_UINT32:
+        return (PVOID)(UINT_PTR)((UINT)(UINT_PTR)pvLeft + (UINT)(UINT_PTR)pvRight);
+
+    default:
+        return (PVOID)pvLeft;
+    }
+}
+
+PVOID CHL_DsCombineMinRA(_In_ PCVOID pvLeft, _In_ PCVOID pvRight, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext)
+{
+    UNREFERENCED_PARAMETER(pvContext);
+
+    switch (valType)
+    {
+    case CHL_VT_INT32:
+        return ((int)(INT_PTR)pvRight < (int)(INT_PTR)pvLeft) ? (PVOID)pvRight : (PVOID)pvLeft;
+
+    case CHL_VT_UINT32:
+        return ((UINT)(UINT_PTR)pvRight < (UINT)(UINT_PTR)pvLeft) ? (PVOID)pvRight : (PVOID)pvLeft;
+
+    case CHL_VT_POINTER:
+        return ((UINT_PTR)pvRight < (UINT_PTR)pvLeft) ? (PVOID)pvRight : (PVOID)pvLeft;
+
+    default:
+        return (PVOID)pvLeft;
+    }
+}
+
+PVOID CHL_DsCombineMaxRA(_In_ PCVOID pvLeft, _In_ PCVOID pvRight, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext)
+{
+    UNREFERENCED_PARAMETER(pvContext);
+
+    switch (valType)
+    {
+    case CHL_VT_INT32:
+        return ((int)(INT_PTR)pvRight > (int)(INT_PTR)pvLeft) ? (PVOID)pvRight : (PVOID)pvLeft;
+
+    case CHL_VT_UINT32:
+        return ((UINT)(UINT_PTR)pvRight > (UINT)(UINT_PTR)pvLeft) ? (PVOID)pvRight : (PVOID)pvLeft;
+
+    case CHL_VT_POINTER:
+        return ((UINT_PTR)pvRight > (UINT_PTR)pvLeft) ? (PVOID)pvRight : (PVOID)pvLeft;
+
+    default:
+        return (PVOID)pvLeft;
+    }
+}
+
+__inline SIZE_T _CalcValArrayBytesForSize(_In_ PCHL_RARRAY pra, _In_ UINT uiSize)
+{
+    ASSERT(uiSize > 0);
+    return ((SIZE_T)uiSize * (RA_IS_PACKED(pra) ? pra->cbPackedVal : sizeof(CHL_VAL)));
+}
+
+// Bytes per value of packed arrays, zero if the value type cannot be packed
+__inline UINT _GetPackedValSize(_In_ CHL_VALTYPE valType)
+{
+    switch (valType)
+    {
+    case CHL_VT_INT32:
+        return sizeof(int);
+
+    case CHL_VT_UINT32:
+        return sizeof(UINT);
+
+    case CHL_VT_POINTER:
+        return sizeof(PVOID);
+
+    default:
+        return 0;
+    }
+}
+
+__inline void _WritePacked(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pVal)
+{
+    if (pra->vt == CHL_VT_POINTER)
+    {
+        ((PVOID*)pra->pvPacked)[index] = pVal;
+    }
+    else
+    {
+        // int and UINT values are stored alike
+        ((PUINT)pra->pvPacked)[index] = (UINT)(UINT_PTR)pVal;
+    }
+    RA_BITMAP_SET(pra->pdwOccupied, index);
+}
+
+// Copies out an occupied value, checking the buffer size as _CopyValOut does
+HRESULT _ReadPacked(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT index,
+    _Out_ PVOID pValBuf,
+    _Inout_opt_ PINT piBufSize,
+    _In_ BOOL fGetPointerOnly)
+{
+    ASSERT(RA_BITMAP_TEST(pra->pdwOccupied, index));
+
+    if (!fGetPointerOnly && (piBufSize != NULL) && (*piBufSize > 0) && ((UINT)*piBufSize < pra->cbPackedVal))
+    {
+        *piBufSize = (int)pra->cbPackedVal;
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    if (pra->vt == CHL_VT_POINTER)
+    {
+        *((PVOID*)pValBuf) = ((PVOID*)pra->pvPacked)[index];
+    }
+    else
+    {
+        *((PUINT)pValBuf) = ((PUINT)pra->pvPacked)[index];
+    }
+    return S_OK;
+}
+
+// Values that are not occupied are kept zeroed, as seen through CHL_DsGetDataRA
+void _ClearPacked(_In_ PCHL_RARRAY pra, _In_ UINT index)
+{
+    RA_BITMAP_CLEAR(pra->pdwOccupied, index);
+    memset((PBYTE)pra->pvPacked + ((SIZE_T)index * pra->cbPackedVal), 0, pra->cbPackedVal);
+}
+
+// The value as it would have been passed to CHL_DsWriteRA
+__inline PCVOID _GetValAsPCVOID(_In_ PCHL_VAL pChlVal, _In_ CHL_VALTYPE valType)
+{
+    switch (valType)
+    {
+    case CHL_VT_INT32:
+        return (PCVOID)(INT_PTR)pChlVal->valDef.iVal;
+
+    case CHL_VT_UINT32:
+        return (PCVOID)(UINT_PTR)pChlVal->valDef.uiVal;
+
+    case CHL_VT_POINTER:
+        return pChlVal->valDef.pvPtr;
+
+    case CHL_VT_USEROBJECT:
+        return pChlVal->valDef.pvUserObj;
+
+    case CHL_VT_STRING:
+        return pChlVal->valDef.pszVal;
+
+    case CHL_VT_WSTRING:
+        return pChlVal->valDef.pwszVal;
+
+    default:
+        return NULL;
+    }
+}
+
+// Sets or clears nBits bits from bit start on, a DWORD at a time
+void _SetBitRange(_Inout_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits, _In_ BOOL fSet)
+{
+    while (nBits > 0)
+    {
+        UINT shift = start & 31;
+        UINT nInDword = min(32 - shift, nBits);
+        DWORD dwMask = (nInDword == 32) ? MAXDWORD : (((1UL << nInDword) - 1) << shift);
+
+        if (fSet)
+        {
+            pdw[start >> 5] |= dwMask;
+        }
+        else
+        {
+            pdw[start >> 5] &= ~dwMask;
+        }
+        start += nInDword;
+        nBits -= nInDword;
+    }
+}
+
+BOOL _AreBitsSet(_In_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits)
+{
+    while (nBits > 0)
+    {
+        UINT shift = start & 31;
+        UINT nInDword = min(32 - shift, nBits);
+        DWORD dwMask = (nInDword == 32) ? MAXDWORD : (((1UL << nInDword) - 1) << shift);
+
+        if ((pdw[start >> 5] & dwMask) != dwMask)
+        {
+            return FALSE;
+        }
+        start += nInDword;
+        nBits -= nInDword;
+    }
+    return TRUE;
+}
+
+BOOL _AnyBitsSet(_In_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits)
+{
+    while (nBits > 0)
+    {
+        UINT shift = start & 31;
+        UINT nInDword = min(32 - shift, nBits);
+        DWORD dwMask = (nInDword == 32) ? MAXDWORD : (((1UL << nInDword) - 1) << shift);
+
+        if ((pdw[start >> 5] & dwMask) != 0)
+        {
+            return TRUE;
+        }
+        start += nInDword;
+        nBits -= nInDword;
+    }
+    return FALSE;
+}
+
+// Copies bits in the direction that allows the ranges to overlap. When the bits are at the same
+// offset within their DWORDs, whole DWORDs are copied at once.
+void _CopyBitRange(_Inout_ PDWORD pdwDest, _In_ UINT destStart, _In_ PDWORD pdwSrc, _In_ UINT srcStart, _In_ UINT nBits)
+{
+    BOOL fBackward = (pdwDest == pdwSrc) && (destStart > srcStart);
+    UINT nHead = nBits;
+    UINT nDwords = 0;
+    UINT nTail = 0;
+
+    if ((((destStart ^ srcStart) & 31) == 0) && (nBits >= 64))
+    {
+        nHead = (32 - (destStart & 31)) & 31;
+        nDwords = (nBits - nHead) / 32;
+        nTail = nBits - nHead - (nDwords * 32);
+    }
+
+    if (fBackward)
+    {
+        _CopyBits(pdwDest, destStart + nBits - nTail, pdwSrc, srcStart + nBits - nTail, nTail, TRUE);
+        memmove(&pdwDest[(destStart + nHead) >> 5], &pdwSrc[(srcStart + nHead) >> 5], (SIZE_T)nDwords * sizeof(DWORD));
+        _CopyBits(pdwDest, destStart, pdwSrc, srcStart, nHead, TRUE);
+    }
+    else
+    {
+        _CopyBits(pdwDest, destStart, pdwSrc, srcStart, nHead, FALSE);
+        memmove(&pdwDest[(destStart + nHead) >> 5], &pdwSrc[(srcStart + nHead) >> 5], (SIZE_T)nDwords * sizeof(DWORD));
+        _CopyBits(pdwDest, destStart + nBits - nTail, pdwSrc, srcStart + nBits - nTail, nTail, FALSE);
+    }
+}
+
+void _CopyBits(
+    _Inout_ PDWORD pdwDest,
+    _In_ UINT destStart,
+    _In_ PDWORD pdwSrc,
+    _In_ UINT srcStart,
+    _In_ UINT nBits,
+    _In_ BOOL fBackward)
+{
+    // Up to 32 bits at a time. Each chunk is read whole before it is written, and chunks go in the
+    // direction that does not overwrite source bits not yet copied.
+    for (UINT done = 0; done < nBits; )
+    {
+        UINT n = min(32, nBits - done);
+        UINT offset = fBackward ? (nBits - done - n) : done;
+
+        _SetBits(pdwDest, destStart + offset, n, _GetBits(pdwSrc, srcStart + offset, n));
+        done += n;
+    }
+}
+
+// Returns nBits (1 to 32) bits of the bitmap from the specified bit onwards, in the low bits
+__inline DWORD _GetBits(_In_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits)
+{
+    UINT iDword = start >> 5;
+    UINT shift = start & 31;
+    ULONGLONG ullBits = pdw[iDword] >> shift;
+
+    if (shift + nBits > 32)
+    {
+        ullBits |= (ULONGLONG)pdw[iDword + 1] << (32 - shift);
+    }
+    return (DWORD)(ullBits & ((1ULL << nBits) - 1));
+}
+
+// Sets nBits (1 to 32) bits of the bitmap from the specified bit onwards to the low bits of dwBits
+__inline void _SetBits(_Inout_ PDWORD pdw, _In_ UINT start, _In_ UINT nBits, _In_ DWORD dwBits)
+{
+    UINT iDword = start >> 5;
+    UINT shift = start & 31;
+    ULONGLONG ullMask = ((1ULL << nBits) - 1) << shift;
+    ULONGLONG ullBits = ((ULONGLONG)dwBits << shift) & ullMask;
+
+    pdw[iDword] = (pdw[iDword] & ~(DWORD)ullMask) | (DWORD)ullBits;
+    if (shift + nBits > 32)
+    {
+        pdw[iDword + 1] = (pdw[iDword + 1] & ~(DWORD)(ullMask >> 32)) | (DWORD)(ullBits >> 32);
+    }
+}
+
+// Values are checked before any is written, as CHL_DsWriteRA does for one
+HRESULT _CheckRangeVals(
+    _In_ PCHL_RARRAY pra,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals)
+{
+    if (pvVals == NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    if ((pra->vt == CHL_VT_INT32) || (pra->vt == CHL_VT_UINT32))
+    {
+        return S_OK;
+    }
+
+    for (UINT idx = 0; idx < nVals; ++idx)
+    {
+        PCVOID pVal = ((PCVOID*)pvVals)[idx];
+
+        if (pVal == NULL)
+        {
+            return E_INVALIDARG;
+        }
+
+        if ((pra->vt == CHL_VT_USEROBJECT) && ((piBufSizes == NULL) || (piBufSizes[idx] <= 0)))
+        {
+            logerr("%s(): Valsize unspecified for value %u.", __FUNCTION__, idx);
+            return E_INVALIDARG;
+        }
+    }
+    return S_OK;
+}
+
+// Writes values of an array of CHL_VAL, without going through _CopyValIn for primitive types
+HRESULT _WriteRangeVals(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT index,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals,
+    _Out_ PUINT pnWritten)
+{
+    HRESULT hr = S_OK;
+    PCHL_VAL pValsToWrite = &pra->pValArray[index];
+    UINT idx = 0;
+
+    if ((pra->vt == CHL_VT_INT32) || (pra->vt == CHL_VT_UINT32) || (pra->vt == CHL_VT_POINTER))
+    {
+        // Nothing of these is on the heap, so there is nothing to delete
+        BOOL fPointer = (pra->vt == CHL_VT_POINTER);
+        int iValSize = fPointer ? sizeof(PVOID) : sizeof(UINT);
+
+        for (idx = 0; idx < nVals; ++idx)
+        {
+            pValsToWrite[idx].iValSize = iValSize;
+            if (fPointer)
+            {
+                pValsToWrite[idx].valDef.pvPtr = ((PVOID*)pvVals)[idx];
+            }
+            else
+            {
+                pValsToWrite[idx].valDef.uiVal = ((PUINT)pvVals)[idx];
+            }
+            _MarkValOccupied(&pValsToWrite[idx]);
+        }
+        goto func_end;
+    }
+
+    for (idx = 0; idx < nVals; ++idx)
+    {
+        PCVOID pVal = ((PCVOID*)pvVals)[idx];
+        int iValSize = (piBufSizes != NULL) ? piBufSizes[idx] : 0;
+
+        if ((iValSize <= 0) && FAILED(hr = _GetValSize((PVOID)pVal, pra->vt, &iValSize)))
+        {
+            break;
+        }
+
+        _DeleteVal(&pValsToWrite[idx], pra->vt, FALSE);
+        hr = _CopyValIn(&pValsToWrite[idx], pra->vt, pVal, iValSize);
+        if (FAILED(hr))
+        {
+            break;
+        }
+    }
+
+func_end:
+    *pnWritten = idx;
+    return hr;
+}
+
+// Both arrays must store values alike, the source range must be within the source array
+HRESULT _CheckCopyRange(
+    _In_ PCHL_RARRAY praDest,
+    _In_ UINT destIndex,
+    _In_ PCHL_RARRAY praSrc,
+    _In_ UINT srcIndex,
+    _In_ UINT nVals)
+{
+    ASSERT(RA_IS_ALLOCATED(praDest) && RA_IS_ALLOCATED(praSrc));
+
+    if ((praDest->vt != praSrc->vt) || (praDest->cbPackedVal != praSrc->cbPackedVal))
+    {
+        return E_INVALIDARG;
+    }
+
+    if ((srcIndex > praSrc->curSize) || (nVals > (praSrc->curSize - srcIndex)) || (nVals > (MAXUINT - destIndex)))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+    }
+
+    return S_OK;
+}
+
+// Clears the values at indexes from start up to end. Values that were moved elsewhere are only zeroed.
+void _ClearRange(_In_ PCHL_RARRAY pra, _In_ UINT start, _In_ UINT end, _In_ BOOL fDeleteVals)
+{
+    if (start >= end)
+    {
+        return;
+    }
+
+    if (RA_IS_PACKED(pra))
+    {
+        memset((PBYTE)pra->pvPacked + ((SIZE_T)start * pra->cbPackedVal), 0, (SIZE_T)(end - start) * pra->cbPackedVal);
+        _SetBitRange(pra->pdwOccupied, start, end - start, FALSE);
+    }
+    else if (fDeleteVals)
+    {
+        for (UINT idx = start; idx < end; ++idx)
+        {
+            _DeleteVal(&pra->pValArray[idx], pra->vt, FALSE);
+        }
+    }
+    else
+    {
+        ZeroMemory(&pra->pValArray[start], (SIZE_T)(end - start) * sizeof(CHL_VAL));
+    }
+}
+
+// Doubles the capacity, or more if that is not enough, but not beyond maxSize
+__inline UINT _CalcNewCapacityGrow(_In_ PCHL_RARRAY pra, _In_ UINT uiSizeNeeded)
+{
+    UINT newCapacity = (pra->capacity > (MAXUINT / 2)) ? MAXUINT : (pra->capacity * 2);
+
+    newCapacity = max(newCapacity, uiSizeNeeded);
+    return (pra->maxSize > 0) ? min(newCapacity, pra->maxSize) : newCapacity;
+}
+
+// Makes sure that indexes below uiSizeNeeded are allocated, growing the capacity geometrically
+HRESULT _GrowToHold(_In_ PCHL_RARRAY pra, _In_ UINT uiSizeNeeded)
+{
+    if (uiSizeNeeded <= pra->capacity)
+    {
+        return S_OK;
+    }
+
+    if ((pra->maxSize != RARRAY_MAX_SIZE_NOLIMIT) && (uiSizeNeeded > pra->maxSize))
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_INDEX);
+    }
+
+    return _SetCapacity(pra, _CalcNewCapacityGrow(pra, uiSizeNeeded));
+}
+
+// Grows the size of the array to newSize, if it is smaller
+HRESULT _GrowSizeTo(_In_ PCHL_RARRAY pra, _In_ UINT newSize)
+{
+    HRESULT hr = S_OK;
+
+    if (newSize > pra->curSize)
+    {
+        hr = _GrowToHold(pra, newSize);
+        if (SUCCEEDED(hr))
+        {
+            pra->curSize = newSize;
+        }
+    }
+    return hr;
+}
+
+// Reallocates the array to hold exactly newCapacity values. Values beyond the new capacity must have
+// been cleared already. New values are zeroed, so that they are not occupied. If memory cannot be given
+// back, the array is left as it is.
+HRESULT _SetCapacity(_In_ PCHL_RARRAY pra, _In_ UINT newCapacity)
+{
+    PVOID pvNew;
+    PVOID *ppvValues = RA_IS_PACKED(pra) ? &pra->pvPacked : (PVOID*)&pra->pValArray;
+    SIZE_T cbVal = RA_IS_PACKED(pra) ? pra->cbPackedVal : sizeof(CHL_VAL);
+
+    ASSERT(newCapacity >= RARRAY_MIN_SIZE);
+
+    if ((SIZE_T)newCapacity > (MAXSIZE_T / cbVal))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pvNew = realloc(*ppvValues, _CalcValArrayBytesForSize(pra, newCapacity));
+    if (pvNew == NULL)
+    {
+        return (newCapacity < pra->capacity) ? S_OK : E_OUTOFMEMORY;
+    }
+    *ppvValues = pvNew;
+
+    if (RA_IS_PACKED(pra))
+    {
+        // Bits beyond the capacity are always clear, so only whole new DWORDs need zeroing. A bitmap
+        // that cannot be given back is merely larger than it needs to be.
+        SIZE_T nOldDwords = RA_BITMAP_DWORDS(pra->capacity);
+        SIZE_T nNewDwords = RA_BITMAP_DWORDS(newCapacity);
+
+        pvNew = realloc(pra->pdwOccupied, nNewDwords * sizeof(DWORD));
+        if (pvNew != NULL)
+        {
+            pra->pdwOccupied = (PDWORD)pvNew;
+            if (nNewDwords > nOldDwords)
+            {
+                ZeroMemory(&pra->pdwOccupied[nOldDwords], (nNewDwords - nOldDwords) * sizeof(DWORD));
+            }
+        }
+        else if (newCapacity > pra->capacity)
+        {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    if (newCapacity > pra->capacity)
+    {
+        ZeroMemory((PBYTE)*ppvValues + (pra->capacity * cbVal), (newCapacity - pra->capacity) * cbVal);
+    }
+    pra->capacity = newCapacity;
+    return S_OK;
+}
+
+#pragma region Algorithms
+
+int _GetThreadCount(_In_ int nThreads, _In_ UINT nVals)
+{
+    SYSTEM_INFO sysInfo;
+
+    if (nThreads == 0)
+    {
+        GetSystemInfo(&sysInfo);
+        nThreads = (int)sysInfo.dwNumberOfProcessors;
+    }
+    nThreads = min(nThreads, RA_MAX_THREADS);
+    nThreads = (int)min((UINT)nThreads, nVals / RA_MIN_VALS_PER_THREAD);
+    return max(1, nThreads);
+}
+
+// Runs the work items on up to nThreads threads, including the calling one
+void _RunParallel(_In_ RA_WORK_FN pfnWork, _In_ PVOID pvWork, _In_ LONG lWorkItems, _In_ int nThreads)
+{
+    int i;
+    int nStarted = 0;
+    HANDLE ahThreads[RA_MAX_THREADS];
+    RA_PARALLEL parallel;
+
+    parallel.pfnWork = pfnWork;
+    parallel.pvWork = pvWork;
+    parallel.lNextWork = 0;
+    parallel.lWorkItems = lWorkItems;
+
+    // If a thread cannot be started, the others take its share
+    nThreads = min(nThreads, (int)lWorkItems);
+    for (i = 1; i < nThreads; ++i)
+    {
+        ahThreads[nStarted] = CreateThread(NULL, 0, _ParallelWorker, &parallel, 0, NULL);
+        if (ahThreads[nStarted] == NULL)
+        {
+            logwarn("%s(): CreateThread() failed, running on %d threads", __FUNCTION__, nStarted + 1);
+            break;
+        }
+        ++nStarted;
+    }
+
+    _ParallelWorker(&parallel);
+
+    if (nStarted > 0)
+    {
+        WaitForMultipleObjects(nStarted, ahThreads, TRUE, INFINITE);
+        for (i = 0; i < nStarted; ++i)
+        {
+            CloseHandle(ahThreads[i]);
+        }
+    }
+}
+
+DWORD WINAPI _ParallelWorker(_In_ LPVOID pvParallel)
+{
+    LONG lWork;
+    RA_PARALLEL *pParallel = (RA_PARALLEL*)pvParallel;
+
+    while ((lWork = InterlockedIncrement(&pParallel->lNextWork) - 1) < pParallel->lWorkItems)
+    {
+        pParallel->pfnWork(pParallel->pvWork, lWork);
+    }
+    return 0;
+}
+
+// Moves the occupied values below the length to the start of the array, keeping their order.
+// The length becomes their number, which is returned.
+UINT _CompactOccupied(_In_ PCHL_RARRAY pra)
+{
+    UINT nVals = 0;
+    UINT length = pra->length;
+
+    if (RA_IS_PACKED(pra))
+    {
+        if ((length > 0) && _AreBitsSet(pra->pdwOccupied, 0, length))
+        {
+            return length;
+        }
+
+        for (UINT idx = 0; idx < length; ++idx)
+        {
+            if (RA_BITMAP_TEST(pra->pdwOccupied, idx))
+            {
+                if (idx != nVals)
+                {
+                    memcpy((PBYTE)pra->pvPacked + ((SIZE_T)nVals * pra->cbPackedVal),
+                        (PBYTE)pra->pvPacked + ((SIZE_T)idx * pra->cbPackedVal), pra->cbPackedVal);
+                }
+                ++nVals;
+            }
+        }
+
+        // Moved values left zeroes behind, or their own copy below nVals
+        _SetBitRange(pra->pdwOccupied, 0, nVals, TRUE);
+        _ClearRange(pra, nVals, length, FALSE);
+    }
+    else
+    {
+        for (UINT idx = 0; idx < length; ++idx)
+        {
+            if (_IsValOccupied(&pra->pValArray[idx]))
+            {
+                if (idx != nVals)
+                {
+                    pra->pValArray[nVals] = pra->pValArray[idx];
+                    ZeroMemory(&pra->pValArray[idx], sizeof(CHL_VAL));
+                }
+                ++nVals;
+            }
+        }
+    }
+
+    pra->length = nVals;
+    return nVals;
+}
+
+// A value being sorted, as it is passed to the compare function
+__inline PCVOID _GetElemAsPCVOID(_In_ PCHL_RARRAY pra, _In_ PBYTE pbVal)
+{
+    if (!RA_IS_PACKED(pra))
+    {
+        return _GetValAsPCVOID((PCHL_VAL)pbVal, pra->vt);
+    }
+
+    switch (pra->vt)
+    {
+    case CHL_VT_INT32:
+        return (PCVOID)(INT_PTR)*(int*)pbVal;
+
+    case CHL_VT_UINT32:
+        return (PCVOID)(UINT_PTR)*(PUINT)pbVal;
+
+    default:
+        return *(PVOID*)pbVal;
+    }
+}
+
+// Same order as the keys of a binary search tree, a negative result puts the left value first
+__inline BOOL _IsLess(_In_ RA_SORT *pSort, _In_ PBYTE pbLeft, _In_ PBYTE pbRight)
+{
+    return pSort->pfnCompare(_GetElemAsPCVOID(pSort->pra, pbLeft), _GetElemAsPCVOID(pSort->pra, pbRight)) < 0;
+}
+
+// Sorts one chunk of the values on its own, the result is left in pbVals
+void _SortRunWork(_In_ PVOID pvSort, _In_ LONG lChunk)
+{
+    RA_SORT *pSort = (RA_SORT*)pvSort;
+    SIZE_T cbVal = pSort->cbVal;
+    UINT start = RA_CHUNK_START(pSort->nVals, pSort->nChunks, lChunk);
+    UINT end = RA_CHUNK_START(pSort->nVals, pSort->nChunks, lChunk + 1);
+    PBYTE pbSrc = pSort->pbVals;
+    PBYTE pbDst = pSort->pbScratch;
+    CHL_VAL valTemp;
+
+    // Insertion sort of short runs
+    for (UINT runStart = start; runStart < end; runStart += min(RA_SORT_RUN, end - runStart))
+    {
+        UINT runEnd = runStart + min(RA_SORT_RUN, end - runStart);
+
+        for (UINT i = runStart + 1; i < runEnd; ++i)
+        {
+            UINT j = i;
+
+            memcpy(&valTemp, pbSrc + (i * cbVal), cbVal);
+            while ((j > runStart) && _IsLess(pSort, (PBYTE)&valTemp, pbSrc + ((j - 1) * cbVal)))
+            {
+                memcpy(pbSrc + (j * cbVal), pbSrc + ((j - 1) * cbVal), cbVal);
+                --j;
+            }
+            memcpy(pbSrc + (j * cbVal), &valTemp, cbVal);
+        }
+    }
+
+    // Merge runs of doubling width, back and forth between the buffers
+    for (ULONGLONG width = RA_SORT_RUN; width < (end - start); width *= 2)
+    {
+        PBYTE pbTemp;
+
+        for (ULONGLONG lo = start; lo < end; lo += 2 * width)
+        {
+            UINT mid = (UINT)min(lo + width, end);
+            UINT hi = (UINT)min(lo + (2 * width), end);
+            _MergeRuns(pSort, pbSrc, (UINT)lo, mid, mid, hi, pbDst, (UINT)lo);
+        }
+
+        pbTemp = pbSrc;
+        pbSrc = pbDst;
+        pbDst = pbTemp;
+    }
+
+    if (pbSrc != pSort->pbVals)
+    {
+        memcpy(pSort->pbVals + (start * cbVal), pbSrc + (start * cbVal), (end - start) * cbVal);
+    }
+}
+
+void _MergeTaskWork(_In_ PVOID pvSort, _In_ LONG lTask)
+{
+    RA_SORT *pSort = (RA_SORT*)pvSort;
+    RA_MERGE_TASK *pTask = &pSort->pTasks[lTask];
+
+    _MergeRuns(pSort, pSort->pbSrc, pTask->aStart, pTask->aEnd, pTask->bStart, pTask->bEnd, pSort->pbDst, pTask->outStart);
+}
+
+// Stable merge, values of the first run go first when equal
+void _MergeRuns(
+    _In_ RA_SORT *pSort,
+    _In_ PBYTE pbSrc,
+    _In_ UINT aStart,
+    _In_ UINT aEnd,
+    _In_ UINT bStart,
+    _In_ UINT bEnd,
+    _Out_ PBYTE pbDst,
+    _In_ UINT outStart)
+{
+    SIZE_T cbVal = pSort->cbVal;
+    PBYTE pbOut = pbDst + (outStart * cbVal);
+
+    while ((aStart < aEnd) && (bStart < bEnd))
+    {
+        if (_IsLess(pSort, pbSrc + (bStart * cbVal), pbSrc + (aStart * cbVal)))
+        {
+            memcpy(pbOut, pbSrc + (bStart * cbVal), cbVal);
+            ++bStart;
+        }
+        else
+        {
+            memcpy(pbOut, pbSrc + (aStart * cbVal), cbVal);
+            ++aStart;
+        }
+        pbOut += cbVal;
+    }
+
+    memcpy(pbOut, pbSrc + (aStart * cbVal), (aEnd - aStart) * cbVal);
+    pbOut += (aEnd - aStart) * cbVal;
+    memcpy(pbOut, pbSrc + (bStart * cbVal), (bEnd - bStart) * cbVal);
+}
+
+// Returns how many values of the first run are among the first diag values of merging the two runs,
+// so that a merge can be split into parts that are done on their own
+UINT _FindMergeSplit(_In_ RA_SORT *pSort, _In_ UINT aStart, _In_ UINT aEnd, _In_ UINT bStart, _In_ UINT bEnd, _In_ UINT diag)
+{
+    SIZE_T cbVal = pSort->cbVal;
+    UINT lo = (diag > (bEnd - bStart)) ? (diag - (bEnd - bStart)) : 0;
+    UINT hi = min(diag, aEnd - aStart);
+
+    while (lo < hi)
+    {
+        UINT mid = lo + ((hi - lo) / 2);
+
+        if (_IsLess(pSort, pSort->pbSrc + ((bStart + diag - mid - 1) * cbVal), pSort->pbSrc + ((aStart + mid) * cbVal)))
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// Sorts nChunks runs on their own, then merges pairs of runs in rounds. Each merge of a round is
+// split into parts, so that all threads have work until the last round.
+HRESULT _MergeSort(_In_ PCHL_RARRAY pra, _In_ CHL_CompareFn pfnCompare, _In_ UINT nVals, _In_ int nThreads)
+{
+    HRESULT hr = S_OK;
+    RA_SORT sort;
+    PUINT puRunStarts = NULL;
+    UINT nRuns;
+    UINT nMaxTasks;
+
+    ZeroMemory(&sort, sizeof(sort));
+    sort.pra = pra;
+    sort.pfnCompare = pfnCompare;
+    sort.cbVal = RA_IS_PACKED(pra) ? pra->cbPackedVal : sizeof(CHL_VAL);
+    sort.nVals = nVals;
+    sort.nChunks = (UINT)nThreads;
+    sort.pbVals = RA_IS_PACKED(pra) ? (PBYTE)pra->pvPacked : (PBYTE)pra->pValArray;
+
+    nMaxTasks = (nThreads * RA_MERGE_TASKS_PER_THREAD) + sort.nChunks;
+    sort.pbScratch = (PBYTE)malloc(nVals * sort.cbVal);
+    sort.pTasks = (RA_MERGE_TASK*)malloc(nMaxTasks * sizeof(RA_MERGE_TASK));
+    puRunStarts = (PUINT)malloc((sort.nChunks + 1) * sizeof(UINT));
+    if ((sort.pbScratch == NULL) || (sort.pTasks == NULL) || (puRunStarts == NULL))
+    {
+        logerr("%s(): malloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto func_end;
+    }
+
+    _RunParallel(_SortRunWork, &sort, sort.nChunks, nThreads);
+
+    for (nRuns = 0; nRuns <= sort.nChunks; ++nRuns)
+    {
+        puRunStarts[nRuns] = RA_CHUNK_START(nVals, sort.nChunks, nRuns);
+    }
+    nRuns = sort.nChunks;
+
+    sort.pbSrc = sort.pbVals;
+    sort.pbDst = sort.pbScratch;
+    while (nRuns > 1)
+    {
+        UINT nPairs = nRuns / 2;
+        UINT nPartsPerPair = max(1, (nThreads * RA_MERGE_TASKS_PER_THREAD) / nPairs);
+        LONG lTasks = 0;
+        PBYTE pbTemp;
+
+        for (UINT iPair = 0; iPair < nPairs; ++iPair)
+        {
+            UINT aStart = puRunStarts[2 * iPair];
+            UINT bStart = puRunStarts[(2 * iPair) + 1];
+            UINT bEnd = puRunStarts[(2 * iPair) + 2];
+            UINT nSplitA = 0;
+
+            for (UINT iPart = 0; iPart < nPartsPerPair; ++iPart)
+            {
+                UINT diagEnd = (UINT)(((ULONGLONG)(bEnd - aStart) * (iPart + 1)) / nPartsPerPair);
+                UINT nSplitAEnd = _FindMergeSplit(&sort, aStart, bStart, bStart, bEnd, diagEnd);
+                RA_MERGE_TASK *pTask = &sort.pTasks[lTasks++];
+                UINT diagStart = (UINT)(((ULONGLONG)(bEnd - aStart) * iPart) / nPartsPerPair);
+
+                pTask->aStart = aStart + nSplitA;
+                pTask->aEnd = aStart + nSplitAEnd;
+                pTask->bStart = bStart + (diagStart - nSplitA);
+                pTask->bEnd = bStart + (diagEnd - nSplitAEnd);
+                pTask->outStart = aStart + diagStart;
+                nSplitA = nSplitAEnd;
+            }
+            puRunStarts[iPair + 1] = bEnd;
+        }
+
+        // A run without a pair is copied over as it is
+        if (nRuns % 2)
+        {
+            RA_MERGE_TASK *pTask = &sort.pTasks[lTasks++];
+
+            pTask->aStart = puRunStarts[nRuns - 1];
+            pTask->aEnd = puRunStarts[nRuns];
+            pTask->bStart = pTask->bEnd = pTask->aEnd;
+            pTask->outStart = pTask->aStart;
+            puRunStarts[nPairs + 1] = pTask->aEnd;
+        }
+
+        ASSERT(lTasks <= (LONG)nMaxTasks);
+        _RunParallel(_MergeTaskWork, &sort, lTasks, nThreads);
+
+        nRuns = nPairs + (nRuns % 2);
+        pbTemp = sort.pbSrc;
+        sort.pbSrc = sort.pbDst;
+        sort.pbDst = pbTemp;
+    }
+
+    if (sort.pbSrc != sort.pbVals)
+    {
+        memcpy(sort.pbVals, sort.pbSrc, nVals * sort.cbVal);
+    }
+
+func_end:
+    free(sort.pbScratch);
+    free(sort.pTasks);
+    free(puRunStarts);
+    return hr;
+}
+
+// Sorts primitive values by their bits. Values of CHL_VAL arrays are taken out as keys and put back,
+// since values of primitive types that are equal are the same.
+HRESULT _RadixSort(_In_ PCHL_RARRAY pra, _In_ UINT nVals, _In_ int nThreads)
+{
+    HRESULT hr = S_OK;
+    BOOL f64 = (pra->vt == CHL_VT_POINTER) && (sizeof(PVOID) == sizeof(ULONGLONG));
+    SIZE_T cbKey = f64 ? sizeof(ULONGLONG) : sizeof(UINT);
+    PVOID pvKeys = RA_IS_PACKED(pra) ? pra->pvPacked : malloc(nVals * cbKey);
+    PVOID pvScratch = malloc(nVals * cbKey);
+    PVOID pvSorted;
+    UINT idx;
+
+    if ((pvKeys == NULL) || (pvScratch == NULL))
+    {
+        logerr("%s(): malloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto func_end;
+    }
+
+    if (!RA_IS_PACKED(pra))
+    {
+        for (idx = 0; idx < nVals; ++idx)
+        {
+            if (f64)
+            {
+                ((PULONGLONG)pvKeys)[idx] = (ULONGLONG)(UINT_PTR)pra->pValArray[idx].valDef.pvPtr;
+            }
+            else
+            {
+                ((PUINT)pvKeys)[idx] = (pra->vt == CHL_VT_POINTER) ?
+                    (UINT)(UINT_PTR)pra->pValArray[idx].valDef.pvPtr : pra->pValArray[idx].valDef.uiVal;
+            }
+        }
+    }
+
+    // Signed values sort as unsigned ones with the sign bit flipped
+    if (pra->vt == CHL_VT_INT32)
+    {
+        for (idx = 0; idx < nVals; ++idx)
+        {
+            ((PUINT)pvKeys)[idx] ^= 0x80000000;
+        }
+    }
+
+    pvSorted = _RadixSortKeys(pvKeys, pvScratch, f64, nVals, nThreads);
+
+    if (pra->vt == CHL_VT_INT32)
+    {
+        for (idx = 0; idx < nVals; ++idx)
+        {
+            ((PUINT)pvSorted)[idx] ^= 0x80000000;
+        }
+    }
+
+    if (RA_IS_PACKED(pra))
+    {
+        if (pvSorted != pra->pvPacked)
+        {
+            memcpy(pra->pvPacked, pvSorted, nVals * cbKey);
+        }
+    }
+    else
+    {
+        for (idx = 0; idx < nVals; ++idx)
+        {
+            if (pra->vt == CHL_VT_POINTER)
+            {
+                pra->pValArray[idx].valDef.pvPtr = f64 ?
+                    (PVOID)(UINT_PTR)((PULONGLONG)pvSorted)[idx] : (PVOID)(UINT_PTR)((PUINT)pvSorted)[idx];
+            }
+            else
+            {
+                pra->pValArray[idx].valDef.uiVal = ((PUINT)pvSorted)[idx];
+            }
+        }
+    }
+
+func_end:
+    if ((pvKeys != pra->pvPacked) || !RA_IS_PACKED(pra))
+    {
+        free(pvKeys);
+    }
+    free(pvScratch);
+    return hr;
+}
+
+// LSD radix sort of the keys, a pass per digit. Each thread counts the digits of its chunk, then puts
+// its keys where the counts of all chunks say. Passes where all keys have the same digit are skipped.
+// Returns the buffer that holds the sorted keys, pvKeys or pvScratch.
+PVOID _RadixSortKeys(_In_ PVOID pvKeys, _In_ PVOID pvScratch, _In_ BOOL f64, _In_ UINT nVals, _In_ int nThreads)
+{
+    RA_RADIX radix;
+    UINT nKeyBits = f64 ? 64 : 32;
+    UINT aTotals[RA_RADIX_BUCKETS];
+
+    ZeroMemory(&radix, sizeof(radix));
+    radix.pvSrc = pvKeys;
+    radix.pvDst = pvScratch;
+    radix.f64 = f64;
+    radix.nVals = nVals;
+    radix.nChunks = (UINT)nThreads;
+
+    // Without room for the counts of each chunk, sort on the calling thread
+    radix.puCounts = (PUINT)malloc(radix.nChunks * RA_RADIX_BUCKETS * sizeof(UINT));
+    if (radix.puCounts == NULL)
+    {
+        radix.nChunks = 1;
+        radix.puCounts = aTotals;
+    }
+
+    for (radix.shift = 0; radix.shift < nKeyBits; radix.shift += RA_RADIX_BITS)
+    {
+        UINT uNext = 0;
+        BOOL fOneDigit = FALSE;
+        PVOID pvTemp;
+
+        radix.fCounting = TRUE;
+        _RunParallel(_RadixWork, &radix, radix.nChunks, nThreads);
+
+        // Each chunk puts the keys with a digit after the ones of the chunks before it
+        for (UINT digit = 0; (digit < RA_RADIX_BUCKETS) && !fOneDigit; ++digit)
+        {
+            UINT uDigitStart = uNext;
+
+            for (UINT iChunk = 0; iChunk < radix.nChunks; ++iChunk)
+            {
+                UINT uCount = radix.puCounts[(iChunk * RA_RADIX_BUCKETS) + digit];
+
+                radix.puCounts[(iChunk * RA_RADIX_BUCKETS) + digit] = uNext;
+                uNext += uCount;
+            }
+            fOneDigit = ((uNext - uDigitStart) == nVals);
+        }
+
+        if (fOneDigit)
+        {
+            continue;
+        }
+
+        radix.fCounting = FALSE;
+        _RunParallel(_RadixWork, &radix, radix.nChunks, nThreads);
+
+        pvTemp = radix.pvSrc;
+        radix.pvSrc = radix.pvDst;
+        radix.pvDst = pvTemp;
+    }
+
+    if (radix.puCounts != aTotals)
+    {
+        free(radix.puCounts);
+    }
+    return radix.pvSrc;
+}
+
+void _RadixWork(_In_ PVOID pvRadix, _In_ LONG lChunk)
+{
+    RA_RADIX *pRadix = (RA_RADIX*)pvRadix;
+    UINT start = RA_CHUNK_START(pRadix->nVals, pRadix->nChunks, lChunk);
+    UINT end = RA_CHUNK_START(pRadix->nVals, pRadix->nChunks, lChunk + 1);
+    UINT shift = pRadix->shift;
+    PUINT puCounts = &pRadix->puCounts[lChunk * RA_RADIX_BUCKETS];
+    UINT idx;
+
+    if (pRadix->fCounting)
+    {
+        ZeroMemory(puCounts, RA_RADIX_BUCKETS * sizeof(UINT));
+    }
+
+    if (pRadix->f64)
+    {
+        PULONGLONG pullSrc = (PULONGLONG)pRadix->pvSrc;
+        PULONGLONG pullDst = (PULONGLONG)pRadix->pvDst;
+
+        if (pRadix->fCounting)
+        {
+            for (idx = start; idx < end; ++idx)
+            {
+                ++puCounts[(pullSrc[idx] >> shift) & (RA_RADIX_BUCKETS - 1)];
+            }
+        }
+        else
+        {
+            for (idx = start; idx < end; ++idx)
+            {
+                pullDst[puCounts[(pullSrc[idx] >> shift) & (RA_RADIX_BUCKETS - 1)]++] = pullSrc[idx];
+            }
+        }
+    }
+    else
+    {
+        PUINT puSrc = (PUINT)pRadix->pvSrc;
+        PUINT puDst = (PUINT)pRadix->pvDst;
+
+        if (pRadix->fCounting)
+        {
+            for (idx = start; idx < end; ++idx)
+            {
+                ++puCounts[(puSrc[idx] >> shift) & (RA_RADIX_BUCKETS - 1)];
+            }
+        }
+        else
+        {
+            for (idx = start; idx < end; ++idx)
+            {
+                puDst[puCounts[(puSrc[idx] >> shift) & (RA_RADIX_BUCKETS - 1)]++] = puSrc[idx];
+            }
+        }
+    }
+}
+
+// Points to the value in place, as passed to CHL_RA_FOREACH_FN
+__inline PVOID _GetValPtrInPlace(_In_ PCHL_RARRAY pra, _In_ UINT index)
+{
+    if (RA_IS_PACKED(pra))
+    {
+        return (PBYTE)pra->pvPacked + ((SIZE_T)index * pra->cbPackedVal);
+    }
+
+    // Primitive values are at the start of the union
+    return (_GetPackedValSize(pra->vt) > 0) ?
+        (PVOID)&pra->pValArray[index].valDef : (PVOID)_GetValAsPCVOID(&pra->pValArray[index], pra->vt);
+}
+
+__inline BOOL _IsOccupiedAt(_In_ PCHL_RARRAY pra, _In_ UINT index)
+{
+    return RA_IS_PACKED(pra) ? RA_BITMAP_TEST(pra->pdwOccupied, index) : _IsValOccupied(&pra->pValArray[index]);
+}
+
+// Replaces an occupied value of a primitive type
+__inline void _SetPrimitiveAt(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pVal)
+{
+    if (RA_IS_PACKED(pra))
+    {
+        _WritePacked(pra, index, pVal);
+    }
+    else if (pra->vt == CHL_VT_POINTER)
+    {
+        pra->pValArray[index].valDef.pvPtr = pVal;
+    }
+    else
+    {
+        pra->pValArray[index].valDef.uiVal = (UINT)(UINT_PTR)pVal;
+    }
+}
+
+// Combines the values from start up to end, returns FALSE if there are none. Sums of packed
+// 32 bit values are added up directly, values that are not occupied are zero.
+BOOL _ReduceRange(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT start,
+    _In_ UINT end,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _Out_ PVOID *ppvResult)
+{
+    BOOL fHasResult = FALSE;
+    PVOID pvResult = NULL;
+
+    if (RA_IS_PACKED(pra) && (pfnCombine == CHL_DsCombineSumRA) && (pra->vt != CHL_VT_POINTER))
+    {
+        PUINT puVals = (PUINT)pra->pvPacked;
+        UINT uSum = 0;
+
+        for (UINT idx = start; idx < end; ++idx)
+        {
+            uSum += puVals[idx];
+        }
+
+        fHasResult = _AnyBitsSet(pra->pdwOccupied, start, end - start);
+        pvResult = (pra->vt == CHL_VT_INT32) ? (PVOID)(INT_PTR)(int)uSum : (PVOID)(UINT_PTR)uSum;
+    }
+    else
+    {
+        for (UINT idx = start; idx < end; ++idx)
+        {
+            if (_IsOccupiedAt(pra, idx))
+            {
+                PCVOID pVal = RA_IS_PACKED(pra) ?
+                    _GetElemAsPCVOID(pra, (PBYTE)_GetValPtrInPlace(pra, idx)) : _GetValAsPCVOID(&pra->pValArray[idx], pra->vt);
+
+                pvResult = fHasResult ? pfnCombine(pvResult, pVal, pra->vt, pvContext) : (PVOID)pVal;
+                fHasResult = TRUE;
+            }
+        }
+    }
+
+    *ppvResult = pvResult;
+    return fHasResult;
+}
+
+// Replaces each value from start up to end with the combination of pvCarry, if fHasCarry, and the values
+// up to and including it. Sums of packed 32 bit values are added up directly, whole DWORDs of the
+// bitmap at a time where all of them are occupied.
+void _ScanRange(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT start,
+    _In_ UINT end,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_opt_ PCVOID pvCarry,
+    _In_ BOOL fHasCarry)
+{
+    UINT idx = start;
+
+    if (RA_IS_PACKED(pra) && (pfnCombine == CHL_DsCombineSumRA) && (pra->vt != CHL_VT_POINTER))
+    {
+        PUINT puVals = (PUINT)pra->pvPacked;
+        PDWORD pdwOccupied = pra->pdwOccupied;
+        UINT uSum = fHasCarry ? (UINT)(UINT_PTR)pvCarry : 0;
+
+        while (idx < end)
+        {
+            if (((idx & 31) == 0) && ((end - idx) >= 32) && (pdwOccupied[idx >> 5] == MAXDWORD))
+            {
+                for (UINT last = idx + 32; idx < last; ++idx)
+                {
+                    uSum += puVals[idx];
+                    puVals[idx] = uSum;
+                }
+            }
+            else
+            {
+                if (RA_BITMAP_TEST(pdwOccupied, idx))
+                {
+                    uSum += puVals[idx];
+                    puVals[idx] = uSum;
+                }
+                ++idx;
+            }
+        }
+    }
+    else
+    {
+        PVOID pvAcc = (PVOID)pvCarry;
+
+        for (; idx < end; ++idx)
+        {
+            if (_IsOccupiedAt(pra, idx))
+            {
+                PCVOID pVal = RA_IS_PACKED(pra) ?
+                    _GetElemAsPCVOID(pra, (PBYTE)_GetValPtrInPlace(pra, idx)) : _GetValAsPCVOID(&pra->pValArray[idx], pra->vt);
+
+                pvAcc = fHasCarry ? pfnCombine(pvAcc, pVal, pra->vt, pvContext) : (PVOID)pVal;
+                fHasCarry = TRUE;
+                _SetPrimitiveAt(pra, idx, pvAcc);
+            }
+        }
+    }
+}
+
+void _ForEachWork(_In_ PVOID pvChunked, _In_ LONG lChunk)
+{
+    RA_CHUNKED *pChunked = (RA_CHUNKED*)pvChunked;
+    UINT start = RA_CHUNK_START(pChunked->nVals, pChunked->nChunks, lChunk);
+    UINT end = RA_CHUNK_START(pChunked->nVals, pChunked->nChunks, lChunk + 1);
+
+    for (UINT idx = start; idx < end; ++idx)
+    {
+        if (_IsOccupiedAt(pChunked->pra, idx))
+        {
+            pChunked->pfnForEach(idx, _GetValPtrInPlace(pChunked->pra, idx), pChunked->pvContext);
+        }
+    }
+}
+
+void _ReduceWork(_In_ PVOID pvChunked, _In_ LONG lChunk)
+{
+    RA_CHUNKED *pChunked = (RA_CHUNKED*)pvChunked;
+    UINT start = RA_CHUNK_START(pChunked->nVals, pChunked->nChunks, lChunk);
+    UINT end = RA_CHUNK_START(pChunked->nVals, pChunked->nChunks, lChunk + 1);
+
+    pChunked->pfHasPartial[lChunk] = _ReduceRange(
+        pChunked->pra, start, end, pChunked->pfnCombine, pChunked->pvContext, &pChunked->ppvPartials[lChunk]);
+}
+
+// The partials hold what the chunks before each one combine to
+void _ScanWork(_In_ PVOID pvChunked, _In_ LONG lChunk)
+{
+    RA_CHUNKED *pChunked = (RA_CHUNKED*)pvChunked;
+    UINT start = RA_CHUNK_START(pChunked->nVals, pChunked->nChunks, lChunk);
+    UINT end = RA_CHUNK_START(pChunked->nVals, pChunked->nChunks, lChunk + 1);
+
+    _ScanRange(pChunked->pra, start, end, pChunked->pfnCombine, pChunked->pvContext,
+        pChunked->ppvPartials[lChunk], pChunked->pfHasPartial[lChunk]);
+}
+
+HRESULT _AllocChunkPartials(_Inout_ RA_CHUNKED *pChunked)
+{
+    pChunked->ppvPartials = (PVOID*)calloc(pChunked->nChunks, sizeof(PVOID));
+    pChunked->pfHasPartial = (PBOOL)calloc(pChunked->nChunks, sizeof(BOOL));
+    if ((pChunked->ppvPartials == NULL) || (pChunked->pfHasPartial == NULL))
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
+}
+
+#pragma endregion Algorithms
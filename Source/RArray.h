@@ -4,6 +4,10 @@
 // Shishir Bhat (http://www.shishirbhat.com)
 // History
 //      2015/12/05 Initial version
+//      10/17/26 Length and capacity apart from size, Append, Reserve and ShrinkToFit
+//      10/17/26 Packed storage for primitive value types
+//      10/17/26 Range functions: WriteRange, AppendRange, ReadRange, CopyRange and MoveRange
+//      10/17/26 Parallel Sort, ForEach, Reduce and Scan
 //
 
 #ifndef _RARRAY_H
@@ -15,14 +19,42 @@ extern "C" {
 
 #include "Defines.h"
 
+// Flags for CHL_DsCreateExRA
+#define CHL_RA_FLAG_PACKED      0x00000001  // Values stored as a plain array of the value type
+
+// Called by CHL_DsForEachRA for each occupied value, from several threads at once for different values.
+// Params:
+//  index       : Array index of the value
+//  pvVal       : Points to the value in the array: to the int, UINT or PVOID for those value types,
+//                which may be modified in place, or to the string or user object itself.
+//  pvContext   : Context passed to CHL_DsForEachRA
+//
+typedef void (*CHL_RA_FOREACH_FN)(_In_ UINT index, _In_ PVOID pvVal, _In_opt_ PVOID pvContext);
+
+// Combines two values for CHL_DsReduceRA and CHL_DsScanRA and returns the result. Values are passed
+// and returned as they are passed to CHL_DsWriteRA. The combiner must be associative, since values
+// are combined in parts on several threads; the order of values is kept, so it need not be commutative.
+// Params:
+//  pvLeft      : The value, or combined values, that come first in the array
+//  pvRight     : The value, or combined values, that come after pvLeft
+//  valType     : Value type of the array
+//  pvContext   : Context passed to CHL_DsReduceRA or CHL_DsScanRA
+//
+typedef PVOID (*CHL_RA_COMBINE_FN)(_In_ PCVOID pvLeft, _In_ PCVOID pvRight, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext);
+
 // The resizable array object
 typedef struct _rarray CHL_RARRAY, *PCHL_RARRAY;
 struct _rarray
 {
-    UINT curSize;               // Size of array currently
+    UINT curSize;               // Size of array currently, indexes below this can be read and written
     UINT maxSize;               // Upper limit for size growth. 0 = unlimited.
+    UINT length;                // One past the highest index written to, where Append writes next
+    UINT capacity;              // Number of values allocated, at least curSize
     CHL_VALTYPE vt;             // Value type being held in the array
-    CHL_VAL *pValArray;         // Actual array holding the values
+    CHL_VAL *pValArray;         // Actual array holding the values, NULL if packed
+    PVOID pvPacked;             // Created with CHL_RA_FLAG_PACKED: the values as a plain array, NULL otherwise
+    PDWORD pdwOccupied;         // Created with CHL_RA_FLAG_PACKED: one bit per value, set if the value is occupied
+    UINT cbPackedVal;           // Created with CHL_RA_FLAG_PACKED: bytes per value in pvPacked, 0 otherwise
 
     // Function pointers
 
@@ -33,8 +65,28 @@ struct _rarray
     HRESULT (*Write)(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pVal, _In_opt_ int iBufSize);
     HRESULT (*ClearAt)(_In_ PCHL_RARRAY pra, _In_ UINT index);
     HRESULT (*Resize)(_In_ PCHL_RARRAY pra, _In_ UINT newSize);
+    HRESULT (*Append)(_In_ PCHL_RARRAY pra, _In_ PCVOID pVal, _In_opt_ int iBufSize, _Out_opt_ PUINT puIndex);
+    HRESULT (*Reserve)(_In_ PCHL_RARRAY pra, _In_ UINT newCapacity);
+    HRESULT (*ShrinkToFit)(_In_ PCHL_RARRAY pra);
     UINT    (*Size)(_In_ PCHL_RARRAY pra);
     UINT    (*MaxSize)(_In_ PCHL_RARRAY pra);
+    UINT    (*Length)(_In_ PCHL_RARRAY pra);
+    UINT    (*Capacity)(_In_ PCHL_RARRAY pra);
+    HRESULT (*GetData)(_In_ PCHL_RARRAY pra, _Out_ PVOID *ppvData, _Out_opt_ PDWORD *ppdwOccupied);
+    HRESULT (*WriteRange)(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVOID pvVals,
+        _In_opt_ const int *piBufSizes, _In_ UINT nVals);
+    HRESULT (*AppendRange)(_In_ PCHL_RARRAY pra, _In_ PCVOID pvVals, _In_opt_ const int *piBufSizes,
+        _In_ UINT nVals, _Out_opt_ PUINT puIndex);
+    HRESULT (*ReadRange)(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ UINT nVals, _Out_ PVOID pvValBuf);
+    HRESULT (*CopyRange)(_In_ PCHL_RARRAY praDest, _In_ UINT destIndex, _In_ PCHL_RARRAY praSrc,
+        _In_ UINT srcIndex, _In_ UINT nVals);
+    HRESULT (*MoveRange)(_In_ PCHL_RARRAY praDest, _In_ UINT destIndex, _In_ PCHL_RARRAY praSrc,
+        _In_ UINT srcIndex, _In_ UINT nVals);
+    HRESULT (*Sort)(_In_ PCHL_RARRAY pra, _In_opt_ CHL_CompareFn pfnCompare, _In_ int nThreads);
+    HRESULT (*ForEach)(_In_ PCHL_RARRAY pra, _In_ CHL_RA_FOREACH_FN pfnForEach, _In_opt_ PVOID pvContext, _In_ int nThreads);
+    HRESULT (*Reduce)(_In_ PCHL_RARRAY pra, _In_ CHL_RA_COMBINE_FN pfnCombine, _In_opt_ PVOID pvContext,
+        _In_ int nThreads, _Out_ PVOID *ppvResult);
+    HRESULT (*Scan)(_In_ PCHL_RARRAY pra, _In_ CHL_RA_COMBINE_FN pfnCombine, _In_opt_ PVOID pvContext, _In_ int nThreads);
 
 };
 
@@ -47,6 +99,23 @@ struct _rarray
 //
 DllExpImp HRESULT CHL_DsCreateRA(_Out_ PCHL_RARRAY pra, _In_ CHL_VALTYPE valType, _In_opt_ UINT initSize, _In_opt_ UINT maxSize);
 
+// Same as CHL_DsCreateRA, with flags that select how values are stored.
+// With CHL_RA_FLAG_PACKED, values are stored as a plain array of int, UINT or PVOID instead of
+// an array of CHL_VAL, along with a bitmap of which values are occupied. This takes a fraction of
+// the memory, and reads and writes are a bitmap test and a load or store. The array can be processed
+// in place through the pointer returned by CHL_DsGetDataRA. Only CHL_VT_INT32, CHL_VT_UINT32 and
+// CHL_VT_POINTER values can be packed.
+// Params:
+//  pra, valType, initSize, maxSize: Same as for CHL_DsCreateRA.
+//  dwFlags     : Zero or CHL_RA_FLAG_PACKED.
+//
+DllExpImp HRESULT CHL_DsCreateExRA(
+    _Out_ PCHL_RARRAY pra,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ UINT initSize,
+    _In_opt_ UINT maxSize,
+    _In_ DWORD dwFlags);
+
 // Destroy a previously created resizable array. This frees all memory occupied by the underlying array.
 // Params:
 //  pra     : Pointer to a previously created CHL_RARRAY object
@@ -66,11 +135,12 @@ DllExpImp HRESULT CHL_DsDestroyRA(_In_ PCHL_RARRAY pra);
 DllExpImp HRESULT CHL_DsReadRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _Out_opt_ PVOID pValBuf,
         _Inout_opt_ PINT piBufSize, _In_ BOOL fGetPointerOnly);
 
-// Write to the specified array index, the specified value
+// Write to the specified array index, the specified value. A value already stored at the index is replaced.
 // Params:
 //  pra     : Pointer to a previously created CHL_RARRAY object
-//  index   : Array index at which to perform the write. Array is automatically resized if the index is
-//            greater than the current size of array, up until maxSize is reached (if specified).
+//  index   : Array index at which to perform the write. If the index is not less than the current size
+//            of array, the size becomes index + 1, up until maxSize is reached (if specified). The
+//            capacity grows geometrically, so that a series of such writes reallocates rarely.
 //  pVal    : Value to be stored. For primitive types, this is the primitive value casted to a PCVOID.
 //  iBufSize : Size of the value in bytes. For null-terminated strings, zero may be passed.
 //            Ignored for primitive types.
@@ -85,12 +155,38 @@ DllExpImp HRESULT CHL_DsWriteRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ PCVO
 DllExpImp HRESULT CHL_DsClearAtRA(_In_ PCHL_RARRAY pra, _In_ UINT index);
 
 // Force resize of the resizable array to the specified size. New size can be lower or higher than current size.
+// Growing beyond the capacity allocates exactly newSize values, shrinking gives the memory beyond newSize back.
+// Values at indexes from newSize on are cleared and the length is cut to newSize.
 // Params:
 //  pra     : Pointer to a previously created CHL_RARRAY object
 //  newSize : Size of the resized array
 //
 DllExpImp HRESULT CHL_DsResizeRA(_In_ PCHL_RARRAY pra, _In_ UINT newSize);
 
+// Write the specified value at the end of the array, that is at the index returned by CHL_DsLengthRA.
+// The capacity grows geometrically, so appending n values takes amortized constant time per value.
+// Params:
+//  pra     : Pointer to a previously created CHL_RARRAY object
+//  pVal    : Value to be stored. Refer documentation of the CHL_DsWriteRA() function.
+//  iBufSize : Size of the value in bytes. Refer documentation of the CHL_DsWriteRA() function.
+//  puIndex : Optional. Receives the index the value was written at.
+//
+DllExpImp HRESULT CHL_DsAppendRA(_In_ PCHL_RARRAY pra, _In_ PCVOID pVal, _In_opt_ int iBufSize, _Out_opt_ PUINT puIndex);
+
+// Make sure that the array has room for at least newCapacity values, so that writes and appends
+// below that index do not reallocate. Neither the size nor the length of the array change.
+// Params:
+//  pra         : Pointer to a previously created CHL_RARRAY object
+//  newCapacity : Number of values to allocate room for. Must not be greater than maxSize (if specified).
+//
+DllExpImp HRESULT CHL_DsReserveRA(_In_ PCHL_RARRAY pra, _In_ UINT newCapacity);
+
+// Give back the memory allocated beyond the current size of the array.
+// Params:
+//  pra     : Pointer to a previously created CHL_RARRAY object
+//
+DllExpImp HRESULT CHL_DsShrinkToFitRA(_In_ PCHL_RARRAY pra);
+
 // Retrieve current size of the resizable array
 // Params:
 //  pra     : Pointer to a previously created CHL_RARRAY object
@@ -103,6 +199,169 @@ DllExpImp UINT CHL_DsSizeRA(_In_ PCHL_RARRAY pra);
 //
 DllExpImp UINT CHL_DsMaxSizeRA(_In_ PCHL_RARRAY pra);
 
+// Retrieve the length of the resizable array: one past the highest index written to since it was
+// created, or since it was resized below that. This is where CHL_DsAppendRA writes next.
+// Params:
+//  pra     : Pointer to a previously created CHL_RARRAY object
+//
+DllExpImp UINT CHL_DsLengthRA(_In_ PCHL_RARRAY pra);
+
+// Retrieve the number of values the resizable array has allocated room for.
+// Params:
+//  pra     : Pointer to a previously created CHL_RARRAY object
+//
+DllExpImp UINT CHL_DsCapacityRA(_In_ PCHL_RARRAY pra);
+
+// Retrieve the values of an array created with CHL_RA_FLAG_PACKED, as a contiguous array of int, UINT
+// or PVOID according to the value type. Value i is occupied if bit (i % 32) of DWORD (i / 32) of the
+// bitmap is set; values that are not occupied read as zero. Values that are occupied may be modified
+// through the pointer. The pointers stay valid until the capacity of the array changes.
+// Params:
+//  pra             : Pointer to a previously created CHL_RARRAY object
+//  ppvData         : Receives a pointer to the first of CHL_DsSizeRA values
+//  ppdwOccupied    : Optional. Receives a pointer to the occupancy bitmap.
+//
+DllExpImp HRESULT CHL_DsGetDataRA(_In_ PCHL_RARRAY pra, _Out_ PVOID *ppvData, _Out_opt_ PDWORD *ppdwOccupied);
+
+// The range functions below pass values as an array: of int for CHL_VT_INT32, of UINT for CHL_VT_UINT32
+// and of pointers for all other value types. Ranges are checked once and the array grows once, and
+// values of packed arrays are copied with memcpy.
+
+// Write the specified values to the array, starting at the specified index. Values already stored
+// in the range are replaced. Values are checked before any is written; if a copy of a string or user
+// object fails, the values before it are written.
+// Params:
+//  pra         : Pointer to a previously created CHL_RARRAY object
+//  index       : Array index of the first value to write. The size grows as with CHL_DsWriteRA.
+//  pvVals      : Array of nVals values as described above
+//  piBufSizes  : Optional. Array of nVals sizes in bytes, as iBufSize of CHL_DsWriteRA.
+//                Required for CHL_VT_USEROBJECT, ignored for primitive types.
+//  nVals       : Number of values to write
+//
+DllExpImp HRESULT CHL_DsWriteRangeRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ UINT index,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals);
+
+// Write the specified values at the end of the array, at the index returned by CHL_DsLengthRA.
+// Params:
+//  pra, pvVals, piBufSizes, nVals: Same as for CHL_DsWriteRangeRA.
+//  puIndex     : Optional. Receives the index the first value was written at.
+//
+DllExpImp HRESULT CHL_DsAppendRangeRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ PCVOID pvVals,
+    _In_opt_ const int *piBufSizes,
+    _In_ UINT nVals,
+    _Out_opt_ PUINT puIndex);
+
+// Read the values in a range of the array into the specified buffer. For strings and user objects,
+// pointers to the stored values are returned, as with fGetPointerOnly of CHL_DsReadRA.
+// Returns S_FALSE if some of the values were not occupied; those are read as zero or NULL.
+// Params:
+//  pra         : Pointer to a previously created CHL_RARRAY object
+//  index       : Array index of the first value to read. The range must be within the current size of array.
+//  nVals       : Number of values to read
+//  pvValBuf    : Buffer that receives an array of nVals values as described above
+//
+DllExpImp HRESULT CHL_DsReadRangeRA(_In_ PCHL_RARRAY pra, _In_ UINT index, _In_ UINT nVals, _Out_ PVOID pvValBuf);
+
+// Copy a range of values from one array to another, or within an array. The ranges may overlap.
+// Values of strings and user objects are duplicated. Values not occupied in the source range clear
+// the values they are copied to. Both arrays must have the same value type and both or neither
+// must be packed.
+// Params:
+//  praDest     : Pointer to the CHL_RARRAY object to copy to. The size grows as with CHL_DsWriteRA.
+//  destIndex   : Array index in praDest of the first value to write
+//  praSrc      : Pointer to the CHL_RARRAY object to copy from, may be the same as praDest
+//  srcIndex    : Array index in praSrc of the first value to copy. The range must be within the current size of praSrc.
+//  nVals       : Number of values to copy
+//
+DllExpImp HRESULT CHL_DsCopyRangeRA(
+    _In_ PCHL_RARRAY praDest,
+    _In_ UINT destIndex,
+    _In_ PCHL_RARRAY praSrc,
+    _In_ UINT srcIndex,
+    _In_ UINT nVals);
+
+// Same as CHL_DsCopyRangeRA, except that values are moved instead of copied: nothing is duplicated,
+// and the values of the source range that are not overwritten are cleared. Neither the size nor the
+// length of praSrc change.
+// Params:
+//  praDest, destIndex, praSrc, srcIndex, nVals: Same as for CHL_DsCopyRangeRA.
+//
+DllExpImp HRESULT CHL_DsMoveRangeRA(
+    _In_ PCHL_RARRAY praDest,
+    _In_ UINT destIndex,
+    _In_ PCHL_RARRAY praSrc,
+    _In_ UINT srcIndex,
+    _In_ UINT nVals);
+
+// The functions below work on the occupied values below the length of the array, using worker threads.
+// The nThreads parameter is the most threads to use, including the calling one, 0 for one per processor.
+// Fewer threads are used for small arrays. The array must not be used by another thread meanwhile.
+
+// Sort the values of the array. Values that compare equal keep their order. The occupied values end up
+// at the start of the array and the length of the array becomes their number. Without a compare function,
+// values of types CHL_VT_INT32, CHL_VT_UINT32 and CHL_VT_POINTER are sorted in ascending order with a
+// radix sort, which does not compare values at all. Otherwise a parallel merge sort is used.
+// Params:
+//  pra         : Pointer to a previously created CHL_RARRAY object
+//  pfnCompare  : Optional for the value types above. Compares two values, as they are passed to CHL_DsWriteRA.
+//                Must return a negative number if the left value comes first, a positive one if the right
+//                value comes first and zero if they are equal, as the key compare function of a BST.
+//  nThreads    : Most threads to use, see above
+//
+DllExpImp HRESULT CHL_DsSortRA(_In_ PCHL_RARRAY pra, _In_opt_ CHL_CompareFn pfnCompare, _In_ int nThreads);
+
+// Call the specified function for each value of the array, from several threads.
+// Params:
+//  pra         : Pointer to a previously created CHL_RARRAY object
+//  pfnForEach  : Function to call, see CHL_RA_FOREACH_FN
+//  pvContext   : Optional. Passed to pfnForEach.
+//  nThreads    : Most threads to use, see above
+//
+DllExpImp HRESULT CHL_DsForEachRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ CHL_RA_FOREACH_FN pfnForEach,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads);
+
+// Combine all values of the array into one. Returns E_NOT_SET if there is no value.
+// Params:
+//  pra         : Pointer to a previously created CHL_RARRAY object
+//  pfnCombine  : Combiner, see CHL_RA_COMBINE_FN. The combiners CHL_DsCombine*RA are fastest on packed arrays.
+//  pvContext   : Optional. Passed to pfnCombine.
+//  nThreads    : Most threads to use, see above
+//  ppvResult   : Receives the combined values, as they are passed to CHL_DsWriteRA
+//
+DllExpImp HRESULT CHL_DsReduceRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads,
+    _Out_ PVOID *ppvResult);
+
+// Replace each value of the array with the combination of all values up to and including it, an
+// inclusive prefix sum when combining with CHL_DsCombineSumRA. Values that are not occupied stay so.
+// Only arrays of CHL_VT_INT32, CHL_VT_UINT32 and CHL_VT_POINTER values are supported.
+// Params:
+//  pra, pfnCombine, pvContext, nThreads: Same as for CHL_DsReduceRA.
+//
+DllExpImp HRESULT CHL_DsScanRA(
+    _In_ PCHL_RARRAY pra,
+    _In_ CHL_RA_COMBINE_FN pfnCombine,
+    _In_opt_ PVOID pvContext,
+    _In_ int nThreads);
+
+// Combiners for CHL_DsReduceRA and CHL_DsScanRA. For values of type CHL_VT_INT32 and CHL_VT_UINT32, they
+// return the sum (wrapping around on overflow), the smaller or the larger of the two values. Pointers are
+// compared by address and are not summed. For other value types, pvLeft is returned.
+DllExpImp PVOID CHL_DsCombineSumRA(_In_ PCVOID pvLeft, _In_ PCVOID pvRight, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext);
+DllExpImp PVOID CHL_DsCombineMinRA(_In_ PCVOID pvLeft, _In_ PCVOID pvRight, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext);
+DllExpImp PVOID CHL_DsCombineMaxRA(_In_ PCVOID pvLeft, _In_ PCVOID pvRight, _In_ CHL_VALTYPE valType, _In_opt_ PVOID pvContext);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,681 @@
+// TtlCache.c
+// Cache whose entries expire after a per-entry time to live, reclaimed by a hierarchical timing wheel
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#include "InternalDefines.h"
+#include "HashFunctions.h"
+#include "TtlCache.h"
+
+#define TTL_MIN_BUCKETS     16
+#define TTL_SLOT_MASK       (CHL_TTL_WHEEL_SLOTS - 1)
+
+// Number of ticks spanned by a slot of the level, and by the whole level
+#define TTL_LEVEL_SHIFT(level)  ((level) * CHL_TTL_WHEEL_BITS)
+#define TTL_WHEEL_SPAN          (1ULL << TTL_LEVEL_SHIFT(CHL_TTL_WHEEL_LEVELS))
+
+// File-local Functions
+static ULONGLONG _DefaultClock(_In_opt_ PVOID pvContext);
+
+static TTL_NODE** _FindLink(
+    _In_ PCHL_TTLCACHE pttl,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ ULONGLONG ullHash);
+
+static TTL_NODE** _LinkToNode(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE *pNode);
+
+static UINT _LowestSlot(_In_ ULONGLONG ullMask);
+static ULONGLONG _ExpireTick(_In_ PCHL_TTLCACHE pttl, _In_ ULONGLONG ullExpireTime);
+static void _WheelAdd(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE *pNode);
+static void _WheelRemove(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE *pNode);
+static BOOL _Cascade(_In_ PCHL_TTLCACHE pttl, _In_ UINT nMaxWork, _Inout_ PUINT pnWork);
+static ULONGLONG _NextEventTick(_In_ PCHL_TTLCACHE pttl);
+
+static BOOL _AdvanceWheel(
+    _In_ PCHL_TTLCACHE pttl,
+    _In_ ULONGLONG ullNow,
+    _In_ UINT nMaxWork,
+    _Out_opt_ PUINT pnExpired);
+
+static void _RemoveNode(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE **ppLink);
+static void _ExpireNode(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE **ppLink);
+static void _GrowIndex(_In_ PCHL_TTLCACHE pttl);
+
+ULONGLONG _DefaultClock(_In_opt_ PVOID pvContext)
+{
+    UNREFERENCED_PARAMETER(pvContext);
+    return GetTickCount64();
+}
+
+HRESULT CHL_DsCreateTTL(
+    _Out_ PCHL_TTLCACHE *pTtlOut,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ int nEstEntries,
+    _In_ UINT nTickMs,
+    _In_opt_ CHL_TTL_CLOCK_FN pfnClock,
+    _In_opt_ CHL_TTL_EXPIRE_FN pfnExpire,
+    _In_opt_ PVOID pvContext)
+{
+    PCHL_TTLCACHE pnewttl = NULL;
+    UINT nBuckets = TTL_MIN_BUCKETS;
+
+    HRESULT hr = S_OK;
+
+    // validate parameters
+    if ((pTtlOut == NULL) || IS_INVALID_CHL_KEYTYPE(keyType) || IS_INVALID_CHL_VALTYPE(valType) || (nEstEntries < 0))
+    {
+        hr = E_INVALIDARG;
+        goto error_return;
+    }
+
+    if ((UINT)nEstEntries > nBuckets)
+    {
+        nBuckets = (UINT)nEstEntries;
+    }
+
+    if ((pnewttl = (CHL_TTLCACHE*)calloc(1, sizeof(CHL_TTLCACHE))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto error_return;
+    }
+
+    if ((pnewttl->ppBuckets = (TTL_NODE**)calloc(nBuckets, sizeof(TTL_NODE*))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto error_return;
+    }
+
+    pnewttl->keyType = keyType;
+    pnewttl->valType = valType;
+    pnewttl->fValIsInHeap = fValInHeapMem;
+    pnewttl->nBuckets = nBuckets;
+    pnewttl->ullHashSeed = _GenerateHashSeed();
+    pnewttl->nTickMs = (nTickMs > 0) ? nTickMs : 1;
+    pnewttl->pfnClock = (pfnClock != NULL) ? pfnClock : _DefaultClock;
+    pnewttl->pfnExpire = pfnExpire;
+    pnewttl->pvContext = pvContext;
+    pnewttl->ullCurTick = pnewttl->pfnClock(pvContext) / pnewttl->nTickMs;
+
+    pnewttl->Destroy = CHL_DsDestroyTTL;
+    pnewttl->Insert = CHL_DsInsertTTL;
+    pnewttl->Find = CHL_DsFindTTL;
+    pnewttl->Remove = CHL_DsRemoveTTL;
+    pnewttl->Expire = CHL_DsExpireTTL;
+
+    *pTtlOut = pnewttl;
+    return hr;
+
+error_return:
+    if (pnewttl)
+    {
+        free(pnewttl->ppBuckets);
+        free(pnewttl);
+    }
+    if (pTtlOut)
+    {
+        *pTtlOut = NULL;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsDestroyTTL(_In_ PCHL_TTLCACHE pttl)
+{
+    TTL_NODE *pNode;
+    TTL_NODE *pNext;
+    UINT uBucket;
+
+    ASSERT(pttl);
+
+    for (uBucket = 0; uBucket < pttl->nBuckets; ++uBucket)
+    {
+        for (pNode = pttl->ppBuckets[uBucket]; pNode != NULL; pNode = pNext)
+        {
+            pNext = pNode->pHashNext;
+            _DeleteKey(&pNode->chlKey, pttl->keyType);
+            _DeleteVal(&pNode->chlVal, pttl->valType, pttl->fValIsInHeap);
+            free(pNode);
+        }
+    }
+
+    free(pttl->ppBuckets);
+
+    DBG_MEMSET(pttl, sizeof(CHL_TTLCACHE));
+    free(pttl);
+
+    return S_OK;
+}
+
+HRESULT CHL_DsInsertTTL(
+    _In_ PCHL_TTLCACHE pttl,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _In_ UINT uTtlMs)
+{
+    ULONGLONG ullNow;
+    ULONGLONG ullHash;
+    TTL_NODE **ppLink;
+    TTL_NODE *pNode;
+    CHL_VAL chlNewVal;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pttl);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pttl->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    if (iValSize <= 0 && FAILED(_GetValSize(pvVal, pttl->valType, &iValSize)))
+    {
+        logerr("%s(): Valsize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto done;
+    }
+
+    ullNow = pttl->pfnClock(pttl->pvContext);
+    _AdvanceWheel(pttl, ullNow, CHL_TTL_WORK_PER_CALL, NULL);
+
+    ullHash = _HashKeyBytes64(pvkey, pttl->keyType, iKeySize, pttl->ullHashSeed);
+    ppLink = _FindLink(pttl, pvkey, iKeySize, ullHash);
+    if (*ppLink != NULL)
+    {
+        // An entry that expired but is not yet reclaimed is simply given the new value and TTL
+        pNode = *ppLink;
+        if (!_IsDuplicateVal(&pNode->chlVal, pvVal, pttl->valType, pNode->chlVal.iValSize))
+        {
+            // Copy the new value first so that a failure leaves the entry as it was
+            ZeroMemory(&chlNewVal, sizeof(chlNewVal));
+            hr = _CopyValIn(&chlNewVal, pttl->valType, pvVal, iValSize);
+            if (FAILED(hr))
+            {
+                goto done;
+            }
+
+            _DeleteVal(&pNode->chlVal, pttl->valType, pttl->fValIsInHeap);
+            pNode->chlVal = chlNewVal;
+        }
+
+        _WheelRemove(pttl, pNode);
+        pNode->ullExpireTime = ullNow + uTtlMs;
+        _WheelAdd(pttl, pNode);
+        goto done;
+    }
+
+    if ((pNode = (TTL_NODE*)calloc(1, sizeof(TTL_NODE))) == NULL)
+    {
+        logerr("%s(): calloc() ", __FUNCTION__);
+        hr = E_OUTOFMEMORY;
+        goto done;
+    }
+
+    hr = _CopyKeyIn(&pNode->chlKey, pttl->keyType, pvkey, iKeySize);
+    if (FAILED(hr))
+    {
+        free(pNode);
+        goto done;
+    }
+
+    hr = _CopyValIn(&pNode->chlVal, pttl->valType, pvVal, iValSize);
+    if (FAILED(hr))
+    {
+        _DeleteKey(&pNode->chlKey, pttl->keyType);
+        free(pNode);
+        goto done;
+    }
+
+    pNode->ullHash = ullHash;
+    pNode->ullExpireTime = ullNow + uTtlMs;
+    *ppLink = pNode;
+    _WheelAdd(pttl, pNode);
+
+    ++(pttl->nEntries);
+    if (pttl->nEntries > pttl->nBuckets)
+    {
+        _GrowIndex(pttl);
+    }
+
+done:
+    return hr;
+}
+
+HRESULT CHL_DsFindTTL(
+    _In_ PCHL_TTLCACHE pttl,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT piValSize,
+    _In_opt_ BOOL fGetPointerOnly)
+{
+    ULONGLONG ullNow;
+    TTL_NODE **ppLink;
+    TTL_NODE *pNode;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pttl);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pttl->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto not_found;
+    }
+
+    ullNow = pttl->pfnClock(pttl->pvContext);
+    _AdvanceWheel(pttl, ullNow, CHL_TTL_WORK_PER_CALL, NULL);
+
+    ppLink = _FindLink(pttl, pvkey, iKeySize, _HashKeyBytes64(pvkey, pttl->keyType, iKeySize, pttl->ullHashSeed));
+    if (*ppLink == NULL)
+    {
+        hr = E_NOT_SET;
+        goto not_found;
+    }
+
+    pNode = *ppLink;
+    if (pNode->ullExpireTime <= ullNow)
+    {
+        _ExpireNode(pttl, ppLink);
+        hr = E_NOT_SET;
+        goto not_found;
+    }
+
+    if (pvVal)
+    {
+        hr = _CopyValOut(&pNode->chlVal, pttl->valType, pvVal, piValSize, fGetPointerOnly);
+    }
+
+    if (SUCCEEDED(hr) && (piValSize != NULL))
+    {
+        *piValSize = pNode->chlVal.iValSize;
+    }
+
+    return hr;
+
+not_found:
+    if (piValSize)
+    {
+        *piValSize = 0;
+    }
+    return hr;
+}
+
+HRESULT CHL_DsRemoveTTL(_In_ PCHL_TTLCACHE pttl, _In_ PCVOID pvkey, _In_ int iKeySize)
+{
+    ULONGLONG ullNow;
+    TTL_NODE **ppLink;
+
+    HRESULT hr = S_OK;
+
+    ASSERT(pttl);
+
+    if (iKeySize <= 0 && FAILED(_GetKeySize(pvkey, pttl->keyType, &iKeySize)))
+    {
+        logerr("%s(): Keysize unspecified or unable to determine.", __FUNCTION__);
+        hr = E_INVALIDARG;
+        goto fend;
+    }
+
+    ullNow = pttl->pfnClock(pttl->pvContext);
+    _AdvanceWheel(pttl, ullNow, CHL_TTL_WORK_PER_CALL, NULL);
+
+    ppLink = _FindLink(pttl, pvkey, iKeySize, _HashKeyBytes64(pvkey, pttl->keyType, iKeySize, pttl->ullHashSeed));
+    if (*ppLink == NULL)
+    {
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    if ((*ppLink)->ullExpireTime <= ullNow)
+    {
+        _ExpireNode(pttl, ppLink);
+        hr = E_NOT_SET;
+        goto fend;
+    }
+
+    _RemoveNode(pttl, ppLink);
+
+fend:
+    return hr;
+}
+
+HRESULT CHL_DsExpireTTL(_In_ PCHL_TTLCACHE pttl, _In_ UINT nMaxWork, _Out_opt_ PUINT pnExpired)
+{
+    ASSERT(pttl);
+
+    if (_AdvanceWheel(pttl, pttl->pfnClock(pttl->pvContext), nMaxWork, pnExpired))
+    {
+        return S_OK;
+    }
+    return S_FALSE;
+}
+
+// Returns the link that points to the entry of the key, or the NULL link at the end
+// of the key's bucket if the key is not in the cache
+TTL_NODE** _FindLink(
+    _In_ PCHL_TTLCACHE pttl,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ ULONGLONG ullHash)
+{
+    TTL_NODE **ppLink = &pttl->ppBuckets[_ReduceHash64(ullHash, pttl->nBuckets)];
+
+    for (; *ppLink != NULL; ppLink = &(*ppLink)->pHashNext)
+    {
+        if (((*ppLink)->ullHash == ullHash) && _IsSameKeyBytes(&(*ppLink)->chlKey, pvkey, pttl->keyType, iKeySize))
+        {
+            break;
+        }
+    }
+    return ppLink;
+}
+
+// Chains are short, finding the link to an entry does not need a key compare
+TTL_NODE** _LinkToNode(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE *pNode)
+{
+    TTL_NODE **ppLink = &pttl->ppBuckets[_ReduceHash64(pNode->ullHash, pttl->nBuckets)];
+
+    while (*ppLink != pNode)
+    {
+        ppLink = &(*ppLink)->pHashNext;
+    }
+    return ppLink;
+}
+
+// _BitScanForward64 is only available on 64-bit targets
+UINT _LowestSlot(_In_ ULONGLONG ullMask)
+{
+    DWORD dwIndex;
+
+    ASSERT(ullMask != 0);
+    if (_BitScanForward(&dwIndex, (DWORD)ullMask))
+    {
+        return (UINT)dwIndex;
+    }
+
+    _BitScanForward(&dwIndex, (DWORD)(ullMask >> 32));
+    return (UINT)dwIndex + 32;
+}
+
+// The first tick that starts at or after the expiry time, the entry is reclaimed when the wheel gets there
+ULONGLONG _ExpireTick(_In_ PCHL_TTLCACHE pttl, _In_ ULONGLONG ullExpireTime)
+{
+    return (ullExpireTime / pttl->nTickMs) + (((ullExpireTime % pttl->nTickMs) != 0) ? 1 : 0);
+}
+
+// Places the entry in the lowest level whose slots are still ahead of the wheel for the entry's
+// tick: level n holds entries due in CHL_TTL_WHEEL_SLOTS^n to CHL_TTL_WHEEL_SLOTS^(n+1) ticks.
+// Entries due beyond the top level are placed in its farthest slot and placed again from there.
+void _WheelAdd(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE *pNode)
+{
+    ULONGLONG ullTick = _ExpireTick(pttl, pNode->ullExpireTime);
+    ULONGLONG ullDelta;
+    UINT uLevel;
+    UINT uSlot;
+    TTL_NODE **ppSlot;
+
+    if (ullTick < pttl->ullCurTick)
+    {
+        ullTick = pttl->ullCurTick;
+    }
+
+    ullDelta = ullTick - pttl->ullCurTick;
+    if (ullDelta >= TTL_WHEEL_SPAN)
+    {
+        ullTick = pttl->ullCurTick + TTL_WHEEL_SPAN - 1;
+        ullDelta = TTL_WHEEL_SPAN - 1;
+    }
+
+    for (uLevel = 0; ullDelta >= (1ULL << TTL_LEVEL_SHIFT(uLevel + 1)); ++uLevel)
+        ;
+
+    uSlot = (UINT)(ullTick >> TTL_LEVEL_SHIFT(uLevel)) & TTL_SLOT_MASK;
+    ppSlot = &pttl->apWheel[uLevel][uSlot];
+
+    pNode->uWheelSlot = (uLevel * CHL_TTL_WHEEL_SLOTS) + uSlot;
+    pNode->ppWheelPrev = ppSlot;
+    pNode->pWheelNext = *ppSlot;
+    if (*ppSlot != NULL)
+    {
+        (*ppSlot)->ppWheelPrev = &pNode->pWheelNext;
+    }
+    *ppSlot = pNode;
+
+    pttl->aullSlotMask[uLevel] |= (1ULL << uSlot);
+}
+
+void _WheelRemove(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE *pNode)
+{
+    UINT uLevel = pNode->uWheelSlot / CHL_TTL_WHEEL_SLOTS;
+    UINT uSlot = pNode->uWheelSlot % CHL_TTL_WHEEL_SLOTS;
+
+    *pNode->ppWheelPrev = pNode->pWheelNext;
+    if (pNode->pWheelNext != NULL)
+    {
+        pNode->pWheelNext->ppWheelPrev = pNode->ppWheelPrev;
+    }
+
+    if (pttl->apWheel[uLevel][uSlot] == NULL)
+    {
+        pttl->aullSlotMask[uLevel] &= ~(1ULL << uSlot);
+    }
+}
+
+// When the wheel reaches a tick that starts a slot of a higher level, that slot's entries are
+// placed again. They are now due within the span of a lower level. Returns FALSE if the work
+// limit was reached first, the remaining entries are moved by the next call.
+BOOL _Cascade(_In_ PCHL_TTLCACHE pttl, _In_ UINT nMaxWork, _Inout_ PUINT pnWork)
+{
+    UINT uLevel;
+    TTL_NODE **ppSlot;
+    TTL_NODE *pNode;
+
+    for (uLevel = 1; uLevel < CHL_TTL_WHEEL_LEVELS; ++uLevel)
+    {
+        if ((pttl->ullCurTick & ((1ULL << TTL_LEVEL_SHIFT(uLevel)) - 1)) != 0)
+        {
+            break;
+        }
+
+        ppSlot = &pttl->apWheel[uLevel][(pttl->ullCurTick >> TTL_LEVEL_SHIFT(uLevel)) & TTL_SLOT_MASK];
+        while ((pNode = *ppSlot) != NULL)
+        {
+            if ((nMaxWork > 0) && (*pnWork >= nMaxWork))
+            {
+                return FALSE;
+            }
+
+            _WheelRemove(pttl, pNode);
+            _WheelAdd(pttl, pNode);
+            ++(*pnWork);
+        }
+    }
+    return TRUE;
+}
+
+// Returns the next tick after the current one at which a slot of any level needs work, or a
+// tick before it, so that the wheel can skip the ticks in between. The level 0 slot of the
+// current tick must be empty.
+ULONGLONG _NextEventTick(_In_ PCHL_TTLCACHE pttl)
+{
+    ULONGLONG ullNext = ULLONG_MAX;
+    ULONGLONG ullCandidate;
+    ULONGLONG ullAhead;
+    ULONGLONG ullMask;
+    UINT uLevel;
+    UINT uShift;
+    UINT uIndex;
+
+    for (uLevel = 0; uLevel < CHL_TTL_WHEEL_LEVELS; ++uLevel)
+    {
+        ullMask = pttl->aullSlotMask[uLevel];
+        if (ullMask == 0)
+        {
+            continue;
+        }
+
+        uShift = TTL_LEVEL_SHIFT(uLevel);
+        uIndex = (UINT)(pttl->ullCurTick >> uShift) & TTL_SLOT_MASK;
+
+        // Slots after the current index are reached in this turn of the level. The slots up to
+        // and including it are reached in the next turn, not before the level wraps around.
+        ullAhead = ullMask & ~((2ULL << uIndex) - 1);
+        if (ullAhead != 0)
+        {
+            ullCandidate = ((pttl->ullCurTick >> (uShift + CHL_TTL_WHEEL_BITS)) << (uShift + CHL_TTL_WHEEL_BITS)) |
+                ((ULONGLONG)_LowestSlot(ullAhead) << uShift);
+        }
+        else
+        {
+            ullCandidate = ((pttl->ullCurTick >> (uShift + CHL_TTL_WHEEL_BITS)) + 1) << (uShift + CHL_TTL_WHEEL_BITS);
+        }
+
+        if (ullCandidate < ullNext)
+        {
+            ullNext = ullCandidate;
+        }
+    }
+    return ullNext;
+}
+
+// Moves the wheel forward to the tick of ullNow, reclaiming the entries of each level 0 slot
+// it passes and cascading higher levels as it reaches their slots. Returns FALSE if the work
+// limit was reached before the wheel got to ullNow.
+BOOL _AdvanceWheel(
+    _In_ PCHL_TTLCACHE pttl,
+    _In_ ULONGLONG ullNow,
+    _In_ UINT nMaxWork,
+    _Out_opt_ PUINT pnExpired)
+{
+    ULONGLONG ullNowTick = ullNow / pttl->nTickMs;
+    ULONGLONG ullNext;
+    TTL_NODE **ppSlot;
+    TTL_NODE *pNode;
+    UINT nWork = 0;
+    UINT nExpired = 0;
+    BOOL fCaughtUp = FALSE;
+
+    for (;;)
+    {
+        if (pttl->fCascadePending)
+        {
+            if (!_Cascade(pttl, nMaxWork, &nWork))
+            {
+                break;
+            }
+            pttl->fCascadePending = FALSE;
+        }
+
+        if (pttl->ullCurTick > ullNowTick)
+        {
+            fCaughtUp = TRUE;
+            break;
+        }
+
+        ppSlot = &pttl->apWheel[0][pttl->ullCurTick & TTL_SLOT_MASK];
+        while ((pNode = *ppSlot) != NULL)
+        {
+            if ((nMaxWork > 0) && (nWork >= nMaxWork))
+            {
+                goto done;
+            }
+
+            _ExpireNode(pttl, _LinkToNode(pttl, pNode));
+            ++nWork;
+            ++nExpired;
+        }
+
+        // Never past the tick after ullNow, entries inserted later may be due then
+        ullNext = _NextEventTick(pttl);
+        pttl->ullCurTick = (ullNext <= ullNowTick) ? ullNext : (ullNowTick + 1);
+        pttl->fCascadePending = TRUE;
+    }
+
+done:
+    if (pnExpired)
+    {
+        *pnExpired = nExpired;
+    }
+    return fCaughtUp;
+}
+
+// Unlinks the entry from its bucket and from the wheel, and frees it
+void _RemoveNode(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE **ppLink)
+{
+    TTL_NODE *pNode = *ppLink;
+
+    *ppLink = pNode->pHashNext;
+    _WheelRemove(pttl, pNode);
+
+    --(pttl->nEntries);
+
+    _DeleteKey(&pNode->chlKey, pttl->keyType);
+    _DeleteVal(&pNode->chlVal, pttl->valType, pttl->fValIsInHeap);
+    free(pNode);
+}
+
+void _ExpireNode(_In_ PCHL_TTLCACHE pttl, _In_ TTL_NODE **ppLink)
+{
+    TTL_NODE *pNode = *ppLink;
+
+    if (pttl->pfnExpire != NULL)
+    {
+        pttl->pfnExpire(
+            _GetKeyArg(&pNode->chlKey, pttl->keyType), pNode->chlKey.iKeySize,
+            _GetValArg(&pNode->chlVal, pttl->valType), pNode->chlVal.iValSize,
+            pttl->pvContext);
+    }
+
+    _RemoveNode(pttl, ppLink);
+    ++(pttl->ullExpired);
+}
+
+// Doubles the number of buckets. If memory for the new buckets cannot be allocated,
+// the cache keeps working with longer chains.
+void _GrowIndex(_In_ PCHL_TTLCACHE pttl)
+{
+    TTL_NODE **ppNewBuckets;
+    TTL_NODE **ppBucket;
+    TTL_NODE *pNode;
+    TTL_NODE *pNext;
+    UINT nNewBuckets;
+    UINT uBucket;
+
+    if (pttl->nBuckets > (UINT_MAX / 2))
+    {
+        return;
+    }
+
+    nNewBuckets = pttl->nBuckets * 2;
+    if ((ppNewBuckets = (TTL_NODE**)calloc(nNewBuckets, sizeof(TTL_NODE*))) == NULL)
+    {
+        logwarn("%s(): calloc() ", __FUNCTION__);
+        return;
+    }
+
+    for (uBucket = 0; uBucket < pttl->nBuckets; ++uBucket)
+    {
+        for (pNode = pttl->ppBuckets[uBucket]; pNode != NULL; pNode = pNext)
+        {
+            pNext = pNode->pHashNext;
+            ppBucket = &ppNewBuckets[_ReduceHash64(pNode->ullHash, nNewBuckets)];
+            pNode->pHashNext = *ppBucket;
+            *ppBucket = pNode;
+        }
+    }
+
+    free(pttl->ppBuckets);
+    pttl->ppBuckets = ppNewBuckets;
+    pttl->nBuckets = nNewBuckets;
+}
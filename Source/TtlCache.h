@@ -0,0 +1,201 @@
+// TtlCache.h
+// Cache whose entries expire after a per-entry time to live, reclaimed by a hierarchical timing wheel
+// Shishir Bhat (http://www.shishirbhat.com)
+// History
+//      10/17/26 Initial version
+//
+
+#ifndef _TTLCACHE_H
+#define _TTLCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Defines.h"
+#include "MemFunctions.h"
+
+// The timing wheel has CHL_TTL_WHEEL_LEVELS levels of CHL_TTL_WHEEL_SLOTS slots each.
+// A slot of level 0 spans one tick, a slot of level n spans CHL_TTL_WHEEL_SLOTS^n ticks.
+#define CHL_TTL_WHEEL_BITS      6
+#define CHL_TTL_WHEEL_SLOTS     (1 << CHL_TTL_WHEEL_BITS)
+#define CHL_TTL_WHEEL_LEVELS    5
+
+// Wheel work done by each Insert, Find and Remove, see CHL_DsExpireTTL
+#define CHL_TTL_WORK_PER_CALL   16
+
+// A cache entry is a node of the key index and of a timing wheel slot at the same time
+typedef struct _ttlNode {
+    struct _ttlNode *pHashNext;     // Next entry in the same bucket of the index
+    struct _ttlNode *pWheelNext;    // Next entry in the same wheel slot
+    struct _ttlNode **ppWheelPrev;  // Link that points to this entry in its wheel slot
+    UINT uWheelSlot;                // Index of the slot in the wheel, level * CHL_TTL_WHEEL_SLOTS + slot
+    ULONGLONG ullHash;              // Full hash of chlKey
+    ULONGLONG ullExpireTime;        // Time at which the entry expires, in milliseconds of the cache clock
+    CHL_KEY chlKey;
+    CHL_VAL chlVal;
+}TTL_NODE;
+
+// Returns the current time in milliseconds. Must never go backwards.
+typedef ULONGLONG (*CHL_TTL_CLOCK_FN)(PVOID pvContext);
+
+// Called for every entry that expires, before the cache frees its copy of the key and value.
+// The key and value are passed as CHL_DsGetCurrentHT would pass them with fGetPointerOnly:
+// integers cast to pointers, otherwise pointers to the stored copies. Entries that are
+// removed, overwritten or destroyed with the cache do not expire.
+// Params:
+//      pvKey: The key of the expired entry.
+//      iKeySize: Size of the key in bytes.
+//      pvVal: The value of the expired entry.
+//      iValSize: Size of the value in bytes.
+//      pvContext: Context passed to CHL_DsCreateTTL.
+//
+typedef void (*CHL_TTL_EXPIRE_FN)(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext);
+
+// The TTL cache itself
+typedef struct _ttlCache CHL_TTLCACHE, *PCHL_TTLCACHE;
+struct _ttlCache {
+    CHL_KEYTYPE keyType;    // Type information for the cache key
+    CHL_VALTYPE valType;    // Type information for the cache value
+    BOOL fValIsInHeap;      // Whether value was allocated on heap by client (for CHL_VT_POINTER only)
+
+    TTL_NODE **ppBuckets;   // Key index, each bucket is a chain of entries
+    UINT nBuckets;          // Number of buckets
+    ULONGLONG ullHashSeed;  // Random per-cache seed for the key hash
+    UINT nEntries;          // Number of entries, including expired ones that are not yet reclaimed
+
+    // Timing wheel. Every entry is in the slot of the tick it expires at, or in a slot of a
+    // higher level that spans that tick. Slots of higher levels are moved down a level as
+    // the wheel reaches them.
+    TTL_NODE *apWheel[CHL_TTL_WHEEL_LEVELS][CHL_TTL_WHEEL_SLOTS];
+    ULONGLONG aullSlotMask[CHL_TTL_WHEEL_LEVELS];  // Bit per slot that is not empty, to skip idle ticks
+    UINT nTickMs;           // Milliseconds per tick
+    ULONGLONG ullCurTick;   // Tick the wheel is at, entries expiring at earlier ticks have been reclaimed
+    BOOL fCascadePending;   // Slots of higher levels due at ullCurTick are not yet moved down
+
+    CHL_TTL_CLOCK_FN pfnClock;      // Clock, GetTickCount64 if not specified
+    CHL_TTL_EXPIRE_FN pfnExpire;    // Optional expiration callback
+    PVOID pvContext;                // Passed to pfnClock and pfnExpire
+
+    ULONGLONG ullExpired;   // Number of entries that expired so far
+
+    // Access methods
+    HRESULT (*Destroy)(PCHL_TTLCACHE pttl);
+
+    HRESULT (*Insert)(
+        PCHL_TTLCACHE pttl,
+        PCVOID pvkey,
+        int iKeySize,
+        PCVOID pvVal,
+        int iValSize,
+        UINT uTtlMs);
+
+    HRESULT (*Find)(
+        PCHL_TTLCACHE pttl,
+        PCVOID pvkey,
+        int iKeySize,
+        PVOID pvVal,
+        PINT pvalsize,
+        BOOL fGetPointerOnly);
+
+    HRESULT (*Remove)(PCHL_TTLCACHE pttl, PCVOID pvkey, int iKeySize);
+    HRESULT (*Expire)(PCHL_TTLCACHE pttl, UINT nMaxWork, PUINT pnExpired);
+};
+
+// -------------------------------------------
+// Functions exported
+
+// Creates a TTL cache and returns a pointer which can be used for later operations on it.
+// The cache has the same key and value semantics as CHL_FHTABLE: string keys are compared
+// as iKeySize bytes. Every entry has its own time to live. An expired entry is never found,
+// and is reclaimed by a later call on the cache: Insert, Find and Remove each advance the
+// timing wheel by up to CHL_TTL_WORK_PER_CALL units of work, and Find and Remove reclaim the
+// entry they find expired. An entry costs at most one unit per level of the wheel over its
+// lifetime, there is never a sweep over all entries. Callers that do not touch the cache
+// for a while can call CHL_DsExpireTTL.
+// Params:
+//      pTtlOut: Address of pointer where to copy the pointer to the cache
+//      keyType: Type of variable that is used as key - a string or a number
+//      valType: Type of value that is stored - number, string or void(can be anything)
+//      fValInHeapMem: Set this to true if the value(type is CHL_VT_POINTER) is allocated memory on the heap.
+//                     This indicates the cache to free it when an entry expires or is removed.
+//      nEstEntries: Estimated number of entries, the index grows as needed.
+//      nTickMs: Resolution of the timing wheel in milliseconds, 0 for 1 millisecond. Entries are
+//               reclaimed up to one tick after they expire. With 5 levels of 64 slots, TTLs of up to
+//               2^30 ticks are placed directly, longer ones are placed again when the wheel gets to them.
+//      pfnClock: Optional. Clock that the TTLs are measured with, GetTickCount64 if NULL.
+//      pfnExpire: Optional. Called for each entry that expires.
+//      pvContext: Optional. Passed to pfnClock and pfnExpire.
+//
+DllExpImp HRESULT CHL_DsCreateTTL(
+    _Out_ CHL_TTLCACHE **pTtlOut,
+    _In_ CHL_KEYTYPE keyType,
+    _In_ CHL_VALTYPE valType,
+    _In_opt_ BOOL fValInHeapMem,
+    _In_ int nEstEntries,
+    _In_ UINT nTickMs,
+    _In_opt_ CHL_TTL_CLOCK_FN pfnClock,
+    _In_opt_ CHL_TTL_EXPIRE_FN pfnExpire,
+    _In_opt_ PVOID pvContext);
+
+// Destroy the cache by removing all key-value pairs from it. The expiration callback is not called.
+// The CHL_TTLCACHE object itself is also destroyed.
+// Params:
+//      pttl: Pointer to the cache object returned by CHL_DsCreateTTL function.
+//
+DllExpImp HRESULT CHL_DsDestroyTTL(_In_ CHL_TTLCACHE *pttl);
+
+// Inserts a key,value pair into the cache that expires uTtlMs milliseconds from now. If the key
+// already exists, then the value is over-written with the new value and the new TTL replaces the old one.
+// Params:
+//      pttl: Pointer to the cache object returned by CHL_DsCreateTTL function.
+//      pvkey, iKeySize, pvVal, iValSize: Refer documentation of the CHL_DsInsertHT() function.
+//      uTtlMs: Time to live of the entry in milliseconds.
+//
+DllExpImp HRESULT CHL_DsInsertTTL(
+    _In_ CHL_TTLCACHE *pttl,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _In_ PCVOID pvVal,
+    _In_ int iValSize,
+    _In_ UINT uTtlMs);
+
+// Find the specified key in the cache. Returns E_NOT_SET if the key is not present or has expired.
+// With fGetPointerOnly, the returned pointer is valid until the next call on the cache that
+// modifies it, including other Finds, which may reclaim expired entries.
+// Params: Refer documentation of the CHL_DsFindHT() function.
+//
+DllExpImp HRESULT CHL_DsFindTTL(
+    _In_ CHL_TTLCACHE *pttl,
+    _In_ PCVOID pvkey,
+    _In_ int iKeySize,
+    _Inout_opt_ PVOID pvVal,
+    _Inout_opt_ PINT pvalsize,
+    _In_opt_ BOOL fGetPointerOnly);
+
+// Deletes the specified key from the cache, the expiration callback is not called. Returns E_NOT_SET
+// if the key is not present or has expired, an expired entry is reclaimed as expired.
+// Params:
+//      pttl: Pointer to the cache object returned by CHL_DsCreateTTL function.
+//      pvkey: Pointer to the key. For primitive types, this is the primitive value casted to a PCVOID.
+//      iKeySize: Size of the key in bytes. For null-terminated strings, zero may be passed.
+//
+DllExpImp HRESULT CHL_DsRemoveTTL(_In_ CHL_TTLCACHE *pttl, _In_ PCVOID pvkey, _In_ int iKeySize);
+
+// Advances the timing wheel towards the current time. Each entry that is reclaimed, and each entry
+// that is moved down a level as the wheel reaches its slot, is one unit of work. Ticks without
+// entries are skipped at no cost. If the work limit is reached, the wheel stops where it is and
+// the next call continues from there.
+// Params:
+//      pttl: Pointer to the cache object returned by CHL_DsCreateTTL function.
+//      nMaxWork: Most units of work to do, 0 for no limit.
+//      pnExpired: Optional. Receives the number of entries reclaimed.
+// Returns S_OK if the wheel reached the current time, S_FALSE if it stopped at the work limit.
+//
+DllExpImp HRESULT CHL_DsExpireTTL(_In_ CHL_TTLCACHE *pttl, _In_ UINT nMaxWork, _Out_opt_ PUINT pnExpired);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TTLCACHE_H
@@ -150,6 +150,12 @@ int CompareFn_Int32(const PVOID pvLeft, const PVOID pvRight)
     return 0;
 }
 
+// Compares only the upper 16 bits, so that values differing in the lower ones are equal
+int CompareFn_Int32HighWord(const PVOID pvLeft, const PVOID pvRight)
+{
+    return CompareFn_Int32((PVOID)((int)pvLeft >> 16), (PVOID)((int)pvRight >> 16));
+}
+
 int CompareFn_WString(const PVOID pvLeft, const PVOID pvRight)
 {
     PCWSTR pszLeft = (PCWSTR)pvLeft;
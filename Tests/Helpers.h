@@ -44,6 +44,7 @@ std::unique_ptr<std::vector<int>> GenerateRandomNumbers(_In_ int count);
 std::unique_ptr<std::vector<std::wstring>> GenerateRandomStrings(_In_ int count, _In_z_ PCWSTR pszSourceChars);
 
 int CompareFn_Int32(const PVOID pvLeft, const PVOID pvRight);
+int CompareFn_Int32HighWord(const PVOID pvLeft, const PVOID pvRight);
 int CompareFn_WString(const PVOID pvLeft, const PVOID pvRight);
 
 template <class T, class Fn>
@@ -19,6 +19,7 @@
 #include <list>
 #include <memory>
 #include <algorithm>
+#include <thread>
 
 // Headers for CppUnitTest
 #include "CppUnitTest.h"
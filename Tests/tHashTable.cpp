@@ -24,8 +24,38 @@ public:
 
     TEST_METHOD(Iteration_WStrInt);
     TEST_METHOD(IterationAndRemoval_WStrInt);
+
+    TEST_METHOD(GrowAndShrink_IntInt);
+    TEST_METHOD(IterationDuringResize_WStrInt);
+    TEST_METHOD(SetLoadFactor);
+    TEST_METHOD(SetHashType);
+    TEST_METHOD(HashTypes_WStrInt);
+    TEST_METHOD(CachedHashAfterGrow_WStrInt);
+    TEST_METHOD(FindOrInsert_WStrInt);
+    TEST_METHOD(FindOrInsert_IntWStr);
+    TEST_METHOD(FindBatchInsertBatch_WStrInt);
+    TEST_METHOD(ConcurrentInsertFindRemove_IntInt);
+    TEST_METHOD(LockFreeReads_IntUserObj);
+    TEST_METHOD(GetStats_StrInt);
+    TEST_METHOD(Compact_StrInt);
+    TEST_METHOD(ByteBudget_IntStr);
+    TEST_METHOD(ByteBudgetOldest_IntInt);
+    TEST_METHOD(Merge_StrInt);
+    TEST_METHOD(MergeMany_IntUint);
+    TEST_METHOD(Multimap_StrInt);
+    TEST_METHOD(KeyHandles_StrInt);
+    TEST_METHOD(KeyHandlesSeeded_StrInt);
+    TEST_METHOD(EntryHandles_StrInt);
+
+private:
+    static void OnEvictInt(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext);
 };
 
+void HashtableUnitTests::OnEvictInt(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext)
+{
+    ((std::vector<int>*)pvContext)->push_back((int)(INT_PTR)pvKey);
+}
+
 void HashtableUnitTests::CreateAndDestroy()
 {
     static int s_tableSizes[] = { 1, 4, 16, 33, 78, 9999, 354972 };
@@ -53,10 +83,16 @@ void HashtableUnitTests::FunctionPointers()
     Assert::IsNotNull((PVOID)pht->Destroy);
     Assert::IsNotNull((PVOID)pht->Dump);
     Assert::IsNotNull((PVOID)pht->Find);
+    Assert::IsNotNull((PVOID)pht->FindOrInsert);
+    Assert::IsNotNull((PVOID)pht->FindBatch);
+    Assert::IsNotNull((PVOID)pht->InsertBatch);
     Assert::IsNotNull((PVOID)pht->InitIterator);
     Assert::IsNotNull((PVOID)pht->Insert);
     Assert::IsNotNull((PVOID)pht->Remove);
     Assert::IsNotNull((PVOID)pht->RemoveAt);
+    Assert::IsNotNull((PVOID)pht->BeginRead);
+    Assert::IsNotNull((PVOID)pht->EndRead);
+    Assert::IsNotNull((PVOID)pht->GetStats);
     Assert::IsTrue(SUCCEEDED(CHL_DsDestroyHT(pht)));
 }
 
@@ -283,6 +319,22 @@ void HashtableUnitTests::InsertFindRemove_IntObj()
         Assert::IsTrue((objs[idx] == st), L"Retrieved struct ptr matches expected struct");
     }
 
+    // Replace a value with a longer object that starts with the same bytes, the new one must be stored
+    {
+        struct { Helpers::TestStruct st; int extra; } longerObj = { objs[0], 42 };
+        auto key = keysVector[0];
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)key, sizeof(int), &longerObj, sizeof(longerObj))));
+
+        Helpers::TestStruct st;
+        int valSize = sizeof(st);
+        Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER), pht->Find(pht, (PVOID)key, sizeof(int), &st, &valSize, FALSE));
+        Assert::AreEqual((int)sizeof(longerObj), valSize, L"Replaced object has the new size");
+
+        decltype(longerObj) foundObj;
+        Assert::AreEqual(S_OK, pht->Find(pht, (PVOID)key, sizeof(int), &foundObj, &valSize, FALSE));
+        Assert::AreEqual(0, memcmp(&foundObj, &longerObj, sizeof(longerObj)), L"Replaced object has the new bytes");
+    }
+
     // Remove all keys
     for (int idx = 0; idx < c_numValues; ++idx)
     {
@@ -437,4 +489,1328 @@ void HashtableUnitTests::IterationAndRemoval_WStrInt()
     Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
 }
 
+void HashtableUnitTests::GrowAndShrink_IntInt()
+{
+    const int c_nItems = 10000;
+    const int c_nItemsToKeep = 10;
+
+    // Hashtable with KT = Int, VT = Int, created much smaller than what is inserted
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 1, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+    int initialTableSize = pht->nTableSize;
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)idx, sizeof(int), (PVOID)(idx * 2), sizeof(int))));
+    }
+
+    Assert::AreEqual(c_nItems, pht->nEntries);
+    Assert::IsTrue(pht->nTableSize >= c_nItems, L"Table must have grown to at least one bucket per entry");
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        int val;
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)idx, sizeof(int), &val, nullptr, FALSE)));
+        Assert::AreEqual(idx * 2, val, L"Retrieved value must match expected value");
+    }
+
+    for (int idx = c_nItemsToKeep; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Remove(pht, (PCVOID)idx, sizeof(int))));
+    }
+
+    Assert::AreEqual(c_nItemsToKeep, pht->nEntries);
+    Assert::IsTrue(pht->nTableSize < c_nItems, L"Table must have shrunk");
+    Assert::IsTrue(pht->nTableSize >= initialTableSize, L"Table must not shrink below its initial size");
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        HRESULT hr = pht->Find(pht, (PCVOID)idx, sizeof(int), nullptr, nullptr, FALSE);
+        Assert::AreEqual((idx < c_nItemsToKeep) ? S_OK : E_NOT_SET, hr);
+    }
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::IterationDuringResize_WStrInt()
+{
+    const int c_nItems = 1000;
+    auto spKeys = Helpers::GenerateRandomStrings(c_nItems, Helpers::s_randomStrSource_AlphaNum);
+
+    // Hashtable with KT = WStr, VT = Int
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+
+    // Insert until a resize is in progress
+    int nInserted = 0;
+    while ((nInserted < c_nItems) && ((nInserted < 100) || (pht->phtNodesOld == NULL)))
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)(*spKeys)[nInserted].c_str(), 0, (PVOID)nInserted, sizeof(int))));
+        ++nInserted;
+    }
+    Assert::IsNotNull(pht->phtNodesOld, L"Resize must be in progress");
+
+    // Let a lookup migrate part of it
+    Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[0].c_str(), 0, nullptr, nullptr, FALSE)));
+    Assert::IsNotNull(pht->phtNodesOld, L"Resize must still be in progress");
+    Assert::IsTrue(pht->iMigrateIndex > 0);
+
+    // An active iterator holds back the resize, ending it lets lookups continue
+    int iMigrateIndex = pht->iMigrateIndex;
+    CHL_HT_ITERATOR htItr;
+    Assert::IsTrue(SUCCEEDED(pht->InitIterator(pht, &htItr)));
+    Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[0].c_str(), 0, nullptr, nullptr, FALSE)));
+    Assert::AreEqual(iMigrateIndex, pht->iMigrateIndex);
+    Assert::AreEqual(S_OK, htItr.End(&htItr));
+    Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[0].c_str(), 0, nullptr, nullptr, FALSE)));
+    Assert::IsTrue(pht->iMigrateIndex > iMigrateIndex);
+    Assert::IsNotNull(pht->phtNodesOld, L"Resize must still be in progress");
+
+    // Iteration sees each entry exactly once, with lookups of the current and other keys
+    // and inserts of new keys between its steps. The resize stays where it was.
+    const int nBefore = nInserted;
+    std::vector<int> nSeen(c_nItems, 0);
+    int nFound = 0;
+    int iVal;
+    iMigrateIndex = pht->iMigrateIndex;
+    Assert::IsTrue(SUCCEEDED(pht->InitIterator(pht, &htItr)));
+    do
+    {
+        Assert::AreEqual(S_OK, htItr.GetCurrent(&htItr, nullptr, nullptr, &iVal, nullptr, TRUE));
+        Assert::IsTrue((iVal >= 0) && (iVal < nInserted));
+        ++nSeen[iVal];
+
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[iVal].c_str(), 0, nullptr, nullptr, FALSE)));
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[nFound % nBefore].c_str(), 0, nullptr, nullptr, FALSE)));
+        if (nInserted < c_nItems)
+        {
+            Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)(*spKeys)[nInserted].c_str(), 0, (PVOID)nInserted, sizeof(int))));
+            ++nInserted;
+        }
+        ++nFound;
+    } while (SUCCEEDED(htItr.MoveNext(&htItr)));
+
+    for (int idx = 0; idx < nBefore; ++idx)
+    {
+        Assert::AreEqual(1, nSeen[idx], L"Entry must be visited exactly once");
+    }
+    for (int idx = nBefore; idx < nInserted; ++idx)
+    {
+        Assert::IsTrue(nSeen[idx] <= 1, L"Entry inserted during iteration must be visited at most once");
+    }
+    Assert::IsNotNull(pht->phtNodesOld, L"Iteration must not complete the resize");
+    Assert::AreEqual(iMigrateIndex, pht->iMigrateIndex);
+
+    // Once the iterator has reached the end, lookups complete the resize
+    for (int idx = 0; (idx < nInserted) && (pht->phtNodesOld != NULL); ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[idx].c_str(), 0, nullptr, nullptr, FALSE)));
+    }
+    Assert::IsNull(pht->phtNodesOld);
+    Assert::AreEqual(0, pht->nActiveIterators);
+
+    // Iteration after the resize sees every entry
+    nFound = 0;
+    Assert::IsTrue(SUCCEEDED(pht->InitIterator(pht, &htItr)));
+    do
+    {
+        Assert::AreEqual(S_OK, htItr.GetCurrent(&htItr, nullptr, nullptr, &iVal, nullptr, TRUE));
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[iVal].c_str(), 0, nullptr, nullptr, FALSE)));
+        ++nFound;
+    } while (SUCCEEDED(htItr.MoveNext(&htItr)));
+    Assert::AreEqual(nInserted, nFound);
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::SetLoadFactor()
+{
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+
+    Assert::AreEqual(E_INVALIDARG, pht->SetLoadFactor(pht, 50, 10), L"Grow threshold must leave room after a resize");
+    Assert::AreEqual(E_INVALIDARG, pht->SetLoadFactor(pht, 100, 25), L"Shrink threshold must leave room after a resize");
+    Assert::AreEqual(E_INVALIDARG, pht->SetLoadFactor(pht, -1, 10));
+
+    // Disable growing, table stays at its initial size
+    Assert::IsTrue(SUCCEEDED(pht->SetLoadFactor(pht, 0, 0)));
+    int initialTableSize = pht->nTableSize;
+    for (int idx = 0; idx < initialTableSize * 4; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)idx, sizeof(int), (PVOID)idx, sizeof(int))));
+    }
+    Assert::AreEqual(initialTableSize, pht->nTableSize);
+
+    // Enabling it again grows the table
+    Assert::IsTrue(SUCCEEDED(pht->SetLoadFactor(pht, 200, 10)));
+    Assert::IsTrue(pht->nTableSize > initialTableSize);
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::SetHashType()
+{
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+    Assert::AreEqual((int)CHL_HT_HASH_SEEDED64, (int)pht->hashType, L"Seeded hash is the default");
+
+    Assert::AreEqual(E_INVALIDARG, pht->SetHashType(pht, CHL_HT_HASH_START));
+    Assert::AreEqual(E_INVALIDARG, pht->SetHashType(pht, CHL_HT_HASH_END));
+
+    Assert::IsTrue(SUCCEEDED(pht->SetHashType(pht, CHL_HT_HASH_DJB2)));
+    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)1, 0, (PVOID)1, 0)));
+    Assert::AreEqual(E_NOT_VALID_STATE, pht->SetHashType(pht, CHL_HT_HASH_SEEDED64), L"Hash type cannot change once there are entries");
+
+    Assert::IsTrue(SUCCEEDED(pht->Remove(pht, (PCVOID)1, 0)));
+    Assert::IsTrue(SUCCEEDED(pht->SetHashType(pht, CHL_HT_HASH_SEEDED64)));
+
+    // Each table gets its own seed
+    PCHL_HTABLE pht2;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht2, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+    Assert::AreNotEqual(pht->ullHashSeed, pht2->ullHashSeed);
+
+    Assert::IsTrue(SUCCEEDED(pht2->Destroy(pht2)));
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::HashTypes_WStrInt()
+{
+    // DJB2 hashes "Aa" and "B@" to the same value, and so every string made of
+    // these two blocks. All of these keys land in one bucket unless the hash is seeded.
+    const int c_nBlocks = 10;
+    const int c_nItems = 1 << c_nBlocks;
+
+    std::vector<std::wstring> keys;
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        std::wstring key;
+        for (int block = 0; block < c_nBlocks; ++block)
+        {
+            key += ((idx >> block) & 1) ? L"B@" : L"Aa";
+        }
+        keys.push_back(key);
+    }
+
+    for (int ht = CHL_HT_HASH_START + 1; ht < CHL_HT_HASH_END; ++ht)
+    {
+        PCHL_HTABLE pht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, c_nItems, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+        Assert::IsTrue(SUCCEEDED(pht->SetHashType(pht, (CHL_HT_HASHTYPE)ht)));
+        Assert::IsTrue(SUCCEEDED(pht->SetLoadFactor(pht, 0, 0)));
+
+        for (int idx = 0; idx < c_nItems; ++idx)
+        {
+            Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)keys[idx].c_str(), 0, (PVOID)idx, sizeof(int))));
+        }
+
+        int maxChain = 0;
+        for (int bucket = 0; bucket < pht->nTableSize; ++bucket)
+        {
+            int chain = pht->phtNodes[bucket].fOccupied ? 1 : 0;
+            for (HT_NODE *pnode = pht->phtNodes[bucket].pnext; pnode != NULL; pnode = pnode->pnext)
+            {
+                ++chain;
+            }
+            maxChain = max(maxChain, chain);
+        }
+        logInfo(L"Hash type %d: longest chain = %d", ht, maxChain);
+        if (ht == CHL_HT_HASH_DJB2)
+        {
+            Assert::AreEqual(c_nItems, maxChain, L"All keys collide with DJB2");
+        }
+        else
+        {
+            Assert::IsTrue(maxChain < 16, L"Seeded hash spreads the keys");
+        }
+
+        for (int idx = 0; idx < c_nItems; ++idx)
+        {
+            int val;
+            Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)keys[idx].c_str(), 0, &val, nullptr, FALSE)));
+            Assert::AreEqual(idx, val);
+            Assert::IsTrue(SUCCEEDED(pht->Remove(pht, (PCVOID)keys[idx].c_str(), 0)));
+        }
+        Assert::AreEqual(0, pht->nEntries);
+
+        Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+    }
+}
+
+void HashtableUnitTests::CachedHashAfterGrow_WStrInt()
+{
+    const int c_nItems = 5000;
+    auto spKeys = Helpers::GenerateRandomStrings(c_nItems, Helpers::s_randomStrSource_AlphaNum);
+
+    for (int ht = CHL_HT_HASH_START + 1; ht < CHL_HT_HASH_END; ++ht)
+    {
+        // Start small so that entries are migrated by several resizes, each of
+        // which places them using the hash cached in their node.
+        PCHL_HTABLE pht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+        Assert::IsTrue(SUCCEEDED(pht->SetHashType(pht, (CHL_HT_HASHTYPE)ht)));
+
+        for (int idx = 0; idx < c_nItems; ++idx)
+        {
+            Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)(*spKeys)[idx].c_str(), 0, (PVOID)idx, sizeof(int))));
+        }
+
+        // Lookups complete a resize in progress
+        for (int idx = 0; (idx < c_nItems) && (pht->phtNodesOld != NULL); ++idx)
+        {
+            Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[idx].c_str(), 0, nullptr, nullptr, FALSE)));
+        }
+        Assert::IsNull(pht->phtNodesOld);
+
+        // Every entry is in the bucket that its key hashes to
+        int nFound = 0;
+        int iVal;
+        int iKeySize;
+        PCWSTR pszKey;
+        CHL_HT_ITERATOR htItr;
+        Assert::IsTrue(SUCCEEDED(pht->InitIterator(pht, &htItr)));
+        do
+        {
+            Assert::IsTrue(SUCCEEDED(htItr.GetCurrent(&htItr, &pszKey, &iKeySize, &iVal, nullptr, TRUE)));
+            Assert::AreEqual(htItr.nCurIndex, (int)_GetBucketIndex(pht, (PCVOID)pszKey, iKeySize, pht->nTableSize));
+            Assert::AreEqual(0, wcscmp(pszKey, (*spKeys)[iVal].c_str()));
+            ++nFound;
+        } while (SUCCEEDED(htItr.MoveNext(&htItr)));
+        Assert::AreEqual(c_nItems, nFound);
+
+        for (int idx = 0; idx < c_nItems; ++idx)
+        {
+            Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[idx].c_str(), 0, &iVal, nullptr, FALSE)));
+            Assert::AreEqual(idx, iVal);
+        }
+
+        Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+    }
+}
+
+void HashtableUnitTests::FindOrInsert_WStrInt()
+{
+    const int c_nItems = 2000;
+    const int c_nRounds = 3;
+    auto spKeys = Helpers::GenerateRandomStrings(c_nItems, Helpers::s_randomStrSource_AlphaNum);
+
+    // Hashtable with KT = WStr, VT = Int
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+
+    // Count occurrences, table grows while doing so
+    for (int round = 0; round < c_nRounds; ++round)
+    {
+        for (int idx = 0; idx < c_nItems; ++idx)
+        {
+            PCHL_VAL pChlVal = nullptr;
+            BOOL fCreated = FALSE;
+            Assert::IsTrue(SUCCEEDED(pht->FindOrInsert(pht, (PCVOID)(*spKeys)[idx].c_str(), 0, (PCVOID)0, sizeof(int), &pChlVal, &fCreated)));
+            Assert::IsNotNull(pChlVal);
+            Assert::AreEqual(round == 0, fCreated == TRUE);
+            Assert::AreEqual(round, pChlVal->valDef.iVal);
+            ++(pChlVal->valDef.iVal);
+        }
+    }
+    Assert::AreEqual(c_nItems, pht->nEntries);
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        int iVal;
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)(*spKeys)[idx].c_str(), 0, &iVal, nullptr, FALSE)));
+        Assert::AreEqual(c_nRounds, iVal);
+    }
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::FindOrInsert_IntWStr()
+{
+    // Hashtable with KT = Int, VT = WStr
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_INT32, CHL_VT_WSTRING, FALSE)));
+
+    PCHL_VAL pChlVal = nullptr;
+    BOOL fCreated = FALSE;
+    Assert::IsTrue(SUCCEEDED(pht->FindOrInsert(pht, (PCVOID)5, 0, L"five", 0, &pChlVal, &fCreated)));
+    Assert::IsTrue(fCreated);
+    Assert::AreEqual(0, wcscmp(L"five", pChlVal->valDef.pwszVal));
+
+    // Value is ignored for an existing key
+    Assert::IsTrue(SUCCEEDED(pht->FindOrInsert(pht, (PCVOID)5, 0, L"other", 0, &pChlVal, &fCreated)));
+    Assert::IsFalse(fCreated);
+    Assert::AreEqual(0, wcscmp(L"five", pChlVal->valDef.pwszVal));
+
+    // Value is only needed when the key is new
+    Assert::IsTrue(SUCCEEDED(pht->FindOrInsert(pht, (PCVOID)5, 0, nullptr, 0, &pChlVal, nullptr)));
+    Assert::AreEqual(E_INVALIDARG, pht->FindOrInsert(pht, (PCVOID)6, 0, nullptr, 0, &pChlVal, &fCreated));
+    Assert::IsNull(pChlVal);
+    Assert::IsFalse(fCreated);
+    Assert::AreEqual(1, pht->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::FindBatchInsertBatch_WStrInt()
+{
+    const int c_nItems = 1000;
+    auto spKeys = Helpers::GenerateRandomStrings(c_nItems, Helpers::s_randomStrSource_AlphaNum);
+
+    std::vector<PVOID> keys;
+    std::vector<PVOID> vals;
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        keys.push_back((PVOID)(*spKeys)[idx].c_str());
+        vals.push_back((PVOID)idx);
+    }
+
+    // Hashtable with KT = WStr, VT = Int
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+
+    std::vector<HRESULT> results(c_nItems, E_FAIL);
+    Assert::IsTrue(SUCCEEDED(pht->InsertBatch(pht, keys.data(), nullptr, vals.data(), nullptr, c_nItems, results.data())));
+    Assert::AreEqual(c_nItems, pht->nEntries);
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::AreEqual(S_OK, results[idx]);
+    }
+
+    // Every third key is one that is not in the table
+    const WCHAR c_szMissing[] = L"#not-a-key#";
+    std::vector<PVOID> lookups;
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        lookups.push_back((idx % 3 == 0) ? (PVOID)c_szMissing : keys[c_nItems - 1 - idx]);
+    }
+
+    std::vector<PCHL_VAL> foundVals(c_nItems, nullptr);
+    Assert::AreEqual(E_NOT_SET, pht->FindBatch(pht, lookups.data(), nullptr, c_nItems, foundVals.data(), results.data()));
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        if (idx % 3 == 0)
+        {
+            Assert::AreEqual(E_NOT_SET, results[idx]);
+            Assert::IsNull(foundVals[idx]);
+        }
+        else
+        {
+            Assert::AreEqual(S_OK, results[idx]);
+            Assert::AreEqual(c_nItems - 1 - idx, foundVals[idx]->valDef.iVal);
+        }
+    }
+
+    // Inserting existing keys updates their values
+    std::vector<PVOID> newVals(c_nItems, (PVOID)-1);
+    Assert::IsTrue(SUCCEEDED(pht->InsertBatch(pht, keys.data(), nullptr, newVals.data(), nullptr, c_nItems, nullptr)));
+    Assert::AreEqual(c_nItems, pht->nEntries);
+    Assert::IsTrue(SUCCEEDED(pht->FindBatch(pht, keys.data(), nullptr, c_nItems, foundVals.data(), nullptr)));
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::AreEqual(-1, foundVals[idx]->valDef.iVal);
+    }
+
+    Assert::AreEqual(E_INVALIDARG, pht->FindBatch(pht, nullptr, nullptr, 1, foundVals.data(), nullptr));
+    Assert::IsTrue(SUCCEEDED(pht->FindBatch(pht, nullptr, nullptr, 0, nullptr, nullptr)));
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::ConcurrentInsertFindRemove_IntInt()
+{
+    const int c_nWriters = 4;
+    const int c_nReaders = 2;
+    const int c_nKeysPerWriter = 20000;
+
+    // Hashtable with KT = Int, VT = Int, starts small so that it is resized while in use
+    PCHL_HTABLE pht;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateExHT(&pht, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE, 0x80));
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&pht, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE, CHL_HT_FLAG_CONCURRENT)));
+    Assert::IsTrue(pht->fConcurrent);
+
+    // Returned pointers could not be protected by the stripe locks
+    PCHL_VAL pChlVal;
+    PVOID pvKey = (PVOID)1;
+    Assert::AreEqual(E_NOT_VALID_STATE, pht->FindOrInsert(pht, pvKey, sizeof(int), (PCVOID)2, sizeof(int), &pChlVal, nullptr));
+    Assert::AreEqual(E_NOT_VALID_STATE, pht->FindBatch(pht, &pvKey, nullptr, 1, &pChlVal, nullptr));
+
+    // Each writer inserts its own range of keys and then removes every other one.
+    // Odd writers insert theirs in batches, the others one at a time.
+    // Readers look up all keys meanwhile and check the values they find.
+    // Failures are counted rather than asserted since they happen off the test thread.
+    volatile LONG nFailures = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < c_nWriters; ++t)
+    {
+        threads.emplace_back([=, &nFailures]()
+        {
+            const int c_nBatch = 100;
+            PVOID apvKeys[c_nBatch];
+            PVOID apvVals[c_nBatch];
+
+            int keyBase = (t * c_nKeysPerWriter) + 1;
+            for (int idx = 0; idx < c_nKeysPerWriter; ++idx)
+            {
+                int key = keyBase + idx;
+                if ((t % 2) == 1)
+                {
+                    apvKeys[idx % c_nBatch] = (PVOID)key;
+                    apvVals[idx % c_nBatch] = (PVOID)(key * 2);
+                    if (((idx % c_nBatch) == c_nBatch - 1) &&
+                        FAILED(pht->InsertBatch(pht, apvKeys, nullptr, apvVals, nullptr, c_nBatch, nullptr)))
+                    {
+                        InterlockedIncrement(&nFailures);
+                    }
+                }
+                else if (FAILED(pht->Insert(pht, (PCVOID)key, sizeof(int), (PVOID)(key * 2), sizeof(int))))
+                {
+                    InterlockedIncrement(&nFailures);
+                }
+            }
+            for (int idx = 0; idx < c_nKeysPerWriter; idx += 2)
+            {
+                int key = keyBase + idx;
+                if (FAILED(pht->Remove(pht, (PCVOID)key, sizeof(int))))
+                {
+                    InterlockedIncrement(&nFailures);
+                }
+            }
+        });
+    }
+
+    for (int t = 0; t < c_nReaders; ++t)
+    {
+        threads.emplace_back([=, &nFailures]()
+        {
+            for (int key = 1; key <= c_nWriters * c_nKeysPerWriter; ++key)
+            {
+                int val = 0;
+                if (SUCCEEDED(pht->Find(pht, (PCVOID)key, sizeof(int), &val, nullptr, FALSE)) && (val != key * 2))
+                {
+                    InterlockedIncrement(&nFailures);
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    Assert::AreEqual(0L, (long)nFailures);
+    Assert::AreEqual(c_nWriters * c_nKeysPerWriter / 2, pht->nEntries);
+    for (int key = 1; key <= c_nWriters * c_nKeysPerWriter; ++key)
+    {
+        int val = 0;
+        bool fRemoved = ((key - 1) % 2) == 0;
+        Assert::AreEqual(fRemoved, (bool)FAILED(pht->Find(pht, (PCVOID)key, sizeof(int), &val, nullptr, FALSE)));
+        if (!fRemoved)
+        {
+            Assert::AreEqual(key * 2, val);
+        }
+    }
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::LockFreeReads_IntUserObj()
+{
+    struct Value
+    {
+        int key;
+        int round;
+        int check;
+    };
+
+    const int c_nKeys = 20000;
+    const int c_nRounds = 5;
+    const int c_nReaders = 3;
+
+    // Hashtable with KT = Int, VT = UserObj, starts small so that it is resized while being read
+    PCHL_HTABLE pht;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateExHT(&pht, 10, CHL_KT_INT32, CHL_VT_USEROBJECT, FALSE,
+        CHL_HT_FLAG_CONCURRENT | CHL_HT_FLAG_LOCKFREE_READS));
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&pht, 10, CHL_KT_INT32, CHL_VT_USEROBJECT, FALSE, CHL_HT_FLAG_LOCKFREE_READS)));
+
+    Value newVal = {};
+    PCHL_VAL pChlVal;
+    Assert::AreEqual(E_NOT_VALID_STATE, pht->FindOrInsert(pht, (PCVOID)1, sizeof(int), &newVal, sizeof(newVal), &pChlVal, nullptr));
+
+    // One writer rewrites every key with a new value each round and removes every third key.
+    // Readers check that each value they find is a whole one, written for the key looked up.
+    volatile LONG nFailures = 0;
+    volatile bool fDone = false;
+    std::vector<std::thread> threads;
+    threads.emplace_back([=, &nFailures, &fDone]()
+    {
+        for (int round = 0; round < c_nRounds; ++round)
+        {
+            for (int key = 0; key < c_nKeys; ++key)
+            {
+                Value val = { key, round, (key * 31) + round };
+                if (FAILED(pht->Insert(pht, (PCVOID)key, sizeof(int), &val, sizeof(val))))
+                {
+                    InterlockedIncrement(&nFailures);
+                }
+            }
+            for (int key = 0; key < c_nKeys; key += 3)
+            {
+                if (FAILED(pht->Remove(pht, (PCVOID)key, sizeof(int))))
+                {
+                    InterlockedIncrement(&nFailures);
+                }
+            }
+        }
+        fDone = true;
+    });
+
+    for (int t = 0; t < c_nReaders; ++t)
+    {
+        threads.emplace_back([=, &nFailures, &fDone]()
+        {
+            while (!fDone)
+            {
+                for (int key = 0; key < c_nKeys; key += 7)
+                {
+                    Value val;
+                    int valSize = sizeof(val);
+                    HRESULT hr = pht->Find(pht, (PCVOID)key, sizeof(int), &val, &valSize, FALSE);
+                    if ((FAILED(hr) && (hr != E_NOT_SET)) ||
+                        (SUCCEEDED(hr) && ((val.key != key) || (val.check != (key * 31) + val.round))))
+                    {
+                        InterlockedIncrement(&nFailures);
+                    }
+
+                    // A stored value found by pointer stays valid until the read section ends
+                    Value* pVal;
+                    if (SUCCEEDED(pht->BeginRead(pht)))
+                    {
+                        if (SUCCEEDED(pht->Find(pht, (PCVOID)key, sizeof(int), &pVal, nullptr, TRUE)))
+                        {
+                            std::this_thread::yield();
+                            if ((pVal->key != key) || (pVal->check != (key * 31) + pVal->round))
+                            {
+                                InterlockedIncrement(&nFailures);
+                            }
+                        }
+
+                        // As do the values found by a batch lookup
+                        PVOID apvKeys[2] = { (PVOID)key, (PVOID)(c_nKeys - 1 - key) };
+                        PCHL_VAL apChlVals[2];
+                        pht->FindBatch(pht, apvKeys, nullptr, 2, apChlVals, nullptr);
+                        std::this_thread::yield();
+                        for (int idx = 0; idx < 2; ++idx)
+                        {
+                            pVal = (apChlVals[idx] != nullptr) ? (Value*)apChlVals[idx]->valDef.pvUserObj : nullptr;
+                            if ((pVal != nullptr) &&
+                                ((pVal->key != (int)apvKeys[idx]) || (pVal->check != (pVal->key * 31) + pVal->round)))
+                            {
+                                InterlockedIncrement(&nFailures);
+                            }
+                        }
+                        pht->EndRead(pht);
+                    }
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    Assert::AreEqual(0L, (long)nFailures);
+    Assert::AreEqual(c_nKeys - ((c_nKeys + 2) / 3), pht->nEntries);
+    for (int key = 0; key < c_nKeys; ++key)
+    {
+        Value val;
+        int valSize = sizeof(val);
+        HRESULT hr = pht->Find(pht, (PCVOID)key, sizeof(int), &val, &valSize, FALSE);
+        if ((key % 3) == 0)
+        {
+            Assert::AreEqual(E_NOT_SET, hr);
+        }
+        else
+        {
+            Assert::AreEqual(S_OK, hr);
+            Assert::AreEqual(c_nRounds - 1, val.round);
+        }
+    }
+
+    // Removing everything shrinks the table again
+    for (int key = 0; key < c_nKeys; ++key)
+    {
+        pht->Remove(pht, (PCVOID)key, sizeof(int));
+    }
+    Assert::AreEqual(0, pht->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::GetStats_StrInt()
+{
+    const int c_nItems = 1000;
+
+    // Hashtable with KT = Str, VT = Int
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+
+    CHL_HT_STATS stats;
+    Assert::IsTrue(SUCCEEDED(pht->GetStats(pht, &stats)));
+    Assert::AreEqual(0, stats.nEntries);
+    Assert::AreEqual(stats.nBuckets, stats.anChainLengths[0]);
+    Assert::AreEqual(0, stats.nMaxChain);
+    Assert::AreEqual((SIZE_T)0, stats.cbKeys);
+
+    SIZE_T cbKeys = 0;
+    char szKey[32];
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, szKey, 0, (PVOID)idx, sizeof(int))));
+        cbKeys += strlen(szKey) + 1;
+    }
+
+    // Look up every key once and as many keys that are not in the table
+    for (int idx = 0; idx < c_nItems * 2; ++idx)
+    {
+        int val;
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual((idx < c_nItems) ? S_OK : E_NOT_SET, pht->Find(pht, szKey, 0, &val, nullptr, FALSE));
+    }
+
+    Assert::IsTrue(SUCCEEDED(pht->GetStats(pht, &stats)));
+    Assert::AreEqual(c_nItems, stats.nEntries);
+    Assert::AreEqual(pht->nTableSize, stats.nBuckets);
+    Assert::AreEqual((int)(((INT64)c_nItems * 100) / (stats.nBuckets + stats.nBucketsOld)), stats.iLoadPct);
+    Assert::AreEqual(cbKeys, stats.cbKeys);
+    Assert::AreEqual((SIZE_T)0, stats.cbValues);
+    Assert::IsTrue(stats.cbNodes >= (SIZE_T)stats.nBuckets * sizeof(HT_NODE));
+
+    // Every bucket is in the histogram, and its entries add up unless some chain is too long to tell
+    int nBuckets = 0;
+    int nEntries = 0;
+    for (int len = 0; len < CHL_HT_STATS_CHAIN_LENGTHS; ++len)
+    {
+        nBuckets += stats.anChainLengths[len];
+        nEntries += len * stats.anChainLengths[len];
+    }
+    Assert::AreEqual(stats.nBuckets + stats.nBucketsOld, nBuckets);
+    Assert::IsTrue(stats.nMaxChain > 0);
+    if (stats.nMaxChain < CHL_HT_STATS_CHAIN_LENGTHS - 1)
+    {
+        Assert::AreEqual(c_nItems, nEntries);
+    }
+
+    // Counters are only there if the library is built with them
+    if (stats.fCountersEnabled)
+    {
+        Assert::AreEqual((ULONGLONG)c_nItems * 3, stats.counters.ullLookups);
+        Assert::AreEqual((ULONGLONG)c_nItems, stats.counters.ullHits);
+        Assert::IsTrue(stats.counters.ullProbes >= stats.counters.ullHits);
+    }
+    else
+    {
+        Assert::AreEqual((ULONGLONG)0, stats.counters.ullLookups);
+    }
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::Compact_StrInt()
+{
+    const int c_nItems = 1000;
+
+    PCHL_HTABLE pht;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateExHT(&pht, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE,
+        CHL_HT_FLAG_COMPACT | CHL_HT_FLAG_CONCURRENT));
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateExHT(&pht, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE,
+        CHL_HT_FLAG_COMPACT | CHL_HT_FLAG_LOCKFREE_READS));
+
+    // Hashtable with KT = Str, VT = Int
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&pht, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE, CHL_HT_FLAG_COMPACT)));
+
+    char szKey[32];
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, szKey, 0, (PVOID)idx, sizeof(int))));
+    }
+
+    // Updating a value keeps the key in its place
+    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, "key0", 0, (PVOID)-1, sizeof(int))));
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        int val;
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual(S_OK, pht->Find(pht, szKey, 0, &val, nullptr, FALSE));
+        Assert::AreEqual((idx == 0) ? -1 : idx, val);
+    }
+
+    // Remove every other key, the rest are iterated in insertion order
+    for (int idx = 0; idx < c_nItems; idx += 2)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual(S_OK, pht->Remove(pht, szKey, 0));
+    }
+    Assert::AreEqual(E_NOT_SET, pht->Remove(pht, "key0", 0));
+
+    CHL_HT_ITERATOR itr;
+    int nFound = 0;
+    for (HRESULT hr = pht->InitIterator(pht, &itr); SUCCEEDED(hr); hr = itr.MoveNext(&itr))
+    {
+        PCSTR pszKey;
+        int val;
+        Assert::IsTrue(SUCCEEDED(itr.GetCurrent(&itr, &pszKey, nullptr, &val, nullptr, TRUE)));
+        Assert::AreEqual(nFound * 2 + 1, val);
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", val)));
+        Assert::AreEqual(szKey, pszKey);
+        ++nFound;
+    }
+    Assert::AreEqual(c_nItems / 2, nFound);
+
+    // Remove the rest through an iterator
+    Assert::IsTrue(SUCCEEDED(pht->InitIterator(pht, &itr)));
+    nFound = 0;
+    while (SUCCEEDED(pht->RemoveAt(&itr)))
+    {
+        ++nFound;
+    }
+    Assert::AreEqual(c_nItems / 2, nFound);
+    Assert::AreEqual(0, pht->nEntries);
+    Assert::AreEqual(E_NOT_SET, pht->InitIterator(pht, &itr));
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::ByteBudget_IntStr()
+{
+    const int c_nItems = 1000;
+
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 10, CHL_KT_INT32, CHL_VT_STRING, FALSE)));
+    Assert::AreEqual((SIZE_T)0, pht->budget.cbUsed);
+
+    // Every entry is charged for its node and its string value
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)idx, 0, "value", 0)));
+    }
+    Assert::AreEqual((SIZE_T)(c_nItems * (sizeof(HT_NODE) + sizeof("value"))), pht->budget.cbUsed);
+
+    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)0, 0, "longer value", 0)));
+    Assert::IsTrue(SUCCEEDED(pht->Remove(pht, (PVOID)1, 0)));
+    Assert::AreEqual((SIZE_T)((c_nItems - 1) * (sizeof(HT_NODE) + sizeof("value")) + sizeof("longer value") - sizeof("value")),
+        pht->budget.cbUsed);
+
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), pht->SetBudget(pht, 4096, CHL_BP_EVICT_OLDEST, nullptr, nullptr),
+        L"Only compact tables keep insertion order");
+
+    // Lowering the budget evicts right away
+    std::vector<int> evicted;
+    const SIZE_T c_cbMax = 100 * (sizeof(HT_NODE) + sizeof("value"));
+    Assert::AreEqual(S_OK, pht->SetBudget(pht, c_cbMax, CHL_BP_EVICT_RANDOM, OnEvictInt, &evicted));
+    Assert::IsTrue(pht->budget.cbUsed <= c_cbMax);
+    Assert::AreEqual((size_t)(c_nItems - 1), pht->nEntries + evicted.size());
+    Assert::AreEqual((ULONGLONG)evicted.size(), pht->budget.ullEvictions);
+    for (int key : evicted)
+    {
+        Assert::AreEqual(E_NOT_SET, pht->Find(pht, (PVOID)key, 0, nullptr, nullptr, FALSE));
+    }
+
+    // Inserts evict other keys, never the one inserted
+    for (int idx = c_nItems; idx < 2 * c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)idx, 0, "value", 0)));
+        Assert::IsTrue(pht->budget.cbUsed <= c_cbMax);
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PVOID)idx, 0, nullptr, nullptr, FALSE)));
+    }
+
+    // An entry larger than the whole budget is rejected
+    std::string bigValue(c_cbMax, 'x');
+    Assert::AreEqual(E_INVALIDARG, pht->Insert(pht, (PVOID)-1, 0, bigValue.c_str(), 0));
+
+    // Failing policy
+    int nEntries = pht->nEntries;
+    Assert::AreEqual(S_OK, pht->SetBudget(pht, pht->budget.cbUsed, CHL_BP_FAIL, nullptr, nullptr));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA), pht->Insert(pht, (PVOID)-1, 0, "value", 0));
+    Assert::AreEqual(S_OK, pht->Insert(pht, (PVOID)(2 * c_nItems - 1), 0, "eulav", 0), L"Same size update fits");
+    Assert::AreEqual(nEntries, pht->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+
+    // Concurrent tables are accounted for but cannot have a budget
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&pht, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE, CHL_HT_FLAG_CONCURRENT)));
+    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)1, 0, (PVOID)1, 0)));
+    Assert::AreEqual((SIZE_T)sizeof(HT_NODE), pht->budget.cbUsed);
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), pht->SetBudget(pht, 4096, CHL_BP_FAIL, nullptr, nullptr));
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::ByteBudgetOldest_IntInt()
+{
+    const int c_nItems = 10000;
+
+    PCHL_HTABLE pht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&pht, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE, CHL_HT_FLAG_COMPACT)));
+
+    // Entries of a compact table are smaller than nodes
+    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)0, 0, (PVOID)0, 0)));
+    SIZE_T cbEntry = pht->budget.cbUsed;
+    Assert::IsTrue((cbEntry > 0) && (cbEntry < sizeof(HT_NODE)));
+    Assert::IsTrue(SUCCEEDED(pht->Remove(pht, (PVOID)0, 0)));
+
+    std::vector<int> evicted;
+    Assert::AreEqual(S_OK, pht->SetBudget(pht, 1000 * cbEntry, CHL_BP_EVICT_OLDEST, OnEvictInt, &evicted));
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)idx, 0, (PVOID)idx, 0)));
+        Assert::IsTrue(pht->nEntries <= 1000);
+    }
+
+    // Evicted in insertion order, the newest are kept
+    Assert::AreEqual((size_t)(c_nItems - 1000), evicted.size());
+    for (int idx = 0; idx < (int)evicted.size(); ++idx)
+    {
+        Assert::AreEqual(idx, evicted[idx]);
+    }
+    for (int idx = c_nItems - 1000; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PVOID)idx, 0, nullptr, nullptr, FALSE)));
+    }
+
+    // An update keeps the key in its place, so it is still the oldest
+    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)(c_nItems - 1000), 0, (PVOID)-1, 0)));
+    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PVOID)c_nItems, 0, (PVOID)c_nItems, 0)));
+    Assert::AreEqual(c_nItems - 1000, evicted.back());
+
+    Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+}
+
+void HashtableUnitTests::Merge_StrInt()
+{
+    PCHL_HTABLE phtDst;
+    PCHL_HTABLE phtSrc;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtDst, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtSrc, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+
+    // Keys 0..1999 in the destination, 1000..3999 in the source
+    char szKey[32];
+    for (int idx = 0; idx < 4000; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        if (idx < 2000)
+        {
+            Assert::IsTrue(SUCCEEDED(phtDst->Insert(phtDst, szKey, 0, (PVOID)1, 0)));
+        }
+        if (idx >= 1000)
+        {
+            Assert::IsTrue(SUCCEEDED(phtSrc->Insert(phtSrc, szKey, 0, (PVOID)idx, 0)));
+        }
+    }
+
+    Assert::AreEqual(S_OK, phtDst->Merge(phtDst, phtSrc, CHL_DsCombineSumHT, nullptr));
+    Assert::AreEqual(4000, phtDst->nEntries);
+    Assert::AreEqual(0, phtSrc->nEntries);
+    Assert::AreEqual((SIZE_T)0, phtSrc->budget.cbUsed);
+
+    int val;
+    for (int idx = 0; idx < 4000; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual(S_OK, phtDst->Find(phtDst, szKey, 0, &val, nullptr, FALSE));
+        Assert::AreEqual((idx < 1000) ? 1 : ((idx < 2000) ? idx + 1 : idx), val);
+        Assert::AreEqual(E_NOT_SET, phtSrc->Find(phtSrc, szKey, 0, nullptr, nullptr, FALSE));
+    }
+
+    // The emptied source can be used again, without a combiner its values win
+    Assert::IsTrue(SUCCEEDED(phtSrc->Insert(phtSrc, "key0", 0, (PVOID)-5, 0)));
+    Assert::AreEqual(S_OK, phtDst->Merge(phtDst, phtSrc, nullptr, nullptr));
+    Assert::AreEqual(S_OK, phtDst->Find(phtDst, "key0", 0, &val, nullptr, FALSE));
+    Assert::AreEqual(-5, val);
+    Assert::AreEqual(4000, phtDst->nEntries);
+
+    // Both tables must hold the same types, and be distinct
+    PCHL_HTABLE phtOther;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtOther, 10, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+    Assert::AreEqual(E_INVALIDARG, phtDst->Merge(phtDst, phtOther, nullptr, nullptr));
+    Assert::AreEqual(E_INVALIDARG, phtDst->Merge(phtDst, phtDst, nullptr, nullptr));
+    Assert::IsTrue(SUCCEEDED(phtOther->Destroy(phtOther)));
+
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&phtOther, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE, CHL_HT_FLAG_COMPACT)));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), phtDst->Merge(phtDst, phtOther, nullptr, nullptr));
+    Assert::IsTrue(SUCCEEDED(phtOther->Destroy(phtOther)));
+
+    Assert::IsTrue(SUCCEEDED(phtSrc->Destroy(phtSrc)));
+    Assert::IsTrue(SUCCEEDED(phtDst->Destroy(phtDst)));
+}
+
+void HashtableUnitTests::MergeMany_IntUint()
+{
+    const int c_nSrcs = 6;
+    const UINT c_nKeys = 50000;
+
+    // Each source counts a different share of the same keys, as per-thread tables would
+    std::vector<UINT> expected(c_nKeys, 0);
+    PCHL_HTABLE aphtSrcs[c_nSrcs];
+    for (int iSrc = 0; iSrc < c_nSrcs; ++iSrc)
+    {
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&aphtSrcs[iSrc], 10, CHL_KT_UINT32, CHL_VT_UINT32, FALSE)));
+        if (iSrc % 2)
+        {
+            Assert::IsTrue(SUCCEEDED(aphtSrcs[iSrc]->SetHashType(aphtSrcs[iSrc], CHL_HT_HASH_DJB2)));
+        }
+
+        for (UINT key = iSrc; key < c_nKeys; key += (iSrc + 1))
+        {
+            Assert::IsTrue(SUCCEEDED(aphtSrcs[iSrc]->Insert(aphtSrcs[iSrc], (PVOID)key, 0, (PVOID)(key % 7 + 1), 0)));
+            expected[key] += key % 7 + 1;
+        }
+    }
+
+    PCHL_HTABLE phtDst;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&phtDst, 10, CHL_KT_UINT32, CHL_VT_UINT32, FALSE, CHL_HT_FLAG_CONCURRENT)));
+    Assert::AreEqual(S_OK, phtDst->MergeMany(phtDst, aphtSrcs, c_nSrcs, CHL_DsCombineSumHT, nullptr, 4));
+
+    int nExpected = 0;
+    UINT val;
+    for (UINT key = 0; key < c_nKeys; ++key)
+    {
+        if (expected[key] == 0)
+        {
+            Assert::AreEqual(E_NOT_SET, phtDst->Find(phtDst, (PVOID)key, 0, nullptr, nullptr, FALSE));
+            continue;
+        }
+        ++nExpected;
+        Assert::AreEqual(S_OK, phtDst->Find(phtDst, (PVOID)key, 0, &val, nullptr, FALSE));
+        Assert::AreEqual(expected[key], val);
+    }
+    Assert::AreEqual(nExpected, phtDst->nEntries);
+    Assert::AreEqual((SIZE_T)nExpected * sizeof(HT_NODE), phtDst->budget.cbUsed);
+
+    // Merging again keeps the larger value, and a source can not be passed twice
+    for (int iSrc = 0; iSrc < c_nSrcs; ++iSrc)
+    {
+        Assert::AreEqual(0, aphtSrcs[iSrc]->nEntries);
+        Assert::IsTrue(SUCCEEDED(aphtSrcs[iSrc]->Insert(aphtSrcs[iSrc], (PVOID)0, 0, (PVOID)(UINT)(100 * iSrc), 0)));
+    }
+    Assert::AreEqual(S_OK, phtDst->MergeMany(phtDst, aphtSrcs, c_nSrcs, CHL_DsCombineMaxHT, nullptr, 0));
+    Assert::AreEqual(S_OK, phtDst->Find(phtDst, (PVOID)0, 0, &val, nullptr, FALSE));
+    Assert::AreEqual((UINT)(100 * (c_nSrcs - 1)), val);
+
+    PCHL_HTABLE aphtSame[2] = { aphtSrcs[0], aphtSrcs[0] };
+    Assert::AreEqual(E_INVALIDARG, phtDst->MergeMany(phtDst, aphtSame, 2, nullptr, nullptr, 2));
+
+    Assert::IsTrue(SUCCEEDED(phtDst->Destroy(phtDst)));
+    for (int iSrc = 0; iSrc < c_nSrcs; ++iSrc)
+    {
+        Assert::IsTrue(SUCCEEDED(aphtSrcs[iSrc]->Destroy(aphtSrcs[iSrc])));
+    }
+}
+
+void HashtableUnitTests::Multimap_StrInt()
+{
+    PCHL_HTABLE phtable;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateExHT(&phtable, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE,
+        CHL_HT_FLAG_MULTIMAP | CHL_HT_FLAG_COMPACT));
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&phtable, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE, CHL_HT_FLAG_MULTIMAP)));
+
+    // Key i has (i % 5) + 1 values, duplicates included
+    char szKey[32];
+    for (int idx = 0; idx < 1000; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        for (int iVal = 0; iVal <= idx % 5; ++iVal)
+        {
+            Assert::AreEqual(S_OK, phtable->Insert(phtable, szKey, 0, (PVOID)(iVal / 2), 0));
+        }
+    }
+    Assert::AreEqual(1000, phtable->nEntries, L"Entries are counted per key");
+
+    PCHL_VAL pChlVals;
+    int nVals;
+    int val;
+    for (int idx = 0; idx < 1000; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual(S_OK, phtable->FindAll(phtable, szKey, 0, &pChlVals, &nVals));
+        Assert::AreEqual((idx % 5) + 1, nVals);
+        for (int iVal = 0; iVal < nVals; ++iVal)
+        {
+            Assert::AreEqual(iVal / 2, pChlVals[iVal].valDef.iVal, L"Values are in insertion order");
+        }
+
+        Assert::AreEqual(S_OK, phtable->Find(phtable, szKey, 0, &val, nullptr, FALSE));
+        Assert::AreEqual(0, val, L"Find returns the first value");
+    }
+
+    Assert::AreEqual(E_NOT_SET, phtable->FindAll(phtable, "nokey", 0, &pChlVals, &nVals));
+    Assert::IsNull(pChlVals);
+    Assert::AreEqual(0, nVals);
+
+    // Removing one pair keeps the order of the others, removing the last one removes the key
+    Assert::AreEqual(S_OK, phtable->RemoveVal(phtable, "key4", 0, (PVOID)0, 0));
+    Assert::AreEqual(S_OK, phtable->FindAll(phtable, "key4", 0, &pChlVals, &nVals));
+    Assert::AreEqual(4, nVals);
+    Assert::AreEqual(0, pChlVals[0].valDef.iVal);
+    Assert::AreEqual(1, pChlVals[1].valDef.iVal);
+    Assert::AreEqual(2, pChlVals[3].valDef.iVal);
+    Assert::AreEqual(E_NOT_SET, phtable->RemoveVal(phtable, "key4", 0, (PVOID)7, 0));
+
+    Assert::AreEqual(S_OK, phtable->RemoveVal(phtable, "key1", 0, (PVOID)0, 0));
+    Assert::AreEqual(S_OK, phtable->RemoveVal(phtable, "key1", 0, (PVOID)0, 0));
+    Assert::AreEqual(E_NOT_SET, phtable->Find(phtable, "key1", 0, nullptr, nullptr, FALSE));
+    Assert::AreEqual(999, phtable->nEntries);
+
+    // Remove takes all values of the key
+    Assert::AreEqual(S_OK, phtable->Remove(phtable, "key9", 0));
+    Assert::AreEqual(E_NOT_SET, phtable->FindAll(phtable, "key9", 0, &pChlVals, &nVals));
+
+    CHL_HT_STATS stats;
+    Assert::AreEqual(S_OK, phtable->GetStats(phtable, &stats));
+    Assert::AreEqual(phtable->budget.cbUsed, stats.cbKeys + stats.cbValues + (phtable->nEntries * sizeof(HT_NODE)));
+
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED),
+        phtable->SetBudget(phtable, 1024 * 1024, CHL_BP_FAIL, nullptr, nullptr));
+
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+}
+
+void HashtableUnitTests::KeyHandles_StrInt()
+{
+    // Tables that share the hash, and one that does not
+    const int c_nTables = 4;
+    PCHL_HTABLE aphtables[c_nTables];
+    for (int iTable = 0; iTable < c_nTables; ++iTable)
+    {
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&aphtables[iTable], 100, CHL_KT_STRING, CHL_VT_INT32, FALSE,
+            (iTable == 1) ? CHL_HT_FLAG_CONCURRENT : 0)));
+        if (iTable != c_nTables - 1)
+        {
+            Assert::AreEqual(S_OK, aphtables[iTable]->SetHashType(aphtables[iTable], CHL_HT_HASH_SHARED64));
+        }
+    }
+    Assert::AreEqual(aphtables[0]->ullHashSeed, aphtables[1]->ullHashSeed, L"Shared hash uses one seed");
+
+    CHL_HT_KEYHANDLE hKey;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsPrepareKeyHT(CHL_KT_STRING, "key", 0, nullptr));
+
+    char szKey[32];
+    for (int idx = 0; idx < 1000; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual(S_OK, CHL_DsPrepareKeyHT(CHL_KT_STRING, szKey, 0, &hKey));
+        Assert::AreEqual((int)strlen(szKey) + 1, hKey.iKeySize);
+        for (int iTable = 0; iTable < c_nTables; ++iTable)
+        {
+            Assert::AreEqual(S_OK, aphtables[iTable]->InsertByHandle(aphtables[iTable], &hKey, (PVOID)(idx + iTable), 0));
+        }
+    }
+
+    // Handles and keys find the same entries in every table
+    int val;
+    for (int idx = 0; idx < 1000; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual(S_OK, CHL_DsPrepareKeyHT(CHL_KT_STRING, szKey, 0, &hKey));
+        for (int iTable = 0; iTable < c_nTables; ++iTable)
+        {
+            Assert::AreEqual(S_OK, aphtables[iTable]->FindByHandle(aphtables[iTable], &hKey, &val, nullptr, FALSE));
+            Assert::AreEqual(idx + iTable, val);
+            Assert::AreEqual(S_OK, aphtables[iTable]->Find(aphtables[iTable], szKey, 0, &val, nullptr, FALSE));
+            Assert::AreEqual(idx + iTable, val);
+        }
+        if (idx % 2)
+        {
+            Assert::AreEqual(S_OK, aphtables[1]->RemoveByHandle(aphtables[1], &hKey));
+            Assert::AreEqual(E_NOT_SET, aphtables[1]->FindByHandle(aphtables[1], &hKey, nullptr, nullptr, FALSE));
+        }
+    }
+    Assert::AreEqual(500, aphtables[1]->nEntries);
+
+    CHL_HT_KEYHANDLE hIntKey;
+    Assert::AreEqual(S_OK, CHL_DsPrepareKeyHT(CHL_KT_INT32, (PVOID)5, 0, &hIntKey));
+    Assert::AreEqual(E_INVALIDARG, aphtables[0]->FindByHandle(aphtables[0], &hIntKey, nullptr, nullptr, FALSE),
+        L"Handle must have the key type of the table");
+
+    // Tables with the same hash merge without hashing the keys again, also after removes
+    Assert::AreEqual(S_OK, aphtables[0]->Merge(aphtables[0], aphtables[1], CHL_DsCombineMaxHT, nullptr));
+    Assert::AreEqual(0, aphtables[1]->nEntries);
+    Assert::AreEqual(1000, aphtables[0]->nEntries);
+    Assert::AreEqual(S_OK, aphtables[0]->Find(aphtables[0], "key10", 0, &val, nullptr, FALSE));
+    Assert::AreEqual(11, val);
+    Assert::AreEqual(S_OK, aphtables[0]->Find(aphtables[0], "key11", 0, &val, nullptr, FALSE));
+    Assert::AreEqual(11, val);
+
+    for (int iTable = 0; iTable < c_nTables; ++iTable)
+    {
+        Assert::IsTrue(SUCCEEDED(aphtables[iTable]->Destroy(aphtables[iTable])));
+    }
+}
+
+void HashtableUnitTests::KeyHandlesSeeded_StrInt()
+{
+    // Two tables with the default hash, each with its own seed
+    PCHL_HTABLE phtFirst, phtSecond;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtFirst, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtSecond, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+    Assert::AreEqual((int)CHL_HT_HASH_SEEDED64, (int)phtFirst->hashType);
+    Assert::AreNotEqual(phtFirst->ullHashSeed, phtSecond->ullHashSeed);
+
+    const int c_nKeys = 1000;
+    char aszKeys[c_nKeys][32];
+    CHL_HT_KEYHANDLE ahKeys[c_nKeys];
+    for (int idx = 0; idx < c_nKeys; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(aszKeys[idx], ARRAYSIZE(aszKeys[idx]), "key%d", idx)));
+        Assert::AreEqual(S_OK, CHL_DsPrepareKeyHT(CHL_KT_STRING, aszKeys[idx], 0, &ahKeys[idx]));
+        Assert::IsFalse(ahKeys[idx].fSeededHash);
+
+        // The table hashes the key once and keeps the hash in the handle, also while it grows
+        Assert::AreEqual(S_OK, phtFirst->InsertByHandle(phtFirst, &ahKeys[idx], (PVOID)idx, 0));
+        Assert::IsTrue(ahKeys[idx].fSeededHash);
+        Assert::AreEqual(phtFirst->ullHashSeed, ahKeys[idx].ullSeed);
+    }
+
+    int val;
+    for (int iPass = 0; iPass < 3; ++iPass)
+    {
+        for (int idx = 0; idx < c_nKeys; ++idx)
+        {
+            ULONGLONG ullSeededHash = ahKeys[idx].ullSeededHash;
+            Assert::AreEqual(S_OK, phtFirst->FindByHandle(phtFirst, &ahKeys[idx], &val, nullptr, FALSE));
+            Assert::AreEqual(idx, val);
+            Assert::AreEqual(ullSeededHash, ahKeys[idx].ullSeededHash);
+            Assert::AreEqual(S_OK, phtFirst->Find(phtFirst, aszKeys[idx], 0, &val, nullptr, FALSE));
+            Assert::AreEqual(idx, val);
+        }
+    }
+
+    // Another table hashes the key with its own seed, and the first one takes it back
+    for (int idx = 0; idx < c_nKeys; ++idx)
+    {
+        Assert::AreEqual(S_OK, phtSecond->InsertByHandle(phtSecond, &ahKeys[idx], (PVOID)(idx + 1), 0));
+        Assert::AreEqual(phtSecond->ullHashSeed, ahKeys[idx].ullSeed);
+        Assert::AreEqual(S_OK, phtSecond->Find(phtSecond, aszKeys[idx], 0, &val, nullptr, FALSE));
+        Assert::AreEqual(idx + 1, val);
+
+        Assert::AreEqual(S_OK, phtFirst->FindByHandle(phtFirst, &ahKeys[idx], &val, nullptr, FALSE));
+        Assert::AreEqual(idx, val);
+        Assert::AreEqual(phtFirst->ullHashSeed, ahKeys[idx].ullSeed);
+        if (idx % 2)
+        {
+            Assert::AreEqual(S_OK, phtFirst->RemoveByHandle(phtFirst, &ahKeys[idx]));
+            Assert::AreEqual(E_NOT_SET, phtFirst->FindByHandle(phtFirst, &ahKeys[idx], nullptr, nullptr, FALSE));
+            Assert::AreEqual(E_NOT_SET, phtFirst->Find(phtFirst, aszKeys[idx], 0, nullptr, nullptr, FALSE));
+        }
+    }
+    Assert::AreEqual(c_nKeys / 2, phtFirst->nEntries);
+    Assert::AreEqual(c_nKeys, phtSecond->nEntries);
+
+    // Preparing the handle again forgets the table hash
+    Assert::AreEqual(S_OK, CHL_DsPrepareKeyHT(CHL_KT_STRING, aszKeys[0], 0, &ahKeys[0]));
+    Assert::IsFalse(ahKeys[0].fSeededHash);
+    Assert::AreEqual(S_OK, phtSecond->FindByHandle(phtSecond, &ahKeys[0], &val, nullptr, FALSE));
+    Assert::AreEqual(1, val);
+
+    Assert::IsTrue(SUCCEEDED(phtFirst->Destroy(phtFirst)));
+    Assert::IsTrue(SUCCEEDED(phtSecond->Destroy(phtSecond)));
+}
+
+void HashtableUnitTests::EntryHandles_StrInt()
+{
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+
+    CHL_HT_ENTRYHANDLE hZero = { 0 };
+    Assert::AreEqual(E_NOT_SET, phtable->GetByEntryHandle(phtable, &hZero, nullptr, nullptr, FALSE));
+
+    // The table grows several times, handles follow the entries
+    const int nKeys = 5000;
+    std::vector<CHL_HT_ENTRYHANDLE> handles(nKeys);
+    char szKey[32];
+    for (int idx = 0; idx < nKeys; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+        Assert::AreEqual(S_OK, phtable->InsertEx(phtable, szKey, 0, (PVOID)idx, 0, &handles[idx]));
+    }
+
+    CHL_HT_ENTRYHANDLE hEntry;
+    Assert::AreEqual(S_OK, phtable->InsertEx(phtable, "key7", 0, (PVOID)70, 0, &hEntry));
+    Assert::AreEqual(handles[7].uSlot, hEntry.uSlot, L"Same key, same handle");
+    Assert::AreEqual(handles[7].uGeneration, hEntry.uGeneration);
+
+    int val;
+    int valSize;
+    for (int idx = 0; idx < nKeys; ++idx)
+    {
+        Assert::AreEqual(S_OK, phtable->GetByEntryHandle(phtable, &handles[idx], &val, &valSize, FALSE));
+        Assert::AreEqual((idx == 7) ? 70 : idx, val);
+        Assert::AreEqual((int)sizeof(int), valSize);
+
+        Assert::AreEqual(S_OK, phtable->SetByEntryHandle(phtable, &handles[idx], (PVOID)(idx * 2), 0));
+    }
+
+    Assert::AreEqual(S_OK, phtable->Find(phtable, "key21", 0, &val, nullptr, FALSE));
+    Assert::AreEqual(42, val);
+
+    // Removed either way, the handle no longer matches and the table shrinks
+    for (int idx = 0; idx < nKeys; ++idx)
+    {
+        if (idx % 2)
+        {
+            Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", idx)));
+            Assert::AreEqual(S_OK, phtable->Remove(phtable, szKey, 0));
+        }
+        else if (idx % 4 == 0)
+        {
+            Assert::AreEqual(S_OK, phtable->RemoveByEntryHandle(phtable, &handles[idx]));
+        }
+    }
+    Assert::AreEqual(nKeys / 4, phtable->nEntries);
+
+    for (int idx = 0; idx < nKeys; ++idx)
+    {
+        if (idx % 4 == 2)
+        {
+            Assert::AreEqual(S_OK, phtable->GetByEntryHandle(phtable, &handles[idx], &val, nullptr, FALSE));
+            Assert::AreEqual(idx * 2, val);
+        }
+        else
+        {
+            Assert::AreEqual(E_NOT_SET, phtable->GetByEntryHandle(phtable, &handles[idx], &val, &valSize, FALSE));
+            Assert::AreEqual(0, valSize);
+            Assert::AreEqual(E_NOT_SET, phtable->SetByEntryHandle(phtable, &handles[idx], (PVOID)1, 0));
+            Assert::AreEqual(E_NOT_SET, phtable->RemoveByEntryHandle(phtable, &handles[idx]));
+        }
+    }
+
+    // A key inserted again gets a new handle, the old one still does not match
+    Assert::AreEqual(S_OK, phtable->InsertEx(phtable, "key0", 0, (PVOID)1, 0, &hEntry));
+    Assert::AreEqual(E_NOT_SET, phtable->GetByEntryHandle(phtable, &handles[0], nullptr, nullptr, FALSE));
+    Assert::AreEqual(S_OK, phtable->GetByEntryHandle(phtable, &hEntry, &val, nullptr, FALSE));
+    Assert::AreEqual(1, val);
+
+    // Entries of a merged table leave their handles behind
+    PCHL_HTABLE phtSrc;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtSrc, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+    Assert::AreEqual(S_OK, phtSrc->InsertEx(phtSrc, "merged", 0, (PVOID)5, 0, &hEntry));
+    Assert::AreEqual(S_OK, phtable->Merge(phtable, phtSrc, nullptr, nullptr));
+    Assert::AreEqual(E_NOT_SET, phtSrc->GetByEntryHandle(phtSrc, &hEntry, nullptr, nullptr, FALSE));
+    Assert::AreEqual(S_OK, phtable->GetByEntryHandle(phtable, &handles[2], &val, nullptr, FALSE));
+    Assert::AreEqual(4, val);
+    Assert::IsTrue(SUCCEEDED(phtSrc->Destroy(phtSrc)));
+
+    PCHL_HTABLE phtConcurrent;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&phtConcurrent, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE, CHL_HT_FLAG_CONCURRENT)));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), phtConcurrent->InsertEx(phtConcurrent, (PVOID)1, 0, (PVOID)1, 0, &hEntry));
+    Assert::AreEqual(S_OK, phtConcurrent->InsertEx(phtConcurrent, (PVOID)1, 0, (PVOID)1, 0, nullptr));
+    Assert::IsTrue(SUCCEEDED(phtConcurrent->Destroy(phtConcurrent)));
+
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+}
+
 }
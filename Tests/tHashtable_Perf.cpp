@@ -1,6 +1,9 @@
 
 #include "stdafx.h"
 #include "Hashtable.h"
+#include "FlatHashtable.h"
+#include "HashtableImage.h"
+#include "IntHashtable.h"
 
 #include "CppUnitTest.h"
 #include "Helpers.h"
@@ -16,8 +19,6 @@ TEST_CLASS(HashTablePerf)
 public:
     TEST_METHOD(StoryProcessing)
     {
-        WCHAR szLine[512];
-        int nFieldsRead = 0;
         const int minLen = 8;
         int nItemsAdded = 0;
 
@@ -26,27 +27,9 @@ public:
 
         list<wstring> inputStrings;
 
-        FILE* pFile = nullptr;
-        Assert::AreEqual(0, _wfopen_s(&pFile, s_pszInputFileTale, L"r"), L"File open must succeed");
-        Assert::IsNotNull(pFile);
-
         Helpers::ITimer* pTimer = new Helpers::CTimerTicks();
         pTimer->Start();
-        while ((nFieldsRead = fwscanf_s(pFile, L"%511s", szLine, (UINT)ARRAYSIZE(szLine))) == 1)
-        {
-            // Skip strings that don't meet min length
-            if (wcslen(szLine) < minLen)
-            {
-                continue;
-            }
-            inputStrings.push_back(szLine);
-        }
-
-        Assert::AreEqual(nFieldsRead, EOF);
-        fclose(pFile);
-        pFile = NULL;
-
-        logInfo(L"#strings greater than length %d = %u", minLen, inputStrings.size());
+        ReadInputStrings(inputStrings, minLen);
         logInfo(L"Time taken to read input file = %llu ms", pTimer->GetElapsedMilliseconds());
 
         // Create the hashtable
@@ -105,7 +88,632 @@ public:
         Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
     }
 
+    // Same workload as StoryProcessing, counting through the value pointer from FindOrInsert
+    TEST_METHOD(StoryProcessing_FindOrInsert)
+    {
+        const int minLen = 8;
+        int nItemsAdded = 0;
+
+        list<wstring> inputStrings;
+
+        Helpers::ITimer* pTimer = new Helpers::CTimerTicks();
+        pTimer->Start();
+        ReadInputStrings(inputStrings, minLen);
+        logInfo(L"Time taken to read input file = %llu ms", pTimer->GetElapsedMilliseconds());
+
+        // Create the hashtable
+        CHL_HTABLE* pht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, 100000, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+
+        pTimer->Reset();
+        pTimer->Start();
+        for (auto& curStr : inputStrings)
+        {
+            PCHL_VAL pChlVal;
+            BOOL fCreated;
+            Assert::IsTrue(SUCCEEDED(pht->FindOrInsert(pht, (PCVOID)curStr.c_str(), 0, (PCVOID)0, sizeof(int), &pChlVal, &fCreated)));
+            ++(pChlVal->valDef.iVal);
+            if (fCreated)
+            {
+                ++nItemsAdded;
+            }
+        }
+
+        logInfo(L"Total insertions = %u, unique = %d", inputStrings.size(), nItemsAdded);
+        logInfo(L"Time taken for insertions = %llu ms", pTimer->GetElapsedMilliseconds());
+
+        // Find the string with highest frequency
+        PCWSTR pszCur = NULL;
+        PCWSTR pszMax = NULL;
+        int freqCur = 0;
+        int freqMax = 0;
+
+        CHL_HT_ITERATOR htItr;
+        Assert::IsTrue(SUCCEEDED(pht->InitIterator(pht, &htItr)));
+
+        int keySize = sizeof(PCWSTR);
+        int valSize = sizeof(int);
+        do
+        {
+            Assert::AreEqual(S_OK, htItr.GetCurrent(&htItr, &pszCur, &keySize, &freqCur, &valSize, TRUE));
+            if (freqCur > freqMax)
+            {
+                freqMax = freqCur;
+                pszMax = pszCur;
+            }
+        } while (SUCCEEDED(htItr.MoveNext(&htItr)));
+
+        logInfo(L"Time taken = %llu ms", pTimer->GetElapsedMilliseconds());
+        logInfo(L"Max : %s = %d", pszMax, freqMax);
+
+        Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+    }
+
+    // Same workload as StoryProcessing, on the open-addressing flat hashtable
+    TEST_METHOD(StoryProcessing_Flat)
+    {
+        const int minLen = 8;
+        int nItemsAdded = 0;
+
+        list<wstring> inputStrings;
+
+        Helpers::ITimer* pTimer = new Helpers::CTimerTicks();
+        pTimer->Start();
+        ReadInputStrings(inputStrings, minLen);
+        logInfo(L"Time taken to read input file = %llu ms", pTimer->GetElapsedMilliseconds());
+
+        // Create the hashtable
+        CHL_FHTABLE* pfht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateFHT(&pfht, 100000, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+
+        pTimer->Reset();
+        pTimer->Start();
+        for (auto& curStr : inputStrings)
+        {
+            int count;
+            int valSize = sizeof(int);
+            if (SUCCEEDED(pfht->Find(pfht, (PCVOID)curStr.c_str(), 0, &count, &valSize, FALSE)))
+            {
+                Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)curStr.c_str(), 0, (PCVOID)(count + 1), sizeof(int))));
+            }
+            else
+            {
+                ++nItemsAdded;
+                Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)curStr.c_str(), 0, (PCVOID)1, sizeof(int))));
+            }
+        }
+
+        logInfo(L"Total insertions = %u, unique = %d", inputStrings.size(), nItemsAdded);
+        logInfo(L"Time taken for insertions = %llu ms", pTimer->GetElapsedMilliseconds());
+
+        // Find the string with highest frequency
+        PCWSTR pszCur = NULL;
+        PCWSTR pszMax = NULL;
+        int freqCur = 0;
+        int freqMax = 0;
+
+        CHL_FHT_ITERATOR itr;
+        Assert::IsTrue(SUCCEEDED(pfht->InitIterator(pfht, &itr)));
+
+        int keySize = sizeof(PCWSTR);
+        int valSize = sizeof(int);
+        do
+        {
+            Assert::AreEqual(S_OK, itr.GetCurrent(&itr, &pszCur, &keySize, &freqCur, &valSize, TRUE));
+            if (freqCur > freqMax)
+            {
+                freqMax = freqCur;
+                pszMax = pszCur;
+            }
+        } while (SUCCEEDED(itr.MoveNext(&itr)));
+
+        logInfo(L"Time taken = %llu ms", pTimer->GetElapsedMilliseconds());
+        logInfo(L"Max : %s = %d", pszMax, freqMax);
+
+        Assert::IsTrue(SUCCEEDED(pfht->Destroy(pfht)));
+        delete pTimer;
+    }
+
+    // Compares bucket distribution and hashing throughput of the hash types over short and long keys
+    TEST_METHOD(HashFunctionComparison)
+    {
+        const int c_keyLengths[] = { 8, 256 };
+        const int c_nKeys[] = { 100000, 20000 };
+        const int c_nRepeats = 10;
+
+        // Indexed by CHL_HT_HASHTYPE
+        const PCWSTR c_pszHashNames[] = { nullptr, L"Seeded64", L"DJB2", L"Shared64" };
+        static_assert(ARRAYSIZE(c_pszHashNames) == CHL_HT_HASH_END, "Name every hash type");
+
+        for (int iLen = 0; iLen < ARRAYSIZE(c_keyLengths); ++iLen)
+        {
+            vector<wstring> keys;
+            for (int idx = 0; idx < c_nKeys[iLen]; ++idx)
+            {
+                keys.push_back(Helpers::GenerateRandomString(c_keyLengths[iLen], Helpers::s_randomStrSource_AlphaNum));
+            }
+
+            for (int ht = CHL_HT_HASH_START + 1; ht < CHL_HT_HASH_END; ++ht)
+            {
+                CHL_HTABLE* pht;
+                Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, (int)keys.size(), CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+                Assert::IsTrue(SUCCEEDED(pht->SetHashType(pht, (CHL_HT_HASHTYPE)ht)));
+                Assert::IsTrue(SUCCEEDED(pht->SetLoadFactor(pht, 0, 0)));
+
+                for (auto& key : keys)
+                {
+                    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)key.c_str(), 0, (PCVOID)1, sizeof(int))));
+                }
+
+                // Sum of chain length * (chain length + 1) / 2 over all buckets, relative to that
+                // of a uniformly random hash. Close to 1.0 is good, much larger means clustering.
+                int maxChain = 0;
+                double sumCost = 0;
+                for (int bucket = 0; bucket < pht->nTableSize; ++bucket)
+                {
+                    int chain = pht->phtNodes[bucket].fOccupied ? 1 : 0;
+                    for (HT_NODE *pnode = pht->phtNodes[bucket].pnext; pnode != NULL; pnode = pnode->pnext)
+                    {
+                        ++chain;
+                    }
+                    maxChain = max(maxChain, chain);
+                    sumCost += (chain * (chain + 1)) / 2.0;
+                }
+                double n = (double)pht->nEntries;
+                double m = (double)pht->nTableSize;
+                double quality = sumCost / ((n / (2 * m)) * (n + 2 * m - 1));
+
+                int keySize = (c_keyLengths[iLen] + 1) * sizeof(WCHAR);
+                DWORD dwSink = 0;
+                Helpers::CTimerTicks timer;
+                timer.Start();
+                for (int rep = 0; rep < c_nRepeats; ++rep)
+                {
+                    for (auto& key : keys)
+                    {
+                        dwSink += _GetBucketIndex(pht, (PCVOID)key.c_str(), keySize, pht->nTableSize);
+                    }
+                }
+                UINT64 elapsedMs = timer.GetElapsedMilliseconds();
+
+                logInfo(L"%s, keylen %d: longest chain = %d, quality = %.3f, %d hashes in %llu ms (%u)",
+                    c_pszHashNames[ht], c_keyLengths[iLen], maxChain, quality,
+                    (int)keys.size() * c_nRepeats, elapsedMs, dwSink);
+
+                Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+            }
+        }
+    }
+
+    // Compares looking up random keys one at a time against looking them up in batches
+    TEST_METHOD(FindBatch)
+    {
+        const int c_nKeys = 1000000;
+        const int c_batchSize = 256;
+
+        auto spKeys = Helpers::GenerateRandomStrings(c_nKeys, Helpers::s_randomStrSource_AlphaNum);
+        vector<PVOID> keys;
+        vector<PVOID> vals;
+        for (int idx = 0; idx < c_nKeys; ++idx)
+        {
+            keys.push_back((PVOID)(*spKeys)[idx].c_str());
+            vals.push_back((PVOID)idx);
+        }
+
+        CHL_HTABLE* pht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, c_nKeys, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+        Assert::IsTrue(SUCCEEDED(pht->InsertBatch(pht, keys.data(), nullptr, vals.data(), nullptr, c_nKeys, nullptr)));
+
+        // Look up in an order unrelated to the insertion order
+        vector<PVOID> lookups;
+        for (int idx = 0; idx < c_nKeys; ++idx)
+        {
+            lookups.push_back(keys[((UINT64)idx * 7919) % c_nKeys]);
+        }
+
+        Helpers::CTimerTicks timer;
+        INT64 sum = 0;
+        timer.Start();
+        for (auto pvKey : lookups)
+        {
+            int val;
+            Assert::IsTrue(SUCCEEDED(pht->Find(pht, pvKey, 0, &val, nullptr, FALSE)));
+            sum += val;
+        }
+        logInfo(L"Find one at a time: %llu ms", timer.GetElapsedMilliseconds());
+
+        vector<PCHL_VAL> foundVals(c_batchSize);
+        INT64 sumBatch = 0;
+        timer.Reset();
+        timer.Start();
+        for (int idx = 0; idx < c_nKeys; idx += c_batchSize)
+        {
+            int nBatch = min(c_batchSize, c_nKeys - idx);
+            Assert::IsTrue(SUCCEEDED(pht->FindBatch(pht, &lookups[idx], nullptr, nBatch, foundVals.data(), nullptr)));
+            for (int i = 0; i < nBatch; ++i)
+            {
+                sumBatch += foundVals[i]->valDef.iVal;
+            }
+        }
+        logInfo(L"Find in batches of %d: %llu ms", c_batchSize, timer.GetElapsedMilliseconds());
+        Assert::AreEqual(sum, sumBatch);
+
+        Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+    }
+
+    // Runs a mix of 4 Finds to 1 Insert (update of an existing key) on an increasing
+    // number of threads, on a concurrent table and on a regular table behind a single lock.
+    TEST_METHOD(ConcurrentFindInsertScaling)
+    {
+        const int c_nKeys = 1000000;
+        const int c_nOpsPerThread = 2000000;
+
+        CHL_HTABLE* phtConcurrent;
+        CHL_HTABLE* phtLocked;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&phtConcurrent, c_nKeys, CHL_KT_INT32, CHL_VT_INT32, FALSE, CHL_HT_FLAG_CONCURRENT)));
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtLocked, c_nKeys, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+        for (int key = 0; key < c_nKeys; ++key)
+        {
+            Assert::IsTrue(SUCCEEDED(phtConcurrent->Insert(phtConcurrent, (PCVOID)key, sizeof(int), (PVOID)key, sizeof(int))));
+            Assert::IsTrue(SUCCEEDED(phtLocked->Insert(phtLocked, (PCVOID)key, sizeof(int), (PVOID)key, sizeof(int))));
+        }
+
+        SRWLOCK srwLock = SRWLOCK_INIT;
+        UINT nMaxThreads = max(1U, std::thread::hardware_concurrency());
+        for (UINT nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2)
+        {
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                bool fConcurrent = (pass == 0);
+                CHL_HTABLE* pht = fConcurrent ? phtConcurrent : phtLocked;
+
+                Helpers::CTimerTicks timer;
+                timer.Start();
+
+                std::vector<std::thread> threads;
+                for (UINT t = 0; t < nThreads; ++t)
+                {
+                    threads.emplace_back([=, &srwLock]()
+                    {
+                        UINT64 key = t;
+                        for (int op = 0; op < c_nOpsPerThread; ++op)
+                        {
+                            key = (key * 6364136223846793005ULL + 1442695040888963407ULL);
+                            int iKey = (int)((key >> 33) % c_nKeys);
+                            bool fInsert = ((op % 5) == 0);
+                            int val;
+
+                            if (!fConcurrent)
+                            {
+                                fInsert ? AcquireSRWLockExclusive(&srwLock) : AcquireSRWLockShared(&srwLock);
+                            }
+
+                            if (fInsert)
+                            {
+                                pht->Insert(pht, (PCVOID)iKey, sizeof(int), (PVOID)iKey, sizeof(int));
+                            }
+                            else
+                            {
+                                pht->Find(pht, (PCVOID)iKey, sizeof(int), &val, nullptr, FALSE);
+                            }
+
+                            if (!fConcurrent)
+                            {
+                                fInsert ? ReleaseSRWLockExclusive(&srwLock) : ReleaseSRWLockShared(&srwLock);
+                            }
+                        }
+                    });
+                }
+
+                for (auto& thread : threads)
+                {
+                    thread.join();
+                }
+
+                logInfo(L"%s table, %u threads: %llu ms for %d ops/thread",
+                    fConcurrent ? L"Concurrent" : L"Single lock", nThreads, timer.GetElapsedMilliseconds(), c_nOpsPerThread);
+            }
+        }
+
+        Assert::AreEqual(c_nKeys, phtConcurrent->nEntries);
+        Assert::IsTrue(SUCCEEDED(phtConcurrent->Destroy(phtConcurrent)));
+        Assert::IsTrue(SUCCEEDED(phtLocked->Destroy(phtLocked)));
+    }
+
+    // Reader threads look up random keys while one thread keeps updating keys, on a table
+    // with lock-free reads and on a concurrent table with striped locks.
+    TEST_METHOD(LockFreeReadScaling)
+    {
+        const int c_nKeys = 1000000;
+        const int c_nFindsPerThread = 4000000;
+
+        UINT nMaxThreads = max(1U, std::thread::hardware_concurrency());
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            DWORD dwFlags = (pass == 0) ? CHL_HT_FLAG_LOCKFREE_READS : CHL_HT_FLAG_CONCURRENT;
+
+            CHL_HTABLE* pht;
+            Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&pht, c_nKeys, CHL_KT_INT32, CHL_VT_INT32, FALSE, dwFlags)));
+            for (int key = 0; key < c_nKeys; ++key)
+            {
+                Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)key, sizeof(int), (PVOID)key, sizeof(int))));
+            }
+
+            for (UINT nReaders = 1; nReaders <= nMaxThreads; nReaders *= 2)
+            {
+                volatile bool fDone = false;
+                std::thread writer([=, &fDone]()
+                {
+                    for (int key = 0; !fDone; key = (key + 1) % c_nKeys)
+                    {
+                        pht->Insert(pht, (PCVOID)key, sizeof(int), (PVOID)(key + 1), sizeof(int));
+                        std::this_thread::yield();
+                    }
+                });
+
+                Helpers::CTimerTicks timer;
+                timer.Start();
+
+                std::vector<std::thread> readers;
+                for (UINT t = 0; t < nReaders; ++t)
+                {
+                    readers.emplace_back([=]()
+                    {
+                        UINT64 key = t;
+                        for (int op = 0; op < c_nFindsPerThread; ++op)
+                        {
+                            int val;
+                            key = (key * 6364136223846793005ULL + 1442695040888963407ULL);
+                            pht->Find(pht, (PCVOID)(int)((key >> 33) % c_nKeys), sizeof(int), &val, nullptr, FALSE);
+                        }
+                    });
+                }
+
+                for (auto& reader : readers)
+                {
+                    reader.join();
+                }
+
+                logInfo(L"%s, %u readers: %llu ms for %d finds/thread",
+                    (pass == 0) ? L"Lock-free reads" : L"Striped locks", nReaders, timer.GetElapsedMilliseconds(), c_nFindsPerThread);
+
+                fDone = true;
+                writer.join();
+            }
+
+            Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+        }
+    }
+
+    // Iterates a table sized for many more entries than it holds, and a full one,
+    // with and without the compact layout.
+    TEST_METHOD(CompactIteration)
+    {
+        const int c_nEstEntries = 900000;
+        const int c_nSparseEntries = 10;
+        const int c_nIterations = 20;
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            DWORD dwFlags = (pass == 0) ? 0 : CHL_HT_FLAG_COMPACT;
+            PCWSTR pszLayout = (pass == 0) ? L"Nodes in buckets" : L"Compact";
+
+            for (int nEntries : { c_nSparseEntries, c_nEstEntries })
+            {
+                CHL_HTABLE* pht;
+                Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&pht, c_nEstEntries, CHL_KT_INT32, CHL_VT_INT32, FALSE, dwFlags)));
+                for (int key = 0; key < nEntries; ++key)
+                {
+                    Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)key, sizeof(int), (PVOID)key, sizeof(int))));
+                }
+
+                Helpers::CTimerTicks timer;
+                timer.Start();
+
+                int nFound = 0;
+                for (int iteration = 0; iteration < c_nIterations; ++iteration)
+                {
+                    CHL_HT_ITERATOR itr;
+                    nFound = 0;
+                    for (HRESULT hr = pht->InitIterator(pht, &itr); SUCCEEDED(hr); hr = itr.MoveNext(&itr))
+                    {
+                        int val;
+                        Assert::IsTrue(SUCCEEDED(itr.GetCurrent(&itr, nullptr, nullptr, &val, nullptr, FALSE)));
+                        ++nFound;
+                    }
+                }
+
+                Assert::AreEqual(nEntries, nFound);
+
+                CHL_HT_STATS stats;
+                Assert::IsTrue(SUCCEEDED(pht->GetStats(pht, &stats)));
+                logInfo(L"%s, %d entries in %d buckets: %llu ms for %d iterations, %Iu bytes",
+                    pszLayout, nEntries, stats.nBuckets, timer.GetElapsedMilliseconds(), c_nIterations, stats.cbNodes);
+
+                Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+            }
+        }
+    }
+
+    TEST_METHOD(ImageOpenVsRebuild)
+    {
+        const int c_nEntries = 1000000;
+        const WCHAR c_szImageFile[] = L"htimage_perf.tmp";
+
+        Helpers::CTimerTicks timer;
+        timer.Start();
+
+        CHL_HTABLE* pht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, c_nEntries, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+        for (int i = 0; i < c_nEntries; ++i)
+        {
+            char szKey[32];
+            Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "user:%08d", i)));
+            Assert::IsTrue(SUCCEEDED(pht->Insert(pht, szKey, 0, (PVOID)i, sizeof(int))));
+        }
+        logInfo(L"Rebuild table of %d entries: %llu ms", c_nEntries, timer.GetElapsedMilliseconds());
+
+        timer.Reset();
+        timer.Start();
+        Assert::AreEqual(S_OK, CHL_DsSaveImageHT(pht, c_szImageFile));
+        logInfo(L"Save image: %llu ms", timer.GetElapsedMilliseconds());
+        Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+
+        timer.Reset();
+        timer.Start();
+        PCHL_HT_IMAGE pImage;
+        Assert::AreEqual(S_OK, CHL_DsOpenImageHT(&pImage, c_szImageFile));
+        logInfo(L"Open image: %llu ms", timer.GetElapsedMilliseconds());
+
+        timer.Reset();
+        timer.Start();
+        for (int i = 0; i < c_nEntries; ++i)
+        {
+            char szKey[32];
+            int val;
+            Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "user:%08d", i)));
+            Assert::IsTrue(SUCCEEDED(pImage->Find(pImage, szKey, 0, &val, nullptr, FALSE)));
+            Assert::AreEqual(i, val);
+        }
+        logInfo(L"Find all %d keys in image: %llu ms", c_nEntries, timer.GetElapsedMilliseconds());
+
+        Assert::IsTrue(SUCCEEDED(pImage->Close(pImage)));
+        Assert::IsTrue(DeleteFile(c_szImageFile));
+    }
+
+    TEST_METHOD(FrozenFindVsTable)
+    {
+        const int c_nEntries = 1000000;
+
+        CHL_HTABLE* pht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, c_nEntries, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+        for (int i = 0; i < c_nEntries; ++i)
+        {
+            char szKey[32];
+            Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "user:%08d", i)));
+            Assert::IsTrue(SUCCEEDED(pht->Insert(pht, szKey, 0, (PVOID)i, sizeof(int))));
+        }
+
+        Helpers::CTimerTicks timer;
+        timer.Start();
+        PCHL_HT_IMAGE pImage;
+        Assert::AreEqual(S_OK, CHL_DsFreezeHT(pht, &pImage));
+        logInfo(L"Freeze %d entries: %llu ms, %llu bytes", c_nEntries, timer.GetElapsedMilliseconds(), pImage->cbImage);
+
+        timer.Reset();
+        timer.Start();
+        for (int i = 0; i < c_nEntries; ++i)
+        {
+            char szKey[32];
+            int val;
+            Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "user:%08d", i)));
+            Assert::IsTrue(SUCCEEDED(pht->Find(pht, szKey, 0, &val, nullptr, FALSE)));
+        }
+        logInfo(L"Find all %d keys in table: %llu ms", c_nEntries, timer.GetElapsedMilliseconds());
+
+        timer.Reset();
+        timer.Start();
+        for (int i = 0; i < c_nEntries; ++i)
+        {
+            char szKey[32];
+            int val;
+            Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "user:%08d", i)));
+            Assert::IsTrue(SUCCEEDED(pImage->Find(pImage, szKey, 0, &val, nullptr, FALSE)));
+        }
+        logInfo(L"Find all %d keys in frozen image: %llu ms", c_nEntries, timer.GetElapsedMilliseconds());
+
+        Assert::IsTrue(SUCCEEDED(pImage->Close(pImage)));
+        Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+    }
+
+    // Integer and pointer keys through CHL_HTABLE versus the integer specialized table
+    TEST_METHOD(IntKeys_HashtableVsIntHashtable)
+    {
+        const int c_nEntries = 1000000;
+
+        // Sequential integers, then heap-like pointers that are 16 byte aligned
+        for (UINT_PTR uStride : { (UINT_PTR)1, (UINT_PTR)16 })
+        {
+            CHL_KEYTYPE keyType = (uStride == 1) ? CHL_KT_INT32 : CHL_KT_POINTER;
+            Helpers::CTimerTicks timer;
+
+            CHL_HTABLE* pht;
+            Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&pht, c_nEntries, keyType, CHL_VT_INT32, FALSE)));
+
+            timer.Start();
+            for (int i = 0; i < c_nEntries; ++i)
+            {
+                Assert::IsTrue(SUCCEEDED(pht->Insert(pht, (PCVOID)((i + 1) * uStride), sizeof(PVOID), (PCVOID)i, sizeof(int))));
+            }
+            UINT64 insertMs = timer.GetElapsedMilliseconds();
+
+            timer.Reset();
+            timer.Start();
+            for (int i = 0; i < c_nEntries; ++i)
+            {
+                int val;
+                Assert::IsTrue(SUCCEEDED(pht->Find(pht, (PCVOID)((i + 1) * uStride), sizeof(PVOID), &val, nullptr, FALSE)));
+            }
+
+            CHL_HT_STATS stats;
+            Assert::IsTrue(SUCCEEDED(pht->GetStats(pht, &stats)));
+            logInfo(L"CHL_HTABLE, stride %Iu: insert %llu ms, find %llu ms, %Iu bytes",
+                uStride, insertMs, timer.GetElapsedMilliseconds(), stats.cbNodes);
+            Assert::IsTrue(SUCCEEDED(pht->Destroy(pht)));
+
+            CHL_IHTABLE* piht;
+            Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, c_nEntries, FALSE)));
+
+            timer.Reset();
+            timer.Start();
+            for (int i = 0; i < c_nEntries; ++i)
+            {
+                Assert::IsTrue(SUCCEEDED(piht->Insert(piht, (i + 1) * uStride, (UINT_PTR)i)));
+            }
+            insertMs = timer.GetElapsedMilliseconds();
+
+            timer.Reset();
+            timer.Start();
+            for (int i = 0; i < c_nEntries; ++i)
+            {
+                UINT_PTR val;
+                Assert::IsTrue(SUCCEEDED(piht->Find(piht, (i + 1) * uStride, &val)));
+            }
+
+            logInfo(L"CHL_IHTABLE, stride %Iu: insert %llu ms, find %llu ms, %Iu bytes",
+                uStride, insertMs, timer.GetElapsedMilliseconds(), (size_t)piht->nCapacity * sizeof(IHT_SLOT));
+            Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)));
+        }
+    }
+
 private:
+    // Reads whitespace separated strings of at least minLen chars from the input file
+    static void ReadInputStrings(_Inout_ list<wstring>& inputStrings, _In_ int minLen)
+    {
+        WCHAR szLine[512];
+        int nFieldsRead = 0;
+
+        FILE* pFile = nullptr;
+        Assert::AreEqual(0, _wfopen_s(&pFile, s_pszInputFileTale, L"r"), L"File open must succeed");
+        Assert::IsNotNull(pFile);
+
+        while ((nFieldsRead = fwscanf_s(pFile, L"%511s", szLine, (UINT)ARRAYSIZE(szLine))) == 1)
+        {
+            // Skip strings that don't meet min length
+            if (wcslen(szLine) < minLen)
+            {
+                continue;
+            }
+            inputStrings.push_back(szLine);
+        }
+
+        Assert::AreEqual(nFieldsRead, EOF);
+        fclose(pFile);
+        pFile = NULL;
+
+        logInfo(L"#strings greater than length %d = %u", minLen, inputStrings.size());
+    }
+
     static PCWSTR s_pszInputFileTale;
 };
 
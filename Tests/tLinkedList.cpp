@@ -14,6 +14,7 @@ public:
     TEST_METHOD(CreateAndDestroy);
     TEST_METHOD(FunctionPointers);
     TEST_METHOD(Iteration_Find);
+    TEST_METHOD(ByteBudget);
 };
 
 void LinkedListUnitTests::CreateAndDestroy()
@@ -45,6 +46,7 @@ void LinkedListUnitTests::FunctionPointers()
     Assert::IsNotNull((PVOID)pList->Remove);
     Assert::IsNotNull((PVOID)pList->RemoveAt);
     Assert::IsNotNull((PVOID)pList->RemoveAtItr);
+    Assert::IsNotNull((PVOID)pList->SetBudget);
     Assert::IsTrue(SUCCEEDED(CHL_DsDestroyLL(pList)));
 }
 
@@ -77,4 +79,41 @@ void LinkedListUnitTests::Iteration_Find()
     Assert::IsTrue(SUCCEEDED(pList->Destroy(pList)));
 }
 
+void LinkedListUnitTests::ByteBudget()
+{
+    PCHL_LLIST pList;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateLL(&pList, CHL_VT_INT32, 10)));
+    Assert::AreEqual(S_OK, pList->SetBudget(pList, 10 * sizeof(LLNODE), CHL_BP_EVICT_OLDEST, nullptr, nullptr));
+
+    // Oldest values are evicted from the head
+    for (int i = 0; i < 100; ++i)
+    {
+        Assert::IsTrue(SUCCEEDED(pList->Insert(pList, (PCVOID)i, 0)));
+    }
+    Assert::AreEqual(10, pList->nCurNodes);
+    Assert::AreEqual((SIZE_T)(10 * sizeof(LLNODE)), pList->budget.cbUsed);
+    Assert::AreEqual(90ULL, pList->budget.ullEvictions);
+
+    int val;
+    Assert::IsTrue(SUCCEEDED(pList->Peek(pList, 0, &val, nullptr, FALSE)));
+    Assert::AreEqual(90, val);
+
+    // Random eviction never evicts the value just inserted at the tail
+    Assert::AreEqual(S_OK, pList->SetBudget(pList, 10 * sizeof(LLNODE), CHL_BP_EVICT_RANDOM, nullptr, nullptr));
+    for (int i = 100; i < 200; ++i)
+    {
+        Assert::IsTrue(SUCCEEDED(pList->Insert(pList, (PCVOID)i, 0)));
+        Assert::IsTrue(SUCCEEDED(pList->Peek(pList, 9, &val, nullptr, FALSE)));
+        Assert::AreEqual(i, val);
+    }
+
+    Assert::AreEqual(S_OK, pList->SetBudget(pList, 10 * sizeof(LLNODE), CHL_BP_FAIL, nullptr, nullptr));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA), pList->Insert(pList, (PCVOID)1, 0));
+    Assert::IsTrue(SUCCEEDED(pList->RemoveAt(pList, 0, nullptr, nullptr, FALSE)));
+    Assert::AreEqual((SIZE_T)(9 * sizeof(LLNODE)), pList->budget.cbUsed);
+    Assert::IsTrue(SUCCEEDED(pList->Insert(pList, (PCVOID)1, 0)));
+
+    Assert::IsTrue(SUCCEEDED(pList->Destroy(pList)));
+}
+
 }
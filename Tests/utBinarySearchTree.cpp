@@ -17,6 +17,8 @@ public:
     TEST_METHOD(FindMinMax_Ints);
     TEST_METHOD(FindFloorCeil_Ints);
     TEST_METHOD(SimpleInsertFind_StrInt);
+    TEST_METHOD(ByteBudget_IntStr);
+    TEST_METHOD(Multimap_IntWStr);
 
     // TODO: Change HRESULT verification from IsTrue to AreEqual
 };
@@ -240,4 +242,92 @@ void BSTUnitTests::SimpleInsertFind_StrInt()
     LOG_FUNC_EXIT;
 }
 
+void BSTUnitTests::ByteBudget_IntStr()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_BSTREE bst;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateBST(&bst, CHL_KT_INT32, CHL_VT_STRING, Helpers::CompareFn_Int32, FALSE)));
+
+    const int c_nItems = 1000;
+    const SIZE_T c_cbEntry = sizeof(BSTNODE) + sizeof("value");
+    for (int i = 0; i < c_nItems; ++i)
+    {
+        Assert::AreEqual(S_OK, bst.Insert(&bst, (PCVOID)i, 0, "value", 0));
+    }
+    Assert::AreEqual((SIZE_T)(c_nItems * c_cbEntry), bst.budget.cbUsed);
+
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), bst.SetBudget(&bst, 4096, CHL_BP_EVICT_OLDEST, nullptr, nullptr),
+        L"The tree does not keep insertion order");
+
+    // Random entries are evicted, the tree stays searchable
+    Assert::AreEqual(S_OK, bst.SetBudget(&bst, 100 * c_cbEntry, CHL_BP_EVICT_RANDOM, nullptr, nullptr));
+    Assert::AreEqual((SIZE_T)(100 * c_cbEntry), bst.budget.cbUsed);
+    Assert::AreEqual(100U, bst.pRoot->treeSize);
+    Assert::AreEqual((ULONGLONG)(c_nItems - 100), bst.budget.ullEvictions);
+
+    int nFound = 0;
+    for (int i = 0; i < c_nItems; ++i)
+    {
+        nFound += SUCCEEDED(bst.Find(&bst, (PCVOID)i, 0, nullptr, nullptr, FALSE)) ? 1 : 0;
+    }
+    Assert::AreEqual(100, nFound);
+
+    Assert::AreEqual(S_OK, bst.Insert(&bst, (PCVOID)-1, 0, "value", 0));
+    Assert::AreEqual(S_OK, bst.Find(&bst, (PCVOID)-1, 0, nullptr, nullptr, FALSE), L"Inserted key is never evicted");
+    Assert::AreEqual(100U, bst.pRoot->treeSize);
+
+    Assert::AreEqual(S_OK, bst.SetBudget(&bst, 100 * c_cbEntry, CHL_BP_FAIL, nullptr, nullptr));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_QUOTA), bst.Insert(&bst, (PCVOID)-2, 0, "value", 0));
+
+    Assert::IsTrue(SUCCEEDED(bst.Destroy(&bst)));
+
+    LOG_FUNC_EXIT;
+}
+
+void BSTUnitTests::Multimap_IntWStr()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_BSTREE bst;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateExBST(&bst, CHL_KT_INT32, CHL_VT_WSTRING, Helpers::CompareFn_Int32, FALSE, 0x80));
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExBST(&bst, CHL_KT_INT32, CHL_VT_WSTRING, Helpers::CompareFn_Int32, FALSE,
+        CHL_BST_FLAG_MULTIMAP)));
+
+    // 50 keys with 10 values each
+    WCHAR szVal[32];
+    for (int i = 0; i < 500; ++i)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfW(szVal, ARRAYSIZE(szVal), L"value%d", i)));
+        Assert::AreEqual(S_OK, bst.Insert(&bst, (PCVOID)((i * 7) % 50), 0, szVal, 0));
+    }
+    Assert::AreEqual(50U, bst.pRoot->treeSize);
+
+    PCHL_VAL pChlVals;
+    int nVals;
+    Assert::AreEqual(S_OK, bst.FindAll(&bst, (PCVOID)7, 0, &pChlVals, &nVals));
+    Assert::AreEqual(10, nVals);
+    Assert::AreEqual(L"value1", pChlVals[0].valDef.pwszVal);
+    Assert::AreEqual(L"value51", pChlVals[1].valDef.pwszVal);
+
+    PCWSTR pszFound;
+    Assert::AreEqual(S_OK, bst.Find(&bst, (PCVOID)7, 0, &pszFound, nullptr, TRUE));
+    Assert::AreEqual(L"value1", pszFound);
+
+    // Remove every value, the last value of a key takes the key with it
+    for (int i = 0; i < 500; ++i)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfW(szVal, ARRAYSIZE(szVal), L"value%d", i)));
+        Assert::AreEqual(S_OK, bst.RemoveVal(&bst, (PCVOID)((i * 7) % 50), 0, szVal, 0));
+    }
+    Assert::AreEqual(E_NOT_SET, bst.RemoveVal(&bst, (PCVOID)7, 0, L"value1", 0));
+    Assert::IsNull(bst.pRoot);
+    Assert::AreEqual((SIZE_T)0, bst.budget.cbUsed);
+
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), bst.SetBudget(&bst, 4096, CHL_BP_FAIL, nullptr, nullptr));
+    Assert::IsTrue(SUCCEEDED(bst.Destroy(&bst)));
+
+    LOG_FUNC_EXIT;
+}
+
 }
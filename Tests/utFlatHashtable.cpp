@@ -0,0 +1,248 @@
+
+#include "stdafx.h"
+#include "FlatHashtable.h"
+
+#include "CppUnitTest.h"
+#include "Helpers.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+TEST_CLASS(FlatHashtableUnitTests)
+{
+public:
+    TEST_METHOD(CreateAndDestroy);
+    TEST_METHOD(InsertFindRemove_IntUint);
+    TEST_METHOD(InsertFindRemove_WStrWStr);
+    TEST_METHOD(GrowAndChurn_IntInt);
+    TEST_METHOD(IterationAndRemoval_WStrInt);
+    TEST_METHOD(RehashInvalidatesIterator);
+};
+
+void FlatHashtableUnitTests::CreateAndDestroy()
+{
+    static int s_tableSizes[] = { 0, 1, 14, 15, 16, 9999, 354972 };
+
+    int itrTableSize = 0;
+    for (int kt = CHL_KT_START + 1; kt < CHL_KT_END; ++kt)
+    {
+        for (int vt = CHL_VT_START + 1; vt < CHL_VT_END; ++vt)
+        {
+            PCHL_FHTABLE pfht;
+            auto nEstEntries = s_tableSizes[itrTableSize++ % ARRAYSIZE(s_tableSizes)];
+
+            logInfo(L"Create flat hashtable: KT = %d, VT = %d, #entries = %d", kt, vt, nEstEntries);
+            Assert::IsTrue(SUCCEEDED(CHL_DsCreateFHT(&pfht, nEstEntries, (CHL_KEYTYPE)kt, (CHL_VALTYPE)vt, FALSE)));
+            Assert::IsTrue((pfht->nCapacity % CHL_FHT_GROUP_WIDTH) == 0, L"Capacity is a multiple of the group width");
+            Assert::IsTrue((pfht->nCapacity & (pfht->nCapacity - 1)) == 0, L"Capacity is a power of 2");
+            Assert::IsTrue(pfht->nGrowthLeft >= (UINT)nEstEntries, L"Estimated entries fit without a rehash");
+            Assert::IsTrue(SUCCEEDED(pfht->Destroy(pfht)), L"Destroying empty hashtable succeeds");
+        }
+    }
+
+    PCHL_FHTABLE pfht;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateFHT(&pfht, -1, CHL_KT_INT32, CHL_VT_INT32, FALSE));
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateFHT(&pfht, 10, CHL_KT_END, CHL_VT_INT32, FALSE));
+}
+
+void FlatHashtableUnitTests::InsertFindRemove_IntUint()
+{
+    static int s_keys[] = { 0, 1, -1, MAXINT32 - 1, MAXINT32 };
+    static UINT s_values[] = { 0, 1, 2, MAXUINT32 - 1, MAXUINT32 };
+    static_assert(ARRAYSIZE(s_keys) == ARRAYSIZE(s_values), "#keys is equal to #values");
+
+    // Flat hashtable with KT = Int, VT = UInt
+    PCHL_FHTABLE pfht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateFHT(&pfht, 10, CHL_KT_INT32, CHL_VT_UINT32, FALSE)));
+
+    for (int idx = 0; idx < ARRAYSIZE(s_keys); ++idx)
+    {
+        logDebug(L"Inserting: %d = %u", s_keys[idx], s_values[idx]);
+        Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)s_keys[idx], 0, (PVOID)s_values[idx], sizeof(s_values[0]))));
+    }
+    Assert::AreEqual((UINT)ARRAYSIZE(s_keys), pfht->nEntries);
+
+    for (int idx = 0; idx < ARRAYSIZE(s_keys); ++idx)
+    {
+        UINT val;
+        Assert::IsTrue(SUCCEEDED(pfht->Find(pfht, (PCVOID)s_keys[idx], 0, &val, nullptr, FALSE)));
+        Assert::AreEqual(s_values[idx], val, L"Retrieved value must match expected value");
+    }
+
+    // Inserting an existing key overwrites its value
+    UINT val;
+    Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)s_keys[0], 0, (PVOID)1234, sizeof(UINT))));
+    Assert::IsTrue(SUCCEEDED(pfht->Find(pfht, (PCVOID)s_keys[0], 0, &val, nullptr, FALSE)));
+    Assert::AreEqual(1234U, val);
+    Assert::AreEqual((UINT)ARRAYSIZE(s_keys), pfht->nEntries);
+
+    for (int idx = 0; idx < ARRAYSIZE(s_keys); ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pfht->Remove(pfht, (PCVOID)s_keys[idx], 0)));
+        Assert::AreEqual(E_NOT_SET, pfht->Find(pfht, (PCVOID)s_keys[idx], 0, nullptr, nullptr, FALSE));
+        Assert::AreEqual(E_NOT_SET, pfht->Remove(pfht, (PCVOID)s_keys[idx], 0));
+    }
+    Assert::AreEqual(0U, pfht->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(pfht->Destroy(pfht)));
+}
+
+void FlatHashtableUnitTests::InsertFindRemove_WStrWStr()
+{
+    const int c_nItems = 500;
+    auto spKeys = Helpers::GenerateRandomStrings(c_nItems, Helpers::s_randomStrSource_AlphaNum);
+    auto spValues = Helpers::GenerateRandomStrings(c_nItems, Helpers::s_randomStrSource_AlphaNum);
+
+    // Flat hashtable with KT = WStr, VT = WStr
+    PCHL_FHTABLE pfht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateFHT(&pfht, 10, CHL_KT_WSTRING, CHL_VT_WSTRING, FALSE)));
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)(*spKeys)[idx].c_str(), 0, (PCVOID)(*spValues)[idx].c_str(), 0)));
+    }
+
+    // Random strings may repeat, the latest value wins
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        PCWSTR pszVal;
+        Assert::IsTrue(SUCCEEDED(pfht->Find(pfht, (PCVOID)(*spKeys)[idx].c_str(), 0, &pszVal, nullptr, TRUE)));
+
+        int iLast = idx;
+        for (int j = idx + 1; j < c_nItems; ++j)
+        {
+            if ((*spKeys)[j] == (*spKeys)[idx])
+            {
+                iLast = j;
+            }
+        }
+        Assert::AreEqual((*spValues)[iLast].c_str(), pszVal, L"Retrieved value must match expected value");
+    }
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        pfht->Remove(pfht, (PCVOID)(*spKeys)[idx].c_str(), 0);
+        Assert::AreEqual(E_NOT_SET, pfht->Find(pfht, (PCVOID)(*spKeys)[idx].c_str(), 0, nullptr, nullptr, FALSE));
+    }
+    Assert::AreEqual(0U, pfht->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(pfht->Destroy(pfht)));
+}
+
+void FlatHashtableUnitTests::GrowAndChurn_IntInt()
+{
+    const int c_nItems = 20000;
+    const int c_nRounds = 10;
+
+    // Created much smaller than what is inserted
+    PCHL_FHTABLE pfht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateFHT(&pfht, 1, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)idx, sizeof(int), (PVOID)(idx * 2), sizeof(int))));
+    }
+    Assert::AreEqual((UINT)c_nItems, pfht->nEntries);
+    UINT nCapacityAfterGrow = pfht->nCapacity;
+
+    // Repeatedly insert and remove other keys. Deleted slots must be reclaimed
+    // rather than growing the table without bound.
+    for (int round = 0; round < c_nRounds; ++round)
+    {
+        int base = c_nItems * (round + 1);
+        for (int idx = 0; idx < c_nItems / 2; ++idx)
+        {
+            Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)(base + idx), sizeof(int), (PVOID)1, sizeof(int))));
+        }
+        for (int idx = 0; idx < c_nItems / 2; ++idx)
+        {
+            Assert::IsTrue(SUCCEEDED(pfht->Remove(pfht, (PCVOID)(base + idx), sizeof(int))));
+        }
+    }
+    Assert::AreEqual((UINT)c_nItems, pfht->nEntries);
+    Assert::IsTrue(pfht->nCapacity <= nCapacityAfterGrow * 2, L"Churn must not keep growing the table");
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        int val;
+        Assert::IsTrue(SUCCEEDED(pfht->Find(pfht, (PCVOID)idx, sizeof(int), &val, nullptr, FALSE)));
+        Assert::AreEqual(idx * 2, val, L"Retrieved value must match expected value");
+    }
+
+    Assert::IsTrue(SUCCEEDED(pfht->Destroy(pfht)));
+}
+
+void FlatHashtableUnitTests::IterationAndRemoval_WStrInt()
+{
+    const int c_nItems = 100;
+
+    // Flat hashtable with KT = WStr, VT = Int
+    PCHL_FHTABLE pfht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateFHT(&pfht, 10, CHL_KT_WSTRING, CHL_VT_INT32, FALSE)));
+
+    std::vector<std::wstring> keys;
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        keys.push_back(L"key" + std::to_wstring(idx));
+        Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)keys[idx].c_str(), 0, (PVOID)idx, sizeof(int))));
+    }
+
+    // Remove every other entry while iterating, all entries are visited exactly once
+    std::vector<bool> seen(c_nItems, false);
+    PCWSTR pszKey;
+    int iVal;
+    CHL_FHT_ITERATOR itr;
+    Assert::IsTrue(SUCCEEDED(pfht->InitIterator(pfht, &itr)));
+    while (SUCCEEDED(itr.GetCurrent(&itr, &pszKey, nullptr, &iVal, nullptr, TRUE)))
+    {
+        Assert::IsTrue((iVal >= 0) && (iVal < c_nItems));
+        Assert::IsFalse(seen[iVal], L"Entry must be visited only once");
+        Assert::AreEqual(keys[iVal].c_str(), pszKey);
+        seen[iVal] = true;
+
+        if ((iVal % 2) == 0)
+        {
+            Assert::IsTrue(SUCCEEDED(pfht->RemoveAt(&itr))); // remove automatically moves to next element
+        }
+        else
+        {
+            itr.MoveNext(&itr);
+        }
+    }
+    Assert::AreEqual(E_NOT_SET, itr.MoveNext(&itr));
+    Assert::IsTrue(std::all_of(seen.cbegin(), seen.cend(), [](bool f) { return f; }));
+    Assert::AreEqual((UINT)(c_nItems / 2), pfht->nEntries);
+
+    for (int idx = 0; idx < c_nItems; ++idx)
+    {
+        HRESULT hr = pfht->Find(pfht, (PCVOID)keys[idx].c_str(), 0, nullptr, nullptr, FALSE);
+        Assert::AreEqual(((idx % 2) == 0) ? E_NOT_SET : S_OK, hr);
+    }
+
+    Assert::IsTrue(SUCCEEDED(pfht->Destroy(pfht)));
+}
+
+void FlatHashtableUnitTests::RehashInvalidatesIterator()
+{
+    PCHL_FHTABLE pfht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateFHT(&pfht, 0, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+    Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)0, 0, (PVOID)0, 0)));
+
+    CHL_FHT_ITERATOR itr;
+    Assert::IsTrue(SUCCEEDED(pfht->InitIterator(pfht, &itr)));
+
+    UINT nCapacity = pfht->nCapacity;
+    for (int idx = 1; pfht->nCapacity == nCapacity; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(pfht->Insert(pfht, (PCVOID)idx, 0, (PVOID)idx, 0)));
+    }
+
+    Assert::AreEqual(E_CHANGED_STATE, itr.MoveNext(&itr));
+    Assert::AreEqual(E_CHANGED_STATE, itr.GetCurrent(&itr, nullptr, nullptr, nullptr, nullptr, FALSE));
+    Assert::AreEqual(E_CHANGED_STATE, pfht->RemoveAt(&itr));
+
+    Assert::IsTrue(SUCCEEDED(pfht->Destroy(pfht)));
+}
+
+}
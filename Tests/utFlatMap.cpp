@@ -0,0 +1,390 @@
+#include "stdafx.h"
+#include "FlatMap.h"
+
+#include "CppUnitTest.h"
+#include "Helpers.h"
+
+#include <map>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+TEST_CLASS(FlatMapUnitTests)
+{
+public:
+    TEST_METHOD(CreateAndDestroy);
+    TEST_METHOD(InsertFindRemove_Ints);
+    TEST_METHOD(FindMinMaxFloorCeil_Ints);
+    TEST_METHOD(InsertBatch_Ints);
+    TEST_METHOD(InsertBatch_HeapVals);
+    TEST_METHOD(InsertFindGetAt_WStrInt);
+
+private:
+    static void VerifyAgainstMap(_In_ PCHL_FLATMAP pfm, _In_ const std::map<int, int>& expected, _In_ int minKey, _In_ int maxKey);
+};
+
+void FlatMapUnitTests::CreateAndDestroy()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_FLATMAP fm;
+    Assert::AreEqual(S_OK, CHL_DsCreateFM(&fm, CHL_KT_INT32, CHL_VT_INT32, nullptr, FALSE));
+
+    PVOID pv = fm.Destroy; Assert::IsNotNull(pv);
+    pv = fm.Insert; Assert::IsNotNull(pv);
+    pv = fm.InsertBatch; Assert::IsNotNull(pv);
+    pv = fm.Find; Assert::IsNotNull(pv);
+    pv = fm.Remove; Assert::IsNotNull(pv);
+    pv = fm.FindMax; Assert::IsNotNull(pv);
+    pv = fm.FindMin; Assert::IsNotNull(pv);
+    pv = fm.FindFloor; Assert::IsNotNull(pv);
+    pv = fm.FindCeil; Assert::IsNotNull(pv);
+    pv = fm.GetAt; Assert::IsNotNull(pv);
+
+    Assert::AreEqual(S_OK, fm.Destroy(&fm));
+
+    // String keys can only be ordered by a compare function
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateFM(&fm, CHL_KT_WSTRING, CHL_VT_INT32, nullptr, FALSE));
+
+    Assert::AreEqual(S_OK, CHL_DsCreateExFM(&fm, CHL_KT_WSTRING, CHL_VT_INT32, Helpers::CompareFn_WString, FALSE, CHL_FM_FLAG_EYTZINGER));
+    Assert::IsTrue(fm.fEytzinger == TRUE);
+    Assert::AreEqual(S_OK, fm.Destroy(&fm));
+
+    LOG_FUNC_EXIT;
+}
+
+void FlatMapUnitTests::InsertFindRemove_Ints()
+{
+    LOG_FUNC_ENTRY;
+
+    const int c_nItems = 1000;
+    DWORD aFlags[] = { 0, CHL_FM_FLAG_EYTZINGER };
+
+    for (auto dwFlags : aFlags)
+    {
+        logInfo(L"Flags: 0x%08x", dwFlags);
+
+        CHL_FLATMAP fm;
+        Assert::AreEqual(S_OK, CHL_DsCreateExFM(&fm, CHL_KT_INT32, CHL_VT_INT32, Helpers::CompareFn_Int32, FALSE, dwFlags));
+
+        int val;
+        Assert::AreEqual(E_NOT_SET, fm.Find(&fm, (PCVOID)0, sizeof(int), &val, nullptr, FALSE));
+
+        // Odd keys in decreasing order, then even keys in increasing order
+        for (int i = c_nItems - 1; i >= 0; i -= 2)
+        {
+            Assert::AreEqual(S_OK, fm.Insert(&fm, (PCVOID)i, sizeof(i), (PCVOID)(i * 10), sizeof(int)));
+        }
+
+        for (int i = 0; i < c_nItems; i += 2)
+        {
+            Assert::AreEqual(S_OK, fm.Insert(&fm, (PCVOID)i, sizeof(i), (PCVOID)(i * 10), sizeof(int)));
+        }
+
+        Assert::AreEqual((UINT)c_nItems, fm.nEntries);
+
+        for (int i = 0; i < c_nItems; ++i)
+        {
+            Assert::AreEqual(S_OK, fm.Find(&fm, (PCVOID)i, sizeof(i), &val, nullptr, FALSE));
+            Assert::AreEqual(i * 10, val);
+        }
+
+        Assert::AreEqual(E_NOT_SET, fm.Find(&fm, (PCVOID)-1, sizeof(int), &val, nullptr, FALSE));
+        Assert::AreEqual(E_NOT_SET, fm.Find(&fm, (PCVOID)c_nItems, sizeof(int), &val, nullptr, FALSE));
+
+        // Inserting an existing key replaces its value
+        Assert::AreEqual(S_OK, fm.Insert(&fm, (PCVOID)7, sizeof(int), (PCVOID)-7, sizeof(int)));
+        Assert::AreEqual((UINT)c_nItems, fm.nEntries);
+        Assert::AreEqual(S_OK, fm.Find(&fm, (PCVOID)7, sizeof(int), &val, nullptr, FALSE));
+        Assert::AreEqual(-7, val);
+
+        // Remove every third key
+        for (int i = 0; i < c_nItems; i += 3)
+        {
+            Assert::AreEqual(S_OK, fm.Remove(&fm, (PCVOID)i, sizeof(i)));
+        }
+
+        Assert::AreEqual(E_NOT_SET, fm.Remove(&fm, (PCVOID)0, sizeof(int)));
+
+        for (int i = 0; i < c_nItems; ++i)
+        {
+            HRESULT hrExpected = ((i % 3) == 0) ? E_NOT_SET : S_OK;
+            Assert::AreEqual(hrExpected, fm.Find(&fm, (PCVOID)i, sizeof(i), &val, nullptr, FALSE));
+        }
+
+        Assert::AreEqual(S_OK, fm.Destroy(&fm));
+    }
+
+    LOG_FUNC_EXIT;
+}
+
+void FlatMapUnitTests::FindMinMaxFloorCeil_Ints()
+{
+    LOG_FUNC_ENTRY;
+
+    const int c_nRandomItems = 500;
+    auto spRandomKeys = Helpers::GenerateRandomNumbers(c_nRandomItems);
+    auto& keysVec = *spRandomKeys;
+
+    DWORD aFlags[] = { 0, CHL_FM_FLAG_EYTZINGER };
+    CHL_CompareFn apfnCompare[] = { nullptr, Helpers::CompareFn_Int32 };
+
+    for (auto dwFlags : aFlags)
+    {
+        for (auto pfnCompare : apfnCompare)
+        {
+            logInfo(L"Flags: 0x%08x, compare function: %s", dwFlags, (pfnCompare != nullptr) ? L"yes" : L"no");
+
+            CHL_FLATMAP fm;
+            Assert::AreEqual(S_OK, CHL_DsCreateExFM(&fm, CHL_KT_INT32, CHL_VT_INT32, pfnCompare, FALSE, dwFlags));
+
+            int key;
+            Assert::AreEqual(E_NOT_SET, fm.FindMin(&fm, &key, nullptr, FALSE));
+            Assert::AreEqual(E_NOT_SET, fm.FindMax(&fm, &key, nullptr, FALSE));
+            Assert::AreEqual(E_NOT_SET, fm.FindFloor(&fm, (PCVOID)0, sizeof(int), &key, nullptr, FALSE));
+            Assert::AreEqual(E_NOT_SET, fm.FindCeil(&fm, (PCVOID)0, sizeof(int), &key, nullptr, FALSE));
+
+            std::map<int, int> expected;
+            int minKey = keysVec[0];
+            int maxKey = keysVec[0];
+            for (int i = 0; i < c_nRandomItems; ++i)
+            {
+                Assert::AreEqual(S_OK, fm.Insert(&fm, (PCVOID)keysVec[i], sizeof(int), (PCVOID)i, sizeof(i)));
+                expected[keysVec[i]] = i;
+                minKey = min(minKey, keysVec[i]);
+                maxKey = max(maxKey, keysVec[i]);
+            }
+
+            VerifyAgainstMap(&fm, expected, minKey, maxKey);
+
+            // Remove half the keys and verify again
+            for (int i = 0; i < c_nRandomItems; i += 2)
+            {
+                fm.Remove(&fm, (PCVOID)keysVec[i], sizeof(int));
+                expected.erase(keysVec[i]);
+            }
+
+            VerifyAgainstMap(&fm, expected, minKey, maxKey);
+
+            Assert::AreEqual(S_OK, fm.Destroy(&fm));
+        }
+    }
+
+    LOG_FUNC_EXIT;
+}
+
+void FlatMapUnitTests::InsertBatch_Ints()
+{
+    LOG_FUNC_ENTRY;
+
+    const int c_nBatches = 10;
+    const int c_nBatchItems = 200;
+    DWORD aFlags[] = { 0, CHL_FM_FLAG_EYTZINGER };
+
+    for (auto dwFlags : aFlags)
+    {
+        logInfo(L"Flags: 0x%08x", dwFlags);
+
+        CHL_FLATMAP fm;
+        Assert::AreEqual(S_OK, CHL_DsCreateExFM(&fm, CHL_KT_INT32, CHL_VT_INT32, nullptr, FALSE, dwFlags));
+
+        Assert::AreEqual(S_OK, fm.InsertBatch(&fm, nullptr, nullptr, nullptr, nullptr, 0));
+        Assert::AreEqual(0U, fm.nEntries);
+
+        // Batches of random keys, with keys repeated within a batch and across batches.
+        // Of equal keys, the one that comes last in a batch is kept.
+        std::map<int, int> expected;
+        int minKey = MAXINT;
+        int maxKey = -MAXINT;
+        for (int batch = 0; batch < c_nBatches; ++batch)
+        {
+            auto spRandomKeys = Helpers::GenerateRandomNumbers(c_nBatchItems);
+            auto& keysVec = *spRandomKeys;
+
+            std::vector<int> valsVec(c_nBatchItems);
+            for (int i = 0; i < c_nBatchItems; ++i)
+            {
+                keysVec[i] %= 1000;
+                valsVec[i] = (batch * c_nBatchItems) + i;
+
+                expected[keysVec[i]] = valsVec[i];
+                minKey = min(minKey, keysVec[i]);
+                maxKey = max(maxKey, keysVec[i]);
+            }
+
+            Assert::AreEqual(S_OK, fm.InsertBatch(&fm, keysVec.data(), nullptr, valsVec.data(), nullptr, c_nBatchItems));
+            Assert::AreEqual((UINT)expected.size(), fm.nEntries);
+        }
+
+        VerifyAgainstMap(&fm, expected, minKey, maxKey);
+
+        Assert::AreEqual(S_OK, fm.Destroy(&fm));
+    }
+
+    LOG_FUNC_EXIT;
+}
+
+void FlatMapUnitTests::InsertBatch_HeapVals()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_FLATMAP fm;
+    Assert::AreEqual(S_OK, CHL_DsCreateFM(&fm, CHL_KT_INT32, CHL_VT_POINTER, nullptr, TRUE));
+
+    PVOID apvVals[5];
+    for (int i = 0; i < ARRAYSIZE(apvVals); ++i)
+    {
+        Assert::IsTrue(SUCCEEDED(CHL_MmAlloc(&apvVals[i], sizeof(int), NULL)));
+        *(int*)apvVals[i] = i;
+    }
+
+    // The same value passed twice for a dropped key is freed once, and a value that is kept is not freed
+    int aKeys[] = { 1, 1, 1, 2, 3, 3 };
+    PVOID apvBatch[] = { apvVals[0], apvVals[0], apvVals[1], apvVals[2], apvVals[3], apvVals[3] };
+    Assert::AreEqual(S_OK, fm.InsertBatch(&fm, aKeys, nullptr, apvBatch, nullptr, ARRAYSIZE(aKeys)));
+    Assert::AreEqual(3U, fm.nEntries);
+
+    // Replacing the value of a key frees the one in the map, unless it is passed again
+    int aKeys2[] = { 2, 2, 3 };
+    PVOID apvBatch2[] = { apvVals[4], apvVals[4], apvVals[3] };
+    Assert::AreEqual(S_OK, fm.InsertBatch(&fm, aKeys2, nullptr, apvBatch2, nullptr, ARRAYSIZE(aKeys2)));
+    Assert::AreEqual(3U, fm.nEntries);
+
+    int aExpected[] = { 1, 4, 3 };
+    for (int key = 1; key <= 3; ++key)
+    {
+        PVOID pv;
+        Assert::AreEqual(S_OK, fm.Find(&fm, (PCVOID)key, sizeof(int), &pv, nullptr, TRUE));
+        Assert::AreEqual(aExpected[key - 1], *(int*)pv);
+    }
+
+    Assert::AreEqual(S_OK, fm.Destroy(&fm));
+
+    // A NULL string key fails the whole batch before anything is compared or copied
+    Assert::AreEqual(S_OK, CHL_DsCreateFM(&fm, CHL_KT_WSTRING, CHL_VT_INT32, Helpers::CompareFn_WString, FALSE));
+    PCWSTR apszKeys[] = { L"one", nullptr, L"two" };
+    int aVals[] = { 1, 2, 3 };
+    Assert::AreEqual(E_INVALIDARG, fm.InsertBatch(&fm, apszKeys, nullptr, aVals, nullptr, ARRAYSIZE(apszKeys)));
+    Assert::AreEqual(0U, fm.nEntries);
+    Assert::AreEqual(S_OK, fm.Destroy(&fm));
+
+    LOG_FUNC_EXIT;
+}
+
+void FlatMapUnitTests::InsertFindGetAt_WStrInt()
+{
+    LOG_FUNC_ENTRY;
+
+    const int c_nItems = 100;
+    auto spRandomStrings = Helpers::GenerateRandomStrings(c_nItems, L"abcdefghijklmnopqrstuvwxyz");
+    auto& stringsVec = *spRandomStrings;
+
+    DWORD aFlags[] = { 0, CHL_FM_FLAG_EYTZINGER };
+
+    for (auto dwFlags : aFlags)
+    {
+        logInfo(L"Flags: 0x%08x", dwFlags);
+
+        CHL_FLATMAP fm;
+        Assert::AreEqual(S_OK, CHL_DsCreateExFM(&fm, CHL_KT_WSTRING, CHL_VT_INT32, Helpers::CompareFn_WString, FALSE, dwFlags));
+
+        // Half the strings one by one, the other half as a batch
+        std::map<std::wstring, int> expected;
+        for (int i = 0; i < c_nItems / 2; ++i)
+        {
+            Assert::AreEqual(S_OK, fm.Insert(&fm, stringsVec[i].c_str(), 0, (PCVOID)i, sizeof(i)));
+            expected[stringsVec[i]] = i;
+        }
+
+        std::vector<PCWSTR> keysVec;
+        std::vector<int> valsVec;
+        for (int i = c_nItems / 2; i < c_nItems; ++i)
+        {
+            keysVec.push_back(stringsVec[i].c_str());
+            valsVec.push_back(i);
+            expected[stringsVec[i]] = i;
+        }
+
+        Assert::AreEqual(S_OK, fm.InsertBatch(&fm, keysVec.data(), nullptr, valsVec.data(), nullptr, (UINT)keysVec.size()));
+        Assert::AreEqual((UINT)expected.size(), fm.nEntries);
+
+        for (auto& entry : expected)
+        {
+            int val;
+            Assert::AreEqual(S_OK, fm.Find(&fm, entry.first.c_str(), 0, &val, nullptr, FALSE));
+            Assert::AreEqual(entry.second, val);
+        }
+
+        // The entries are in the order of the compare function
+        UINT index = 0;
+        for (auto& entry : expected)
+        {
+            PWSTR pszKey;
+            int val;
+            Assert::AreEqual(S_OK, fm.GetAt(&fm, index, &pszKey, nullptr, &val, nullptr, TRUE));
+            Assert::AreEqual(entry.first.c_str(), pszKey);
+            Assert::AreEqual(entry.second, val);
+            ++index;
+        }
+
+        Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_INVALID_INDEX), fm.GetAt(&fm, index, nullptr, nullptr, nullptr, nullptr, TRUE));
+
+        Assert::AreEqual(S_OK, fm.Destroy(&fm));
+    }
+
+    LOG_FUNC_EXIT;
+}
+
+void FlatMapUnitTests::VerifyAgainstMap(_In_ PCHL_FLATMAP pfm, _In_ const std::map<int, int>& expected, _In_ int minKey, _In_ int maxKey)
+{
+    Assert::AreEqual((UINT)expected.size(), pfm->nEntries);
+
+    int key, val;
+    Assert::AreEqual(S_OK, pfm->FindMin(pfm, &key, nullptr, FALSE));
+    Assert::AreEqual(expected.cbegin()->first, key, L"Expected min key");
+    Assert::AreEqual(S_OK, pfm->FindMax(pfm, &key, nullptr, FALSE));
+    Assert::AreEqual(expected.crbegin()->first, key, L"Expected max key");
+
+    for (int searchKey = minKey - 1; searchKey <= maxKey + 1; ++searchKey)
+    {
+        // Floor is the largest key less than or equal to the search key, ceil is the smallest key
+        // greater than or equal to it
+        auto itrCeil = expected.lower_bound(searchKey);
+        auto itrFloor = expected.upper_bound(searchKey);
+
+        if (itrFloor == expected.cbegin())
+        {
+            Assert::AreEqual(E_NOT_SET, pfm->FindFloor(pfm, (PCVOID)searchKey, sizeof(int), &key, nullptr, FALSE));
+        }
+        else
+        {
+            --itrFloor;
+            Assert::AreEqual(S_OK, pfm->FindFloor(pfm, (PCVOID)searchKey, sizeof(int), &key, nullptr, FALSE));
+            Assert::AreEqual(itrFloor->first, key, L"Expected floor key");
+        }
+
+        if (itrCeil == expected.cend())
+        {
+            Assert::AreEqual(E_NOT_SET, pfm->FindCeil(pfm, (PCVOID)searchKey, sizeof(int), &key, nullptr, FALSE));
+        }
+        else
+        {
+            Assert::AreEqual(S_OK, pfm->FindCeil(pfm, (PCVOID)searchKey, sizeof(int), &key, nullptr, FALSE));
+            Assert::AreEqual(itrCeil->first, key, L"Expected ceil key");
+        }
+
+        HRESULT hr = pfm->Find(pfm, (PCVOID)searchKey, sizeof(int), &val, nullptr, FALSE);
+        if (itrCeil != expected.cend() && itrCeil->first == searchKey)
+        {
+            Assert::AreEqual(S_OK, hr);
+            Assert::AreEqual(itrCeil->second, val);
+        }
+        else
+        {
+            Assert::AreEqual(E_NOT_SET, hr);
+        }
+    }
+}
+
+}
@@ -0,0 +1,403 @@
+
+#include "stdafx.h"
+#include "Hashtable.h"
+#include "HashtableImage.h"
+
+#include "CppUnitTest.h"
+#include "Helpers.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+TEST_CLASS(HashtableImageUnitTests)
+{
+public:
+    TEST_METHOD(SaveOpenFind_IntInt);
+    TEST_METHOD(SaveOpenFind_StrWStr);
+    TEST_METHOD(SaveOpenFind_WStrUserObj);
+    TEST_METHOD(UnsupportedTypes);
+    TEST_METHOD(UnsupportedMultimap);
+    TEST_METHOD(InvalidImages);
+    TEST_METHOD(Freeze_PointerKeys);
+    TEST_METHOD(Freeze_IterateWriteOpen);
+
+private:
+    static const WCHAR s_szImageFile[];
+};
+
+const WCHAR HashtableImageUnitTests::s_szImageFile[] = L"htimage.tmp";
+
+void HashtableImageUnitTests::SaveOpenFind_IntInt()
+{
+    const int nEntries = 50000;
+
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE)));
+
+    // An empty table gives an empty image
+    PCHL_HT_IMAGE pImage;
+    int val;
+    Assert::AreEqual(S_OK, CHL_DsSaveImageHT(phtable, s_szImageFile));
+    Assert::AreEqual(S_OK, CHL_DsOpenImageHT(&pImage, s_szImageFile));
+    Assert::AreEqual(0, pImage->nEntries);
+    Assert::AreEqual(E_NOT_SET, pImage->Find(pImage, (PCVOID)5, 0, &val, nullptr, FALSE));
+    Assert::AreEqual(S_OK, pImage->Close(pImage));
+
+    for (int i = -500; i < nEntries; ++i)
+    {
+        Assert::IsTrue(SUCCEEDED(phtable->Insert(phtable, (PCVOID)i, 0, (PCVOID)(i * 3), sizeof(int))));
+    }
+
+    Assert::AreEqual(S_OK, CHL_DsSaveImageHT(phtable, s_szImageFile));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+
+    Assert::AreEqual(S_OK, CHL_DsOpenImageHT(&pImage, s_szImageFile));
+    Assert::AreEqual(nEntries + 500, pImage->nEntries);
+    Assert::AreEqual((int)CHL_KT_INT32, (int)pImage->keyType);
+    Assert::AreEqual((int)CHL_VT_INT32, (int)pImage->valType);
+
+    for (int i = -500; i < nEntries; ++i)
+    {
+        int valSize = 0;
+        Assert::AreEqual(S_OK, pImage->Find(pImage, (PCVOID)i, 0, &val, &valSize, FALSE));
+        Assert::AreEqual(i * 3, val);
+        Assert::AreEqual((int)sizeof(int), valSize);
+    }
+
+    int valSize = -1;
+    Assert::AreEqual(E_NOT_SET, pImage->Find(pImage, (PCVOID)nEntries, 0, &val, &valSize, FALSE));
+    Assert::AreEqual(0, valSize, L"Value size is zero when the key is not found");
+
+    Assert::AreEqual(S_OK, pImage->Close(pImage));
+    Assert::IsTrue(DeleteFile(s_szImageFile));
+}
+
+void HashtableImageUnitTests::SaveOpenFind_StrWStr()
+{
+    const int nEntries = 3000;
+
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&phtable, 10, CHL_KT_STRING, CHL_VT_WSTRING, FALSE, CHL_HT_FLAG_COMPACT)));
+
+    for (int i = 0; i < nEntries; ++i)
+    {
+        char szKey[32];
+        WCHAR szVal[32];
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", i)));
+        Assert::IsTrue(SUCCEEDED(StringCchPrintf(szVal, ARRAYSIZE(szVal), L"value-%d", i)));
+        Assert::IsTrue(SUCCEEDED(phtable->Insert(phtable, szKey, 0, szVal, 0)));
+    }
+
+    Assert::AreEqual(S_OK, CHL_DsSaveImageHT(phtable, s_szImageFile));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+
+    PCHL_HT_IMAGE pImage;
+    Assert::AreEqual(S_OK, CHL_DsOpenImageHT(&pImage, s_szImageFile));
+    Assert::AreEqual(nEntries, pImage->nEntries);
+
+    for (int i = 0; i < nEntries; ++i)
+    {
+        char szKey[32];
+        WCHAR szExpected[32];
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", i)));
+        Assert::IsTrue(SUCCEEDED(StringCchPrintf(szExpected, ARRAYSIZE(szExpected), L"value-%d", i)));
+        int cbExpected = (int)((wcslen(szExpected) + 1) * sizeof(WCHAR));
+
+        // Pointer into the mapped image
+        PCWSTR pszVal;
+        int valSize;
+        Assert::AreEqual(S_OK, pImage->Find(pImage, szKey, 0, &pszVal, &valSize, TRUE));
+        Assert::AreEqual(szExpected, pszVal);
+        Assert::AreEqual(cbExpected, valSize);
+
+        // Key size without the terminator finds the same key
+        Assert::AreEqual(S_OK, pImage->Find(pImage, szKey, (int)strlen(szKey), nullptr, &valSize, FALSE));
+        Assert::AreEqual(cbExpected, valSize);
+
+        // Copy into a caller buffer
+        WCHAR szVal[32];
+        valSize = sizeof(WCHAR);
+        Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER), pImage->Find(pImage, szKey, 0, szVal, &valSize, FALSE));
+        Assert::AreEqual(cbExpected, valSize, L"Required size is returned");
+
+        valSize = sizeof(szVal);
+        Assert::AreEqual(S_OK, pImage->Find(pImage, szKey, 0, szVal, &valSize, FALSE));
+        Assert::AreEqual(szExpected, (PCWSTR)szVal);
+    }
+
+    Assert::AreEqual(E_NOT_SET, pImage->Find(pImage, "nokey", 0, nullptr, nullptr, FALSE));
+
+    Assert::AreEqual(S_OK, pImage->Close(pImage));
+    Assert::IsTrue(DeleteFile(s_szImageFile));
+}
+
+void HashtableImageUnitTests::SaveOpenFind_WStrUserObj()
+{
+    struct TestObj
+    {
+        int iIndex;
+        double dHalf;
+    };
+
+    const int nEntries = 1000;
+
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_WSTRING, CHL_VT_USEROBJECT, FALSE)));
+
+    for (int i = 0; i < nEntries; ++i)
+    {
+        WCHAR szKey[32];
+        TestObj obj = { i, i / 2.0 };
+        Assert::IsTrue(SUCCEEDED(StringCchPrintf(szKey, ARRAYSIZE(szKey), L"w%d", i)));
+        Assert::IsTrue(SUCCEEDED(phtable->Insert(phtable, szKey, 0, &obj, sizeof(obj))));
+    }
+
+    Assert::AreEqual(S_OK, CHL_DsSaveImageHT(phtable, s_szImageFile));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+
+    // Two images of the same file can be open at once
+    PCHL_HT_IMAGE pImage1;
+    PCHL_HT_IMAGE pImage2;
+    Assert::AreEqual(S_OK, CHL_DsOpenImageHT(&pImage1, s_szImageFile));
+    Assert::AreEqual(S_OK, CHL_DsOpenImageHT(&pImage2, s_szImageFile));
+
+    for (int i = 0; i < nEntries; ++i)
+    {
+        WCHAR szKey[32];
+        Assert::IsTrue(SUCCEEDED(StringCchPrintf(szKey, ARRAYSIZE(szKey), L"w%d", i)));
+
+        TestObj *pObj;
+        int valSize;
+        Assert::AreEqual(S_OK, pImage1->Find(pImage1, szKey, 0, &pObj, &valSize, TRUE));
+        Assert::AreEqual((int)sizeof(TestObj), valSize);
+        Assert::AreEqual(i, pObj->iIndex);
+        Assert::AreEqual(i / 2.0, pObj->dHalf);
+        Assert::IsTrue(((UINT_PTR)pObj % sizeof(double)) == 0, L"User objects in the image are aligned");
+
+        TestObj obj;
+        valSize = sizeof(obj);
+        Assert::AreEqual(S_OK, pImage2->Find(pImage2, szKey, 0, &obj, &valSize, FALSE));
+        Assert::AreEqual(i, obj.iIndex);
+    }
+
+    Assert::AreEqual(S_OK, pImage1->Close(pImage1));
+    Assert::AreEqual(S_OK, pImage2->Close(pImage2));
+    Assert::IsTrue(DeleteFile(s_szImageFile));
+}
+
+void HashtableImageUnitTests::UnsupportedTypes()
+{
+    PCHL_HTABLE phtable;
+
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_POINTER, CHL_VT_INT32, FALSE)));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), CHL_DsSaveImageHT(phtable, s_szImageFile));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_INT32, CHL_VT_POINTER, FALSE)));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), CHL_DsSaveImageHT(phtable, s_szImageFile));
+
+    // Pointer types can be frozen, but the frozen image cannot be written either
+    PCHL_HT_IMAGE pImage;
+    Assert::AreEqual(S_OK, CHL_DsFreezeHT(phtable, &pImage));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), CHL_DsWriteImageHT(pImage, s_szImageFile));
+    Assert::AreEqual(S_OK, pImage->Close(pImage));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+
+    Assert::IsFalse(PathFileExists(s_szImageFile), L"No image is written for unsupported types");
+}
+
+void HashtableImageUnitTests::UnsupportedMultimap()
+{
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateExHT(&phtable, 10, CHL_KT_INT32, CHL_VT_INT32, FALSE, CHL_HT_FLAG_MULTIMAP)));
+
+    // An image could only hold the first value of each key
+    for (int idx = 0; idx < 100; ++idx)
+    {
+        Assert::AreEqual(S_OK, phtable->Insert(phtable, (PVOID)idx, 0, (PVOID)idx, 0));
+        Assert::AreEqual(S_OK, phtable->Insert(phtable, (PVOID)idx, 0, (PVOID)(idx + 1), 0));
+    }
+
+    PCHL_HT_IMAGE pImage = (PCHL_HT_IMAGE)1;
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), CHL_DsFreezeHT(phtable, &pImage));
+    Assert::IsNull(pImage);
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), CHL_DsSaveImageHT(phtable, s_szImageFile));
+    Assert::IsFalse(PathFileExists(s_szImageFile), L"No image is written for a multimap");
+
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+}
+
+void HashtableImageUnitTests::InvalidImages()
+{
+    PCHL_HT_IMAGE pImage;
+    HANDLE hFile;
+    DWORD cbWritten;
+
+    Assert::IsTrue(FAILED(CHL_DsOpenImageHT(&pImage, L"nonexistent_htimage.tmp")));
+
+    // Empty file
+    hFile = CreateFile(s_szImageFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+    CloseHandle(hFile);
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_BAD_FORMAT), CHL_DsOpenImageHT(&pImage, s_szImageFile));
+
+    // Not an image
+    BYTE abGarbage[128];
+    memset(abGarbage, 0xA5, sizeof(abGarbage));
+    hFile = CreateFile(s_szImageFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+    Assert::IsTrue(WriteFile(hFile, abGarbage, sizeof(abGarbage), &cbWritten, NULL));
+    CloseHandle(hFile);
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_BAD_FORMAT), CHL_DsOpenImageHT(&pImage, s_szImageFile));
+
+    // Truncated image
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_STRING, CHL_VT_INT32, FALSE)));
+    Assert::IsTrue(SUCCEEDED(phtable->Insert(phtable, "one", 0, (PCVOID)1, sizeof(int))));
+    Assert::AreEqual(S_OK, CHL_DsSaveImageHT(phtable, s_szImageFile));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+
+    LARGE_INTEGER liSize;
+    hFile = CreateFile(s_szImageFile, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    Assert::IsTrue(hFile != INVALID_HANDLE_VALUE);
+    Assert::IsTrue(GetFileSizeEx(hFile, &liSize));
+    --liSize.QuadPart;
+    Assert::IsTrue(SetFilePointerEx(hFile, liSize, NULL, FILE_BEGIN));
+    Assert::IsTrue(SetEndOfFile(hFile));
+    CloseHandle(hFile);
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_BAD_FORMAT), CHL_DsOpenImageHT(&pImage, s_szImageFile));
+
+    Assert::IsTrue(DeleteFile(s_szImageFile));
+}
+
+void HashtableImageUnitTests::Freeze_PointerKeys()
+{
+    const int nEntries = 5000;
+    static int s_aiObjects[nEntries];
+
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_POINTER, CHL_VT_INT32, FALSE)));
+    for (int i = 0; i < nEntries; ++i)
+    {
+        Assert::IsTrue(SUCCEEDED(phtable->Insert(phtable, &s_aiObjects[i], sizeof(PVOID), (PCVOID)i, sizeof(int))));
+    }
+
+    // The image does not depend on the table
+    PCHL_HT_IMAGE pImage;
+    Assert::AreEqual(S_OK, CHL_DsFreezeHT(phtable, &pImage));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+    Assert::AreEqual(nEntries, pImage->nEntries);
+    Assert::IsFalse(pImage->fMapped);
+
+    for (int i = 0; i < nEntries; ++i)
+    {
+        int val;
+        Assert::AreEqual(S_OK, pImage->Find(pImage, &s_aiObjects[i], sizeof(PVOID), &val, nullptr, FALSE));
+        Assert::AreEqual(i, val);
+    }
+
+    int iNotInserted;
+    Assert::AreEqual(E_NOT_SET, pImage->Find(pImage, &iNotInserted, sizeof(PVOID), nullptr, nullptr, FALSE));
+
+    // Every key is visited exactly once
+    CHL_HT_IMAGE_ITERATOR itr;
+    int nFound = 0;
+    UINT64 ullSum = 0;
+    HRESULT hr;
+    for (hr = pImage->InitIterator(pImage, &itr); SUCCEEDED(hr); hr = itr.MoveNext(&itr))
+    {
+        int *pKey;
+        int val;
+        Assert::AreEqual(S_OK, itr.GetCurrent(&itr, &pKey, nullptr, &val, nullptr, TRUE));
+        Assert::IsTrue(pKey == &s_aiObjects[val]);
+        ullSum += val;
+        ++nFound;
+    }
+    Assert::AreEqual(E_NOT_SET, hr);
+    Assert::AreEqual(nEntries, nFound);
+    Assert::AreEqual((UINT64)nEntries * (nEntries - 1) / 2, ullSum);
+
+    Assert::AreEqual(S_OK, pImage->Close(pImage));
+}
+
+void HashtableImageUnitTests::Freeze_IterateWriteOpen()
+{
+    const int nEntries = 20000;
+
+    PCHL_HTABLE phtable;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateHT(&phtable, 10, CHL_KT_STRING, CHL_VT_WSTRING, FALSE)));
+
+    // An empty table gives an empty image
+    PCHL_HT_IMAGE pImage;
+    CHL_HT_IMAGE_ITERATOR itr;
+    Assert::AreEqual(S_OK, CHL_DsFreezeHT(phtable, &pImage));
+    Assert::AreEqual(E_NOT_SET, pImage->InitIterator(pImage, &itr));
+    Assert::AreEqual(E_NOT_SET, pImage->Find(pImage, "k0", 0, nullptr, nullptr, FALSE));
+    Assert::AreEqual(S_OK, pImage->Close(pImage));
+
+    for (int i = 0; i < nEntries; ++i)
+    {
+        char szKey[32];
+        WCHAR szVal[32];
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "k%d", i)));
+        Assert::IsTrue(SUCCEEDED(StringCchPrintf(szVal, ARRAYSIZE(szVal), L"v%d", i)));
+        Assert::IsTrue(SUCCEEDED(phtable->Insert(phtable, szKey, 0, szVal, 0)));
+    }
+
+    Assert::AreEqual(S_OK, CHL_DsFreezeHT(phtable, &pImage));
+    Assert::IsTrue(SUCCEEDED(phtable->Destroy(phtable)));
+
+    // Keys match only in full, a prefix of a key is a different key
+    PCWSTR pszVal;
+    Assert::AreEqual(E_NOT_SET, pImage->Find(pImage, "k", 0, nullptr, nullptr, FALSE));
+    Assert::AreEqual(S_OK, pImage->Find(pImage, "k10", 2, &pszVal, nullptr, TRUE));
+    Assert::AreEqual(L"v1", pszVal);
+    Assert::AreEqual(E_NOT_SET, pImage->Find(pImage, "k20000", 0, nullptr, nullptr, FALSE));
+
+    int nFound = 0;
+    HRESULT hr;
+    for (hr = pImage->InitIterator(pImage, &itr); SUCCEEDED(hr); hr = itr.MoveNext(&itr))
+    {
+        char szKey[32];
+        WCHAR szVal[32];
+        WCHAR szExpected[32];
+        int keySize = sizeof(szKey);
+        int valSize = sizeof(szVal);
+        Assert::AreEqual(S_OK, itr.GetCurrent(&itr, szKey, &keySize, szVal, &valSize, FALSE));
+        Assert::AreEqual((int)strlen(szKey) + 1, keySize);
+
+        Assert::IsTrue(SUCCEEDED(StringCchPrintf(szExpected, ARRAYSIZE(szExpected), L"v%S", szKey + 1)));
+        Assert::AreEqual((PCWSTR)szExpected, (PCWSTR)szVal);
+        Assert::AreEqual((int)((wcslen(szExpected) + 1) * sizeof(WCHAR)), valSize);
+
+        keySize = 1;
+        Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER), itr.GetCurrent(&itr, szKey, &keySize, nullptr, nullptr, FALSE));
+        ++nFound;
+    }
+    Assert::AreEqual(E_NOT_SET, hr);
+    Assert::AreEqual(nEntries, nFound);
+
+    // A frozen image written to a file opens as the same image
+    PCHL_HT_IMAGE pOpened;
+    Assert::AreEqual(S_OK, CHL_DsWriteImageHT(pImage, s_szImageFile));
+    Assert::AreEqual(S_OK, CHL_DsOpenImageHT(&pOpened, s_szImageFile));
+    Assert::AreEqual(nEntries, pOpened->nEntries);
+    Assert::IsTrue(pOpened->fMapped);
+
+    for (int i = 0; i < nEntries; ++i)
+    {
+        char szKey[32];
+        WCHAR szExpected[32];
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "k%d", i)));
+        Assert::IsTrue(SUCCEEDED(StringCchPrintf(szExpected, ARRAYSIZE(szExpected), L"v%d", i)));
+        Assert::AreEqual(S_OK, pOpened->Find(pOpened, szKey, 0, &pszVal, nullptr, TRUE));
+        Assert::AreEqual((PCWSTR)szExpected, pszVal);
+    }
+
+    Assert::AreEqual(S_OK, pOpened->Close(pOpened));
+    Assert::AreEqual(S_OK, pImage->Close(pImage));
+    Assert::IsTrue(DeleteFile(s_szImageFile));
+}
+
+}
@@ -0,0 +1,303 @@
+
+#include "stdafx.h"
+#include "IntHashtable.h"
+
+#include "CppUnitTest.h"
+#include "Helpers.h"
+
+using namespace std;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+TEST_CLASS(IntHashtableUnitTests)
+{
+public:
+    TEST_METHOD(CreateAndDestroy);
+    TEST_METHOD(InsertFindRemove_Int);
+    TEST_METHOD(InsertFindRemove_Pointer);
+    TEST_METHOD(ZeroKey);
+    TEST_METHOD(GrowAndChurn);
+    TEST_METHOD(Iteration);
+    TEST_METHOD(HeapValues);
+};
+
+void IntHashtableUnitTests::CreateAndDestroy()
+{
+    static int s_tableSizes[] = { 0, 1, 12, 13, 9999, 354972 };
+
+    for (int idx = 0; idx < ARRAYSIZE(s_tableSizes); ++idx)
+    {
+        PCHL_IHTABLE piht;
+        Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, s_tableSizes[idx], FALSE)));
+        Assert::IsTrue((piht->nCapacity & (piht->nCapacity - 1)) == 0, L"Capacity is a power of 2");
+        Assert::IsTrue(piht->nMaxEntries >= (UINT)s_tableSizes[idx], L"Estimated entries fit without a rehash");
+        Assert::AreEqual(0U, piht->nEntries);
+        Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)), L"Destroying empty hashtable succeeds");
+    }
+
+    PCHL_IHTABLE piht;
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateIHT(&piht, -1, FALSE));
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateIHT(nullptr, 10, FALSE));
+}
+
+void IntHashtableUnitTests::InsertFindRemove_Int()
+{
+    static int s_keys[] = { 1, -1, 2, MAXINT32 - 1, MAXINT32, MININT32 };
+    static UINT s_values[] = { 0, 1, 2, MAXUINT32 - 1, MAXUINT32, 7 };
+    static_assert(ARRAYSIZE(s_keys) == ARRAYSIZE(s_values), "#keys is equal to #values");
+
+    PCHL_IHTABLE piht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, 10, FALSE)));
+
+    for (int idx = 0; idx < ARRAYSIZE(s_keys); ++idx)
+    {
+        Assert::AreEqual(S_OK, piht->Insert(piht, (UINT)s_keys[idx], s_values[idx]));
+    }
+    Assert::AreEqual((UINT)ARRAYSIZE(s_keys), piht->nEntries);
+
+    for (int idx = 0; idx < ARRAYSIZE(s_keys); ++idx)
+    {
+        UINT_PTR val;
+        Assert::AreEqual(S_OK, piht->Find(piht, (UINT)s_keys[idx], &val));
+        Assert::AreEqual(s_values[idx], (UINT)val, L"Retrieved value must match expected value");
+    }
+
+    // Inserting an existing key overwrites its value
+    UINT_PTR val;
+    Assert::AreEqual(S_OK, piht->Insert(piht, (UINT)s_keys[0], 1234));
+    Assert::AreEqual(S_OK, piht->Find(piht, (UINT)s_keys[0], &val));
+    Assert::AreEqual((UINT_PTR)1234, val);
+    Assert::AreEqual((UINT)ARRAYSIZE(s_keys), piht->nEntries);
+
+    for (int idx = 0; idx < ARRAYSIZE(s_keys); ++idx)
+    {
+        Assert::AreEqual(S_OK, piht->Remove(piht, (UINT)s_keys[idx]));
+        Assert::AreEqual(E_NOT_SET, piht->Find(piht, (UINT)s_keys[idx], &val));
+        Assert::AreEqual(E_NOT_SET, piht->Remove(piht, (UINT)s_keys[idx]));
+    }
+    Assert::AreEqual(0U, piht->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)));
+}
+
+void IntHashtableUnitTests::InsertFindRemove_Pointer()
+{
+    const int nObjects = 5000;
+
+    // Heap pointers are 8 or 16 byte aligned, their low bits are all the same
+    vector<PVOID> objects(nObjects);
+    for (int idx = 0; idx < nObjects; ++idx)
+    {
+        objects[idx] = malloc(24);
+        Assert::IsNotNull(objects[idx]);
+    }
+
+    PCHL_IHTABLE piht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, 0, FALSE)));
+
+    for (int idx = 0; idx < nObjects; ++idx)
+    {
+        Assert::AreEqual(S_OK, piht->Insert(piht, (UINT_PTR)objects[idx], (UINT_PTR)idx));
+    }
+    Assert::AreEqual((UINT)nObjects, piht->nEntries);
+
+    for (int idx = 0; idx < nObjects; ++idx)
+    {
+        UINT_PTR val;
+        Assert::AreEqual(S_OK, piht->Find(piht, (UINT_PTR)objects[idx], &val));
+        Assert::AreEqual((UINT_PTR)idx, val);
+    }
+
+    // Remove every other pointer, the rest must still be found after entries shift back
+    for (int idx = 0; idx < nObjects; idx += 2)
+    {
+        Assert::AreEqual(S_OK, piht->Remove(piht, (UINT_PTR)objects[idx]));
+    }
+
+    for (int idx = 0; idx < nObjects; ++idx)
+    {
+        UINT_PTR val;
+        HRESULT hr = piht->Find(piht, (UINT_PTR)objects[idx], &val);
+        if (idx % 2 == 0)
+        {
+            Assert::AreEqual(E_NOT_SET, hr);
+        }
+        else
+        {
+            Assert::AreEqual(S_OK, hr);
+            Assert::AreEqual((UINT_PTR)idx, val);
+        }
+    }
+
+    Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)));
+    for (auto pv : objects)
+    {
+        free(pv);
+    }
+}
+
+void IntHashtableUnitTests::ZeroKey()
+{
+    PCHL_IHTABLE piht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, 10, FALSE)));
+
+    UINT_PTR val;
+    Assert::AreEqual(E_NOT_SET, piht->Find(piht, 0, &val));
+    Assert::AreEqual(E_NOT_SET, piht->Remove(piht, 0));
+
+    Assert::AreEqual(S_OK, piht->Insert(piht, 0, 42));
+    Assert::AreEqual(S_OK, piht->Insert(piht, 1, 43));
+    Assert::AreEqual(2U, piht->nEntries);
+    Assert::AreEqual(S_OK, piht->Find(piht, 0, &val));
+    Assert::AreEqual((UINT_PTR)42, val);
+
+    Assert::AreEqual(S_OK, piht->Insert(piht, 0, 44));
+    Assert::AreEqual(2U, piht->nEntries);
+    Assert::AreEqual(S_OK, piht->Find(piht, 0, &val));
+    Assert::AreEqual((UINT_PTR)44, val);
+
+    Assert::AreEqual(S_OK, piht->Remove(piht, 0));
+    Assert::AreEqual(E_NOT_SET, piht->Find(piht, 0, &val));
+    Assert::AreEqual(S_OK, piht->Find(piht, 1, &val));
+    Assert::AreEqual(1U, piht->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)));
+}
+
+void IntHashtableUnitTests::GrowAndChurn()
+{
+    const int nKeys = 20000;
+    const int nOps = 400000;
+
+    PCHL_IHTABLE piht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, 0, FALSE)));
+
+    // Model of what the table must contain, -1 when a key is absent
+    vector<int> model(nKeys, -1);
+    int nPresent = 0;
+
+    srand(11);
+    for (int op = 0; op < nOps; ++op)
+    {
+        int key = (rand() * (RAND_MAX + 1) + rand()) % nKeys;
+        UINT_PTR val;
+
+        switch (rand() % 3)
+        {
+        case 0:
+            if (model[key] < 0)
+            {
+                ++nPresent;
+            }
+            model[key] = op;
+            Assert::AreEqual(S_OK, piht->Insert(piht, (UINT_PTR)key * 8, (UINT_PTR)op));
+            break;
+
+        case 1:
+            Assert::AreEqual((model[key] >= 0) ? S_OK : E_NOT_SET, piht->Remove(piht, (UINT_PTR)key * 8));
+            if (model[key] >= 0)
+            {
+                --nPresent;
+            }
+            model[key] = -1;
+            break;
+
+        default:
+            if (model[key] >= 0)
+            {
+                Assert::AreEqual(S_OK, piht->Find(piht, (UINT_PTR)key * 8, &val));
+                Assert::AreEqual((UINT_PTR)model[key], val);
+            }
+            else
+            {
+                Assert::AreEqual(E_NOT_SET, piht->Find(piht, (UINT_PTR)key * 8, &val));
+            }
+            break;
+        }
+    }
+
+    Assert::AreEqual((UINT)nPresent, piht->nEntries);
+    Assert::IsTrue(piht->nEntries <= piht->nMaxEntries + 1, L"Table stays within its max load");
+
+    Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)));
+}
+
+void IntHashtableUnitTests::Iteration()
+{
+    const int nKeys = 1000;
+
+    PCHL_IHTABLE piht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, 0, FALSE)));
+
+    CHL_IHT_ITERATOR itr;
+    Assert::AreEqual(E_NOT_SET, piht->InitIterator(piht, &itr), L"Empty table has nothing to iterate");
+
+    for (int key = 0; key < nKeys; ++key)
+    {
+        Assert::AreEqual(S_OK, piht->Insert(piht, (UINT_PTR)key, (UINT_PTR)(key * 2)));
+    }
+
+    vector<bool> seen(nKeys, false);
+    int nFound = 0;
+    for (HRESULT hr = piht->InitIterator(piht, &itr); SUCCEEDED(hr); hr = itr.MoveNext(&itr))
+    {
+        UINT_PTR key;
+        UINT_PTR val;
+        Assert::AreEqual(S_OK, itr.GetCurrent(&itr, &key, &val));
+        Assert::IsTrue(key < (UINT_PTR)nKeys);
+        Assert::IsFalse(seen[key], L"Each key is visited once");
+        Assert::AreEqual(key * 2, val);
+        seen[key] = true;
+        ++nFound;
+    }
+    Assert::AreEqual(nKeys, nFound, L"Key 0 is visited along with the others");
+
+    // Inserting a new key invalidates the iterator, overwriting a value does not
+    Assert::AreEqual(S_OK, piht->InitIterator(piht, &itr));
+    Assert::AreEqual(S_OK, piht->Insert(piht, 5, 55));
+    Assert::AreEqual(S_OK, itr.MoveNext(&itr));
+    Assert::AreEqual(S_OK, piht->Insert(piht, nKeys, 0));
+    Assert::AreEqual(E_CHANGED_STATE, itr.MoveNext(&itr));
+    Assert::AreEqual(E_CHANGED_STATE, itr.GetCurrent(&itr, nullptr, nullptr));
+
+    Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)));
+}
+
+void IntHashtableUnitTests::HeapValues()
+{
+    PCHL_IHTABLE piht;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateIHT(&piht, 0, TRUE)));
+
+    // Overwritten, removed and remaining values are all freed by the table
+    for (int key = 0; key < 100; ++key)
+    {
+        PVOID pv;
+        Assert::IsTrue(SUCCEEDED(CHL_MmAlloc(&pv, sizeof(int), NULL)));
+        *(int*)pv = key;
+        Assert::AreEqual(S_OK, piht->Insert(piht, (UINT_PTR)key, (UINT_PTR)pv));
+    }
+
+    for (int key = 0; key < 50; ++key)
+    {
+        PVOID pv;
+        Assert::IsTrue(SUCCEEDED(CHL_MmAlloc(&pv, sizeof(int), NULL)));
+        *(int*)pv = -key;
+        Assert::AreEqual(S_OK, piht->Insert(piht, (UINT_PTR)key, (UINT_PTR)pv));
+    }
+
+    for (int key = 0; key < 100; key += 3)
+    {
+        Assert::AreEqual(S_OK, piht->Remove(piht, (UINT_PTR)key));
+    }
+
+    UINT_PTR val;
+    Assert::AreEqual(S_OK, piht->Find(piht, 1, &val));
+    Assert::AreEqual(-1, *(int*)val);
+    Assert::AreEqual(S_OK, piht->Find(piht, 98, &val));
+    Assert::AreEqual(98, *(int*)val);
+
+    Assert::IsTrue(SUCCEEDED(piht->Destroy(piht)));
+}
+
+}
@@ -0,0 +1,208 @@
+#include "stdafx.h"
+#include "LruCache.h"
+
+#include "CppUnitTest.h"
+#include "Helpers.h"
+
+using namespace std;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+TEST_CLASS(LruCacheUnitTests)
+{
+public:
+    TEST_METHOD(CreateAndDestroy);
+    TEST_METHOD(EvictLeastRecentlyUsed);
+    TEST_METHOD(UpdateAndRemove);
+    TEST_METHOD(ByteCapacity);
+    TEST_METHOD(EvictCallbackReleasesValues);
+
+private:
+    struct EvictLog
+    {
+        vector<int> keys;
+    };
+
+    static void OnEvictInt(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext);
+    static void OnEvictFree(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext);
+};
+
+void LruCacheUnitTests::OnEvictInt(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext)
+{
+    EvictLog *pLog = (EvictLog*)pvContext;
+    pLog->keys.push_back((int)(INT_PTR)pvKey);
+}
+
+void LruCacheUnitTests::OnEvictFree(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext)
+{
+    int *pnFreed = (int*)pvContext;
+    free(pvVal);
+    ++(*pnFreed);
+}
+
+void LruCacheUnitTests::CreateAndDestroy()
+{
+    PCHL_LRU plru;
+
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateLRU(&plru, CHL_KT_INT32, CHL_VT_INT32, FALSE, 0, 0, nullptr, nullptr),
+        L"A capacity is required");
+    Assert::IsNull(plru);
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateLRU(nullptr, CHL_KT_INT32, CHL_VT_INT32, FALSE, 10, 0, nullptr, nullptr));
+
+    Assert::AreEqual(S_OK, CHL_DsCreateLRU(&plru, CHL_KT_STRING, CHL_VT_WSTRING, FALSE, 100, 0, nullptr, nullptr));
+    Assert::AreEqual(0U, plru->nEntries);
+    Assert::AreEqual((SIZE_T)0, plru->cbUsed);
+    Assert::IsTrue(SUCCEEDED(plru->Destroy(plru)), L"Destroying empty cache succeeds");
+
+    Assert::AreEqual(S_OK, CHL_DsCreateLRU(&plru, CHL_KT_INT32, CHL_VT_INT32, FALSE, 0, 4096, nullptr, nullptr));
+    for (int i = 0; i < 1000; ++i)
+    {
+        Assert::AreEqual(S_OK, plru->Insert(plru, (PCVOID)i, 0, (PCVOID)i, 0));
+    }
+    Assert::IsTrue(SUCCEEDED(plru->Destroy(plru)));
+}
+
+void LruCacheUnitTests::EvictLeastRecentlyUsed()
+{
+    EvictLog log;
+    PCHL_LRU plru;
+    Assert::AreEqual(S_OK, CHL_DsCreateLRU(&plru, CHL_KT_INT32, CHL_VT_INT32, FALSE, 3, 0, OnEvictInt, &log));
+
+    for (int i = 1; i <= 3; ++i)
+    {
+        Assert::AreEqual(S_OK, plru->Insert(plru, (PCVOID)i, 0, (PCVOID)(i * 10), 0));
+    }
+
+    // A hit makes 1 the most recently used, so 2 is evicted next
+    int val;
+    Assert::AreEqual(S_OK, plru->Find(plru, (PCVOID)1, 0, &val, nullptr, FALSE));
+    Assert::AreEqual(10, val);
+
+    Assert::AreEqual(S_OK, plru->Insert(plru, (PCVOID)4, 0, (PCVOID)40, 0));
+    Assert::AreEqual((size_t)1, log.keys.size());
+    Assert::AreEqual(2, log.keys[0]);
+    Assert::AreEqual(3U, plru->nEntries);
+
+    int valSize = -1;
+    Assert::AreEqual(E_NOT_SET, plru->Find(plru, (PCVOID)2, 0, &val, &valSize, FALSE));
+    Assert::AreEqual(0, valSize);
+
+    Assert::AreEqual(S_OK, plru->Insert(plru, (PCVOID)5, 0, (PCVOID)50, 0));
+    Assert::AreEqual((size_t)2, log.keys.size());
+    Assert::AreEqual(3, log.keys[1]);
+
+    Assert::AreEqual(2ULL, plru->counters.ullEvictions);
+    Assert::AreEqual(1ULL, plru->counters.ullHits);
+    Assert::AreEqual(1ULL, plru->counters.ullMisses);
+
+    // Many more keys than the capacity, only the most recent ones are kept
+    for (int i = 100; i < 10100; ++i)
+    {
+        Assert::AreEqual(S_OK, plru->Insert(plru, (PCVOID)i, 0, (PCVOID)i, 0));
+    }
+    Assert::AreEqual(3U, plru->nEntries);
+    for (int i = 10097; i < 10100; ++i)
+    {
+        Assert::AreEqual(S_OK, plru->Find(plru, (PCVOID)i, 0, &val, nullptr, FALSE));
+        Assert::AreEqual(i, val);
+    }
+    Assert::AreEqual(10097, log.keys.back());
+
+    Assert::IsTrue(SUCCEEDED(plru->Destroy(plru)));
+    Assert::AreEqual((size_t)10002, log.keys.size(), L"Destroy does not call the eviction callback");
+}
+
+void LruCacheUnitTests::UpdateAndRemove()
+{
+    PCHL_LRU plru;
+    Assert::AreEqual(S_OK, CHL_DsCreateLRU(&plru, CHL_KT_STRING, CHL_VT_STRING, FALSE, 2, 0, nullptr, nullptr));
+
+    Assert::AreEqual(S_OK, plru->Insert(plru, "one", 0, "1", 0));
+    Assert::AreEqual(S_OK, plru->Insert(plru, "two", 0, "2", 0));
+
+    // Updating a key makes it the most recently used
+    Assert::AreEqual(S_OK, plru->Insert(plru, "one", 0, "uno", 0));
+    Assert::AreEqual(S_OK, plru->Insert(plru, "three", 0, "3", 0));
+
+    PCSTR pszVal;
+    int valSize;
+    Assert::AreEqual(E_NOT_SET, plru->Find(plru, "two", 0, &pszVal, nullptr, TRUE));
+    Assert::AreEqual(S_OK, plru->Find(plru, "one", 0, &pszVal, &valSize, TRUE));
+    Assert::AreEqual("uno", pszVal);
+    Assert::AreEqual(4, valSize);
+
+    Assert::AreEqual(S_OK, plru->Remove(plru, "one", 0));
+    Assert::AreEqual(E_NOT_SET, plru->Remove(plru, "one", 0));
+    Assert::AreEqual(E_NOT_SET, plru->Find(plru, "one", 0, nullptr, nullptr, FALSE));
+    Assert::AreEqual(1U, plru->nEntries);
+    Assert::AreEqual(1ULL, plru->counters.ullEvictions, L"Removing is not evicting");
+
+    Assert::IsTrue(SUCCEEDED(plru->Destroy(plru)));
+}
+
+void LruCacheUnitTests::ByteCapacity()
+{
+    const SIZE_T c_cbMax = 64 * 1024;
+
+    PCHL_LRU plru;
+    Assert::AreEqual(S_OK, CHL_DsCreateLRU(&plru, CHL_KT_STRING, CHL_VT_USEROBJECT, FALSE, 0, c_cbMax, nullptr, nullptr));
+
+    BYTE abValue[200];
+    memset(abValue, 0x5A, sizeof(abValue));
+
+    const int nKeys = 5000;
+    for (int i = 0; i < nKeys; ++i)
+    {
+        char szKey[32];
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", i)));
+        Assert::AreEqual(S_OK, plru->Insert(plru, szKey, 0, abValue, (i % 2) ? sizeof(abValue) : sizeof(abValue) / 2));
+        Assert::IsTrue(plru->cbUsed <= c_cbMax, L"Cache stays within its byte capacity");
+    }
+
+    Assert::IsTrue(plru->counters.ullEvictions > 0);
+    Assert::AreEqual((ULONGLONG)nKeys, plru->nEntries + plru->counters.ullEvictions);
+
+    // The entries kept are the most recent ones
+    for (int i = nKeys - (int)plru->nEntries; i < nKeys; ++i)
+    {
+        char szKey[32];
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szKey, ARRAYSIZE(szKey), "key%d", i)));
+        Assert::AreEqual(S_OK, plru->Find(plru, szKey, 0, nullptr, nullptr, FALSE));
+    }
+
+    // An entry larger than the whole cache is rejected
+    vector<BYTE> bigValue(c_cbMax + 1);
+    UINT nEntries = plru->nEntries;
+    Assert::AreEqual(E_INVALIDARG, plru->Insert(plru, "big", 0, bigValue.data(), (int)bigValue.size()));
+    Assert::AreEqual(nEntries, plru->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(plru->Destroy(plru)));
+}
+
+void LruCacheUnitTests::EvictCallbackReleasesValues()
+{
+    int nFreed = 0;
+    PCHL_LRU plru;
+    Assert::AreEqual(S_OK, CHL_DsCreateLRU(&plru, CHL_KT_UINT32, CHL_VT_POINTER, FALSE, 10, 0, OnEvictFree, &nFreed));
+
+    for (UINT i = 0; i < 100; ++i)
+    {
+        PVOID pv = malloc(16);
+        Assert::IsNotNull(pv);
+        Assert::AreEqual(S_OK, plru->Insert(plru, (PCVOID)i, 0, pv, sizeof(PVOID)));
+    }
+    Assert::AreEqual(90, nFreed);
+
+    // What is left still belongs to the caller
+    for (UINT i = 90; i < 100; ++i)
+    {
+        PVOID pv;
+        Assert::AreEqual(S_OK, plru->Find(plru, (PCVOID)i, 0, &pv, nullptr, FALSE));
+        free(pv);
+    }
+
+    Assert::IsTrue(SUCCEEDED(plru->Destroy(plru)));
+}
+
+}
@@ -23,8 +23,26 @@ public:
     TEST_METHOD(ShrinkManuallyNoWrites_Obj);
 	TEST_METHOD(WriteClearRead_Obj);
 	TEST_METHOD(WriteClearRead_Int);
+    TEST_METHOD(AppendReserveShrink_Int);
+    TEST_METHOD(AppendUpToMaxSize_Str);
+    TEST_METHOD(Packed_Int);
+    TEST_METHOD(Packed_Pointer);
+    TEST_METHOD(Ranges_Int);
+    TEST_METHOD(Ranges_Str);
+    TEST_METHOD(Sort_Int);
+    TEST_METHOD(Sort_Str);
+    TEST_METHOD(ForEachReduceScan_Int);
+
+private:
+    static void DoubleInt(UINT index, PVOID pvVal, PVOID pvContext);
 };
 
+void ResizableArrayUnitTests::DoubleInt(UINT index, PVOID pvVal, PVOID pvContext)
+{
+    *(int*)pvVal *= 2;
+    InterlockedIncrement((volatile LONG*)pvContext);
+}
+
 
 void ResizableArrayUnitTests::CreateAndDestroy()
 {
@@ -561,4 +579,425 @@ void ResizableArrayUnitTests::WriteClearRead_Int()
 	LOG_FUNC_EXIT;
 }
 
+
+void ResizableArrayUnitTests::AppendReserveShrink_Int()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_RARRAY ra;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateRA(&ra, CHL_VT_INT32, 10, 0)));
+    Assert::AreEqual(10U, ra.Size(&ra));
+    Assert::AreEqual(0U, ra.Length(&ra), L"Nothing written yet");
+    Assert::AreEqual(10U, ra.Capacity(&ra));
+
+    // Capacity grows geometrically, so there are few reallocations
+    const UINT c_nItems = 100000;
+    UINT nCapacityChanges = 0;
+    UINT capacity = ra.Capacity(&ra);
+    for (UINT idx = 0; idx < c_nItems; ++idx)
+    {
+        UINT index;
+        Assert::AreEqual(S_OK, ra.Append(&ra, (PCVOID)(idx * 3), 0, &index));
+        Assert::AreEqual(idx, index);
+        if (ra.Capacity(&ra) != capacity)
+        {
+            ++nCapacityChanges;
+            capacity = ra.Capacity(&ra);
+        }
+    }
+    Assert::AreEqual(c_nItems, ra.Length(&ra));
+    Assert::AreEqual(c_nItems, ra.Size(&ra));
+    Assert::IsTrue(ra.Capacity(&ra) >= c_nItems);
+    Assert::IsTrue(nCapacityChanges < 20);
+
+    for (UINT idx = 0; idx < c_nItems; ++idx)
+    {
+        int val;
+        Assert::AreEqual(S_OK, ra.Read(&ra, idx, &val, nullptr, FALSE));
+        Assert::AreEqual((int)(idx * 3), val);
+    }
+
+    Assert::AreEqual(S_OK, ra.ShrinkToFit(&ra));
+    Assert::AreEqual(c_nItems, ra.Capacity(&ra));
+
+    // Reserving changes neither size nor length
+    Assert::AreEqual(S_OK, ra.Reserve(&ra, c_nItems * 2));
+    Assert::AreEqual(c_nItems * 2, ra.Capacity(&ra));
+    Assert::AreEqual(c_nItems, ra.Size(&ra));
+    Assert::AreEqual(c_nItems, ra.Length(&ra));
+
+    // Resizing down cuts the length, writing beyond the size grows it
+    Assert::AreEqual(S_OK, ra.Resize(&ra, 50));
+    Assert::AreEqual(50U, ra.Length(&ra));
+    Assert::AreEqual(50U, ra.Capacity(&ra));
+    Assert::AreEqual(S_OK, ra.Write(&ra, 1000, (PCVOID)7, 0));
+    Assert::AreEqual(1001U, ra.Size(&ra));
+    Assert::AreEqual(1001U, ra.Length(&ra));
+    Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 500, nullptr, nullptr, FALSE), L"Grown values are not set");
+
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    LOG_FUNC_EXIT;
+}
+
+void ResizableArrayUnitTests::AppendUpToMaxSize_Str()
+{
+    LOG_FUNC_ENTRY;
+
+    const UINT c_maxSize = 8;
+    CHL_RARRAY ra;
+    Assert::IsTrue(SUCCEEDED(CHL_DsCreateRA(&ra, CHL_VT_STRING, 0, c_maxSize)));
+
+    char szVal[16];
+    for (UINT idx = 0; idx < c_maxSize; ++idx)
+    {
+        Assert::IsTrue(SUCCEEDED(StringCchPrintfA(szVal, ARRAYSIZE(szVal), "val%u", idx)));
+        Assert::AreEqual(S_OK, ra.Append(&ra, szVal, 0, nullptr));
+    }
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_INVALID_INDEX), ra.Append(&ra, "full", 0, nullptr));
+    Assert::AreEqual(E_INVALIDARG, ra.Reserve(&ra, c_maxSize + 1));
+    Assert::AreEqual(c_maxSize, ra.Length(&ra));
+
+    // Writing over a value replaces it
+    PCSTR pszVal;
+    Assert::AreEqual(S_OK, ra.Write(&ra, 3, "replaced", 0));
+    Assert::AreEqual(S_OK, ra.Read(&ra, 3, &pszVal, nullptr, TRUE));
+    Assert::AreEqual("replaced", pszVal);
+    Assert::AreEqual(S_OK, ra.Read(&ra, 7, &pszVal, nullptr, TRUE));
+    Assert::AreEqual("val7", pszVal);
+
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    LOG_FUNC_EXIT;
+}
+
+
+void ResizableArrayUnitTests::Packed_Int()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_RARRAY ra;
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), CHL_DsCreateExRA(&ra, CHL_VT_STRING, 10, 0, CHL_RA_FLAG_PACKED));
+    Assert::AreEqual(S_OK, CHL_DsCreateExRA(&ra, CHL_VT_INT32, 10, 0, CHL_RA_FLAG_PACKED));
+    Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 0, nullptr, nullptr, FALSE));
+
+    const UINT c_nItems = 1000;
+    for (UINT idx = 0; idx < c_nItems; ++idx)
+    {
+        Assert::AreEqual(S_OK, ra.Append(&ra, (PCVOID)((int)idx - 500), 0, nullptr));
+    }
+
+    int val;
+    int valSize = 2;
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER), ra.Read(&ra, 1, &val, &valSize, FALSE));
+    Assert::AreEqual((int)sizeof(int), valSize);
+    Assert::AreEqual(S_OK, ra.ClearAt(&ra, 5));
+    Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 5, &val, nullptr, FALSE));
+
+    // The values in place, with a bit per value telling which are occupied
+    PVOID pvData;
+    PDWORD pdwOccupied;
+    Assert::AreEqual(S_OK, ra.GetData(&ra, &pvData, &pdwOccupied));
+    int *piData = (int*)pvData;
+    for (UINT idx = 0; idx < c_nItems; ++idx)
+    {
+        BOOL fOccupied = (pdwOccupied[idx / 32] & (1UL << (idx % 32))) != 0;
+        Assert::AreEqual((BOOL)(idx != 5), fOccupied);
+        Assert::AreEqual((idx == 5) ? 0 : ((int)idx - 500), piData[idx]);
+    }
+
+    piData[6] = 66;
+    Assert::AreEqual(S_OK, ra.Read(&ra, 6, &val, nullptr, FALSE));
+    Assert::AreEqual(66, val);
+
+    // Values cut off by resizing are not occupied once the array grows again
+    Assert::AreEqual(S_OK, ra.Resize(&ra, 40));
+    Assert::AreEqual(S_OK, ra.Resize(&ra, 100));
+    Assert::AreEqual(S_OK, ra.Read(&ra, 39, &val, nullptr, FALSE));
+    Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 40, &val, nullptr, FALSE));
+
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    LOG_FUNC_EXIT;
+}
+
+void ResizableArrayUnitTests::Packed_Pointer()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_RARRAY ra;
+    Assert::AreEqual(S_OK, CHL_DsCreateExRA(&ra, CHL_VT_POINTER, 0, 0, CHL_RA_FLAG_PACKED));
+    Assert::AreEqual(E_INVALIDARG, ra.Append(&ra, nullptr, 0, nullptr));
+    Assert::AreEqual(0U, ra.Length(&ra));
+
+    int aInts[4];
+    for (int i = 0; i < (int)ARRAYSIZE(aInts); ++i)
+    {
+        Assert::AreEqual(S_OK, ra.Write(&ra, i * 2, &aInts[i], 0));
+    }
+
+    PVOID pv;
+    Assert::AreEqual(S_OK, ra.Read(&ra, 6, &pv, nullptr, TRUE));
+    Assert::IsTrue(pv == &aInts[3]);
+    Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 5, &pv, nullptr, TRUE));
+
+    PVOID pvData;
+    Assert::AreEqual(S_OK, ra.GetData(&ra, &pvData, nullptr));
+    Assert::IsTrue(((PVOID*)pvData)[4] == &aInts[2]);
+    Assert::IsNull(((PVOID*)pvData)[5]);
+
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    // Arrays of CHL_VAL have no data pointer
+    Assert::AreEqual(S_OK, CHL_DsCreateRA(&ra, CHL_VT_POINTER, 0, 0));
+    Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), ra.GetData(&ra, &pvData, nullptr));
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    LOG_FUNC_EXIT;
+}
+
+
+void ResizableArrayUnitTests::Ranges_Int()
+{
+    LOG_FUNC_ENTRY;
+
+    const UINT c_nItems = 1000;
+    std::vector<int> vals(c_nItems);
+    for (UINT idx = 0; idx < c_nItems; ++idx)
+    {
+        vals[idx] = (int)idx - 100;
+    }
+
+    // Same results with and without packing
+    for (DWORD dwFlags = 0; dwFlags <= CHL_RA_FLAG_PACKED; ++dwFlags)
+    {
+        CHL_RARRAY ra, raOther;
+        Assert::AreEqual(S_OK, CHL_DsCreateExRA(&ra, CHL_VT_INT32, 0, 0, dwFlags));
+        Assert::AreEqual(S_OK, CHL_DsCreateExRA(&raOther, CHL_VT_INT32, 0, 0, dwFlags));
+
+        UINT index;
+        Assert::AreEqual(S_OK, ra.AppendRange(&ra, vals.data(), nullptr, c_nItems, &index));
+        Assert::AreEqual(0U, index);
+        Assert::AreEqual(S_OK, ra.AppendRange(&ra, vals.data(), nullptr, c_nItems, &index));
+        Assert::AreEqual(c_nItems, index);
+        Assert::AreEqual(c_nItems * 2, ra.Length(&ra));
+
+        std::vector<int> readVals(c_nItems);
+        Assert::AreEqual(S_OK, ra.ReadRange(&ra, c_nItems, c_nItems, readVals.data()));
+        Assert::IsTrue(vals == readVals);
+        Assert::AreEqual(HRESULT_FROM_WIN32(ERROR_INVALID_INDEX), ra.ReadRange(&ra, c_nItems + 1, c_nItems, readVals.data()));
+
+        // Not occupied values read as zero
+        Assert::AreEqual(S_OK, ra.ClearAt(&ra, 10));
+        Assert::AreEqual(S_FALSE, ra.ReadRange(&ra, 0, c_nItems, readVals.data()));
+        Assert::AreEqual(0, readVals[10]);
+
+        // Moving to another array clears the source range and grows the destination
+        Assert::AreEqual(S_OK, raOther.MoveRange(&raOther, 5, &ra, c_nItems, c_nItems));
+        Assert::AreEqual(c_nItems + 5, raOther.Size(&raOther));
+        Assert::AreEqual(c_nItems + 5, raOther.Length(&raOther));
+        Assert::AreEqual(E_NOT_SET, raOther.Read(&raOther, 4, nullptr, nullptr, FALSE));
+        Assert::AreEqual(S_OK, raOther.ReadRange(&raOther, 5, c_nItems, readVals.data()));
+        Assert::IsTrue(vals == readVals);
+        Assert::AreEqual(E_NOT_SET, ra.Read(&ra, c_nItems, nullptr, nullptr, FALSE));
+
+        // Overlapping copy within the array: shift the first half up by 3
+        std::vector<int> shiftedVals(c_nItems + 3);
+        Assert::AreEqual(S_OK, ra.CopyRange(&ra, 3, &ra, 0, c_nItems));
+        Assert::AreEqual(S_FALSE, ra.ReadRange(&ra, 0, c_nItems + 3, shiftedVals.data()));
+        Assert::AreEqual(vals[2], shiftedVals[2]);
+        Assert::AreEqual(vals[0], shiftedVals[3]);
+        Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 13, nullptr, nullptr, FALSE));
+        Assert::AreEqual(vals[c_nItems - 1], shiftedVals[c_nItems + 2]);
+        Assert::AreEqual(E_NOT_SET, ra.Read(&ra, c_nItems + 3, nullptr, nullptr, FALSE));
+        Assert::AreEqual(c_nItems * 2, ra.Length(&ra), L"Moving does not change the source length");
+
+        Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+        Assert::IsTrue(SUCCEEDED(raOther.Destroy(&raOther)));
+    }
+
+    // Packed and not packed arrays do not mix
+    CHL_RARRAY raPacked, raVals;
+    Assert::AreEqual(S_OK, CHL_DsCreateExRA(&raPacked, CHL_VT_INT32, 10, 0, CHL_RA_FLAG_PACKED));
+    Assert::AreEqual(S_OK, CHL_DsCreateRA(&raVals, CHL_VT_INT32, 10, 0));
+    Assert::AreEqual(E_INVALIDARG, raPacked.CopyRange(&raPacked, 0, &raVals, 0, 1));
+    Assert::IsTrue(SUCCEEDED(raPacked.Destroy(&raPacked)));
+    Assert::IsTrue(SUCCEEDED(raVals.Destroy(&raVals)));
+
+    LOG_FUNC_EXIT;
+}
+
+void ResizableArrayUnitTests::Ranges_Str()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_RARRAY ra, raCopy;
+    Assert::AreEqual(S_OK, CHL_DsCreateRA(&ra, CHL_VT_STRING, 0, 0));
+    Assert::AreEqual(S_OK, CHL_DsCreateRA(&raCopy, CHL_VT_STRING, 0, 0));
+
+    PCSTR apszVals[] = { "zero", "one", "two", "three" };
+    PCSTR apszBad[] = { "four", nullptr };
+    Assert::AreEqual(S_OK, ra.WriteRange(&ra, 0, apszVals, nullptr, ARRAYSIZE(apszVals)));
+    Assert::AreEqual(E_INVALIDARG, ra.AppendRange(&ra, apszBad, nullptr, ARRAYSIZE(apszBad), nullptr));
+    Assert::AreEqual((UINT)ARRAYSIZE(apszVals), ra.Length(&ra), L"Nothing is written if a value is invalid");
+
+    // Copies are duplicated, so they outlive the source
+    Assert::AreEqual(S_OK, raCopy.CopyRange(&raCopy, 0, &ra, 1, 3));
+    Assert::AreEqual(S_OK, ra.MoveRange(&ra, 0, &ra, 2, 2));
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    PCSTR apszRead[3];
+    Assert::AreEqual(S_OK, raCopy.ReadRange(&raCopy, 0, 3, apszRead));
+    Assert::AreEqual("one", apszRead[0]);
+    Assert::AreEqual("three", apszRead[2]);
+    Assert::IsTrue(SUCCEEDED(raCopy.Destroy(&raCopy)));
+
+    LOG_FUNC_EXIT;
+}
+
+void ResizableArrayUnitTests::Sort_Int()
+{
+    LOG_FUNC_ENTRY;
+
+    // Enough values for several threads, with some not occupied
+    const UINT c_nItems = 200000;
+    std::vector<int> vals;
+    CHL_RARRAY ra;
+    Assert::AreEqual(S_OK, CHL_DsCreateExRA(&ra, CHL_VT_INT32, 0, 0, CHL_RA_FLAG_PACKED));
+    for (UINT idx = 0; idx < c_nItems; ++idx)
+    {
+        int val = (int)((idx * 2654435761U) % 100000) - 50000;
+        Assert::AreEqual(S_OK, ra.Append(&ra, (PCVOID)val, 0, nullptr));
+        if (idx % 10 == 0)
+        {
+            Assert::AreEqual(S_OK, ra.ClearAt(&ra, idx));
+        }
+        else
+        {
+            vals.push_back(val);
+        }
+    }
+
+    std::sort(vals.begin(), vals.end());
+    Assert::AreEqual(S_OK, ra.Sort(&ra, nullptr, 0));
+    Assert::AreEqual((UINT)vals.size(), ra.Length(&ra), L"Values that are not occupied are dropped");
+    for (UINT idx = 0; idx < vals.size(); ++idx)
+    {
+        int val;
+        Assert::AreEqual(S_OK, ra.Read(&ra, idx, &val, nullptr, FALSE));
+        Assert::AreEqual(vals[idx], val);
+    }
+
+    // The same with a compare function, starting from descending order
+    std::vector<int> reversed(vals.rbegin(), vals.rend());
+    Assert::AreEqual(S_OK, ra.WriteRange(&ra, 0, reversed.data(), nullptr, (UINT)reversed.size()));
+    Assert::AreEqual(S_OK, ra.Sort(&ra, Helpers::CompareFn_Int32, 4));
+    for (UINT idx = 0; idx < vals.size(); ++idx)
+    {
+        int val;
+        Assert::AreEqual(S_OK, ra.Read(&ra, idx, &val, nullptr, FALSE));
+        Assert::AreEqual(vals[idx], val);
+    }
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    // Equal values keep their order: the low bits are the original index and are not compared
+    Assert::AreEqual(S_OK, CHL_DsCreateRA(&ra, CHL_VT_INT32, 0, 0));
+    for (UINT idx = 0; idx < 60000; ++idx)
+    {
+        int val = (int)((((idx * 7919) % 100) << 16) | idx);
+        Assert::AreEqual(S_OK, ra.Append(&ra, (PCVOID)val, 0, nullptr));
+    }
+    Assert::AreEqual(S_OK, ra.Sort(&ra, Helpers::CompareFn_Int32HighWord, 0));
+
+    int prev = -1;
+    for (UINT idx = 0; idx < ra.Length(&ra); ++idx)
+    {
+        int val;
+        Assert::AreEqual(S_OK, ra.Read(&ra, idx, &val, nullptr, FALSE));
+        Assert::IsTrue(val > prev);
+        prev = val;
+    }
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    LOG_FUNC_EXIT;
+}
+
+void ResizableArrayUnitTests::Sort_Str()
+{
+    LOG_FUNC_ENTRY;
+
+    CHL_RARRAY ra;
+    Assert::AreEqual(S_OK, CHL_DsCreateRA(&ra, CHL_VT_WSTRING, 0, 0));
+
+    PCWSTR apszVals[] = { L"pear", L"apple", L"fig", L"kiwi", L"banana", L"cherry" };
+    Assert::AreEqual(S_OK, ra.WriteRange(&ra, 0, apszVals, nullptr, ARRAYSIZE(apszVals)));
+    Assert::AreEqual(S_OK, ra.ClearAt(&ra, 3));
+    Assert::AreEqual(E_INVALIDARG, ra.Sort(&ra, nullptr, 0), L"Strings need a compare function");
+
+    Assert::AreEqual(S_OK, ra.Sort(&ra, Helpers::CompareFn_WString, 0));
+    Assert::AreEqual(5U, ra.Length(&ra));
+
+    PCWSTR apszSorted[] = { L"apple", L"banana", L"cherry", L"fig", L"pear" };
+    for (UINT idx = 0; idx < ARRAYSIZE(apszSorted); ++idx)
+    {
+        PCWSTR pszVal;
+        Assert::AreEqual(S_OK, ra.Read(&ra, idx, &pszVal, nullptr, TRUE));
+        Assert::AreEqual(apszSorted[idx], pszVal);
+    }
+    Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 5, nullptr, nullptr, FALSE));
+
+    Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+
+    LOG_FUNC_EXIT;
+}
+
+void ResizableArrayUnitTests::ForEachReduceScan_Int()
+{
+    LOG_FUNC_ENTRY;
+
+    const UINT c_nItems = 100000;
+    for (int packed = 0; packed < 2; ++packed)
+    {
+        CHL_RARRAY ra;
+        PVOID pvResult;
+        Assert::AreEqual(S_OK, CHL_DsCreateExRA(&ra, CHL_VT_INT32, 0, 0, packed ? CHL_RA_FLAG_PACKED : 0));
+        Assert::AreEqual(E_NOT_SET, ra.Reduce(&ra, CHL_DsCombineSumRA, nullptr, 0, &pvResult));
+
+        for (UINT idx = 0; idx < c_nItems; ++idx)
+        {
+            Assert::AreEqual(S_OK, ra.Append(&ra, (PCVOID)(int)(idx % 1000), 0, nullptr));
+        }
+        Assert::AreEqual(S_OK, ra.ClearAt(&ra, 1));
+
+        LONG nCalls = 0;
+        Assert::AreEqual(S_OK, ra.ForEach(&ra, DoubleInt, &nCalls, 0));
+        Assert::AreEqual((LONG)c_nItems - 1, nCalls);
+
+        Assert::AreEqual(S_OK, ra.Reduce(&ra, CHL_DsCombineMaxRA, nullptr, 0, &pvResult));
+        Assert::AreEqual(1998, (int)(INT_PTR)pvResult);
+        Assert::AreEqual(S_OK, ra.Reduce(&ra, CHL_DsCombineSumRA, nullptr, 3, &pvResult));
+        Assert::AreEqual((int)(100 * 999 * 1000 - 2), (int)(INT_PTR)pvResult);
+
+        // Each value becomes the sum of the values up to it
+        Assert::AreEqual(S_OK, ra.Scan(&ra, CHL_DsCombineSumRA, nullptr, 0));
+        Assert::AreEqual(E_NOT_SET, ra.Read(&ra, 1, nullptr, nullptr, FALSE));
+
+        int sum = 0;
+        for (UINT idx = 0; idx < c_nItems; ++idx)
+        {
+            if (idx != 1)
+            {
+                int val;
+                sum += (idx % 1000) * 2;
+                Assert::AreEqual(S_OK, ra.Read(&ra, idx, &val, nullptr, FALSE));
+                Assert::AreEqual(sum, val);
+            }
+        }
+
+        Assert::IsTrue(SUCCEEDED(ra.Destroy(&ra)));
+    }
+
+    LOG_FUNC_EXIT;
+}
+
 } // namespace Tests
@@ -0,0 +1,220 @@
+#include "stdafx.h"
+#include "TtlCache.h"
+
+#include "CppUnitTest.h"
+#include "Helpers.h"
+
+using namespace std;
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+TEST_CLASS(TtlCacheUnitTests)
+{
+public:
+    TEST_METHOD(CreateAndDestroy);
+    TEST_METHOD(ExpireAfterTtl);
+    TEST_METHOD(UpdateRefreshesTtl);
+    TEST_METHOD(WheelReclaimsInOrder);
+    TEST_METHOD(ExpireIsBounded);
+
+private:
+    // The tests drive the cache with this clock instead of the real one
+    struct TestClock
+    {
+        ULONGLONG ullNow;
+        vector<int> expiredKeys;
+    };
+
+    static ULONGLONG GetTestTime(PVOID pvContext);
+    static void OnExpireInt(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext);
+};
+
+ULONGLONG TtlCacheUnitTests::GetTestTime(PVOID pvContext)
+{
+    return ((TestClock*)pvContext)->ullNow;
+}
+
+void TtlCacheUnitTests::OnExpireInt(PCVOID pvKey, int iKeySize, PVOID pvVal, int iValSize, PVOID pvContext)
+{
+    ((TestClock*)pvContext)->expiredKeys.push_back((int)(INT_PTR)pvKey);
+}
+
+void TtlCacheUnitTests::CreateAndDestroy()
+{
+    PCHL_TTLCACHE pttl;
+
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateTTL(nullptr, CHL_KT_INT32, CHL_VT_INT32, FALSE, 0, 0, nullptr, nullptr, nullptr));
+    Assert::AreEqual(E_INVALIDARG, CHL_DsCreateTTL(&pttl, CHL_KT_INT32, CHL_VT_INT32, FALSE, -1, 0, nullptr, nullptr, nullptr));
+    Assert::IsNull(pttl);
+
+    // Real clock, nothing expires while the test runs
+    Assert::AreEqual(S_OK, CHL_DsCreateTTL(&pttl, CHL_KT_STRING, CHL_VT_WSTRING, FALSE, 100, 0, nullptr, nullptr, nullptr));
+    Assert::AreEqual(1U, pttl->nTickMs);
+    Assert::AreEqual(S_OK, pttl->Insert(pttl, "key", 0, L"value", 0, 60 * 60 * 1000));
+
+    PCWSTR pszVal;
+    int valSize;
+    Assert::AreEqual(S_OK, pttl->Find(pttl, "key", 0, &pszVal, &valSize, TRUE));
+    Assert::AreEqual(L"value", pszVal);
+    Assert::AreEqual((int)sizeof(L"value"), valSize);
+
+    Assert::IsTrue(SUCCEEDED(pttl->Destroy(pttl)), L"Destroying cache with entries succeeds");
+}
+
+void TtlCacheUnitTests::ExpireAfterTtl()
+{
+    TestClock clock = { 1000000 };
+    PCHL_TTLCACHE pttl;
+    Assert::AreEqual(S_OK, CHL_DsCreateTTL(&pttl, CHL_KT_INT32, CHL_VT_INT32, FALSE, 0, 1, GetTestTime, OnExpireInt, &clock));
+
+    Assert::AreEqual(S_OK, pttl->Insert(pttl, (PCVOID)1, 0, (PCVOID)10, 0, 100));
+    Assert::AreEqual(S_OK, pttl->Insert(pttl, (PCVOID)2, 0, (PCVOID)20, 0, 5000));
+
+    int val;
+    clock.ullNow += 99;
+    Assert::AreEqual(S_OK, pttl->Find(pttl, (PCVOID)1, 0, &val, nullptr, FALSE));
+    Assert::AreEqual(10, val);
+
+    // Found expired, so reclaimed right away
+    int valSize = -1;
+    clock.ullNow += 1;
+    Assert::AreEqual(E_NOT_SET, pttl->Find(pttl, (PCVOID)1, 0, &val, &valSize, FALSE));
+    Assert::AreEqual(0, valSize);
+    Assert::AreEqual((size_t)1, clock.expiredKeys.size());
+    Assert::AreEqual(1, clock.expiredKeys[0]);
+    Assert::AreEqual(1U, pttl->nEntries);
+
+    // Reclaimed by the wheel without being looked up
+    UINT nExpired;
+    clock.ullNow += 5000;
+    Assert::AreEqual(S_OK, pttl->Expire(pttl, 0, &nExpired));
+    Assert::AreEqual(1U, nExpired);
+    Assert::AreEqual(0U, pttl->nEntries);
+    Assert::AreEqual(2, clock.expiredKeys[1]);
+    Assert::AreEqual(2ULL, pttl->ullExpired);
+
+    // Removing is not expiring
+    Assert::AreEqual(S_OK, pttl->Insert(pttl, (PCVOID)3, 0, (PCVOID)30, 0, 100));
+    Assert::AreEqual(S_OK, pttl->Remove(pttl, (PCVOID)3, 0));
+    Assert::AreEqual(E_NOT_SET, pttl->Remove(pttl, (PCVOID)3, 0));
+    Assert::AreEqual((size_t)2, clock.expiredKeys.size());
+
+    Assert::IsTrue(SUCCEEDED(pttl->Destroy(pttl)));
+}
+
+void TtlCacheUnitTests::UpdateRefreshesTtl()
+{
+    TestClock clock = { 0 };
+    PCHL_TTLCACHE pttl;
+    Assert::AreEqual(S_OK, CHL_DsCreateTTL(&pttl, CHL_KT_STRING, CHL_VT_STRING, FALSE, 0, 10, GetTestTime, nullptr, &clock));
+
+    Assert::AreEqual(S_OK, pttl->Insert(pttl, "session", 0, "a", 0, 1000));
+    clock.ullNow += 900;
+    Assert::AreEqual(S_OK, pttl->Insert(pttl, "session", 0, "b", 0, 1000));
+    clock.ullNow += 900;
+
+    PCSTR pszVal;
+    Assert::AreEqual(S_OK, pttl->Find(pttl, "session", 0, &pszVal, nullptr, TRUE));
+    Assert::AreEqual("b", pszVal);
+    Assert::AreEqual(1U, pttl->nEntries);
+
+    clock.ullNow += 100;
+    Assert::AreEqual(E_NOT_SET, pttl->Find(pttl, "session", 0, &pszVal, nullptr, TRUE));
+    Assert::AreEqual(1ULL, pttl->ullExpired);
+
+    Assert::IsTrue(SUCCEEDED(pttl->Destroy(pttl)));
+}
+
+void TtlCacheUnitTests::WheelReclaimsInOrder()
+{
+    TestClock clock = { 12345 };
+    PCHL_TTLCACHE pttl;
+    Assert::AreEqual(S_OK, CHL_DsCreateTTL(&pttl, CHL_KT_INT32, CHL_VT_INT32, FALSE, 0, 1, GetTestTime, OnExpireInt, &clock));
+
+    // TTLs that span every level of the wheel
+    const int nKeys = 20000;
+    vector<ULONGLONG> expireTimes(nKeys);
+    for (int i = 0; i < nKeys; ++i)
+    {
+        UINT uTtl = (UINT)(((ULONGLONG)i * 2654435761ULL) % 100000000ULL);
+        expireTimes[i] = clock.ullNow + uTtl;
+        Assert::AreEqual(S_OK, pttl->Insert(pttl, (PCVOID)i, 0, (PCVOID)i, 0, uTtl));
+    }
+
+    ULONGLONG ullStep = 1;
+    while (pttl->nEntries > 0)
+    {
+        clock.ullNow += ullStep;
+        ullStep = (ullStep * 3) % 1000003;
+
+        size_t nBefore = clock.expiredKeys.size();
+        Assert::AreEqual(S_OK, pttl->Expire(pttl, 0, nullptr));
+
+        // Only expired entries are reclaimed, and all of them within a tick
+        for (size_t i = nBefore; i < clock.expiredKeys.size(); ++i)
+        {
+            Assert::IsTrue(expireTimes[clock.expiredKeys[i]] <= clock.ullNow);
+        }
+        for (int i = 0; i < nKeys; i += 97)
+        {
+            if (expireTimes[i] < clock.ullNow)
+            {
+                Assert::AreEqual(E_NOT_SET, pttl->Find(pttl, (PCVOID)i, 0, nullptr, nullptr, FALSE));
+            }
+        }
+    }
+
+    Assert::AreEqual((size_t)nKeys, clock.expiredKeys.size());
+    Assert::AreEqual((ULONGLONG)nKeys, pttl->ullExpired);
+    Assert::IsTrue(SUCCEEDED(pttl->Destroy(pttl)));
+}
+
+void TtlCacheUnitTests::ExpireIsBounded()
+{
+    TestClock clock = { 0 };
+    PCHL_TTLCACHE pttl;
+    Assert::AreEqual(S_OK, CHL_DsCreateTTL(&pttl, CHL_KT_UINT32, CHL_VT_UINT32, FALSE, 0, 0, GetTestTime, nullptr, &clock));
+
+    const UINT nKeys = 10000;
+    for (UINT i = 0; i < nKeys; ++i)
+    {
+        Assert::AreEqual(S_OK, pttl->Insert(pttl, (PCVOID)i, 0, (PCVOID)i, 0, 1000 + (i % 5000)));
+    }
+
+    // All of them are due, each call does a bounded amount of work
+    clock.ullNow += 60 * 1000;
+
+    UINT nExpired;
+    UINT nTotal = 0;
+    int nCalls = 0;
+    HRESULT hr;
+    do
+    {
+        hr = pttl->Expire(pttl, 100, &nExpired);
+        Assert::IsTrue(nExpired <= 100);
+        nTotal += nExpired;
+        ++nCalls;
+    } while (hr == S_FALSE);
+
+    Assert::AreEqual(S_OK, hr);
+    Assert::AreEqual(nKeys, nTotal);
+    Assert::AreEqual(0U, pttl->nEntries);
+    Assert::IsTrue(nCalls > (int)(nKeys / 100));
+
+    // Regular calls keep reclaiming without Expire
+    for (UINT i = 0; i < 100; ++i)
+    {
+        Assert::AreEqual(S_OK, pttl->Insert(pttl, (PCVOID)i, 0, (PCVOID)i, 0, 10));
+    }
+    clock.ullNow += 10;
+    for (UINT i = 0; i < 100; ++i)
+    {
+        pttl->Find(pttl, (PCVOID)(i + nKeys), 0, nullptr, nullptr, FALSE);
+    }
+    Assert::AreEqual(0U, pttl->nEntries);
+
+    Assert::IsTrue(SUCCEEDED(pttl->Destroy(pttl)));
+}
+
+}